@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -59,6 +60,68 @@ static uint32_t mp4_seek_callback (void *data, uint64_t pos)
     return vfs_fseek ((VFSFile *) data, pos, SEEK_SET);
 }
 
+/* mp4ff positions the file for every sample it reads and parses the sample
+ * tables four bytes at a time.  During playback, reads are served from a
+ * block read ahead from the file, so that both become one VFS read per
+ * READ_BLOCK bytes, and seeks within the block do not reach the VFS at all. */
+#define READ_BLOCK 65536
+
+typedef struct {
+    VFSFile * file;
+    int64_t pos;            /* where mp4ff thinks it is */
+    int64_t file_pos;       /* where the VFS really is */
+    int64_t block_pos;      /* file position of block[0] */
+    int block_len;
+    unsigned char block[READ_BLOCK];
+} BufferedFile;
+
+static uint32_t buffered_read_callback (void * data, void * buffer, uint32_t len)
+{
+    BufferedFile * bf = data;
+    uint32_t done = 0;
+
+    while (done < len)
+    {
+        int64_t offset = bf->pos - bf->block_pos;
+
+        if (offset >= 0 && offset < bf->block_len)
+        {
+            uint32_t copy = MIN (len - done, bf->block_len - offset);
+
+            memcpy ((unsigned char *) buffer + done, bf->block + offset, copy);
+            done += copy;
+            bf->pos += copy;
+            continue;
+        }
+
+        if (bf->file_pos != bf->pos)
+        {
+            if (vfs_fseek (bf->file, bf->pos, SEEK_SET))
+                break;
+
+            bf->file_pos = bf->pos;
+        }
+
+        bf->block_pos = bf->pos;
+        bf->block_len = MAX (vfs_fread (bf->block, 1, READ_BLOCK, bf->file), 0);
+        bf->file_pos += bf->block_len;
+
+        if (! bf->block_len)
+            break;
+    }
+
+    return done;
+}
+
+static uint32_t buffered_seek_callback (void * data, uint64_t pos)
+{
+    if (! data || pos > INT64_MAX)
+        return -1;
+
+    ((BufferedFile *) data)->pos = pos;
+    return 0;
+}
+
 static bool_t mp4_init (void)
 {
     mp4cfg.file_type = FILE_OTHER;
@@ -130,7 +193,7 @@ int aac_parse_frame (unsigned char * buf, int *srate, int *num)
     fl =
      ((buf[i + 3] & 0x03) << 11) | (buf[i + 4] << 3) | ((buf[i +
      5] >> 5) & 0x07);
-    *num = (buf[i + 6] & 0x02) + 1;
+    *num = (buf[i + 6] & 0x03) + 1;
 
     return fl;
 }
@@ -234,125 +297,186 @@ static bool_t mp4_is_our_fd (const char * filename, VFSFile * file)
     return parse_aac_stream (file);
 }
 
-/* Gets info (some approximated) from an AAC/ADTS file.  <length> is
- * milliseconds, <bitrate> is kilobits per second.  Any parameters that cannot
- * be read are set to -1. */
-static void calc_aac_info (VFSFile * handle, int * length, int * bitrate,
- int * samplerate, int * channels)
+/* Files up to this size have every frame header walked for an exact length;
+ * of larger ones, only a few runs of frames spread over the file are. */
+#define EXACT_WALK_SIZE (8 << 20)
+#define SAMPLE_POINTS 8
+#define SAMPLE_FRAMES 64
+
+/* Hops from one ADTS frame header to the next without decoding, reading only
+ * as far as needed, for up to <max> frames from the current position of
+ * <handle>; the first header is searched for.  Adds up the bytes and
+ * microseconds of the frames walked, stopping at the end of the stream or
+ * where the headers no longer follow each other.  Returns the number of
+ * frames walked. */
+static int walk_adts_frames (VFSFile * handle, int max, int64_t * bytes,
+ int64_t * usecs)
 {
-    NeAACDecHandle decoder;
-    NeAACDecFrameInfo frame;
-    bool_t initted = FALSE;
-    int size = vfs_fsize (handle);
     unsigned char buffer[BUFFER_SIZE];
-    int offset = 0, filled = 0;
-    int found, bytes_used = 0, time_used = 0;
+    int offset, filled, size, frames = 0, rate = 0;
+    int64_t samples = 0;
 
-    decoder = NULL;             /* avoid bogus uninitialized variable warning */
+    filled = vfs_fread (buffer, 1, sizeof buffer, handle);
 
-    *length = -1;
-    *bitrate = -1;
-    *samplerate = -1;
-    *channels = -1;
-
-    /* look for a representative bitrate in the middle of the file */
-    if (size > 0 && vfs_fseek (handle, size / 2, SEEK_SET))
-        goto DONE;
+    if ((offset = find_aac_header (buffer, filled, &size)) < 0)
+        return 0;
 
-    for (found = 0; found < 32; found++)
+    while (frames < max)
     {
-        if (filled < BUFFER_SIZE / 2)
+        int frame_rate, num;
+
+        if (filled - offset < 8)
         {
+            filled -= offset;
             memmove (buffer, buffer + offset, filled);
             offset = 0;
 
-            if (vfs_fread (buffer + filled, 1, BUFFER_SIZE - filled, handle)
-             != BUFFER_SIZE - filled)
-            {
-                PROBE_DEBUG ("Read failed.\n");
-                goto DONE;
-            }
+            filled += vfs_fread (buffer + filled, 1, sizeof buffer - filled, handle);
 
-            filled = BUFFER_SIZE;
+            if (filled < 8)
+                break;
         }
 
-        if (!initted)
+        size = aac_parse_frame (buffer + offset, &frame_rate, &num);
+
+        if (size < 8 || (frames && frame_rate != rate))
+            break;
+
+        rate = frame_rate;
+        samples += num * 1024;
+        *bytes += size;
+        frames++;
+
+        /* skip the rest of a frame not in the buffer without reading it */
+        if ((offset += size) > filled)
         {
-            int inner, a;
-            unsigned long r;
-            unsigned char ch;
+            if (vfs_fseek (handle, offset - filled, SEEK_CUR))
+                break;
 
-            inner = find_aac_header (buffer + offset, filled, &a);
+            offset = filled = 0;
+        }
+    }
 
-            if (inner < 0)
-            {
-                PROBE_DEBUG ("No ADTS header.\n");
-                goto DONE;
-            }
+    if (frames)
+        *usecs += samples * 1000000 / rate;
 
-            offset += inner;
-            filled -= inner;
+    return frames;
+}
 
-            decoder = NeAACDecOpen ();
-            inner = NeAACDecInit (decoder, buffer + offset, filled, &r, &ch);
+/* Returns the offset of the stream following an ID3v2 tag at the start of the
+ * file, or 0 if there is none. */
+static int64_t skip_id3v2 (VFSFile * handle)
+{
+    unsigned char h[10];
 
-            if (inner < 0)
-            {
-                PROBE_DEBUG ("Decoder init failed.\n");
-                NeAACDecClose (decoder);
-                goto DONE;
-            }
+    if (vfs_fread (h, 1, sizeof h, handle) != sizeof h || strncmp ((char *) h, "ID3", 3))
+        return 0;
 
-            offset += inner;
-            filled -= inner;
-            bytes_used += inner;
+    int64_t size = 10 + ((h[6] & 0x7f) << 21 | (h[7] & 0x7f) << 14 |
+     (h[8] & 0x7f) << 7 | (h[9] & 0x7f));
 
-            *samplerate = r;
-            *channels = ch;
-            initted = TRUE;
-        }
+    return (h[5] & 0x10) ? size + 10 : size;
+}
 
-        if (NeAACDecDecode (decoder, &frame, buffer + offset, filled) == NULL)
-        {
-            PROBE_DEBUG ("Decode failed.\n");
-            goto DONE;
-        }
+/* Reads the bitrate from an ADIF header, or returns -1 if there is none. */
+static int read_adif_bitrate (VFSFile * handle)
+{
+    unsigned char h[17];
+
+    if (vfs_fread (h, 1, sizeof h, handle) != sizeof h || strncmp ((char *) h, "ADIF", 4))
+        return -1;
 
-        if (frame.samplerate != *samplerate || frame.channels != *channels)
+    /* an optional 72-bit copyright id, two flags and the bitstream type come
+     * before the 23-bit bitrate */
+    int bit = (h[4] & 0x80) ? 4 * 8 + 1 + 72 + 3 : 4 * 8 + 1 + 3;
+    int bitrate = 0;
+
+    for (int i = 0; i < 23; i++, bit++)
+        bitrate = (bitrate << 1) | ((h[bit / 8] >> (7 - bit % 8)) & 1);
+
+    return bitrate ? bitrate : -1;
+}
+
+/* Gets the length and average bitrate of an AAC/ADTS file from its frame
+ * headers, without decoding.  <length> is milliseconds, <bitrate> is kilobits
+ * per second.  Either is set to -1 if it cannot be found out; both are
+ * extrapolated from samples of the stream for large files. */
+static void calc_aac_info (VFSFile * handle, int * length, int * bitrate)
+{
+    int64_t size = vfs_fsize (handle);
+    int64_t bytes = 0, usecs = 0;
+
+    *length = -1;
+    *bitrate = -1;
+
+    if (vfs_fseek (handle, 0, SEEK_SET))
+        return;
+
+    int64_t start = skip_id3v2 (handle);
+
+    if (vfs_fseek (handle, start, SEEK_SET))
+        return;
+
+    /* ADIF has no frame headers, but may state a constant bitrate */
+    int adif = read_adif_bitrate (handle);
+
+    if (adif > 0)
+    {
+        *bitrate = adif / 1000;
+
+        if (size > 0)
+            *length = (size - start) * 8 * (int64_t) 1000 / adif;
+
+        return;
+    }
+
+    if (vfs_fseek (handle, start, SEEK_SET))
+        return;
+
+    if (size > 0 && size <= EXACT_WALK_SIZE)
+    {
+        walk_adts_frames (handle, INT_MAX, &bytes, &usecs);
+
+        /* unless the walk lost sync, this is the exact length */
+        if (bytes >= (size - start) - (size - start) / 8)
+            *length = usecs / 1000;
+    }
+    else if (size > 0)
+    {
+        for (int i = 0; i < SAMPLE_POINTS; i++)
         {
-            PROBE_DEBUG ("Parameter mismatch.\n");
-            goto DONE;
-        }
+            if (vfs_fseek (handle, size * (2 * i + 1) / (2 * SAMPLE_POINTS), SEEK_SET))
+                break;
 
-        offset += frame.bytesconsumed;
-        filled -= frame.bytesconsumed;
-        bytes_used += frame.bytesconsumed;
-        time_used += frame.samples / frame.channels * (int64_t) 1000 /
-         frame.samplerate;
+            walk_adts_frames (handle, SAMPLE_FRAMES, &bytes, &usecs);
+        }
     }
+    else
+        walk_adts_frames (handle, SAMPLE_FRAMES, &bytes, &usecs);
 
-    /* bits per millisecond = kilobits per second */
-    *bitrate = bytes_used * 8 / time_used;
+    PROBE_DEBUG ("Walked %d bytes of frames, %d ms.\n", (int) bytes, (int) (usecs / 1000));
 
-    if (size > 0)
-        *length = size * (int64_t) time_used / bytes_used;
+    if (! bytes || ! usecs)
+        return;
 
-  DONE:
-    if (initted)
-        NeAACDecClose (decoder);
+    /* bits per millisecond = kilobits per second */
+    *bitrate = bytes * 8 * 1000 / usecs;
+
+    if (size > 0 && *length < 0)
+        *length = (size - start) * usecs / bytes / 1000;
 }
 
 static Tuple *aac_get_tuple (const char * filename, VFSFile * handle)
 {
     Tuple *tuple = tuple_new_from_filename (filename);
     char *temp;
-    int length, bitrate, samplerate, channels;
+    int length, bitrate;
 
     tuple_set_str (tuple, FIELD_CODEC, NULL, "MPEG-2/4 AAC");
 
     if (!vfs_is_remote (filename))
     {
-        calc_aac_info (handle, &length, &bitrate, &samplerate, &channels);
+        calc_aac_info (handle, &length, &bitrate);
 
         if (length > 0)
             tuple_set_int (tuple, FIELD_LENGTH, NULL, length);
@@ -632,7 +756,15 @@ static bool_t my_decode_mp4 (InputPlayback * playback, const char * filename,
 
         if (seek_value >= 0)
         {
-            sampleID = (int64_t) seek_value * samplerate / 1000 / framesize;
+            int64_t time = (int64_t) seek_value * mp4ff_time_scale (mp4file,
+             mp4track) / 1000;
+            int32_t sample = mp4ff_find_sample (mp4file, mp4track, time, NULL);
+
+            /* Without a usable time table, assume equal frames. */
+            if (sample < 0 && time < mp4ff_get_track_duration (mp4file, mp4track))
+                sample = (int64_t) seek_value * samplerate / 1000 / framesize;
+
+            sampleID = (sample < 0) ? numSamples : sample;
             playback->output->flush (seek_value);
             seek_value = -1;
         }
@@ -897,29 +1029,41 @@ static bool_t mp4_play (InputPlayback * playback, const char * filename,
     if (! file)
         return FALSE;
 
-    mp4ff_callback_t mp4cb;
-    mp4ff_t *mp4file;
-    bool_t ret;
+    if (parse_aac_stream (file))
+    {
+        vfs_rewind (file);
+        seek_value = (start_time > 0) ? start_time : -1;
+        stop_flag = FALSE;
 
-    ret = parse_aac_stream (file);
-    vfs_rewind (file);
+        return my_decode_aac (playback, filename, file, pause);
+    }
 
+    if (vfs_fseek (file, 0, SEEK_SET))
+        return FALSE;
+
+    BufferedFile * bf = malloc (sizeof (BufferedFile));
+    bf->file = file;
+    bf->pos = bf->file_pos = bf->block_pos = 0;
+    bf->block_len = 0;
+
+    mp4ff_callback_t mp4cb;
     memset (& mp4cb, 0, sizeof (mp4ff_callback_t));
-    mp4cb.read = mp4_read_callback;
-    mp4cb.seek = mp4_seek_callback;
-    mp4cb.user_data = file;
+    mp4cb.read = buffered_read_callback;
+    mp4cb.seek = buffered_seek_callback;
+    mp4cb.user_data = bf;
 
-    mp4file = mp4ff_open_read (& mp4cb);
+    mp4ff_t * mp4file = mp4ff_open_read (& mp4cb);
 
     seek_value = (start_time > 0) ? start_time : -1;
     stop_flag = FALSE;
 
-    if (ret == TRUE)
-    {
-        return my_decode_aac (playback, filename, file, pause);
-    }
+    bool_t ret = mp4file ? my_decode_mp4 (playback, filename, mp4file, pause) : FALSE;
+
+    if (mp4file)
+        mp4ff_close (mp4file);
 
-    return my_decode_mp4 (playback, filename, mp4file, pause);
+    free (bf);
+    return ret;
 }
 
 bool_t read_itunes_cover (const char * filename, VFSFile * file, void * *
@@ -86,6 +86,12 @@ void mp4ff_close(mp4ff_t *ff)
                 free(ff->track[i]->ctts_sample_count);
             if (ff->track[i]->ctts_sample_offset)
                 free(ff->track[i]->ctts_sample_offset);
+            if (ff->track[i]->chunk_first_sample)
+                free(ff->track[i]->chunk_first_sample);
+            if (ff->track[i]->stts_first_sample)
+                free(ff->track[i]->stts_first_sample);
+            if (ff->track[i]->stts_first_time)
+                free(ff->track[i]->stts_first_time);
 #ifdef ITUNES_DRM
             if (ff->track[i]->p_drms)
                 drms_free(ff->track[i]->p_drms);
@@ -343,6 +349,15 @@ int32_t mp4ff_get_sample_duration_use_offsets(const mp4ff_t *f, const int32_t tr
 int32_t mp4ff_get_sample_duration(const mp4ff_t *f, const int32_t track, const int32_t sample)
 {
     int32_t i, co = 0;
+    mp4ff_track_t * p_track = f->track[track];
+
+    mp4ff_build_index(p_track);
+
+    if (p_track->stts_first_sample)
+    {
+        i = mp4ff_find_stts_entry(p_track, sample);
+        return (i < 0) ? (int32_t)(-1) : p_track->stts_sample_delta[i];
+    }
 
     for (i = 0; i < f->track[track]->stts_entry_count; i++)
     {
@@ -358,6 +373,20 @@ int64_t mp4ff_get_sample_position(const mp4ff_t *f, const int32_t track, const i
 {
     int32_t i, co = 0;
     int64_t acc = 0;
+    mp4ff_track_t * p_track = f->track[track];
+
+    mp4ff_build_index(p_track);
+
+    if (p_track->stts_first_sample)
+    {
+        i = mp4ff_find_stts_entry(p_track, sample);
+
+        if (i < 0)
+            return (int64_t)(-1);
+
+        return p_track->stts_first_time[i] +
+               (int64_t)p_track->stts_sample_delta[i] * (sample - p_track->stts_first_sample[i]);
+    }
 
     for (i = 0; i < f->track[track]->stts_entry_count; i++)
     {
@@ -396,6 +425,36 @@ int32_t mp4ff_find_sample(const mp4ff_t *f, const int32_t track, const int64_t o
     int64_t offset_total = 0;
     mp4ff_track_t * p_track = f->track[track];
 
+    mp4ff_build_index(p_track);
+
+    if (p_track->stts_first_time)
+    {
+        int32_t lo = 0, hi = p_track->stts_entry_count;
+
+        if (offset < 0 || offset >= p_track->stts_first_time[hi])
+            return (int32_t)(-1);
+
+        while (hi - lo > 1)
+        {
+            int32_t mid = (lo + hi) / 2;
+
+            if (p_track->stts_first_time[mid] <= offset)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        /* An entry spanning no time is never the last one starting at or
+         * before offset, so a zero delta here means a broken table. */
+        if (p_track->stts_sample_delta[lo] > 0)
+        {
+            int64_t offset_fromstts = offset - p_track->stts_first_time[lo];
+            int32_t sample_delta = p_track->stts_sample_delta[lo];
+            if (toskip) *toskip = (int32_t)(offset_fromstts % sample_delta);
+            return p_track->stts_first_sample[lo] + (int32_t)(offset_fromstts / sample_delta);
+        }
+    }
+
     for (i = 0; i < p_track->stts_entry_count; i++)
     {
         int32_t sample_count = p_track->stts_sample_count[i];
@@ -187,6 +187,17 @@ typedef struct
     int32_t *ctts_sample_count;
     int32_t *ctts_sample_offset;
 
+    /* lookup tables built from the above on first use, see mp4sample.c */
+    int32_t index_built;
+    int32_t *chunk_first_sample;    /* stco_entry_count entries */
+    int32_t *stts_first_sample;     /* stts_entry_count + 1 entries */
+    int64_t *stts_first_time;       /* stts_entry_count + 1 entries */
+
+    /* position of the sample after the last one read, for sequential reads */
+    int32_t next_sample;
+    int32_t next_chunk;
+    int32_t next_offset;
+
     /* esde */
     uint8_t *decoderConfig;
     int32_t decoderConfigLen;
@@ -251,6 +262,8 @@ int32_t mp4ff_atom_read(mp4ff_t *f, const int32_t size, const uint8_t atom_type)
 /* mp4sample.c */
 int32_t mp4ff_audio_frame_size(const mp4ff_t *f, const int32_t track, const int32_t sample);
 int32_t mp4ff_set_sample_position(mp4ff_t *f, const int32_t track, const int32_t sample);
+int32_t mp4ff_build_index(mp4ff_track_t *p_track);
+int32_t mp4ff_find_stts_entry(const mp4ff_track_t *p_track, const int32_t sample);
 
 #ifdef USE_TAGGING
 /* mp4meta.c */
@@ -117,9 +117,141 @@ static int32_t mp4ff_sample_range_size(const mp4ff_t *f, const int32_t track,
     return total;
 }
 
+/* mp4ff_chunk_of_sample and mp4ff_find_sample would otherwise walk the
+ * run-length stsc and stts tables from the start for every sample.  The first
+ * sample of each chunk, and the first sample and time of each stts entry, are
+ * accumulated once per track so that both lookups become binary searches. */
+int32_t mp4ff_build_index(mp4ff_track_t *p_track)
+{
+    int32_t i, entry = 0, total = 0;
+    int64_t time = 0;
+
+    if (p_track->index_built)
+        return 0;
+
+    p_track->index_built = 1;
+
+    if (p_track->stco_entry_count > 0 && p_track->stsc_entry_count > 0)
+    {
+        p_track->chunk_first_sample = (int32_t*)malloc(p_track->stco_entry_count * sizeof(int32_t));
+
+        if (p_track->chunk_first_sample)
+        {
+            for (i = 0; i < p_track->stco_entry_count; i++)
+            {
+                while (entry + 1 < p_track->stsc_entry_count &&
+                       p_track->stsc_first_chunk[entry + 1] <= i + 1)
+                    entry++;
+
+                p_track->chunk_first_sample[i] = total;
+
+                if (p_track->stsc_first_chunk[entry] <= i + 1)
+                    total += p_track->stsc_samples_per_chunk[entry];
+            }
+        }
+    }
+
+    if (p_track->stts_entry_count > 0)
+    {
+        p_track->stts_first_sample = (int32_t*)malloc((p_track->stts_entry_count + 1) * sizeof(int32_t));
+        p_track->stts_first_time = (int64_t*)malloc((p_track->stts_entry_count + 1) * sizeof(int64_t));
+
+        if (p_track->stts_first_sample && p_track->stts_first_time)
+        {
+            for (i = 0, total = 0; i < p_track->stts_entry_count; i++)
+            {
+                p_track->stts_first_sample[i] = total;
+                p_track->stts_first_time[i] = time;
+                total += p_track->stts_sample_count[i];
+                time += (int64_t)p_track->stts_sample_delta[i] * p_track->stts_sample_count[i];
+            }
+
+            p_track->stts_first_sample[i] = total;
+            p_track->stts_first_time[i] = time;
+        }
+        else
+        {
+            if (p_track->stts_first_sample) {free(p_track->stts_first_sample);p_track->stts_first_sample=0;}
+            if (p_track->stts_first_time) {free(p_track->stts_first_time);p_track->stts_first_time=0;}
+        }
+    }
+
+    return 0;
+}
+
+/* Returns the stts entry covering sample, or -1 if there is none. */
+int32_t mp4ff_find_stts_entry(const mp4ff_track_t *p_track, const int32_t sample)
+{
+    int32_t lo = 0, hi = p_track->stts_entry_count;
+
+    if (sample < 0 || sample >= p_track->stts_first_sample[hi])
+        return -1;
+
+    while (hi - lo > 1)
+    {
+        int32_t mid = (lo + hi) / 2;
+
+        if (p_track->stts_first_sample[mid] <= sample)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Returns the (1-based) chunk holding sample; with no empty chunk in the
+ * way, the last one starting at or before it. */
+static int32_t mp4ff_find_chunk(const mp4ff_track_t *p_track, const int32_t sample)
+{
+    int32_t lo = 0, hi = p_track->stco_entry_count;
+
+    while (hi - lo > 1)
+    {
+        int32_t mid = (lo + hi) / 2;
+
+        if (p_track->chunk_first_sample[mid] <= sample)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return lo + 1;
+}
+
 static int32_t mp4ff_sample_to_offset(const mp4ff_t *f, const int32_t track, const int32_t sample)
 {
     int32_t chunk=0, chunk_sample=0, chunk_offset1, chunk_offset2;
+    mp4ff_track_t * p_track = f->track[track];
+
+    mp4ff_build_index(p_track);
+
+    if (p_track->chunk_first_sample)
+    {
+        chunk = mp4ff_find_chunk(p_track, sample);
+
+        /* Samples within a chunk follow each other, so reading them in order
+         * only needs the size of the previous one. */
+        if (sample == p_track->next_sample && chunk == p_track->next_chunk)
+            chunk_offset2 = p_track->next_offset;
+        else
+        {
+            chunk_sample = p_track->chunk_first_sample[chunk - 1];
+            chunk_offset1 = mp4ff_chunk_to_offset(f, track, chunk);
+            chunk_offset2 = chunk_offset1 + mp4ff_sample_range_size(f, track, chunk_sample, sample);
+        }
+
+        if (sample >= 0 && (p_track->stsz_sample_size || sample < p_track->stsz_sample_count))
+        {
+            p_track->next_sample = sample + 1;
+            p_track->next_chunk = chunk;
+            p_track->next_offset = chunk_offset2 + mp4ff_audio_frame_size(f, track, sample);
+        }
+        else
+            p_track->next_chunk = 0;
+
+        return chunk_offset2;
+    }
 
     mp4ff_chunk_of_sample(f, track, sample, &chunk_sample, &chunk);
 
@@ -23,10 +23,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <glib.h>
+#include <glib/gstdio.h>
 
 #include "adplug.h"
+#include "database.h"
 #include "emuopl.h"
 #include "silentopl.h"
+#include "shadowopl.h"
 #include "players.h"
 
 extern "C" {
@@ -35,6 +42,8 @@ extern "C" {
 #include <libaudcore/audstrings.h>
 
 #include "adplug-xmms.h"
+#include "../decodeahead/decodeahead.h"
+#include "../ratepref/ratepref.h"
 }
 
 /***** Defines *****/
@@ -45,6 +54,10 @@ extern "C" {
 // Sound buffer size in samples
 #define SNDBUFSIZE	512
 
+// Song time between replay state snapshots (ms), and how many to keep
+#define CHECKPOINT_MS		5000
+#define MAX_CHECKPOINTS		1024
+
 // AdPlug's 8 and 16 bit audio formats
 #define FORMAT_8	FMT_U8
 #define FORMAT_16	FMT_S16_NE
@@ -55,11 +68,16 @@ extern "C" {
 // Default AdPlug user's configuration subdirectory
 #define ADPLUG_CONFDIR		".adplug"
 
+// File name of the song length cache, in the user's cache directory
+#define LENGTHDB_FILE		"lengths.db"
+
 /***** Global variables *****/
 
 static bool_t audio_error = FALSE;
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;   // guards plr.db
 static bool_t stop_flag;
+static DecodeAhead decodeahead = DECODEAHEAD_INIT;
 
 // Configuration (and defaults)
 static struct
@@ -71,18 +89,25 @@ static struct
 {
 44100l, true, false, false, CAdPlug::getPlayers()};
 
-// Player variables
+// Player variables; the player itself belongs to whoever renders with it
 static struct
 {
-  CPlayer *p;
   CAdPlugDatabase *db;
   unsigned int subsong, songlength;
-  int seek;
   char * filename;
-} plr = {0, 0, 0, 0, -1, NULL};
+} plr = {0, 0, 0, NULL};
 
 static InputPlayback *playback;
 
+// Song lengths computed so far, in AdPlug database format
+static struct
+{
+  CAdPlugDatabase *db;
+  char *path;
+  bool dirty;
+  pthread_mutex_t mutex;
+} lengths = {0, NULL, false, PTHREAD_MUTEX_INITIALIZER};
+
 /***** Debugging *****/
 
 #ifdef DEBUG
@@ -108,9 +133,40 @@ dbg_printf (const char *fmt, ...)
 
 #endif
 
+static void
+database_load (void)
+/* Loads the user's database when the first player is made, not at startup. */
+{
+  pthread_mutex_lock (& db_mutex);
+
+  if (!plr.db)
+  {
+    plr.db = new CAdPlugDatabase;
+
+    const char *homedir = getenv ("HOME");
+
+    if (homedir)
+    {
+      std::string userdb;
+      userdb = std::string ("file://") + homedir + "/" ADPLUG_CONFDIR "/" + ADPLUGDB_FILE;
+
+      if (vfs_file_test (userdb.c_str (), VFS_EXISTS))
+      {
+        plr.db->load (userdb);    // load user's database
+        dbg_printf ("database: userdb=\"%s\"\n", userdb.c_str());
+      }
+    }
+
+    CAdPlug::set_database (plr.db);
+  }
+
+  pthread_mutex_unlock (& db_mutex);
+}
+
 static CPlayer *
 factory (VFSFile * fd, Copl * newopl)
 {
+  database_load ();
   return CAdPlug::factory (fd, newopl, conf.players);
 }
 
@@ -119,8 +175,184 @@ void adplug_stop(InputPlayback * data);
 bool_t adplug_play(InputPlayback * data, const char * filename, VFSFile * file, int start_time, int stop_time, bool_t pause);
 }
 
+/***** Song length cache *****/
+
+static char *
+lengthdb_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "audacious", "adplug",
+                           LENGTHDB_FILE, NULL);
+}
+
+static void
+lengthdb_load (void)
+{
+  lengths.db = new CAdPlugDatabase;
+  lengths.path = lengthdb_path ();
+  lengths.dirty = false;
+
+  char *uri = filename_to_uri (lengths.path);
+
+  if (uri && vfs_file_test (uri, VFS_EXISTS))
+    lengths.db->load (uri);
+
+  g_free (uri);
+}
+
+static void
+lengthdb_save (void)
+{
+  if (!lengths.dirty)
+    return;
+
+  // written under a temporary name, so that a reader never loads half of it
+  char *dir = g_path_get_dirname (lengths.path);
+  char *temp = g_strconcat (lengths.path, ".tmp", NULL);
+  char *uri = filename_to_uri (temp);
+  bool ok = false;
+
+  if (uri && g_mkdir_with_parents (dir, 0700) == 0)
+  {
+    vfsostream f (uri);
+    ok = !f.error () && lengths.db->save (f) && !f.error ();
+  }
+
+  if (ok && g_rename (temp, lengths.path) == 0)
+    lengths.dirty = false;
+  else
+    g_unlink (temp);
+
+  g_free (uri);
+  g_free (temp);
+  g_free (dir);
+}
+
+static void
+lengthdb_free (void)
+{
+  delete lengths.db;
+  lengths.db = 0;
+  g_free (lengths.path);
+  lengths.path = NULL;
+}
+
+// Looks up the length of a subsong by the CRC key of the whole file, running
+// the song through the silent OPL only if it is not cached yet.
+static unsigned long
+cached_songlength (CPlayer * p, VFSFile * fd, unsigned int subsong)
+{
+  if (vfs_fseek (fd, 0, SEEK_SET))
+    return p->songlength (subsong);
+
+  vfsistream in (fd);
+  CAdPlugDatabase::CKey key (in);
+  CLengthRecord *rec;
+
+  pthread_mutex_lock (& lengths.mutex);
+
+  if (!lengths.db)
+    lengthdb_load ();
+
+  rec = (CLengthRecord *) lengths.db->search (key);
+
+  if (rec && rec->type == CAdPlugDatabase::CRecord::SongLength &&
+      subsong < rec->lengths.size () && rec->lengths[subsong] != CLengthRecord::unknown)
+  {
+    unsigned long length = rec->lengths[subsong];
+    pthread_mutex_unlock (& lengths.mutex);
+    return length;
+  }
+
+  pthread_mutex_unlock (& lengths.mutex);
+
+  unsigned long length = p->songlength (subsong);
+
+  pthread_mutex_lock (& lengths.mutex);
+  rec = (CLengthRecord *) lengths.db->search (key);
+
+  if (!rec)
+  {
+    rec = new CLengthRecord;
+    rec->key = key;
+    rec->filetype = p->gettype ();
+
+    if (!lengths.db->insert (rec))
+    {
+      // the database is full
+      delete rec;
+      rec = 0;
+    }
+  }
+
+  if (rec && rec->type == CAdPlugDatabase::CRecord::SongLength)
+  {
+    unsigned int count = MAX (subsong + 1, p->getsubsongs ());
+
+    if (rec->lengths.size () < count)
+      rec->lengths.resize (count, CLengthRecord::unknown);
+
+    rec->lengths[subsong] = length;
+    lengths.dirty = true;
+  }
+
+  pthread_mutex_unlock (& lengths.mutex);
+  return length;
+}
+
+/***** Seeking *****/
+
+// Replay state at some point of the song, for seeking
+struct checkpoint
+{
+  double time;
+  CPlayer::State *state;
+  CShadowopl::Regs regs;
+};
+
+typedef std::vector<checkpoint> checkpoints;
+
+static void
+checkpoint_save (checkpoints & cps, CPlayer * p, CShadowopl & shadow, double time)
+/* Takes a snapshot once the song is CHECKPOINT_MS past the last one. */
+{
+  if (cps.size () >= MAX_CHECKPOINTS || time < cps.size () * CHECKPOINT_MS)
+    return;
+
+  checkpoint cp;
+  if (!(cp.state = p->savestate ()))
+    return;
+
+  cp.time = time;
+  shadow.save (cp.regs);
+  cps.push_back (cp);
+}
+
+static checkpoint *
+checkpoint_find (checkpoints & cps, int time)
+/* Returns the latest snapshot not past the given time, if any. */
+{
+  for (checkpoints::size_type i = cps.size (); i > 0; i--)
+    if (cps[i - 1].time <= time)
+      return &cps[i - 1];
+
+  return NULL;
+}
+
+static void
+checkpoint_free (checkpoints & cps)
+{
+  for (checkpoints::size_type i = 0; i < cps.size (); i++)
+    delete cps[i].state;
+
+  cps.clear ();
+}
+
 /***** Main player (!! threaded !!) *****/
 
+// Like adplug_is_our_fd(), this touches nothing of the player's state: the
+// database it searches is only ever added to under db_mutex, before any
+// player is made, and the length cache has a lock of its own.  Any number of
+// files can be probed at once, while playing or not.
 extern "C" Tuple * adplug_get_tuple (const char * filename, VFSFile * fd)
 {
   Tuple * ti = NULL;
@@ -145,35 +377,139 @@ extern "C" Tuple * adplug_get_tuple (const char * filename, VFSFile * fd)
 
     tuple_set_str(ti, FIELD_CODEC, NULL, p->gettype().c_str());
     tuple_set_str(ti, FIELD_QUALITY, NULL, _("sequenced"));
-    tuple_set_int(ti, FIELD_LENGTH, NULL, p->songlength (plr.subsong));
+    tuple_set_int(ti, FIELD_LENGTH, NULL, cached_songlength (p, fd, 0));
     delete p;
   }
 
   return ti;
 }
 
-// Define sampsize macro (only usable inside play_loop()!)
+// Emulator state shared by play_loop() and render()
+struct render_state
+{
+  CPlayer *p;
+  unsigned int subsong;
+  CEmuopl *opl;
+  CShadowopl *shadow;
+  checkpoints cps;
+  char *sndbuf;
+  unsigned long freq;
+  bool bit16, stereo;
+};
+
+// Define sampsize macro (only usable inside play_loop() and render()!)
 #define sampsize ((bit16 ? 2 : 1) * (stereo ? 2 : 1))
 
+static bool_t render (DecodeAhead * d, void * user)
+/* Runs on the decode-ahead thread, or on the playback thread without one. */
+{
+  render_state & rs = * (render_state *) user;
+  double pos = 0;               // song time of the next tick (ms)
+  long toadd = 0, i, towrite;
+  char *sndbufpos;
+  bool playing = true,          // Song self-end indicator.
+    bit16 = rs.bit16, stereo = rs.stereo;
+  unsigned long freq = rs.freq;
+
+  // main playback loop
+  while (1)
+  {
+    pthread_mutex_lock (& mutex);
+
+    if (stop_flag)
+    {
+        pthread_mutex_unlock (& mutex);
+        break;
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    // let the output catch up, unless a seek comes in meanwhile
+    if (!playing && !conf.endless && !decodeahead_finish (d))
+      break;
+
+    // seek requested ?
+    int seek = decodeahead_get_seek (d);
+
+    if (seek != -1)
+    {
+      checkpoint *cp = checkpoint_find (rs.cps, seek);
+
+      // Nobody hears the skipped ticks, so only the registers are tracked
+      rs.shadow->detach ();
+
+      // jump to the nearest snapshot, or rewind on a backward seek
+      if (cp && (cp->time > pos || seek < pos))
+      {
+        rs.p->loadstate (cp->state);
+        rs.shadow->load (cp->regs);
+        pos = cp->time;
+      }
+      else if (seek < pos)
+      {
+        rs.p->rewind (rs.subsong);
+        pos = 0;
+      }
+
+      // seek to requested position
+      playing = true;
+      while (pos < seek && (playing = rs.p->update ()))
+      {
+        pos += 1000 / rs.p->getrefresh ();
+        checkpoint_save (rs.cps, rs.p, *rs.shadow, pos);
+      }
+
+      rs.shadow->attach ();
+
+      // Reset output plugin and some values
+      decodeahead_seek_done (d);
+    }
+    else if (!playing && !conf.endless)
+      continue;
+
+    // fill sound buffer
+    towrite = SNDBUFSIZE;
+    sndbufpos = rs.sndbuf;
+    while (towrite > 0)
+    {
+      while (toadd < 0)
+      {
+        toadd += freq;
+        playing = rs.p->update ();
+        pos += 1000 / rs.p->getrefresh ();
+        checkpoint_save (rs.cps, rs.p, *rs.shadow, pos);
+      }
+      i = MIN (towrite, (long) (toadd / rs.p->getrefresh () + 4) & ~3);
+      rs.opl->update ((short *) sndbufpos, i);
+      sndbufpos += i * sampsize;
+      towrite -= i;
+      toadd -= (long) (rs.p->getrefresh () * i);
+    }
+
+    if (!decodeahead_write (d, rs.sndbuf, SNDBUFSIZE * sampsize))
+      break;
+  }
+
+  return TRUE;
+}
+
 static bool_t play_loop (InputPlayback * playback, const char * filename,
- VFSFile * fd)
+ VFSFile * fd, unsigned long freq)
 /* Main playback thread. Takes the filename to play as argument. */
 {
   dbg_printf ("play_loop(\"%s\"): ", filename);
-  CEmuopl opl (conf.freq, conf.bit16, conf.stereo);
-  long toadd = 0, i, towrite;
-  char *sndbuf, *sndbufpos;
-  bool playing = true,          // Song self-end indicator.
-    bit16 = conf.bit16,          // Duplicate config, so it doesn't affect us if
+  CEmuopl opl (freq, conf.bit16, conf.stereo);
+  CShadowopl shadow (&opl);
+  render_state rs;
+  bool bit16 = conf.bit16,      // Duplicate config, so it doesn't affect us if
     stereo = conf.stereo;        // the user changes it while we're playing.
-  unsigned long freq = conf.freq;
 
   if (!fd)
     return FALSE;
 
   // Try to load module
   dbg_printf ("factory, ");
-  if (!(plr.p = factory (fd, &opl)))
+  if (!(rs.p = factory (fd, &shadow)))
   {
     dbg_printf ("error!\n");
     // MessageBox("AdPlug :: Error", "File could not be opened!", "Ok");
@@ -189,9 +525,16 @@ static bool_t play_loop (InputPlayback * playback, const char * filename,
     plr.subsong = 0;
   }
 
+  rs.subsong = plr.subsong;
+
   // Allocate audio buffer
   dbg_printf ("buffer, ");
-  sndbuf = (char *) malloc (SNDBUFSIZE * sampsize);
+  rs.opl = &opl;
+  rs.shadow = &shadow;
+  rs.sndbuf = (char *) malloc (SNDBUFSIZE * sampsize);
+  rs.freq = freq;
+  rs.bit16 = bit16;
+  rs.stereo = stereo;
 
   // Set XMMS main window information
   dbg_printf ("xmms, ");
@@ -199,84 +542,162 @@ static bool_t play_loop (InputPlayback * playback, const char * filename,
 
   // Rewind player to right subsong
   dbg_printf ("rewind, ");
-  plr.p->rewind (plr.subsong);
+  rs.p->rewind (rs.subsong);
 
   pthread_mutex_lock (& mutex);
-  plr.seek = -1;
   stop_flag = FALSE;
   playback->set_pb_ready (playback);
   pthread_mutex_unlock (& mutex);
 
-  // main playback loop
   dbg_printf ("loop.\n");
-  while ((playing || conf.endless))
-  {
-    pthread_mutex_lock (& mutex);
+  decodeahead_play (& decodeahead, playback, freq, sampsize, render, & rs);
 
-    if (stop_flag)
-    {
-        pthread_mutex_unlock (& mutex);
-        break;
-    }
+  pthread_mutex_lock (& mutex);
+  stop_flag = FALSE;
+  pthread_mutex_unlock (& mutex);
 
-    // seek requested ?
-    if (plr.seek != -1)
-    {
-      int time = playback->output->written_time ();
+  // free everything and exit
+  dbg_printf ("free");
+  checkpoint_free (rs.cps);
+  delete rs.p;
+  free (rs.sndbuf);
+  dbg_printf (".\n");
+  return TRUE;
+}
 
-      // backward seek ?
-      if (plr.seek < time)
-      {
-        plr.p->rewind (plr.subsong);
-        time = 0;
-      }
+// sampsize macro not useful anymore.
+#undef sampsize
 
-      // seek to requested position
-      while (time < plr.seek && plr.p->update ())
-        time += (int) (1000 / plr.p->getrefresh ());
+/***** Batch rendering (export) *****/
 
-      // Reset output plugin and some values
-      playback->output->flush (time);
-      plr.seek = -1;
-    }
+// Jobs shared by the workers of one adplug_render_batch() call
+struct batch_state
+{
+  AdplugBatchJob *jobs;
+  int count, next, rate, channels;
+  pthread_mutex_t mutex;
+};
+
+static bool_t
+batch_render_job (AdplugBatchJob * job, int rate, int channels)
+/* Renders one job with a player and emulator of its own. */
+{
+  VFSFile *fd = vfs_fopen (job->filename, "r");
+  if (!fd)
+    return FALSE;
 
-    pthread_mutex_unlock (& mutex);
+  CEmuopl opl (rate, true, channels == 2);
+  CPlayer *p = factory (fd, &opl);
+  vfs_fclose (fd);
 
-    // fill sound buffer
-    towrite = SNDBUFSIZE;
-    sndbufpos = sndbuf;
-    while (towrite > 0)
+  if (!p)
+    return FALSE;
+
+  if (job->subsong < 0 || (unsigned) job->subsong >= p->getsubsongs ())
+  {
+    delete p;
+    return FALSE;
+  }
+
+  p->rewind (job->subsong);
+
+  int64_t limit = job->max_ms > 0 ? (int64_t) rate * job->max_ms / 1000 : -1;
+  short buf[SNDBUFSIZE * 2];
+  long toadd = 0;
+  bool playing = true;
+  bool_t ok = TRUE;
+
+  // same tick arithmetic as render(), so the audio comes out identical
+  while (playing && (limit < 0 || job->frames < limit))
+  {
+    long towrite = SNDBUFSIZE, left, i;
+    short *pos = buf;
+
+    if (limit >= 0)
+      towrite = MIN (towrite, (long) (limit - job->frames));
+
+    for (left = towrite; left > 0; left -= i)
     {
       while (toadd < 0)
       {
-        toadd += freq;
-        playing = plr.p->update ();
+        toadd += rate;
+        playing = p->update ();
       }
-      i = MIN (towrite, (long) (toadd / plr.p->getrefresh () + 4) & ~3);
-      opl.update ((short *) sndbufpos, i);
-      sndbufpos += i * sampsize;
-      towrite -= i;
-      toadd -= (long) (plr.p->getrefresh () * i);
+      i = MIN (left, (long) (toadd / p->getrefresh () + 4) & ~3);
+      opl.update (pos, i);
+      pos += i * channels;
+      toadd -= (long) (p->getrefresh () * i);
     }
 
-    playback->output->write_audio (sndbuf, SNDBUFSIZE * sampsize);
+    if (!job->write (buf, towrite * 2 * channels, job->user))
+    {
+      ok = FALSE;
+      break;
+    }
+
+    job->frames += towrite;
   }
 
-  pthread_mutex_lock (& mutex);
-  stop_flag = FALSE;
-  pthread_mutex_unlock (& mutex);
+  delete p;
+  return ok;
+}
 
-  // free everything and exit
-  dbg_printf ("free");
-  delete plr.p;
-  plr.p = 0;
-  free (sndbuf);
-  dbg_printf (".\n");
-  return TRUE;
+static void *
+batch_worker (void * data)
+{
+  batch_state & bs = * (batch_state *) data;
+
+  while (1)
+  {
+    pthread_mutex_lock (& bs.mutex);
+    int j = bs.next ++;
+    pthread_mutex_unlock (& bs.mutex);
+
+    if (j >= bs.count)
+      break;
+
+    bs.jobs[j].frames = 0;
+    bs.jobs[j].ok = batch_render_job (& bs.jobs[j], bs.rate, bs.channels);
+  }
+
+  return NULL;
 }
 
-// sampsize macro not useful anymore.
-#undef sampsize
+extern "C" int
+adplug_render_batch (AdplugBatchJob * jobs, int count, int threads, int rate,
+ int channels)
+{
+  batch_state bs = {jobs, count, 0, rate, channels, PTHREAD_MUTEX_INITIALIZER};
+
+  if (count <= 0 || rate <= 0 || (channels != 1 && channels != 2))
+    return 0;
+
+  if (threads <= 0)
+    threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+
+  threads = MIN (threads, count);
+
+  std::vector<pthread_t> workers (threads);
+  int started = 0;
+
+  for (int t = 0; t < threads; t++)
+    if (!pthread_create (&workers[started], NULL, batch_worker, &bs))
+      started++;
+
+  // without any thread, render on this one
+  if (!started)
+    batch_worker (&bs);
+
+  for (int t = 0; t < started; t++)
+    pthread_join (workers[t], NULL);
+
+  int done = 0;
+  for (int j = 0; j < count; j++)
+    if (jobs[j].ok)
+      done++;
+
+  return done;
+}
 
 /***** Informational *****/
 
@@ -309,17 +730,20 @@ adplug_play (InputPlayback * data, const char * filename, VFSFile * file, int st
   dbg_printf ("adplug_play(\"%s\"): ", filename);
   audio_error = FALSE;
 
+  // the OPL emulator renders at any rate, so use the output's if known
+  int freq = ratepref_get (conf.freq);
+
   // open output plugin
   dbg_printf ("open, ");
   if (!playback->output->
-      open_audio (conf.bit16 ? FORMAT_16 : FORMAT_8, conf.freq,
+      open_audio (conf.bit16 ? FORMAT_16 : FORMAT_8, freq,
                   conf.stereo ? 2 : 1))
   {
     audio_error = TRUE;
     return TRUE;
   }
 
-  play_loop (playback, filename, file);
+  play_loop (playback, filename, file, freq);
   return FALSE;
 }
 
@@ -330,7 +754,7 @@ extern "C" void adplug_stop (InputPlayback * p)
     if (! stop_flag)
     {
         stop_flag = TRUE;
-        p->output->abort_write ();
+        decodeahead_stop (& decodeahead);
     }
 
     pthread_mutex_unlock (& mutex);
@@ -351,10 +775,7 @@ extern "C" void adplug_mseek (InputPlayback * p, int time)
     pthread_mutex_lock (& mutex);
 
     if (! stop_flag)
-    {
-        plr.seek = time;
-        p->output->abort_write();
-    }
+        decodeahead_seek (& decodeahead, time);
 
     pthread_mutex_unlock (& mutex);
 }
@@ -398,26 +819,7 @@ extern "C" bool_t adplug_init (void)
     free (cfgstr);
   }
 
-  // Load database from disk and hand it to AdPlug
-  dbg_printf ("database");
-  plr.db = new CAdPlugDatabase;
-
-  {
-    const char *homedir = getenv ("HOME");
-
-    if (homedir)
-    {
-      std::string userdb;
-      userdb = std::string ("file://") + homedir + "/" ADPLUG_CONFDIR "/" + ADPLUGDB_FILE;
-
-      if (vfs_file_test (userdb.c_str (), VFS_EXISTS))
-      {
-        plr.db->load (userdb);    // load user's database
-        dbg_printf (" (userdb=\"%s\")", userdb.c_str());
-      }
-    }
-  }
-  CAdPlug::set_database (plr.db);
+  // The database and the song length cache are loaded on first use
   dbg_printf (".\n");
 
   return TRUE;
@@ -428,8 +830,13 @@ adplug_quit (void)
 {
   // Close database
   dbg_printf ("db, ");
-  if (plr.db)
-    delete plr.db;
+  CAdPlug::set_database (0);
+  delete plr.db;
+  plr.db = 0;
+
+  dbg_printf ("lengths, ");
+  lengthdb_save ();
+  lengthdb_free ();
 
   free (plr.filename);
   plr.filename = NULL;
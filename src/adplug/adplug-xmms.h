@@ -20,6 +20,8 @@
 #ifndef ADPLUG_XMMS_H
 #define ADPLUG_XMMS_H
 
+#include <stdint.h>
+
 #include <audacious/plugin.h>
 
 bool_t adplug_init (void);
@@ -35,4 +37,31 @@ void adplug_info_box (const char * filename);
 Tuple * adplug_get_tuple (const char * filename, VFSFile * file);
 bool_t adplug_is_our_fd (const char * filename, VFSFile * file);
 
+/* Offline rendering, for exporting many songs at once.  Each job renders one
+ * subsong (counting from 0) of one file with a player and OPL emulator of its
+ * own, from the start until the song ends or max_ms have been rendered (0 for
+ * no limit; songs that loop forever need one).  The audio is 16-bit native
+ * endian at the given rate and channels (1 or 2), passed to write() in blocks;
+ * write() returns FALSE to abandon the job.  write() is called on a worker
+ * thread, concurrently for different jobs. */
+
+typedef bool_t (* AdplugBatchWrite) (const void * data, int bytes, void * user);
+
+typedef struct {
+    const char * filename;
+    int subsong;
+    int max_ms;
+    AdplugBatchWrite write;
+    void * user;
+
+    /* set by adplug_render_batch() */
+    bool_t ok;
+    int64_t frames;
+} AdplugBatchJob;
+
+/* Renders the jobs on up to <threads> threads (0 for one per processor) and
+ * returns how many succeeded.  Can be called while a song is playing. */
+int adplug_render_batch (AdplugBatchJob * jobs, int count, int threads,
+ int rate, int channels);
+
 #endif
@@ -135,19 +135,113 @@ CAdPlug::init_players (const CPlayerDesc pd[])
   return initplayers;
 }
 
+/***** Signature checks *****/
+
+// These only reject files a player's load() would certainly refuse as well;
+// they spare the players sharing an extension from opening and parsing files
+// meant for one of the others.
+
+static bool
+has_magic (const unsigned char *head, unsigned long size,
+           unsigned long offset, const char *magic, unsigned long len)
+{
+  return size >= offset + len && !memcmp (head + offset, magic, len);
+}
+
+static bool
+sniff_sng (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "ObsM", 4);
+}
+
+static bool
+sniff_a2m (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "_A2module_", 10);
+}
+
+static bool
+sniff_bam (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "CBMF", 4);
+}
+
+static bool
+sniff_dfm (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "DFM\x1a", 4);
+}
+
+static bool
+sniff_s3m (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 44, "SCRM", 4);
+}
+
+static bool
+sniff_dtm (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "DeFy DTM ", 9);
+}
+
+static bool
+sniff_fmc (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "FMC!", 4);
+}
+
+static bool
+sniff_mtk (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "mpu401tr\x92kk\xeer@data", 18);
+}
+
+static bool
+sniff_rad (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "RAD by REALiTY!!", 16);
+}
+
+static bool
+sniff_sa2 (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "SAdT", 4);
+}
+
+// XAD files all start with 'XAD!'; the player is picked by the 16-bit
+// format number following the title and author (see CxadPlayer)
+template < unsigned char fmt > static bool
+sniff_xad (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "XAD!", 4) && size >= 78 &&
+    head[76] == fmt && head[77] == 0;
+}
+
+static bool
+sniff_dro (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "DBRAWOPL\0\0\1\0", 12);
+}
+
+static bool
+sniff_dro2 (const unsigned char *head, unsigned long size)
+{
+  return has_magic (head, size, 0, "DBRAWOPL\2\0\0\0", 12);
+}
+
 const CPlayers& CAdPlug::getPlayers() {
   static const CPlayerDesc
   _allplayers[] = {
   CPlayerDesc (ChscPlayer::factory, "HSC-Tracker", ".hsc\0"),
-  CPlayerDesc (CsngPlayer::factory, "SNGPlay", ".sng\0"),
+  CPlayerDesc (CsngPlayer::factory, "SNGPlay", ".sng\0", sniff_sng),
   CPlayerDesc (CimfPlayer::factory, "Apogee IMF", ".imf\0.wlf\0.adlib\0"),
-  CPlayerDesc (Ca2mLoader::factory, "Adlib Tracker 2", ".a2m\0"),
+  CPlayerDesc (Ca2mLoader::factory, "Adlib Tracker 2", ".a2m\0", sniff_a2m),
   CPlayerDesc (CadtrackLoader::factory, "Adlib Tracker", ".sng\0"),
   CPlayerDesc (CamdLoader::factory, "AMUSIC", ".amd\0"),
-  CPlayerDesc (CbamPlayer::factory, "Bob's Adlib Music", ".bam\0"),
+  CPlayerDesc (CbamPlayer::factory, "Bob's Adlib Music", ".bam\0", sniff_bam),
   CPlayerDesc (CcmfPlayer::factory, "Creative Music File", ".cmf\0"),
   CPlayerDesc (Cd00Player::factory, "Packed EdLib", ".d00\0"),
-  CPlayerDesc (CdfmLoader::factory, "Digital-FM", ".dfm\0"),
+  CPlayerDesc (CdfmLoader::factory, "Digital-FM", ".dfm\0", sniff_dfm),
   CPlayerDesc (ChspLoader::factory, "HSC Packed", ".hsp\0"),
   CPlayerDesc (CksmPlayer::factory, "Ken Silverman Music", ".ksm\0"),
   CPlayerDesc (CmadLoader::factory, "Mlat Adlib Tracker", ".mad\0"),
@@ -155,26 +249,26 @@ const CPlayers& CAdPlug::getPlayers() {
   CPlayerDesc (CmkjPlayer::factory, "MKJamz", ".mkj\0"),
   CPlayerDesc (CcffLoader::factory, "Boomtracker", ".cff\0"),
   CPlayerDesc (CdmoLoader::factory, "TwinTeam", ".dmo\0"),
-  CPlayerDesc (Cs3mPlayer::factory, "Scream Tracker 3", ".s3m\0"),
-  CPlayerDesc (CdtmLoader::factory, "DeFy Adlib Tracker", ".dtm\0"),
-  CPlayerDesc (CfmcLoader::factory, "Faust Music Creator", ".sng\0"),
-  CPlayerDesc (CmtkLoader::factory, "MPU-401 Trakker", ".mtk\0"),
-  CPlayerDesc (CradLoader::factory, "Reality Adlib Tracker", ".rad\0"),
+  CPlayerDesc (Cs3mPlayer::factory, "Scream Tracker 3", ".s3m\0", sniff_s3m),
+  CPlayerDesc (CdtmLoader::factory, "DeFy Adlib Tracker", ".dtm\0", sniff_dtm),
+  CPlayerDesc (CfmcLoader::factory, "Faust Music Creator", ".sng\0", sniff_fmc),
+  CPlayerDesc (CmtkLoader::factory, "MPU-401 Trakker", ".mtk\0", sniff_mtk),
+  CPlayerDesc (CradLoader::factory, "Reality Adlib Tracker", ".rad\0", sniff_rad),
   CPlayerDesc (CrawPlayer::factory, "RdosPlay RAW", ".raw\0"),
   CPlayerDesc (Csa2Loader::factory, "Surprise! Adlib Tracker",
-               ".sat\0.sa2\0"),
-  CPlayerDesc (CxadbmfPlayer::factory, "BMF Adlib Tracker", ".xad\0"),
-  CPlayerDesc (CxadflashPlayer::factory, "Flash", ".xad\0"),
-  CPlayerDesc (CxadhybridPlayer::factory, "Hybrid", ".xad\0"),
-  CPlayerDesc (CxadhypPlayer::factory, "Hypnosis", ".xad\0"),
-  CPlayerDesc (CxadpsiPlayer::factory, "PSI", ".xad\0"),
-  CPlayerDesc (CxadratPlayer::factory, "rat", ".xad\0"),
+               ".sat\0.sa2\0", sniff_sa2),
+  CPlayerDesc (CxadbmfPlayer::factory, "BMF Adlib Tracker", ".xad\0", sniff_xad<4>),
+  CPlayerDesc (CxadflashPlayer::factory, "Flash", ".xad\0", sniff_xad<3>),
+  CPlayerDesc (CxadhybridPlayer::factory, "Hybrid", ".xad\0", sniff_xad<6>),
+  CPlayerDesc (CxadhypPlayer::factory, "Hypnosis", ".xad\0", sniff_xad<1>),
+  CPlayerDesc (CxadpsiPlayer::factory, "PSI", ".xad\0", sniff_xad<2>),
+  CPlayerDesc (CxadratPlayer::factory, "rat", ".xad\0", sniff_xad<5>),
   CPlayerDesc (CldsPlayer::factory, "LOUDNESS Sound System", ".lds\0"),
   CPlayerDesc (Cu6mPlayer::factory, "Ultima 6 Music", ".m\0"),
   CPlayerDesc (CrolPlayer::factory, "Adlib Visual Composer", ".rol\0"),
   CPlayerDesc (CxsmPlayer::factory, "eXtra Simple Music", ".xsm\0"),
-  CPlayerDesc (CdroPlayer::factory, "DOSBox Raw OPL v0.1", ".dro\0"),
-  CPlayerDesc (Cdro2Player::factory, "DOSBox Raw OPL v2.0", ".dro\0"),
+  CPlayerDesc (CdroPlayer::factory, "DOSBox Raw OPL v0.1", ".dro\0", sniff_dro),
+  CPlayerDesc (Cdro2Player::factory, "DOSBox Raw OPL v2.0", ".dro\0", sniff_dro2),
   CPlayerDesc (CmscPlayer::factory, "Adlib MSC Player", ".msc\0"),
   CPlayerDesc (CrixPlayer::factory, "Softstar RIX OPL Music", ".rix\0"),
   CPlayerDesc (CadlPlayer::factory, "Westwood ADL", ".adl\0"),
@@ -195,12 +289,33 @@ CAdPlug::factory (VFSFile * fd, Copl * opl, const CPlayers & pl,
   CPlayer *p;
   CPlayers::const_iterator i;
   unsigned int j;
+  unsigned char head[CPlayerDesc::sniff_size];
+  long headsize = -1;
 
   // Try a direct hit by file extension
   for (i = pl.begin (); i != pl.end (); i++)
     for (j = 0; (*i)->get_extension (j); j++)
       if (fp.extension (vfs_get_filename (fd), (*i)->get_extension (j)))
       {
+        // the head of the file is read only once, for all players
+        if ((*i)->sniff)
+        {
+          if (headsize < 0)
+          {
+            vfs_rewind (fd);
+            headsize = vfs_fread (head, 1, sizeof head, fd);
+            if (headsize < 0)
+              headsize = 0;
+          }
+
+          if (!(*i)->sniff (head, headsize))
+          {
+            AdPlug_LogWrite ("Skipping (no signature): %s\n",
+                             (*i)->filetype.c_str ());
+            break;
+          }
+        }
+
         AdPlug_LogWrite ("Trying direct hit: %s\n", (*i)->filetype.c_str ());
         vfs_rewind (fd);
         if ((p = (*i)->factory (opl)))
@@ -214,6 +329,7 @@ CAdPlug::factory (VFSFile * fd, Copl * opl, const CPlayers & pl,
           else
             delete p;
         }
+        break;
       }
 
 #if 0
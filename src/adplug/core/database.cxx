@@ -120,43 +120,39 @@ CAdPlugDatabase::save (binostream & f)
 
 CAdPlugDatabase::CRecord * CAdPlugDatabase::search (CKey const &key)
 {
-  if (lookup (key))
-    return get_record ();
-  else
-    return 0;
+  // Unlike lookup(), leaves the current position alone, so that any number of
+  // threads can search a database that is not being changed.
+  DB_Bucket *bucket = find_bucket (key);
+  return bucket ? bucket->record : 0;
 }
 
 bool
 CAdPlugDatabase::lookup (CKey const &key)
 {
-  unsigned long index = make_hash (key);
-  if (!db_hashed[index])
-    return false;
+  DB_Bucket *bucket = find_bucket (key);
 
-  // immediate hit ?
-  DB_Bucket *bucket = db_hashed[index];
+  if (!bucket)
+    return false;
 
-  if (!bucket->deleted && bucket->record->key == key)
-  {
-    linear_index = bucket->index;
-    return true;
-  }
+  linear_index = bucket->index;
+  return true;
+}
 
-  // in-chain hit ?
-  bucket = db_hashed[index]->chain;
+CAdPlugDatabase::DB_Bucket * CAdPlugDatabase::find_bucket (CKey const &key)
+{
+  unsigned long index = make_hash (key);
+  DB_Bucket *bucket = db_hashed[index];
 
+  // immediate or in-chain hit ?
   while (bucket)
   {
     if (!bucket->deleted && bucket->record->key == key)
-    {
-      linear_index = bucket->index;
-      return true;
-    }
+      return bucket;
 
     bucket = bucket->chain;
   }
 
-  return false;
+  return 0;
 }
 
 bool
@@ -298,6 +294,8 @@ CAdPlugDatabase::CRecord * CAdPlugDatabase::CRecord::factory (RecordType type)
     return new CInfoRecord;
   case ClockSpeed:
     return new CClockRecord;
+  case SongLength:
+    return new CLengthRecord;
   default:
     return 0;
   }
@@ -369,6 +367,9 @@ CAdPlugDatabase::CRecord::user_write (std::ostream & out)
   case ClockSpeed:
     out << "ClockSpeed";
     break;
+  case SongLength:
+    out << "SongLength";
+    break;
   default:
     out << "*** Unknown ***";
     break;
@@ -518,3 +519,67 @@ CClockRecord::user_write_own (std::ostream & out)
   out << "Clock speed: " << clock << " Hz" << std::endl;
   return true;
 }
+
+/***** CLengthRecord *****/
+
+const unsigned long CLengthRecord::unknown;
+
+CLengthRecord::CLengthRecord ()
+{
+  type = SongLength;
+}
+
+void
+CLengthRecord::read_own (binistream & in)
+{
+  unsigned long count = in.readInt (4);
+
+  lengths.clear ();
+  for (unsigned long i = 0; i < count && !in.eof (); i++)
+    lengths.push_back (in.readInt (4));
+}
+
+void
+CLengthRecord::write_own (binostream & out)
+{
+  out.writeInt (lengths.size (), 4);
+  for (unsigned long i = 0; i < lengths.size (); i++)
+    out.writeInt (lengths[i], 4);
+}
+
+unsigned long
+CLengthRecord::get_size ()
+{
+  return 4 + 4 * lengths.size ();
+}
+
+bool
+CLengthRecord::user_read_own (std::istream & in, std::ostream & out)
+{
+  unsigned long count;
+
+  out << "Subsongs: ";
+  in >> count;
+  lengths.assign (count, unknown);
+
+  for (unsigned long i = 0; i < count; i++)
+  {
+    out << "Length of subsong " << i << " (ms): ";
+    in >> lengths[i];
+  }
+  return true;
+}
+
+bool
+CLengthRecord::user_write_own (std::ostream & out)
+{
+  for (unsigned long i = 0; i < lengths.size (); i++)
+  {
+    out << "Length of subsong " << i << ": ";
+    if (lengths[i] == unknown)
+      out << "unknown" << std::endl;
+    else
+      out << lengths[i] << " ms" << std::endl;
+  }
+  return true;
+}
@@ -26,6 +26,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "binio_virtual.h"
 
@@ -50,7 +51,7 @@ public:
   class CRecord
   {
   public:
-    typedef enum { Plain, SongInfo, ClockSpeed } RecordType;
+    typedef enum { Plain, SongInfo, ClockSpeed, SongLength } RecordType;
 
     RecordType	type;
     CKey	key;
@@ -121,6 +122,7 @@ private:
   unsigned long	linear_index, linear_logic_length, linear_length;
 
   unsigned long make_hash(CKey const &key);
+  DB_Bucket *find_bucket(CKey const &key);
 };
 
 class CPlainRecord: public CAdPlugDatabase::CRecord
@@ -167,4 +169,21 @@ protected:
   virtual bool user_write_own(std::ostream &out);
 };
 
+class CLengthRecord: public CAdPlugDatabase::CRecord
+{
+public:
+  static const unsigned long unknown = 0xffffffffUL;
+
+  std::vector<unsigned long>	lengths;	// per subsong, in ms or unknown
+
+  CLengthRecord();
+
+protected:
+  virtual void read_own(binistream &in);
+  virtual void write_own(binostream &out);
+  virtual unsigned long get_size();
+  virtual bool user_read_own(std::istream &in, std::ostream &out);
+  virtual bool user_write_own(std::ostream &out);
+};
+
 #endif
@@ -21,6 +21,12 @@
 
 #include "emuopl.h"
 
+extern "C" {
+#include <libaudcore/audio.h>
+}
+
+#include "../../pcmconv/pcmconv.h"
+
 CEmuopl::CEmuopl (int rate, bool bit16, bool usestereo):use16bit (bit16), stereo (usestereo),
 mixbufSamples (0)
 {
@@ -48,6 +54,7 @@ void
 CEmuopl::update (short *buf, int samples)
 {
   int i;
+  const void *planes[2];
 
   //ensure that our mix buffers are adequately sized
   if (mixbufSamples < samples)
@@ -65,22 +72,14 @@ CEmuopl::update (short *buf, int samples)
   }
 
   //data should be rendered to outbuf
-  //tempbuf should be used as a temporary buffer
   //if we are supposed to generate 16bit output,
-  //then outbuf may point directly to the actual waveform output "buf"
+  //then outbuf points directly to the actual waveform output "buf"
   //if we are supposed to generate 8bit output,
   //then outbuf cannot point to "buf" (because there will not be enough room)
   //and so it must point to a mixbuf instead--
   //it will be reduced to 8bit and put in "buf" later
-  short *outbuf;
+  short *outbuf = use16bit ? buf : mixbuf1;
   short *tempbuf = mixbuf0;
-  short *tempbuf2 = mixbuf1;
-  if (use16bit)
-    outbuf = buf;
-  else
-    outbuf = mixbuf1;
-  //...there is a potentially confusing situation where mixbuf1 can be aliased.
-  //beware. it is a little loony.
 
   //all of the following rendering code produces 16bit output
 
@@ -88,17 +87,16 @@ CEmuopl::update (short *buf, int samples)
   {
   case TYPE_OPL2:
     //for opl2 mode:
-    //render chip0 to the output buffer
-    YM3812UpdateOne (opl[0], outbuf, samples);
-
-    //if we are supposed to output stereo,
-    //then we need to dup the mono channel
+    //render chip0 to the output buffer, or if we are supposed to
+    //output stereo, to the temp buffer and dup the mono channel
     if (stereo)
-      for (i = samples - 1; i >= 0; i--)
-      {
-        outbuf[i * 2] = outbuf[i];
-        outbuf[i * 2 + 1] = outbuf[i];
-      }
+    {
+      YM3812UpdateOne (opl[0], tempbuf, samples);
+      planes[0] = planes[1] = tempbuf;
+      pcm_interleave (planes, FMT_S16_NE, 2, outbuf, samples);
+    }
+    else
+      YM3812UpdateOne (opl[0], outbuf, samples);
     break;
 
   case TYPE_OPL3:              // unsupported
@@ -106,34 +104,37 @@ CEmuopl::update (short *buf, int samples)
 
   case TYPE_DUAL_OPL2:
     //for dual opl2 mode:
-    //render each chip to a different tempbuffer
-    YM3812UpdateOne (opl[0], tempbuf2, samples);
-    YM3812UpdateOne (opl[1], tempbuf, samples);
-
-    //output stereo:
-    //then we need to interleave the two buffers
+    //chip1 always goes to the temp buffer. chip0 is rendered first,
+    //the rhythm section's noise depends on the order.
     if (stereo)
     {
-      //first, spread tempbuf's samples across left channel
-      //left channel
-      for (i = 0; i < samples; i++)
-        outbuf[i * 2] = tempbuf2[i];
-      //next, insert the samples from tempbuf2 into right channel
-      for (i = 0; i < samples; i++)
-        outbuf[i * 2 + 1] = tempbuf[i];
+      //output stereo:
+      //render chip0 into the upper half of outbuf and interleave
+      //in place (pcm_interleave allows the first plane to be there)
+      short *left = outbuf + samples;
+
+      YM3812UpdateOne (opl[0], left, samples);
+      YM3812UpdateOne (opl[1], tempbuf, samples);
+      planes[0] = left;
+      planes[1] = tempbuf;
+      pcm_interleave (planes, FMT_S16_NE, 2, outbuf, samples);
     }
     else
+    {
       //output mono:
-      //then we need to mix the two buffers into buf
+      //render chip0 in place and mix the temp buffer into it
+      YM3812UpdateOne (opl[0], outbuf, samples);
+      YM3812UpdateOne (opl[1], tempbuf, samples);
       for (i = 0; i < samples; i++)
-        outbuf[i] = (tempbuf[i] >> 1) + (tempbuf2[i] >> 1);
+        outbuf[i] = (tempbuf[i] >> 1) + (outbuf[i] >> 1);
+    }
     break;
   }
 
   //now reduce to 8bit if we need to
   if (!use16bit)
-    for (i = 0; i < (stereo ? samples * 2 : samples); i++)
-      ((char *) buf)[i] = (outbuf[i] >> 8) ^ 0x80;
+    pcm_convert (outbuf, FMT_S16_NE, buf, FMT_U8,
+                 stereo ? samples * 2 : samples);
 }
 
 void
@@ -136,6 +136,11 @@ typedef struct fm_opl_f {
 	INT32 amsIncr;
 	INT32 vibCnt;
 	INT32 vibIncr;
+	/* render state, used while updating */
+	INT32 ams;			/* current LFO output */
+	INT32 vib;
+	INT32 outd[1];		/* output accumulator */
+	INT32 feedback2;	/* connect for SLOT 2 */
 	/* wave selector enable flag */
 	UINT8 wavesel;
 	/* external event callback handler */
@@ -43,6 +43,20 @@ public:
 	virtual void rewind(int subsong = -1) = 0;	// rewinds to specified subsong
 	virtual float getrefresh() = 0;			// returns needed timer refresh rate
 
+/***** Replay state snapshots *****/
+	class State					// opaque, from savestate()
+	{
+	public:
+	  virtual ~State() {}
+	};
+
+	// Copy of the replay state, excluding the OPL registers. Returns 0 if
+	// the player does not support snapshots. Caller deletes the result.
+	virtual State *savestate()
+	{ return 0; }
+	virtual void loadstate(const State *s)		// restores a savestate() copy
+	{ }
+
 /***** Informational methods *****/
 	unsigned long songlength(int subsong = -1);
 
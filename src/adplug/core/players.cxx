@@ -27,12 +27,13 @@
 /***** CPlayerDesc *****/
 
 CPlayerDesc::CPlayerDesc()
-  : factory(0), extensions(0), extlength(0)
+  : factory(0), sniff(0), extensions(0), extlength(0)
 {
 }
 
 CPlayerDesc::CPlayerDesc(const CPlayerDesc &pd)
-  : factory(pd.factory), filetype(pd.filetype), extlength(pd.extlength)
+  : factory(pd.factory), sniff(pd.sniff), filetype(pd.filetype),
+    extlength(pd.extlength)
 {
   if(pd.extensions) {
     extensions = (char *)malloc(extlength);
@@ -41,8 +42,9 @@ CPlayerDesc::CPlayerDesc(const CPlayerDesc &pd)
     extensions = 0;
 }
 
-CPlayerDesc::CPlayerDesc(Factory f, const std::string &type, const char *ext)
-  : factory(f), filetype(type), extensions(0)
+CPlayerDesc::CPlayerDesc(Factory f, const std::string &type, const char *ext,
+			 Sniff s)
+  : factory(f), sniff(s), filetype(type), extensions(0)
 {
   const char *i = ext;
 
@@ -32,13 +32,20 @@ class CPlayerDesc
 {
 public:
   typedef CPlayer *(*Factory)(Copl *);
+  // Cheap check on the first sniff_size bytes (or fewer, if the file is
+  // shorter) of a file; false if the player certainly can't load it
+  typedef bool (*Sniff)(const unsigned char *head, unsigned long size);
+
+  enum { sniff_size = 80 };
 
   Factory	factory;
+  Sniff		sniff;
   std::string	filetype;
 
   CPlayerDesc();
   CPlayerDesc(const CPlayerDesc &pd);
-  CPlayerDesc(Factory f, const std::string &type, const char *ext);
+  CPlayerDesc(Factory f, const std::string &type, const char *ext,
+	      Sniff s = 0);
 
   ~CPlayerDesc();
 
@@ -625,6 +625,62 @@ CmodPlayer::rewind (int subsong)
     opl->write (0xbd, regbd);
 }
 
+struct CmodPlayer::ModState: public CPlayer::State
+{
+  ModState (unsigned long nchans):channel (new Channel[nchans])
+  {
+  }
+
+  ~ModState ()
+  {
+    delete[]channel;
+  }
+
+  Channel *channel;
+  unsigned char speed, del, songend, regbd;
+  unsigned short tempo;
+  unsigned long rw, ord;
+  int curchip;
+};
+
+CPlayer::State *
+CmodPlayer::savestate ()
+  /*
+   * Only the playing variables change during replay; the song data is left
+   * alone, so it is not copied.
+   */
+{
+  ModState *s = new ModState (nchans);
+
+  memcpy (s->channel, channel, sizeof (Channel) * nchans);
+  s->speed = speed;
+  s->del = del;
+  s->songend = songend;
+  s->regbd = regbd;
+  s->tempo = tempo;
+  s->rw = rw;
+  s->ord = ord;
+  s->curchip = curchip;
+
+  return s;
+}
+
+void
+CmodPlayer::loadstate (const State * state)
+{
+  const ModState *s = static_cast < const ModState * >(state);
+
+  memcpy (channel, s->channel, sizeof (Channel) * nchans);
+  speed = s->speed;
+  del = s->del;
+  songend = s->songend;
+  regbd = s->regbd;
+  tempo = s->tempo;
+  rw = s->rw;
+  ord = s->ord;
+  curchip = s->curchip;
+}
+
 float
 CmodPlayer::getrefresh ()
 {
@@ -34,6 +34,9 @@ public:
   void rewind(int subsong);
   float getrefresh();
 
+  State *savestate();
+  void loadstate(const State *s);
+
   unsigned int getpatterns()
     { return nop; }
   unsigned int getpattern()
@@ -97,6 +100,8 @@ public:
   unsigned short rows, notetable[12];
   unsigned long rw, ord, nrows, npats, nchans;
 
+  struct ModState;
+
   void setvolume(unsigned char chan);
   void setvolume_alt(unsigned char chan);
   void setfreq(unsigned char chan);
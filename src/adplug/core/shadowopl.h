@@ -0,0 +1,124 @@
+/*
+ * Adplug - Replayer for many OPL2/OPL3 audio file formats.
+ * Copyright (C) 1999 - 2005 Simon Peter, <dn.tlp@gmx.net>, et al.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * shadowopl.h - Register-recording OPL pass-through
+ */
+
+#ifndef H_ADPLUG_SHADOWOPL
+#define H_ADPLUG_SHADOWOPL
+
+#include <string.h>
+
+#include "opl.h"
+
+/*
+ * Forwards everything to another OPL device and keeps a copy of the
+ * register file, so that the device can be brought back to a saved state
+ * by writing the registers again. While detached, only the copy is kept up
+ * to date.
+ */
+class CShadowopl: public Copl
+{
+public:
+  struct Regs {
+    unsigned char	data[2][256];	// registers of both chips
+    int			chip;		// currently selected chip
+  };
+
+  CShadowopl(Copl *newopl)
+    : target(newopl), attached(true)
+    {
+      currType = target->gettype();
+      memset(&regs, 0, sizeof(regs));
+    }
+
+  void write(int reg, int val)
+    {
+      regs.data[currChip][reg & 0xff] = val;
+      if(attached)
+	target->write(reg, val);
+    }
+
+  void setchip(int n)
+    {
+      Copl::setchip(n);
+      target->setchip(n);
+    }
+
+  void init()
+    {
+      memset(regs.data, 0, sizeof(regs.data));
+      if(attached)
+	target->init();
+    }
+
+  void update(short *buf, int samples)
+    {
+      target->update(buf, samples);
+    }
+
+  void save(Regs &r)
+    {
+      r = regs;
+      r.chip = currChip;
+    }
+
+  void load(const Regs &r)			// rewrite registers from save()
+    {
+      regs = r;
+      setchip(r.chip);
+      if(attached)
+	sync();
+    }
+
+  void detach()					// stop writing to the device
+    {
+      attached = false;
+    }
+
+  void attach()					// resync and resume writing
+    {
+      if(!attached) {
+	attached = true;
+	sync();
+      }
+    }
+
+private:
+  Copl	*target;
+  Regs	regs;
+  bool	attached;
+
+  void sync()
+    {
+      target->init();
+
+      // Timer registers (2-4) are left alone. Ascending order puts the
+      // operator and frequency settings ahead of the key-on bits in 0xb0-0xbd.
+      for(int chip = 0; chip < 2; chip++) {
+	target->setchip(chip);
+	for(int reg = 1; reg < 256; reg++)
+	  if((reg < 2 || reg > 4) && regs.data[chip][reg])
+	    target->write(reg, regs.data[chip][reg]);
+      }
+
+      target->setchip(currChip);
+    }
+};
+
+#endif
@@ -17,51 +17,320 @@
  * the use of this software.
  */
 
+#include <pthread.h>
+
 #include <audacious/drct.h>
 #include <audacious/i18n.h>
+#include <audacious/misc.h>
+#include <audacious/playlist.h>
 #include <audacious/plugin.h>
 #include <libaudcore/hook.h>
 #include <libaudgui/libaudgui-gtk.h>
 
-static void album_set_unscaled (GtkWidget * widget, GdkPixbuf * unscaled)
+/* Cover art is decoded on a worker thread, straight to the size of the widget
+ * (JPEG can skip most of the work when asked for a fraction of the full size),
+ * and the results are kept in a small cache keyed by a hash of the image data
+ * and the size asked for, so that tracks from the same album and redraws at
+ * the same size do not decode anything at all. */
+
+#define CACHE_SIZE 8
+#define MIN_SIZE 96
+
+typedef struct {
+    int serial;            /* bumped whenever a different image is wanted */
+    bool_t pending;        /* a decode for the current serial is in flight */
+    char * filename;       /* pooled; the song whose art is wanted */
+    GdkPixbuf * unscaled;  /* as decoded */
+    GdkPixbuf * scaled;
+    int width, height;     /* box the image was decoded to fit */
+    bool_t reduced;        /* the image is larger than what was decoded */
+} AlbumState;
+
+typedef struct {
+    GtkWidget * widget;    /* referenced until the job is finished */
+    AlbumState * state;
+    int serial;
+    char * filename;       /* pooled; holds a reference to the art data */
+    const void * data;
+    int64_t size;
+    int width, height;
+    GdkPixbuf * pixbuf;
+    bool_t reduced;
+} DecodeJob;
+
+typedef struct {
+    unsigned hash;
+    int64_t size;
+    int width, height;
+    GdkPixbuf * pixbuf;
+    bool_t reduced;
+} CacheEntry;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static bool_t worker_running, worker_quit;
+static GQueue queue = G_QUEUE_INIT;   /* jobs waiting for the worker */
+static GQueue cache = G_QUEUE_INIT;   /* most recently used first */
+static GList * finished;              /* jobs waiting for job_done_cb() */
+static int done_source;
+
+static unsigned hash_data (const void * data, int64_t size)
 {
-    GdkPixbuf * old;
+    const unsigned char * p = data;
+    unsigned hash = 2166136261u;
 
-    if ((old = g_object_get_data ((GObject *) widget, "pixbux-unscaled")))
-        g_object_unref (old);
-    if ((old = g_object_get_data ((GObject *) widget, "pixbux-scaled")))
-        g_object_unref (old);
+    while (size --)
+        hash = (hash ^ * p ++) * 16777619u;
 
-    g_object_set_data ((GObject *) widget, "pixbuf-unscaled", unscaled);
-    g_object_set_data ((GObject *) widget, "pixbuf-scaled", NULL);
+    return hash;
+}
 
-    gtk_widget_queue_draw (widget);
+/* called with the mutex held */
+static CacheEntry * cache_lookup (unsigned hash, int64_t size, int width, int height)
+{
+    for (GList * node = cache.head; node; node = node->next)
+    {
+        CacheEntry * entry = node->data;
+
+        if (entry->hash == hash && entry->size == size && entry->width == width
+         && entry->height == height)
+        {
+            g_queue_unlink (& cache, node);
+            g_queue_push_head_link (& cache, node);
+            return entry;
+        }
+    }
+
+    return NULL;
 }
 
-static GdkPixbuf * album_get_scaled (GtkWidget * widget, int maxwidth, int maxheight)
+static void cache_entry_free (CacheEntry * entry)
 {
-    GdkPixbuf * unscaled = g_object_get_data ((GObject *) widget, "pixbuf-unscaled");
-    if (! unscaled)
-        return NULL;
+    g_object_unref (entry->pixbuf);
+    g_slice_free (CacheEntry, entry);
+}
 
-    int width = gdk_pixbuf_get_width (unscaled);
-    int height = gdk_pixbuf_get_height (unscaled);
+/* called with the mutex held */
+static void cache_add (unsigned hash, int64_t size, int width, int height,
+ GdkPixbuf * pixbuf, bool_t reduced)
+{
+    CacheEntry * entry = g_slice_new (CacheEntry);
+    entry->hash = hash;
+    entry->size = size;
+    entry->width = width;
+    entry->height = height;
+    entry->pixbuf = g_object_ref (pixbuf);
+    entry->reduced = reduced;
+
+    g_queue_push_head (& cache, entry);
 
-    if (width > maxwidth || height > maxheight)
+    while (g_queue_get_length (& cache) > CACHE_SIZE)
+        cache_entry_free (g_queue_pop_tail (& cache));
+}
+
+static void fit_within (int * width, int * height, int maxwidth, int maxheight)
+{
+    if (* width > maxwidth || * height > maxheight)
     {
-        if (width * maxheight > height * maxwidth)
+        if (* width * maxheight > * height * maxwidth)
         {
-            height = height * maxwidth / width;
-            width = maxwidth;
+            * height = MAX (1, * height * maxwidth / * width);
+            * width = maxwidth;
         }
         else
         {
-            width = width * maxheight / height;
-            height = maxheight;
+            * width = MAX (1, * width * maxheight / * height);
+            * height = maxheight;
+        }
+    }
+}
+
+static void size_prepared (GdkPixbufLoader * loader, int width, int height,
+ DecodeJob * job)
+{
+    int new_width = width, new_height = height;
+    fit_within (& new_width, & new_height, job->width, job->height);
+
+    if (new_width != width || new_height != height)
+    {
+        gdk_pixbuf_loader_set_size (loader, new_width, new_height);
+        job->reduced = TRUE;
+    }
+}
+
+static void decode (DecodeJob * job)
+{
+    unsigned hash = hash_data (job->data, job->size);
+
+    pthread_mutex_lock (& mutex);
+
+    CacheEntry * entry = cache_lookup (hash, job->size, job->width, job->height);
+    if (entry)
+    {
+        job->pixbuf = g_object_ref (entry->pixbuf);
+        job->reduced = entry->reduced;
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    if (job->pixbuf)
+        return;
+
+    GdkPixbufLoader * loader = gdk_pixbuf_loader_new ();
+    g_signal_connect (loader, "size-prepared", (GCallback) size_prepared, job);
+
+    if (gdk_pixbuf_loader_write (loader, job->data, job->size, NULL) &&
+     gdk_pixbuf_loader_close (loader, NULL))
+    {
+        if ((job->pixbuf = gdk_pixbuf_loader_get_pixbuf (loader)))
+            g_object_ref (job->pixbuf);
+    }
+    else
+        gdk_pixbuf_loader_close (loader, NULL);
+
+    g_object_unref (loader);
+
+    if (job->pixbuf)
+    {
+        pthread_mutex_lock (& mutex);
+        cache_add (hash, job->size, job->width, job->height, job->pixbuf, job->reduced);
+        pthread_mutex_unlock (& mutex);
+    }
+}
+
+static void album_set_unscaled (GtkWidget * widget, AlbumState * state,
+ GdkPixbuf * unscaled, bool_t reduced)
+{
+    if (state->unscaled)
+        g_object_unref (state->unscaled);
+    if (state->scaled)
+        g_object_unref (state->scaled);
+
+    state->unscaled = unscaled;
+    state->scaled = NULL;
+    state->reduced = reduced;
+
+    gtk_widget_queue_draw (widget);
+}
+
+static bool_t job_done_cb (void * unused)
+{
+    pthread_mutex_lock (& mutex);
+    GList * jobs = finished;
+    finished = NULL;
+    done_source = 0;
+    pthread_mutex_unlock (& mutex);
+
+    for (GList * node = jobs; node; node = node->next)
+    {
+        DecodeJob * job = node->data;
+        AlbumState * state = job->state;
+
+        if (job->serial == state->serial)
+        {
+            state->pending = FALSE;
+            state->width = job->width;
+            state->height = job->height;
+
+            if (job->pixbuf)
+                album_set_unscaled (job->widget, state, job->pixbuf, job->reduced);
+            else
+                album_set_unscaled (job->widget, state, audgui_pixbuf_fallback (), FALSE);
+        }
+        else if (job->pixbuf)
+            g_object_unref (job->pixbuf);
+
+        aud_art_unref (job->filename);
+        str_unref (job->filename);
+        g_object_unref (job->widget);
+        g_slice_free (DecodeJob, job);
+    }
+
+    g_list_free (jobs);
+    return FALSE;
+}
+
+static void * worker_thread (void * unused)
+{
+    pthread_mutex_lock (& mutex);
+
+    while (! worker_quit)
+    {
+        DecodeJob * job = g_queue_pop_head (& queue);
+
+        if (! job)
+        {
+            pthread_cond_wait (& cond, & mutex);
+            continue;
         }
+
+        pthread_mutex_unlock (& mutex);
+
+        /* skip images that were replaced while this one was waiting */
+        if (__atomic_load_n (& job->state->serial, __ATOMIC_RELAXED) == job->serial)
+            decode (job);
+
+        pthread_mutex_lock (& mutex);
+
+        if (! done_source)
+            done_source = g_idle_add (job_done_cb, NULL);
+
+        finished = g_list_append (finished, job);
+    }
+
+    pthread_mutex_unlock (& mutex);
+    return NULL;
+}
+
+static void start_decode (GtkWidget * widget, AlbumState * state, int width, int height)
+{
+    DecodeJob * job = g_slice_new0 (DecodeJob);
+
+    aud_art_request_data (state->filename, & job->data, & job->size);
+
+    if (! job->data)
+    {
+        g_slice_free (DecodeJob, job);
+        album_set_unscaled (widget, state, audgui_pixbuf_fallback (), FALSE);
+        return;
     }
 
-    GdkPixbuf * scaled = g_object_get_data ((GObject *) widget, "pixbuf-scaled");
+    job->widget = g_object_ref (widget);
+    job->state = state;
+    job->serial = state->serial;
+    job->filename = str_ref (state->filename);
+    job->width = MAX (width, MIN_SIZE);
+    job->height = MAX (height, MIN_SIZE);
+
+    state->pending = TRUE;
+
+    pthread_mutex_lock (& mutex);
+
+    if (! worker_running)
+    {
+        worker_quit = FALSE;
+        worker_running = TRUE;
+        pthread_create (& worker, NULL, worker_thread, NULL);
+    }
+
+    g_queue_push_tail (& queue, job);
+    pthread_cond_signal (& cond);
+    pthread_mutex_unlock (& mutex);
+}
+
+static GdkPixbuf * album_get_scaled (AlbumState * state, int maxwidth, int maxheight)
+{
+    GdkPixbuf * unscaled = state->unscaled;
+    if (! unscaled)
+        return NULL;
+
+    int width = gdk_pixbuf_get_width (unscaled);
+    int height = gdk_pixbuf_get_height (unscaled);
+
+    fit_within (& width, & height, maxwidth, maxheight);
+
+    GdkPixbuf * scaled = state->scaled;
     if (scaled)
     {
         if (gdk_pixbuf_get_width (scaled) == width &&
@@ -72,16 +341,21 @@ static GdkPixbuf * album_get_scaled (GtkWidget * widget, int maxwidth, int maxhe
     }
 
     scaled = gdk_pixbuf_scale_simple (unscaled, width, height, GDK_INTERP_BILINEAR);
-    g_object_set_data ((GObject *) widget, "pixbuf-scaled", scaled);
+    state->scaled = scaled;
     return scaled;
 }
 
-static bool_t album_draw (GtkWidget * widget, cairo_t * cr)
+static bool_t album_draw (GtkWidget * widget, cairo_t * cr, AlbumState * state)
 {
     GdkRectangle rect;
     gtk_widget_get_allocation (widget, & rect);
 
-    GdkPixbuf * scaled = album_get_scaled (widget, rect.width, rect.height);
+    /* the widget has grown past what we decoded; the full image has more */
+    if (state->reduced && ! state->pending && (rect.width > state->width ||
+     rect.height > state->height))
+        start_decode (widget, state, rect.width, rect.height);
+
+    GdkPixbuf * scaled = album_get_scaled (state, rect.width, rect.height);
     if (! scaled)
         return TRUE;
 
@@ -104,15 +378,38 @@ static void album_update (void * unused, GtkWidget * widget)
     if (! aud_drct_get_playing ())
         return;
 
-    GdkPixbuf * unscaled = audgui_pixbuf_request_current ();
-    album_set_unscaled (widget, unscaled ? unscaled : audgui_pixbuf_fallback ());
-    gtk_widget_queue_draw (widget);
+    AlbumState * state = g_object_get_data ((GObject *) widget, "album-state");
+
+    int list = aud_playlist_get_playing ();
+    int entry = aud_playlist_get_position (list);
+
+    str_unref (state->filename);
+    state->filename = (entry >= 0) ? aud_playlist_entry_get_filename (list, entry) : NULL;
+    __atomic_store_n (& state->serial, state->serial + 1, __ATOMIC_RELAXED);
+    state->pending = FALSE;
+
+    if (! state->filename)
+    {
+        album_set_unscaled (widget, state, audgui_pixbuf_fallback (), FALSE);
+        return;
+    }
+
+    /* the old image stays up until the new one is ready */
+    GdkRectangle rect;
+    gtk_widget_get_allocation (widget, & rect);
+    start_decode (widget, state, rect.width, rect.height);
 }
 
 static void album_clear (void * unused, GtkWidget * widget)
 {
-    album_set_unscaled (widget, NULL);
-    gtk_widget_queue_draw (widget);
+    AlbumState * state = g_object_get_data ((GObject *) widget, "album-state");
+
+    str_unref (state->filename);
+    state->filename = NULL;
+    __atomic_store_n (& state->serial, state->serial + 1, __ATOMIC_RELAXED);
+    state->pending = FALSE;
+
+    album_set_unscaled (widget, state, NULL, FALSE);
 }
 
 static void album_cleanup (GtkWidget * widget)
@@ -122,12 +419,29 @@ static void album_cleanup (GtkWidget * widget)
     hook_dissociate_full ("playback stop", (HookFunction) album_clear, widget);
 }
 
+/* runs when the last job referencing the widget has finished */
+static void album_state_free (AlbumState * state)
+{
+    str_unref (state->filename);
+
+    if (state->unscaled)
+        g_object_unref (state->unscaled);
+    if (state->scaled)
+        g_object_unref (state->scaled);
+
+    g_slice_free (AlbumState, state);
+}
+
 static void * album_get_widget (void)
 {
     GtkWidget * widget = gtk_drawing_area_new ();
-    gtk_widget_set_size_request (widget, 96, 96);
+    gtk_widget_set_size_request (widget, MIN_SIZE, MIN_SIZE);
+
+    AlbumState * state = g_slice_new0 (AlbumState);
+    g_object_set_data_full ((GObject *) widget, "album-state", state,
+     (GDestroyNotify) album_state_free);
 
-    g_signal_connect (widget, "draw", (GCallback) album_draw, NULL);
+    g_signal_connect (widget, "draw", (GCallback) album_draw, state);
     g_signal_connect (widget, "configure-event", (GCallback) album_configure, NULL);
     g_signal_connect (widget, "destroy", (GCallback) album_cleanup, NULL);
 
@@ -138,9 +452,45 @@ static void * album_get_widget (void)
     return widget;
 }
 
+static void album_plugin_cleanup (void)
+{
+    pthread_mutex_lock (& mutex);
+
+    if (worker_running)
+    {
+        worker_quit = TRUE;
+        pthread_cond_signal (& cond);
+        pthread_mutex_unlock (& mutex);
+
+        pthread_join (worker, NULL);
+
+        pthread_mutex_lock (& mutex);
+        worker_running = FALSE;
+    }
+
+    /* whatever was not decoded is finished off with the rest */
+    DecodeJob * job;
+    while ((job = g_queue_pop_head (& queue)))
+        finished = g_list_append (finished, job);
+
+    if (done_source)
+    {
+        g_source_remove (done_source);
+        done_source = 0;
+    }
+
+    while (g_queue_get_length (& cache))
+        cache_entry_free (g_queue_pop_head (& cache));
+
+    pthread_mutex_unlock (& mutex);
+
+    job_done_cb (NULL);
+}
+
 AUD_GENERAL_PLUGIN
 (
     .name = N_("Album Art"),
     .domain = PACKAGE,
+    .cleanup = album_plugin_cleanup,
     .get_widget = album_get_widget
 )
@@ -35,28 +35,69 @@
  *   entering pause.)
  * * After setting the pump_quit flag, signal on alsa_cond AND the poll_pipe
  *   before joining the thread.
+ * * To flush or drain, park the pump (pump_park) rather than stopping it.  It
+ *   then waits on alsa_cond, away from the ALSA handle, until pump_unpark.
+ *
+ * In mmap mode, alsa_write_audio copies straight into the hardware buffer
+ * whenever our own buffer is empty, saving a copy of every sample.  Our
+ * buffer then only takes what is written while paused or what could not be
+ * written directly; alsa_buffer_free reports no room until the pump has
+ * emptied it, so that the order of the data is kept.  The hardware buffer is
+ * prepared right away, so prebuffering fills it directly too.
+ *
+ * Diagnostic counters (alsa_stats) are protected by alsa_mutex.  If the
+ * "stats-file" setting names a file, the pump rewrites it with the current
+ * counters every few seconds and once more when the device is closed.
+ *
+ * The pump thread can be given real-time priority ("realtime",
+ * "realtime-policy", "realtime-priority") and pinned to a list of CPUs such
+ * as "1" or "0,2-3" ("cpu-affinity").  Where the priority cannot be set
+ * directly, we retry within RLIMIT_RTPRIO and then ask rtkit.  Asking rtkit
+ * is a synchronous D-Bus call, which is why the pump lives from opening the
+ * device to closing it and is only parked for seeks and drains.
+ *
+ * The period is a quarter of the hardware buffer unless "period-time"
+ * (milliseconds) or "period-count" says otherwise.  With "low-latency", the
+ * hardware buffer is only filled up to alsa_latency frames; the limit shrinks
+ * while there are no underruns and doubles after one, and the last value is
+ * kept for the next time the device is opened.
+ *
+ * With "direct", the device is opened with ALSA's automatic format, channel
+ * and rate conversion turned off, so that the samples reach the hardware
+ * exactly as the core hands them over.  If the device cannot play the stream
+ * that way, we say what it can play and fall back to opening it normally.
  */
 
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include <alsa/asoundlib.h>
+#include <gio/gio.h>
 
 #include <audacious/debug.h>
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
 
 #include "alsa.h"
+#include "../ratepref/ratepref.h"
 
 #define CHECK_VAL_RECOVER(value, function, ...) \
 do { \
     (value) = function (__VA_ARGS__); \
     if ((value) < 0) { \
+        count_recovery (value); \
         CHECK (snd_pcm_recover, alsa_handle, (value), 0); \
         CHECK_VAL ((value), function, __VA_ARGS__); \
     } \
@@ -79,6 +120,8 @@ static void * alsa_buffer;
 static int alsa_buffer_length, alsa_buffer_data_start, alsa_buffer_data_length;
 static int alsa_period; /* milliseconds */
 
+static char alsa_mmap;
+
 static int64_t alsa_written; /* frames */
 static char alsa_prebuffer, alsa_paused;
 static int alsa_paused_delay; /* frames */
@@ -87,12 +130,126 @@ static int poll_pipe[2];
 static int poll_count;
 static struct pollfd * poll_handles;
 
-static char pump_quit;
+static char pump_quit, pump_hold, pump_held, pump_running;
 static pthread_t pump_thread;
 
 static snd_mixer_t * alsa_mixer;
 static snd_mixer_elem_t * alsa_mixer_element;
 
+#define STATS_INTERVAL 5 /* seconds */
+
+static AlsaStats alsa_stats;
+
+static snd_pcm_uframes_t alsa_hw_frames, alsa_period_frames;
+static snd_pcm_uframes_t alsa_latency; /* frames */
+static int alsa_learned_latency; /* milliseconds, kept across opens */
+static int64_t latency_xruns;
+
+/* Leaves out the part of the hardware buffer above the latency limit. */
+static snd_pcm_sframes_t limit_avail (snd_pcm_sframes_t avail)
+{
+    snd_pcm_sframes_t reserve = alsa_hw_frames - alsa_latency;
+    return (avail < 0) ? avail : MAX (0, avail - reserve);
+}
+
+static void set_latency (snd_pcm_uframes_t frames)
+{
+    frames = MIN (alsa_hw_frames, MAX (2 * alsa_period_frames, frames));
+
+    if (frames == alsa_latency)
+        return;
+
+    AUDDBG ("Latency limit: %d ms.\n", (int) (frames * 1000 / alsa_rate));
+    alsa_latency = frames;
+    alsa_stats.latency = frames * 1000 / alsa_rate;
+
+    /* Wake the pump only once it can write a period without passing the
+     * limit; otherwise poll() would return right away. */
+    snd_pcm_sw_params_t * params;
+    snd_pcm_sw_params_alloca (& params);
+    CHECK (snd_pcm_sw_params_current, alsa_handle, params);
+    CHECK (snd_pcm_sw_params_set_avail_min, alsa_handle, params,
+     alsa_hw_frames - frames + alsa_period_frames);
+    CHECK (snd_pcm_sw_params, alsa_handle, params);
+
+FAILED:
+    return;
+}
+
+static void count_recovery (int error)
+{
+    alsa_stats.recoveries ++;
+    if (error == -EPIPE)
+    {
+        alsa_stats.xruns ++;
+        if (alsa_config_low_latency)
+            set_latency (alsa_latency * 2);
+    }
+}
+
+static void count_write (int frames)
+{
+    alsa_stats.writes ++;
+    alsa_stats.frames_written += frames;
+    alsa_stats.max_write = MAX (alsa_stats.max_write, frames);
+}
+
+static int64_t time_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stats_write (const AlsaStats * s)
+{
+    if (! alsa_config_stats_file || ! alsa_config_stats_file[0])
+        return;
+
+    SPRINTF (temp, "%s.tmp", alsa_config_stats_file);
+
+    FILE * file = fopen (temp, "w");
+    if (! file)
+    {
+        ERROR ("Failed to open %s: %s.\n", temp, strerror (errno));
+        return;
+    }
+
+    fprintf (file, "rate %d\nhardware-buffer-ms %d\nsoftware-buffer-ms %d\n"
+     "period-ms %d\nmmap %d\nlatency-ms %d\n", s->rate, s->hard_buffer,
+     s->soft_buffer, s->period, s->mmap, s->latency);
+    fprintf (file, "direct %d\n", s->direct);
+    if (s->native[0])
+        fprintf (file, "native %s\n", s->native);
+    fprintf (file, "recoveries %" PRId64 "\nxruns %" PRId64 "\n",
+     s->recoveries, s->xruns);
+    fprintf (file, "wakeups %" PRId64 "\nidle-wakeups %" PRId64 "\n",
+     s->wakeups, s->idle_wakeups);
+    fprintf (file, "writes %" PRId64 "\nframes-written %" PRId64 "\n"
+     "average-write-frames %" PRId64 "\nmax-write-frames %" PRId64 "\n",
+     s->writes, s->frames_written, s->writes ? s->frames_written / s->writes :
+     0, s->max_write);
+    fprintf (file, "sleep-ms %" PRId64 "\nmax-sleep-ms %" PRId64 "\n",
+     s->sleep_ns / 1000000, s->max_sleep_ns / 1000000);
+    fprintf (file, "delay-samples %" PRId64 "\naverage-delay-frames %" PRId64
+     "\nmax-delay-frames %" PRId64 "\n", s->delay_samples, s->delay_samples ?
+     s->delay_total / s->delay_samples : 0, s->max_delay);
+
+    if (fclose (file) || rename (temp, alsa_config_stats_file))
+    {
+        ERROR ("Failed to write %s: %s.\n", alsa_config_stats_file,
+         strerror (errno));
+        unlink (temp);
+    }
+}
+
+void alsa_get_stats (AlsaStats * stats)
+{
+    pthread_mutex_lock (& alsa_mutex);
+    * stats = alsa_stats;
+    pthread_mutex_unlock (& alsa_mutex);
+}
+
 static char poll_setup (void)
 {
     if (pipe (poll_pipe))
@@ -149,17 +306,163 @@ static void poll_cleanup (void)
     free (poll_handles);
 }
 
+static char rtkit_make_realtime (int priority)
+{
+    GError * error = NULL;
+    GDBusConnection * bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, & error);
+
+    if (! bus)
+        goto FAILED;
+
+    /* rtkit only accepts threads with a limit on real-time CPU use. */
+    struct rlimit limit;
+    if (! getrlimit (RLIMIT_RTTIME, & limit) && limit.rlim_max == RLIM_INFINITY)
+    {
+        limit.rlim_cur = limit.rlim_max = 200000; /* microseconds */
+        setrlimit (RLIMIT_RTTIME, & limit);
+    }
+
+    GVariant * reply = g_dbus_connection_call_sync (bus,
+     "org.freedesktop.RealtimeKit1", "/org/freedesktop/RealtimeKit1",
+     "org.freedesktop.RealtimeKit1", "MakeThreadRealtime", g_variant_new
+     ("(tu)", (guint64) syscall (SYS_gettid), (guint32) priority), NULL,
+     G_DBUS_CALL_FLAGS_NONE, -1, NULL, & error);
+    g_object_unref (bus);
+
+    if (! reply)
+        goto FAILED;
+
+    g_variant_unref (reply);
+    AUDDBG ("Real-time priority %d granted by rtkit.\n", priority);
+    return 1;
+
+FAILED:
+    ERROR ("rtkit: %s.\n", error->message);
+    g_error_free (error);
+    return 0;
+}
+
+static void set_realtime (void)
+{
+    int policy = (alsa_config_realtime_policy && ! strcmp
+     (alsa_config_realtime_policy, "rr")) ? SCHED_RR : SCHED_FIFO;
+    struct sched_param param = {.sched_priority = CLAMP
+     (alsa_config_realtime_priority, sched_get_priority_min (policy),
+     sched_get_priority_max (policy))};
+
+    int error = pthread_setschedparam (pthread_self (), policy, & param);
+
+    /* RLIMIT_RTPRIO may allow a lower priority than the one asked for. */
+    struct rlimit limit;
+    if (error == EPERM && ! getrlimit (RLIMIT_RTPRIO, & limit) &&
+     limit.rlim_cur > 0 && limit.rlim_cur < (rlim_t) param.sched_priority)
+    {
+        param.sched_priority = limit.rlim_cur;
+        error = pthread_setschedparam (pthread_self (), policy, & param);
+    }
+
+    if (! error)
+    {
+        AUDDBG ("Real-time priority %d.\n", param.sched_priority);
+        return;
+    }
+
+    if (error == EPERM && rtkit_make_realtime (param.sched_priority))
+        return;
+
+    ERROR ("Failed to set real-time priority: %s; using normal priority.\n",
+     strerror (error));
+}
+
+static void set_affinity (const char * list)
+{
+    cpu_set_t set;
+    CPU_ZERO (& set);
+
+    const char * p = list;
+    while (* p)
+    {
+        char * end;
+        long first = strtol (p, & end, 10), last = first;
+
+        if (end == p)
+            goto INVALID;
+
+        if (* end == '-')
+        {
+            p = end + 1;
+            last = strtol (p, & end, 10);
+
+            if (end == p)
+                goto INVALID;
+        }
+
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            goto INVALID;
+
+        for (long cpu = first; cpu <= last; cpu ++)
+            CPU_SET (cpu, & set);
+
+        p = end;
+
+        if (* p == ',')
+            p ++;
+        else if (* p)
+            goto INVALID;
+    }
+
+    int error = pthread_setaffinity_np (pthread_self (), sizeof set, & set);
+    if (error)
+        ERROR ("Failed to set CPU affinity: %s.\n", strerror (error));
+
+    return;
+
+INVALID:
+    ERROR ("Invalid CPU list: %s.\n", list);
+}
+
+static snd_pcm_sframes_t pcm_writei (snd_pcm_t * pcm, const void * data,
+ snd_pcm_uframes_t frames)
+{
+    if (alsa_mmap)
+        return snd_pcm_mmap_writei (pcm, data, frames);
+    else
+        return snd_pcm_writei (pcm, data, frames);
+}
+
 static void * pump (void * unused)
 {
+    if (alsa_config_cpu_affinity && alsa_config_cpu_affinity[0])
+        set_affinity (alsa_config_cpu_affinity);
+    if (alsa_config_realtime)
+        set_realtime ();
+
     pthread_mutex_lock (& alsa_mutex);
     pthread_cond_broadcast (& alsa_cond); /* signal thread started */
 
     char failed = 0;
     char workaround = 0;
     int slept = 0;
+    int64_t check_time = time_ns ();
 
     while (! pump_quit)
     {
+        if (pump_hold)
+        {
+            pump_held = 1;
+            pthread_cond_broadcast (& alsa_cond); /* signal parked */
+            pthread_cond_wait (& alsa_cond, & alsa_mutex);
+            continue;
+        }
+
+        if (pump_held)
+        {
+            /* the device was dropped and prepared meanwhile; start over */
+            pump_held = 0;
+            failed = workaround = 0;
+            slept = 0;
+        }
+
         if (alsa_prebuffer || alsa_paused || ! snd_pcm_bytes_to_frames
          (alsa_handle, alsa_buffer_data_length))
         {
@@ -169,9 +472,15 @@ static void * pump (void * unused)
 
         int length;
         CHECK_VAL_RECOVER (length, snd_pcm_avail_update, alsa_handle);
+        length = limit_avail (length);
+
+        alsa_stats.wakeups ++;
 
         if (! length)
+        {
+            alsa_stats.idle_wakeups ++;
             goto WAIT;
+        }
 
         slept = 0;
 
@@ -181,10 +490,11 @@ static void * pump (void * unused)
         length = snd_pcm_bytes_to_frames (alsa_handle, length);
 
         int written;
-        CHECK_VAL_RECOVER (written, snd_pcm_writei, alsa_handle, (char *)
+        CHECK_VAL_RECOVER (written, pcm_writei, alsa_handle, (char *)
          alsa_buffer + alsa_buffer_data_start, length);
 
         failed = 0;
+        count_write (written);
 
         written = snd_pcm_frames_to_bytes (alsa_handle, written);
         alsa_buffer_data_start += written;
@@ -201,9 +511,30 @@ static void * pump (void * unused)
         if (! snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer_data_length))
             continue;
 
-    WAIT:
+    WAIT:;
+        int64_t now = time_ns ();
+        AlsaStats stats;
+        char save_stats = (now - check_time >= (int64_t) STATS_INTERVAL *
+         1000000000);
+
+        if (save_stats)
+        {
+            if (alsa_config_low_latency && alsa_stats.xruns == latency_xruns)
+                set_latency (alsa_latency * 3 / 4);
+
+            latency_xruns = alsa_stats.xruns;
+            stats = alsa_stats;
+            check_time = now;
+        }
+
         pthread_mutex_unlock (& alsa_mutex);
 
+        if (save_stats)
+        {
+            stats_write (& stats);
+            now = time_ns ();
+        }
+
         if (slept > 4)
         {
             AUDDBG ("Activating timer workaround.\n");
@@ -223,6 +554,10 @@ static void * pump (void * unused)
         }
 
         pthread_mutex_lock (& alsa_mutex);
+
+        now = time_ns () - now;
+        alsa_stats.sleep_ns += now;
+        alsa_stats.max_sleep_ns = MAX (alsa_stats.max_sleep_ns, now);
         continue;
 
     FAILED:
@@ -233,6 +568,9 @@ static void * pump (void * unused)
         CHECK (snd_pcm_prepare, alsa_handle);
     }
 
+    pump_running = 0;
+    pthread_cond_broadcast (& alsa_cond); /* signal no longer running */
+
     pthread_mutex_unlock (& alsa_mutex);
     return NULL;
 }
@@ -240,6 +578,7 @@ static void * pump (void * unused)
 static void pump_start (void)
 {
     AUDDBG ("Starting pump.\n");
+    pump_running = 1;
     pthread_create (& pump_thread, NULL, pump, NULL);
     pthread_cond_wait (& alsa_cond, & alsa_mutex);
 }
@@ -253,16 +592,33 @@ static void pump_stop (void)
     pthread_mutex_unlock (& alsa_mutex);
     pthread_join (pump_thread, NULL);
     pthread_mutex_lock (& alsa_mutex);
-    pump_quit = 0;
+    pump_quit = pump_hold = pump_held = 0;
 }
 
-static void start_playback (void)
+/* Keeps the pump off the ALSA handle without ending the thread, so that its
+ * priority and CPU affinity need not be set up again. */
+static void pump_park (void)
 {
-    AUDDBG ("Starting playback.\n");
-    CHECK (snd_pcm_prepare, alsa_handle);
+    pump_hold = 1;
+    pthread_cond_broadcast (& alsa_cond);
+    poll_wake ();
+
+    while (pump_running && ! pump_held)
+        pthread_cond_wait (& alsa_cond, & alsa_mutex);
+}
+
+static void pump_unpark (void)
+{
+    pump_hold = 0;
+
+    /* a pump that gave up after repeated errors is started afresh */
+    if (! pump_running)
+    {
+        pump_stop ();
+        pump_start ();
+        return;
+    }
 
-FAILED:
-    alsa_prebuffer = 0;
     pthread_cond_broadcast (& alsa_cond);
 }
 
@@ -272,10 +628,30 @@ static int get_delay (void)
 
     CHECK_RECOVER (snd_pcm_delay, alsa_handle, & delay);
 
+    alsa_stats.delay_samples ++;
+    alsa_stats.delay_total += delay;
+    alsa_stats.max_delay = MAX (alsa_stats.max_delay, delay);
+
 FAILED:
     return delay;
 }
 
+static void start_playback (void)
+{
+    AUDDBG ("Starting playback.\n");
+
+    /* In mmap mode the buffer is already prepared and may hold data. */
+    if (! alsa_mmap)
+        CHECK (snd_pcm_prepare, alsa_handle);
+    else if (snd_pcm_state (alsa_handle) == SND_PCM_STATE_PREPARED &&
+     get_delay () > 0)
+        CHECK (snd_pcm_start, alsa_handle);
+
+FAILED:
+    alsa_prebuffer = 0;
+    pthread_cond_broadcast (& alsa_cond);
+}
+
 int alsa_init (void)
 {
     AUDDBG ("Initialize.\n");
@@ -291,38 +667,90 @@ void alsa_cleanup (void)
     alsa_config_save ();
 }
 
+static const struct
+{
+    int aud_format, format;
+}
+format_table[] =
+{
+    {FMT_FLOAT, SND_PCM_FORMAT_FLOAT},
+    {FMT_S8, SND_PCM_FORMAT_S8},
+    {FMT_U8, SND_PCM_FORMAT_U8},
+    {FMT_S16_LE, SND_PCM_FORMAT_S16_LE},
+    {FMT_S16_BE, SND_PCM_FORMAT_S16_BE},
+    {FMT_U16_LE, SND_PCM_FORMAT_U16_LE},
+    {FMT_U16_BE, SND_PCM_FORMAT_U16_BE},
+    {FMT_S24_LE, SND_PCM_FORMAT_S24_LE},
+    {FMT_S24_BE, SND_PCM_FORMAT_S24_BE},
+    {FMT_U24_LE, SND_PCM_FORMAT_U24_LE},
+    {FMT_U24_BE, SND_PCM_FORMAT_U24_BE},
+    {FMT_S32_LE, SND_PCM_FORMAT_S32_LE},
+    {FMT_S32_BE, SND_PCM_FORMAT_S32_BE},
+    {FMT_U32_LE, SND_PCM_FORMAT_U32_LE},
+    {FMT_U32_BE, SND_PCM_FORMAT_U32_BE},
+};
+
 static int convert_aud_format (int aud_format)
 {
-    const struct
+    for (int count = 0; count < sizeof format_table / sizeof format_table[0]; count ++)
     {
-        int aud_format, format;
+        if (format_table[count].aud_format == aud_format)
+            return format_table[count].format;
     }
-    table[] =
+
+    return SND_PCM_FORMAT_UNKNOWN;
+}
+
+#define DIRECT_OPEN_MODE (SND_PCM_NO_AUTO_RESAMPLE | SND_PCM_NO_AUTO_CHANNELS | \
+ SND_PCM_NO_AUTO_FORMAT)
+
+static const int common_rates[] = {8000, 11025, 16000, 22050, 32000, 44100,
+ 48000, 88200, 96000, 176400, 192000, 352800, 384000};
+
+static void append (char * buf, int size, const char * text)
+{
+    int len = strlen (buf);
+    snprintf (buf + len, size - len, "%s%s", len ? " " : "", text);
+}
+
+/* Lists the formats (of those the core can produce) and the common rates that
+ * the device takes without conversion, e.g. "S16_LE S32_LE @ 44100 48000". */
+static void describe_native (snd_pcm_hw_params_t * params, char * buf, int size)
+{
+    buf[0] = 0;
+
+    for (int i = 0; i < sizeof format_table / sizeof format_table[0]; i ++)
     {
-        {FMT_FLOAT, SND_PCM_FORMAT_FLOAT},
-        {FMT_S8, SND_PCM_FORMAT_S8},
-        {FMT_U8, SND_PCM_FORMAT_U8},
-        {FMT_S16_LE, SND_PCM_FORMAT_S16_LE},
-        {FMT_S16_BE, SND_PCM_FORMAT_S16_BE},
-        {FMT_U16_LE, SND_PCM_FORMAT_U16_LE},
-        {FMT_U16_BE, SND_PCM_FORMAT_U16_BE},
-        {FMT_S24_LE, SND_PCM_FORMAT_S24_LE},
-        {FMT_S24_BE, SND_PCM_FORMAT_S24_BE},
-        {FMT_U24_LE, SND_PCM_FORMAT_U24_LE},
-        {FMT_U24_BE, SND_PCM_FORMAT_U24_BE},
-        {FMT_S32_LE, SND_PCM_FORMAT_S32_LE},
-        {FMT_S32_BE, SND_PCM_FORMAT_S32_BE},
-        {FMT_U32_LE, SND_PCM_FORMAT_U32_LE},
-        {FMT_U32_BE, SND_PCM_FORMAT_U32_BE},
-    };
+        if (! snd_pcm_hw_params_test_format (alsa_handle, params, format_table[i].format))
+            append (buf, size, snd_pcm_format_name (format_table[i].format));
+    }
 
-    for (int count = 0; count < sizeof table / sizeof table[0]; count ++)
+    append (buf, size, "@");
+
+    for (int i = 0; i < sizeof common_rates / sizeof common_rates[0]; i ++)
     {
-        if (table[count].aud_format == aud_format)
-            return table[count].format;
+        if (! snd_pcm_hw_params_test_rate (alsa_handle, params, common_rates[i], 0))
+        {
+            SPRINTF (rate_s, "%d", common_rates[i]);
+            append (buf, size, rate_s);
+        }
     }
+}
 
-    return SND_PCM_FORMAT_UNKNOWN;
+/* Publishes the rate nearest the stream's that the device takes without ALSA
+ * converting it, which behind "default" is usually the fixed rate of dmix. */
+static void publish_native_rate (snd_pcm_hw_params_t * params, int rate)
+{
+    snd_pcm_hw_params_t * test;
+    snd_pcm_hw_params_alloca (& test);
+    snd_pcm_hw_params_copy (test, params);
+
+    unsigned int native = rate;
+    int direction = 0;
+
+    if (! snd_pcm_hw_params_set_rate_resample (alsa_handle, test, 0) &&
+     ! snd_pcm_hw_params_set_rate_near (alsa_handle, test, & native, & direction))
+        ratepref_set_native (native);
 }
 
 int alsa_open_audio (int aud_format, int rate, int channels)
@@ -332,16 +760,52 @@ int alsa_open_audio (int aud_format, int rate, int channels)
     assert (alsa_handle == NULL);
 
     int format = convert_aud_format (aud_format);
-    AUDDBG ("Opening PCM device %s for %s, %d channels, %d Hz.\n",
-     alsa_config_pcm, snd_pcm_format_name (format), channels, rate);
-    CHECK_NOISY (snd_pcm_open, & alsa_handle, alsa_config_pcm,
-     SND_PCM_STREAM_PLAYBACK, 0);
+    int mode = alsa_config_direct ? DIRECT_OPEN_MODE : 0;
+    char native[sizeof alsa_stats.native] = "";
 
     snd_pcm_hw_params_t * params;
     snd_pcm_hw_params_alloca (& params);
+
+RETRY:
+    AUDDBG ("Opening PCM device %s for %s, %d channels, %d Hz%s.\n",
+     alsa_config_pcm, snd_pcm_format_name (format), channels, rate,
+     mode ? " without conversion" : "");
+    CHECK_NOISY (snd_pcm_open, & alsa_handle, alsa_config_pcm,
+     SND_PCM_STREAM_PLAYBACK, mode);
+
     CHECK_NOISY (snd_pcm_hw_params_any, alsa_handle, params);
-    CHECK_NOISY (snd_pcm_hw_params_set_access, alsa_handle, params,
-     SND_PCM_ACCESS_RW_INTERLEAVED);
+
+    publish_native_rate (params, rate);
+
+    if (mode)
+    {
+        snd_pcm_hw_params_set_rate_resample (alsa_handle, params, 0);
+        describe_native (params, native, sizeof native);
+
+        if (snd_pcm_hw_params_test_format (alsa_handle, params, format) ||
+         snd_pcm_hw_params_test_channels (alsa_handle, params, channels) ||
+         snd_pcm_hw_params_test_rate (alsa_handle, params, rate, 0))
+        {
+            ERROR ("%s cannot play %s, %d channels, %d Hz without conversion "
+             "(it takes %s); opening it normally.\n", alsa_config_pcm,
+             snd_pcm_format_name (format), channels, rate, native);
+
+            snd_pcm_close (alsa_handle);
+            alsa_handle = NULL;
+            mode = 0;
+            goto RETRY;
+        }
+    }
+
+    alsa_mmap = alsa_config_mmap && ! snd_pcm_hw_params_set_access
+     (alsa_handle, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+
+    if (alsa_config_mmap && ! alsa_mmap)
+        AUDDBG ("No mmap access; using read/write transfers.\n");
+
+    if (! alsa_mmap)
+        CHECK_NOISY (snd_pcm_hw_params_set_access, alsa_handle, params,
+         SND_PCM_ACCESS_RW_INTERLEAVED);
 
     CHECK_NOISY (snd_pcm_hw_params_set_format, alsa_handle, params, format);
     CHECK_NOISY (snd_pcm_hw_params_set_channels, alsa_handle, params, channels);
@@ -351,31 +815,68 @@ int alsa_open_audio (int aud_format, int rate, int channels)
     alsa_channels = channels;
     alsa_rate = rate;
 
+    /* In mmap mode, the hardware buffer is all the buffering there is. */
     int total_buffer = aud_get_int (NULL, "output_buffer_size");
-    unsigned int useconds = 1000 * MIN (1000, total_buffer / 2);
+    unsigned int useconds = 1000 * MIN (1000, alsa_mmap ? total_buffer :
+     total_buffer / 2);
     int direction = 0;
     CHECK_NOISY (snd_pcm_hw_params_set_buffer_time_near, alsa_handle, params,
      & useconds, & direction);
     int hard_buffer = useconds / 1000;
 
-    useconds = 1000 * (hard_buffer / 4);
     direction = 0;
-    CHECK_NOISY (snd_pcm_hw_params_set_period_time_near, alsa_handle, params,
-     & useconds, & direction);
-    alsa_period = useconds / 1000;
+
+    if (alsa_config_period_count > 0 && alsa_config_period_time <= 0)
+    {
+        unsigned int periods = alsa_config_period_count;
+        CHECK_NOISY (snd_pcm_hw_params_set_periods_near, alsa_handle, params,
+         & periods, & direction);
+    }
+    else
+    {
+        useconds = 1000 * ((alsa_config_period_time > 0) ?
+         alsa_config_period_time : hard_buffer / 4);
+        CHECK_NOISY (snd_pcm_hw_params_set_period_time_near, alsa_handle,
+         params, & useconds, & direction);
+    }
 
     CHECK_NOISY (snd_pcm_hw_params, alsa_handle, params);
 
+    CHECK_NOISY (snd_pcm_hw_params_get_buffer_size, params, & alsa_hw_frames);
+    CHECK_NOISY (snd_pcm_hw_params_get_period_size, params,
+     & alsa_period_frames, & direction);
+    alsa_period = alsa_period_frames * 1000 / rate;
+
     int soft_buffer = MAX (total_buffer / 2, total_buffer - hard_buffer);
     AUDDBG ("Buffer: hardware %d ms, software %d ms, period %d ms.\n",
      hard_buffer, soft_buffer, alsa_period);
 
+    /* It must hold anything alsa_buffer_free may report in mmap mode. */
+    if (alsa_mmap)
+        soft_buffer = MAX (soft_buffer, hard_buffer + alsa_period);
+
     alsa_buffer_length = snd_pcm_frames_to_bytes (alsa_handle, (int64_t)
      soft_buffer * rate / 1000);
     alsa_buffer = malloc (alsa_buffer_length);
     alsa_buffer_data_start = 0;
     alsa_buffer_data_length = 0;
 
+    memset (& alsa_stats, 0, sizeof alsa_stats);
+    alsa_stats.rate = rate;
+    alsa_stats.hard_buffer = hard_buffer;
+    alsa_stats.soft_buffer = soft_buffer;
+    alsa_stats.period = alsa_period;
+    alsa_stats.mmap = alsa_mmap;
+    alsa_stats.direct = (mode != 0);
+    strcpy (alsa_stats.native, native);
+
+    alsa_latency = alsa_hw_frames;
+    alsa_stats.latency = hard_buffer;
+    latency_xruns = 0;
+
+    if (alsa_config_low_latency && alsa_learned_latency)
+        set_latency ((int64_t) alsa_learned_latency * rate / 1000);
+
     alsa_written = 0;
     alsa_prebuffer = 1;
     alsa_paused = 0;
@@ -416,21 +917,116 @@ FAILED:
     snd_pcm_close (alsa_handle);
     alsa_handle = NULL;
 
+    alsa_learned_latency = alsa_config_low_latency ? alsa_stats.latency : 0;
+
+    AlsaStats stats = alsa_stats;
     pthread_mutex_unlock (& alsa_mutex);
+
+    stats_write (& stats);
+}
+
+static char can_write_direct (void)
+{
+    return alsa_mmap && ! alsa_paused && ! alsa_buffer_data_length;
+}
+
+static int buffer_free_locked (void)
+{
+    if (alsa_mmap && ! alsa_paused)
+    {
+        if (alsa_buffer_data_length)
+            return 0;
+
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (alsa_handle);
+
+        if (avail < 0 && ! snd_pcm_recover (alsa_handle, avail, 1))
+            avail = snd_pcm_avail_update (alsa_handle);
+
+        /* if ALSA is in trouble, let the pump deal with it */
+        if (avail < 0)
+            return alsa_buffer_length;
+
+        avail = limit_avail (avail);
+
+        return snd_pcm_frames_to_bytes (alsa_handle, avail);
+    }
+
+    return alsa_buffer_length - alsa_buffer_data_length;
 }
 
 int alsa_buffer_free (void)
 {
     pthread_mutex_lock (& alsa_mutex);
-    int avail = alsa_buffer_length - alsa_buffer_data_length;
+    int avail = buffer_free_locked ();
     pthread_mutex_unlock (& alsa_mutex);
     return avail;
 }
 
+/* Copies as much as fits into the hardware buffer; returns bytes written. */
+static int write_direct (const void * data, int length)
+{
+    int frames = snd_pcm_bytes_to_frames (alsa_handle, length);
+    int done = 0;
+
+    while (done < frames)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (alsa_handle);
+
+        if (avail < 0 && ! snd_pcm_recover (alsa_handle, avail, 1))
+            avail = snd_pcm_avail_update (alsa_handle);
+
+        avail = limit_avail (avail);
+
+        if (avail <= 0)
+            break;
+
+        const snd_pcm_channel_area_t * areas;
+        snd_pcm_uframes_t offset, count = MIN (frames - done, avail);
+
+        if (snd_pcm_mmap_begin (alsa_handle, & areas, & offset, & count) < 0 ||
+         ! count)
+            break;
+
+        /* interleaved: all channels share one area */
+        memcpy ((char *) areas[0].addr + (areas[0].first + offset *
+         areas[0].step) / 8, (const char *) data + snd_pcm_frames_to_bytes
+         (alsa_handle, done), snd_pcm_frames_to_bytes (alsa_handle, count));
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit (alsa_handle, offset,
+         count);
+
+        if (committed <= 0)
+            break;
+
+        done += committed;
+    }
+
+    /* after an underrun, the stream has to be restarted by hand */
+    if (done && ! alsa_prebuffer && snd_pcm_state (alsa_handle) ==
+     SND_PCM_STATE_PREPARED)
+        snd_pcm_start (alsa_handle);
+
+    return snd_pcm_frames_to_bytes (alsa_handle, done);
+}
+
 void alsa_write_audio (void * data, int length)
 {
     pthread_mutex_lock (& alsa_mutex);
 
+    alsa_written += snd_pcm_bytes_to_frames (alsa_handle, length);
+
+    if (can_write_direct ())
+    {
+        int done = write_direct (data, length);
+        if (done)
+            count_write (snd_pcm_bytes_to_frames (alsa_handle, done));
+        data = (char *) data + done;
+        length -= done;
+    }
+
+    if (! length)
+        goto DONE;
+
     int start = (alsa_buffer_data_start + alsa_buffer_data_length) %
      alsa_buffer_length;
 
@@ -447,11 +1043,11 @@ void alsa_write_audio (void * data, int length)
         memcpy ((char *) alsa_buffer + start, data, length);
 
     alsa_buffer_data_length += length;
-    alsa_written += snd_pcm_bytes_to_frames (alsa_handle, length);
 
     if (! alsa_paused)
         pthread_cond_broadcast (& alsa_cond);
 
+DONE:
     pthread_mutex_unlock (& alsa_mutex);
 }
 
@@ -459,7 +1055,7 @@ void alsa_period_wait (void)
 {
     pthread_mutex_lock (& alsa_mutex);
 
-    while (alsa_buffer_data_length == alsa_buffer_length)
+    while (! buffer_free_locked ())
     {
         if (! alsa_paused)
         {
@@ -469,7 +1065,20 @@ void alsa_period_wait (void)
                 pthread_cond_broadcast (& alsa_cond);
         }
 
-        pthread_cond_wait (& alsa_cond, & alsa_mutex);
+        /* Waiting for the hardware to make room: the pump is idle, and
+         * polling ALSA from this thread would race with it, so just sleep
+         * for a while. */
+        if (can_write_direct () && ! alsa_prebuffer)
+        {
+            const struct timespec delay = {.tv_sec = 0, .tv_nsec = 500000 *
+             alsa_period};
+
+            pthread_mutex_unlock (& alsa_mutex);
+            nanosleep (& delay, NULL);
+            pthread_mutex_lock (& alsa_mutex);
+        }
+        else
+            pthread_cond_wait (& alsa_cond, & alsa_mutex);
     }
 
     pthread_mutex_unlock (& alsa_mutex);
@@ -488,7 +1097,7 @@ void alsa_drain (void)
     while (snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer_data_length))
         pthread_cond_wait (& alsa_cond, & alsa_mutex);
 
-    pump_stop ();
+    pump_park ();
 
     if (alsa_config_drain_workaround)
     {
@@ -517,7 +1126,7 @@ void alsa_drain (void)
         }
     }
 
-    pump_start ();
+    pump_unpark ();
 
 FAILED:
     pthread_mutex_unlock (& alsa_mutex);
@@ -531,7 +1140,8 @@ int alsa_output_time (void)
     int64_t frames = alsa_written - snd_pcm_bytes_to_frames (alsa_handle,
      alsa_buffer_data_length);
 
-    if (alsa_prebuffer || alsa_paused)
+    /* in mmap mode, prebuffered data is already in the hardware buffer */
+    if ((alsa_prebuffer && ! alsa_mmap) || alsa_paused)
         frames -= alsa_paused_delay;
     else
         frames -= get_delay ();
@@ -547,9 +1157,12 @@ void alsa_flush (int time)
     AUDDBG ("Seek requested; discarding buffer.\n");
     pthread_mutex_lock (& alsa_mutex);
 
-    pump_stop ();
+    pump_park ();
     CHECK (snd_pcm_drop, alsa_handle);
 
+    if (alsa_mmap)
+        CHECK (snd_pcm_prepare, alsa_handle);
+
 FAILED:
     alsa_buffer_data_start = 0;
     alsa_buffer_data_length = 0;
@@ -560,7 +1173,7 @@ FAILED:
 
     pthread_cond_broadcast (& alsa_cond); /* interrupt period wait */
 
-    pump_start ();
+    pump_unpark ();
 
     pthread_mutex_unlock (& alsa_mutex);
 }
@@ -579,6 +1192,8 @@ void alsa_pause (int pause)
 
         CHECK (snd_pcm_pause, alsa_handle, pause);
     }
+    else if (alsa_mmap && pause)
+        alsa_paused_delay = get_delay ();
 
 DONE:
     if (! pause)
@@ -20,6 +20,7 @@
 #ifndef AUDACIOUS_ALSA_H
 #define AUDACIOUS_ALSA_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <audacious/misc.h>
 
@@ -54,6 +55,21 @@ do { \
     } \
 } while (0)
 
+/* Counters kept by the output since the device was last opened. */
+typedef struct {
+    int rate, hard_buffer, soft_buffer, period; /* Hz, milliseconds */
+    char mmap;
+    char direct; /* opened without conversion by ALSA */
+    char native[256]; /* formats and rates the device takes without it */
+    int latency; /* limit on hardware buffer fill, milliseconds */
+
+    int64_t recoveries, xruns; /* calls to snd_pcm_recover, underruns among them */
+    int64_t wakeups, idle_wakeups; /* pump checks of snd_pcm_avail_update */
+    int64_t writes, frames_written, max_write; /* frames */
+    int64_t sleep_ns, max_sleep_ns; /* pump blocked waiting for ALSA */
+    int64_t delay_samples, delay_total, max_delay; /* frames */
+} AlsaStats;
+
 /* alsa.c */
 int alsa_init (void);
 void alsa_cleanup (void);
@@ -70,11 +86,16 @@ void alsa_open_mixer (void);
 void alsa_close_mixer (void);
 void alsa_get_volume (int * left, int * right);
 void alsa_set_volume (int left, int right);
+void alsa_get_stats (AlsaStats * stats);
 
 /* config.c */
-extern char * alsa_config_pcm, * alsa_config_mixer, * alsa_config_mixer_element;
+extern char * alsa_config_pcm, * alsa_config_mixer, * alsa_config_mixer_element,
+ * alsa_config_stats_file, * alsa_config_realtime_policy,
+ * alsa_config_cpu_affinity;
 extern int alsa_config_drop_workaround, alsa_config_drain_workaround,
- alsa_config_delay_workaround;
+ alsa_config_delay_workaround, alsa_config_mmap, alsa_config_realtime,
+ alsa_config_realtime_priority, alsa_config_period_count,
+ alsa_config_period_time, alsa_config_low_latency, alsa_config_direct;
 
 void alsa_config_load (void);
 void alsa_config_save (void);
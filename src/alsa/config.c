@@ -27,12 +27,17 @@
 
 #include "alsa.h"
 char * alsa_config_pcm = NULL, * alsa_config_mixer = NULL,
- * alsa_config_mixer_element = NULL;
-int alsa_config_drain_workaround = 1;
+ * alsa_config_mixer_element = NULL, * alsa_config_stats_file = NULL,
+ * alsa_config_realtime_policy = NULL, * alsa_config_cpu_affinity = NULL;
+int alsa_config_drain_workaround = 1, alsa_config_mmap = 0,
+ alsa_config_realtime = 0, alsa_config_realtime_priority = 10,
+ alsa_config_period_count = 0, alsa_config_period_time = 0,
+ alsa_config_low_latency = 0, alsa_config_direct = 0;
 
 static GtkListStore * pcm_list, * mixer_list, * mixer_element_list;
 static GtkWidget * window, * pcm_combo, * mixer_combo, * mixer_element_combo,
- * drain_workaround_check;
+ * drain_workaround_check, * mmap_check, * realtime_check, * low_latency_check,
+ * direct_check;
 
 static GtkTreeIter * list_lookup_member (GtkListStore * list, const char * text)
 {
@@ -314,6 +319,18 @@ static const gchar * const alsa_defaults[] = {
  "pcm", "default",
  "mixer", "default",
  "drain-workaround", "TRUE",
+ "mmap", "FALSE",
+ "realtime", "FALSE",
+ "low-latency", "FALSE",
+ "direct", "FALSE",
+
+ /* no dialog entries for these; see alsa.c */
+ "stats-file", "",
+ "realtime-policy", "fifo",
+ "realtime-priority", "10",
+ "cpu-affinity", "",
+ "period-count", "0",
+ "period-time", "0",
  NULL};
 
 void alsa_config_load (void)
@@ -324,6 +341,16 @@ void alsa_config_load (void)
     alsa_config_mixer = aud_get_string ("alsa", "mixer");
     alsa_config_mixer_element = aud_get_string ("alsa", "mixer-element");
     alsa_config_drain_workaround = aud_get_bool ("alsa", "drain-workaround");
+    alsa_config_mmap = aud_get_bool ("alsa", "mmap");
+    alsa_config_realtime = aud_get_bool ("alsa", "realtime");
+    alsa_config_low_latency = aud_get_bool ("alsa", "low-latency");
+    alsa_config_direct = aud_get_bool ("alsa", "direct");
+    alsa_config_stats_file = aud_get_string ("alsa", "stats-file");
+    alsa_config_realtime_policy = aud_get_string ("alsa", "realtime-policy");
+    alsa_config_realtime_priority = aud_get_int ("alsa", "realtime-priority");
+    alsa_config_cpu_affinity = aud_get_string ("alsa", "cpu-affinity");
+    alsa_config_period_count = aud_get_int ("alsa", "period-count");
+    alsa_config_period_time = aud_get_int ("alsa", "period-time");
 
     if (! alsa_config_mixer_element[0])
         guess_mixer_element ();
@@ -353,6 +380,11 @@ void alsa_config_save (void)
     aud_set_string ("alsa", "mixer", alsa_config_mixer);
     aud_set_string ("alsa", "mixer-element", alsa_config_mixer_element);
     aud_set_bool ("alsa", "drain-workaround", alsa_config_drain_workaround);
+    aud_set_bool ("alsa", "mmap", alsa_config_mmap);
+    aud_set_bool ("alsa", "realtime", alsa_config_realtime);
+    aud_set_bool ("alsa", "low-latency", alsa_config_low_latency);
+    aud_set_bool ("alsa", "direct", alsa_config_direct);
+    aud_set_string ("alsa", "stats-file", alsa_config_stats_file);
 
     free (alsa_config_pcm);
     alsa_config_pcm = NULL;
@@ -360,6 +392,12 @@ void alsa_config_save (void)
     alsa_config_mixer = NULL;
     free (alsa_config_mixer_element);
     alsa_config_mixer_element = NULL;
+    free (alsa_config_stats_file);
+    alsa_config_stats_file = NULL;
+    free (alsa_config_realtime_policy);
+    alsa_config_realtime_policy = NULL;
+    free (alsa_config_cpu_affinity);
+    alsa_config_cpu_affinity = NULL;
 }
 
 static GtkWidget * combo_new (const char * title, GtkListStore * list,
@@ -444,6 +482,30 @@ static void create_window (void)
      alsa_config_drain_workaround);
     gtk_box_pack_start ((GtkBox *) vbox, drain_workaround_check, 0, 0, 0);
 
+    mmap_check = gtk_check_button_new_with_label (_("Write directly to the "
+     "hardware buffer (mmap)"));
+    gtk_toggle_button_set_active ((GtkToggleButton *) mmap_check,
+     alsa_config_mmap);
+    gtk_box_pack_start ((GtkBox *) vbox, mmap_check, 0, 0, 0);
+
+    realtime_check = gtk_check_button_new_with_label (_("Run output thread "
+     "with real-time priority"));
+    gtk_toggle_button_set_active ((GtkToggleButton *) realtime_check,
+     alsa_config_realtime);
+    gtk_box_pack_start ((GtkBox *) vbox, realtime_check, 0, 0, 0);
+
+    low_latency_check = gtk_check_button_new_with_label (_("Reduce latency "
+     "while playback runs without underruns"));
+    gtk_toggle_button_set_active ((GtkToggleButton *) low_latency_check,
+     alsa_config_low_latency);
+    gtk_box_pack_start ((GtkBox *) vbox, low_latency_check, 0, 0, 0);
+
+    direct_check = gtk_check_button_new_with_label (_("Bit-perfect output "
+     "(no format or rate conversion by ALSA)"));
+    gtk_toggle_button_set_active ((GtkToggleButton *) direct_check,
+     alsa_config_direct);
+    gtk_box_pack_start ((GtkBox *) vbox, direct_check, 0, 0, 0);
+
     gtk_widget_show_all (window);
 }
 
@@ -500,6 +562,13 @@ static void boolean_toggled (GtkToggleButton * button, void * data)
     * (int *) data = gtk_toggle_button_get_active (button);
 }
 
+/* for settings that only take effect when the device is reopened */
+static void reopen_toggled (GtkToggleButton * button, void * data)
+{
+    * (int *) data = gtk_toggle_button_get_active (button);
+    aud_output_reset (OUTPUT_RESET_SOFT);
+}
+
 static void connect_callbacks (void)
 {
     g_signal_connect ((GObject *) pcm_combo, "changed", (GCallback) pcm_changed,
@@ -510,6 +579,14 @@ static void connect_callbacks (void)
      mixer_element_changed, NULL);
     g_signal_connect ((GObject *) drain_workaround_check, "toggled", (GCallback)
      boolean_toggled, & alsa_config_drain_workaround);
+    g_signal_connect ((GObject *) mmap_check, "toggled", (GCallback)
+     reopen_toggled, & alsa_config_mmap);
+    g_signal_connect ((GObject *) realtime_check, "toggled", (GCallback)
+     reopen_toggled, & alsa_config_realtime);
+    g_signal_connect ((GObject *) low_latency_check, "toggled", (GCallback)
+     reopen_toggled, & alsa_config_low_latency);
+    g_signal_connect ((GObject *) direct_check, "toggled", (GCallback)
+     reopen_toggled, & alsa_config_direct);
     g_signal_connect ((GObject *) window, "response", (GCallback)
      gtk_widget_destroy, window);
     g_signal_connect ((GObject *) window, "destroy", (GCallback)
@@ -21,12 +21,47 @@
 #include <audacious/plugin.h>
 
 #include "alsa.h"
+#include "../perfstat/perfstat.h"
+
 static const char alsa_about[] =
  N_("ALSA Output Plugin for Audacious\n"
     "Copyright 2009-2012 John Lindgren\n\n"
     "My thanks to William Pitcock, author of the ALSA Output Plugin NG, whose "
     "code served as a reference when the ALSA manual was not enough.");
 
+static PerfStatOutput perfstat = PERFSTAT_OUTPUT_INIT (N_("ALSA Output"));
+
+static int timed_open_audio (int format, int rate, int channels)
+{
+    if (! alsa_open_audio (format, rate, channels))
+        return 0;
+
+    perfstat_output_open (& perfstat, FMT_SIZEOF (format) * channels * rate);
+    return 1;
+}
+
+static void timed_write_audio (void * data, int length)
+{
+    perfstat_output_write (& perfstat, alsa_write_audio (data, length), length);
+}
+
+static void timed_period_wait (void)
+{
+    perfstat_output_wait (& perfstat, alsa_period_wait ());
+}
+
+static void timed_flush (int time)
+{
+    alsa_flush (time);
+    perfstat_output_idle (& perfstat);
+}
+
+static void timed_pause (int pause)
+{
+    alsa_pause (pause);
+    perfstat_output_idle (& perfstat);
+}
+
 AUD_OUTPUT_PLUGIN
 (
     .name = N_("ALSA Output"),
@@ -35,15 +70,15 @@ AUD_OUTPUT_PLUGIN
     .probe_priority = 5,
     .init = alsa_init,
     .cleanup = alsa_cleanup,
-    .open_audio = alsa_open_audio,
+    .open_audio = timed_open_audio,
     .close_audio = alsa_close_audio,
     .buffer_free = alsa_buffer_free,
-    .write_audio = alsa_write_audio,
-    .period_wait = alsa_period_wait,
+    .write_audio = timed_write_audio,
+    .period_wait = timed_period_wait,
     .drain = alsa_drain,
     .output_time = alsa_output_time,
-    .flush = alsa_flush,
-    .pause = alsa_pause,
+    .flush = timed_flush,
+    .pause = timed_pause,
     .set_volume = alsa_set_volume,
     .get_volume = alsa_get_volume,
     .configure = alsa_configure,
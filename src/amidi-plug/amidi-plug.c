@@ -32,6 +32,7 @@
 #include "i_fileinfo.h"
 #include "i_midi.h"
 #include "i_utils.h"
+#include "../warmup/warmup.h"
 
 enum
 {
@@ -65,6 +66,17 @@ static pthread_mutex_t audio_control_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* also used in i_configure.c */
 amidiplug_sequencer_backend_t * backend;
 
+/* Loading a backend can mean loading a SoundFont of some size, so it is done
+ * in the background (see warmup.h); backend is not to be touched without
+ * waiting for backend_warmup first.  Also used in i_configure.c. */
+static void amidiplug_load_backend (void)
+{
+    backend = i_backend_load (amidiplug_cfg_ap->ap_seq_backend);
+}
+
+Warmup backend_warmup = WARMUP_INIT (N_("AMIDI-Plug (MIDI Player)"),
+ amidiplug_load_backend);
+
 static int seek_time;
 
 static pthread_t audio_thread;
@@ -75,8 +87,12 @@ static volatile int current_time = -1;
 
 static void amidiplug_cleanup (void)
 {
+    warmup_stop (& backend_warmup);
+
     if (backend)
-        i_backend_unload (backend);
+        i_backend_unload (backend, FALSE);
+
+    backend = NULL;
 
     i_configure_cfg_ap_free ();
     i_configure_cfg_backend_free ();
@@ -84,17 +100,13 @@ static void amidiplug_cleanup (void)
 
 static bool_t amidiplug_init (void)
 {
+    int64_t init_begin = perfstat_now ();
+
     i_configure_cfg_ap_read ();
     i_configure_cfg_backend_read ();
 
-    backend = i_backend_load (amidiplug_cfg_ap->ap_seq_backend);
-
-    if (! backend)
-    {
-        amidiplug_cleanup ();
-        return FALSE;
-    }
-
+    /* a backend that fails to load is reported when playback is tried */
+    warmup_start (& backend_warmup, init_begin);
     return TRUE;
 }
 
@@ -167,7 +179,9 @@ static int amidiplug_get_time (InputPlayback * playback)
 
 static int amidiplug_get_volume (int * l_p, int * r_p)
 {
-    if (backend->autonomous_audio == TRUE)
+    warmup_wait (& backend_warmup);
+
+    if (backend && backend->autonomous_audio == TRUE)
     {
         backend->audio_volume_get (l_p, r_p);
         return 1;
@@ -179,7 +193,9 @@ static int amidiplug_get_volume (int * l_p, int * r_p)
 
 static int amidiplug_set_volume (int  l, int  r)
 {
-    if (backend->autonomous_audio == TRUE)
+    warmup_wait (& backend_warmup);
+
+    if (backend && backend->autonomous_audio == TRUE)
     {
         backend->audio_volume_set (l, r);
         return 1;
@@ -213,7 +229,9 @@ static bool_t amidiplug_play (InputPlayback * playback, const char *
     int port_count = 0;
     int au_samplerate = -1, au_bitdepth = -1, au_channels = -1;
 
-    if (backend->gmodule == NULL)
+    warmup_wait (& backend_warmup);
+
+    if (backend == NULL || backend->gmodule == NULL)
     {
         g_warning ("No sequencer backend selected\n");
         /* not usable, cause now amidiplug_play is in a different thread
@@ -233,7 +251,8 @@ static bool_t amidiplug_play (InputPlayback * playback, const char *
     if (backend->autonomous_audio == FALSE)
     {
         DEBUGMSG ("PLAY requested, opening audio output plugin\n");
-        playback->output->open_audio (FMT_S16_NE, au_samplerate, au_channels);
+        playback->output->open_audio ((au_bitdepth == 32) ? FMT_FLOAT : FMT_S16_NE,
+                                      au_samplerate, au_channels);
     }
 
     DEBUGMSG ("PLAY requested, midifile init\n");
@@ -419,14 +438,12 @@ static void do_pause (bool_t pause)
 
 static void amidiplug_play_loop (InputPlayback * playback)
 {
-    int j = 0;
     bool_t rewind = TRUE, paused = FALSE, stopped = FALSE;
 
     if (rewind)
     {
-        /* initialize current position in each track */
-        for (j = 0; j < midifile.num_tracks; ++j)
-            midifile.tracks[j].current_event = midifile.tracks[j].first_event;
+        /* initialize current position */
+        midifile.current_event = 0;
     }
 
     if (! backend->autonomous_audio)
@@ -442,8 +459,6 @@ static void amidiplug_play_loop (InputPlayback * playback)
     for (;;)
     {
         midievent_t * event = NULL;
-        midifile_track_t * event_track = NULL;
-        int i, min_tick = midifile.max_tick + 1;
 
         pthread_mutex_lock (& control_mutex);
 
@@ -492,25 +507,11 @@ static void amidiplug_play_loop (InputPlayback * playback)
 
         pthread_mutex_unlock (& control_mutex);
 
-        /* search next event */
-        for (i = 0; i < midifile.num_tracks; ++i)
-        {
-            midifile_track_t * track = &midifile.tracks[i];
-            midievent_t * e2 = track->current_event;
-
-            if ((e2) && (e2->tick < min_tick))
-            {
-                min_tick = e2->tick;
-                event = e2;
-                event_track = track;
-            }
-        }
-
-        if (!event)
+        if (midifile.current_event >= midifile.num_events)
             break; /* end of song reached */
 
-        /* advance pointer to next event */
-        event_track->current_event = event->next;
+        /* advance to next event */
+        event = &midifile.events[midifile.current_event++];
         /* consider the midifile.skip_offset */
         event->tick_real = event->tick - midifile.skip_offset;
 
@@ -595,55 +596,169 @@ static void amidiplug_play_loop (InputPlayback * playback)
 }
 
 
-/* amidigplug_skipto: re-do all events that influence the playing of our
-   midi file; re-do them using a time-tick of 0, so they are processed
-   istantaneously and proceed this way until the playing_tick is reached;
-   also obtain the correct skip_offset from the playing_tick */
-static void amidiplug_skipto (int playing_tick)
+/* sends one event while skipping, with a time-tick of 0 so that it is
+   processed istantaneously; notes are not resent */
+static void amidiplug_skipto_event (midievent_t * event)
+{
+    event->tick_real = 0;
+
+    switch (event->type)
+    {
+        /* do nothing for these
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF:
+        case SND_SEQ_EVENT_KEYPRESS:
+        {
+          break;
+        } */
+    case SND_SEQ_EVENT_CONTROLLER:
+        backend->seq_event_controller (event);
+        break;
+
+    case SND_SEQ_EVENT_PGMCHANGE:
+        backend->seq_event_pgmchange (event);
+        break;
+
+    case SND_SEQ_EVENT_CHANPRESS:
+        backend->seq_event_chanpress (event);
+        break;
+
+    case SND_SEQ_EVENT_PITCHBEND:
+        backend->seq_event_pitchbend (event);
+        break;
+
+    case SND_SEQ_EVENT_SYSEX:
+        backend->seq_event_sysex (event);
+        break;
+
+    case SND_SEQ_EVENT_TEMPO:
+        backend->seq_event_tempo (event);
+        midifile.current_tempo = event->data.tempo;
+        break;
+
+    default:
+        return;
+    }
+
+    if (backend->autonomous_audio == TRUE)
+    {
+        /* these backends deal with audio production themselves (i.e. ALSA) */
+        backend->seq_output (NULL, NULL);
+    }
+}
+
+
+/* restores the state recorded in a snapshot: first the sysex and (N)RPN
+   events before it, in order, then each channel's controllers, program,
+   pressure and pitch bend, then the tempo */
+static void amidiplug_skipto_snapshot (midifile_snapshot_t * snap)
 {
-    int i;
+    midievent_t event;
+    int i, port, channel;
+
+    for (i = 0; i < midifile.num_replay && midifile.replay[i] < snap->event; ++i)
+        amidiplug_skipto_event (&midifile.events[midifile.replay[i]]);
+
+    memset (&event, 0, sizeof (midievent_t));
+
+    for (port = 0; port < midifile.port_count; ++port)
+    {
+        for (channel = 0; channel < 16; ++channel)
+        {
+            unsigned char * state = snap->state + (port * 16 + channel) * MIDI_CHANNEL_STATE;
+
+            event.port = port;
+            event.data.d[0] = channel;
+
+            /* controllers first, so bank selects precede the program */
+            event.type = SND_SEQ_EVENT_CONTROLLER;
+
+            for (i = 0; i < 128; ++i)
+            {
+                if (state[i] == MIDI_STATE_UNSET)
+                    continue;
+
+                event.data.d[1] = i;
+                event.data.d[2] = state[i];
+                amidiplug_skipto_event (&event);
+            }
+
+            if (state[MIDI_STATE_PROGRAM] != MIDI_STATE_UNSET)
+            {
+                event.type = SND_SEQ_EVENT_PGMCHANGE;
+                event.data.d[1] = state[MIDI_STATE_PROGRAM];
+                amidiplug_skipto_event (&event);
+            }
+
+            if (state[MIDI_STATE_CHANPRESS] != MIDI_STATE_UNSET)
+            {
+                event.type = SND_SEQ_EVENT_CHANPRESS;
+                event.data.d[1] = state[MIDI_STATE_CHANPRESS];
+                amidiplug_skipto_event (&event);
+            }
 
+            if (state[MIDI_STATE_PITCHBEND] != MIDI_STATE_UNSET)
+            {
+                event.type = SND_SEQ_EVENT_PITCHBEND;
+                event.data.d[1] = state[MIDI_STATE_PITCHBEND];
+                event.data.d[2] = state[MIDI_STATE_PITCHBEND + 1];
+                amidiplug_skipto_event (&event);
+            }
+        }
+    }
+
+    if (snap->tempo >= 0)
+    {
+        memset (&event, 0, sizeof (midievent_t));
+        event.type = SND_SEQ_EVENT_TEMPO;
+        event.data.tempo = snap->tempo;
+        amidiplug_skipto_event (&event);
+    }
+}
+
+
+/* amidigplug_skipto: restore the state of the midi file at the nearest
+   snapshot before playing_tick, then re-do the events that influence the
+   playing from there on, using a time-tick of 0, until the playing_tick is
+   reached; also obtain the correct skip_offset from the playing_tick */
+static void amidiplug_skipto (int playing_tick)
+{
     /* this check is always made, for safety*/
     if (playing_tick >= midifile.max_tick)
         playing_tick = midifile.max_tick - 1;
 
-    /* initialize current position in each track */
-    for (i = 0; i < midifile.num_tracks; ++i)
-        midifile.tracks[i].current_event = midifile.tracks[i].first_event;
-
     /* common settings for all our events */
     backend->seq_event_init();
     backend->seq_queue_start();
 
-    DEBUGMSG ("SKIPTO request, starting skipto loop\n");
+    i_midi_build_snapshots (&midifile);
 
-    for (;;)
+    if (midifile.num_snapshots > 0)
     {
-        midievent_t * event = NULL;
-        midifile_track_t * event_track = NULL;
-        int i, min_tick = midifile.max_tick + 1;
+        midifile_snapshot_t * snap = &midifile.snapshots[i_midi_find_snapshot (&midifile, playing_tick)];
 
-        /* search next event */
-        for (i = 0; i < midifile.num_tracks; ++i)
-        {
-            midifile_track_t * track = &midifile.tracks[i];
-            midievent_t * e2 = track->current_event;
+        DEBUGMSG ("SKIPTO request, restoring snapshot at event %i\n", snap->event);
+        amidiplug_skipto_snapshot (snap);
+        midifile.current_event = snap->event;
+    }
+    else
+        midifile.current_event = 0;
 
-            if ((e2) && (e2->tick < min_tick))
-            {
-                min_tick = e2->tick;
-                event = e2;
-                event_track = track;
-            }
-        }
+    DEBUGMSG ("SKIPTO request, starting skipto loop\n");
+
+    for (;;)
+    {
+        midievent_t * event;
 
         /* unlikely here... unless very strange MIDI files are played :) */
-        if (!event)
+        if (midifile.current_event >= midifile.num_events)
         {
             DEBUGMSG ("SKIPTO request, reached the last event but not the requested tick (!)\n");
             break; /* end of song reached */
         }
 
+        event = &midifile.events[midifile.current_event];
+
         /* reached the requested tick, job done */
         if (event->tick >= playing_tick)
         {
@@ -651,51 +766,9 @@ static void amidiplug_skipto (int playing_tick)
             break;
         }
 
-        /* advance pointer to next event */
-        event_track->current_event = event->next;
-        /* set the time tick to 0 */
-        event->tick_real = 0;
-
-        switch (event->type)
-        {
-            /* do nothing for these
-            case SND_SEQ_EVENT_NOTEON:
-            case SND_SEQ_EVENT_NOTEOFF:
-            case SND_SEQ_EVENT_KEYPRESS:
-            {
-              break;
-            } */
-        case SND_SEQ_EVENT_CONTROLLER:
-            backend->seq_event_controller (event);
-            break;
-
-        case SND_SEQ_EVENT_PGMCHANGE:
-            backend->seq_event_pgmchange (event);
-            break;
-
-        case SND_SEQ_EVENT_CHANPRESS:
-            backend->seq_event_chanpress (event);
-            break;
-
-        case SND_SEQ_EVENT_PITCHBEND:
-            backend->seq_event_pitchbend (event);
-            break;
-
-        case SND_SEQ_EVENT_SYSEX:
-            backend->seq_event_sysex (event);
-            break;
-
-        case SND_SEQ_EVENT_TEMPO:
-            backend->seq_event_tempo (event);
-            midifile.current_tempo = event->data.tempo;
-            break;
-        }
-
-        if (backend->autonomous_audio == TRUE)
-        {
-            /* these backends deal with audio production themselves (i.e. ALSA) */
-            backend->seq_output (NULL, NULL);
-        }
+        /* advance to next event */
+        midifile.current_event++;
+        amidiplug_skipto_event (event);
     }
 
     midifile.skip_offset = playing_tick;
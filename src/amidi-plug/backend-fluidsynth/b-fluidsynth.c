@@ -21,10 +21,13 @@
 #include <pthread.h>
 #include <string.h>
 
+#include <gmodule.h>
+
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
 
 #include "../i_configure.h"
+#include "../../ratepref/ratepref.h"
 #include "b-fluidsynth.h"
 
 /* sequencer instance */
@@ -59,33 +62,75 @@ int backend_info_get (char ** name, char ** longname, char ** desc, int * ppos)
 }
 
 
+/* keep this module loaded for the life of the player, so that the synth and
+   its SoundFonts in sc survive the backend being unloaded and loaded again
+   (each time the configuration is saved) */
+G_MODULE_EXPORT const gchar * g_module_check_init (GModule * module)
+{
+    g_module_make_resident (module);
+    return NULL;
+}
+
+
+/* the synth renders at any rate, so use the output's if known; it is only
+   given to FluidSynth on creation, so a newly learned rate takes effect the
+   next time the backend is loaded */
+static int synth_rate (void)
+{
+    return ratepref_get (fsyn_cfg->fsyn_synth_samplerate);
+}
+
+
 int backend_init (amidiplug_cfg_backend_t * cfg)
 {
     fsyn_cfg = cfg->fsyn;
 
-    sc.soundfont_ids = g_array_new (FALSE, FALSE, sizeof (int));
-    sc.sample_rate = fsyn_cfg->fsyn_synth_samplerate;
-    sc.settings = new_fluid_settings();
+    /* a synth left by the last backend_cleanup() is reused as it is, with
+       its SoundFonts, unless it was created with different settings */
+    if (sc.synth && ! i_synth_settings_match ())
+        backend_cache_free ();
 
-    fluid_settings_setnum (sc.settings, "synth.sample-rate", fsyn_cfg->fsyn_synth_samplerate);
+    if (! sc.synth)
+    {
+        sc.soundfont_ids = g_array_new (FALSE, FALSE, sizeof (int));
+        sc.sample_rate = synth_rate ();
+        sc.settings = new_fluid_settings();
 
-    if (fsyn_cfg->fsyn_synth_gain != -1)
-        fluid_settings_setnum (sc.settings, "synth.gain", (gdouble) fsyn_cfg->fsyn_synth_gain / 10);
+        fluid_settings_setnum (sc.settings, "synth.sample-rate", sc.sample_rate);
 
-    if (fsyn_cfg->fsyn_synth_polyphony != -1)
-        fluid_settings_setint (sc.settings, "synth.polyphony", fsyn_cfg->fsyn_synth_polyphony);
+        if (fsyn_cfg->fsyn_synth_gain != -1)
+            fluid_settings_setnum (sc.settings, "synth.gain", (gdouble) fsyn_cfg->fsyn_synth_gain / 10);
 
-    if (fsyn_cfg->fsyn_synth_reverb == 1)
-        fluid_settings_setstr (sc.settings, "synth.reverb.active", "yes");
-    else if (fsyn_cfg->fsyn_synth_reverb == 0)
-        fluid_settings_setstr (sc.settings, "synth.reverb.active", "no");
+        if (fsyn_cfg->fsyn_synth_polyphony != -1)
+            fluid_settings_setint (sc.settings, "synth.polyphony", fsyn_cfg->fsyn_synth_polyphony);
 
-    if (fsyn_cfg->fsyn_synth_chorus == 1)
-        fluid_settings_setstr (sc.settings, "synth.chorus.active", "yes");
-    else if (fsyn_cfg->fsyn_synth_chorus == 0)
-        fluid_settings_setstr (sc.settings, "synth.chorus.active", "no");
+        if (fsyn_cfg->fsyn_synth_cpu_cores != -1)
+            fluid_settings_setint (sc.settings, "synth.cpu-cores", fsyn_cfg->fsyn_synth_cpu_cores);
 
-    sc.synth = new_fluid_synth (sc.settings);
+        if (fsyn_cfg->fsyn_synth_parallel_render == 1)
+            fluid_settings_setint (sc.settings, "synth.parallel-render", 1);
+        else if (fsyn_cfg->fsyn_synth_parallel_render == 0)
+            fluid_settings_setint (sc.settings, "synth.parallel-render", 0);
+
+        if (fsyn_cfg->fsyn_synth_reverb == 1)
+            fluid_settings_setstr (sc.settings, "synth.reverb.active", "yes");
+        else if (fsyn_cfg->fsyn_synth_reverb == 0)
+            fluid_settings_setstr (sc.settings, "synth.reverb.active", "no");
+
+        if (fsyn_cfg->fsyn_synth_chorus == 1)
+            fluid_settings_setstr (sc.settings, "synth.chorus.active", "yes");
+        else if (fsyn_cfg->fsyn_synth_chorus == 0)
+            fluid_settings_setstr (sc.settings, "synth.chorus.active", "no");
+
+        sc.synth = new_fluid_synth (sc.settings);
+        sc.synth_cfg = * fsyn_cfg;
+    }
+
+    /* render 10 ms at a time unless told otherwise */
+    if (fsyn_cfg->fsyn_render_block > 0)
+        sc.block_frames = fsyn_cfg->fsyn_render_block;
+    else
+        sc.block_frames = sc.sample_rate / 100;
 
     /* soundfont loader, check if we should load soundfont on backend init */
     if (fsyn_cfg->fsyn_soundfont_load == 0)
@@ -97,19 +142,28 @@ int backend_init (amidiplug_cfg_backend_t * cfg)
 
 int backend_cleanup (void)
 {
-    if (sc.soundfont_ids->len > 0)
-    {
-        /* unload soundfonts */
-        int i = 0;
+    /* the synth and its SoundFonts stay in sc for the next backend_init();
+       backend_cache_free() is what really releases them */
+    fluid_synth_system_reset (sc.synth);
+    return 1;
+}
 
-        for (i = 0 ; i < sc.soundfont_ids->len ; i++)
-            fluid_synth_sfunload (sc.synth, g_array_index (sc.soundfont_ids, int, i), 0);
-    }
+
+int backend_cache_free (void)
+{
+    if (! sc.synth)
+        return 1;
+
+    i_soundfont_unload ();
 
     g_array_free (sc.soundfont_ids, TRUE);
     delete_fluid_synth (sc.synth);
     delete_fluid_settings (sc.settings);
 
+    sc.soundfont_ids = NULL;
+    sc.synth = NULL;
+    sc.settings = NULL;
+
     return 1;
 }
 
@@ -124,7 +178,7 @@ int sequencer_get_port_count (void)
 int sequencer_start (char * midi_fname)
 {
     /* soundfont loader, check if we should load soundfont on first midifile play */
-    if ((fsyn_cfg->fsyn_soundfont_load == 1) && (sc.soundfont_ids->len == 0))
+    if (fsyn_cfg->fsyn_soundfont_load == 1)
         i_soundfont_load();
 
     return 1; /* success */
@@ -167,6 +221,7 @@ int sequencer_queue_start (void)
 {
     pthread_mutex_lock (& timer_mutex);
     timer = 0;
+    sc.timer_remainder = 0;
     pthread_mutex_unlock (& timer_mutex);
 
     return 1;
@@ -274,6 +329,7 @@ int sequencer_event_tempo (midievent_t * event)
 
     pthread_mutex_lock (& timer_mutex);
     timer = 0;
+    sc.timer_remainder = 0;
     pthread_mutex_unlock (& timer_mutex);
 
     return 1;
@@ -303,14 +359,17 @@ int sequencer_event_allnoteoff (int unused)
 
 int sequencer_output (void * * buffer, int * length)
 {
-    int frames = sc.sample_rate / 100;
+    int frames = sc.block_frames;
 
-    * buffer = g_realloc (* buffer, 4 * frames);
-    * length = 4 * frames;
-    fluid_synth_write_s16 (sc.synth, frames, * buffer, 0, 2, * buffer, 1, 2);
+    /* render straight into the float output format, no S16 round-trip */
+    * buffer = g_realloc (* buffer, 2 * sizeof (float) * frames);
+    * length = 2 * sizeof (float) * frames;
+    fluid_synth_write_float (sc.synth, frames, * buffer, 0, 2, * buffer, 1, 2);
 
     pthread_mutex_lock (& timer_mutex);
-    timer += 10000;
+    sc.timer_remainder += (gint64) frames * 1000000;
+    timer += sc.timer_remainder / sc.sample_rate;
+    sc.timer_remainder %= sc.sample_rate;
     pthread_cond_signal (& timer_cond);
     pthread_mutex_unlock (& timer_mutex);
 
@@ -341,8 +400,8 @@ int audio_volume_set (int left_volume, int right_volume)
 int audio_info_get (int * channels, int * bitdepth, int * samplerate)
 {
     *channels = 2;
-    *bitdepth = 16; /* always 16 bit, we use fluid_synth_write_s16() */
-    *samplerate = fsyn_cfg->fsyn_synth_samplerate;
+    *bitdepth = 32; /* always float, we use fluid_synth_write_float() */
+    *samplerate = sc.sample_rate;
     return 1; /* valid information */
 }
 
@@ -372,8 +431,42 @@ void i_sleep (unsigned tick)
 }
 
 
+/* true if sc.synth was created with the settings now configured; gain,
+   polyphony, reverb and chorus are only given to FluidSynth on creation */
+bool_t i_synth_settings_match (void)
+{
+    return (sc.sample_rate == (unsigned) synth_rate () &&
+            sc.synth_cfg.fsyn_synth_gain == fsyn_cfg->fsyn_synth_gain &&
+            sc.synth_cfg.fsyn_synth_polyphony == fsyn_cfg->fsyn_synth_polyphony &&
+            sc.synth_cfg.fsyn_synth_cpu_cores == fsyn_cfg->fsyn_synth_cpu_cores &&
+            sc.synth_cfg.fsyn_synth_parallel_render == fsyn_cfg->fsyn_synth_parallel_render &&
+            sc.synth_cfg.fsyn_synth_reverb == fsyn_cfg->fsyn_synth_reverb &&
+            sc.synth_cfg.fsyn_synth_chorus == fsyn_cfg->fsyn_synth_chorus);
+}
+
+
+void i_soundfont_unload (void)
+{
+    int i = 0;
+
+    for (i = 0 ; i < sc.soundfont_ids->len ; i++)
+        fluid_synth_sfunload (sc.synth, g_array_index (sc.soundfont_ids, int, i), 0);
+
+    g_array_set_size (sc.soundfont_ids, 0);
+
+    g_free (sc.soundfont_file);
+    sc.soundfont_file = NULL;
+}
+
+
 void i_soundfont_load (void)
 {
+    /* already loaded from the same list of files, nothing to do */
+    if (sc.soundfont_file && ! strcmp (sc.soundfont_file, fsyn_cfg->fsyn_soundfont_file))
+        return;
+
+    i_soundfont_unload ();
+
     if (strcmp (fsyn_cfg->fsyn_soundfont_file, ""))
     {
         char ** sffiles = g_strsplit (fsyn_cfg->fsyn_soundfont_file, ";", 0);
@@ -400,6 +493,7 @@ void i_soundfont_load (void)
 
         g_strfreev (sffiles);
 
+        sc.soundfont_file = g_strdup (fsyn_cfg->fsyn_soundfont_file);
         fluid_synth_system_reset (sc.synth);
     }
     else
@@ -25,6 +25,7 @@
 #include <fluidsynth.h>
 
 #include "../i_common.h"
+#include "../i_configure.h"
 #include "../i_midievent.h"
 
 
@@ -34,17 +35,25 @@ typedef struct
     fluid_synth_t * synth;
 
     GArray * soundfont_ids;
+    char * soundfont_file;	/* the list soundfont_ids were loaded from */
+    amidiplug_cfg_fsyn_t synth_cfg;	/* settings synth was created with */
 
     int ppq;
     gdouble cur_microsec_per_tick;
     unsigned tick_offset;
 
     unsigned sample_rate;
+    int block_frames;		/* frames rendered per sequencer_output() */
+    gint64 timer_remainder;	/* sub-microsecond part of rendered time, in frames * 1000000 */
 }
 sequencer_client_t;
 
 
+int backend_cache_free (void);
+
 void i_sleep (unsigned);
+bool_t i_synth_settings_match (void);
+void i_soundfont_unload (void);
 void i_soundfont_load (void);
 
 #endif /* !_B_FLUIDSYNTH_H */
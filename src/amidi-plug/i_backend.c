@@ -134,9 +134,11 @@ amidiplug_sequencer_backend_t * i_backend_load (const char * module_name)
     amidiplug_sequencer_backend_t * backend = malloc (sizeof (amidiplug_sequencer_backend_t));
 
     backend->gmodule = module;
+    backend->name = g_strdup (module_name);
 
     backend->init = get_symbol (module, "backend_init");
     backend->cleanup = get_symbol (module, "backend_cleanup");
+    backend->cache_free = get_symbol (module, "backend_cache_free");
     backend->audio_info_get = get_symbol (module, "audio_info_get");
     backend->audio_volume_get = get_symbol (module, "audio_volume_get");
     backend->audio_volume_set = get_symbol (module, "audio_volume_set");
@@ -172,9 +174,16 @@ amidiplug_sequencer_backend_t * i_backend_load (const char * module_name)
 }
 
 
-void i_backend_unload (amidiplug_sequencer_backend_t * backend)
+/* keep_cache lets a backend hold on to expensive state (such as loaded
+   SoundFonts) for the next time the same backend is loaded */
+void i_backend_unload (amidiplug_sequencer_backend_t * backend, bool_t keep_cache)
 {
     backend->cleanup ();
+
+    if (! keep_cache && backend->cache_free)
+        backend->cache_free ();
+
     g_module_close (backend->gmodule);
+    g_free (backend->name);
     free (backend);
 }
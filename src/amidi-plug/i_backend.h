@@ -40,8 +40,10 @@ amidiplug_sequencer_backend_name_t;
 typedef struct
 {
     GModule * gmodule;
+    char * name;
     int (*init) (struct amidiplug_cfg_backend_s *);
     int (*cleanup) (void);
+    int (*cache_free) (void);			/* optional */
     int (*audio_info_get) (int *, int *, int *);
     int (*audio_volume_get) (int *, int *);
     int (*audio_volume_set) (int, int);
@@ -74,6 +76,6 @@ amidiplug_sequencer_backend_t;
 GSList * i_backend_list_lookup (void);
 void i_backend_list_free (GSList *);
 amidiplug_sequencer_backend_t * i_backend_load (const char * module_name);
-void i_backend_unload (amidiplug_sequencer_backend_t * backend);
+void i_backend_unload (amidiplug_sequencer_backend_t * backend, bool_t keep_cache);
 
 #endif /* !_I_BACKEND_H */
@@ -216,6 +216,17 @@ void i_configure_ev_sypoly_commit (void * poly_spinbt)
 }
 
 
+void i_configure_ev_sycores_commit (void * cores_spinbt)
+{
+    amidiplug_cfg_fsyn_t * fsyncfg = amidiplug_cfg_backend->fsyn;
+
+    if (gtk_widget_get_sensitive (cores_spinbt))
+        fsyncfg->fsyn_synth_cpu_cores = (int) (gtk_spin_button_get_value (GTK_SPIN_BUTTON (cores_spinbt)));
+    else
+        fsyncfg->fsyn_synth_cpu_cores = -1;
+}
+
+
 void i_configure_ev_syreverb_commit (void * reverb_yes_radiobt)
 {
     amidiplug_cfg_fsyn_t * fsyncfg = amidiplug_cfg_backend->fsyn;
@@ -310,6 +321,8 @@ void i_configure_gui_tab_fsyn (GtkWidget * fsyn_page_alignment,
         GtkWidget * synth_gain_value_label, *synth_gain_value_spin, *synth_gain_defcheckbt;
         GtkWidget * synth_poly_frame, *synth_poly_hbox, *synth_poly_value_hbox;
         GtkWidget * synth_poly_value_label, *synth_poly_value_spin, *synth_poly_defcheckbt;
+        GtkWidget * synth_cores_frame, *synth_cores_hbox, *synth_cores_value_hbox;
+        GtkWidget * synth_cores_value_label, *synth_cores_value_spin, *synth_cores_defcheckbt;
         GtkWidget * synth_reverb_frame, *synth_reverb_hbox, *synth_reverb_value_hbox;
         GtkWidget * synth_reverb_value_option[2], *synth_reverb_defcheckbt;
         GtkWidget * synth_chorus_frame, *synth_chorus_hbox, *synth_chorus_value_hbox;
@@ -624,6 +637,36 @@ void i_configure_gui_tab_fsyn (GtkWidget * fsyn_page_alignment,
         gtk_box_pack_start (GTK_BOX (synth_samplerate_vbox), synth_samplerate_option[2], FALSE, FALSE, 0);
         gtk_box_pack_start (GTK_BOX (synth_samplerate_vbox), synth_samplerate_option[3], FALSE, FALSE, 0);
         gtk_box_pack_start (GTK_BOX (synth_samplerate_vbox), synth_samplerate_optionhbox, FALSE, FALSE, 0);
+        /* synth settings - cpu cores */
+        synth_cores_frame = gtk_frame_new (_("CPU cores"));
+        gtk_frame_set_label_align (GTK_FRAME (synth_cores_frame), 0.5, 0.5);
+        gtk_box_pack_start (GTK_BOX (synth_rightcol_vbox), synth_cores_frame, FALSE, FALSE, 0);
+        synth_cores_hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 2);
+        gtk_container_set_border_width (GTK_CONTAINER (synth_cores_hbox), 2);
+        gtk_container_add (GTK_CONTAINER (synth_cores_frame), synth_cores_hbox);
+        synth_cores_defcheckbt = gtk_check_button_new_with_label (_("use default"));
+        gtk_box_pack_start (GTK_BOX (synth_cores_hbox), synth_cores_defcheckbt, FALSE, FALSE, 0);
+        synth_cores_value_hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 4);
+        synth_cores_value_label = gtk_label_new (_("value:"));
+        synth_cores_value_spin = gtk_spin_button_new_with_range (1, 256, 1);
+        gtk_spin_button_set_value (GTK_SPIN_BUTTON (synth_cores_value_spin), 1);
+        g_signal_connect (G_OBJECT (synth_cores_defcheckbt), "toggled",
+                          G_CALLBACK (i_configure_ev_toggle_default), synth_cores_value_hbox);
+
+        if (fsyncfg->fsyn_synth_cpu_cores < 0)
+        {
+            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (synth_cores_defcheckbt), TRUE);
+        }
+        else
+        {
+            gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (synth_cores_defcheckbt), FALSE);
+            gtk_spin_button_set_value (GTK_SPIN_BUTTON (synth_cores_value_spin),
+                                       (gdouble) fsyncfg->fsyn_synth_cpu_cores);
+        }
+
+        gtk_box_pack_start (GTK_BOX (synth_cores_hbox), synth_cores_value_hbox, FALSE, FALSE, 0);
+        gtk_box_pack_start (GTK_BOX (synth_cores_value_hbox), synth_cores_value_label, FALSE, FALSE, 0);
+        gtk_box_pack_start (GTK_BOX (synth_cores_value_hbox), synth_cores_value_spin, FALSE, FALSE, 0);
 
         gtk_box_pack_start (GTK_BOX (content_vbox), synth_frame, TRUE, TRUE, 0);
 
@@ -636,6 +679,8 @@ void i_configure_gui_tab_fsyn (GtkWidget * fsyn_page_alignment,
                                   G_CALLBACK (i_configure_ev_sygain_commit), synth_gain_value_spin);
         g_signal_connect_swapped (G_OBJECT (commit_button), "ap-commit",
                                   G_CALLBACK (i_configure_ev_sypoly_commit), synth_poly_value_spin);
+        g_signal_connect_swapped (G_OBJECT (commit_button), "ap-commit",
+                                  G_CALLBACK (i_configure_ev_sycores_commit), synth_cores_value_spin);
         g_signal_connect_swapped (G_OBJECT (commit_button), "ap-commit",
                                   G_CALLBACK (i_configure_ev_syreverb_commit), synth_reverb_value_option[0]);
         g_signal_connect_swapped (G_OBJECT (commit_button), "ap-commit",
@@ -684,8 +729,11 @@ void i_configure_cfg_fsyn_read (void)
         "fsyn_synth_samplerate", "44100",
         "fsyn_synth_gain", "-1",
         "fsyn_synth_polyphony", "-1",
+        "fsyn_synth_cpu_cores", "-1",
+        "fsyn_synth_parallel_render", "-1",
         "fsyn_synth_reverb", "-1",
         "fsyn_synth_chorus", "-1",
+        "fsyn_render_block", "-1",
         NULL
     };
 
@@ -699,8 +747,11 @@ void i_configure_cfg_fsyn_read (void)
     fsyncfg->fsyn_synth_samplerate = aud_get_int ("amidiplug", "fsyn_synth_samplerate");
     fsyncfg->fsyn_synth_gain = aud_get_int ("amidiplug", "fsyn_synth_gain");
     fsyncfg->fsyn_synth_polyphony = aud_get_int ("amidiplug", "fsyn_synth_polyphony");
+    fsyncfg->fsyn_synth_cpu_cores = aud_get_int ("amidiplug", "fsyn_synth_cpu_cores");
+    fsyncfg->fsyn_synth_parallel_render = aud_get_int ("amidiplug", "fsyn_synth_parallel_render");
     fsyncfg->fsyn_synth_reverb = aud_get_int ("amidiplug", "fsyn_synth_reverb");
     fsyncfg->fsyn_synth_chorus = aud_get_int ("amidiplug", "fsyn_synth_chorus");
+    fsyncfg->fsyn_render_block = aud_get_int ("amidiplug", "fsyn_render_block");
 }
 
 
@@ -713,8 +764,11 @@ void i_configure_cfg_fsyn_save (void)
     aud_set_int ("amidiplug", "fsyn_synth_samplerate", fsyncfg->fsyn_synth_samplerate);
     aud_set_int ("amidiplug", "fsyn_synth_gain", fsyncfg->fsyn_synth_gain);
     aud_set_int ("amidiplug", "fsyn_synth_polyphony", fsyncfg->fsyn_synth_polyphony);
+    aud_set_int ("amidiplug", "fsyn_synth_cpu_cores", fsyncfg->fsyn_synth_cpu_cores);
+    aud_set_int ("amidiplug", "fsyn_synth_parallel_render", fsyncfg->fsyn_synth_parallel_render);
     aud_set_int ("amidiplug", "fsyn_synth_reverb", fsyncfg->fsyn_synth_reverb);
     aud_set_int ("amidiplug", "fsyn_synth_chorus", fsyncfg->fsyn_synth_chorus);
+    aud_set_int ("amidiplug", "fsyn_render_block", fsyncfg->fsyn_render_block);
 }
 
 #endif /* AMIDIPLUG_FLUIDSYNTH */
@@ -32,6 +32,7 @@
 #include "i_configure-ap.h"
 #include "i_configure-alsa.h"
 #include "i_configure-fluidsynth.h"
+#include "../warmup/warmup.h"
 
 #ifdef AMIDIPLUG_ALSA
 #define DEFAULT_BACKEND "alsa"
@@ -43,6 +44,7 @@
 
 /* from amidi-plug.c */
 extern amidiplug_sequencer_backend_t * backend;
+extern Warmup backend_warmup;
 
 amidiplug_cfg_ap_t * amidiplug_cfg_ap;
 amidiplug_cfg_backend_t * amidiplug_cfg_backend;
@@ -169,7 +171,11 @@ static void i_configure_commit (void)
     if (aud_drct_get_playing ())
         aud_drct_stop ();
 
-    i_backend_unload (backend);
+    warmup_wait (& backend_warmup);
+
+    /* reloading the same backend can reuse what it has cached */
+    if (backend)
+        i_backend_unload (backend, ! strcmp (backend->name, amidiplug_cfg_ap->ap_seq_backend));
     backend = i_backend_load (amidiplug_cfg_ap->ap_seq_backend);
 
     /* quit if new backend fails to load
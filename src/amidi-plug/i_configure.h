@@ -48,8 +48,11 @@ typedef struct
     int fsyn_synth_samplerate;
     int fsyn_synth_gain;
     int fsyn_synth_polyphony;
+    int fsyn_synth_cpu_cores;
+    int fsyn_synth_parallel_render;
     int fsyn_synth_reverb;
     int fsyn_synth_chorus;
+    int fsyn_render_block;
 }
 amidiplug_cfg_fsyn_t;
 
@@ -62,40 +62,13 @@ void i_fileinfo_grid_add_entry (char * field_text, char * value_text,
 }
 
 
-/* COMMENT: this will also reset current position in each track! */
 void i_fileinfo_text_fill (midifile_t * mf, GtkTextBuffer * text_tb, GtkTextBuffer * lyrics_tb)
 {
-    int l = 0;
+    int i = 0;
 
-    /* initialize current position in each track */
-    for (l = 0; l < mf->num_tracks; ++l)
-        mf->tracks[l].current_event = mf->tracks[l].first_event;
-
-    for (;;)
+    for (i = 0 ; i < mf->num_events ; ++i)
     {
-        midievent_t * event = NULL;
-        midifile_track_t * event_track = NULL;
-        int i, min_tick = mf->max_tick + 1;
-
-        /* search next event */
-        for (i = 0 ; i < mf->num_tracks ; ++i)
-        {
-            midifile_track_t * track = &mf->tracks[i];
-            midievent_t * e2 = track->current_event;
-
-            if ((e2) && (e2->tick < min_tick))
-            {
-                min_tick = e2->tick;
-                event = e2;
-                event_track = track;
-            }
-        }
-
-        if (!event)
-            break; /* end of song reached */
-
-        /* advance pointer to next event */
-        event_track->current_event = event->next;
+        midievent_t * event = &mf->events[i];
 
         switch (event->type)
         {
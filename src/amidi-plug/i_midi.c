@@ -122,27 +122,114 @@ int i_midi_file_read_var (midifile_t * mf)
 }
 
 
+/* hands out payload bytes from the file's blocks; blocks are never moved,
+   so events can keep pointing into them */
+static unsigned char * i_midi_file_alloc_payload (midifile_t * mf, int length)
+{
+    midifile_payload_t * block = mf->payload;
+
+    if (!block || block->size - block->used < length)
+    {
+        int size = (length > 65536) ? length : 65536;
+
+        block = malloc (sizeof (midifile_payload_t) + size);
+        block->next = mf->payload;
+        block->used = 0;
+        block->size = size;
+        mf->payload = block;
+    }
+
+    block->used += length;
+    return block->data + block->used - length;
+}
+
+
 /* allocates a new event */
-midievent_t * i_midi_file_new_event (midifile_track_t * track, int sysex_length)
+midievent_t * i_midi_file_new_event (midifile_t * mf, midifile_track_t * track, int sysex_length)
 {
     midievent_t * event;
 
-    event = malloc (sizeof (midievent_t));
-    event->sysex = sysex_length ? malloc (sysex_length) : NULL;
-    event->next = NULL;
-
-    /* append at the end of the track's linked list */
-    if (track->current_event)
-        track->current_event->next = event;
-    else
-        track->first_event = event;
+    /* append at the end of the track's array */
+    if (track->num_events == track->alloc_events)
+    {
+        track->alloc_events = track->alloc_events ? track->alloc_events * 2 : 256;
+        track->events = realloc (track->events, track->alloc_events * sizeof (midievent_t));
+    }
 
-    track->current_event = event;
+    event = &track->events[track->num_events++];
+    memset (event, 0, sizeof (midievent_t));
+    event->sysex = sysex_length ? i_midi_file_alloc_payload (mf, sysex_length) : NULL;
 
     return event;
 }
 
 
+typedef struct
+{
+    unsigned tick;
+    int index;
+}
+midifile_sortkey_t;
+
+static int i_midi_file_compare_keys (const void * a, const void * b)
+{
+    const midifile_sortkey_t * ka = a, * kb = b;
+
+    if (ka->tick != kb->tick)
+        return (ka->tick < kb->tick) ? -1 : 1;
+
+    return ka->index - kb->index;
+}
+
+
+/* merges the events of all tracks into one array, in the order playback
+   used to pick them: by tick, then by track, then by position in track */
+static void i_midi_file_merge_tracks (midifile_t * mf)
+{
+    midievent_t * all;
+    midifile_sortkey_t * keys;
+    int i, n = 0;
+
+    for (i = 0 ; i < mf->num_tracks ; ++i)
+        n += mf->tracks[i].num_events;
+
+    all = malloc (n * sizeof (midievent_t) + 1);
+    keys = malloc (n * sizeof (midifile_sortkey_t) + 1);
+    n = 0;
+
+    for (i = 0 ; i < mf->num_tracks ; ++i)
+    {
+        midifile_track_t * track = &mf->tracks[i];
+
+        if (track->num_events)
+            memcpy (all + n, track->events, track->num_events * sizeof (midievent_t));
+
+        n += track->num_events;
+
+        free (track->events);
+        track->events = NULL;
+        track->num_events = track->alloc_events = 0;
+    }
+
+    for (i = 0 ; i < n ; ++i)
+    {
+        keys[i].tick = all[i].tick;
+        keys[i].index = i;
+    }
+
+    qsort (keys, n, sizeof (midifile_sortkey_t), i_midi_file_compare_keys);
+
+    mf->events = malloc (n * sizeof (midievent_t) + 1);
+    mf->num_events = n;
+
+    for (i = 0 ; i < n ; ++i)
+        mf->events[i] = all[keys[i].index];
+
+    free (keys);
+    free (all);
+}
+
+
 /* reads one complete track from the file */
 int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
                             int track_end, int port_count)
@@ -209,7 +296,7 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
         case 0x9:
         case 0xa:
         {
-            event = i_midi_file_new_event (track, 0);
+            event = i_midi_file_new_event (mf, track, 0);
             event->type = cmd_type[cmd >> 4];
             event->port = port;
             event->tick = tick;
@@ -243,7 +330,7 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
         case 0xb: /* channel msg with 2 parameter bytes */
         case 0xe:
         {
-            event = i_midi_file_new_event (track, 0);
+            event = i_midi_file_new_event (mf, track, 0);
             event->type = cmd_type[cmd >> 4];
             event->port = port;
             event->tick = tick;
@@ -256,7 +343,7 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
         case 0xc: /* channel msg with 1 parameter byte */
         case 0xd:
         {
-            event = i_midi_file_new_event (track, 0);
+            event = i_midi_file_new_event (mf, track, 0);
             event->type = cmd_type[cmd >> 4];
             event->port = port;
             event->tick = tick;
@@ -280,7 +367,7 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
                 if (cmd == 0xf0)
                     ++len;
 
-                event = i_midi_file_new_event (track, len);
+                event = i_midi_file_new_event (mf, track, len);
                 event->type = SND_SEQ_EVENT_SYSEX;
                 event->port = port;
                 event->tick = tick;
@@ -340,7 +427,7 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
                     }
                     else
                     {
-                        event = i_midi_file_new_event (track, 0);
+                        event = i_midi_file_new_event (mf, track, 0);
                         event->type = SND_SEQ_EVENT_TEMPO;
                         event->port = port;
                         event->tick = tick;
@@ -361,10 +448,10 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
                         if (len < 1)
                             ERRMSG_MIDITRACK();
 
-                        event = i_midi_file_new_event (track, 0);
+                        event = i_midi_file_new_event (mf, track, 0);
                         event->type = SND_SEQ_EVENT_META_TEXT;
                         event->tick = tick;
-                        event->data.metat = malloc (len + 1);
+                        event->data.metat = (char *) i_midi_file_alloc_payload (mf, len + 1);
 
                         for (ic = 0 ; ic < len ; ic++)
                             event->data.metat[ic] = i_midi_file_read_byte (mf);
@@ -385,10 +472,10 @@ int i_midi_file_read_track (midifile_t * mf, midifile_track_t * track,
                         if (len < 1)
                             ERRMSG_MIDITRACK();
 
-                        event = i_midi_file_new_event (track, 0);
+                        event = i_midi_file_new_event (mf, track, 0);
                         event->type = SND_SEQ_EVENT_META_LYRIC;
                         event->tick = tick;
-                        event->data.metat = malloc (len + 1);
+                        event->data.metat = (char *) i_midi_file_alloc_payload (mf, len + 1);
 
                         for (ic = 0 ; ic < len ; ic++)
                             event->data.metat[ic] = i_midi_file_read_byte (mf);
@@ -458,6 +545,7 @@ int i_midi_file_parse_smf (midifile_t * mf, int port_count)
 
     mf->tracks = malloc (mf->num_tracks * sizeof (midifile_track_t));
     memset (mf->tracks, 0, mf->num_tracks * sizeof (midifile_track_t));
+    mf->port_count = port_count;
 
     mf->time_division = i_midi_file_read_int (mf,2);
 
@@ -511,6 +599,8 @@ int i_midi_file_parse_smf (midifile_t * mf, int port_count)
             mf->max_tick = mf->tracks[i].end_tick;
     }
 
+    i_midi_file_merge_tracks (mf);
+
     /* ok, success */
     return 1;
 }
@@ -562,6 +652,15 @@ void i_midi_init (midifile_t * mf)
     mf->file_offset = 0;
     mf->num_tracks = 0;
     mf->tracks = NULL;
+    mf->events = NULL;
+    mf->num_events = 0;
+    mf->current_event = 0;
+    mf->payload = NULL;
+    mf->port_count = 0;
+    mf->snapshots = NULL;
+    mf->num_snapshots = 0;
+    mf->replay = NULL;
+    mf->num_replay = 0;
     mf->max_tick = 0;
     mf->smpte_timing = 0;
     mf->format = 0;
@@ -578,37 +677,43 @@ void i_midi_init (midifile_t * mf)
 
 void i_midi_free (midifile_t * mf)
 {
+    int i;
+
     free (mf->file_name);
     mf->file_name = NULL;
 
     if (mf->tracks)
     {
-        int i;
-
-        /* free event list for each track */
+        /* event arrays are only left here if parsing failed half-way */
         for (i = 0 ; i < mf->num_tracks ; ++i)
-        {
-            midievent_t * event = mf->tracks[i].first_event;
-            midievent_t * event_tmp = NULL;
-
-            while (event)
-            {
-                event_tmp = event;
-                event = event->next;
-
-                if ((event_tmp->type == SND_SEQ_EVENT_META_TEXT) ||
-                        (event_tmp->type == SND_SEQ_EVENT_META_LYRIC))
-                    free (event_tmp->data.metat);
-
-                free (event_tmp->sysex);
-                free (event_tmp);
-            }
-        }
+            free (mf->tracks[i].events);
 
         /* free track array */
         free (mf->tracks);
         mf->tracks = NULL;
     }
+
+    free (mf->events);
+    mf->events = NULL;
+    mf->num_events = 0;
+
+    while (mf->payload)
+    {
+        midifile_payload_t * next = mf->payload->next;
+        free (mf->payload);
+        mf->payload = next;
+    }
+
+    for (i = 0 ; i < mf->num_snapshots ; ++i)
+        free (mf->snapshots[i].state);
+
+    free (mf->snapshots);
+    mf->snapshots = NULL;
+    mf->num_snapshots = 0;
+
+    free (mf->replay);
+    mf->replay = NULL;
+    mf->num_replay = 0;
 }
 
 
@@ -670,8 +775,7 @@ int i_midi_setget_tempo (midifile_t * mf)
 }
 
 
-/* this will set the midi length in microseconds
-   COMMENT: this will also reset current position in each track! */
+/* this will set the midi length in microseconds */
 void i_midi_setget_length (midifile_t * mf)
 {
     int64_t length_microsec = 0;
@@ -679,44 +783,14 @@ void i_midi_setget_length (midifile_t * mf)
     /* get the first microsec_per_tick ratio */
     int microsec_per_tick = (int) (mf->current_tempo / mf->ppq);
 
-    /* initialize current position in each track */
-    for (i = 0; i < mf->num_tracks; ++i)
-        mf->tracks[i].current_event = mf->tracks[i].first_event;
-
-    /* search for tempo events in each track; in fact, since the program
-       currently supports type 0 and type 1 MIDI files, we should find
-       tempo events only in one track */
+    /* search for tempo events; in fact, since the program currently
+       supports type 0 and type 1 MIDI files, we should find tempo events
+       only in one track */
     DEBUGMSG ("LENGTH calc: starting calc loop\n");
 
-    for (;;)
+    for (i = 0 ; i < mf->num_events ; ++i)
     {
-        midievent_t * event = NULL;
-        midifile_track_t * event_track = NULL;
-        int i, min_tick = mf->max_tick + 1;
-
-        /* search next event */
-        for (i = 0 ; i < mf->num_tracks ; ++i)
-        {
-            midifile_track_t * track = &mf->tracks[i];
-            midievent_t * e2 = track->current_event;
-
-            if (e2 && e2->tick < min_tick)
-            {
-                min_tick = e2->tick;
-                event = e2;
-                event_track = track;
-            }
-        }
-
-        if (!event)
-        {
-            /* calculate the remaining length */
-            length_microsec += (microsec_per_tick * (mf->max_tick - last_tick));
-            break; /* end of song reached */
-        }
-
-        /* advance pointer to next event */
-        event_track->current_event = event->next;
+        midievent_t * event = &mf->events[i];
 
         /* check if this is a tempo event */
         if (event->type == SND_SEQ_EVENT_TEMPO)
@@ -731,6 +805,9 @@ void i_midi_setget_length (midifile_t * mf)
         }
     }
 
+    /* calculate the remaining length */
+    length_microsec += (microsec_per_tick * (mf->max_tick - last_tick));
+
     /* IMPORTANT
        this couple of important values is set by i_midi_set_length */
     mf->length = length_microsec;
@@ -745,8 +822,7 @@ void i_midi_setget_length (midifile_t * mf)
 
 
 /* this will get the weighted average bpm of the midi file;
-   if the file has a variable bpm, 'bpm' is set to -1;
-   COMMENT: this will also reset current position in each track! */
+   if the file has a variable bpm, 'bpm' is set to -1 */
 void i_midi_get_bpm (midifile_t * mf, int * bpm, int * wavg_bpm)
 {
     int i = 0, last_tick = 0;
@@ -754,44 +830,14 @@ void i_midi_get_bpm (midifile_t * mf, int * bpm, int * wavg_bpm)
     bool_t is_monotempo = TRUE;
     int last_tempo = mf->current_tempo;
 
-    /* initialize current position in each track */
-    for (i = 0 ; i < mf->num_tracks ; ++i)
-        mf->tracks[i].current_event = mf->tracks[i].first_event;
-
-    /* search for tempo events in each track; in fact, since the program
-       currently supports type 0 and type 1 MIDI files, we should find
-       tempo events only in one track */
+    /* search for tempo events; in fact, since the program currently
+       supports type 0 and type 1 MIDI files, we should find tempo events
+       only in one track */
     DEBUGMSG ("BPM calc: starting calc loop\n");
 
-    for (;;)
+    for (i = 0 ; i < mf->num_events ; ++i)
     {
-        midievent_t * event = NULL;
-        midifile_track_t * event_track = NULL;
-        int i, min_tick = mf->max_tick + 1;
-
-        /* search next event */
-        for (i = 0 ; i < mf->num_tracks ; ++i)
-        {
-            midifile_track_t * track = &mf->tracks[i];
-            midievent_t * e2 = track->current_event;
-
-            if (e2 && e2->tick < min_tick)
-            {
-                min_tick = e2->tick;
-                event = e2;
-                event_track = track;
-            }
-        }
-
-        if (!event)
-        {
-            /* calculate the remaining length */
-            weighted_avg_tempo += (unsigned) (last_tempo * ((float) (mf->max_tick - last_tick) / (float) mf->max_tick));
-            break; /* end of song reached */
-        }
-
-        /* advance pointer to next event */
-        event_track->current_event = event->next;
+        midievent_t * event = &mf->events[i];
 
         /* check if this is a tempo event */
         if (event->type == SND_SEQ_EVENT_TEMPO)
@@ -811,6 +857,9 @@ void i_midi_get_bpm (midifile_t * mf, int * bpm, int * wavg_bpm)
         }
     }
 
+    /* calculate the remaining length */
+    weighted_avg_tempo += (unsigned) (last_tempo * ((float) (mf->max_tick - last_tick) / (float) mf->max_tick));
+
     DEBUGMSG ("BPM calc: weighted average tempo: %i\n", weighted_avg_tempo);
 
     *wavg_bpm = (int) (60000000 / weighted_avg_tempo);
@@ -826,6 +875,130 @@ void i_midi_get_bpm (midifile_t * mf, int * bpm, int * wavg_bpm)
 }
 
 
+/* controllers whose meaning depends on the ones sent before them (data
+   entry and the (N)RPN selectors); these are replayed in order on a seek
+   rather than folded into a snapshot */
+static bool_t i_midi_is_param_controller (int controller)
+{
+    switch (controller)
+    {
+    case 6: case 38: case 96: case 97: case 98: case 99: case 100: case 101:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+
+static void i_midi_add_replay (midifile_t * mf, int event)
+{
+    /* grow in powers of two */
+    if ((mf->num_replay & (mf->num_replay - 1)) == 0)
+        mf->replay = realloc (mf->replay, (mf->num_replay ? mf->num_replay * 2 : 1) * sizeof (int));
+
+    mf->replay[mf->num_replay++] = event;
+}
+
+
+/* record the channel and tempo state every MIDI_SNAPSHOT_EVENTS events;
+   done on the first seek, so that files which are only probed or played
+   straight through don't pay for it */
+#define MIDI_SNAPSHOT_EVENTS 4096
+
+void i_midi_build_snapshots (midifile_t * mf)
+{
+    int state_size = mf->port_count * 16 * MIDI_CHANNEL_STATE;
+    unsigned char * state;
+    int tempo = -1, i;
+
+    if (mf->snapshots || state_size < 1)
+        return;
+
+    state = malloc (state_size);
+    memset (state, MIDI_STATE_UNSET, state_size);
+
+    mf->snapshots = malloc ((mf->num_events / MIDI_SNAPSHOT_EVENTS + 1) * sizeof (midifile_snapshot_t));
+    mf->replay = NULL;
+    mf->num_replay = 0;
+
+    for (i = 0 ; ; ++i)
+    {
+        midievent_t * event;
+        unsigned char * channel;
+
+        if (i % MIDI_SNAPSHOT_EVENTS == 0)
+        {
+            midifile_snapshot_t * snap = &mf->snapshots[mf->num_snapshots++];
+
+            snap->event = i;
+            snap->tempo = tempo;
+            snap->state = malloc (state_size);
+            memcpy (snap->state, state, state_size);
+        }
+
+        if (i == mf->num_events)
+            break;
+
+        event = &mf->events[i];
+        channel = state + ((event->port % mf->port_count) * 16 + (event->data.d[0] & 0x0f)) * MIDI_CHANNEL_STATE;
+
+        switch (event->type)
+        {
+        case SND_SEQ_EVENT_CONTROLLER:
+            if (i_midi_is_param_controller (event->data.d[1]))
+                i_midi_add_replay (mf, i);
+            else
+                channel[event->data.d[1]] = event->data.d[2];
+            break;
+
+        case SND_SEQ_EVENT_PGMCHANGE:
+            channel[MIDI_STATE_PROGRAM] = event->data.d[1];
+            break;
+
+        case SND_SEQ_EVENT_CHANPRESS:
+            channel[MIDI_STATE_CHANPRESS] = event->data.d[1];
+            break;
+
+        case SND_SEQ_EVENT_PITCHBEND:
+            channel[MIDI_STATE_PITCHBEND] = event->data.d[1];
+            channel[MIDI_STATE_PITCHBEND + 1] = event->data.d[2];
+            break;
+
+        case SND_SEQ_EVENT_TEMPO:
+            tempo = event->data.tempo;
+            break;
+
+        case SND_SEQ_EVENT_SYSEX:
+            i_midi_add_replay (mf, i);
+            break;
+        }
+    }
+
+    free (state);
+}
+
+
+/* returns the last snapshot taken before any event at or after tick */
+int i_midi_find_snapshot (midifile_t * mf, int tick)
+{
+    int low = 0, high = mf->num_snapshots - 1;
+
+    /* snapshot 0 is taken before the first event, so it always fits */
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        int event = mf->snapshots[mid].event;
+
+        if (mf->events[event - 1].tick < (unsigned) tick)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+
+    return low;
+}
+
+
 /* helper function that parses a midi file; returns 1 on success, 0 otherwise */
 int i_midi_parse_from_filename (const char * filename, midifile_t * mf)
 {
@@ -229,12 +229,41 @@ enum snd_seq_event_type
 
 typedef struct
 {
-    midievent_t * first_event;	/* list of all events in this track */
+    midievent_t * events;		/* this track's events, only while loading */
+    int num_events;
+    int alloc_events;
     int end_tick;			/* length of this track */
-    midievent_t * current_event;	/* used while loading and playing */
 }
 midifile_track_t;
 
+/* sysex and meta-event data of a file, carved out of a few large blocks */
+typedef struct midifile_payload_s
+{
+    struct midifile_payload_s * next;
+    int used;
+    int size;
+    unsigned char data[];
+}
+midifile_payload_t;
+
+/* bytes of state kept per channel in a snapshot: 128 controllers, then
+   program, channel pressure and the two pitch bend bytes */
+#define MIDI_CHANNEL_STATE 132
+#define MIDI_STATE_PROGRAM 128
+#define MIDI_STATE_CHANPRESS 129
+#define MIDI_STATE_PITCHBEND 130
+#define MIDI_STATE_UNSET 0xff
+
+/* channel and tempo state at some point of the song, so that a seek can
+   restore it at once instead of replaying every event before it */
+typedef struct
+{
+    int event;				/* index of the first event not covered */
+    int tempo;				/* last tempo, or -1 if none yet */
+    unsigned char * state;		/* MIDI_CHANNEL_STATE bytes per channel, per port */
+}
+midifile_snapshot_t;
+
 typedef struct
 {
     VFSFile * file_pointer;
@@ -244,6 +273,17 @@ typedef struct
     int num_tracks;
     midifile_track_t * tracks;
 
+    midievent_t * events;		/* events of all tracks, in playing order */
+    int num_events;
+    int current_event;			/* next event to be played */
+    midifile_payload_t * payload;
+    int port_count;
+
+    midifile_snapshot_t * snapshots;	/* built on the first seek */
+    int num_snapshots;
+    int * replay;			/* events a snapshot can't hold (sysex, (N)RPN) */
+    int num_replay;
+
     unsigned short format;
     unsigned max_tick;
     int smpte_timing;
@@ -260,7 +300,7 @@ typedef struct
 }
 midifile_t;
 
-midievent_t * i_midi_file_new_event (midifile_track_t *, int);
+midievent_t * i_midi_file_new_event (midifile_t *, midifile_track_t *, int);
 void i_midi_file_skip_bytes (midifile_t *, int);
 int i_midi_file_read_byte (midifile_t *);
 int i_midi_file_read_32_le (midifile_t *);
@@ -275,6 +315,8 @@ void i_midi_free (midifile_t *);
 int i_midi_setget_tempo (midifile_t *);
 void i_midi_setget_length (midifile_t *);
 void i_midi_get_bpm (midifile_t *, int *, int *);
+void i_midi_build_snapshots (midifile_t *);
+int i_midi_find_snapshot (midifile_t *, int);
 /* helper function */
 int i_midi_parse_from_filename (const char *, midifile_t *);
 
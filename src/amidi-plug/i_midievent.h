@@ -23,7 +23,6 @@
 
 struct midievent_s
 {
-    struct midievent_s * next;		/* linked list */
     unsigned char type;				/* SND_SEQ_EVENT_xxx */
     unsigned char port;				/* port index */
     unsigned tick;
@@ -35,7 +34,7 @@ struct midievent_s
         unsigned length;			/* length of sysex data */
         char * metat;			/* meta-event text */
     } data;
-    unsigned char * sysex;
+    unsigned char * sysex;		/* points into the file's payload blocks */
 };
 
 typedef struct midievent_s midievent_t;
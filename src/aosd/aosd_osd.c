@@ -50,6 +50,7 @@ typedef struct
   gint width;
   gint height;
   gint deco_code;
+  gboolean use_opacity;
 }
 GhosdFadeData;
 
@@ -160,7 +161,22 @@ aosd_fade_func ( Ghosd * gosd , cairo_t * cr , void * user_data )
   }
 
   cairo_set_source_surface( cr , fade_data->surface , 0 , 0 );
-  cairo_paint_with_alpha( cr , fade_data->alpha );
+
+  /* when the window opacity does the fading, the contents stay opaque */
+  if ( fade_data->use_opacity )
+    cairo_paint( cr );
+  else
+    cairo_paint_with_alpha( cr , fade_data->alpha );
+}
+
+
+static void
+aosd_osd_fade ( void )
+{
+  if ( osd_data->fade_data.use_opacity )
+    ghosd_set_opacity( osd , osd_data->fade_data.alpha );
+  else
+    ghosd_render( osd );
 }
 
 
@@ -295,12 +311,16 @@ aosd_osd_create ( void )
   osd_data->fade_data.height = layout_height + pad_top + pad_bottom;
   osd_data->fade_data.alpha = 0;
   osd_data->fade_data.deco_code = osd_data->cfg_osd->decoration.code;
+  osd_data->fade_data.use_opacity = ghosd_can_set_opacity( osd );
   osd_data->dalpha_in = 1.0 / ( osd_data->cfg_osd->animation.timing_fadein / (gfloat)AOSD_TIMING );
   osd_data->dalpha_out = 1.0 / ( osd_data->cfg_osd->animation.timing_fadeout / (gfloat)AOSD_TIMING );
   osd_data->ddisplay_stay = 1.0 / ( osd_data->cfg_osd->animation.timing_display / (gfloat)AOSD_TIMING );
   ghosd_set_render( osd , (GhosdRenderFunc)aosd_fade_func , &(osd_data->fade_data) , NULL );
 
   /* show the osd (with alpha 0, invisible) */
+  if ( osd_data->fade_data.use_opacity )
+    ghosd_set_opacity( osd , 0 );
+
   ghosd_show( osd );
   return;
 }
@@ -319,7 +339,7 @@ aosd_timer_func ( gpointer none )
       osd_data->fade_data.alpha += osd_data->dalpha_in;
       if ( osd_data->fade_data.alpha < 1.0 )
       {
-        ghosd_render( osd );
+        aosd_osd_fade();
         ghosd_main_iterations( osd );
       }
       else
@@ -327,7 +347,7 @@ aosd_timer_func ( gpointer none )
         osd_data->fade_data.alpha = 1.0;
         display_time = 0;
         osd_status = AOSD_STATUS_SHOW; /* move to next phase */
-        ghosd_render( osd );
+        aosd_osd_fade();
         ghosd_main_iterations( osd );
       }
       return TRUE;
@@ -354,14 +374,14 @@ aosd_timer_func ( gpointer none )
       osd_data->fade_data.alpha -= osd_data->dalpha_out;
       if ( osd_data->fade_data.alpha > 0.0 )
       {
-        ghosd_render( osd );
+        aosd_osd_fade();
         ghosd_main_iterations( osd );
       }
       else
       {
         osd_data->fade_data.alpha = 0.0;
         osd_status = AOSD_STATUS_DESTROY; /* move to next phase */
-        ghosd_render( osd );
+        aosd_osd_fade();
         ghosd_main_iterations( osd );
       }
       return TRUE;
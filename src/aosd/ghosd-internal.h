@@ -9,6 +9,7 @@
  */
 
 #include <X11/Xlib.h>
+#include <cairo/cairo.h>
 
 #include "ghosd.h"
 
@@ -28,6 +29,13 @@ typedef struct {
   int set;
 } GhosdBackground;
 
+/* kept across frames, so that animating only costs a repaint */
+typedef struct {
+  Pixmap pixmap;
+  GC gc;
+  cairo_surface_t *surface;
+} GhosdBacking;
+
 struct _Ghosd {
   Display *dpy;
   Window win;
@@ -41,6 +49,8 @@ struct _Ghosd {
   int x, y, width, height;
 
   GhosdBackground background;
+  GhosdBacking backing;
+  Atom opacity_atom;
   RenderCallback render;
   EventButtonCallback eventbutton;
 };
@@ -127,72 +127,92 @@ take_snapshot(Ghosd *ghosd) {
   return pixmap;
 }
 
+static void
+release_backing(Ghosd *ghosd) {
+  if (ghosd->backing.surface == NULL)
+    return;
+
+  cairo_surface_destroy(ghosd->backing.surface);
+  XFreeGC(ghosd->dpy, ghosd->backing.gc);
+  XFreePixmap(ghosd->dpy, ghosd->backing.pixmap);
+  ghosd->backing.surface = NULL;
+}
+
+static void
+ensure_backing(Ghosd *ghosd) {
+  XRenderPictFormat *xrformat;
+  Screen *screen;
+
+  if (ghosd->backing.surface != NULL)
+    return;
+
+  if (ghosd->composite) {
+    ghosd->backing.pixmap = XCreatePixmap(ghosd->dpy, ghosd->win,
+      ghosd->width, ghosd->height, 32);
+    xrformat = XRenderFindVisualFormat(ghosd->dpy, ghosd->visual);
+    screen = ScreenOfDisplay(ghosd->dpy, ghosd->screen_num);
+  } else {
+    ghosd->backing.pixmap = XCreatePixmap(ghosd->dpy, ghosd->win,
+      ghosd->width, ghosd->height, DefaultDepth(ghosd->dpy, DefaultScreen(ghosd->dpy)));
+    xrformat = XRenderFindVisualFormat(ghosd->dpy,
+      DefaultVisual(ghosd->dpy, DefaultScreen(ghosd->dpy)));
+    screen = ScreenOfDisplay(ghosd->dpy, DefaultScreen(ghosd->dpy));
+  }
+
+  ghosd->backing.gc = XCreateGC(ghosd->dpy, ghosd->backing.pixmap, 0, NULL);
+  ghosd->backing.surface = cairo_xlib_surface_create_with_xrender_format(
+    ghosd->dpy, ghosd->backing.pixmap, screen, xrformat, ghosd->width, ghosd->height);
+}
+
 void
 ghosd_render(Ghosd *ghosd) {
-  Pixmap pixmap;
-  GC gc;
+  ensure_backing(ghosd);
 
-  if (ghosd->composite)
-  {
-    pixmap = XCreatePixmap(ghosd->dpy, ghosd->win, ghosd->width, ghosd->height, 32);
-    gc = XCreateGC(ghosd->dpy, pixmap, 0, NULL);
+  Pixmap pixmap = ghosd->backing.pixmap;
+  GC gc = ghosd->backing.gc;
+
+  if ((!ghosd->composite) && (ghosd->transparent)) {
+    /* start from our copy of what was underneath the window. */
+    XCopyArea(ghosd->dpy, ghosd->background.pixmap, pixmap, gc,
+      0, 0, ghosd->width, ghosd->height, 0, 0);
+  } else {
     XFillRectangle(ghosd->dpy, pixmap, gc,
       0, 0, ghosd->width, ghosd->height);
   }
-  else
-  {
-    pixmap = XCreatePixmap(ghosd->dpy, ghosd->win, ghosd->width, ghosd->height,
-      DefaultDepth(ghosd->dpy, DefaultScreen(ghosd->dpy)));
-    gc = XCreateGC(ghosd->dpy, pixmap, 0, NULL);
-    if (ghosd->transparent) {
-      /* make our own copy of the background pixmap as the initial surface. */
-      XCopyArea(ghosd->dpy, ghosd->background.pixmap, pixmap, gc,
-        0, 0, ghosd->width, ghosd->height, 0, 0);
-    } else {
-      XFillRectangle(ghosd->dpy, pixmap, gc,
-        0, 0, ghosd->width, ghosd->height);
-    }
-  }
-  XFreeGC(ghosd->dpy, gc);
+  cairo_surface_mark_dirty(ghosd->backing.surface);
 
   /* render with cairo. */
   if (ghosd->render.func) {
-    /* create cairo surface using the pixmap. */
-    XRenderPictFormat *xrformat;
-    cairo_surface_t *surf;
-    if (ghosd->composite) {
-      xrformat = XRenderFindVisualFormat(ghosd->dpy, ghosd->visual);
-      surf = cairo_xlib_surface_create_with_xrender_format(
-               ghosd->dpy, pixmap,
-               ScreenOfDisplay(ghosd->dpy, ghosd->screen_num),
-               xrformat, ghosd->width, ghosd->height);
-    } else {
-      xrformat = XRenderFindVisualFormat(ghosd->dpy,
-                   DefaultVisual(ghosd->dpy, DefaultScreen(ghosd->dpy)));
-      surf = cairo_xlib_surface_create_with_xrender_format(
-               ghosd->dpy, pixmap,
-               ScreenOfDisplay(ghosd->dpy, DefaultScreen(ghosd->dpy)),
-               xrformat, ghosd->width, ghosd->height);
-    }
-
-    /* draw some stuff. */
-    cairo_t *cr = cairo_create(surf);
+    cairo_t *cr = cairo_create(ghosd->backing.surface);
     ghosd->render.func(ghosd, cr, ghosd->render.data);
     cairo_destroy(cr);
-    cairo_surface_destroy(surf);
+    cairo_surface_flush(ghosd->backing.surface);
   }
 
-  /* point window at its new backing pixmap. */
+  /* point window at the backing pixmap and tell it to redraw. */
   XSetWindowBackgroundPixmap(ghosd->dpy, ghosd->win, pixmap);
-  /* I think it's ok to free it here because XCreatePixmap(3X11) says: "the X
-   * server frees the pixmap storage when there are no references to it".
-   */
-  XFreePixmap(ghosd->dpy, pixmap);
-
-  /* and tell the window to redraw with this pixmap. */
   XClearWindow(ghosd->dpy, ghosd->win);
 }
 
+/* With a compositing manager, fading is done by changing the window opacity
+ * instead of repainting, so the contents only need to be rendered once. */
+int
+ghosd_can_set_opacity(Ghosd *ghosd) {
+  return ghosd->composite;
+}
+
+void
+ghosd_set_opacity(Ghosd *ghosd, double opacity) {
+  if (opacity >= 1.0) {
+    XDeleteProperty(ghosd->dpy, ghosd->win, ghosd->opacity_atom);
+    return;
+  }
+
+  unsigned long value = (opacity > 0.0) ? (unsigned long)(opacity * 0xffffffffu) : 0;
+  XChangeProperty(ghosd->dpy, ghosd->win, ghosd->opacity_atom, XA_CARDINAL, 32,
+                  PropModeReplace, (unsigned char *)&value, 1);
+}
+
 static void
 set_hints(Display *dpy, Window win) {
   XClassHint *classhints;
@@ -331,6 +351,9 @@ ghosd_set_position(Ghosd *ghosd, int x, int y, int width, int height) {
     y = dpy_height - height + y;
   }
 
+  if (width != ghosd->width || height != ghosd->height)
+    release_backing(ghosd);
+
   ghosd->x      = x;
   ghosd->y      = y;
   ghosd->width  = width;
@@ -391,6 +414,7 @@ ghosd_new(void) {
   ghosd->composite = 0;
   ghosd->eventbutton.func = NULL;
   ghosd->background.set = 0;
+  ghosd->opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
 
   return ghosd;
 }
@@ -432,6 +456,7 @@ ghosd_new_with_argbvisual(void) {
   ghosd->composite = 1;
   ghosd->eventbutton.func = NULL;
   ghosd->background.set = 0;
+  ghosd->opacity_atom = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", False);
 
   return ghosd;
 }
@@ -483,6 +508,7 @@ ghosd_check_composite_mgr(void)
 
 void
 ghosd_destroy(Ghosd* ghosd) {
+  release_backing(ghosd);
   if (ghosd->background.set)
   {
     XFreePixmap(ghosd->dpy, ghosd->background.pixmap);
@@ -49,6 +49,8 @@ void ghosd_set_render(Ghosd *ghosd, GhosdRenderFunc render_func,
                       void* user_data, void (*user_data_d)(void*));
 
 void ghosd_render(Ghosd *ghosd);
+int  ghosd_can_set_opacity(Ghosd *ghosd);
+void ghosd_set_opacity(Ghosd *ghosd, double opacity);
 void ghosd_show(Ghosd *ghosd);
 void ghosd_hide(Ghosd *ghosd);
 
@@ -17,6 +17,7 @@
  * the use of this software.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -102,13 +103,345 @@ static bool_t write_key (VFSFile * file, const char * key, const char * val)
     return write_key_raw (file, key, buf);
 }
 
+/* audplb: a binary variant of the same format.  Every string in the playlist
+ * (title, URIs, field names, string values) is stored once in a table at the
+ * start of the file and referred to by index; integers are stored as such.
+ * Loading then is a single read and a pass over fixed-size records, with no
+ * line splitting, percent decoding or number parsing.  All values are little
+ * endian.
+ *
+ * header:   magic[8], title, n_strings, strings_size, n_entries
+ * strings:  n_strings x (length, bytes, 0)
+ * entries:  n_entries x (size, uri, n_fields, n_fields x (key, value))
+ *
+ * key is (field name << 1 | is_int); value is a string index or an integer.
+ * n_fields is NO_TUPLE if the entry has no tuple at all. */
+
+#define AUDPLB_MAGIC "AUDPLB\0\1"
+#define AUDPLB_HEADER 24
+#define NO_TUPLE 0xffffffff
+
+typedef struct {
+    unsigned char * data;
+    int len, size;
+} Buffer;
+
+typedef struct {
+    Buffer data;
+    int * offsets;
+    int count;
+    int * slots; /* hash table of string indexes, -1 if empty */
+    int mask;
+} StringTable;
+
+static inline uint32_t get_u32 (const unsigned char * p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline void set_u32 (unsigned char * p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+}
+
+static void buf_put_u32 (Buffer * buf, uint32_t val)
+{
+    if (buf->len + 4 > buf->size)
+    {
+        buf->size = buf->size ? buf->size * 2 : 65536;
+        buf->data = realloc (buf->data, buf->size);
+    }
+
+    set_u32 (buf->data + buf->len, val);
+    buf->len += 4;
+}
+
+static void buf_put_str (Buffer * buf, const char * str, int len)
+{
+    buf_put_u32 (buf, len);
+
+    if (buf->len + len + 1 > buf->size)
+    {
+        while (buf->len + len + 1 > buf->size)
+            buf->size *= 2;
+        buf->data = realloc (buf->data, buf->size);
+    }
+
+    memcpy (buf->data + buf->len, str, len + 1);
+    buf->len += len + 1;
+}
+
+static unsigned str_hash (const char * str, int len)
+{
+    unsigned hash = 2166136261u;
+
+    while (len --)
+        hash = (hash ^ (unsigned char) * str ++) * 16777619u;
+
+    return hash;
+}
+
+static uint32_t intern (StringTable * table, const char * str)
+{
+    int len = strlen (str);
+
+    if (table->count * 2 >= table->mask)
+    {
+        int mask = table->mask ? table->mask * 2 + 1 : 1023;
+        int * slots = malloc (sizeof (int) * (mask + 1));
+        memset (slots, -1, sizeof (int) * (mask + 1));
+
+        for (int i = 0; i < table->count; i ++)
+        {
+            const unsigned char * p = table->data.data + table->offsets[i];
+            unsigned h = str_hash ((const char *) p + 4, get_u32 (p)) & mask;
+
+            while (slots[h] >= 0)
+                h = (h + 1) & mask;
+
+            slots[h] = i;
+        }
+
+        free (table->slots);
+        table->slots = slots;
+        table->mask = mask;
+        table->offsets = realloc (table->offsets, sizeof (int) * (mask + 1) / 2);
+    }
+
+    unsigned h = str_hash (str, len) & table->mask;
+
+    for (; table->slots[h] >= 0; h = (h + 1) & table->mask)
+    {
+        const unsigned char * p = table->data.data + table->offsets[table->slots[h]];
+
+        if (get_u32 (p) == len && ! memcmp (p + 4, str, len))
+            return table->slots[h];
+    }
+
+    table->slots[h] = table->count;
+    table->offsets[table->count] = table->data.len;
+    buf_put_str (& table->data, str, len);
+
+    return table->count ++;
+}
+
+static bool_t audplb_save (VFSFile * file, const char * title,
+ Index * filenames, Index * tuples)
+{
+    StringTable table = {{NULL, 0, 0}, NULL, 0, NULL, 0};
+    Buffer entries = {NULL, 0, 0};
+    Buffer header = {NULL, 0, 0};
+    int count = index_count (filenames);
+
+    uint32_t title_id = intern (& table, title);
+
+    for (int i = 0; i < count; i ++)
+    {
+        const Tuple * tuple = tuples ? index_get (tuples, i) : NULL;
+        int start = entries.len;
+
+        buf_put_u32 (& entries, 0); /* size, filled in below */
+        buf_put_u32 (& entries, intern (& table, index_get (filenames, i)));
+        buf_put_u32 (& entries, tuple ? 0 : NO_TUPLE);
+
+        if (tuple)
+        {
+            uint32_t keys = 0;
+
+            for (int f = 0; f < TUPLE_FIELDS; f ++)
+            {
+                if (f == FIELD_FILE_PATH || f == FIELD_FILE_NAME || f == FIELD_FILE_EXT)
+                    continue;
+
+                TupleValueType type = tuple_get_value_type (tuple, f, NULL);
+                uint32_t name;
+
+                if (type == TUPLE_STRING)
+                {
+                    char * str = tuple_get_str (tuple, f, NULL);
+                    name = intern (& table, tuple_field_get_name (f));
+                    buf_put_u32 (& entries, name << 1);
+                    buf_put_u32 (& entries, intern (& table, str));
+                    str_unref (str);
+                    keys ++;
+                }
+                else if (type == TUPLE_INT)
+                {
+                    name = intern (& table, tuple_field_get_name (f));
+                    buf_put_u32 (& entries, name << 1 | 1);
+                    buf_put_u32 (& entries, tuple_get_int (tuple, f, NULL));
+                    keys ++;
+                }
+            }
+
+            set_u32 (entries.data + start + 8, keys);
+        }
+
+        set_u32 (entries.data + start, entries.len - start - 4);
+    }
+
+    buf_put_u32 (& header, 0);
+    buf_put_u32 (& header, 0);
+    memcpy (header.data, AUDPLB_MAGIC, 8);
+    buf_put_u32 (& header, title_id);
+    buf_put_u32 (& header, table.count);
+    buf_put_u32 (& header, table.data.len);
+    buf_put_u32 (& header, count);
+
+    bool_t success = (vfs_fwrite (header.data, 1, header.len, file) == header.len &&
+     vfs_fwrite (table.data.data, 1, table.data.len, file) == table.data.len &&
+     vfs_fwrite (entries.data, 1, entries.len, file) == entries.len);
+
+    free (header.data);
+    free (entries.data);
+    free (table.data.data);
+    free (table.offsets);
+    free (table.slots);
+
+    return success;
+}
+
+/* The magic has already been read. */
+static bool_t audplb_load (VFSFile * file, char * * title, Index * filenames,
+ Index * tuples)
+{
+    int64_t size = vfs_fsize (file);
+    unsigned char * data = NULL;
+    int64_t len = 0;
+
+    if (size > 8 && size < INT32_MAX)
+    {
+        data = malloc (size - 8);
+        len = vfs_fread (data, 1, size - 8, file);
+    }
+    else
+    {
+        /* size unknown; read until the end */
+        for (int64_t alloc = 65536; ; alloc *= 2)
+        {
+            data = realloc (data, alloc);
+            len += vfs_fread (data + len, 1, alloc - len, file);
+
+            if (len < alloc)
+                break;
+        }
+    }
+
+    const unsigned char * p = data, * end = data + len;
+    char * * strings = NULL;
+    int * fields = NULL;
+    uint32_t n_loaded = 0, i;
+    bool_t success = FALSE;
+
+    if (len < AUDPLB_HEADER - 8)
+        goto DONE;
+
+    uint32_t title_id = get_u32 (p);
+    uint32_t n_strings = get_u32 (p + 4);
+    uint32_t strings_size = get_u32 (p + 8);
+    uint32_t n_entries = get_u32 (p + 12);
+    p += AUDPLB_HEADER - 8;
+
+    if (strings_size > end - p || n_strings > strings_size / 5 || title_id >= n_strings)
+        goto DONE;
+
+    strings = malloc (sizeof (char *) * n_strings);
+    fields = malloc (sizeof (int) * n_strings);
+
+    const unsigned char * strings_end = p + strings_size;
+
+    for (; n_loaded < n_strings; n_loaded ++)
+    {
+        uint32_t slen;
+
+        if (strings_end - p < 5 || (slen = get_u32 (p)) > strings_end - p - 5 || p[4 + slen])
+            goto DONE;
+
+        strings[n_loaded] = str_get ((const char *) p + 4);
+        fields[n_loaded] = -2; /* not looked up yet */
+        p += 5 + slen;
+    }
+
+    * title = str_ref (strings[title_id]);
+
+    for (i = 0; i < n_entries; i ++)
+    {
+        if (end - p < 12)
+            break;
+
+        uint32_t entry_size = get_u32 (p);
+        uint32_t uri_id = get_u32 (p + 4);
+        uint32_t n_fields = get_u32 (p + 8);
+
+        if (entry_size < 8 || entry_size > end - p - 4 || uri_id >= n_strings ||
+         (n_fields != NO_TUPLE && n_fields > (entry_size - 8) / 8))
+            break;
+
+        const unsigned char * field = p + 12;
+        char * uri = strings[uri_id];
+        Tuple * tuple = NULL;
+
+        p += 4 + entry_size;
+
+        if (n_fields != NO_TUPLE)
+        {
+            tuple = tuple_new_from_filename (uri);
+
+            for (uint32_t f = 0; f < n_fields; f ++, field += 8)
+            {
+                uint32_t key = get_u32 (field), name = key >> 1;
+                uint32_t val = get_u32 (field + 4);
+
+                if (name >= n_strings)
+                    continue;
+
+                if (fields[name] == -2)
+                    fields[name] = tuple_field_by_name (strings[name]);
+
+                int id = fields[name];
+
+                if (id < 0)
+                    continue;
+
+                if ((key & 1) && tuple_field_get_type (id) == TUPLE_INT)
+                    tuple_set_int (tuple, id, NULL, (int32_t) val);
+                else if (! (key & 1) && val < n_strings && tuple_field_get_type (id) == TUPLE_STRING)
+                    tuple_set_str (tuple, id, NULL, strings[val]);
+            }
+        }
+
+        index_append (filenames, str_ref (uri));
+        index_append (tuples, tuple);
+    }
+
+    success = TRUE;
+
+DONE:
+    for (i = 0; i < n_loaded; i ++)
+        str_unref (strings[i]);
+
+    free (strings);
+    free (fields);
+    free (data);
+    return success;
+}
+
 static bool_t audpl_load (const char * path, VFSFile * file, char * * title,
  Index * filenames, Index * tuples)
 {
     ReadState * state = malloc (sizeof (ReadState));
     state->file = file;
     state->cur = state->buf;
-    state->len = 0;
+    state->len = vfs_fread (state->buf, 1, 8, file);
+
+    if (state->len == 8 && ! memcmp (state->buf, AUDPLB_MAGIC, 8))
+    {
+        free (state);
+        return audplb_load (file, title, filenames, tuples);
+    }
 
     char * key, * val;
 
@@ -158,6 +491,9 @@ static bool_t audpl_load (const char * path, VFSFile * file, char * * title,
 static bool_t audpl_save (const char * path, VFSFile * file,
  const char * title, Index * filenames, Index * tuples)
 {
+    if (str_has_suffix_nocase (path, ".audplb"))
+        return audplb_save (file, title, filenames, tuples);
+
     if (! write_key (file, "title", title))
         return FALSE;
 
@@ -215,7 +551,7 @@ static bool_t audpl_save (const char * path, VFSFile * file,
     return TRUE;
 }
 
-static const char * const audpl_exts[] = {"audpl", NULL};
+static const char * const audpl_exts[] = {"audpl", "audplb", NULL};
 
 AUD_PLAYLIST_PLUGIN
 (
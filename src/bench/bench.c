@@ -0,0 +1,311 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "bench.h"
+
+typedef Plugin * (* PluginGetInfo) (AudAPITable * table);
+
+static GSList * modules;
+
+static int64_t clock_ns (clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime (id, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_time_now (BenchTime * time)
+{
+    time->wall = clock_ns (CLOCK_MONOTONIC);
+    time->cpu = clock_ns (CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void bench_time_add_since (BenchTime * total, const BenchTime * start)
+{
+    BenchTime now;
+    bench_time_now (& now);
+
+    total->wall += now.wall - start->wall;
+    total->cpu += now.cpu - start->cpu;
+}
+
+void bench_reset_peak_rss (void)
+{
+    /* "5" resets the VmHWM counter on Linux 4.0 and later. */
+    FILE * file = fopen ("/proc/self/clear_refs", "w");
+    if (! file)
+        return;
+
+    fputs ("5", file);
+    fclose (file);
+}
+
+long bench_peak_rss (void)
+{
+    FILE * file = fopen ("/proc/self/status", "r");
+    if (file)
+    {
+        char line[256];
+        long peak = -1;
+
+        while (fgets (line, sizeof line, file))
+        {
+            if (! strncmp (line, "VmHWM:", 6))
+            {
+                peak = atol (line + 6);
+                break;
+            }
+        }
+
+        fclose (file);
+
+        if (peak >= 0)
+            return peak;
+    }
+
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, & usage);
+    return usage.ru_maxrss;
+}
+
+#ifdef __GLIBC__
+
+/* glibc lets a program replace malloc() and friends for every library it
+ * uses, plugins included; these count the calls and hand them on. */
+extern void * __libc_malloc (size_t size);
+extern void * __libc_calloc (size_t nmemb, size_t size);
+extern void * __libc_realloc (void * ptr, size_t size);
+
+static volatile int counting_allocs;
+static int64_t allocs;
+
+void * malloc (size_t size)
+{
+    if (counting_allocs)
+        __sync_fetch_and_add (& allocs, 1);
+
+    return __libc_malloc (size);
+}
+
+void * calloc (size_t nmemb, size_t size)
+{
+    if (counting_allocs)
+        __sync_fetch_and_add (& allocs, 1);
+
+    return __libc_calloc (nmemb, size);
+}
+
+void * realloc (void * ptr, size_t size)
+{
+    if (counting_allocs)
+        __sync_fetch_and_add (& allocs, 1);
+
+    return __libc_realloc (ptr, size);
+}
+
+void bench_count_allocs (bool_t enable)
+{
+    if (enable)
+        allocs = 0;
+
+    counting_allocs = enable;
+}
+
+int64_t bench_allocs (void)
+{
+    return allocs;
+}
+
+#else
+
+void bench_count_allocs (bool_t enable)
+{
+}
+
+int64_t bench_allocs (void)
+{
+    return -1;
+}
+
+#endif
+
+int bench_parse_int_list (const char * arg, int * values, int max)
+{
+    char * * split = g_strsplit (arg, ",", -1);
+    int count = 0;
+
+    for (char * * item = split; * item; item ++)
+    {
+        char * end;
+        long value = strtol (* item, & end, 10);
+
+        if (count == max || end == * item || * end || value <= 0 || value > G_MAXINT)
+        {
+            count = 0;
+            break;
+        }
+
+        values[count ++] = value;
+    }
+
+    g_strfreev (split);
+    return count;
+}
+
+Plugin * bench_load_plugin (const char * path, int type)
+{
+    void * module = dlopen (path, RTLD_NOW | RTLD_LOCAL);
+    if (! module)
+    {
+        fprintf (stderr, "%s\n", dlerror ());
+        return NULL;
+    }
+
+    PluginGetInfo func = (PluginGetInfo) dlsym (module, "get_plugin_info");
+    Plugin * header = func ? func (& bench_api_table) : NULL;
+
+    if (! header || header->magic != _AUD_PLUGIN_MAGIC)
+    {
+        fprintf (stderr, "%s is not a valid Audacious plugin.\n", path);
+        dlclose (module);
+        return NULL;
+    }
+
+    if (header->version != _AUD_PLUGIN_VERSION)
+    {
+        fprintf (stderr, "%s is not compatible with this version of Audacious.\n", path);
+        dlclose (module);
+        return NULL;
+    }
+
+    if (header->type != type)
+    {
+        fprintf (stderr, "%s is not the right type of plugin.\n", path);
+        dlclose (module);
+        return NULL;
+    }
+
+    modules = g_slist_prepend (modules, module);
+    return header;
+}
+
+bool_t bench_start_plugin (const char * path, int type, GSList * * list)
+{
+    Plugin * header = bench_load_plugin (path, type);
+    if (! header)
+        return FALSE;
+
+    if (header->init && ! header->init ())
+    {
+        fprintf (stderr, "%s: init failed.\n", path);
+        return FALSE;
+    }
+
+    * list = g_slist_append (* list, header);
+    return TRUE;
+}
+
+void bench_stop_plugins (GSList * list)
+{
+    for (GSList * node = list; node; node = node->next)
+    {
+        Plugin * header = node->data;
+        if (header->cleanup)
+            header->cleanup ();
+    }
+
+    g_slist_free (list);
+}
+
+void * bench_find_symbol (const char * name)
+{
+    for (GSList * node = modules; node; node = node->next)
+    {
+        void * symbol = dlsym (node->data, name);
+        if (symbol)
+            return symbol;
+    }
+
+    return NULL;
+}
+
+void bench_unload_plugins (void)
+{
+    g_slist_free_full (modules, (GDestroyNotify) dlclose);
+    modules = NULL;
+}
+
+static void usage (void)
+{
+    fprintf (stderr,
+     "Usage: audbench <command> [options] ...\n\n"
+     "Commands:\n"
+     "  effect    Run effect plugins over synthetic or raw PCM\n"
+     "  input     Decode files to a null output or an output plugin\n"
+     "  opl       Render AdLib songs to WAV files on several threads\n"
+     "  playlist  Load and save large synthetic playlists\n"
+     "  probe     Time input plugin probes over a set of files\n\n"
+     "Run \"audbench <command> -h\" for the options of a command.\n\n"
+     "Plugins choose their SIMD kernels by what the CPU supports.  Set\n"
+     "AUD_CPU_FEATURES to limit the choice (e.g. \"sse2\", \"-avx2\" or \"none\")\n"
+     "and AUD_CPU_REPORT=1 to list the kernels chosen.\n");
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        usage ();
+        return EXIT_FAILURE;
+    }
+
+    bench_config_init ();
+
+    int ret;
+
+    if (! strcmp (argv[1], "effect"))
+        ret = bench_effect_main (argc - 1, argv + 1);
+    else if (! strcmp (argv[1], "input"))
+        ret = bench_input_main (argc - 1, argv + 1);
+    else if (! strcmp (argv[1], "opl"))
+        ret = bench_opl_main (argc - 1, argv + 1);
+    else if (! strcmp (argv[1], "playlist"))
+        ret = bench_playlist_main (argc - 1, argv + 1);
+    else if (! strcmp (argv[1], "probe"))
+        ret = bench_probe_main (argc - 1, argv + 1);
+    else
+    {
+        usage ();
+        ret = EXIT_FAILURE;
+    }
+
+    bench_unload_plugins ();
+    bench_config_cleanup ();
+
+    return ret;
+}
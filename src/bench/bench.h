@@ -0,0 +1,125 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDBENCH_H
+#define AUDBENCH_H
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include <audacious/plugin.h>
+
+/* The benchmarks load plugins with dlopen() outside of Audacious.  They hand
+ * each plugin a private API table (see config.c) so that the configuration
+ * calls a plugin makes on startup land in an in-memory store instead of the
+ * real config database.  The input benchmark adds the few playlist calls
+ * filewriter makes (see input.c), and the playlist benchmark the URI and
+ * decoder calls of container plugins (see playlist.c).  Plugins that call into
+ * other parts of the API are not supported. */
+
+typedef struct {
+    int64_t wall; /* nanoseconds, CLOCK_MONOTONIC */
+    int64_t cpu; /* nanoseconds, CLOCK_PROCESS_CPUTIME_ID */
+} BenchTime;
+
+void bench_time_now (BenchTime * time);
+void bench_time_add_since (BenchTime * total, const BenchTime * start);
+
+/* Peak resident set size in KiB since the last call to bench_reset_peak_rss().
+ * On systems without /proc/self/clear_refs, this is the peak for the whole
+ * process lifetime. */
+void bench_reset_peak_rss (void);
+long bench_peak_rss (void);
+
+/* Counts calls to malloc(), calloc() and realloc() from anywhere in the
+ * process, from bench_count_allocs(TRUE) until bench_count_allocs(FALSE).
+ * GSlice and other allocators with pools of their own are only counted when
+ * they grow.  bench_allocs() returns -1 where counting is not supported (libc
+ * other than glibc). */
+void bench_count_allocs (bool_t enable);
+int64_t bench_allocs (void);
+
+/* Parses a comma-separated list of positive integers ("1,2,6").  Returns the
+ * number of values stored, or 0 on a parse error. */
+int bench_parse_int_list (const char * arg, int * values, int max);
+
+/* Loads a plugin module and checks that it is of the given type
+ * (PLUGIN_TYPE_XXX).  Returns NULL on failure. */
+Plugin * bench_load_plugin (const char * path, int type);
+void bench_unload_plugins (void);
+
+/* Looks up a symbol in the plugin modules loaded so far, for plugins that
+ * offer more than the plugin API.  Returns NULL if none has it. */
+void * bench_find_symbol (const char * name);
+
+/* Loads a plugin as above, calls its init(), and appends it to <list>.
+ * bench_stop_plugins() calls cleanup() for each plugin and frees the list. */
+bool_t bench_start_plugin (const char * path, int type, GSList * * list);
+void bench_stop_plugins (GSList * list);
+
+/* config.c */
+extern AudAPITable bench_api_table;
+
+void bench_config_init (void);
+void bench_config_cleanup (void);
+
+/* Overrides a config value given as "section:name=value".  Overrides are
+ * applied after the plugin has registered its defaults. */
+bool_t bench_config_override (const char * arg);
+
+/* effect.c */
+int bench_effect_main (int argc, char * * argv);
+
+/* golden.c */
+uint64_t bench_hash_init (void);
+uint64_t bench_hash_add (uint64_t hash, const void * data, int64_t length);
+
+/* Loads hashes to check against (-g).  bench_golden_record() instead collects
+ * the hashes that come out, for bench_golden_finish() to save (-G). */
+bool_t bench_golden_load (const char * path);
+void bench_golden_record (void);
+bool_t bench_golden_active (void);
+void bench_golden_check (const char * name, uint64_t hash, int64_t bytes);
+
+/* Prints the tally and saves the hashes collected, if any.  Returns FALSE if
+ * any hash differed or saving failed.  bench_golden_discard() just forgets
+ * them. */
+bool_t bench_golden_finish (const char * save_path);
+void bench_golden_discard (void);
+
+/* Appends a row of timings, with the date, to a tab-separated file (-R). */
+bool_t bench_trend_open (const char * path);
+void bench_trend_add (const char * name, const char * what, double audio,
+ double wall, double cpu);
+void bench_trend_close (void);
+
+/* input.c */
+int bench_input_main (int argc, char * * argv);
+
+/* opl.c */
+int bench_opl_main (int argc, char * * argv);
+
+/* playlist.c */
+int bench_playlist_main (int argc, char * * argv);
+
+/* probe.c */
+int bench_probe_main (int argc, char * * argv);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <audacious/misc.h>
+
+#include "bench.h"
+
+/* Values are kept as strings, the same way the real config database keeps
+ * them, so that a value set with one type and read back with another behaves
+ * as it would in Audacious. */
+
+static GHashTable * config;
+
+static char * make_key (const char * section, const char * name)
+{
+    return g_strdup_printf ("%s:%s", section ? section : "audacious", name);
+}
+
+static const char * lookup (const char * section, const char * name)
+{
+    char * key = make_key (section, name);
+    const char * value = g_hash_table_lookup (config, key);
+    g_free (key);
+    return value;
+}
+
+static void store (const char * section, const char * name, const char * value)
+{
+    g_hash_table_insert (config, make_key (section, name), g_strdup (value));
+}
+
+static void config_set_defaults (const char * section, const char * const * entries)
+{
+    for (; entries[0] && entries[1]; entries += 2)
+    {
+        if (! lookup (section, entries[0]))
+            store (section, entries[0], entries[1]);
+    }
+}
+
+static gboolean match_section (void * key, void * value, void * prefix)
+{
+    return g_str_has_prefix (key, prefix);
+}
+
+static void config_clear_section (const char * section)
+{
+    char * prefix = make_key (section, "");
+    g_hash_table_foreach_remove (config, match_section, prefix);
+    g_free (prefix);
+}
+
+static void set_string (const char * section, const char * name, const char * value)
+{
+    store (section, name, value);
+}
+
+static char * get_string (const char * section, const char * name)
+{
+    const char * value = lookup (section, name);
+    return g_strdup (value ? value : "");
+}
+
+static void set_bool (const char * section, const char * name, bool_t value)
+{
+    store (section, name, value ? "TRUE" : "FALSE");
+}
+
+static bool_t get_bool (const char * section, const char * name)
+{
+    const char * value = lookup (section, name);
+    return value && ! g_ascii_strcasecmp (value, "TRUE");
+}
+
+static void set_int (const char * section, const char * name, int value)
+{
+    char buf[16];
+    snprintf (buf, sizeof buf, "%d", value);
+    store (section, name, buf);
+}
+
+static int get_int (const char * section, const char * name)
+{
+    const char * value = lookup (section, name);
+    return value ? atoi (value) : 0;
+}
+
+static void set_double (const char * section, const char * name, double value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    store (section, name, g_ascii_dtostr (buf, sizeof buf, value));
+}
+
+static double get_double (const char * section, const char * name)
+{
+    const char * value = lookup (section, name);
+    return value ? g_ascii_strtod (value, NULL) : 0;
+}
+
+static struct MiscAPI bench_misc_api = {
+    .config_set_defaults = config_set_defaults,
+    .config_clear_section = config_clear_section,
+    .set_string = set_string,
+    .get_string = get_string,
+    .set_bool = set_bool,
+    .get_bool = get_bool,
+    .set_int = set_int,
+    .get_int = get_int,
+    .set_double = set_double,
+    .get_double = get_double
+};
+
+AudAPITable bench_api_table = {
+    .misc_api = & bench_misc_api
+};
+
+void bench_config_init (void)
+{
+    config = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
+
+void bench_config_cleanup (void)
+{
+    g_hash_table_destroy (config);
+    config = NULL;
+}
+
+bool_t bench_config_override (const char * arg)
+{
+    const char * colon = strchr (arg, ':');
+    const char * equals = colon ? strchr (colon, '=') : NULL;
+
+    if (! colon || ! equals || colon == arg || equals == colon + 1)
+    {
+        fprintf (stderr, "Invalid config override: %s (expected section:name=value)\n", arg);
+        return FALSE;
+    }
+
+    char * section = g_strndup (arg, colon - arg);
+    char * name = g_strndup (colon + 1, equals - (colon + 1));
+
+    store (section, name, equals + 1);
+
+    g_free (section);
+    g_free (name);
+    return TRUE;
+}
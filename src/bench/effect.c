@@ -0,0 +1,328 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Effect benchmark: runs each effect plugin over every combination of channel
+ * count, sample rate and block size given on the command line, and reports
+ * throughput, cost per frame, added latency and peak memory use.
+ *
+ *     audbench effect -c 1,2,6 -r 44100,96000 -b 256,4096 \
+ *      src/compressor/compressor.so src/echo_plugin/echo-plugin.so
+ *
+ * The input is a synthetic test signal (a few sine tones with a slowly varying
+ * envelope and some noise) unless a file of raw native-endian 32-bit floats is
+ * given with -i.
+ *
+ * The signal is followed by a stretch of digital silence (-s), timed on its
+ * own.  Effects with feedback decay into subnormal numbers there, which can be
+ * far slower to compute than the signal itself; compare the "tail ns/f" column
+ * with and without e.g. -o echo_plugin:flush_denormals=FALSE. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "bench.h"
+
+#define MAX_VALUES 16
+
+static int channel_list[MAX_VALUES] = {2};
+static int n_channels = 1;
+static int rate_list[MAX_VALUES] = {44100};
+static int n_rates = 1;
+static int block_list[MAX_VALUES] = {512, 4096};
+static int n_blocks = 2;
+static int seconds = 10;
+static int silence_seconds = 2;
+
+static float * file_data;
+static int64_t file_samples;
+
+static void effect_usage (void)
+{
+    fprintf (stderr,
+     "Usage: audbench effect [options] <plugin.so> ...\n\n"
+     "  -c LIST    channel counts (default: 2)\n"
+     "  -r LIST    sample rates (default: 44100)\n"
+     "  -b LIST    block sizes in frames (default: 512,4096)\n"
+     "  -t SECS    seconds of audio per run (default: 10)\n"
+     "  -s SECS    seconds of silence after the audio (default: 2)\n"
+     "  -i FILE    read raw 32-bit float samples from FILE\n"
+     "  -o S:N=V   set config value N in section S to V\n\n"
+     "Lists are comma-separated, e.g. -c 1,2,6.\n");
+}
+
+static bool_t load_file (const char * path)
+{
+    char * contents;
+    gsize length;
+    GError * error = NULL;
+
+    if (! g_file_get_contents (path, & contents, & length, & error))
+    {
+        fprintf (stderr, "%s\n", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    if (length < sizeof (float))
+    {
+        fprintf (stderr, "%s contains no audio.\n", path);
+        g_free (contents);
+        return FALSE;
+    }
+
+    file_data = (float *) contents;
+    file_samples = length / sizeof (float);
+    return TRUE;
+}
+
+/* Fills one second of interleaved audio, which is then played in a loop. */
+static void fill_source (float * data, int channels, int rate)
+{
+    if (file_data)
+    {
+        int64_t samples = (int64_t) channels * rate;
+        for (int64_t i = 0; i < samples; i ++)
+            data[i] = file_data[i % file_samples];
+
+        return;
+    }
+
+    uint32_t seed = 12345;
+
+    for (int f = 0; f < rate; f ++)
+    {
+        float t = (float) f / rate;
+        float envelope = 0.3 + 0.25 * sinf (2 * M_PI * 2 * t);
+
+        for (int c = 0; c < channels; c ++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            float noise = (float) (int32_t) seed / G_MAXINT32;
+            float tone = sinf (2 * M_PI * (220 + 110 * c) * t) +
+             0.5 * sinf (2 * M_PI * (3520 + 440 * c) * t);
+
+            * data ++ = envelope * (0.6 * tone + 0.05 * noise);
+        }
+    }
+}
+
+static void run_one (EffectPlugin * ep, const char * name, int channels,
+ int rate, int block)
+{
+    int out_channels = channels, out_rate = rate;
+
+    float * source = g_new (float, (int64_t) channels * rate);
+    float * work = g_new (float, (int64_t) channels * block);
+    fill_source (source, channels, rate);
+
+    bench_reset_peak_rss ();
+
+    BenchTime total = {0, 0}, start;
+
+    bench_time_now (& start);
+    ep->start (& out_channels, & out_rate);
+    bench_time_add_since (& total, & start);
+
+    int64_t total_frames = (int64_t) seconds * rate;
+    int64_t out_samples = 0;
+    int pos = 0;
+    int latency = -1;
+
+    for (int64_t done = 0; done < total_frames; )
+    {
+        int frames = MIN (block, total_frames - done);
+
+        if (pos + frames > rate)
+            pos = 0;
+
+        memcpy (work, source + (int64_t) channels * pos, sizeof (float) * channels * frames);
+
+        float * data = work;
+        int samples = channels * frames;
+
+        bench_time_now (& start);
+        ep->process (& data, & samples);
+        bench_time_add_since (& total, & start);
+
+        out_samples += samples;
+        done += frames;
+        pos += frames;
+
+        /* sample the latency halfway through, once the plugin is primed */
+        if (latency < 0 && done >= total_frames / 2 && ep->adjust_delay)
+            latency = ep->adjust_delay (0);
+    }
+
+    BenchTime tail = {0, 0};
+    int64_t tail_frames = (int64_t) silence_seconds * rate;
+
+    for (int64_t done = 0; done < tail_frames; )
+    {
+        int frames = MIN (block, tail_frames - done);
+
+        memset (work, 0, sizeof (float) * channels * frames);
+
+        float * data = work;
+        int samples = channels * frames;
+
+        bench_time_now (& start);
+        ep->process (& data, & samples);
+        bench_time_add_since (& tail, & start);
+
+        out_samples += samples;
+        done += frames;
+    }
+
+    if (ep->finish)
+    {
+        float * data = work;
+        int samples = 0;
+
+        bench_time_now (& start);
+        ep->finish (& data, & samples);
+        bench_time_add_since (& total, & start);
+
+        out_samples += samples;
+    }
+
+    BenchTime flush_time = {0, 0};
+
+    if (ep->flush)
+    {
+        bench_time_now (& start);
+        ep->flush ();
+        bench_time_add_since (& flush_time, & start);
+    }
+
+    long peak_rss = bench_peak_rss ();
+
+    double in_samples = (double) total_frames * channels;
+    double cpu_secs = total.cpu / 1e9;
+
+    printf ("%-24s %3d %6d %6d  %3d %6d  %10.2f %9.1f %9.1f %9.1f %7d %8.1f %9ld\n",
+     name, channels, rate, block, out_channels, out_rate,
+     cpu_secs > 0 ? in_samples / cpu_secs / 1e6 : 0,
+     (double) total.cpu / total_frames,
+     tail_frames > 0 ? (double) tail.cpu / tail_frames : 0,
+     cpu_secs > 0 ? seconds / cpu_secs : 0,
+     MAX (latency, 0), flush_time.wall / 1e3, peak_rss);
+
+    if (out_channels > 0 && out_samples % out_channels)
+        fprintf (stderr, "%s: output is not a whole number of frames "
+         "(%" G_GINT64_FORMAT " samples).\n", name, out_samples);
+
+    g_free (source);
+    g_free (work);
+}
+
+static void run_plugin (const char * path)
+{
+    EffectPlugin * ep = (EffectPlugin *) bench_load_plugin (path, PLUGIN_TYPE_EFFECT);
+    if (! ep)
+        return;
+
+    if (ep->init && ! ep->init ())
+    {
+        fprintf (stderr, "%s: init failed.\n", path);
+        return;
+    }
+
+    char * name = g_path_get_basename (path);
+    char * dot = strrchr (name, '.');
+    if (dot)
+        * dot = 0;
+
+    for (int c = 0; c < n_channels; c ++)
+    {
+        for (int r = 0; r < n_rates; r ++)
+        {
+            for (int b = 0; b < n_blocks; b ++)
+                run_one (ep, name, channel_list[c], rate_list[r], MIN (block_list[b], rate_list[r]));
+        }
+    }
+
+    if (ep->cleanup)
+        ep->cleanup ();
+
+    g_free (name);
+}
+
+int bench_effect_main (int argc, char * * argv)
+{
+    int opt;
+
+    while ((opt = getopt (argc, argv, "c:r:b:t:s:i:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (! (n_channels = bench_parse_int_list (optarg, channel_list, MAX_VALUES)))
+                goto ERR;
+            break;
+        case 'r':
+            if (! (n_rates = bench_parse_int_list (optarg, rate_list, MAX_VALUES)))
+                goto ERR;
+            break;
+        case 'b':
+            if (! (n_blocks = bench_parse_int_list (optarg, block_list, MAX_VALUES)))
+                goto ERR;
+            break;
+        case 't':
+            if ((seconds = atoi (optarg)) <= 0)
+                goto ERR;
+            break;
+        case 's':
+            if ((silence_seconds = atoi (optarg)) < 0)
+                goto ERR;
+            break;
+        case 'i':
+            if (! load_file (optarg))
+                return EXIT_FAILURE;
+            break;
+        case 'o':
+            if (! bench_config_override (optarg))
+                return EXIT_FAILURE;
+            break;
+        default:
+            goto ERR;
+        }
+    }
+
+    if (optind == argc)
+        goto ERR;
+
+    printf ("%-24s %3s %6s %6s  %3s %6s  %10s %9s %9s %9s %7s %8s %9s\n",
+     "plugin", "ch", "rate", "block", "och", "orate", "Msamp/s",
+     "ns/frame", "tail ns/f", "realtime", "lat ms", "flush us", "peak KiB");
+
+    for (int i = optind; i < argc; i ++)
+        run_plugin (argv[i]);
+
+    g_free (file_data);
+    return EXIT_SUCCESS;
+
+ERR:
+    effect_usage ();
+    return EXIT_FAILURE;
+}
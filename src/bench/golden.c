@@ -0,0 +1,269 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Golden hashes for the input benchmark.  Emulator plugins (console, adplug,
+ * sid, psf, xsf, vtx) are deterministic: the same tune rendered for the same
+ * length gives the same samples, bit for bit.  A change meant only to make
+ * one faster can therefore be checked by hashing what it renders and
+ * comparing with a hash taken before the change:
+ *
+ *     audbench input -T src/unix-io/unix-io.so -P src/console/console.so \
+ *      -l 30 -G golden.txt $(find corpus -name '*.spc')     (before)
+ *     audbench input -T src/unix-io/unix-io.so -P src/console/console.so \
+ *      -l 30 -g golden.txt -R trend.tsv $(find corpus -name '*.spc')     (after)
+ *
+ * The hash (64-bit FNV-1a) covers the output format, rate and channels and
+ * the first -l seconds of audio, so that a plugin that does not stop exactly
+ * on time still hashes the same.  Files are matched by base name.
+ *
+ * With -R, every run is also appended to a tab-separated file with the date,
+ * so that the timings can be followed from one change to the next. */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "bench.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct {
+    uint64_t hash;
+    int64_t bytes;
+} Golden;
+
+static GHashTable * golden; /* loaded with -g */
+static GHashTable * rendered; /* for -G */
+static int matched, differed, missing;
+
+static FILE * trend;
+static char trend_date[32];
+
+uint64_t bench_hash_init (void)
+{
+    return FNV_OFFSET;
+}
+
+uint64_t bench_hash_add (uint64_t hash, const void * data, int64_t length)
+{
+    const unsigned char * p = data, * end = p + length;
+
+    while (p < end)
+    {
+        hash ^= * p ++;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static Golden * golden_new (uint64_t hash, int64_t bytes)
+{
+    Golden * entry = g_slice_new (Golden);
+    entry->hash = hash;
+    entry->bytes = bytes;
+    return entry;
+}
+
+static void golden_free (void * entry)
+{
+    g_slice_free (Golden, entry);
+}
+
+static GHashTable * golden_table (void)
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, golden_free);
+}
+
+bool_t bench_golden_load (const char * path)
+{
+    FILE * file = fopen (path, "r");
+    if (! file)
+    {
+        perror (path);
+        return FALSE;
+    }
+
+    if (! golden)
+        golden = golden_table ();
+
+    char line[1024];
+    int number = 0;
+
+    while (fgets (line, sizeof line, file))
+    {
+        uint64_t hash;
+        int64_t bytes;
+        int name;
+
+        number ++;
+        line[strcspn (line, "\n")] = 0;
+
+        if (! line[0] || line[0] == '#')
+            continue;
+
+        if (sscanf (line, "%" SCNx64 " %" SCNd64 " %n", & hash, & bytes, & name) < 2
+         || ! line[name])
+        {
+            fprintf (stderr, "%s:%d: bad line.\n", path, number);
+            continue;
+        }
+
+        g_hash_table_replace (golden, g_strdup (line + name), golden_new (hash, bytes));
+    }
+
+    fclose (file);
+    return TRUE;
+}
+
+bool_t bench_golden_active (void)
+{
+    return golden || rendered;
+}
+
+void bench_golden_record (void)
+{
+    if (! rendered)
+        rendered = golden_table ();
+}
+
+void bench_golden_check (const char * name, uint64_t hash, int64_t bytes)
+{
+    if (rendered)
+        g_hash_table_replace (rendered, g_strdup (name), golden_new (hash, bytes));
+
+    if (! golden)
+        return;
+
+    Golden * entry = g_hash_table_lookup (golden, name);
+
+    if (! entry)
+    {
+        fprintf (stderr, "%s: no golden hash.\n", name);
+        missing ++;
+    }
+    else if (entry->hash != hash || entry->bytes != bytes)
+    {
+        fprintf (stderr, "%s: output differs: %016" PRIx64 " (%" PRId64
+         " bytes), expected %016" PRIx64 " (%" PRId64 " bytes).\n", name, hash,
+         bytes, entry->hash, entry->bytes);
+        differed ++;
+    }
+    else
+        matched ++;
+}
+
+bool_t bench_golden_finish (const char * save_path)
+{
+    bool_t ok = TRUE;
+
+    if (golden)
+    {
+        printf ("\ngolden: %d matched, %d differed, %d missing\n", matched,
+         differed, missing);
+        ok = ! differed;
+    }
+
+    if (rendered)
+    {
+        FILE * file = fopen (save_path, "w");
+
+        if (! file)
+        {
+            perror (save_path);
+            ok = FALSE;
+        }
+        else
+        {
+            GList * names = g_list_sort (g_hash_table_get_keys (rendered),
+             (GCompareFunc) strcmp);
+
+            fprintf (file, "# hash, bytes, file (written by audbench input -G)\n");
+
+            for (GList * node = names; node; node = node->next)
+            {
+                Golden * entry = g_hash_table_lookup (rendered, node->data);
+                fprintf (file, "%016" PRIx64 " %" PRId64 " %s\n", entry->hash,
+                 entry->bytes, (const char *) node->data);
+            }
+
+            g_list_free (names);
+
+            if (fclose (file) < 0)
+            {
+                perror (save_path);
+                ok = FALSE;
+            }
+        }
+    }
+
+    bench_golden_discard ();
+    return ok;
+}
+
+void bench_golden_discard (void)
+{
+    if (golden)
+    {
+        g_hash_table_destroy (golden);
+        golden = NULL;
+    }
+
+    if (rendered)
+    {
+        g_hash_table_destroy (rendered);
+        rendered = NULL;
+    }
+
+    matched = differed = missing = 0;
+}
+
+bool_t bench_trend_open (const char * path)
+{
+    if (! (trend = fopen (path, "a")))
+    {
+        perror (path);
+        return FALSE;
+    }
+
+    time_t now = time (NULL);
+    strftime (trend_date, sizeof trend_date, "%Y-%m-%dT%H:%M:%S", localtime (& now));
+    return TRUE;
+}
+
+void bench_trend_add (const char * name, const char * what, double audio,
+ double wall, double cpu)
+{
+    if (! trend)
+        return;
+
+    fprintf (trend, "%s\t%s\t%s\t%.3f\t%.4f\t%.4f\t%.2f\n", trend_date, name,
+     what, audio, wall, cpu, cpu > 0 ? audio / cpu : 0);
+}
+
+void bench_trend_close (void)
+{
+    if (trend)
+    {
+        fclose (trend);
+        trend = NULL;
+    }
+}
@@ -0,0 +1,774 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Input benchmark: decodes files to a null output as fast as the decoder will
+ * go and reports wall time, CPU time and realtime factor for each file and for
+ * each file format (extension).
+ *
+ *     audbench input -T src/unix-io/unix-io.so -P src/vtx/vtx.so \
+ *      -P src/mpg123/madplug.so $(find music -name '*.vtx' -o -name '*.mp3')
+ *
+ * Each file is handed to the first plugin (in command line order) that claims
+ * it, either by extension or through is_our_file_from_vfs().  Playback runs in
+ * its own thread, as it does in Audacious, so that stop() can be called from
+ * outside when the -l time limit is reached.
+ *
+ * With -F, the decoded audio goes to an output plugin instead; together with
+ * -j this turns the benchmark into a batch transcoder:
+ *
+ *     audbench input -T src/unix-io/unix-io.so -P src/flacng/flacng.so \
+ *      -o filewriter:fileext=1 -o filewriter:save_original=FALSE \
+ *      -o filewriter:file_path=file:///tmp/out \
+ *      -o filewriter:filenamefromtags=FALSE \
+ *      -F src/filewriter/filewriter.so -j 8 $(find music -name '*.flac')
+ *
+ * Output plugins read their settings when loaded, so -o has to come before
+ * -F.  filewriter asks the playlist about the song being played; the answers
+ * come from the file being decoded (see the playlist functions below).
+ *
+ * With -g or -G, the audio is also hashed and checked against, or saved as,
+ * a set of golden hashes; -R keeps a record of timings (see golden.c).
+ *
+ * filewriter and its encoders keep their state in globals, so parallel jobs
+ * cannot share a process.  With -j, every file is decoded in a child process
+ * of its own, forked after the plugins are loaded, and the children send
+ * their results back through a pipe for the summary. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include <libaudcore/audio.h>
+#include <libaudcore/audstrings.h>
+#include <libaudcore/tuple.h>
+#include <libaudcore/vfs.h>
+
+#include <audacious/playlist.h>
+
+#include "bench.h"
+
+typedef struct {
+    char * ext;
+    double audio, wall, cpu;
+    int files;
+} FormatStats;
+
+/* sent from a child process through the results pipe */
+typedef struct {
+    char ext[16], name[128], what[32];
+    double audio, wall, cpu;
+    uint64_t hash;
+    int64_t hashed;
+} RunResult;
+
+static GSList * transports;
+static GSList * inputs;
+static GSList * outputs;
+static OutputPlugin * encoder; /* the first in outputs */
+static int repeats = 1;
+static int time_limit = -1; /* milliseconds */
+static int jobs = 1;
+static const char * golden_save_path;
+
+static GHashTable * format_stats;
+static int result_fd = -1; /* in child processes */
+
+/* the file being decoded, for the playlist functions */
+static const char * cur_uri;
+static Tuple * cur_tuple;
+
+/* state of the current playback, shared with the fake output */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static void * pb_data;
+static int out_format, out_rate, out_channels;
+static int64_t out_bytes;
+static uint64_t out_hash;
+static int64_t out_hashed, hash_limit;
+static bool_t pb_ready, pb_done;
+static bool_t out_open;
+
+static void input_usage (void)
+{
+    fprintf (stderr,
+     "Usage: audbench input [options] <file> ...\n\n"
+     "  -T PLUGIN  load a transport plugin (at least unix-io is needed)\n"
+     "  -P PLUGIN  load an input plugin (may be given several times)\n"
+     "  -n COUNT   decode each file COUNT times (default: 1)\n"
+     "  -l SECS    stop after SECS seconds of audio (for endless formats)\n"
+     "  -o S:N=V   set config value N in section S to V\n"
+     "  -F PLUGIN  write the audio to an output plugin, such as filewriter\n"
+     "  -j JOBS    decode JOBS files at once, each in its own process\n"
+     "             (default: 1; 0 means one per processor)\n"
+     "  -g FILE    check the audio against the golden hashes in FILE\n"
+     "  -G FILE    save the hashes of the audio to FILE as golden hashes\n"
+     "  -R FILE    append the timings to FILE, for following a trend\n");
+}
+
+static int pl_get_playing (void)
+{
+    return 0;
+}
+
+static int pl_get_position (int playlist)
+{
+    return 0;
+}
+
+static char * pl_entry_get_filename (int playlist, int entry)
+{
+    return str_get (cur_uri);
+}
+
+static Tuple * pl_entry_get_tuple (int playlist, int entry, bool_t fast)
+{
+    return cur_tuple ? tuple_ref (cur_tuple) : NULL;
+}
+
+static char * pl_entry_get_title (int playlist, int entry, bool_t fast)
+{
+    char * title = cur_tuple ? tuple_get_str (cur_tuple, FIELD_TITLE, NULL) : NULL;
+    if (title)
+        return title;
+
+    char * base = g_path_get_basename (cur_uri);
+    title = str_get (base);
+    g_free (base);
+    return title;
+}
+
+static struct PlaylistAPI bench_playlist_api = {
+    .playlist_get_playing = pl_get_playing,
+    .playlist_get_position = pl_get_position,
+    .playlist_entry_get_filename = pl_entry_get_filename,
+    .playlist_entry_get_tuple = pl_entry_get_tuple,
+    .playlist_entry_get_title = pl_entry_get_title
+};
+
+static VFSConstructor * lookup_transport (const char * scheme)
+{
+    for (GSList * node = transports; node; node = node->next)
+    {
+        TransportPlugin * tp = node->data;
+
+        for (int i = 0; tp->schemes[i]; i ++)
+        {
+            if (! strcmp (tp->schemes[i], scheme))
+                return tp->vtable;
+        }
+    }
+
+    return NULL;
+}
+
+static int64_t bytes_per_second (void)
+{
+    return (int64_t) FMT_SIZEOF (out_format) * out_channels * out_rate;
+}
+
+static int written_ms_locked (void)
+{
+    int64_t bps = bytes_per_second ();
+    return bps ? out_bytes * 1000 / bps : 0;
+}
+
+static int null_open_audio (int format, int rate, int channels)
+{
+    if (encoder)
+    {
+        if (out_open)
+            encoder->close_audio ();
+
+        out_open = encoder->open_audio (format, rate, channels);
+        if (! out_open)
+            return 0;
+    }
+
+    pthread_mutex_lock (& mutex);
+    out_format = format;
+    out_rate = rate;
+    out_channels = channels;
+    out_bytes = 0;
+
+    int params[3] = {format, rate, channels};
+    out_hash = bench_hash_add (out_hash, params, sizeof params);
+    hash_limit = (time_limit >= 0) ? out_hashed + (int64_t) time_limit *
+     bytes_per_second () / 1000 : INT64_MAX;
+    pthread_mutex_unlock (& mutex);
+    return 1;
+}
+
+static void null_set_replaygain_info (const ReplayGainInfo * info)
+{
+}
+
+static void null_write_audio (void * data, int length)
+{
+    if (out_open)
+        encoder->write_audio (data, length);
+
+    pthread_mutex_lock (& mutex);
+    out_bytes += length;
+
+    if (bench_golden_active () && out_hashed < hash_limit)
+    {
+        int64_t count = MIN (length, hash_limit - out_hashed);
+        out_hash = bench_hash_add (out_hash, data, count);
+        out_hashed += count;
+    }
+
+    pthread_mutex_unlock (& mutex);
+}
+
+static void null_abort_write (void)
+{
+}
+
+static void null_pause (bool_t pause)
+{
+}
+
+static int null_written_time (void)
+{
+    pthread_mutex_lock (& mutex);
+    int time = written_ms_locked ();
+    pthread_mutex_unlock (& mutex);
+    return time;
+}
+
+static void null_flush (int time)
+{
+    if (out_open)
+        encoder->flush (time);
+
+    pthread_mutex_lock (& mutex);
+    out_bytes = (int64_t) time * bytes_per_second () / 1000;
+    pthread_mutex_unlock (& mutex);
+}
+
+static struct OutputAPI null_output = {
+    .open_audio = null_open_audio,
+    .set_replaygain_info = null_set_replaygain_info,
+    .write_audio = null_write_audio,
+    .abort_write = null_abort_write,
+    .pause = null_pause,
+    .written_time = null_written_time,
+    .flush = null_flush
+};
+
+static void pb_set_data (InputPlayback * playback, void * data)
+{
+    pthread_mutex_lock (& mutex);
+    pb_data = data;
+    pthread_mutex_unlock (& mutex);
+}
+
+static void * pb_get_data (InputPlayback * playback)
+{
+    pthread_mutex_lock (& mutex);
+    void * data = pb_data;
+    pthread_mutex_unlock (& mutex);
+    return data;
+}
+
+static void pb_set_pb_ready (InputPlayback * playback)
+{
+    pthread_mutex_lock (& mutex);
+    pb_ready = TRUE;
+    pthread_mutex_unlock (& mutex);
+}
+
+static void pb_set_params (InputPlayback * playback, int bitrate, int rate, int channels)
+{
+}
+
+static void pb_set_tuple (InputPlayback * playback, Tuple * tuple)
+{
+    tuple_unref (tuple);
+}
+
+static void pb_set_gain_from_playlist (InputPlayback * playback)
+{
+}
+
+static InputPlayback playback = {
+    .output = & null_output,
+    .set_data = pb_set_data,
+    .get_data = pb_get_data,
+    .set_pb_ready = pb_set_pb_ready,
+    .set_params = pb_set_params,
+    .set_tuple = pb_set_tuple,
+    .set_gain_from_playlist = pb_set_gain_from_playlist
+};
+
+typedef struct {
+    InputPlugin * ip;
+    const char * uri;
+    VFSFile * file;
+    bool_t success;
+} PlayJob;
+
+static void * play_worker (void * arg)
+{
+    PlayJob * job = arg;
+
+    job->success = job->ip->play (& playback, job->uri, job->file, 0, time_limit, FALSE);
+
+    pthread_mutex_lock (& mutex);
+    pb_done = TRUE;
+    pthread_mutex_unlock (& mutex);
+
+    return NULL;
+}
+
+static bool_t has_extension (InputPlugin * ip, const char * ext)
+{
+    if (! ip->extensions || ! ext)
+        return FALSE;
+
+    for (int i = 0; ip->extensions[i]; i ++)
+    {
+        if (! g_ascii_strcasecmp (ip->extensions[i], ext))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static InputPlugin * find_decoder (const char * uri, const char * ext, VFSFile * file)
+{
+    for (GSList * node = inputs; node; node = node->next)
+    {
+        if (has_extension (node->data, ext))
+            return node->data;
+    }
+
+    for (GSList * node = inputs; node; node = node->next)
+    {
+        InputPlugin * ip = node->data;
+
+        if (! ip->is_our_file_from_vfs || ! file)
+            continue;
+
+        if (vfs_fseek (file, 0, SEEK_SET) < 0)
+            continue;
+
+        if (ip->is_our_file_from_vfs (uri, file))
+            return ip;
+    }
+
+    return NULL;
+}
+
+static void add_stats (const RunResult * result)
+{
+    if (result_fd >= 0)
+    {
+        /* less than PIPE_BUF, so the write is atomic */
+        if (write (result_fd, result, sizeof * result) != sizeof * result)
+            perror ("write");
+
+        return;
+    }
+
+    FormatStats * stats = g_hash_table_lookup (format_stats, result->ext);
+
+    if (! stats)
+    {
+        stats = g_slice_new0 (FormatStats);
+        stats->ext = g_strdup (result->ext);
+        g_hash_table_insert (format_stats, stats->ext, stats);
+    }
+
+    stats->audio += result->audio;
+    stats->wall += result->wall;
+    stats->cpu += result->cpu;
+    stats->files ++;
+
+    if (bench_golden_active ())
+        bench_golden_check (result->name, result->hash, result->hashed);
+
+    bench_trend_add (result->name, result->what, result->audio, result->wall,
+     result->cpu);
+}
+
+static void free_stats (void * data)
+{
+    FormatStats * stats = data;
+    g_free (stats->ext);
+    g_slice_free (FormatStats, stats);
+}
+
+static void print_row (const char * name, const char * what, double audio,
+ double wall, double cpu)
+{
+    printf ("%-32s %-16s %9.2f %8.3f %8.3f %9.1f %9.1f\n", name, what, audio,
+     wall, cpu, wall > 0 ? audio / wall : 0, cpu > 0 ? audio / cpu : 0);
+}
+
+static void run_file (const char * path)
+{
+    char * uri = strstr (path, "://") ? g_strdup (path) : filename_to_uri (path);
+    if (! uri)
+    {
+        fprintf (stderr, "%s: invalid file name.\n", path);
+        return;
+    }
+
+    const char * dot = strrchr (path, '.');
+    char * ext = g_ascii_strdown (dot && ! strchr (dot, '/') ? dot + 1 : "(none)", -1);
+
+    for (int run = 0; run < repeats; run ++)
+    {
+        VFSFile * file = vfs_fopen (uri, "r");
+        InputPlugin * ip = find_decoder (uri, ext, file);
+
+        if (! ip)
+        {
+            fprintf (stderr, "%s: no plugin claims this file.\n", path);
+            if (file)
+                vfs_fclose (file);
+            break;
+        }
+
+        if (encoder)
+        {
+            cur_uri = uri;
+            cur_tuple = (file && ip->probe_for_tuple) ? ip->probe_for_tuple (uri, file) : NULL;
+            if (! cur_tuple)
+                cur_tuple = tuple_new_from_filename (uri);
+        }
+
+        if (file)
+            vfs_fseek (file, 0, SEEK_SET);
+
+        pthread_mutex_lock (& mutex);
+        out_format = out_rate = out_channels = 0;
+        out_bytes = 0;
+        out_hash = bench_hash_init ();
+        out_hashed = 0;
+        hash_limit = INT64_MAX;
+        pb_data = NULL;
+        pb_ready = pb_done = FALSE;
+        pthread_mutex_unlock (& mutex);
+
+        PlayJob job = {ip, uri, file, FALSE};
+        BenchTime start, total = {0, 0};
+        pthread_t thread;
+
+        bench_time_now (& start);
+        pthread_create (& thread, NULL, play_worker, & job);
+
+        /* Not every plugin honors stop_time, so enforce the limit here too. */
+        bool_t stopped = FALSE;
+
+        while (1)
+        {
+            pthread_mutex_lock (& mutex);
+            bool_t done = pb_done;
+            bool_t over = (time_limit >= 0 && written_ms_locked () >= time_limit);
+            pthread_mutex_unlock (& mutex);
+
+            if (done)
+                break;
+
+            if (over && ! stopped && ip->stop)
+            {
+                ip->stop (& playback);
+                stopped = TRUE;
+            }
+
+            usleep (2000);
+        }
+
+        pthread_join (thread, NULL);
+
+        if (out_open)
+        {
+            if (encoder->drain)
+                encoder->drain ();
+
+            encoder->close_audio ();
+            out_open = FALSE;
+        }
+
+        bench_time_add_since (& total, & start);
+
+        if (cur_tuple)
+        {
+            tuple_unref (cur_tuple);
+            cur_tuple = NULL;
+        }
+
+        if (file)
+            vfs_fclose (file);
+
+        int64_t bps = bytes_per_second ();
+        double audio = bps ? (double) out_bytes / bps : 0;
+
+        if (! job.success)
+            fprintf (stderr, "%s: playback failed.\n", path);
+
+        RunResult result = {.audio = audio, .wall = total.wall / 1e9,
+         .cpu = total.cpu / 1e9, .hash = out_hash, .hashed = out_hashed};
+
+        char * name = g_path_get_basename (path);
+        g_strlcpy (result.ext, ext, sizeof result.ext);
+        g_strlcpy (result.name, name, sizeof result.name);
+        snprintf (result.what, sizeof result.what, "%s %d/%d", ext, out_rate, out_channels);
+        g_free (name);
+
+        print_row (result.name, result.what, audio, result.wall, result.cpu);
+        fflush (stdout);
+
+        add_stats (& result);
+    }
+
+    g_free (ext);
+    g_free (uri);
+}
+
+static void read_results (int fd)
+{
+    RunResult result;
+
+    while (read (fd, & result, sizeof result) == sizeof result)
+    {
+        result.ext[sizeof result.ext - 1] = 0;
+        result.name[sizeof result.name - 1] = 0;
+        result.what[sizeof result.what - 1] = 0;
+        add_stats (& result);
+    }
+}
+
+/* Returns the wall time taken, in seconds. */
+static double run_parallel (char * * files, int count)
+{
+    int fds[2];
+
+    if (pipe (fds) < 0)
+    {
+        perror ("pipe");
+        return 0;
+    }
+
+    fcntl (fds[0], F_SETFL, O_NONBLOCK);
+
+    BenchTime start, total = {0, 0};
+    bench_time_now (& start);
+
+    int next = 0, running = 0, done = 0;
+
+    while (done < count)
+    {
+        while (running < jobs && next < count)
+        {
+            fflush (stdout);
+            pid_t pid = fork ();
+
+            if (pid == 0)
+            {
+                close (fds[0]);
+                result_fd = fds[1];
+                run_file (files[next]);
+                _exit (EXIT_SUCCESS);
+            }
+
+            if (pid < 0)
+            {
+                /* give up on the rest, but let the running jobs finish */
+                perror ("fork");
+                count = next;
+                break;
+            }
+
+            next ++;
+            running ++;
+        }
+
+        struct pollfd pfd = {fds[0], POLLIN};
+        if (poll (& pfd, 1, 100) > 0)
+            read_results (fds[0]);
+
+        int status;
+        pid_t pid;
+
+        while (running && (pid = waitpid (-1, & status, WNOHANG)) > 0)
+        {
+            running --;
+            done ++;
+
+            if (! WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS)
+                fprintf (stderr, "[%d/%d] worker %d failed.\n", done, count, (int) pid);
+            else
+                fprintf (stderr, "[%d/%d] done.\n", done, count);
+        }
+    }
+
+    read_results (fds[0]);
+    close (fds[0]);
+    close (fds[1]);
+
+    bench_time_add_since (& total, & start);
+    return total.wall / 1e9;
+}
+
+static void print_batch (int files, double wall)
+{
+    GList * list = g_hash_table_get_values (format_stats);
+    double audio = 0;
+
+    for (GList * node = list; node; node = node->next)
+        audio += ((FormatStats *) node->data)->audio;
+
+    g_list_free (list);
+
+    printf ("\n%d files in %d jobs: %.2f s of audio in %.3f s (%.1fx realtime)\n",
+     files, jobs, audio, wall, wall > 0 ? audio / wall : 0);
+}
+
+static void print_summary (void)
+{
+    GList * keys = g_list_sort (g_hash_table_get_keys (format_stats), (GCompareFunc) strcmp);
+
+    printf ("\n%-32s %-16s %9s %8s %8s %9s %9s\n", "format", "files", "audio s",
+     "wall s", "cpu s", "x wall", "x cpu");
+
+    for (GList * node = keys; node; node = node->next)
+    {
+        FormatStats * stats = g_hash_table_lookup (format_stats, node->data);
+        SPRINTF (files, "%d", stats->files);
+        print_row (stats->ext, files, stats->audio, stats->wall, stats->cpu);
+    }
+
+    g_list_free (keys);
+}
+
+int bench_input_main (int argc, char * * argv)
+{
+    int opt, ret = EXIT_FAILURE;
+
+    bench_api_table.playlist_api = & bench_playlist_api;
+
+    while ((opt = getopt (argc, argv, "T:P:F:n:l:o:j:g:G:R:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'T':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_TRANSPORT, & transports))
+                goto CLEANUP;
+            break;
+        case 'P':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_INPUT, & inputs))
+                goto CLEANUP;
+            break;
+        case 'F':
+            if (encoder)
+                goto USAGE;
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_OUTPUT, & outputs))
+                goto CLEANUP;
+            encoder = outputs->data;
+            break;
+        case 'j':
+            if ((jobs = atoi (optarg)) < 0)
+                goto USAGE;
+            if (! jobs)
+                jobs = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+            break;
+        case 'n':
+            if ((repeats = atoi (optarg)) <= 0)
+                goto USAGE;
+            break;
+        case 'l':
+            if (atoi (optarg) <= 0)
+                goto USAGE;
+            time_limit = atoi (optarg) * 1000;
+            break;
+        case 'o':
+            if (! bench_config_override (optarg))
+                goto CLEANUP;
+            break;
+        case 'g':
+            if (! bench_golden_load (optarg))
+                goto CLEANUP;
+            break;
+        case 'G':
+            golden_save_path = optarg;
+            bench_golden_record ();
+            break;
+        case 'R':
+            if (! bench_trend_open (optarg))
+                goto CLEANUP;
+            break;
+        default:
+            goto USAGE;
+        }
+    }
+
+    if (! transports || ! inputs || optind == argc)
+        goto USAGE;
+
+    vfs_set_lookup_func (lookup_transport);
+    format_stats = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, free_stats);
+
+    printf ("%-32s %-16s %9s %8s %8s %9s %9s\n", "file", "format", "audio s",
+     "wall s", "cpu s", "x wall", "x cpu");
+
+    if (jobs > 1)
+    {
+        double wall = run_parallel (argv + optind, argc - optind);
+        print_summary ();
+        print_batch (argc - optind, wall);
+    }
+    else
+    {
+        for (int i = optind; i < argc; i ++)
+            run_file (argv[i]);
+
+        print_summary ();
+    }
+
+    g_hash_table_destroy (format_stats);
+    format_stats = NULL;
+    ret = bench_golden_finish (golden_save_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    goto CLEANUP;
+
+USAGE:
+    input_usage ();
+
+CLEANUP:
+    bench_golden_discard ();
+    bench_trend_close ();
+    golden_save_path = NULL;
+    bench_stop_plugins (outputs);
+    outputs = NULL;
+    encoder = NULL;
+    bench_stop_plugins (inputs);
+    inputs = NULL;
+    bench_stop_plugins (transports);
+    transports = NULL;
+    return ret;
+}
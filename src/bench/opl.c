@@ -0,0 +1,336 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* OPL export: renders AdLib songs to WAV files through the AdPlug plugin's
+ * batch API, as fast as the given number of threads will go.
+ *
+ *     audbench opl -T src/unix-io/unix-io.so -P src/adplug/adplug.so \
+ *      -j 0 -s 1,2 -d /tmp/out $(find music -name '*.d00')
+ *
+ * Every subsong in the -s list of every file is a job of its own, written to
+ * <dir>/<file name>.<subsong>.wav.  A subsong the file does not have counts as
+ * a failed job.  Unlike "audbench input -F", nothing goes through an output
+ * plugin, and the jobs share one process: each has a player and emulator of
+ * its own (see adplug_render_batch() in src/adplug/adplug-xmms.h). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <libaudcore/audstrings.h>
+#include <libaudcore/vfs.h>
+
+#include "bench.h"
+#include "../adplug/adplug-xmms.h"
+
+#define MAX_SUBSONGS 64
+#define WAV_HEADER 44
+
+typedef int (* RenderBatchFunc) (AdplugBatchJob * jobs, int count,
+ int threads, int rate, int channels);
+
+typedef struct {
+    FILE * file;
+    char * path;
+    int64_t bytes;
+} WavSink;
+
+static GSList * transports;
+static GSList * inputs;
+static int subsong_list[MAX_SUBSONGS] = {1};
+static int n_subsongs = 1;
+
+static void opl_usage (void)
+{
+    fprintf (stderr,
+     "Usage: audbench opl [options] -d DIR <file> ...\n\n"
+     "  -T PLUGIN  load a transport plugin (at least unix-io is needed)\n"
+     "  -P PLUGIN  load the AdPlug input plugin\n"
+     "  -d DIR     write the WAV files to DIR\n"
+     "  -s LIST    render the subsongs in LIST of each file, counting from 1\n"
+     "             (default: 1)\n"
+     "  -l SECS    stop each song after SECS seconds (default: 600)\n"
+     "  -r RATE    render at RATE Hz (default: 44100)\n"
+     "  -m         render in mono\n"
+     "  -j JOBS    render JOBS songs at once (default: 0, one per processor)\n"
+     "  -o S:N=V   set config value N in section S to V\n");
+}
+
+static VFSConstructor * lookup_transport (const char * scheme)
+{
+    for (GSList * node = transports; node; node = node->next)
+    {
+        TransportPlugin * tp = node->data;
+
+        for (int i = 0; tp->schemes[i]; i ++)
+        {
+            if (! strcmp (tp->schemes[i], scheme))
+                return tp->vtable;
+        }
+    }
+
+    return NULL;
+}
+
+static void put_le (unsigned char * out, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i ++)
+        out[i] = value >> (8 * i);
+}
+
+static void make_wav_header (unsigned char * out, int rate, int channels,
+ int64_t bytes)
+{
+    uint32_t size = MIN (bytes, UINT32_MAX - 36);
+
+    memcpy (out, "RIFF", 4);
+    put_le (out + 4, 36 + size, 4);
+    memcpy (out + 8, "WAVEfmt ", 8);
+    put_le (out + 16, 16, 4);
+    put_le (out + 20, 1, 2); /* PCM */
+    put_le (out + 22, channels, 2);
+    put_le (out + 24, rate, 4);
+    put_le (out + 28, rate * channels * 2, 4);
+    put_le (out + 32, channels * 2, 2);
+    put_le (out + 34, 16, 2);
+    memcpy (out + 36, "data", 4);
+    put_le (out + 40, size, 4);
+}
+
+/* called on the plugin's worker threads, each with its own sink */
+static bool_t wav_write (const void * data, int bytes, void * user)
+{
+    WavSink * sink = user;
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+    const int16_t * in = data;
+    int16_t swapped[bytes / 2];
+
+    for (int i = 0; i < bytes / 2; i ++)
+        swapped[i] = GINT16_SWAP_LE_BE (in[i]);
+
+    data = swapped;
+#endif
+
+    if (fwrite (data, 1, bytes, sink->file) != bytes)
+        return FALSE;
+
+    sink->bytes += bytes;
+    return TRUE;
+}
+
+static bool_t wav_open (WavSink * sink, const char * dir, const char * file,
+ int subsong)
+{
+    char * base = g_path_get_basename (file);
+    SPRINTF (name, "%s.%d.wav", base, subsong);
+    g_free (base);
+
+    sink->path = g_build_filename (dir, name, NULL);
+    sink->bytes = 0;
+
+    unsigned char header[WAV_HEADER] = {0};
+
+    if (! (sink->file = fopen (sink->path, "wb")) ||
+     fwrite (header, 1, WAV_HEADER, sink->file) != WAV_HEADER)
+    {
+        fprintf (stderr, "%s: cannot write.\n", sink->path);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static bool_t wav_close (WavSink * sink, int rate, int channels)
+{
+    unsigned char header[WAV_HEADER];
+    make_wav_header (header, rate, channels, sink->bytes);
+
+    bool_t ok = ! fseek (sink->file, 0, SEEK_SET) &&
+     fwrite (header, 1, WAV_HEADER, sink->file) == WAV_HEADER;
+
+    if (fclose (sink->file))
+        ok = FALSE;
+
+    sink->file = NULL;
+    return ok;
+}
+
+int bench_opl_main (int argc, char * * argv)
+{
+    int opt, ret = EXIT_FAILURE;
+    const char * dir = NULL;
+    int limit = 600, rate = 44100, channels = 2, threads = 0;
+
+    while ((opt = getopt (argc, argv, "T:P:d:s:l:r:mj:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'T':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_TRANSPORT, & transports))
+                goto CLEANUP;
+            break;
+        case 'P':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_INPUT, & inputs))
+                goto CLEANUP;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 's':
+            if (! (n_subsongs = bench_parse_int_list (optarg, subsong_list, MAX_SUBSONGS)))
+                goto USAGE;
+            break;
+        case 'l':
+            if ((limit = atoi (optarg)) < 0)
+                goto USAGE;
+            break;
+        case 'r':
+            if ((rate = atoi (optarg)) <= 0)
+                goto USAGE;
+            break;
+        case 'm':
+            channels = 1;
+            break;
+        case 'j':
+            if ((threads = atoi (optarg)) < 0)
+                goto USAGE;
+            break;
+        case 'o':
+            if (! bench_config_override (optarg))
+                goto CLEANUP;
+            break;
+        default:
+            goto USAGE;
+        }
+    }
+
+    if (! transports || ! inputs || ! dir || optind == argc)
+        goto USAGE;
+
+    RenderBatchFunc render_batch = (RenderBatchFunc) bench_find_symbol ("adplug_render_batch");
+
+    if (! render_batch)
+    {
+        fprintf (stderr, "No plugin loaded has adplug_render_batch().\n");
+        goto CLEANUP;
+    }
+
+    if (! threads)
+        threads = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+
+    vfs_set_lookup_func (lookup_transport);
+
+    int n_files = argc - optind;
+    int count = n_files * n_subsongs;
+    AdplugBatchJob * jobs = g_new0 (AdplugBatchJob, count);
+    WavSink * sinks = g_new0 (WavSink, count);
+    bool_t opened = TRUE;
+
+    for (int f = 0; f < n_files; f ++)
+    {
+        const char * path = argv[optind + f];
+        char * uri = strstr (path, "://") ? g_strdup (path) : filename_to_uri (path);
+
+        for (int s = 0; s < n_subsongs; s ++)
+        {
+            AdplugBatchJob * job = & jobs[f * n_subsongs + s];
+            WavSink * sink = & sinks[f * n_subsongs + s];
+
+            job->filename = uri ? str_get (uri) : NULL;
+            job->subsong = subsong_list[s] - 1;
+            job->max_ms = limit * 1000;
+            job->write = wav_write;
+            job->user = sink;
+
+            if (! uri || ! wav_open (sink, dir, path, subsong_list[s]))
+                opened = FALSE;
+        }
+
+        g_free (uri);
+    }
+
+    BenchTime start, total = {0, 0};
+    int done = 0;
+
+    if (opened)
+    {
+        bench_time_now (& start);
+        render_batch (jobs, count, threads, rate, channels);
+        bench_time_add_since (& total, & start);
+    }
+
+    double audio = 0;
+
+    for (int j = 0; j < count; j ++)
+    {
+        AdplugBatchJob * job = & jobs[j];
+        WavSink * sink = & sinks[j];
+
+        if (sink->file && ! wav_close (sink, rate, channels))
+            job->ok = FALSE;
+
+        if (job->ok)
+            done ++;
+
+        if (opened)
+        {
+            printf ("%-48.48s %3d %9.2f s  %s\n", sink->path, job->subsong + 1,
+             (double) job->frames / rate, job->ok ? "ok" : "failed");
+            audio += (double) job->frames / rate;
+        }
+
+        if (! job->ok && sink->path)
+            unlink (sink->path);
+
+        if (job->filename)
+            str_unref ((char *) job->filename);
+
+        g_free (sink->path);
+    }
+
+    if (opened)
+    {
+        double wall = total.wall / 1e9, cpu = total.cpu / 1e9;
+
+        printf ("\n%d of %d songs on %d threads: %.2f s of audio in %.3f s "
+         "(%.1fx realtime, %.1fx per CPU second)\n", done, count, threads, audio,
+         wall, wall > 0 ? audio / wall : 0, cpu > 0 ? audio / cpu : 0);
+
+        if (done == count)
+            ret = EXIT_SUCCESS;
+    }
+
+    g_free (jobs);
+    g_free (sinks);
+    goto CLEANUP;
+
+USAGE:
+    opl_usage ();
+
+CLEANUP:
+    bench_stop_plugins (inputs);
+    inputs = NULL;
+    bench_stop_plugins (transports);
+    transports = NULL;
+    return ret;
+}
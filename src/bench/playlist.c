@@ -0,0 +1,685 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Playlist benchmark: has container plugins load and save synthetic playlists
+ * of growing size and reports, per format and size, how fast they go and what
+ * a load costs in memory.
+ *
+ *     audbench playlist -C src/m3u/m3u.so -C src/pls/pls.so -C src/asx/asx.so \
+ *      -C src/xspf/xspf.so -C src/audpl/audpl.so -C src/cue/cue.so \
+ *      -n 1000,10000,100000,1000000
+ *
+ * For each extension of each plugin that there is a generator for, a playlist
+ * with the given number of entries is written to an in-memory transport
+ * ("mem://"), so that neither the disk nor the page cache is measured.  Every
+ * entry has a URI, a title, an artist, an album, a track number and a length,
+ * as far as the format can carry them.  audplb has no generator; its input is
+ * what the plugin itself saves.  libcue takes at most 99 tracks per sheet, so
+ * cue sheets stop there whatever the size asked for.
+ *
+ * The load is timed -r times and the best time is reported.  The peak memory
+ * (growth of the resident set over the load) and the number of allocations
+ * are from the first load, when nothing is left over from an earlier one.
+ * Then the same entries, with full tuples, are saved and loaded back, and the
+ * number of entries coming back is checked. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <libaudcore/audstrings.h>
+#include <libaudcore/index.h>
+#include <libaudcore/tuple.h>
+#include <libaudcore/vfs.h>
+
+#include <audacious/misc.h>
+
+#include "bench.h"
+
+#define MAX_SIZES 16
+#define MAX_CUE_TRACKS 99
+#define TRACKS_PER_ALBUM 10
+#define ALBUMS_PER_ARTIST 5
+
+typedef struct {
+    const char * ext;
+    void (* generate) (GString * out, int count);
+    int max_entries; /* 0 if unlimited */
+} Format;
+
+typedef struct {
+    int64_t ns, allocs;
+    long peak; /* KiB */
+    int entries;
+} LoadResult;
+
+/* a file of the in-memory transport */
+typedef struct {
+    char * data;
+    int64_t len, size;
+} MemBuf;
+
+typedef struct {
+    MemBuf * buf;
+    int64_t pos;
+} MemFile;
+
+static GSList * containers;
+static int size_list[MAX_SIZES] = {1000, 10000, 100000};
+static int n_sizes = 3;
+static int repeats = 3;
+
+static GHashTable * mem_files; /* URI -> MemBuf */
+
+static void playlist_usage (void)
+{
+    fprintf (stderr,
+     "Usage: audbench playlist [options]\n\n"
+     "  -C PLUGIN  load a container plugin (may be given several times)\n"
+     "  -n LIST    load and save playlists with each number of entries in LIST\n"
+     "             (default: 1000,10000,100000)\n"
+     "  -r COUNT   time each load and save COUNT times (default: 3)\n"
+     "  -o S:N=V   set config value N in section S to V\n");
+}
+
+static void mem_buf_free (MemBuf * buf)
+{
+    free (buf->data);
+    g_slice_free (MemBuf, buf);
+}
+
+static void * mem_fopen (const char * uri, const char * mode)
+{
+    MemBuf * buf = g_hash_table_lookup (mem_files, uri);
+
+    if (mode[0] == 'w')
+    {
+        if (! buf)
+        {
+            buf = g_slice_new0 (MemBuf);
+            g_hash_table_insert (mem_files, g_strdup (uri), buf);
+        }
+
+        buf->len = 0;
+    }
+    else if (! buf)
+        return NULL;
+
+    MemFile * mf = g_slice_new (MemFile);
+    mf->buf = buf;
+    mf->pos = 0;
+    return mf;
+}
+
+static int mem_fclose (VFSFile * file)
+{
+    g_slice_free (MemFile, vfs_get_handle (file));
+    return 0;
+}
+
+static int64_t mem_fread (void * ptr, int64_t size, int64_t nitems, VFSFile * file)
+{
+    MemFile * mf = vfs_get_handle (file);
+
+    if (size <= 0 || mf->pos >= mf->buf->len)
+        return 0;
+
+    nitems = MIN (nitems, (mf->buf->len - mf->pos) / size);
+    memcpy (ptr, mf->buf->data + mf->pos, size * nitems);
+    mf->pos += size * nitems;
+    return nitems;
+}
+
+static int64_t mem_fwrite (const void * ptr, int64_t size, int64_t nitems,
+ VFSFile * file)
+{
+    MemFile * mf = vfs_get_handle (file);
+    MemBuf * buf = mf->buf;
+    int64_t len = size * nitems;
+
+    if (len <= 0)
+        return 0;
+
+    if (mf->pos + len > buf->size)
+    {
+        buf->size = MAX (buf->size * 2, mf->pos + len);
+        buf->data = realloc (buf->data, buf->size);
+    }
+
+    if (mf->pos > buf->len)
+        memset (buf->data + buf->len, 0, mf->pos - buf->len);
+
+    memcpy (buf->data + mf->pos, ptr, len);
+    mf->pos += len;
+    buf->len = MAX (buf->len, mf->pos);
+    return nitems;
+}
+
+static int mem_fseek (VFSFile * file, int64_t offset, int whence)
+{
+    MemFile * mf = vfs_get_handle (file);
+    int64_t base = (whence == SEEK_SET) ? 0 : (whence == SEEK_CUR) ? mf->pos :
+     (whence == SEEK_END) ? mf->buf->len : -1;
+
+    if (base < 0 || base + offset < 0)
+        return -1;
+
+    mf->pos = base + offset;
+    return 0;
+}
+
+static int64_t mem_ftell (VFSFile * file)
+{
+    return ((MemFile *) vfs_get_handle (file))->pos;
+}
+
+static bool_t mem_feof (VFSFile * file)
+{
+    MemFile * mf = vfs_get_handle (file);
+    return (mf->pos >= mf->buf->len);
+}
+
+static int mem_ftruncate (VFSFile * file, int64_t length)
+{
+    MemFile * mf = vfs_get_handle (file);
+
+    if (length < 0 || length > mf->buf->len)
+        return -1;
+
+    mf->buf->len = length;
+    return 0;
+}
+
+static int64_t mem_fsize (VFSFile * file)
+{
+    return ((MemFile *) vfs_get_handle (file))->buf->len;
+}
+
+static VFSConstructor mem_vtable = {
+    .vfs_fopen_impl = mem_fopen,
+    .vfs_fclose_impl = mem_fclose,
+    .vfs_fread_impl = mem_fread,
+    .vfs_fwrite_impl = mem_fwrite,
+    .vfs_fseek_impl = mem_fseek,
+    .vfs_ftell_impl = mem_ftell,
+    .vfs_feof_impl = mem_feof,
+    .vfs_ftruncate_impl = mem_ftruncate,
+    .vfs_fsize_impl = mem_fsize
+};
+
+static VFSConstructor * lookup_transport (const char * scheme)
+{
+    return strcmp (scheme, "mem") ? NULL : & mem_vtable;
+}
+
+static int64_t mem_file_size (const char * uri)
+{
+    MemBuf * buf = g_hash_table_lookup (mem_files, uri);
+    return buf ? buf->len : 0;
+}
+
+/* Resolves a playlist entry as Audacious does: URIs are taken as they are,
+ * local paths are converted, and anything else is relative to the playlist. */
+static char * pl_construct_uri (const char * string, const char * playlist_name)
+{
+    if (strstr (string, "://"))
+        return strdup (string);
+
+    if (string[0] == '/')
+        return filename_to_uri (string);
+
+    const char * slash = strrchr (playlist_name, '/');
+    if (! slash)
+        return NULL;
+
+    int baselen = slash + 1 - playlist_name;
+    char * uri = malloc (baselen + 3 * strlen (string) + 1);
+
+    memcpy (uri, playlist_name, baselen);
+    str_encode_percent (string, -1, uri + baselen);
+    return uri;
+}
+
+/* Cue sheets look for a decoder for each audio file they refer to.  These
+ * files do not exist, so the tracks get what the sheet says and no more. */
+static PluginHandle * pl_file_find_decoder (const char * filename, bool_t fast)
+{
+    return NULL;
+}
+
+static Tuple * pl_file_read_tuple (const char * filename, PluginHandle * decoder)
+{
+    return NULL;
+}
+
+static int entry_album (int i)
+{
+    return i / TRACKS_PER_ALBUM;
+}
+
+static int entry_artist (int i)
+{
+    return entry_album (i) / ALBUMS_PER_ARTIST;
+}
+
+static int entry_track (int i)
+{
+    return i % TRACKS_PER_ALBUM + 1;
+}
+
+static int entry_length (int i) /* seconds */
+{
+    return 120 + i % 240;
+}
+
+static void append_uri (GString * out, int i)
+{
+    g_string_append_printf (out,
+     "file:///music/Artist%%20%d/Album%%20%d/%02d%%20Track%%20%d.flac",
+     entry_artist (i), entry_album (i), entry_track (i), i);
+}
+
+static void gen_m3u (GString * out, int count)
+{
+    g_string_append (out, "#EXTM3U\n");
+
+    for (int i = 0; i < count; i ++)
+    {
+        g_string_append_printf (out, "#EXTINF:%d,Artist %d - Track %d\n",
+         entry_length (i), entry_artist (i), i);
+        append_uri (out, i);
+        g_string_append_c (out, '\n');
+    }
+}
+
+static void gen_pls (GString * out, int count)
+{
+    g_string_append_printf (out, "[playlist]\nNumberOfEntries=%d\n", count);
+
+    for (int i = 0; i < count; i ++)
+    {
+        g_string_append_printf (out, "File%d=", i + 1);
+        append_uri (out, i);
+        g_string_append_printf (out, "\nTitle%d=Artist %d - Track %d\nLength%d=%d\n",
+         i + 1, entry_artist (i), i, i + 1, entry_length (i));
+    }
+
+    g_string_append (out, "Version=2\n");
+}
+
+static void gen_asx (GString * out, int count)
+{
+    g_string_append (out, "[Reference]\r\n");
+
+    for (int i = 0; i < count; i ++)
+    {
+        g_string_append_printf (out, "Ref%d=", i + 1);
+        append_uri (out, i);
+        g_string_append (out, "\r\n");
+    }
+}
+
+static void gen_xspf (GString * out, int count)
+{
+    g_string_append (out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+     "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+     "<title>Benchmark</title>\n<trackList>\n");
+
+    for (int i = 0; i < count; i ++)
+    {
+        g_string_append (out, "<track><location>");
+        append_uri (out, i);
+        g_string_append_printf (out, "</location><creator>Artist %d</creator>"
+         "<title>Track %d</title><album>Album %d</album><trackNum>%d</trackNum>"
+         "<duration>%d</duration></track>\n", entry_artist (i), i,
+         entry_album (i), entry_track (i), entry_length (i) * 1000);
+    }
+
+    g_string_append (out, "</trackList>\n</playlist>\n");
+}
+
+static void gen_audpl (GString * out, int count)
+{
+    g_string_append (out, "title=Benchmark\n");
+
+    for (int i = 0; i < count; i ++)
+    {
+        g_string_append (out, "uri=");
+        append_uri (out, i);
+        g_string_append_printf (out, "\ntitle=Track%%20%d\nartist=Artist%%20%d\n"
+         "album=Album%%20%d\ntrack-number=%d\nlength=%d\n", i, entry_artist (i),
+         entry_album (i), entry_track (i), entry_length (i) * 1000);
+    }
+}
+
+static void gen_cue (GString * out, int count)
+{
+    g_string_append (out, "PERFORMER \"Benchmark\"\nTITLE \"Benchmark\"\n");
+
+    int offset = 0; /* seconds into the current file */
+
+    for (int i = 0; i < count; i ++)
+    {
+        if (entry_track (i) == 1)
+        {
+            g_string_append_printf (out, "FILE \"Album %d.flac\" WAVE\n",
+             entry_album (i));
+            offset = 0;
+        }
+
+        g_string_append_printf (out, "  TRACK %02d AUDIO\n    TITLE \"Track %d\"\n"
+         "    PERFORMER \"Artist %d\"\n    INDEX 01 %02d:%02d:00\n", i + 1, i,
+         entry_artist (i), offset / 60, offset % 60);
+
+        offset += entry_length (i);
+    }
+}
+
+static const Format formats[] = {
+    {"m3u", gen_m3u},
+    {"pls", gen_pls},
+    {"asx", gen_asx},
+    {"xspf", gen_xspf},
+    {"audpl", gen_audpl},
+    {"audplb", NULL},
+    {"cue", gen_cue, MAX_CUE_TRACKS}
+};
+
+/* the entries to be saved, with everything the generators write */
+static void make_entries (int count, Index * filenames, Index * tuples)
+{
+    GString * uri = g_string_new (NULL);
+
+    for (int i = 0; i < count; i ++)
+    {
+        g_string_truncate (uri, 0);
+        append_uri (uri, i);
+
+        Tuple * tuple = tuple_new_from_filename (uri->str);
+        SPRINTF (title, "Track %d", i);
+        SPRINTF (artist, "Artist %d", entry_artist (i));
+        SPRINTF (album, "Album %d", entry_album (i));
+
+        tuple_set_str (tuple, FIELD_TITLE, NULL, title);
+        tuple_set_str (tuple, FIELD_ARTIST, NULL, artist);
+        tuple_set_str (tuple, FIELD_ALBUM, NULL, album);
+        tuple_set_int (tuple, FIELD_TRACK_NUMBER, NULL, entry_track (i));
+        tuple_set_int (tuple, FIELD_LENGTH, NULL, entry_length (i) * 1000);
+
+        index_append (filenames, str_get (uri->str));
+        index_append (tuples, tuple);
+    }
+
+    g_string_free (uri, TRUE);
+}
+
+static void free_entries (Index * filenames, Index * tuples)
+{
+    for (int i = 0; i < index_count (filenames); i ++)
+        str_unref (index_get (filenames, i));
+
+    for (int i = 0; i < index_count (tuples); i ++)
+    {
+        Tuple * tuple = index_get (tuples, i);
+        if (tuple)
+            tuple_unref (tuple);
+    }
+
+    index_free (filenames);
+    index_free (tuples);
+}
+
+static bool_t run_load (PlaylistPlugin * pp, const char * uri, LoadResult * res)
+{
+    VFSFile * file = vfs_fopen (uri, "r");
+    if (! file)
+        return FALSE;
+
+    Index * filenames = index_new ();
+    Index * tuples = index_new ();
+    char * title = NULL;
+    BenchTime start, total = {0, 0};
+
+    bench_reset_peak_rss ();
+    long base = bench_peak_rss ();
+
+    bench_count_allocs (TRUE);
+    bench_time_now (& start);
+
+    bool_t ok = pp->load (uri, file, & title, filenames, tuples);
+
+    bench_time_add_since (& total, & start);
+    bench_count_allocs (FALSE);
+
+    res->ns = total.wall;
+    res->allocs = bench_allocs ();
+    res->peak = MAX (bench_peak_rss () - base, 0);
+    res->entries = index_count (filenames);
+
+    vfs_fclose (file);
+
+    if (title)
+        str_unref (title);
+
+    free_entries (filenames, tuples);
+    return ok;
+}
+
+/* Returns the wall time taken in nanoseconds, or -1 on error. */
+static int64_t run_save (PlaylistPlugin * pp, const char * uri,
+ Index * filenames, Index * tuples)
+{
+    VFSFile * file = vfs_fopen (uri, "w");
+    if (! file)
+        return -1;
+
+    BenchTime start, total = {0, 0};
+    bench_time_now (& start);
+
+    bool_t ok = pp->save (uri, file, "Benchmark", filenames, tuples);
+
+    bench_time_add_since (& total, & start);
+
+    if (vfs_fclose (file) < 0)
+        ok = FALSE;
+
+    return ok ? total.wall : -1;
+}
+
+static double per_second (int entries, int64_t ns)
+{
+    return ns > 0 ? entries * 1e9 / ns : 0;
+}
+
+static void bench_format (PlaylistPlugin * pp, const Format * format, int count)
+{
+    if (format->max_entries)
+        count = MIN (count, format->max_entries);
+
+    SPRINTF (in_uri, "mem:///bench/in.%s", format->ext);
+    SPRINTF (out_uri, "mem:///bench/out.%s", format->ext);
+
+    Index * filenames = index_new ();
+    Index * tuples = index_new ();
+    make_entries (count, filenames, tuples);
+
+    if (format->generate)
+    {
+        GString * text = g_string_new (NULL);
+        format->generate (text, count);
+
+        VFSFile * file = vfs_fopen (in_uri, "w");
+        vfs_fwrite (text->str, 1, text->len, file);
+        vfs_fclose (file);
+
+        g_string_free (text, TRUE);
+    }
+    else if (! pp->save || run_save (pp, in_uri, filenames, tuples) < 0)
+    {
+        printf ("%-8s %9d  (no input)\n", format->ext, count);
+        goto DONE;
+    }
+
+    LoadResult first = {0}, res;
+    int64_t load_ns = -1, save_ns = -1;
+
+    for (int r = 0; r < repeats; r ++)
+    {
+        if (! run_load (pp, in_uri, r ? & res : & first))
+        {
+            printf ("%-8s %9d  (load failed)\n", format->ext, count);
+            goto DONE;
+        }
+
+        int64_t ns = r ? res.ns : first.ns;
+        load_ns = (load_ns < 0) ? ns : MIN (load_ns, ns);
+    }
+
+    if (pp->save)
+    {
+        for (int r = 0; r < repeats; r ++)
+        {
+            int64_t ns = run_save (pp, out_uri, filenames, tuples);
+
+            if (ns < 0)
+            {
+                save_ns = -1;
+                break;
+            }
+
+            save_ns = (save_ns < 0) ? ns : MIN (save_ns, ns);
+        }
+    }
+
+    /* the output has to come back with as many entries as went in */
+    char check[32] = "ok";
+
+    if (first.entries != count)
+        snprintf (check, sizeof check, "loaded %d", first.entries);
+    else if (save_ns >= 0)
+    {
+        if (! run_load (pp, out_uri, & res))
+            snprintf (check, sizeof check, "reload failed");
+        else if (res.entries != count)
+            snprintf (check, sizeof check, "reloaded %d", res.entries);
+    }
+    else if (pp->save)
+        snprintf (check, sizeof check, "save failed");
+
+    char allocs[16] = "-";
+    if (first.allocs >= 0 && count)
+        snprintf (allocs, sizeof allocs, "%.1f", (double) first.allocs / count);
+
+    printf ("%-8s %9d %9.1f %10.0f %9ld %8s", format->ext, count,
+     load_ns / 1e6, per_second (count, load_ns), first.peak, allocs);
+
+    if (save_ns >= 0)
+        printf (" %9.1f %10.0f %9.1f", save_ns / 1e6, per_second (count,
+         save_ns), mem_file_size (out_uri) / 1024.0);
+    else
+        printf (" %9s %10s %9s", "-", "-", "-");
+
+    printf ("  %s\n", check);
+    fflush (stdout);
+
+DONE:
+    free_entries (filenames, tuples);
+    g_hash_table_remove_all (mem_files);
+}
+
+static void bench_container (PlaylistPlugin * pp)
+{
+    printf ("\n%s\n", pp->name);
+    printf ("%-8s %9s %9s %10s %9s %8s %9s %10s %9s  %s\n", "format", "entries",
+     "load ms", "entries/s", "peak KiB", "allocs/e", "save ms", "entries/s",
+     "out KiB", "check");
+
+    for (int i = 0; pp->extensions && pp->extensions[i]; i ++)
+    {
+        for (int f = 0; f < G_N_ELEMENTS (formats); f ++)
+        {
+            if (g_ascii_strcasecmp (pp->extensions[i], formats[f].ext))
+                continue;
+
+            for (int s = 0; s < n_sizes; s ++)
+                bench_format (pp, & formats[f], size_list[s]);
+        }
+    }
+}
+
+int bench_playlist_main (int argc, char * * argv)
+{
+    int opt, ret = EXIT_FAILURE;
+
+    bench_api_table.misc_api->construct_uri = pl_construct_uri;
+    bench_api_table.misc_api->file_find_decoder = pl_file_find_decoder;
+    bench_api_table.misc_api->file_read_tuple = pl_file_read_tuple;
+
+    while ((opt = getopt (argc, argv, "C:n:r:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'C':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_PLAYLIST, & containers))
+                goto CLEANUP;
+            break;
+        case 'n':
+            if (! (n_sizes = bench_parse_int_list (optarg, size_list, MAX_SIZES)))
+                goto USAGE;
+            break;
+        case 'r':
+            if ((repeats = atoi (optarg)) < 1)
+                goto USAGE;
+            break;
+        case 'o':
+            if (! bench_config_override (optarg))
+                goto CLEANUP;
+            break;
+        default:
+            goto USAGE;
+        }
+    }
+
+    if (! containers || optind != argc)
+        goto USAGE;
+
+    mem_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+     (GDestroyNotify) mem_buf_free);
+    vfs_set_lookup_func (lookup_transport);
+
+    for (GSList * node = containers; node; node = node->next)
+        bench_container (node->data);
+
+    g_hash_table_destroy (mem_files);
+    mem_files = NULL;
+
+    ret = EXIT_SUCCESS;
+    goto CLEANUP;
+
+USAGE:
+    playlist_usage ();
+
+CLEANUP:
+    bench_stop_plugins (containers);
+    containers = NULL;
+    return ret;
+}
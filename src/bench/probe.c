@@ -0,0 +1,463 @@
+/*
+ * Plugin Benchmarks for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Probe benchmark: does what adding files to the library does, for a set of
+ * files and a number of worker threads, and reports per input plugin what the
+ * probes cost.
+ *
+ *     audbench probe -T src/unix-io/unix-io.so -P src/flacng/flacng.so \
+ *      -P src/mpg123/madplug.so -P src/sid/sid.so -t 1,2,4,8 \
+ *      $(find music -type f)
+ *
+ * Every plugin's is_our_file_from_vfs() is asked about every file, in command
+ * line order, through one handle per file that is rewound between plugins,
+ * as Audacious does.  Then probe_for_tuple() is called for each plugin that
+ * claimed the file, not only the first one, so that claims can be checked: a
+ * claim that is not followed by a tuple counts as a false positive.  Plugins
+ * without is_our_file_from_vfs() claim files by extension only.
+ *
+ * Reads through the "file" transport are counted per call, so the report
+ * shows how many bytes each probe pulls in as well as how long it takes.
+ *
+ * The files are split between the threads as they become free.  Each thread
+ * count in the -t list is a separate pass; the first pass is taken as the
+ * reference, and every later pass compares its outcome for each file and
+ * plugin (claimed or not, tuple or not, and the tuple's title and length)
+ * against it.  Plugins keeping probe state in globals tend to show up there
+ * as mismatches, if they do not crash outright; a plugin with none is not
+ * thereby proven safe, but one with some certainly is not. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <libaudcore/audstrings.h>
+#include <libaudcore/tuple.h>
+#include <libaudcore/vfs.h>
+
+#include "bench.h"
+
+#define MAX_PASSES 16
+
+#define CLAIMED 1
+#define HAS_TUPLE 2
+
+typedef struct {
+    int calls, claims, false_claims, tuples, mismatches;
+    int64_t probe_ns, probe_max_ns, probe_bytes;
+    int64_t tuple_ns, tuple_bytes;
+} ProbeStats;
+
+typedef struct {
+    unsigned char flags;
+    unsigned hash; /* of the tuple's title and length */
+} Outcome;
+
+static GSList * transports;
+static GSList * inputs;
+static int n_inputs;
+static int thread_list[MAX_PASSES] = {1};
+static int n_passes = 1;
+
+static char * * files;
+static int n_files;
+
+static Outcome * reference; /* n_files * n_inputs, from the first pass */
+static Outcome * outcomes;
+
+/* shared between the worker threads of a pass */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int next_file;
+static ProbeStats * stats; /* n_inputs */
+
+/* bytes read through the counting transport by the current thread */
+static __thread int64_t bytes_read;
+
+static VFSConstructor * file_vtable;
+static VFSConstructor counting_vtable;
+
+static void probe_usage (void)
+{
+    fprintf (stderr,
+     "Usage: audbench probe [options] <file> ...\n\n"
+     "  -T PLUGIN  load a transport plugin (at least unix-io is needed)\n"
+     "  -P PLUGIN  load an input plugin (may be given several times)\n"
+     "  -t LIST    run a pass with each number of threads in LIST\n"
+     "             (default: 1; 0 means one per processor)\n"
+     "  -o S:N=V   set config value N in section S to V\n");
+}
+
+static int64_t counting_fread (void * ptr, int64_t size, int64_t nitems, VFSFile * file)
+{
+    int64_t done = file_vtable->vfs_fread_impl (ptr, size, nitems, file);
+
+    if (done > 0)
+        bytes_read += done * size;
+
+    return done;
+}
+
+static VFSConstructor * lookup_transport (const char * scheme)
+{
+    if (file_vtable && ! strcmp (scheme, "file"))
+        return & counting_vtable;
+
+    for (GSList * node = transports; node; node = node->next)
+    {
+        TransportPlugin * tp = node->data;
+
+        for (int i = 0; tp->schemes[i]; i ++)
+        {
+            if (! strcmp (tp->schemes[i], scheme))
+                return tp->vtable;
+        }
+    }
+
+    return NULL;
+}
+
+/* The handle of a file opened through the counting vtable is the transport's
+ * own, so only the read function needs wrapping. */
+static void setup_counting (void)
+{
+    file_vtable = lookup_transport ("file");
+
+    if (file_vtable)
+    {
+        counting_vtable = * file_vtable;
+        counting_vtable.vfs_fread_impl = counting_fread;
+    }
+}
+
+static int64_t elapsed_ns (const BenchTime * start)
+{
+    BenchTime total = {0, 0};
+    bench_time_add_since (& total, start);
+    return total.wall;
+}
+
+static bool_t has_extension (InputPlugin * ip, const char * ext)
+{
+    if (! ip->extensions || ! ext)
+        return FALSE;
+
+    for (int i = 0; ip->extensions[i]; i ++)
+    {
+        if (! g_ascii_strcasecmp (ip->extensions[i], ext))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static unsigned hash_tuple (Tuple * tuple)
+{
+    char * title = tuple_get_str (tuple, FIELD_TITLE, NULL);
+    unsigned hash = title ? g_str_hash (title) : 0;
+
+    hash = hash * 31 + tuple_get_int (tuple, FIELD_LENGTH, NULL);
+
+    if (title)
+        str_unref (title);
+
+    return hash;
+}
+
+static void probe_file (const char * path, Outcome * out, ProbeStats * local)
+{
+    char * uri = strstr (path, "://") ? g_strdup (path) : filename_to_uri (path);
+    if (! uri)
+    {
+        fprintf (stderr, "%s: invalid file name.\n", path);
+        return;
+    }
+
+    const char * dot = strrchr (path, '.');
+    char * ext = (dot && ! strchr (dot, '/')) ? g_ascii_strdown (dot + 1, -1) : NULL;
+
+    VFSFile * file = vfs_fopen (uri, "r");
+
+    if (! file)
+    {
+        fprintf (stderr, "%s: cannot open.\n", path);
+        goto DONE;
+    }
+
+    int i = 0;
+
+    for (GSList * node = inputs; node; node = node->next, i ++)
+    {
+        InputPlugin * ip = node->data;
+        ProbeStats * st = & local[i];
+        BenchTime start;
+        bool_t claimed;
+
+        if (ip->is_our_file_from_vfs)
+        {
+            if (vfs_fseek (file, 0, SEEK_SET) < 0)
+                continue;
+
+            bytes_read = 0;
+            bench_time_now (& start);
+
+            claimed = ip->is_our_file_from_vfs (uri, file);
+
+            int64_t ns = elapsed_ns (& start);
+            st->calls ++;
+            st->probe_ns += ns;
+            st->probe_max_ns = MAX (st->probe_max_ns, ns);
+            st->probe_bytes += bytes_read;
+        }
+        else
+            claimed = has_extension (ip, ext);
+
+        if (! claimed)
+            continue;
+
+        st->claims ++;
+        out[i].flags |= CLAIMED;
+
+        if (! ip->probe_for_tuple || vfs_fseek (file, 0, SEEK_SET) < 0)
+            continue;
+
+        bytes_read = 0;
+        bench_time_now (& start);
+
+        Tuple * tuple = ip->probe_for_tuple (uri, file);
+
+        st->tuple_ns += elapsed_ns (& start);
+        st->tuple_bytes += bytes_read;
+
+        if (tuple)
+        {
+            st->tuples ++;
+            out[i].flags |= HAS_TUPLE;
+            out[i].hash = hash_tuple (tuple);
+            tuple_unref (tuple);
+        }
+        else
+            st->false_claims ++;
+    }
+
+    vfs_fclose (file);
+
+DONE:
+    g_free (ext);
+    g_free (uri);
+}
+
+static void * probe_worker (void * arg)
+{
+    ProbeStats * local = g_new0 (ProbeStats, n_inputs);
+
+    while (1)
+    {
+        pthread_mutex_lock (& mutex);
+        int f = next_file ++;
+        pthread_mutex_unlock (& mutex);
+
+        if (f >= n_files)
+            break;
+
+        /* each file has its own row, so no locking is needed */
+        probe_file (files[f], outcomes + f * n_inputs, local);
+    }
+
+    pthread_mutex_lock (& mutex);
+
+    for (int i = 0; i < n_inputs; i ++)
+    {
+        ProbeStats * st = & stats[i];
+
+        st->calls += local[i].calls;
+        st->claims += local[i].claims;
+        st->false_claims += local[i].false_claims;
+        st->tuples += local[i].tuples;
+        st->probe_ns += local[i].probe_ns;
+        st->probe_max_ns = MAX (st->probe_max_ns, local[i].probe_max_ns);
+        st->probe_bytes += local[i].probe_bytes;
+        st->tuple_ns += local[i].tuple_ns;
+        st->tuple_bytes += local[i].tuple_bytes;
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    g_free (local);
+    return NULL;
+}
+
+/* Returns the wall time taken, in seconds. */
+static double run_pass (int threads)
+{
+    pthread_t * workers = g_new (pthread_t, threads);
+    BenchTime start, total = {0, 0};
+
+    next_file = 0;
+    memset (stats, 0, sizeof (ProbeStats) * n_inputs);
+    memset (outcomes, 0, sizeof (Outcome) * n_files * n_inputs);
+
+    bench_time_now (& start);
+
+    for (int t = 0; t < threads; t ++)
+        pthread_create (& workers[t], NULL, probe_worker, NULL);
+    for (int t = 0; t < threads; t ++)
+        pthread_join (workers[t], NULL);
+
+    bench_time_add_since (& total, & start);
+    g_free (workers);
+
+    if (! reference)
+        reference = g_memdup (outcomes, sizeof (Outcome) * n_files * n_inputs);
+    else
+    {
+        for (int f = 0; f < n_files; f ++)
+        {
+            for (int i = 0; i < n_inputs; i ++)
+            {
+                Outcome * a = & reference[f * n_inputs + i];
+                Outcome * b = & outcomes[f * n_inputs + i];
+
+                if (a->flags != b->flags || a->hash != b->hash)
+                    stats[i].mismatches ++;
+            }
+        }
+    }
+
+    return total.wall / 1e9;
+}
+
+static void print_pass (int threads, double wall)
+{
+    double sum = 0;
+
+    for (int i = 0; i < n_inputs; i ++)
+        sum += stats[i].probe_ns + stats[i].tuple_ns;
+
+    printf ("\n%d thread%s: %d files in %.3f s (%.1f files/s)\n", threads,
+     threads == 1 ? "" : "s", n_files, wall, wall > 0 ? n_files / wall : 0);
+
+    printf ("%-24s %6s %6s %6s %6s %9s %9s %9s %9s %9s %6s\n", "plugin", "calls",
+     "claims", "false", "mism", "probe us", "max us", "probe KiB", "tuple us",
+     "tuple KiB", "% time");
+
+    int i = 0;
+
+    for (GSList * node = inputs; node; node = node->next, i ++)
+    {
+        Plugin * header = node->data;
+        ProbeStats * st = & stats[i];
+
+        printf ("%-24.24s %6d %6d %6d %6d %9.1f %9.1f %9.2f %9.1f %9.2f %6.1f\n",
+         header->name, st->calls, st->claims, st->false_claims, st->mismatches,
+         st->calls ? st->probe_ns / 1e3 / st->calls : 0,
+         st->probe_max_ns / 1e3,
+         st->calls ? st->probe_bytes / 1024.0 / st->calls : 0,
+         st->claims ? st->tuple_ns / 1e3 / st->claims : 0,
+         st->claims ? st->tuple_bytes / 1024.0 / st->claims : 0,
+         sum > 0 ? (st->probe_ns + st->tuple_ns) * 100 / sum : 0);
+    }
+}
+
+int bench_probe_main (int argc, char * * argv)
+{
+    int opt, ret = EXIT_FAILURE;
+
+    while ((opt = getopt (argc, argv, "T:P:t:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'T':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_TRANSPORT, & transports))
+                goto CLEANUP;
+            break;
+        case 'P':
+            if (! bench_start_plugin (optarg, PLUGIN_TYPE_INPUT, & inputs))
+                goto CLEANUP;
+            break;
+        case 't':
+            /* "0" is not accepted by bench_parse_int_list() */
+            if (! strcmp (optarg, "0"))
+            {
+                thread_list[0] = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+                n_passes = 1;
+            }
+            else if (! (n_passes = bench_parse_int_list (optarg, thread_list, MAX_PASSES)))
+                goto USAGE;
+            break;
+        case 'o':
+            if (! bench_config_override (optarg))
+                goto CLEANUP;
+            break;
+        default:
+            goto USAGE;
+        }
+    }
+
+    if (! transports || ! inputs || optind == argc)
+        goto USAGE;
+
+    setup_counting ();
+    vfs_set_lookup_func (lookup_transport);
+
+    files = argv + optind;
+    n_files = argc - optind;
+    n_inputs = g_slist_length (inputs);
+
+    stats = g_new (ProbeStats, n_inputs);
+    outcomes = g_new (Outcome, n_files * n_inputs);
+
+    double first = 0;
+
+    for (int p = 0; p < n_passes; p ++)
+    {
+        double wall = run_pass (thread_list[p]);
+        print_pass (thread_list[p], wall);
+
+        if (! p)
+            first = wall;
+        else
+            printf ("speedup over %d thread%s: %.2fx\n", thread_list[0],
+             thread_list[0] == 1 ? "" : "s", wall > 0 ? first / wall : 0);
+
+        fflush (stdout);
+    }
+
+    g_free (stats);
+    g_free (outcomes);
+    g_free (reference);
+    stats = NULL;
+    outcomes = reference = NULL;
+
+    ret = EXIT_SUCCESS;
+    goto CLEANUP;
+
+USAGE:
+    probe_usage ();
+
+CLEANUP:
+    bench_stop_plugins (inputs);
+    inputs = NULL;
+    bench_stop_plugins (transports);
+    transports = NULL;
+    return ret;
+}
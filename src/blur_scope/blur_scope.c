@@ -26,6 +26,12 @@
 #include <math.h>
 #include <string.h>
 
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <gtk/gtk.h>
 
 #include <audacious/i18n.h>
@@ -33,6 +39,8 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../vislimit/vislimit.h"
+
 #define D_WIDTH 64
 #define D_HEIGHT 32
 
@@ -65,7 +73,14 @@ AUD_VIS_PLUGIN
 
 static GtkWidget * area = NULL;
 static gint width, height, stride, image_size;
+
+/* Each frame is blurred from the image being shown into the back buffer, and
+ * then the two are swapped.  Only rows that may have something lit in them
+ * are processed: dirty_top .. dirty_bottom for the image, back_top ..
+ * back_bottom for what is left in the back buffer. */
 static guint32 * image = NULL, * corner = NULL;
+static guint32 * back = NULL, * back_corner = NULL;
+static gint dirty_top, dirty_bottom, back_top, back_bottom;
 
 static const gchar * const bscope_defaults[] = {
  "color", "16727935", /* 0xFF3F7F */
@@ -86,7 +101,14 @@ static void bscope_cleanup (void)
     aud_set_int ("BlurScope", "color", color);
 
     g_free (image);
-    image = NULL;
+    g_free (back);
+    image = back = NULL;
+}
+
+static void bscope_reset_dirty (void)
+{
+    dirty_top = back_top = height;
+    dirty_bottom = back_bottom = -1;
 }
 
 static void bscope_resize (gint w, gint h)
@@ -96,8 +118,12 @@ static void bscope_resize (gint w, gint h)
     stride = width + 2;
     image_size = (stride << 2) * (height + 2);
     image = g_realloc (image, image_size);
+    back = g_realloc (back, image_size);
     memset (image, 0, image_size);
+    memset (back, 0, image_size);
     corner = image + stride + 1;
+    back_corner = back + stride + 1;
+    bscope_reset_dirty ();
 }
 
 static void bscope_draw_to_cairo (cairo_t * cr)
@@ -141,6 +167,8 @@ static void /* GtkWidget */ * bscope_get_widget (void)
     g_signal_connect (area, "configure-event", (GCallback) configure_event, NULL);
     g_signal_connect (area, "destroy", (GCallback) gtk_widget_destroyed, & area);
 
+    vislimit_attach (area, NULL, NULL);
+
     GtkWidget * frame = gtk_frame_new (NULL);
     gtk_frame_set_shadow_type ((GtkFrame *) frame, GTK_SHADOW_IN);
     gtk_container_add ((GtkContainer *) frame, area);
@@ -151,26 +179,106 @@ static void bscope_clear (void)
 {
     g_return_if_fail (image != NULL);
     memset (image, 0, image_size);
+    memset (back, 0, image_size);
+    bscope_reset_dirty ();
     bscope_draw ();
 }
 
+/* We do a quick and dirty average of four color values, first masking off the
+ * lowest two bits.  Over a large area, this masking has the net effect of
+ * subtracting 1.5 from each value, which by a happy chance is just right for a
+ * gradual fade effect.  Each byte is divided by four before adding, so the sum
+ * never carries from one byte into the next and the same arithmetic works on
+ * four pixels at once. */
+#define QUARTER(p) (((p) >> 2) & 0x3F3F3F)
+
+/* returns nonzero if anything in the row is still lit */
+static guint32 blur_row (const guint32 * src, guint32 * dest)
+{
+    const guint32 * up = src - stride, * down = src + stride;
+    guint32 lit = 0, any[4] = {0};
+    gint x = 0;
+
+#if defined (__SSE2__)
+    const __m128i mask = _mm_set1_epi32 (0x3F3F3F);
+    __m128i acc = _mm_setzero_si128 ();
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (up + x));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (src + x - 1));
+        __m128i c = _mm_loadu_si128 ((const __m128i *) (src + x + 1));
+        __m128i d = _mm_loadu_si128 ((const __m128i *) (down + x));
+
+        a = _mm_and_si128 (_mm_srli_epi32 (a, 2), mask);
+        b = _mm_and_si128 (_mm_srli_epi32 (b, 2), mask);
+        c = _mm_and_si128 (_mm_srli_epi32 (c, 2), mask);
+        d = _mm_and_si128 (_mm_srli_epi32 (d, 2), mask);
+
+        __m128i sum = _mm_add_epi32 (_mm_add_epi32 (a, b), _mm_add_epi32 (c, d));
+        _mm_storeu_si128 ((__m128i *) (dest + x), sum);
+        acc = _mm_or_si128 (acc, sum);
+    }
+
+    _mm_storeu_si128 ((__m128i *) any, acc);
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+    const uint32x4_t mask = vdupq_n_u32 (0x3F3F3F);
+    uint32x4_t acc = vdupq_n_u32 (0);
+
+    for (; x + 4 <= width; x += 4)
+    {
+        uint32x4_t a = vandq_u32 (vshrq_n_u32 (vld1q_u32 (up + x), 2), mask);
+        uint32x4_t b = vandq_u32 (vshrq_n_u32 (vld1q_u32 (src + x - 1), 2), mask);
+        uint32x4_t c = vandq_u32 (vshrq_n_u32 (vld1q_u32 (src + x + 1), 2), mask);
+        uint32x4_t d = vandq_u32 (vshrq_n_u32 (vld1q_u32 (down + x), 2), mask);
+
+        uint32x4_t sum = vaddq_u32 (vaddq_u32 (a, b), vaddq_u32 (c, d));
+        vst1q_u32 (dest + x, sum);
+        acc = vorrq_u32 (acc, sum);
+    }
+
+    vst1q_u32 (any, acc);
+#endif
+
+    for (; x < width; x ++)
+    {
+        dest[x] = QUARTER (up[x]) + QUARTER (src[x - 1]) + QUARTER (src[x + 1])
+         + QUARTER (down[x]);
+        lit |= dest[x];
+    }
+
+    return lit | any[0] | any[1] | any[2] | any[3];
+}
+
 static void bscope_blur (void)
 {
-    for (gint y = 0; y < height; y ++)
+    /* anything lit spreads by one row per frame; rows outside both ranges
+     * are dark in both buffers and stay that way */
+    gint top = MAX (0, MIN (dirty_top - 1, back_top));
+    gint bottom = MIN (height - 1, MAX (dirty_bottom + 1, back_bottom));
+    gint new_top = height, new_bottom = -1;
+
+    for (gint y = top; y <= bottom; y ++)
     {
-        guint32 * p = corner + stride * y;
-        guint32 * end = p + width;
-        guint32 * plast = p - stride;
-        guint32 * pnext = p + stride;
-
-        /* We do a quick and dirty average of four color values, first masking
-         * off the lowest two bits.  Over a large area, this masking has the net
-         * effect of subtracting 1.5 from each value, which by a happy chance
-         * is just right for a gradual fade effect. */
-        for (; p < end; p ++)
-            * p = ((* plast ++ & 0xFCFCFC) + (p[-1] & 0xFCFCFC) + (p[1] &
-             0xFCFCFC) + (* pnext ++ & 0xFCFCFC)) >> 2;
+        if (blur_row (corner + stride * y, back_corner + stride * y))
+        {
+            new_top = MIN (new_top, y);
+            new_bottom = y;
+        }
     }
+
+    guint32 * swap = image;
+    image = back;
+    back = swap;
+
+    swap = corner;
+    corner = back_corner;
+    back_corner = swap;
+
+    back_top = dirty_top;
+    back_bottom = dirty_bottom;
+    dirty_top = new_top;
+    dirty_bottom = new_bottom;
 }
 
 static inline void draw_vert_line (gint x, guint y1, gint y2)
@@ -189,6 +297,9 @@ static inline void draw_vert_line (gint x, guint y1, gint y2)
 
 static void bscope_render (const gfloat * data)
 {
+    if (! area || ! vislimit_visible (area))
+        return;
+
     bscope_blur ();
 
     gint prev_y = (0.5 + data[0]) * height;
@@ -199,10 +310,14 @@ static void bscope_render (const gfloat * data)
         gint y = (0.5 + data[i * 512 / width]) * height;
         y = CLAMP (y, 0, height - 1);
         draw_vert_line (i, prev_y, y);
+
+        dirty_top = MIN (dirty_top, MIN (prev_y, y));
+        dirty_bottom = MAX (dirty_bottom, MAX (prev_y, y));
         prev_y = y;
     }
 
-    bscope_draw ();
+    if (vislimit_frame_due (area, TRUE))
+        bscope_draw ();
 }
 
 static void color_set_cb (GtkWidget * chooser)
@@ -27,8 +27,23 @@
 #include <audacious/misc.h>
 #include <bs2b.h>
 
-static t_bs2bdp bs2b = NULL;
-static gint bs2b_channels;
+#include "../perfstat/perfstat.h"
+
+/* Per-stream state.  The levels are only ever applied to the bs2b instance
+ * from the audio thread, at the start of a block; the settings window just
+ * stores new values and raises levels_changed.  A feed level below
+ * BS2B_MINFEED means crossfeed is off, and the audio is left untouched. */
+
+typedef struct {
+    t_bs2bdp bs2b;
+    gint channels;
+    gint feed, fcut;
+    gboolean active;
+} Bs2bState;
+
+static Bs2bState state;
+static gint levels_changed;
+
 static GtkWidget *config_window, *feed_slider, *fcut_slider;
 static const gchar * const bs2b_defaults[] = {
  "feed", "45",
@@ -38,48 +53,84 @@ static const gchar * const bs2b_defaults[] = {
 #define feed_level aud_get_int("bs2b", "feed")
 #define fcut_level aud_get_int("bs2b", "fcut")
 
+static void apply_levels (void)
+{
+    g_atomic_int_set (& levels_changed, FALSE);
+
+    gint feed = feed_level;
+    gint fcut = fcut_level;
+    gboolean active = (feed >= BS2B_MINFEED);
+
+    if (active && feed != state.feed)
+        bs2b_set_level_feed (state.bs2b, feed);
+    if (active && fcut != state.fcut)
+        bs2b_set_level_fcut (state.bs2b, fcut);
+
+    /* don't let stale filter history through when crossfeed comes back on */
+    if (active && ! state.active)
+        bs2b_clear (state.bs2b);
+
+    state.feed = feed;
+    state.fcut = fcut;
+    state.active = active;
+}
+
 gboolean init()
 {
     aud_config_set_defaults("bs2b", bs2b_defaults);
-    bs2b = bs2b_open();
+    state.bs2b = bs2b_open();
 
-    if (bs2b == NULL)
+    if (state.bs2b == NULL)
         return FALSE;
 
-    bs2b_set_level_feed(bs2b, feed_level);
-    bs2b_set_level_fcut(bs2b, fcut_level);
+    state.feed = state.fcut = 0;
+    state.active = FALSE;
+    apply_levels ();
 
     return TRUE;
 }
 
 static void cleanup()
 {
-    if (bs2b == NULL)
+    if (state.bs2b == NULL)
         return;
 
-    bs2b_close(bs2b);
-    bs2b = NULL;
+    bs2b_close(state.bs2b);
+    state.bs2b = NULL;
 }
 
 static void bs2b_start (gint * channels, gint * rate)
 {
-    if (bs2b == NULL)
+    if (state.bs2b == NULL)
         return;
 
-    bs2b_channels = * channels;
+    state.channels = * channels;
 
     if (* channels != 2)
         return;
 
-    bs2b_set_srate (bs2b, * rate);
+    bs2b_set_srate (state.bs2b, * rate);
+    bs2b_clear (state.bs2b);
 }
 
 static void bs2b_process (gfloat * * data, gint * samples)
 {
-    if (bs2b == NULL || bs2b_channels != 2)
+    if (state.bs2b == NULL || state.channels != 2)
         return;
 
-    bs2b_cross_feed_f (bs2b, * data, (* samples) / 2);
+    if (g_atomic_int_get (& levels_changed))
+        apply_levels ();
+
+    if (! state.active || * samples < 2)
+        return;
+
+    bs2b_cross_feed_f (state.bs2b, * data, (* samples) / 2);
+}
+
+static void bs2b_flush (void)
+{
+    if (state.bs2b != NULL)
+        bs2b_clear (state.bs2b);
 }
 
 static void bs2b_finish (gfloat * * data, gint * samples)
@@ -90,18 +141,21 @@ static void bs2b_finish (gfloat * * data, gint * samples)
 static void feed_value_changed(GtkRange *range, gpointer data)
 {
     aud_set_int("bs2b", "feed", gtk_range_get_value(range));
-    bs2b_set_level_feed(bs2b, feed_level);
+    g_atomic_int_set (& levels_changed, TRUE);
 }
 
 static gchar *feed_format_value(GtkScale *scale, gdouble value)
 {
+    if (value < BS2B_MINFEED)
+        return g_strdup(_("Off"));
+
     return g_strdup_printf("%.1f dB", (float) value / 10);
 }
 
 static void fcut_value_changed(GtkRange *range, gpointer data)
 {
     aud_set_int("bs2b", "fcut", gtk_range_get_value(range));
-    bs2b_set_level_fcut(bs2b, fcut_level);
+    g_atomic_int_set (& levels_changed, TRUE);
 }
 
 static gchar *fcut_format_value(GtkScale *scale, gdouble value)
@@ -146,7 +200,7 @@ static void configure (void)
 
         gtk_box_pack_start(GTK_BOX(hbox), gtk_label_new(_("Feed level:")), TRUE, FALSE, 0);
 
-        feed_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, BS2B_MINFEED, BS2B_MAXFEED, 1.0);
+        feed_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, BS2B_MINFEED - 1, BS2B_MAXFEED, 1.0);
         gtk_range_set_value (GTK_RANGE(feed_slider), feed_level);
         gtk_widget_set_size_request (feed_slider, 200, -1);
         gtk_box_pack_start ((GtkBox *) hbox, feed_slider, FALSE, FALSE, 0);
@@ -192,6 +246,8 @@ static void configure (void)
     gtk_window_present ((GtkWindow *) config_window);
 }
 
+PERFSTAT_EFFECT (N_("Bauer Stereophonic-to-Binaural (BS2B)"), bs2b_start, bs2b_process, bs2b_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Bauer Stereophonic-to-Binaural (BS2B)"),
@@ -199,8 +255,9 @@ AUD_EFFECT_PLUGIN
     .init = init,
     .cleanup = cleanup,
     .configure = configure,
-    .start = bs2b_start,
-    .process = bs2b_process,
-    .finish = bs2b_finish,
+    .start = perfstat_start,
+    .process = perfstat_process,
+    .flush = bs2b_flush,
+    .finish = perfstat_finish,
     .preserves_format = TRUE
 )
@@ -31,68 +31,57 @@
 #include <libaudgui/libaudgui.h>
 #include <libaudgui/libaudgui-gtk.h>
 
+#include "../visbands/visbands.h"
+#include "../vislimit/vislimit.h"
+
 #define MAX_BANDS   (256)
 #define VIS_DELAY 2 /* delay before falloff in frames */
 #define VIS_FALLOFF 2 /* falloff in pixels per frame */
 
 static GtkWidget * spect_widget = NULL;
-static gfloat xscale[MAX_BANDS + 1];
+static VisBands * vis_bands = NULL;
 static gint width, height, bands;
 static gint bars[MAX_BANDS + 1];
 static gint delay[MAX_BANDS + 1];
 
-static void calculate_xscale (void)
+/* one horizontal gradient holding the color of every bar, so that all the
+ * bars can be filled at once; rebuilt when the size or theme changes */
+static cairo_pattern_t * bar_pattern = NULL;
+static bool_t theme_valid = FALSE;
+
+static void calculate_bands (void)
 {
-    for (gint i = 0; i <= bands; i ++)
-        xscale[i] = powf (256, (gfloat) i / bands) - 0.5f;
+    if (vis_bands && visbands_count (vis_bands) == bands)
+        return;
+
+    visbands_free (vis_bands);
+    vis_bands = visbands_new (bands);
 }
 
 static void render_cb (gfloat * freq)
 {
     g_return_if_fail (spect_widget);
 
-    if (! bands)
+    if (! vis_bands)
         return;
 
-    for (gint i = 0; i < bands; i ++)
-    {
-        gint a = ceilf (xscale[i]);
-        gint b = floorf (xscale[i + 1]);
-        gfloat n = 0;
-
-        if (b < a)
-            n += freq[b] * (xscale[i + 1] - xscale[i]);
-        else
-        {
-            if (a > 0)
-                n += freq[a - 1] * (a - xscale[i]);
-            for (; a < b; a ++)
-                n += freq[a];
-            if (b < 256)
-                n += freq[b] * (xscale[i + 1] - b);
-        }
-
-        /* fudge factor to make the graph have the same overall height as a
-           12-band one no matter how many bands there are */
-        n *= (gfloat) bands / 12;
-
-        /* 40 dB range */
-        gint x = 40 + 20 * log10f (n);
-        x = CLAMP (x, 0, 40);
-
-        bars[i] -= MAX (0, VIS_FALLOFF - delay[i]);
-
-        if (delay[i])
-            delay[i]--;
-
-        if (x > bars[i])
-        {
-            bars[i] = x;
-            delay[i] = VIS_DELAY;
-        }
-    }
+    gfloat levels[MAX_BANDS];
+    visbands_compute (vis_bands, freq, 40, levels);
+
+    gboolean changed = visbands_falloff (levels, bands, 40, VIS_DELAY,
+     VIS_FALLOFF, bars, delay);
+
+    if (vislimit_frame_due (spect_widget, changed))
+        gtk_widget_queue_draw (spect_widget);
+}
 
-    gtk_widget_queue_draw (spect_widget);
+/* listen for data only while the spectrum is on screen */
+static void visible_cb (gboolean visible)
+{
+    if (visible)
+        aud_vis_func_add (AUD_VIS_TYPE_FREQ, (VisFunc) render_cb);
+    else
+        aud_vis_func_remove ((VisFunc) render_cb);
 }
 
 static void rgb_to_hsv (gfloat r, gfloat g, gfloat b, gfloat * h, gfloat * s, gfloat * v)
@@ -161,10 +150,9 @@ static void hsv_to_rgb (gfloat h, gfloat s, gfloat v, gfloat * r, gfloat * g, gf
 static void get_color (gint i, gfloat * r, gfloat * g, gfloat * b)
 {
     static GdkRGBA c;
-    static bool_t valid = FALSE;
     gfloat h, s, v, n;
 
-    if (! valid)
+    if (! theme_valid)
     {
         /* we want a color that matches the current theme
          * selected color of a GtkEntry should be reasonable */
@@ -175,7 +163,7 @@ static void get_color (gint i, gfloat * r, gfloat * g, gfloat * b)
         gtk_widget_path_free (path);
         gtk_style_context_get_background_color (style, GTK_STATE_FLAG_SELECTED, & c);
         g_object_unref (style);
-        valid = TRUE;
+        theme_valid = TRUE;
     }
 
     rgb_to_hsv (c.red, c.green, c.blue, & h, & s, & v);
@@ -193,6 +181,33 @@ static void get_color (gint i, gfloat * r, gfloat * g, gfloat * b)
     hsv_to_rgb (h, s, v, r, g, b);
 }
 
+static void invalidate_pattern (void)
+{
+    if (bar_pattern)
+    {
+        cairo_pattern_destroy (bar_pattern);
+        bar_pattern = NULL;
+    }
+}
+
+static void update_pattern (void)
+{
+    gint bar_width = width / bands;
+    gint span = bar_width * (bands + 1) + 3;
+
+    bar_pattern = cairo_pattern_create_linear (0, 0, span, 0);
+
+    for (gint i = 0; i <= bands; i++)
+    {
+        gint x = (bar_width * i) + 2;
+        gfloat r, g, b;
+
+        get_color (i, & r, & g, & b);
+        cairo_pattern_add_color_stop_rgb (bar_pattern, (gdouble) (x + 1) / span, r, g, b);
+        cairo_pattern_add_color_stop_rgb (bar_pattern, (gdouble) (x + bar_width) / span, r, g, b);
+    }
+}
+
 static void draw_background (GtkWidget * area, cairo_t * cr)
 {
 #if 0
@@ -231,16 +246,25 @@ static void draw_visualizer (GtkWidget *widget, cairo_t *cr)
 {
     gfloat base_s = (height / 40);
 
+    if (! bar_pattern)
+        update_pattern ();
+
     for (gint i = 0; i <= bands; i++)
     {
         gint x = ((width / bands) * i) + 2;
-        gfloat r, g, b;
 
-        get_color (i, & r, & g, & b);
-        cairo_set_source_rgb (cr, r, g, b);
-        cairo_rectangle (cr, x + 1, height - (bars[i] * base_s), (width / bands) - 1, (bars[i] * base_s));
-        cairo_fill (cr);
+        if (bars[i])
+            cairo_rectangle (cr, x + 1, height - (bars[i] * base_s), (width / bands) - 1, (bars[i] * base_s));
     }
+
+    cairo_set_source (cr, bar_pattern);
+    cairo_fill (cr);
+}
+
+static void style_updated (GtkWidget * widget)
+{
+    theme_valid = FALSE;
+    invalidate_pattern ();
 }
 
 static gboolean configure_event (GtkWidget * widget, GdkEventConfigure * event)
@@ -251,7 +275,8 @@ static gboolean configure_event (GtkWidget * widget, GdkEventConfigure * event)
 
     bands = width / 10;
     bands = CLAMP(bands, 12, MAX_BANDS);
-    calculate_xscale ();
+    calculate_bands ();
+    invalidate_pattern ();
 
     return TRUE;
 }
@@ -271,6 +296,10 @@ static gboolean draw_event (GtkWidget * widget, cairo_t * cr, GtkWidget * area)
 static gboolean destroy_event (void)
 {
     aud_vis_func_remove ((VisFunc) render_cb);
+    invalidate_pattern ();
+
+    visbands_free (vis_bands);
+    vis_bands = NULL;
     spect_widget = NULL;
     return TRUE;
 }
@@ -282,9 +311,10 @@ static /* GtkWidget * */ gpointer get_widget(void)
 
     g_signal_connect(area, "draw", (GCallback) draw_event, NULL);
     g_signal_connect(area, "configure-event", (GCallback) configure_event, NULL);
+    g_signal_connect(area, "style-updated", (GCallback) style_updated, NULL);
     g_signal_connect(area, "destroy", (GCallback) destroy_event, NULL);
 
-    aud_vis_func_add (AUD_VIS_TYPE_FREQ, (VisFunc) render_cb);
+    vislimit_attach (area, (VisLimitFunc) visible_cb, NULL);
 
     GtkWidget * frame = gtk_frame_new (NULL);
     gtk_frame_set_shadow_type ((GtkFrame *) frame, GTK_SHADOW_IN);
@@ -53,13 +53,19 @@
 #include <libaudgui/libaudgui.h>
 #include <libaudgui/libaudgui-gtk.h>
 
+#include "reader.h"
+#include "../warmup/warmup.h"
+
 #define DEF_STRING_LEN 256
 
 #define MIN_DISC_SPEED 2
 #define MAX_DISC_SPEED 24
 
-#define MAX_RETRIES 10
-#define MAX_SKIPS 10
+#define MIN_READAHEAD 1
+#define MAX_READAHEAD 60
+
+#define WRITE_SECTORS 75 /* one second */
+#define RIP_RING_SECTORS (75 * 60) /* one minute, about 10 MB */
 
 #define warn(...) fprintf(stderr, "cdaudio-ng: " __VA_ARGS__)
 
@@ -76,15 +82,38 @@ trackinfo_t;
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static int seek_time;
 static bool_t playing;
+static CDReader * reader;
+
+/* In rip mode, the reader is kept running past the end of each track, and the
+ * next track picks it up if it starts where the last one ended. */
+static CDReader * parked_reader;
+static int parked_lsn;
 
 /* lock mutex to read / set these variables */
 static int firsttrackno = -1;
 static int lasttrackno = -1;
 static int n_audio_tracks;
 static cdrom_drive_t *pcdrom_drive = NULL;
+static int drive_speed;
 static trackinfo_t *trackinfo = NULL;
 static int monitor_source = 0;
 
+typedef struct
+{
+    cddb_disc_t * disc;
+    unsigned discid;
+    char * toc;
+    int first, last;
+}
+CDDBJob;
+
+/* lock mutex to read / set these variables */
+static unsigned current_discid;
+static CDDBJob * cddb_pending;
+static pthread_t cddb_thread;
+static bool_t cddb_running, cddb_joinable, cddb_quit;
+static int rescan_source;
+
 static bool_t cdaudio_init (void);
 static int cdaudio_is_our_file (const char * filename, VFSFile * file);
 static bool_t cdaudio_play (InputPlayback * p, const char * name, VFSFile *
@@ -95,6 +124,7 @@ static void cdaudio_mseek (InputPlayback * p, int time);
 static void cdaudio_cleanup (void);
 static Tuple * make_tuple (const char * filename, VFSFile * file);
 static void scan_cd (void);
+static void job_free (CDDBJob * job);
 static void refresh_trackinfo (bool_t warning);
 static int calculate_track_length (int startlsn, int endlsn);
 static int find_trackno_from_filename (const char * filename);
@@ -110,6 +140,9 @@ static const char * const schemes[] = {"cdda", NULL};
 
 static const char * const cdaudio_defaults[] = {
  "disc_speed", "2",
+ "readahead", "10",
+ "paranoia", "FALSE",
+ "rip_mode", "FALSE",
  "use_cdtext", "TRUE",
  "use_cddb", "TRUE",
  "cddbhttp", "FALSE",
@@ -122,6 +155,15 @@ static const PreferencesWidget cdaudio_widgets[] = {
  {WIDGET_SPIN_BTN, N_("Read speed:"),
   .cfg_type = VALUE_INT, .csect = "CDDA", .cname = "disc_speed",
   .data = {.spin_btn = {MIN_DISC_SPEED, MAX_DISC_SPEED, 1}}},
+ {WIDGET_SPIN_BTN, N_("Read ahead:"),
+  .cfg_type = VALUE_INT, .csect = "CDDA", .cname = "readahead",
+  .data = {.spin_btn = {MIN_READAHEAD, MAX_READAHEAD, 1, N_("seconds")}}},
+#ifdef HAVE_CDIO_PARANOIA
+ {WIDGET_CHK_BTN, N_("Verify reads with cdparanoia (slower)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "CDDA", .cname = "paranoia"},
+#endif
+ {WIDGET_CHK_BTN, N_("Rip mode: read at full speed, straight through tracks"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "CDDA", .cname = "rip_mode"},
  {WIDGET_ENTRY, N_("Override device:"),
   .cfg_type = VALUE_STRING, .csect = "CDDA", .cname = "device"},
  {WIDGET_LABEL, N_("<b>Metadata</b>")},
@@ -239,19 +281,31 @@ static void trigger_monitor (void)
         monitor_source = g_timeout_add_seconds (1, monitor, NULL);
 }
 
-/* main thread only */
-static bool_t cdaudio_init (void)
-{
-    aud_config_set_defaults ("CDDA", cdaudio_defaults);
+/* Setting up libcdio (which looks for drivers) and libcddb is left to the
+ * background (see warmup.h) and waited for before the drive is opened. */
+static bool_t cdio_ready;
 
+static void cdaudio_warm_up (void)
+{
     if (!cdio_init ())
-    {
         cdaudio_error (_("Failed to initialize cdio subsystem."));
-        return FALSE;
-    }
+    else
+        cdio_ready = TRUE;
 
     libcddb_init ();
+}
+
+static Warmup warmup = WARMUP_INIT (N_("Audio CD Plugin"), cdaudio_warm_up);
+
+/* main thread only */
+static bool_t cdaudio_init (void)
+{
+    int64_t init_begin = perfstat_now ();
+
+    aud_config_set_defaults ("CDDA", cdaudio_defaults);
+    cddb_quit = FALSE;
 
+    warmup_start (& warmup, init_begin);
     return TRUE;
 }
 
@@ -282,6 +336,28 @@ static void cdaudio_set_fullinfo (trackinfo_t * t,
     cdaudio_set_strinfo (t, performer, name, genre);
 }
 
+/* mutex must be locked */
+static void set_drive_speed (int speed)
+{
+    if (speed == drive_speed)
+        return;
+
+    if (cdda_speed_set (pcdrom_drive, speed) != DRIVER_OP_SUCCESS)
+        warn ("Cannot set drive speed.\n");
+
+    drive_speed = speed;
+}
+
+/* mutex must be locked; before the drive is closed or the disc rescanned */
+static void drop_parked_reader (void)
+{
+    if (parked_reader)
+    {
+        reader_stop (parked_reader);
+        parked_reader = NULL;
+    }
+}
+
 /* play thread only */
 static bool_t cdaudio_play (InputPlayback * p, const char * name, VFSFile *
  file, int start, int stop, bool_t pause)
@@ -337,69 +413,110 @@ static bool_t cdaudio_play (InputPlayback * p, const char * name, VFSFile *
     int buffer_size = aud_get_int (NULL, "output_buffer_size");
     int speed = aud_get_int ("CDDA", "disc_speed");
     speed = CLAMP (speed, MIN_DISC_SPEED, MAX_DISC_SPEED);
-    int sectors = CLAMP (buffer_size / 2, 50, 250) * speed * 75 / 1000;
-    unsigned char buffer[2352 * sectors];
-    int currlsn = startlsn;
-    int retry_count = 0, skip_count = 0;
+    int chunk = CLAMP (buffer_size / 2, 50, 250) * speed * 75 / 1000;
+    int readahead = aud_get_int ("CDDA", "readahead");
+    readahead = CLAMP (readahead, MIN_READAHEAD, MAX_READAHEAD);
+    int ring = readahead * 75;
+
+    /* Rip mode is for writing to a file: nothing paces the reads but the
+     * drive, so read as fast as it goes, in the largest chunks the ring
+     * allows, and on through the following audio tracks so that the next
+     * track is being read while this one is still being encoded. */
+    bool_t rip = aud_get_bool ("CDDA", "rip_mode");
+    int readend = endlsn;
+
+    if (rip)
+    {
+        speed = MAX_DISC_SPEED;
+        ring = MAX (ring, RIP_RING_SECTORS);
+        chunk = ring;
+
+        if (stop < 0)
+        {
+            for (int t = trackno + 1; t <= lasttrackno &&
+             trackinfo[t].startlsn == trackinfo[t - 1].endlsn + 1 &&
+             cdda_track_audiop (pcdrom_drive, t); t ++)
+                readend = trackinfo[t].endlsn;
+        }
+    }
+
+    set_drive_speed (speed);
 
-    while (playing)
+    if (rip && parked_reader && parked_lsn == startlsn && seek_time < 0)
+    {
+        reader = parked_reader;
+        parked_reader = NULL;
+    }
+    else
+    {
+        drop_parked_reader ();
+        reader = reader_start (pcdrom_drive, startlsn, readend, ring, chunk,
+         aud_get_bool ("CDDA", "paranoia"));
+    }
+
+    if (! reader)
+    {
+        playing = FALSE;
+        pthread_mutex_unlock (& mutex);
+        return FALSE;
+    }
+
+    unsigned char * buffer = g_malloc (SECTOR_SIZE * WRITE_SECTORS);
+    int lsn = startlsn;
+
+    while (playing && lsn <= endlsn)
     {
         if (seek_time >= 0)
         {
             p->output->flush (seek_time);
-            currlsn = startlsn + (seek_time * 75 / 1000);
+            lsn = startlsn + (seek_time * 75 / 1000);
+            reader_seek (reader, lsn);
             seek_time = -1;
-        }
 
-        sectors = MIN (sectors, endlsn + 1 - currlsn);
-        if (sectors < 1)
-            break;
+            if (lsn > endlsn)
+                break;
+        }
 
         /* unlock mutex here to avoid blocking
          * other threads must be careful not to close drive handle */
         pthread_mutex_unlock (& mutex);
 
-        int ret = cdio_read_audio_sectors (pcdrom_drive->p_cdio, buffer,
-         currlsn, sectors);
+        /* the reader may be reading on into the next track */
+        int ret = reader_get (reader, buffer, MIN (WRITE_SECTORS, endlsn + 1 - lsn));
 
-        if (ret == DRIVER_OP_SUCCESS)
-            p->output->write_audio (buffer, 2352 * sectors);
+        if (ret > 0)
+        {
+            p->output->write_audio (buffer, SECTOR_SIZE * ret);
+            lsn += ret;
+        }
 
         pthread_mutex_lock (& mutex);
 
-        if (ret == DRIVER_OP_SUCCESS)
-        {
-            currlsn += sectors;
-            retry_count = 0;
-            skip_count = 0;
-        }
-        else if (sectors > 16)
-        {
-            /* maybe a smaller read size will help */
-            sectors /= 2;
-        }
-        else if (retry_count < MAX_RETRIES)
-        {
-            /* still failed; retry a few times */
-            retry_count ++;
-        }
-        else if (skip_count < MAX_SKIPS)
-        {
-            /* maybe the disk is scratched; try skipping ahead */
-            currlsn = MIN (currlsn + 75, endlsn + 1);
-            skip_count ++;
-        }
-        else
+        if (ret == READER_ERROR)
         {
-            /* still failed; give it up */
             cdaudio_error (_("Error reading audio CD."));
             break;
         }
+
+        if (! ret)
+            break;
     }
 
+    /* still under the mutex, so that the drive is not closed under the
+     * reader thread */
+    if (playing && lsn > endlsn && lsn <= readend)
+    {
+        parked_reader = reader;
+        parked_lsn = lsn;
+    }
+    else
+        reader_stop (reader);
+
+    reader = NULL;
     playing = FALSE;
 
     pthread_mutex_unlock (& mutex);
+    g_free (buffer);
     return TRUE;
 }
 
@@ -409,6 +526,10 @@ static void cdaudio_stop (InputPlayback * p)
     pthread_mutex_lock (& mutex);
     playing = FALSE;
     p->output->abort_write();
+
+    if (reader)
+        reader_interrupt (reader);
+
     pthread_mutex_unlock (& mutex);
 }
 
@@ -426,6 +547,10 @@ static void cdaudio_mseek (InputPlayback * p, int time)
     pthread_mutex_lock (& mutex);
     seek_time = time;
     p->output->abort_write();
+
+    if (reader)
+        reader_interrupt (reader);
+
     pthread_mutex_unlock (& mutex);
 }
 
@@ -434,12 +559,39 @@ static void cdaudio_cleanup (void)
 {
     pthread_mutex_lock (& mutex);
 
+    cddb_quit = TRUE;
+
+    if (cddb_pending)
+    {
+        job_free (cddb_pending);
+        cddb_pending = NULL;
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    /* wait for a query in progress */
+    if (cddb_joinable)
+    {
+        pthread_join (cddb_thread, NULL);
+        cddb_joinable = FALSE;
+    }
+
+    pthread_mutex_lock (& mutex);
+
+    if (rescan_source)
+    {
+        g_source_remove (rescan_source);
+        rescan_source = 0;
+    }
+
     if (monitor_source)
     {
         g_source_remove (monitor_source);
         monitor_source = 0;
     }
 
+    drop_parked_reader ();
+
     if (pcdrom_drive != NULL)
     {
         cdda_close (pcdrom_drive);
@@ -452,9 +604,11 @@ static void cdaudio_cleanup (void)
         trackinfo = NULL;
     }
 
-    libcddb_shutdown ();
-
     pthread_mutex_unlock (& mutex);
+
+    warmup_stop (& warmup);
+    libcddb_shutdown ();
+    cdio_ready = FALSE;
 }
 
 /* thread safe */
@@ -527,6 +681,10 @@ static void open_cd (void)
     AUDDBG ("Opening CD drive.\n");
     g_return_if_fail (pcdrom_drive == NULL);
 
+    warmup_wait (& warmup);
+    if (! cdio_ready)
+        return;
+
     char * device = aud_get_string ("CDDA", "device");
 
     if (device[0])
@@ -553,6 +711,362 @@ static void open_cd (void)
     free (device);
 }
 
+/* Track lists and metadata are cached by CDDB disc ID, together with the TOC
+ * they were found for, so that a disc seen before is listed at once.  CDDB is
+ * only ever asked in the background: for a new disc without CD-Text, the
+ * tracks are listed by number until the answer comes, and for a cached disc
+ * whose information came from CDDB, the entry is refreshed.  Either way the
+ * playlist is rescanned if anything changed. */
+
+/* mutex must be locked */
+static CDDBJob * job_new (void)
+{
+    CDDBJob * job = g_slice_new (CDDBJob);
+    GString * toc = g_string_new (NULL);
+
+    job->disc = cddb_disc_new ();
+    job->first = firsttrackno;
+    job->last = lasttrackno;
+
+    lba_t lba = cdio_get_track_lba (pcdrom_drive->p_cdio, CDIO_CDROM_LEADOUT_TRACK);
+    cddb_disc_set_length (job->disc, FRAMES_TO_SECONDS (lba));
+
+    for (int trackno = firsttrackno; trackno <= lasttrackno; trackno ++)
+    {
+        lba_t offset = cdio_get_track_lba (pcdrom_drive->p_cdio, trackno);
+        cddb_track_t * pcddb_track = cddb_track_new ();
+
+        cddb_track_set_frame_offset (pcddb_track, offset);
+        cddb_disc_add_track (job->disc, pcddb_track);
+        g_string_append_printf (toc, "%d ", (int) offset);
+    }
+
+    g_string_append_printf (toc, "%d", (int) lba);
+
+    cddb_disc_calc_discid (job->disc);
+    job->discid = cddb_disc_get_discid (job->disc);
+    job->toc = g_string_free (toc, FALSE);
+
+    return job;
+}
+
+/* thread safe */
+static void job_free (CDDBJob * job)
+{
+    cddb_disc_destroy (job->disc);
+    g_free (job->toc);
+    g_slice_free (CDDBJob, job);
+}
+
+/* thread safe */
+static char * cache_path (unsigned discid)
+{
+    char name[16];
+    snprintf (name, sizeof name, "%08x", discid);
+    return g_build_filename (g_get_user_cache_dir (), "audacious", "cdaudio", name, NULL);
+}
+
+/* thread safe */
+static void cache_load_track (GKeyFile * keyfile, int trackno, trackinfo_t * t)
+{
+    char group[16];
+    snprintf (group, sizeof group, "%d", trackno);
+
+    char * performer = g_key_file_get_string (keyfile, group, "performer", NULL);
+    char * name = g_key_file_get_string (keyfile, group, "name", NULL);
+    char * genre = g_key_file_get_string (keyfile, group, "genre", NULL);
+
+    cdaudio_set_strinfo (t, performer, name, genre);
+
+    g_free (performer);
+    g_free (name);
+    g_free (genre);
+}
+
+/* mutex must be locked */
+static bool_t cache_load (const CDDBJob * job, bool_t * from_cddb)
+{
+    char * path = cache_path (job->discid);
+    GKeyFile * keyfile = g_key_file_new ();
+    bool_t found = FALSE;
+
+    if (g_key_file_load_from_file (keyfile, path, 0, NULL))
+    {
+        char * toc = g_key_file_get_string (keyfile, "disc", "toc", NULL);
+
+        if (toc && ! strcmp (toc, job->toc))
+        {
+            char * source = g_key_file_get_string (keyfile, "disc", "source", NULL);
+            * from_cddb = (source && ! strcmp (source, "cddb"));
+            g_free (source);
+
+            cache_load_track (keyfile, 0, & trackinfo[0]);
+
+            for (int trackno = job->first; trackno <= job->last; trackno ++)
+                cache_load_track (keyfile, trackno, & trackinfo[trackno]);
+
+            found = TRUE;
+        }
+
+        g_free (toc);
+    }
+
+    g_key_file_free (keyfile);
+    g_free (path);
+    return found;
+}
+
+/* thread safe */
+static void cache_save_track (GKeyFile * keyfile, int trackno, const trackinfo_t * t)
+{
+    char group[16];
+    snprintf (group, sizeof group, "%d", trackno);
+
+    g_key_file_set_string (keyfile, group, "performer", t->performer);
+    g_key_file_set_string (keyfile, group, "name", t->name);
+    g_key_file_set_string (keyfile, group, "genre", t->genre);
+}
+
+/* thread safe (info must not change meanwhile) */
+static void cache_save (const CDDBJob * job, const char * source, const trackinfo_t * info)
+{
+    GKeyFile * keyfile = g_key_file_new ();
+
+    g_key_file_set_string (keyfile, "disc", "toc", job->toc);
+    g_key_file_set_string (keyfile, "disc", "source", source);
+
+    cache_save_track (keyfile, 0, & info[0]);
+
+    for (int trackno = job->first; trackno <= job->last; trackno ++)
+        cache_save_track (keyfile, trackno, & info[trackno]);
+
+    char * path = cache_path (job->discid);
+    char * dir = g_path_get_dirname (path);
+    char * data = g_key_file_to_data (keyfile, NULL, NULL);
+
+    if (g_mkdir_with_parents (dir, 0700) || ! g_file_set_contents (path, data, -1, NULL))
+        warn ("Cannot write %s.\n", path);
+
+    g_free (data);
+    g_free (dir);
+    g_free (path);
+    g_key_file_free (keyfile);
+}
+
+/* thread safe */
+static cddb_conn_t * cddb_connect (void)
+{
+    cddb_conn_t *pcddb_conn = cddb_new ();
+
+    if (pcddb_conn == NULL)
+    {
+        cdaudio_error (_("Failed to create the cddb connection."));
+        return NULL;
+    }
+
+    cddb_cache_enable (pcddb_conn);
+    // cddb_cache_set_dir(pcddb_conn, "~/.cddbslave");
+
+    char * server = aud_get_string ("CDDA", "cddbserver");
+    char * path = aud_get_string ("CDDA", "cddbpath");
+    int port = aud_get_int ("CDDA", "cddbport");
+
+    if (aud_get_bool (NULL, "use_proxy"))
+    {
+        char * prhost = aud_get_string (NULL, "proxy_host");
+        int prport = aud_get_int (NULL, "proxy_port");
+        char * pruser = aud_get_string (NULL, "proxy_user");
+        char * prpass = aud_get_string (NULL, "proxy_pass");
+
+        cddb_http_proxy_enable (pcddb_conn);
+        cddb_set_http_proxy_server_name (pcddb_conn, prhost);
+        cddb_set_http_proxy_server_port (pcddb_conn, prport);
+        cddb_set_http_proxy_username (pcddb_conn, pruser);
+        cddb_set_http_proxy_password (pcddb_conn, prpass);
+
+        free (prhost);
+        free (pruser);
+        free (prpass);
+
+        cddb_set_server_name (pcddb_conn, server);
+        cddb_set_server_port (pcddb_conn, port);
+    }
+    else if (aud_get_bool ("CDDA", "cddbhttp"))
+    {
+        cddb_http_enable (pcddb_conn);
+        cddb_set_server_name (pcddb_conn, server);
+        cddb_set_server_port (pcddb_conn, port);
+        cddb_set_http_path_query (pcddb_conn, path);
+    }
+    else
+    {
+        cddb_set_server_name (pcddb_conn, server);
+        cddb_set_server_port (pcddb_conn, port);
+    }
+
+    free (server);
+    free (path);
+
+    return pcddb_conn;
+}
+
+/* thread safe; fills in the strings of info[0] and info[first .. last] */
+static bool_t cddb_fetch (CDDBJob * job, trackinfo_t * info)
+{
+    cddb_conn_t *pcddb_conn = cddb_connect ();
+    bool_t found = FALSE;
+
+    if (pcddb_conn == NULL)
+        return FALSE;
+
+    AUDDBG ("getting CDDB info for disc %08x\n", job->discid);
+
+    int matches;
+    if ((matches = cddb_query (pcddb_conn, job->disc)) == -1)
+    {
+        if (cddb_errno (pcddb_conn) == CDDB_ERR_OK)
+            cdaudio_error (_("Failed to query the CDDB server"));
+        else
+            cdaudio_error (_("Failed to query the CDDB server: %s"),
+                           cddb_error_str (cddb_errno (pcddb_conn)));
+    }
+    else if (matches == 0)
+        AUDDBG ("no cddb info available for this disc\n");
+    else
+    {
+        AUDDBG ("CDDB disc category = \"%s\"\n",
+               cddb_disc_get_category_str (job->disc));
+
+        cddb_read (pcddb_conn, job->disc);
+        if (cddb_errno (pcddb_conn) != CDDB_ERR_OK)
+            cdaudio_error (_("Failed to read the cddb info: %s"),
+                           cddb_error_str (cddb_errno (pcddb_conn)));
+        else
+        {
+            cdaudio_set_strinfo (&info[0],
+                                 cddb_disc_get_artist (job->disc),
+                                 cddb_disc_get_title (job->disc),
+                                 cddb_disc_get_genre (job->disc));
+
+            for (int trackno = job->first; trackno <= job->last; trackno++)
+            {
+                cddb_track_t *pcddb_track =
+                    cddb_disc_get_track (job->disc, trackno - job->first);
+                cdaudio_set_strinfo (&info[trackno],
+                                     cddb_track_get_artist (pcddb_track),
+                                     cddb_track_get_title (pcddb_track),
+                                     cddb_disc_get_genre (job->disc));
+            }
+
+            found = TRUE;
+        }
+    }
+
+    cddb_destroy (pcddb_conn);
+    return found;
+}
+
+/* main thread only */
+static bool_t rescan_cb (gpointer unused)
+{
+    pthread_mutex_lock (& mutex);
+
+    int first = firsttrackno, last = lasttrackno;
+    bool_t have_disc = (trackinfo != NULL);
+    rescan_source = 0;
+
+    pthread_mutex_unlock (& mutex);
+
+    for (int trackno = first; have_disc && trackno <= last; trackno ++)
+    {
+        SPRINTF (filename, "cdda://?%d", trackno);
+        aud_playlist_rescan_file (filename);
+    }
+
+    return FALSE;
+}
+
+/* mutex must be locked */
+static bool_t apply_strinfo (trackinfo_t * t, const trackinfo_t * from)
+{
+    if (! strcmp (t->performer, from->performer) && ! strcmp (t->name,
+     from->name) && ! strcmp (t->genre, from->genre))
+        return FALSE;
+
+    cdaudio_set_strinfo (t, from->performer, from->name, from->genre);
+    return TRUE;
+}
+
+static void * cddb_worker (void * unused)
+{
+    pthread_mutex_lock (& mutex);
+
+    while (cddb_pending && ! cddb_quit)
+    {
+        CDDBJob * job = cddb_pending;
+        cddb_pending = NULL;
+
+        pthread_mutex_unlock (& mutex);
+
+        trackinfo_t * info = g_new0 (trackinfo_t, job->last + 1);
+        bool_t found = cddb_fetch (job, info);
+
+        if (found)
+            cache_save (job, "cddb", info);
+
+        pthread_mutex_lock (& mutex);
+
+        /* the disc may have been changed meanwhile */
+        if (found && ! cddb_quit && trackinfo != NULL && job->discid ==
+         current_discid && job->first == firsttrackno && job->last == lasttrackno)
+        {
+            bool_t changed = apply_strinfo (& trackinfo[0], & info[0]);
+
+            for (int trackno = job->first; trackno <= job->last; trackno ++)
+                changed |= apply_strinfo (& trackinfo[trackno], & info[trackno]);
+
+            if (changed && ! rescan_source)
+                rescan_source = g_idle_add (rescan_cb, NULL);
+        }
+
+        g_free (info);
+        job_free (job);
+    }
+
+    cddb_running = FALSE;
+    pthread_mutex_unlock (& mutex);
+    return NULL;
+}
+
+/* mutex must be locked; takes ownership of job */
+static void cddb_start (CDDBJob * job)
+{
+    if (cddb_pending)
+        job_free (cddb_pending);
+
+    cddb_pending = job;
+
+    if (cddb_running)
+        return;
+
+    /* a finished worker does not use the mutex any more */
+    if (cddb_joinable)
+    {
+        pthread_join (cddb_thread, NULL);
+        cddb_joinable = FALSE;
+    }
+
+    if (pthread_create (& cddb_thread, NULL, cddb_worker, NULL))
+    {
+        warn ("Cannot start CDDB thread.\n");
+        job_free (cddb_pending);
+        cddb_pending = NULL;
+        return;
+    }
+
+    cddb_running = cddb_joinable = TRUE;
+}
+
 /* mutex must be locked */
 static void scan_cd (void)
 {
@@ -576,9 +1090,8 @@ static void scan_cd (void)
     }
 
     int speed = aud_get_int ("CDDA", "disc_speed");
-    speed = CLAMP (speed, MIN_DISC_SPEED, MAX_DISC_SPEED);
-    if (cdda_speed_set (pcdrom_drive, speed) != DRIVER_OP_SUCCESS)
-        warn ("Cannot set drive speed.\n");
+    drive_speed = 0;
+    set_drive_speed (CLAMP (speed, MIN_DISC_SPEED, MAX_DISC_SPEED));
 
     firsttrackno = cdio_get_first_track_num (pcdrom_drive->p_cdio);
     lasttrackno = cdio_get_last_track_num (pcdrom_drive->p_cdio);
@@ -618,6 +1131,23 @@ static void scan_cd (void)
             n_audio_tracks++;
     }
 
+    CDDBJob * job = job_new ();
+    bool_t from_cddb = FALSE;
+
+    current_discid = job->discid;
+
+    if (cache_load (job, & from_cddb))
+    {
+        AUDDBG ("using cached information for disc %08x\n", job->discid);
+
+        if (from_cddb && aud_get_bool ("CDDA", "use_cddb"))
+            cddb_start (job);
+        else
+            job_free (job);
+
+        return;
+    }
+
     /* get trackinfo[0] cdtext information (the disc) */
     cdtext_t *pcdtext = NULL;
     if (aud_get_bool ("CDDA", "use_cdtext"))
@@ -687,162 +1217,15 @@ static void scan_cd (void)
         }
     }
 
-    if (!cdtext_was_available)
+    if (cdtext_was_available)
     {
-        /* initialize de cddb subsystem */
-        cddb_conn_t *pcddb_conn = NULL;
-        cddb_disc_t *pcddb_disc = NULL;
-        cddb_track_t *pcddb_track = NULL;
-        lba_t lba;              /* Logical Block Address */
-
-        if (aud_get_bool ("CDDA", "use_cddb"))
-        {
-            pcddb_conn = cddb_new ();
-            if (pcddb_conn == NULL)
-                cdaudio_error (_("Failed to create the cddb connection."));
-            else
-            {
-                AUDDBG ("getting CDDB info\n");
-
-                cddb_cache_enable (pcddb_conn);
-                // cddb_cache_set_dir(pcddb_conn, "~/.cddbslave");
-
-                char * server = aud_get_string ("CDDA", "cddbserver");
-                char * path = aud_get_string ("CDDA", "cddbpath");
-                int port = aud_get_int ("CDDA", "cddbport");
-
-                if (aud_get_bool (NULL, "use_proxy"))
-                {
-                    char * prhost = aud_get_string (NULL, "proxy_host");
-                    int prport = aud_get_int (NULL, "proxy_port");
-                    char * pruser = aud_get_string (NULL, "proxy_user");
-                    char * prpass = aud_get_string (NULL, "proxy_pass");
-
-                    cddb_http_proxy_enable (pcddb_conn);
-                    cddb_set_http_proxy_server_name (pcddb_conn, prhost);
-                    cddb_set_http_proxy_server_port (pcddb_conn, prport);
-                    cddb_set_http_proxy_username (pcddb_conn, pruser);
-                    cddb_set_http_proxy_password (pcddb_conn, prpass);
-
-                    free (prhost);
-                    free (pruser);
-                    free (prpass);
-
-                    cddb_set_server_name (pcddb_conn, server);
-                    cddb_set_server_port (pcddb_conn, port);
-                }
-                else if (aud_get_bool ("CDDA", "cddbhttp"))
-                {
-                    cddb_http_enable (pcddb_conn);
-                    cddb_set_server_name (pcddb_conn, server);
-                    cddb_set_server_port (pcddb_conn, port);
-                    cddb_set_http_path_query (pcddb_conn, path);
-                }
-                else
-                {
-                    cddb_set_server_name (pcddb_conn, server);
-                    cddb_set_server_port (pcddb_conn, port);
-                }
-
-                free (server);
-                free (path);
-
-                pcddb_disc = cddb_disc_new ();
-
-                lba = cdio_get_track_lba (pcdrom_drive->p_cdio,
-                                          CDIO_CDROM_LEADOUT_TRACK);
-                cddb_disc_set_length (pcddb_disc, FRAMES_TO_SECONDS (lba));
-
-                for (trackno = firsttrackno; trackno <= lasttrackno; trackno++)
-                {
-                    pcddb_track = cddb_track_new ();
-                    cddb_track_set_frame_offset (pcddb_track,
-                                                 cdio_get_track_lba (
-                                                     pcdrom_drive->p_cdio,
-                                                     trackno));
-                    cddb_disc_add_track (pcddb_disc, pcddb_track);
-                }
-
-                cddb_disc_calc_discid (pcddb_disc);
-
-#if DEBUG
-                guint discid = cddb_disc_get_discid (pcddb_disc);
-                AUDDBG ("CDDB disc id = %x\n", discid);
-#endif
-
-                int matches;
-                if ((matches = cddb_query (pcddb_conn, pcddb_disc)) == -1)
-                {
-                    if (cddb_errno (pcddb_conn) == CDDB_ERR_OK)
-                        cdaudio_error (_("Failed to query the CDDB server"));
-                    else
-                        cdaudio_error (_("Failed to query the CDDB server: %s"),
-                                       cddb_error_str (cddb_errno
-                                                       (pcddb_conn)));
-
-                    cddb_disc_destroy (pcddb_disc);
-                    pcddb_disc = NULL;
-                }
-                else
-                {
-                    if (matches == 0)
-                    {
-                        AUDDBG ("no cddb info available for this disc\n");
-
-                        cddb_disc_destroy (pcddb_disc);
-                        pcddb_disc = NULL;
-                    }
-                    else
-                    {
-                        AUDDBG ("CDDB disc category = \"%s\"\n",
-                               cddb_disc_get_category_str (pcddb_disc));
-
-                        cddb_read (pcddb_conn, pcddb_disc);
-                        if (cddb_errno (pcddb_conn) != CDDB_ERR_OK)
-                        {
-                            cdaudio_error (_("Failed to read the cddb info: %s"),
-                                           cddb_error_str (cddb_errno
-                                                           (pcddb_conn)));
-                            cddb_disc_destroy (pcddb_disc);
-                            pcddb_disc = NULL;
-                        }
-                        else
-                        {
-                            cdaudio_set_strinfo (&trackinfo[0],
-                                                 cddb_disc_get_artist
-                                                 (pcddb_disc),
-                                                 cddb_disc_get_title
-                                                 (pcddb_disc),
-                                                 cddb_disc_get_genre
-                                                 (pcddb_disc));
-
-                            int trackno;
-                            for (trackno = firsttrackno; trackno <= lasttrackno;
-                                 trackno++)
-                            {
-                                cddb_track_t *pcddb_track =
-                                    cddb_disc_get_track (pcddb_disc,
-                                                         trackno - 1);
-                                cdaudio_set_strinfo (&trackinfo[trackno],
-                                                     cddb_track_get_artist
-                                                     (pcddb_track),
-                                                     cddb_track_get_title
-                                                     (pcddb_track),
-                                                     cddb_disc_get_genre
-                                                     (pcddb_disc));
-                            }
-                        }
-                    }
-                }
-            }
-        }
-
-        if (pcddb_disc != NULL)
-            cddb_disc_destroy (pcddb_disc);
-
-        if (pcddb_conn != NULL)
-            cddb_destroy (pcddb_conn);
+        cache_save (job, "cdtext", trackinfo);
+        job_free (job);
     }
+    else if (aud_get_bool ("CDDA", "use_cddb"))
+        cddb_start (job);
+    else
+        job_free (job);
 
     return;
 
@@ -878,6 +1261,8 @@ static void refresh_trackinfo (bool_t warning)
                 cdaudio_error (_("Unsupported disk type."));
         }
 
+        drop_parked_reader ();
+
         /* reset libcdio, else it will not read a new disk correctly */
         if (pcdrom_drive)
         {
@@ -892,6 +1277,7 @@ static void refresh_trackinfo (bool_t warning)
 
     if (trackinfo == NULL || cdio_get_media_changed (pcdrom_drive->p_cdio))
     {
+        drop_parked_reader ();
         g_free (trackinfo);
         trackinfo = NULL;
         scan_cd ();
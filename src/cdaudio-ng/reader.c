@@ -0,0 +1,321 @@
+/*
+ * Audacious CD Digital Audio plugin
+ * Read-ahead thread
+ *
+ * Copyright (c) 2014 Audacious developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; under version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "reader.h"
+
+#ifdef HAVE_CDIO_PARANOIA
+#if LIBCDIO_VERSION_NUM >= 90
+#include <cdio/paranoia/paranoia.h>
+#else
+#include <cdio/paranoia.h>
+#endif
+#endif
+
+#include <audacious/debug.h>
+
+#define MAX_RETRIES 10
+#define MAX_SKIPS 10
+
+#define MIN_CHUNK 16
+#define TARGET_MS 250 /* time a single read should take */
+
+#define PARANOIA_RETRIES 20
+
+struct CDReader {
+    cdrom_drive_t * drive;
+#ifdef HAVE_CDIO_PARANOIA
+    cdrom_paranoia_t * paranoia;
+    int paranoia_lsn; /* where cdparanoia will read next */
+#endif
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    unsigned char * ring;
+    int size;           /* sectors */
+    int head, fill;     /* index of the first sector, number of sectors */
+
+    int next_lsn, endlsn;
+    int chunk, max_chunk;
+    int serial;         /* incremented by each seek */
+
+    bool_t quit, interrupt, finished, failed;
+};
+
+static int64_t time_us (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool_t read_sectors (CDReader * r, unsigned char * buf, int lsn, int count)
+{
+#ifdef HAVE_CDIO_PARANOIA
+    if (r->paranoia)
+    {
+        if (lsn != r->paranoia_lsn)
+            cdio_paranoia_seek (r->paranoia, lsn, SEEK_SET);
+
+        r->paranoia_lsn = -1;
+
+        for (int i = 0; i < count; i ++)
+        {
+            int16_t * data = cdio_paranoia_read_limited (r->paranoia, NULL,
+             PARANOIA_RETRIES);
+
+            if (! data)
+                return FALSE;
+
+            /* cdparanoia returns samples in host order */
+            int16_t * out = (int16_t *) (buf + SECTOR_SIZE * i);
+
+            for (int j = 0; j < SECTOR_SIZE / 2; j ++)
+                out[j] = GINT16_TO_LE (data[j]);
+        }
+
+        r->paranoia_lsn = lsn + count;
+        return TRUE;
+    }
+#endif
+
+    return (cdio_read_audio_sectors (r->drive->p_cdio, buf, lsn, count) ==
+     DRIVER_OP_SUCCESS);
+}
+
+static void * reader_thread (void * data)
+{
+    CDReader * r = data;
+    int retries = 0, skips = 0;
+
+    pthread_mutex_lock (& r->mutex);
+
+    while (! r->quit)
+    {
+        int want = MIN (r->chunk, r->endlsn + 1 - r->next_lsn);
+        int tail = (r->head + r->fill) % r->size;
+
+        /* never split a read across the end of the ring */
+        want = MIN (want, r->size - tail);
+
+        if (want < 1 && ! r->finished)
+        {
+            r->finished = TRUE;
+            pthread_cond_broadcast (& r->cond);
+        }
+
+        if (r->finished || r->failed || r->size - r->fill < want)
+        {
+            pthread_cond_wait (& r->cond, & r->mutex);
+            continue;
+        }
+
+        int lsn = r->next_lsn;
+        int serial = r->serial;
+
+        pthread_mutex_unlock (& r->mutex);
+
+        /* The consumer never touches the free part of the ring, and a seek
+         * only empties it, so the sectors are read in place. */
+        int64_t start = time_us ();
+        bool_t ok = read_sectors (r, r->ring + SECTOR_SIZE * tail, lsn, want);
+        int64_t spent = time_us () - start;
+
+        pthread_mutex_lock (& r->mutex);
+
+        if (serial != r->serial)
+        {
+            retries = skips = 0;
+            continue;
+        }
+
+        if (ok)
+        {
+            r->fill += want;
+            r->next_lsn += want;
+            retries = skips = 0;
+
+            /* Move halfway toward a chunk the drive reads in TARGET_MS;
+             * reads cut short by the end of the ring say little. */
+            if (want == r->chunk)
+            {
+                int64_t target = (int64_t) want * TARGET_MS * 1000 / MAX (spent, 1);
+                target = CLAMP (target, MIN_CHUNK, r->max_chunk);
+                r->chunk = (r->chunk + target) / 2;
+            }
+
+            pthread_cond_broadcast (& r->cond);
+        }
+        else if (r->chunk > MIN_CHUNK)
+        {
+            /* maybe a smaller read size will help */
+            r->chunk /= 2;
+        }
+        else if (retries < MAX_RETRIES)
+        {
+            /* still failed; retry a few times */
+            retries ++;
+        }
+        else if (skips < MAX_SKIPS)
+        {
+            /* maybe the disk is scratched; try skipping ahead */
+            AUDDBG ("Skipping sectors %d to %d.\n", r->next_lsn, r->next_lsn + 74);
+            r->next_lsn = MIN (r->next_lsn + 75, r->endlsn + 1);
+            skips ++;
+        }
+        else
+        {
+            /* still failed; give it up */
+            r->failed = TRUE;
+            pthread_cond_broadcast (& r->cond);
+        }
+    }
+
+    pthread_mutex_unlock (& r->mutex);
+    return NULL;
+}
+
+CDReader * reader_start (cdrom_drive_t * drive, int startlsn, int endlsn,
+ int ring_sectors, int chunk, bool_t verify)
+{
+    CDReader * r = g_slice_new0 (CDReader);
+
+    r->drive = drive;
+    r->size = MAX (ring_sectors, 2 * MIN_CHUNK);
+    r->ring = g_malloc (SECTOR_SIZE * r->size);
+    r->next_lsn = startlsn;
+    r->endlsn = endlsn;
+    r->max_chunk = MAX (r->size / 4, MIN_CHUNK);
+    r->chunk = CLAMP (chunk, MIN_CHUNK, r->max_chunk);
+
+#ifdef HAVE_CDIO_PARANOIA
+    if (verify)
+    {
+        if ((r->paranoia = cdio_paranoia_init (drive)))
+        {
+            cdio_paranoia_modeset (r->paranoia, PARANOIA_MODE_FULL ^
+             PARANOIA_MODE_NEVERSKIP);
+            r->paranoia_lsn = -1;
+        }
+        else
+            fprintf (stderr, "cdaudio-ng: Failed to initialize cdparanoia.\n");
+    }
+#endif
+
+    pthread_mutex_init (& r->mutex, NULL);
+    pthread_cond_init (& r->cond, NULL);
+
+    if (pthread_create (& r->thread, NULL, reader_thread, r))
+    {
+        fprintf (stderr, "cdaudio-ng: Failed to start reader thread.\n");
+
+        pthread_mutex_destroy (& r->mutex);
+        pthread_cond_destroy (& r->cond);
+#ifdef HAVE_CDIO_PARANOIA
+        if (r->paranoia)
+            cdio_paranoia_free (r->paranoia);
+#endif
+        g_free (r->ring);
+        g_slice_free (CDReader, r);
+        return NULL;
+    }
+
+    AUDDBG ("Reading ahead %d sectors, %d at a time.\n", r->size, r->chunk);
+    return r;
+}
+
+void reader_stop (CDReader * r)
+{
+    pthread_mutex_lock (& r->mutex);
+    r->quit = TRUE;
+    pthread_cond_broadcast (& r->cond);
+    pthread_mutex_unlock (& r->mutex);
+
+    pthread_join (r->thread, NULL);
+
+    pthread_mutex_destroy (& r->mutex);
+    pthread_cond_destroy (& r->cond);
+#ifdef HAVE_CDIO_PARANOIA
+    if (r->paranoia)
+        cdio_paranoia_free (r->paranoia);
+#endif
+    g_free (r->ring);
+    g_slice_free (CDReader, r);
+}
+
+int reader_get (CDReader * r, void * buf, int max)
+{
+    int ret;
+
+    pthread_mutex_lock (& r->mutex);
+
+    while (! r->fill && ! r->finished && ! r->failed && ! r->interrupt)
+        pthread_cond_wait (& r->cond, & r->mutex);
+
+    if (r->interrupt)
+    {
+        r->interrupt = FALSE;
+        ret = READER_INTERRUPTED;
+    }
+    else if (r->fill)
+    {
+        ret = MIN (max, MIN (r->fill, r->size - r->head));
+        memcpy (buf, r->ring + SECTOR_SIZE * r->head, SECTOR_SIZE * ret);
+
+        r->head = (r->head + ret) % r->size;
+        r->fill -= ret;
+
+        pthread_cond_broadcast (& r->cond);
+    }
+    else
+        ret = r->failed ? READER_ERROR : 0;
+
+    pthread_mutex_unlock (& r->mutex);
+    return ret;
+}
+
+void reader_seek (CDReader * r, int lsn)
+{
+    pthread_mutex_lock (& r->mutex);
+
+    r->serial ++;
+    r->head = r->fill = 0;
+    r->next_lsn = lsn;
+    r->finished = r->failed = FALSE;
+
+    pthread_cond_broadcast (& r->cond);
+    pthread_mutex_unlock (& r->mutex);
+}
+
+void reader_interrupt (CDReader * r)
+{
+    pthread_mutex_lock (& r->mutex);
+    r->interrupt = TRUE;
+    pthread_cond_broadcast (& r->cond);
+    pthread_mutex_unlock (& r->mutex);
+}
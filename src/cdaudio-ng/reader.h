@@ -0,0 +1,64 @@
+/*
+ * Audacious CD Digital Audio plugin
+ * Read-ahead thread
+ *
+ * Copyright (c) 2014 Audacious developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; under version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses>.
+ */
+
+#ifndef CDAUDIO_NG_READER_H
+#define CDAUDIO_NG_READER_H
+
+#include <libaudcore/core.h>
+
+/* prevent libcdio from redefining PACKAGE, VERSION, etc. */
+#define EXTERNAL_LIBCDIO_CONFIG_H
+
+#include <cdio/cdio.h>
+
+#if LIBCDIO_VERSION_NUM >= 90
+#include <cdio/paranoia/cdda.h>
+#else
+#include <cdio/cdda.h>
+#endif
+
+#define SECTOR_SIZE 2352
+
+#define READER_ERROR -1
+#define READER_INTERRUPTED -2
+
+/* A thread that reads sectors ahead of playback into a ring, so that drive
+ * spin-up, seeks and retries are absorbed by the ring rather than heard as
+ * gaps.  Sectors are read in chunks sized to take about a quarter of a second
+ * at the throughput measured so far.  With verify set (and libcdio_paranoia
+ * available), sectors are read through cdparanoia instead.
+ *
+ * The drive must stay open until reader_stop returns. */
+
+typedef struct CDReader CDReader;
+
+CDReader * reader_start (cdrom_drive_t * drive, int startlsn, int endlsn,
+ int ring_sectors, int chunk, bool_t verify);
+void reader_stop (CDReader * r);
+
+/* Waits for sectors and copies up to max of them to buf.  Returns the number
+ * copied, 0 once the last sector has been read, READER_ERROR if the drive
+ * gave up, or READER_INTERRUPTED if woken by reader_interrupt. */
+int reader_get (CDReader * r, void * buf, int max);
+
+/* Discards what has been read ahead and continues from lsn. */
+void reader_seek (CDReader * r, int lsn);
+void reader_interrupt (CDReader * r);
+
+#endif
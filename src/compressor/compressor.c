@@ -24,6 +24,7 @@
 #include <audacious/misc.h>
 
 #include "compressor.h"
+#include "../denormal/denormal.h"
 
 /* Response time adjustments.  Maybe this should be adjustable.  Or maybe that
  * would just be confusing.  I don't know. */
@@ -33,28 +34,34 @@
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
-static float * buffer, * output, * peaks;
-static int output_size;
+/* Audio is kept in a power-of-two ring.  The lookahead (CHUNKS chunks) starts
+ * at read_pos; the chunks processed during the current call sit just before
+ * it, starting at out_pos.  When that region is contiguous, it is returned to
+ * the caller directly; only when it wraps around the end of the ring (or the
+ * caller passes in more audio than the ring can hold) is it copied out to the
+ * output buffer. */
+
+static float * ring, * output, * peaks;
+static int ring_size, ring_mask;
+static int output_size, output_filled;
 static int chunk_size, buffer_size;
-static int ring_at, buffer_filled, peaks_filled;
+static int read_pos, buffer_filled;
+static int out_pos, out_filled;
+static int ring_at, peaks_filled;
 static float current_peak;
-static int output_filled;
 static int current_channels, current_rate;
+static bool_t flush_denormals;
 
 static void buffer_append (float * * data, int * length)
 {
-    int offset = (chunk_size * ring_at + buffer_filled) % buffer_size;
+    int offset = (read_pos + buffer_filled) & ring_mask;
     int writable = MIN (* length, buffer_size - buffer_filled);
+    writable = MIN (writable, ring_size - buffer_filled - out_filled);
 
-    if (writable <= buffer_size - offset)
-        memcpy (buffer + offset, * data, sizeof (float) * writable);
-    else
-    {
-        int part = buffer_size - offset;
+    int first = MIN (writable, ring_size - offset);
 
-        memcpy (buffer + offset, * data, part);
-        memcpy (buffer, (* data) + part, writable - part);
-    }
+    memcpy (ring + offset, * data, sizeof (float) * first);
+    memcpy (ring, (* data) + first, sizeof (float) * (writable - first));
 
     buffer_filled += writable;
     * data += writable;
@@ -72,26 +79,39 @@ static float calc_peak (float * data, int length)
     if (! length)
         return 0;
 
-    float sum = 0;
+    return compressor_sum_abs (data, length) / length * 6;
+}
+
+/* calc_peak() over a region of the ring, which may wrap around. */
+static float calc_ring_peak (int offset, int length)
+{
+    if (! length)
+        return 0;
 
-    float * end = data + length;
-    while (data < end)
-        sum += fabsf (* data ++);
+    int first = MIN (length, ring_size - offset);
+    float sum = compressor_sum_abs (ring + offset, first) +
+     compressor_sum_abs (ring, length - first);
 
     return sum / length * 6;
 }
 
-static void do_ramp (float * data, int length, float peak_a, float peak_b)
+static void do_ramp (int offset, int length, float peak_a, float peak_b)
 {
     float center = aud_get_double ("compressor", "center");
     float range = aud_get_double ("compressor", "range");
     float a = powf (peak_a / center, range - 1);
     float b = powf (peak_b / center, range - 1);
 
-    for (int count = 0; count < length; count ++)
+    int first = MIN (length, ring_size - offset);
+
+    if (first == length)
+        compressor_ramp (ring + offset, length, a, b);
+    else
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        float mid = a + (b - a) * first / length;
+
+        compressor_ramp (ring + offset, first, a, mid);
+        compressor_ramp (ring, length - first, mid, b);
     }
 }
 
@@ -107,9 +127,22 @@ static void output_append (float * data, int length)
     output_filled += length;
 }
 
+/* Moves the audio processed so far in this call out of the ring. */
+static void flush_out (void)
+{
+    int first = MIN (out_filled, ring_size - out_pos);
+
+    output_append (ring + out_pos, first);
+    output_append (ring, out_filled - first);
+
+    out_pos = read_pos;
+    out_filled = 0;
+}
+
 static void reset (void)
 {
     ring_at = 0;
+    read_pos = 0;
     buffer_filled = 0;
     peaks_filled = 0;
     current_peak = 0.0;
@@ -117,6 +150,7 @@ static void reset (void)
 
 #define IN_RING(i) ((ring_at + i) % CHUNKS)
 #define GET_PEAK(i) peaks[IN_RING (i)]
+#define CHUNK_OFFSET(i) ((read_pos + chunk_size * (i)) & ring_mask)
 
 static inline float FMAX (float a, float b)
 {
@@ -128,16 +162,26 @@ static void do_compress (float * * data, int * samples, char finish)
     float new_peak;
 
     output_filled = 0;
+    out_pos = read_pos;
+    out_filled = 0;
 
     while (1)
     {
         buffer_append (data, samples);
 
         if (buffer_filled < buffer_size)
-            break;
+        {
+            if (! * samples)
+                break;
+
+            /* out of room; make some by moving this call's output out of the
+             * ring */
+            flush_out ();
+            continue;
+        }
 
         for (; peaks_filled < CHUNKS; peaks_filled ++)
-            GET_PEAK (peaks_filled) = calc_peak (buffer + chunk_size * IN_RING
+            GET_PEAK (peaks_filled) = calc_ring_peak (CHUNK_OFFSET
              (peaks_filled), chunk_size);
 
         if (current_peak == 0.0)
@@ -150,11 +194,10 @@ static void do_compress (float * * data, int * samples, char finish)
             new_peak = FMAX (new_peak, current_peak + (GET_PEAK (count) -
              current_peak) / count);
 
-        do_ramp (buffer + chunk_size * ring_at, chunk_size, current_peak,
-         new_peak);
-
-        output_append (buffer + chunk_size * ring_at, chunk_size);
+        do_ramp (read_pos, chunk_size, current_peak, new_peak);
 
+        read_pos = CHUNK_OFFSET (1);
+        out_filled += chunk_size;
         ring_at = IN_RING (1);
         buffer_filled -= chunk_size;
         peaks_filled --;
@@ -163,34 +206,38 @@ static void do_compress (float * * data, int * samples, char finish)
 
     if (finish)
     {
-        int offset = chunk_size * ring_at;
-        int first = MIN (buffer_filled, buffer_size - offset);
-        int second = buffer_filled - first;
-
         if (current_peak == 0.0)
-        {
-            current_peak = FMAX (0.01, calc_peak (buffer + offset, first));
-            current_peak = FMAX (current_peak, calc_peak (buffer, second));
-        }
+            current_peak = FMAX (0.01, calc_ring_peak (read_pos, buffer_filled));
 
-        do_ramp (buffer + offset, first, current_peak, current_peak);
-        do_ramp (buffer, second, current_peak, current_peak);
+        do_ramp (read_pos, buffer_filled, current_peak, current_peak);
 
-        output_append (buffer + offset, first);
-        output_append (buffer, second);
+        read_pos = (read_pos + buffer_filled) & ring_mask;
+        out_filled += buffer_filled;
+        buffer_filled = 0;
+    }
 
-        reset ();
+    if (! output_filled && out_filled <= ring_size - out_pos)
+    {
+        * data = ring + out_pos;
+        * samples = out_filled;
+    }
+    else
+    {
+        flush_out ();
+        * data = output;
+        * samples = output_filled;
     }
 
-    * data = output;
-    * samples = output_filled;
+    if (finish)
+        reset ();
 }
 
 int compressor_init (void)
 {
     compressor_config_load ();
+    compressor_kernels_init ();
 
-    buffer = NULL;
+    ring = NULL;
     output = NULL;
     output_size = 0;
     peaks = NULL;
@@ -200,7 +247,7 @@ int compressor_init (void)
 
 void compressor_cleanup (void)
 {
-    free (buffer);
+    free (ring);
     free (output);
     free (peaks);
 }
@@ -209,18 +256,36 @@ void compressor_start (int * channels, int * rate)
 {
     chunk_size = (* channels) * (int) ((* rate) * CHUNK_TIME);
     buffer_size = chunk_size * CHUNKS;
-    buffer = realloc (buffer, sizeof (float) * buffer_size);
+
+    /* room for the lookahead plus at least one processed chunk */
+    for (ring_size = 1; ring_size < buffer_size + chunk_size; ring_size <<= 1)
+        ;
+
+    ring_mask = ring_size - 1;
+    ring = realloc (ring, sizeof (float) * ring_size);
     peaks = realloc (peaks, sizeof (float) * CHUNKS);
 
+    /* preallocate the fallback output buffer so that it normally never grows
+     * while playing */
+    if (output_size < ring_size)
+    {
+        output_size = ring_size;
+        output = realloc (output, sizeof (float) * output_size);
+    }
+
     current_channels = * channels;
     current_rate = * rate;
+    flush_denormals = aud_get_bool ("compressor", "flush_denormals");
 
     reset ();
 }
 
 void compressor_process (float * * data, int * samples)
 {
+    DenormalState fpu;
+    denormal_begin (& fpu, flush_denormals);
     do_compress (data, samples, 0);
+    denormal_end (& fpu);
 }
 
 void compressor_flush (void)
@@ -230,7 +295,10 @@ void compressor_flush (void)
 
 void compressor_finish (float * * data, int * samples)
 {
+    DenormalState fpu;
+    denormal_begin (& fpu, flush_denormals);
     do_compress (data, samples, 1);
+    denormal_end (& fpu);
 }
 
 int compressor_adjust_delay (int delay)
@@ -26,3 +26,10 @@ void compressor_process (float * * data, int * samples);
 void compressor_flush (void);
 void compressor_finish (float * * data, int * samples);
 int compressor_adjust_delay (int delay);
+
+/* kernels.c: vector implementations are selected at runtime by
+ * compressor_kernels_init(); the scalar ones are used otherwise. */
+extern float (* compressor_sum_abs) (const float * data, int length);
+extern void (* compressor_ramp) (float * data, int length, float a, float b);
+
+void compressor_kernels_init (void);
@@ -0,0 +1,235 @@
+/*
+ * Dynamic Range Compression Plugin for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+
+#include "compressor.h"
+#include "../cpudispatch/cpudispatch.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define USE_X86
+#include <immintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+/* The vector versions compute the gain at sample i as a + (b - a) * i / length,
+ * which is the same ramp as the scalar version but without a division per
+ * sample.  The index is kept in float; it is exact up to 2^24 samples, far
+ * beyond any chunk size we use. */
+
+static float sum_abs_c (const float * data, int length)
+{
+    float sum = 0;
+
+    const float * end = data + length;
+    while (data < end)
+        sum += fabsf (* data ++);
+
+    return sum;
+}
+
+static void ramp_c (float * data, int length, float a, float b)
+{
+    for (int count = 0; count < length; count ++)
+    {
+        * data = (* data) * (a * (length - count) + b * count) / length;
+        data ++;
+    }
+}
+
+#ifdef USE_X86
+
+__attribute__ ((target ("sse2")))
+static float sum_abs_sse2 (const float * data, int length)
+{
+    const __m128 mask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+    __m128 sum0 = _mm_setzero_ps ();
+    __m128 sum1 = _mm_setzero_ps ();
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_and_ps (_mm_loadu_ps (data + i), mask));
+        sum1 = _mm_add_ps (sum1, _mm_and_ps (_mm_loadu_ps (data + i + 4), mask));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps (lanes, _mm_add_ps (sum0, sum1));
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+__attribute__ ((target ("sse2")))
+static void ramp_sse2 (float * data, int length, float a, float b)
+{
+    if (! length)
+        return;
+
+    float step = (b - a) / length;
+    const __m128 va = _mm_set1_ps (a);
+    const __m128 vstep = _mm_set1_ps (step);
+    const __m128 four = _mm_set1_ps (4);
+    __m128 index = _mm_setr_ps (0, 1, 2, 3);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128 gain = _mm_add_ps (va, _mm_mul_ps (vstep, index));
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), gain));
+        index = _mm_add_ps (index, four);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+__attribute__ ((target ("avx2,fma")))
+static float sum_abs_avx2 (const float * data, int length)
+{
+    const __m256 mask = _mm256_castsi256_ps (_mm256_set1_epi32 (0x7fffffff));
+    __m256 sum0 = _mm256_setzero_ps ();
+    __m256 sum1 = _mm256_setzero_ps ();
+    int i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        sum0 = _mm256_add_ps (sum0, _mm256_and_ps (_mm256_loadu_ps (data + i), mask));
+        sum1 = _mm256_add_ps (sum1, _mm256_and_ps (_mm256_loadu_ps (data + i + 8), mask));
+    }
+
+    __m256 sum8 = _mm256_add_ps (sum0, sum1);
+    __m128 sum4 = _mm_add_ps (_mm256_castps256_ps128 (sum8), _mm256_extractf128_ps (sum8, 1));
+
+    float lanes[4];
+    _mm_storeu_ps (lanes, sum4);
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void ramp_avx2 (float * data, int length, float a, float b)
+{
+    if (! length)
+        return;
+
+    float step = (b - a) / length;
+    const __m256 va = _mm256_set1_ps (a);
+    const __m256 vstep = _mm256_set1_ps (step);
+    const __m256 eight = _mm256_set1_ps (8);
+    __m256 index = _mm256_setr_ps (0, 1, 2, 3, 4, 5, 6, 7);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        __m256 gain = _mm256_fmadd_ps (vstep, index, va);
+        _mm256_storeu_ps (data + i, _mm256_mul_ps (_mm256_loadu_ps (data + i), gain));
+        index = _mm256_add_ps (index, eight);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+#endif /* USE_X86 */
+
+#ifdef USE_NEON
+
+static float sum_abs_neon (const float * data, int length)
+{
+    float32x4_t sum0 = vdupq_n_f32 (0);
+    float32x4_t sum1 = vdupq_n_f32 (0);
+    int i = 0;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        sum0 = vaddq_f32 (sum0, vabsq_f32 (vld1q_f32 (data + i)));
+        sum1 = vaddq_f32 (sum1, vabsq_f32 (vld1q_f32 (data + i + 4)));
+    }
+
+    float32x4_t sum4 = vaddq_f32 (sum0, sum1);
+    float32x2_t sum2 = vadd_f32 (vget_low_f32 (sum4), vget_high_f32 (sum4));
+    float sum = vget_lane_f32 (vpadd_f32 (sum2, sum2), 0);
+
+    for (; i < length; i ++)
+        sum += fabsf (data[i]);
+
+    return sum;
+}
+
+static void ramp_neon (float * data, int length, float a, float b)
+{
+    if (! length)
+        return;
+
+    static const float start[4] = {0, 1, 2, 3};
+
+    float step = (b - a) / length;
+    const float32x4_t va = vdupq_n_f32 (a);
+    const float32x4_t four = vdupq_n_f32 (4);
+    float32x4_t index = vld1q_f32 (start);
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        float32x4_t gain = vmlaq_n_f32 (va, index, step);
+        vst1q_f32 (data + i, vmulq_f32 (vld1q_f32 (data + i), gain));
+        index = vaddq_f32 (index, four);
+    }
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
+#endif /* USE_NEON */
+
+float (* compressor_sum_abs) (const float * data, int length) = sum_abs_c;
+void (* compressor_ramp) (float * data, int length, float a, float b) = ramp_c;
+
+typedef struct {
+    CpuVariant variant;
+    float (* sum_abs) (const float * data, int length);
+    void (* ramp) (float * data, int length, float a, float b);
+} KernelSet;
+
+static const KernelSet kernels[] = {
+#if defined (USE_X86)
+ {{"avx2", CPU_AVX2 | CPU_FMA}, sum_abs_avx2, ramp_avx2},
+ {{"sse2", CPU_SSE2}, sum_abs_sse2, ramp_sse2},
+#elif defined (USE_NEON)
+ {{"neon", CPU_NEON}, sum_abs_neon, ramp_neon},
+#endif
+ {{"c"}, sum_abs_c, ramp_c}};
+
+void compressor_kernels_init (void)
+{
+    const KernelSet * set = CPU_DISPATCH ("compressor", kernels);
+
+    compressor_sum_abs = set->sum_abs;
+    compressor_ramp = set->ramp;
+}
@@ -23,12 +23,14 @@
 #include <audacious/preferences.h>
 
 #include "compressor.h"
+#include "../perfstat/perfstat.h"
 
 /* What is a "normal" volume?  Replay Gain stuff claims to use 89 dB, but what
  * does that translate to in our PCM range?  Does anybody even know? */
 static const char * const compressor_defaults[] = {
  "center", "0.5",
  "range", "0.5",
+ "flush_denormals", "TRUE",
  NULL};
 
 static const PreferencesWidget compressor_widgets[] = {
@@ -38,7 +40,9 @@ static const PreferencesWidget compressor_widgets[] = {
   .data = {.spin_btn = {0.1, 1, 0.1}}},
  {WIDGET_SPIN_BTN, N_("Dynamic range:"),
   .cfg_type = VALUE_FLOAT, .csect = "compressor", .cname = "range",
-  .data = {.spin_btn = {0.0, 3.0, 0.1}}}};
+  .data = {.spin_btn = {0.0, 3.0, 0.1}}},
+ {WIDGET_CHK_BTN, N_("Flush denormals (avoids slowdowns in silence)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "compressor", .cname = "flush_denormals"}};
 
 static const PluginPreferences compressor_prefs = {
  .widgets = compressor_widgets,
@@ -53,6 +57,8 @@ static const char compressor_about[] =
  N_("Dynamic Range Compression Plugin for Audacious\n"
     "Copyright 2010-2012 John Lindgren");
 
+PERFSTAT_EFFECT (N_("Dynamic Range Compressor"), compressor_start, compressor_process, compressor_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Dynamic Range Compressor"),
@@ -61,10 +67,10 @@ AUD_EFFECT_PLUGIN
     .prefs = & compressor_prefs,
     .init = compressor_init,
     .cleanup = compressor_cleanup,
-    .start = compressor_start,
-    .process = compressor_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = compressor_flush,
-    .finish = compressor_finish,
+    .finish = perfstat_finish,
     .adjust_delay = compressor_adjust_delay,
     .preserves_format = TRUE
 )
@@ -8,7 +8,9 @@
 
 #include <math.h>
 #include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 extern "C" {
 #include <libaudcore/audstrings.h>
@@ -18,15 +20,22 @@ extern "C" {
 #include "configure.h"
 #include "Music_Emu.h"
 #include "Gzip_Reader.h"
+#include "../decodeahead/decodeahead.h"
+#include "../ratepref/ratepref.h"
 
 static pthread_mutex_t seek_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t seek_cond = PTHREAD_COND_INITIALIZER;
-static gint seek_value = -1;
 static gboolean stop_flag = FALSE;
+static DecodeAhead decodeahead = DECODEAHEAD_INIT;
 
 static const gint fade_threshold = 10 * 1000;
 static const gint fade_length    = 8 * 1000;
 
+// render block, in samples at 44.1 kHz; it starts small after a seek so the
+// first sound comes quickly, then grows so the effects downstream see fewer,
+// larger writes
+static const gint min_block = 4096;
+static const gint max_block = 16384;
+
 static blargg_err_t log_err(blargg_err_t err)
 {
     if (err) g_critical("console: %s\n", err);
@@ -55,8 +64,10 @@ public:
     ConsoleFileHandler(const gchar* path, VFSFile *fd = NULL);
 
     // Creates emulator and returns 0. If this wasn't a music file or
-    // emulator couldn't be created, returns 1.
-    gint load(gint sample_rate);
+    // emulator couldn't be created, returns 1. An emulator of the same type
+    // and sample rate may be passed in to be loaded again instead; it is
+    // owned by the handler either way.
+    gint load(gint sample_rate, Music_Emu *reuse = NULL);
 
     // Deletes owned emu and closes file
     ~ConsoleFileHandler();
@@ -108,12 +119,31 @@ ConsoleFileHandler::~ConsoleFileHandler()
     g_free(m_path);
 }
 
-gint ConsoleFileHandler::load(gint sample_rate)
+gint ConsoleFileHandler::load(gint sample_rate, Music_Emu *reuse)
 {
     if (!m_type)
+    {
+        gme_delete(reuse);
         return 1;
+    }
+
+    if (reuse != NULL)
+        m_emu = reuse;
+    else if (sample_rate == gme_info_only || audcfg.echo)
+        m_emu = gme_new_emu(m_type, sample_rate);
+    else
+    {
+        // without echo, an Effects_Buffer only adds idle channels to the
+        // emulator's own Stereo_Buffer, which mixes the same sound
+        m_emu = m_type->new_emu();
+        if (m_emu != NULL && log_err(m_emu->set_sample_rate(sample_rate)))
+        {
+            delete m_emu;
+            m_emu = NULL;
+            return 1;
+        }
+    }
 
-    m_emu = gme_new_emu(m_type, sample_rate);
     if (m_emu == NULL)
     {
         log_err("Out of memory allocating emulator engine. Fatal error.");
@@ -195,8 +225,127 @@ static Tuple * get_track_ti(const gchar *path, const track_info_t *info, const g
     return ti;
 }
 
+/* Info-only emulators of recently probed local files, so that probing each
+ * track of a multi-track file loads the file only once.  An entry is used
+ * only while the file's mtime and size are unchanged. */
+struct ProbeCacheEntry {
+    gchar *path;
+    time_t mtime;
+    gint64 size;
+    Music_Emu *emu;
+};
+
+static const gint probe_cache_size = 16;
+static ProbeCacheEntry probe_cache[probe_cache_size];
+static gint probe_cache_next;
+static pthread_mutex_t probe_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static gboolean get_mtime(const gchar *uri, time_t *mtime, gint64 *size)
+{
+    if (strncmp(uri, "file://", 7))
+        return FALSE;
+
+    gchar *path = uri_to_filename(uri);
+    if (path == NULL)
+        return FALSE;
+
+    struct stat st;
+    gboolean ok = !stat(path, &st);
+    free(path);
+
+    if (!ok)
+        return FALSE;
+
+    *mtime = st.st_mtime;
+    *size = st.st_size;
+    return TRUE;
+}
+
+static void probe_cache_clear(ProbeCacheEntry *entry)
+{
+    g_free(entry->path);
+    gme_delete(entry->emu);
+    entry->path = NULL;
+    entry->emu = NULL;
+}
+
+// Returns the tuple for the track, or NULL if the file isn't cached.
+static Tuple *probe_cache_lookup(const gchar *path, time_t mtime, gint64 size, gint track)
+{
+    Tuple *ti = NULL;
+
+    pthread_mutex_lock(&probe_cache_mutex);
+
+    for (gint i = 0; i < probe_cache_size; i++)
+    {
+        ProbeCacheEntry *entry = &probe_cache[i];
+        if (entry->path == NULL || strcmp(entry->path, path))
+            continue;
+
+        if (entry->mtime != mtime || entry->size != size)
+        {
+            probe_cache_clear(entry);
+            break;
+        }
+
+        track_info_t info;
+        if (!log_err(entry->emu->track_info(&info, track < 0 ? 0 : track)))
+            ti = get_track_ti(path, &info, track);
+
+        break;
+    }
+
+    pthread_mutex_unlock(&probe_cache_mutex);
+    return ti;
+}
+
+// Takes ownership of emu.
+static void probe_cache_add(const gchar *path, time_t mtime, gint64 size, Music_Emu *emu)
+{
+    pthread_mutex_lock(&probe_cache_mutex);
+
+    // another thread may have added the same file meanwhile
+    for (gint i = 0; i < probe_cache_size; i++)
+    {
+        if (probe_cache[i].path != NULL && !strcmp(probe_cache[i].path, path))
+            probe_cache_clear(&probe_cache[i]);
+    }
+
+    ProbeCacheEntry *entry = &probe_cache[probe_cache_next];
+    probe_cache_next = (probe_cache_next + 1) % probe_cache_size;
+
+    probe_cache_clear(entry);
+    entry->path = g_strdup(path);
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->emu = emu;
+
+    pthread_mutex_unlock(&probe_cache_mutex);
+}
+
 extern "C" Tuple * console_probe_for_tuple(const gchar *filename, VFSFile *fd)
 {
+    const gchar *sub;
+    gint track = -1;
+    uri_parse(filename, NULL, NULL, &sub, &track);
+
+    gchar *path = g_strndup(filename, sub - filename);
+    time_t mtime = 0;
+    gint64 size = 0;
+    gboolean local = get_mtime(path, &mtime, &size);
+
+    if (local)
+    {
+        Tuple *ti = probe_cache_lookup(path, mtime, size, track - 1);
+        if (ti != NULL)
+        {
+            g_free(path);
+            return ti;
+        }
+    }
+
+    g_free(path);
+
     ConsoleFileHandler fh(filename, fd);
 
     if (!fh.m_type)
@@ -204,44 +353,237 @@ extern "C" Tuple * console_probe_for_tuple(const gchar *filename, VFSFile *fd)
 
     if (!fh.load(gme_info_only))
     {
+        Tuple *ti = NULL;
         track_info_t info;
         if (!log_err(fh.m_emu->track_info(&info, fh.m_track < 0 ? 0 : fh.m_track)))
-            return get_track_ti(fh.m_path, &info, fh.m_track);
+            ti = get_track_ti(fh.m_path, &info, fh.m_track);
+
+        if (ti != NULL && local)
+        {
+            probe_cache_add(fh.m_path, mtime, size, fh.m_emu);
+            fh.m_emu = NULL;
+        }
+
+        return ti;
     }
 
     return NULL;
 }
 
+/* The emulator of the last file played, kept when playback ends.  Playing
+ * another track of the same (unchanged, local) file then only restarts it,
+ * and a file of the same type is loaded into it, reusing its sound buffers.
+ * It is only used again with the settings it was set up with. */
+struct PlaySettings {
+    gint sample_rate, echo, treble, bass;
+};
+
+struct PlayCache {
+    gchar *path;
+    time_t mtime;
+    gint64 size;
+    gboolean local;
+    PlaySettings settings;
+    Music_Emu *emu;
+};
+
+static PlayCache play_cache;
+static pthread_mutex_t play_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void play_cache_clear()
+{
+    g_free(play_cache.path);
+    gme_delete(play_cache.emu);
+    play_cache.path = NULL;
+    play_cache.emu = NULL;
+}
+
+static void get_play_settings(PlaySettings *settings, gme_type_t type)
+{
+    // The emulators resample internally anyway, so by default render at the
+    // output's rate rather than leave it to the output to resample again.
+    if (audcfg.resample)
+        settings->sample_rate = audcfg.resample_rate;
+    else
+        settings->sample_rate = ratepref_get((type == gme_spc_type) ? 32000 : 44100);
+
+    settings->echo = audcfg.echo;
+    settings->treble = audcfg.treble;
+    settings->bass = audcfg.bass;
+}
+
+// Takes the cached emulator if it was set up with the settings for its type;
+// same_file tells whether it holds the file at path, already loaded.
+static Music_Emu *play_cache_take(const gchar *path, gboolean *same_file)
+{
+    pthread_mutex_lock(&play_cache_mutex);
+
+    Music_Emu *emu = play_cache.emu;
+    *same_file = FALSE;
+
+    if (emu != NULL)
+    {
+        PlaySettings settings;
+        get_play_settings(&settings, emu->type());
+
+        if (memcmp(&settings, &play_cache.settings, sizeof settings))
+            emu = NULL;
+        else
+        {
+            time_t mtime = 0;
+            gint64 size = 0;
+            *same_file = play_cache.local && !strcmp(play_cache.path, path) &&
+                get_mtime(path, &mtime, &size) && mtime == play_cache.mtime &&
+                size == play_cache.size;
+
+            play_cache.emu = NULL;
+        }
+    }
+
+    play_cache_clear();
+    pthread_mutex_unlock(&play_cache_mutex);
+    return emu;
+}
+
+// Takes ownership of emu.
+static void play_cache_put(const gchar *path, const PlaySettings *settings, Music_Emu *emu)
+{
+    pthread_mutex_lock(&play_cache_mutex);
+
+    play_cache_clear();
+    play_cache.path = g_strdup(path);
+    play_cache.local = get_mtime(path, &play_cache.mtime, &play_cache.size);
+    play_cache.settings = *settings;
+    play_cache.emu = emu;
+
+    pthread_mutex_unlock(&play_cache_mutex);
+}
+
+// Owns the emulator while playing and hands it to the play cache afterwards.
+struct PlayEmu {
+    Music_Emu *emu;
+    gchar *path;
+    PlaySettings settings;
+
+    PlayEmu() : emu(NULL), path(NULL) {}
+    ~PlayEmu()
+    {
+        if (emu != NULL)
+            play_cache_put(path, &settings, emu);
+        g_free(path);
+    }
+};
+
+struct ConsoleRender
+{
+    Music_Emu *emu;
+    gint block_min, block_max;
+};
+
+// Runs on the decode-ahead thread, so the emulator and the output chain
+// (effects, filewriter encoders) each get a core of their own
+static bool_t console_render(DecodeAhead *d, void *data)
+{
+    ConsoleRender *r = (ConsoleRender *) data;
+    Music_Emu *emu = r->emu;
+    Music_Emu::sample_t *buf = g_new(Music_Emu::sample_t, r->block_max);
+    gint block = r->block_min;
+    gint seek;
+
+    while (!g_atomic_int_get(&stop_flag))
+    {
+        /* Perform seek, if requested */
+        if ((seek = decodeahead_get_seek(d)) >= 0)
+        {
+            emu->seek(seek);
+            block = r->block_min;
+            decodeahead_seek_done(d);
+        }
+
+        emu->play(block, buf);
+
+        if (!decodeahead_write(d, buf, block * sizeof(Music_Emu::sample_t)))
+            break;
+
+        if (emu->track_ended())
+        {
+            // TODO: remove delay once host doesn't cut the end of track off
+            gint delay = emu->sample_rate() * 3 * 2;
+            Music_Emu::sample_t *silence = g_new0(Music_Emu::sample_t, delay);
+            gboolean written = decodeahead_write(d, silence, delay * sizeof(Music_Emu::sample_t));
+            g_free(silence);
+
+            // a seek during the silence takes us back into the track
+            if (!written || !decodeahead_finish(d))
+                break;
+        }
+
+        block = MIN(block * 2, r->block_max);
+    }
+
+    g_free(buf);
+    return TRUE;
+}
+
 extern "C" gboolean console_play(InputPlayback *playback, const gchar *filename,
     VFSFile *file, gint start_time, gint stop_time, gboolean pause)
 {
-    gint length, end_delay, sample_rate;
+    gint length, sample_rate;
     track_info_t info;
     gboolean error = FALSE;
 
-    // identify file
-    ConsoleFileHandler fh(filename);
-    if (!fh.m_type)
-        return FALSE;
+    PlayEmu pe;
+    const gchar *sub;
+    gint track = -1;
+    uri_parse(filename, NULL, NULL, &sub, &track);
+    pe.path = g_strndup(filename, sub - filename);
+    track = MAX(track - 1, 0);
 
-    if (fh.m_track < 0)
-        fh.m_track = 0;
+    gboolean same_file;
+    Music_Emu *cached = play_cache_take(pe.path, &same_file);
 
-    // select sample rate
-    sample_rate = 0;
-    if (fh.m_type == gme_spc_type)
-        sample_rate = 32000;
-    if (audcfg.resample)
-        sample_rate = audcfg.resample_rate;
-    if (sample_rate == 0)
-        sample_rate = 44100;
+    if (same_file)
+    {
+        // another track of the file just played; start_track() resets it
+        pe.emu = cached;
+        get_play_settings(&pe.settings, pe.emu->type());
+    }
+    else
+    {
+        // identify file
+        ConsoleFileHandler fh(filename);
+        if (!fh.m_type)
+        {
+            gme_delete(cached);
+            return FALSE;
+        }
 
-    // create emulator and load file
-    if (fh.load(sample_rate))
-        return FALSE;
+        get_play_settings(&pe.settings, fh.m_type);
+
+        if (cached != NULL && cached->type() != fh.m_type)
+        {
+            gme_delete(cached);
+            cached = NULL;
+        }
+
+        // create emulator (or reuse the cached one) and load file
+        if (fh.load(pe.settings.sample_rate, cached))
+            return FALSE;
+
+        pe.emu = fh.m_emu;
+        fh.m_emu = NULL;
+    }
+
+    Music_Emu *emu = pe.emu;
+    gme_type_t type = emu->type();
+    sample_rate = pe.settings.sample_rate;
 
     // stereo echo depth
-    gme_set_stereo_depth(fh.m_emu, 1.0 / 100 * audcfg.echo);
+    gme_set_stereo_depth(emu, 1.0 / 100 * audcfg.echo);
+
+    // end-of-track detection
+    log_err(emu->set_silence_detection(audcfg.silence_lookahead,
+            audcfg.silence_block_ms));
 
     // set equalizer
     if (audcfg.treble || audcfg.bass)
@@ -256,30 +598,30 @@ extern "C" gboolean console_play(InputPlayback *playback, const gchar *filename,
         double treble = audcfg.treble / 100.0;
         eq.treble = treble * (treble < 0 ? 50.0 : 5.0);
 
-        fh.m_emu->set_equalizer(eq);
+        emu->set_equalizer(eq);
     }
 
     // get info
     length = -1;
-    if (!log_err(fh.m_emu->track_info(&info, fh.m_track)))
+    if (!log_err(emu->track_info(&info, track)))
     {
-        if (fh.m_type == gme_spc_type && audcfg.ignore_spc_length)
+        if (type == gme_spc_type && audcfg.ignore_spc_length)
             info.length = -1;
 
-        Tuple *ti = get_track_ti(fh.m_path, &info, fh.m_track);
+        Tuple *ti = get_track_ti(pe.path, &info, track);
         if (ti != NULL)
         {
             length = tuple_get_int(ti, FIELD_LENGTH, NULL);
             tuple_unref(ti);
-            playback->set_params(playback, fh.m_emu->voice_count() * 1000, sample_rate, 2);
+            playback->set_params(playback, emu->voice_count() * 1000, sample_rate, 2);
         }
     }
 
     // start track
-    if (log_err(fh.m_emu->start_track(fh.m_track)))
+    if (log_err(emu->start_track(track)))
         return FALSE;
 
-    log_warning(fh.m_emu);
+    log_warning(emu);
 
     if (!playback->output->open_audio(FMT_S16_NE, sample_rate, 2))
         return FALSE;
@@ -292,49 +634,22 @@ extern "C" gboolean console_play(InputPlayback *playback, const gchar *filename,
         length = audcfg.loop_length * 1000;
     if (length >= fade_threshold + fade_length)
         length -= fade_length / 2;
-    fh.m_emu->set_fade(length, fade_length);
+    emu->set_fade(length, fade_length);
 
     stop_flag = FALSE;
-    end_delay = 0;
     playback->set_pb_ready(playback);
 
-    while (!stop_flag)
-    {
-        /* Perform seek, if requested */
-        pthread_mutex_lock(&seek_mutex);
-        if (seek_value >= 0)
-        {
-            playback->output->flush(seek_value);
-            fh.m_emu->seek(seek_value);
-            seek_value = -1;
-            pthread_cond_signal(&seek_cond);
-        }
-        pthread_mutex_unlock(&seek_mutex);
-
-        /* Fill and play buffer of audio */
-        gint const buf_size = 1024;
-        Music_Emu::sample_t buf[buf_size];
-        if (end_delay)
-        {
-            // TODO: remove delay once host doesn't cut the end of track off
-            if (!--end_delay)
-                stop_flag = TRUE;
-            memset(buf, 0, sizeof(buf));
-        }
-        else
-        {
-            fh.m_emu->play(buf_size, buf);
-            if (fh.m_emu->track_ended())
-            {
-                end_delay = (fh.m_emu->sample_rate() * 3 * 2) / buf_size;
-            }
-        }
+    // keep the block a whole number of stereo frames
+    ConsoleRender render;
+    render.emu = emu;
+    render.block_min = MAX(2, (gint64) min_block * sample_rate / 44100 & ~1);
+    render.block_max = MAX(2, (gint64) max_block * sample_rate / 44100 & ~1);
 
-        playback->output->write_audio(buf, sizeof(buf));
-    }
+    decodeahead_play(&decodeahead, playback, sample_rate,
+            2 * sizeof(Music_Emu::sample_t), console_render, &render);
 
     // stop playing
-    stop_flag = TRUE;
+    g_atomic_int_set(&stop_flag, TRUE);
 
     return !error;
 }
@@ -344,12 +659,7 @@ extern "C" void console_seek(InputPlayback *playback, gint time)
     pthread_mutex_lock(&seek_mutex);
 
     if (!stop_flag)
-    {
-        seek_value = time;
-        playback->output->abort_write();
-        pthread_cond_signal(&seek_cond);
-        pthread_cond_wait(&seek_cond, &seek_mutex);
-    }
+        decodeahead_seek(&decodeahead, time);
 
     pthread_mutex_unlock(&seek_mutex);
 }
@@ -360,9 +670,9 @@ extern "C" void console_stop(InputPlayback *playback)
 
     if (!stop_flag)
     {
-        stop_flag = TRUE;
+        g_atomic_int_set(&stop_flag, TRUE);
         playback->output->abort_write();
-        pthread_cond_signal(&seek_cond);
+        decodeahead_stop(&decodeahead);
     }
 
     pthread_mutex_unlock (&seek_mutex);
@@ -383,3 +693,17 @@ extern "C" gboolean console_init (void)
     console_cfg_load();
     return TRUE;
 }
+
+extern "C" void console_cleanup (void)
+{
+    pthread_mutex_lock(&play_cache_mutex);
+    play_cache_clear();
+    pthread_mutex_unlock(&play_cache_mutex);
+
+    pthread_mutex_lock(&probe_cache_mutex);
+
+    for (gint i = 0; i < probe_cache_size; i++)
+        probe_cache_clear(&probe_cache[i]);
+
+    pthread_mutex_unlock(&probe_cache_mutex);
+}
@@ -338,10 +338,11 @@ void Ay_Apu::run_until( blip_time_t final_end_time )
 						// loop usually runs less than once
 						//SUB_CASE_COUNTER( (time < end) * (end - time + period - 1) / period );
 
-						while ( time < end )
+						if ( time < end )
 						{
-							time += period;
-							phase ^= 1;
+							blargg_long count = (end - time + period - 1) / period;
+							phase ^= count & 1;
+							time += count * period;
 						}
 					}
 				}
@@ -95,6 +95,19 @@ blargg_err_t Classic_Emu::start_track_( int track )
 	return 0;
 }
 
+long Classic_Emu::snapshot_ahead_() const
+{
+	return buf->samples_avail();
+}
+
+void Classic_Emu::clear_buffer() { buf->clear(); }
+
+void Classic_Emu::snapshot_loaded()
+{
+	clear_buffer();
+	set_equalizer_( equalizer() );
+}
+
 blargg_err_t Classic_Emu::play_( long count, sample_t* out )
 {
 	long remain = count;
@@ -32,6 +32,14 @@ protected:
 	void mute_voices_( int );
 	void set_equalizer_( equalizer_t const& );
 	blargg_err_t play_( long, sample_t* );
+	long snapshot_ahead_() const;
+
+	// Discard sound generated but not yet played
+	void clear_buffer();
+
+	// Call from load_snapshot_(): discards buffered sound and reapplies the
+	// equalizer, which the raw images of the sound chips bring back
+	void snapshot_loaded();
 private:
 	Multi_Buffer* buf;
 	Multi_Buffer* stereo_buffer; // NULL if using custom buffer
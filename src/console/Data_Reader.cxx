@@ -127,6 +127,15 @@ blargg_err_t Remaining_Reader::read( void* out, long count )
 	return in->read( (char*) out + first, second );
 }
 
+blargg_err_t Remaining_Reader::skip( long count )
+{
+	long first = header_end - header;
+	if ( first > count )
+		first = count;
+	header += first;
+	return in->skip( count - first );
+}
+
 // Mem_File_Reader
 
 Mem_File_Reader::Mem_File_Reader( const void* p, long s ) :
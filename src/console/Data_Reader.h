@@ -108,6 +108,7 @@ public:
 	long remain() const;
 	long read_avail( void*, long );
 	blargg_err_t read( void*, long );
+	blargg_err_t skip( long );
 private:
 	char const* header;
 	char const* header_end;
@@ -18,6 +18,14 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 
 #include "blargg_source.h"
 
+#if defined (__SSE2__)
+	#include <emmintrin.h>
+	#define MIX_SSE2 1
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define MIX_NEON 1
+#endif
+
 unsigned const resampler_extra = 256;
 
 Dual_Resampler::Dual_Resampler() { }
@@ -108,7 +116,51 @@ void Dual_Resampler::mix_samples( Blip_Buffer& blip_buf, dsample_t* out )
 	int bass = sn.begin( blip_buf );
 	const dsample_t* in = sample_buf.begin();
 
-	for ( int n = sample_buf_size >> 1; n--; )
+#if MIX_SSE2 || MIX_NEON
+	// The integrator can only run one sample at a time, so it fills a block
+	// first and the mixing and clamping of that block is then done four pairs
+	// at a time. A few leftover pairs go through the plain loop below.
+	int const block = 64;
+	int n = sample_buf_size >> 1;
+	while ( n >= 4 )
+	{
+		blip_long sb [block];
+		int count = min( n, block ) & ~3;
+		for ( int i = 0; i < count; i++ )
+		{
+			sb [i] = sn.read();
+			sn.next( bass );
+		}
+
+		for ( int i = 0; i < count; i += 4 )
+		{
+		#if MIX_SSE2
+			__m128i s  = _mm_loadu_si128( (__m128i const*) &sb [i] );
+			__m128i x  = _mm_loadu_si128( (__m128i const*) in );
+			__m128i const zero = _mm_setzero_si128();
+			__m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( zero, x ), 15 ); // in * 2
+			__m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( zero, x ), 15 );
+			lo = _mm_add_epi32( lo, _mm_unpacklo_epi32( s, s ) );
+			hi = _mm_add_epi32( hi, _mm_unpackhi_epi32( s, s ) );
+			_mm_storeu_si128( (__m128i*) out, _mm_packs_epi32( lo, hi ) );
+		#else
+			int32x4_t s = vld1q_s32( &sb [i] );
+			int16x8_t x = vld1q_s16( in );
+			int32x4x2_t ss = vzipq_s32( s, s );
+			int32x4_t lo = vaddq_s32( vshll_n_s16( vget_low_s16( x ), 1 ), ss.val [0] );
+			int32x4_t hi = vaddq_s32( vshll_n_s16( vget_high_s16( x ), 1 ), ss.val [1] );
+			vst1q_s16( out, vcombine_s16( vqmovn_s32( lo ), vqmovn_s32( hi ) ) );
+		#endif
+			in  += 8;
+			out += 8;
+		}
+		n -= count;
+	}
+#else
+	int n = sample_buf_size >> 1;
+#endif
+
+	for ( ; n--; )
 	{
 		int s = sn.read();
 		blargg_long l = (blargg_long) in [0] * 2 + s;
@@ -128,4 +180,3 @@ void Dual_Resampler::mix_samples( Blip_Buffer& blip_buf, dsample_t* out )
 
 	sn.end( blip_buf );
 }
-
@@ -19,6 +19,12 @@ public:
 	void resize( int pairs_per_frame );
 	void clear();
 
+	// Number of output samples already generated but not yet played
+	int samples_avail() const { return sample_buf_size - buf_pos; }
+
+	// Number of output samples generated by each frame
+	int frame_size() const { return sample_buf_size; }
+
 	void dual_play( long count, dsample_t* out, Blip_Buffer& );
 
 protected:
@@ -7,6 +7,16 @@
 #include "blargg_common.h"
 #include <string.h>
 
+// Vector products over four taps of both channels at a time (widths that are
+// a multiple of 4 only; others use the plain loop)
+#if defined (__SSE2__)
+	#include <emmintrin.h>
+	#define FIR_SSE2 1
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define FIR_NEON 1
+#endif
+
 class Fir_Resampler_ {
 public:
 
@@ -124,6 +134,48 @@ int Fir_Resampler<width>::read( sample_t* out_begin, blargg_long count )
 			if ( count < 0 )
 				break;
 
+		#if FIR_SSE2
+			if ( width % 4 == 0 )
+			{
+				// input LRLRLRLR is reordered to LLRRLLRR so that each
+				// multiply-add pairs two taps of one channel
+				__m128i sum = _mm_setzero_si128();
+				for ( int n = 0; n < width; n += 4 )
+				{
+					__m128i x = _mm_loadu_si128( (__m128i const*) (i + n * stereo) );
+					x = _mm_shufflelo_epi16( x, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+					x = _mm_shufflehi_epi16( x, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+					__m128i c = _mm_loadl_epi64( (__m128i const*) (imp + n) );
+					c = _mm_shuffle_epi32( c, _MM_SHUFFLE( 1, 1, 0, 0 ) );
+					sum = _mm_add_epi32( sum, _mm_madd_epi16( x, c ) );
+				}
+				sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 8 ) );
+				l = _mm_cvtsi128_si32( sum );
+				r = _mm_cvtsi128_si32( _mm_srli_si128( sum, 4 ) );
+				imp += width;
+			}
+			else
+		#elif FIR_NEON
+			if ( width % 4 == 0 )
+			{
+				int32x4_t sum_l = vdupq_n_s32( 0 );
+				int32x4_t sum_r = vdupq_n_s32( 0 );
+				for ( int n = 0; n < width; n += 4 )
+				{
+					int16x4x2_t x = vld2_s16( i + n * stereo );
+					int16x4_t c = vld1_s16( imp + n );
+					sum_l = vmlal_s16( sum_l, x.val [0], c );
+					sum_r = vmlal_s16( sum_r, x.val [1], c );
+				}
+				int32x2_t sum = vpadd_s32(
+						vpadd_s32( vget_low_s32( sum_l ), vget_high_s32( sum_l ) ),
+						vpadd_s32( vget_low_s32( sum_r ), vget_high_s32( sum_r ) ) );
+				l = vget_lane_s32( sum, 0 );
+				r = vget_lane_s32( sum, 1 );
+				imp += width;
+			}
+			else
+		#endif
 			for ( int n = width / 2; n; --n )
 			{
 				int pt0 = imp [0];
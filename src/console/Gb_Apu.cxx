@@ -99,6 +99,18 @@ void Gb_Apu::set_tempo( double t )
 		frame_period = blip_time_t (frame_period / t);
 }
 
+bool Gb_Apu::silent() const
+{
+	for ( int i = 0; i < osc_count; i++ )
+	{
+		Gb_Osc const& osc = *oscs [i];
+		if ( osc.enabled && osc.volume &&
+				(!(osc.regs [4] & osc.len_enabled_mask) || osc.length) )
+			return false;
+	}
+	return true;
+}
+
 void Gb_Apu::reset()
 {
 	next_frame_time = 0;
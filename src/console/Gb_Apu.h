@@ -50,6 +50,10 @@ public:
 
 	void set_tempo( double );
 
+	// True if no oscillator is making sound, so that the output stays at a
+	// constant level until a register is written
+	bool silent() const;
+
 public:
 	Gb_Apu();
 private:
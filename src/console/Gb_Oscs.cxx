@@ -142,6 +142,15 @@ void Gb_Square::run( blip_time_t time, blip_time_t end_time, int playing )
 	if ( !playing )
 		time = end_time;
 
+	if ( !volume && time < end_time )
+	{
+		// silent: maintain phase without generating deltas
+		int const period = (2048 - frequency) * 4;
+		blargg_long count = (end_time - time + period - 1) / period;
+		phase = (phase + count) & 7;
+		time += count * period;
+	}
+
 	if ( time < end_time )
 	{
 		int const period = (2048 - frequency) * 4;
@@ -193,6 +202,22 @@ void Gb_Noise::run( blip_time_t time, blip_time_t end_time, int playing )
 		static unsigned char const table [8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
 		int period = table [regs [3] & 7] << (regs [3] >> 4);
 
+		if ( !volume )
+		{
+			// silent: clock LFSR only
+			unsigned bits = this->bits;
+			do
+			{
+				unsigned changed = (bits >> tap) + 1;
+				time += period;
+				bits = bits << 1 | (changed >> 1 & 1);
+			}
+			while ( time < end_time );
+			this->bits = bits;
+			delay = time - end_time;
+			return;
+		}
+
 		// keep parallel resampled time to eliminate time conversion in the loop
 		Blip_Buffer* const output = this->output;
 		const blip_resampled_time_t resampled_period =
@@ -278,6 +303,15 @@ void Gb_Wave::run( blip_time_t time, blip_time_t end_time, int playing )
 	if ( !playing )
 		time = end_time;
 
+	if ( !volume && time < end_time )
+	{
+		// silent: maintain position without generating deltas
+		int const period = (2048 - frequency) * 2;
+		blargg_long count = (end_time - time + period - 1) / period;
+		wave_pos = (wave_pos + count) & (wave_size - 1);
+		time += count * period;
+	}
+
 	if ( time < end_time )
 	{
 		Blip_Buffer* const output = this->output;
@@ -51,6 +51,8 @@ void Gbs_Emu::unload()
 	Music_Emu::unload();
 }
 
+int Gbs_Emu::silent_() const { return apu.silent(); }
+
 // Track info
 
 static void copy_gbs_fields( Gbs_Emu::header_t const& h, track_info_t* out )
@@ -236,6 +238,32 @@ blargg_err_t Gbs_Emu::start_track_( int track )
 	return 0;
 }
 
+// Snapshots
+
+long Gbs_Emu::snapshot_size_() const
+{
+	return sizeof (Gb_Cpu) + sizeof ram + sizeof apu + sizeof play_period + sizeof next_play;
+}
+
+void Gbs_Emu::save_snapshot_( byte* out ) const
+{
+	save_raw( out, *static_cast<Gb_Cpu const*> (this) ); // registers, bank mapping
+	save_raw( out, ram );
+	save_raw( out, apu );
+	save_raw( out, play_period );
+	save_raw( out, next_play );
+}
+
+void Gbs_Emu::load_snapshot_( byte const* in )
+{
+	load_raw( in, *static_cast<Gb_Cpu*> (this) );
+	load_raw( in, ram );
+	load_raw( in, apu );
+	load_raw( in, play_period );
+	load_raw( in, next_play );
+	snapshot_loaded();
+}
+
 blargg_err_t Gbs_Emu::run_clocks( blip_time_t& duration, int )
 {
 	cpu_time = 0;
@@ -57,6 +57,10 @@ protected:
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
 	void update_eq( blip_eq_t const& );
 	void unload();
+	int silent_() const;
+	long snapshot_size_() const;
+	void save_snapshot_( byte* ) const;
+	void load_snapshot_( byte const* );
 private:
 	// rom
 	enum { bank_size = 0x4000 };
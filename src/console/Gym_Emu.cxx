@@ -84,7 +84,9 @@ blargg_err_t Gym_Emu::track_info_( track_info_t* out, int ) const
 	return 0;
 }
 
-static long gym_track_length( byte const* p, byte const* end )
+// If the last command continues past end, sets *overrun to the number of its
+// bytes beyond end
+static long gym_track_length( byte const* p, byte const* end, long* overrun = 0 )
 {
 	long time = 0;
 	while ( p < end )
@@ -105,6 +107,8 @@ static long gym_track_length( byte const* p, byte const* end )
 				break;
 		}
 	}
+	if ( overrun )
+		*overrun = p - end;
 	return time;
 }
 
@@ -136,24 +140,45 @@ static blargg_err_t check_header( byte const* in, long size, int* data_offset =
 
 struct Gym_File : Gme_Info_
 {
-	byte const* file_begin;
-	byte const* file_end;
-	int data_offset;
+	Gym_Emu::header_t h;
+	long length;
 
 	Gym_File() { set_type( gme_gym_type ); }
 
-	blargg_err_t load_mem_( byte const* in, long size )
+	// Counts frames while reading through the file, rather than holding all
+	// of it in memory
+	blargg_err_t load_( Data_Reader& in )
 	{
-		file_begin = in;
-		file_end   = in + size;
-		data_offset = 0;
-		return check_header( in, size, &data_offset );
+		byte buf [4096];
+		long count = in.read_avail( buf, sizeof buf );
+		if ( count < 0 )
+			return "Read error";
+
+		int data_offset = 0;
+		RETURN_ERR( check_header( buf, count, &data_offset ) );
+		memset( &h, 0, sizeof h );
+		if ( data_offset )
+			memcpy( &h, buf, sizeof h );
+
+		length = 0;
+		long skip = data_offset;
+		while ( count > 0 )
+		{
+			if ( skip < count )
+				length += gym_track_length( buf + skip, buf + count, &skip );
+			else
+				skip -= count;
+
+			count = in.read_avail( buf, sizeof buf );
+			if ( count < 0 )
+				return "Read error";
+		}
+		return 0;
 	}
 
 	blargg_err_t track_info_( track_info_t* out, int ) const
 	{
-		long length = gym_track_length( &file_begin [data_offset], file_end );
-		get_gym_info( *(Gym_Emu::header_t const*) file_begin, length, out );
+		get_gym_info( h, length, out );
 		return 0;
 	}
 };
@@ -378,3 +403,26 @@ blargg_err_t Gym_Emu::play_( long count, sample_t* out )
 	Dual_Resampler::dual_play( count, out, blip_buf );
 	return 0;
 }
+
+blargg_err_t Gym_Emu::skip_( long count )
+{
+	// Most of a long skip only applies the register writes of each frame, then the
+	// last half second is emulated (muted) so that envelopes settle before the target
+	long const settle = sample_rate(); // half a second of stereo samples
+	long ahead = Dual_Resampler::samples_avail();
+	long frames = (count - ahead - settle) / Dual_Resampler::frame_size();
+	if ( frames > settle / Dual_Resampler::frame_size() )
+	{
+		blip_buf.clear();
+		Dual_Resampler::clear();
+		count -= ahead + frames * Dual_Resampler::frame_size();
+
+		bool saved_muted = dac_muted;
+		dac_muted = true; // parse_frame() then skips generating the dac samples
+		while ( frames-- && pos < data_end )
+			parse_frame();
+		dac_muted = saved_muted;
+	}
+
+	return Music_Emu::skip_( count );
+}
@@ -106,3 +106,19 @@ long Gzip_Reader::read_avail( void* out, long count )
 		count = -1;
 	return count;
 }
+
+blargg_err_t Gzip_Reader::skip( long count )
+{
+	// uncompressed data can be skipped by seeking; deflated data has to be
+	// inflated and discarded
+	if ( !in || inflater.deflated() || remain() < 0 )
+		return Data_Reader::skip( count );
+
+	if ( count > size_ - tell_ )
+		return eof_error;
+
+	long first = inflater.discard_copied( count );
+	RETURN_ERR( in->skip( count - first ) );
+	tell_ += count;
+	return 0;
+}
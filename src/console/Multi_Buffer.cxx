@@ -15,6 +15,15 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 
 #include "blargg_source.h"
 
+// The sides (and center) are integrated side by side in one vector register
+#if defined (__SSE2__)
+	#include <emmintrin.h>
+	#define MIX_SSE2 1
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define MIX_NEON 1
+#endif
+
 #ifdef BLARGG_ENABLE_OPTIMIZER
 	#include BLARGG_ENABLE_OPTIMIZER
 #endif
@@ -156,6 +165,47 @@ void Stereo_Buffer::mix_stereo( blip_sample_t* out_, blargg_long count )
 	BLIP_READER_BEGIN( right, bufs [2] );
 	BLIP_READER_BEGIN( center, bufs [0] );
 
+#if MIX_SSE2
+	// lanes: left, right, center, unused
+	__m128i accum = _mm_setr_epi32( left_reader_accum, right_reader_accum, center_reader_accum, 0 );
+	__m128i const shift = _mm_cvtsi32_si128( bass );
+	for ( ; count; --count )
+	{
+		__m128i s = _mm_srai_epi32( accum, blip_sample_bits - 16 );
+		s = _mm_add_epi32( s, _mm_shuffle_epi32( s, _MM_SHUFFLE( 2, 2, 2, 2 ) ) );
+		*(uint32_t*) out = _mm_cvtsi128_si32( _mm_packs_epi32( s, s ) );
+		out += 2;
+
+		__m128i in = _mm_setr_epi32( *left_reader_buf++, *right_reader_buf++,
+				*center_reader_buf++, 0 );
+		accum = _mm_add_epi32( accum, _mm_sub_epi32( in, _mm_sra_epi32( accum, shift ) ) );
+	}
+	left_reader_accum   = _mm_cvtsi128_si32( accum );
+	right_reader_accum  = _mm_cvtsi128_si32( _mm_srli_si128( accum, 4 ) );
+	center_reader_accum = _mm_cvtsi128_si32( _mm_srli_si128( accum, 8 ) );
+#elif MIX_NEON
+	int32_t lanes [4] = { left_reader_accum, right_reader_accum, center_reader_accum, 0 };
+	int32x4_t accum = vld1q_s32( lanes );
+	int32x4_t const shift = vdupq_n_s32( -bass );
+	for ( ; count; --count )
+	{
+		int32x4_t s = vshrq_n_s32( accum, blip_sample_bits - 16 );
+		s = vaddq_s32( s, vdupq_lane_s32( vget_high_s32( s ), 0 ) );
+		int16x4_t o = vqmovn_s32( s );
+		vst1_lane_s16( out,     o, 0 );
+		vst1_lane_s16( out + 1, o, 1 );
+		out += 2;
+
+		lanes [0] = *left_reader_buf++;
+		lanes [1] = *right_reader_buf++;
+		lanes [2] = *center_reader_buf++;
+		accum = vaddq_s32( accum, vsubq_s32( vld1q_s32( lanes ), vshlq_s32( accum, shift ) ) );
+	}
+	vst1q_s32( lanes, accum );
+	left_reader_accum   = lanes [0];
+	right_reader_accum  = lanes [1];
+	center_reader_accum = lanes [2];
+#else
 	for ( ; count; --count )
 	{
 		int c = BLIP_READER_READ( center );
@@ -175,6 +225,7 @@ void Stereo_Buffer::mix_stereo( blip_sample_t* out_, blargg_long count )
 		out [1] = r;
 		out += 2;
 	}
+#endif
 
 	BLIP_READER_END( center, bufs [0] );
 	BLIP_READER_END( right, bufs [2] );
@@ -188,6 +239,40 @@ void Stereo_Buffer::mix_stereo_no_center( blip_sample_t* out_, blargg_long count
 	BLIP_READER_BEGIN( left, bufs [1] );
 	BLIP_READER_BEGIN( right, bufs [2] );
 
+#if MIX_SSE2
+	__m128i accum = _mm_setr_epi32( left_reader_accum, right_reader_accum, 0, 0 );
+	__m128i const shift = _mm_cvtsi32_si128( bass );
+	for ( ; count; --count )
+	{
+		__m128i s = _mm_srai_epi32( accum, blip_sample_bits - 16 );
+		*(uint32_t*) out = _mm_cvtsi128_si32( _mm_packs_epi32( s, s ) );
+		out += 2;
+
+		__m128i in = _mm_setr_epi32( *left_reader_buf++, *right_reader_buf++, 0, 0 );
+		accum = _mm_add_epi32( accum, _mm_sub_epi32( in, _mm_sra_epi32( accum, shift ) ) );
+	}
+	left_reader_accum  = _mm_cvtsi128_si32( accum );
+	right_reader_accum = _mm_cvtsi128_si32( _mm_srli_si128( accum, 4 ) );
+#elif MIX_NEON
+	int32_t lanes [2] = { left_reader_accum, right_reader_accum };
+	int32x2_t accum = vld1_s32( lanes );
+	int32x2_t const shift = vdup_n_s32( -bass );
+	for ( ; count; --count )
+	{
+		int32x2_t s = vshr_n_s32( accum, blip_sample_bits - 16 );
+		int16x4_t o = vqmovn_s32( vcombine_s32( s, s ) );
+		vst1_lane_s16( out,     o, 0 );
+		vst1_lane_s16( out + 1, o, 1 );
+		out += 2;
+
+		lanes [0] = *left_reader_buf++;
+		lanes [1] = *right_reader_buf++;
+		accum = vadd_s32( accum, vsub_s32( vld1_s32( lanes ), vshl_s32( accum, shift ) ) );
+	}
+	vst1_s32( lanes, accum );
+	left_reader_accum  = lanes [0];
+	right_reader_accum = lanes [1];
+#else
 	for ( ; count; --count )
 	{
 		blargg_long l = BLIP_READER_READ( left );
@@ -205,6 +290,7 @@ void Stereo_Buffer::mix_stereo_no_center( blip_sample_t* out_, blargg_long count
 		out [1] = r;
 		out += 2;
 	}
+#endif
 
 	BLIP_READER_END( right, bufs [2] );
 	BLIP_READER_END( left, bufs [1] );
@@ -5,6 +5,14 @@
 #include "Multi_Buffer.h"
 #include <string.h>
 
+#if defined (__SSE2__)
+	#include <emmintrin.h>
+	#define SCAN_SSE2 1
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define SCAN_NEON 1
+#endif
+
 /* Copyright (C) 2003-2006 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -21,8 +29,11 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 int const stereo = 2; // number of channels for stereo
 int const silence_max = 6; // seconds
 int const silence_threshold = 0x10;
+long const default_buf_size = 2048;
 long const fade_block_size = 512;
 int const fade_shift = 8; // fade ends with gain at 1.0 / (1 << fade_shift)
+int const snapshot_period = 10; // seconds
+long const snapshot_max_size = 16 * 1024 * 1024L; // total for all snapshots
 
 Music_Emu::equalizer_t const Music_Emu::tv_eq = { -8.0, 180 };
 
@@ -45,6 +56,7 @@ void Music_Emu::unload()
 {
 	voice_count_ = 0;
 	clear_track_vars();
+	clear_snapshots();
 	Gme_File::unload();
 }
 
@@ -60,6 +72,9 @@ Music_Emu::Music_Emu()
 	// defaults
 	max_initial_silence = 2;
 	silence_lookahead   = 3;
+	user_lookahead      = 0;
+	block_msec          = 0;
+	buf_size            = default_buf_size;
 	ignore_silence_     = false;
 	equalizer_.treble   = -1.0;
 	equalizer_.bass     = 60;
@@ -78,11 +93,32 @@ blargg_err_t Music_Emu::set_sample_rate( long rate )
 {
 	require( !sample_rate() ); // sample rate can't be changed once set
 	RETURN_ERR( set_sample_rate_( rate ) );
-	RETURN_ERR( buf.resize( buf_size ) );
 	sample_rate_ = rate;
+	return resize_buf();
+}
+
+blargg_err_t Music_Emu::resize_buf()
+{
+	long size = default_buf_size;
+	if ( block_msec )
+		size = max( 64L, (long) msec_to_samples( block_msec ) & ~1L );
+
+	if ( size != buf_size || !buf.size() )
+	{
+		buf_remain = 0; // any lookahead held in buf is lost
+		RETURN_ERR( buf.resize( size ) );
+		buf_size = size;
+	}
 	return 0;
 }
 
+blargg_err_t Music_Emu::set_silence_detection( int lookahead, int msec )
+{
+	user_lookahead = max( lookahead, 0 );
+	block_msec     = max( msec, 0 );
+	return sample_rate() ? resize_buf() : 0;
+}
+
 void Music_Emu::pre_load()
 {
 	require( sample_rate() ); // set_sample_rate() must be called before loading a file
@@ -121,6 +157,7 @@ void Music_Emu::set_tempo( double t )
 	if ( t > max ) t = max;
 	tempo_ = t;
 	set_tempo_( t );
+	clear_snapshots(); // timing has changed
 }
 
 void Music_Emu::post_load_()
@@ -130,6 +167,12 @@ void Music_Emu::post_load_()
 }
 
 blargg_err_t Music_Emu::start_track( int track )
+{
+	clear_snapshots();
+	return begin_track( track );
+}
+
+blargg_err_t Music_Emu::begin_track( int track )
 {
 	clear_track_vars();
 
@@ -187,8 +230,17 @@ long Music_Emu::tell() const
 blargg_err_t Music_Emu::seek( long msec )
 {
 	blargg_long time = msec_to_samples( msec );
-	if ( time < out_time )
-		RETURN_ERR( start_track( current_track_ ) );
+
+	// latest snapshot not after time
+	int i = snapshot_count;
+	while ( i && snapshot_times [i - 1] > time )
+		i--;
+
+	if ( i && (time < out_time || snapshot_times [i - 1] > out_time) )
+		load_snapshot( i - 1 );
+	else if ( time < out_time )
+		RETURN_ERR( begin_track( current_track_ ) );
+
 	return skip( time - out_time );
 }
 
@@ -208,10 +260,21 @@ blargg_err_t Music_Emu::skip( long count )
 		count -= n;
 	}
 
-	if ( count && !emu_track_ended_ )
+	while ( count && !emu_track_ended_ )
 	{
-		emu_time += count;
-		end_track_if_error( skip_( count ) );
+		// stop at each snapshot time so that a long skip leaves snapshots behind
+		long n = count;
+		if ( snapshot_interval )
+		{
+			blargg_long next = (snapshot_count + 1) * snapshot_interval - emu_time;
+			if ( next > 0 && next < n )
+				n = next + (next & 1);
+		}
+
+		count    -= n;
+		emu_time += n;
+		end_track_if_error( skip_( n ) );
+		check_snapshot();
 	}
 
 	if ( !(silence_count | buf_remain) ) // caught up to emulator, so update track ended
@@ -249,6 +312,72 @@ blargg_err_t Music_Emu::skip_( long count )
 	return 0;
 }
 
+// Snapshots
+
+void Music_Emu::clear_snapshots()
+{
+	snapshot_count    = 0;
+	snapshot_interval = snapshot_period * stereo * sample_rate();
+	snapshot_times.clear();
+	snapshots.clear();
+}
+
+// Takes a snapshot once the emulator passes the next snapshot time. When the
+// snapshots would exceed snapshot_max_size, every other one is dropped and the
+// interval doubled, so a track of any length is covered evenly.
+void Music_Emu::check_snapshot()
+{
+	long size = snapshot_size_();
+	if ( !size || !snapshot_interval || emu_track_ended_ || size > snapshot_max_size / 8 )
+		return;
+
+	blargg_long time = emu_time + snapshot_ahead_();
+	if ( time < (snapshot_count + 1) * snapshot_interval )
+		return;
+
+	if ( (snapshot_count + 1) * size > snapshot_max_size )
+	{
+		for ( int i = 0; i < snapshot_count / 2; i++ )
+		{
+			snapshot_times [i] = snapshot_times [i * 2 + 1];
+			memcpy( &snapshots [i * size], &snapshots [(i * 2 + 1) * size], size );
+		}
+		snapshot_count /= 2;
+		snapshot_interval *= 2;
+		if ( time < (snapshot_count + 1) * snapshot_interval )
+			return;
+	}
+
+	if ( (size_t) snapshot_count >= snapshot_times.size() )
+	{
+		size_t n = snapshot_count ? snapshot_count * 2 : 16;
+		if ( snapshot_times.resize( n ) || snapshots.resize( n * size ) )
+		{
+			clear_snapshots(); // out of memory; just go without
+			snapshot_interval = 0;
+			return;
+		}
+	}
+
+	snapshot_times [snapshot_count] = time;
+	save_snapshot_( &snapshots [snapshot_count * size] );
+	snapshot_count++;
+}
+
+void Music_Emu::load_snapshot( int i )
+{
+	load_snapshot_( &snapshots [i * snapshot_size_()] );
+	remute_voices();
+
+	out_time         = snapshot_times [i];
+	emu_time         = out_time;
+	emu_track_ended_ = false;
+	track_ended_     = false;
+	silence_time     = out_time;
+	silence_count    = 0;
+	buf_remain       = 0;
+}
+
 // Fading
 
 void Music_Emu::set_fade( long start_msec, long length_msec )
@@ -292,7 +421,10 @@ void Music_Emu::emu_play( long count, sample_t* out )
 	check( current_track_ >= 0 );
 	emu_time += count;
 	if ( current_track_ >= 0 && !emu_track_ended_ )
+	{
 		end_track_if_error( play_( count, out ) );
+		check_snapshot();
+	}
 	else
 		memset( out, 0, count * sizeof *out );
 }
@@ -300,9 +432,37 @@ void Music_Emu::emu_play( long count, sample_t* out )
 // number of consecutive silent samples at end
 static long count_silence( Music_Emu::sample_t* begin, long size )
 {
+	Music_Emu::sample_t* p = begin + size;
+
+	// skip back over silent samples eight at a time, leaving the block with
+	// the first loud sample (if any) to the loop below
+#if SCAN_SSE2
+	__m128i const hi = _mm_set1_epi16( silence_threshold / 2 );
+	__m128i const lo = _mm_set1_epi16( -silence_threshold / 2 );
+	while ( p - begin >= 8 )
+	{
+		__m128i in = _mm_loadu_si128( (__m128i const*) (p - 8) );
+		__m128i loud = _mm_or_si128( _mm_cmpgt_epi16( in, hi ), _mm_cmplt_epi16( in, lo ) );
+		if ( _mm_movemask_epi8( loud ) )
+			break;
+		p -= 8;
+	}
+#elif SCAN_NEON
+	int16x8_t const hi = vdupq_n_s16( silence_threshold / 2 );
+	int16x8_t const lo = vdupq_n_s16( -silence_threshold / 2 );
+	while ( p - begin >= 8 )
+	{
+		int16x8_t in = vld1q_s16( p - 8 );
+		uint16x8_t loud = vorrq_u16( vcgtq_s16( in, hi ), vcltq_s16( in, lo ) );
+		uint64x2_t any = vreinterpretq_u64_u16( loud );
+		if ( vgetq_lane_u64( any, 0 ) | vgetq_lane_u64( any, 1 ) )
+			break;
+		p -= 8;
+	}
+#endif
+
 	Music_Emu::sample_t first = *begin;
 	*begin = silence_threshold; // sentinel
-	Music_Emu::sample_t* p = begin + size;
 	while ( (unsigned) (*--p + silence_threshold / 2) <= (unsigned) silence_threshold ) { }
 	*begin = first;
 	return size - (p - begin);
@@ -346,7 +506,8 @@ blargg_err_t Music_Emu::play( long out_count, sample_t* out )
 		if ( silence_count )
 		{
 			// during a run of silence, run emulator at >=2x speed so it gets ahead
-			long ahead_time = silence_lookahead * (out_time + out_count - silence_time) + silence_time;
+			int lookahead = user_lookahead ? user_lookahead : silence_lookahead;
+			long ahead_time = lookahead * (out_time + out_count - silence_time) + silence_time;
 			while ( emu_time < ahead_time && !(buf_remain | emu_track_ended_) )
 				fill_buf();
 
@@ -386,7 +547,14 @@ blargg_err_t Music_Emu::play( long out_count, sample_t* out )
 				if ( silence < remain )
 					silence_time = emu_time - silence;
 
-				if ( emu_time - silence_time >= buf_size )
+				// if the emulator can tell that its hardware is still making
+				// sound, this is only a quiet passage; wait a second before
+				// looking ahead rather than racing ahead through every rest
+				long quiet = buf_size;
+				if ( silent_() == 0 )
+					quiet = max( quiet, (long) sample_rate() * stereo );
+
+				if ( emu_time - silence_time >= quiet )
 					fill_buf(); // cause silence detection on next play()
 			}
 		}
@@ -5,6 +5,7 @@
 #define MUSIC_EMU_H
 
 #include "Gme_File.h"
+#include <string.h>
 class Multi_Buffer;
 
 struct Music_Emu : public Gme_File {
@@ -41,7 +42,9 @@ public:
 	// Number of milliseconds (1000 msec = 1 second) played since beginning of track
 	long tell() const;
 
-	// Seek to new time in track. Seeking backwards or far forward can take a while.
+	// Seek to new time in track. Emulators which support snapshots restore the
+	// nearest one taken earlier in the track; otherwise seeking backwards or far
+	// forward can take a while.
 	blargg_err_t seek( long msec );
 
 	// Skip n samples
@@ -57,6 +60,12 @@ public:
 	// Disable automatic end-of-track detection and skipping of silence at beginning
 	void ignore_silence( bool disable = true );
 
+	// Tune silence detection. During a run of silence the emulator runs
+	// 'lookahead' times faster than real time to find where the silence ends,
+	// in blocks of 'block_msec'. Zero keeps the default for each: the speed
+	// chosen by the emulator type, and blocks of about 23 msec.
+	blargg_err_t set_silence_detection( int lookahead, int block_msec = 0 );
+
 	// Info for current track
 	using Gme_File::track_info;
 	blargg_err_t track_info( track_info_t* out ) const;
@@ -122,6 +131,22 @@ protected:
 	virtual blargg_err_t start_track_( int ) = 0; // tempo is set before this
 	virtual blargg_err_t play_( long count, sample_t* out ) = 0;
 	virtual blargg_err_t skip_( long count );
+
+	// 1 if the emulated sound hardware is making no sound at all (every
+	// channel off or at zero volume), 0 if it may be, or -1 if the emulator
+	// can't tell. Used to tell quiet passages from real silence.
+	virtual int silent_() const { return -1; }
+
+	// Snapshots for fast seeking. An emulator which can copy its complete state
+	// returns the space needed from snapshot_size_(). Snapshots are raw images of
+	// the emulator's own objects, so they are only loaded back into the same
+	// emulator with the same file, and pointers within them stay valid. Voices
+	// are remuted after a load. snapshot_ahead_() is the number of samples already
+	// emulated but not yet returned by play_(); load_snapshot_() discards them.
+	virtual long snapshot_size_() const { return 0; }
+	virtual void save_snapshot_( byte* ) const { }
+	virtual void load_snapshot_( byte const* ) { }
+	virtual long snapshot_ahead_() const { return 0; }
 protected:
 	virtual void unload();
 	virtual void pre_load();
@@ -147,6 +172,16 @@ private:
 	volatile bool track_ended_;
 	void clear_track_vars();
 	void end_track_if_error( blargg_err_t );
+	blargg_err_t begin_track( int );
+
+	// snapshots
+	int snapshot_count;
+	blargg_long snapshot_interval; // samples between snapshots
+	blargg_vector<blargg_long> snapshot_times;
+	blargg_vector<byte> snapshots;
+	void clear_snapshots();
+	void check_snapshot();
+	void load_snapshot( int );
 
 	// fading
 	blargg_long fade_start;
@@ -155,12 +190,15 @@ private:
 
 	// silence detection
 	int silence_lookahead; // speed to run emulator when looking ahead for silence
+	int user_lookahead;    // overrides silence_lookahead if non-zero
+	int block_msec;        // size of buf, or 0 for the default
 	bool ignore_silence_;
 	long silence_time;     // number of samples where most recent silence began
 	long silence_count;    // number of samples of silence to play before using buf
 	long buf_remain;       // number of samples left in silence buffer
-	enum { buf_size = 2048 };
+	long buf_size;
 	blargg_vector<sample_t> buf;
+	blargg_err_t resize_buf();
 	void fill_buf();
 	void emu_play( long count, sample_t* out );
 
@@ -198,6 +236,21 @@ inline const Music_Emu::equalizer_t& Music_Emu::equalizer() const { return equal
 inline void Music_Emu::enable_accuracy( bool b )    { enable_accuracy_( b ); }
 inline void Music_Emu::set_tempo_( double t )       { tempo_ = t; }
 inline void Music_Emu::remute_voices()              { mute_voices( mute_mask_ ); }
+
+// Raw copies of an emulator's objects into and out of a snapshot
+template<class T>
+inline void save_raw( Music_Emu::byte*& out, T const& t )
+{
+	memcpy( out, (void const*) &t, sizeof t );
+	out += sizeof t;
+}
+
+template<class T>
+inline void load_raw( Music_Emu::byte const*& in, T& t )
+{
+	memcpy( (void*) &t, in, sizeof t );
+	in += sizeof t;
+}
 inline void Music_Emu::ignore_silence( bool b )     { ignore_silence_ = b; }
 inline blargg_err_t Music_Emu::start_track_( int )  { return 0; }
 
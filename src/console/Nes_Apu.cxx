@@ -132,6 +132,16 @@ void Nes_Apu::irq_changed()
 	}
 }
 
+bool Nes_Apu::silent() const
+{
+	// the envelope volume is zero once the length counter has run out; the
+	// triangle holds its level once either of its counters has; the DMC is
+	// quiet once its last byte is out
+	return !square1.volume() && !square2.volume() && !noise.volume() &&
+			!(triangle.length_counter && triangle.linear_counter) &&
+			!dmc.length_counter && dmc.silence;
+}
+
 // frames
 
 void Nes_Apu::run_until( nes_time_t end_time )
@@ -90,6 +90,10 @@ public:
 	// Time when next DMC memory read will occur
 	nes_time_t next_dmc_read_time() const;
 
+	// True if no oscillator is making sound, so that the output stays at a
+	// constant level until a register is written
+	bool silent() const;
+
 	// Run DMC until specified time, so that any DMC memory reads can be
 	// accounted for (i.e. inserting CPU wait states).
 	void run_until( nes_time_t );
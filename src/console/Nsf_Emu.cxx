@@ -74,6 +74,15 @@ void Nsf_Emu::unload()
 	Music_Emu::unload();
 }
 
+int Nsf_Emu::silent_() const
+{
+	#if !NSF_EMU_APU_ONLY
+		if ( vrc6 || namco || fme7 )
+			return -1; // expansion chips can't tell
+	#endif
+	return apu.silent();
+}
+
 // Track info
 
 static void copy_nsf_fields( Nsf_Emu::header_t const& h, track_info_t* out )
@@ -485,6 +494,64 @@ blargg_err_t Nsf_Emu::start_track_( int track )
 	return 0;
 }
 
+// Snapshots
+
+long Nsf_Emu::snapshot_size_() const
+{
+	long size = sizeof (Nes_Cpu) + sizeof apu + sizeof sram + sizeof saved_state +
+			sizeof next_play + sizeof play_extra + sizeof play_ready;
+
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco ) size += sizeof *namco;
+		if ( vrc6  ) size += sizeof *vrc6;
+		if ( fme7  ) size += sizeof *fme7;
+	}
+	#endif
+
+	return size;
+}
+
+void Nsf_Emu::save_snapshot_( byte* out ) const
+{
+	save_raw( out, *static_cast<Nes_Cpu const*> (this) ); // registers, RAM, bank mapping
+	save_raw( out, apu );
+	save_raw( out, sram );
+	save_raw( out, saved_state );
+	save_raw( out, next_play );
+	save_raw( out, play_extra );
+	save_raw( out, play_ready );
+
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco ) save_raw( out, *namco );
+		if ( vrc6  ) save_raw( out, *vrc6 );
+		if ( fme7  ) save_raw( out, *fme7 );
+	}
+	#endif
+}
+
+void Nsf_Emu::load_snapshot_( byte const* in )
+{
+	load_raw( in, *static_cast<Nes_Cpu*> (this) );
+	load_raw( in, apu );
+	load_raw( in, sram );
+	load_raw( in, saved_state );
+	load_raw( in, next_play );
+	load_raw( in, play_extra );
+	load_raw( in, play_ready );
+
+	#if !NSF_EMU_APU_ONLY
+	{
+		if ( namco ) load_raw( in, *namco );
+		if ( vrc6  ) load_raw( in, *vrc6 );
+		if ( fme7  ) load_raw( in, *fme7 );
+	}
+	#endif
+
+	snapshot_loaded();
+}
+
 blargg_err_t Nsf_Emu::run_clocks( blip_time_t& duration, int )
 {
 	set_time( 0 );
@@ -61,6 +61,10 @@ protected:
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
 	void update_eq( blip_eq_t const& );
 	void unload();
+	int silent_() const;
+	long snapshot_size_() const;
+	void save_snapshot_( byte* ) const;
+	void load_snapshot_( byte const* );
 protected:
 	enum { bank_count = 8 };
 	byte initial_banks [bank_count];
@@ -26,6 +26,15 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA */
 	#error "Requires that int type have at least 32 bits"
 #endif
 
+// Echo FIR with vector multiply-adds; exactly the same sums as the plain code
+#if defined (__SSE2__)
+	#include <emmintrin.h>
+	#define SPC_FIR_SSE2 1
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define SPC_FIR_NEON 1
+#endif
+
 
 // TODO: add to blargg_endian.h
 #define GET_LE16SA( addr )      ((int16_t) GET_LE16( addr ))
@@ -202,6 +211,30 @@ void Spc_Dsp::run( int clock_count )
 	if ( mvoll * mvolr < m.surround_threshold )
 		mvoll = -mvoll; // eliminate surround
 
+	// FIR coefficients can't change during run()
+#if SPC_FIR_SSE2
+	// taps paired as 0 1 0 1 2 3 2 3 to match history reordered to LLRRLLRR
+	__m128i const fir_lo = _mm_setr_epi16(
+			(int8_t) REG(fir + 0x00), (int8_t) REG(fir + 0x10),
+			(int8_t) REG(fir + 0x00), (int8_t) REG(fir + 0x10),
+			(int8_t) REG(fir + 0x20), (int8_t) REG(fir + 0x30),
+			(int8_t) REG(fir + 0x20), (int8_t) REG(fir + 0x30) );
+	__m128i const fir_hi = _mm_setr_epi16(
+			(int8_t) REG(fir + 0x40), (int8_t) REG(fir + 0x50),
+			(int8_t) REG(fir + 0x40), (int8_t) REG(fir + 0x50),
+			(int8_t) REG(fir + 0x60), (int8_t) REG(fir + 0x70),
+			(int8_t) REG(fir + 0x60), (int8_t) REG(fir + 0x70) );
+#elif SPC_FIR_NEON
+	int32_t const fir_taps [8] = {
+		(int8_t) REG(fir + 0x00), (int8_t) REG(fir + 0x10),
+		(int8_t) REG(fir + 0x20), (int8_t) REG(fir + 0x30),
+		(int8_t) REG(fir + 0x40), (int8_t) REG(fir + 0x50),
+		(int8_t) REG(fir + 0x60), (int8_t) REG(fir + 0x70)
+	};
+	int32x4_t const fir_lo = vld1q_s32( fir_taps );
+	int32x4_t const fir_hi = vld1q_s32( fir_taps + 4 );
+#endif
+
 	do
 	{
 		// KON/KOFF reading
@@ -567,6 +600,32 @@ skip_brr:
 		echo_hist_pos [0] [0] = echo_hist_pos [8] [0] = echo_in_l;
 		echo_hist_pos [0] [1] = echo_hist_pos [8] [1] = echo_in_r;
 
+	#if SPC_FIR_SSE2
+		{
+			// taps 0-7 apply to echo_hist_pos [1-8], all 16-bit values
+			__m128i const* h = (__m128i const*) echo_hist_pos [1];
+			__m128i a = _mm_packs_epi32( _mm_loadu_si128( h + 0 ), _mm_loadu_si128( h + 1 ) );
+			__m128i b = _mm_packs_epi32( _mm_loadu_si128( h + 2 ), _mm_loadu_si128( h + 3 ) );
+			a = _mm_shufflehi_epi16( _mm_shufflelo_epi16( a, _MM_SHUFFLE( 3, 1, 2, 0 ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+			b = _mm_shufflehi_epi16( _mm_shufflelo_epi16( b, _MM_SHUFFLE( 3, 1, 2, 0 ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+			__m128i sum = _mm_add_epi32( _mm_madd_epi16( a, fir_lo ), _mm_madd_epi16( b, fir_hi ) );
+			sum = _mm_add_epi32( sum, _mm_srli_si128( sum, 8 ) );
+			echo_in_l = _mm_cvtsi128_si32( sum );
+			echo_in_r = _mm_cvtsi128_si32( _mm_srli_si128( sum, 4 ) );
+		}
+	#elif SPC_FIR_NEON
+		{
+			int32x4x2_t lo = vld2q_s32( echo_hist_pos [1] );
+			int32x4x2_t hi = vld2q_s32( echo_hist_pos [5] );
+			int32x4_t l = vmlaq_s32( vmulq_s32( lo.val [0], fir_lo ), hi.val [0], fir_hi );
+			int32x4_t r = vmlaq_s32( vmulq_s32( lo.val [1], fir_lo ), hi.val [1], fir_hi );
+			int32x2_t sum = vpadd_s32(
+					vpadd_s32( vget_low_s32( l ), vget_high_s32( l ) ),
+					vpadd_s32( vget_low_s32( r ), vget_high_s32( r ) ) );
+			echo_in_l = vget_lane_s32( sum, 0 );
+			echo_in_r = vget_lane_s32( sum, 1 );
+		}
+	#else
 		#define CALC_FIR_( i, in )  ((in) * (int8_t) REG(fir + i * 0x10))
 		echo_in_l = CALC_FIR_( 7, echo_in_l );
 		echo_in_r = CALC_FIR_( 7, echo_in_r );
@@ -585,6 +644,7 @@ skip_brr:
 		DO_FIR( 4 );
 		DO_FIR( 5 );
 		DO_FIR( 6 );
+	#endif
 
 		// Echo out
 		if ( !(REG(flg) & 0x20) )
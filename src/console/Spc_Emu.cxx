@@ -311,14 +311,17 @@ blargg_err_t Spc_Emu::play_and_filter( long count, sample_t out [] )
 
 blargg_err_t Spc_Emu::skip_( long count )
 {
-	if ( sample_rate() != native_sample_rate )
+	// the samples played below to eliminate the resampler pop are part of the
+	// skip; otherwise every skip, including each step of a long one, runs late
+	const int resampler_latency = 64;
+	count -= resampler_latency;
+
+	if ( count > 0 && sample_rate() != native_sample_rate )
 	{
 		count = long (count * resampler.ratio()) & ~1;
 		count -= resampler.skip_input( count );
 	}
 
-	// TODO: shouldn't skip be adjusted for the 64 samples read afterwards?
-
 	if ( count > 0 )
 	{
 		RETURN_ERR( apu.skip( count ) );
@@ -326,11 +329,28 @@ blargg_err_t Spc_Emu::skip_( long count )
 	}
 
 	// eliminate pop due to resampler
-	const int resampler_latency = 64;
 	sample_t buf [resampler_latency];
 	return play_( resampler_latency, buf );
 }
 
+// Snapshots
+
+long Spc_Emu::snapshot_size_() const { return sizeof apu; }
+
+void Spc_Emu::save_snapshot_( byte* out ) const { save_raw( out, apu ); }
+
+void Spc_Emu::load_snapshot_( byte const* in )
+{
+	load_raw( in, apu );
+	resampler.clear();
+	filter.clear();
+}
+
+long Spc_Emu::snapshot_ahead_() const
+{
+	return (sample_rate() != native_sample_rate) ? resampler.avail() : 0;
+}
+
 blargg_err_t Spc_Emu::play_( long count, sample_t* out )
 {
 	if ( sample_rate() == native_sample_rate )
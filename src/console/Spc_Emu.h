@@ -67,6 +67,10 @@ protected:
 	void mute_voices_( int );
 	void set_tempo_( double );
 	void enable_accuracy_( bool );
+	long snapshot_size_() const;
+	void save_snapshot_( byte* ) const;
+	void load_snapshot_( byte const* );
+	long snapshot_ahead_() const;
 private:
 	byte const* file_data;
 	long        file_size;
@@ -399,6 +399,77 @@ blargg_err_t Vgm_Emu::start_track_( int track )
 	return 0;
 }
 
+// Snapshots
+
+long Vgm_Emu::snapshot_size_() const
+{
+	long size = sizeof vgm_time + sizeof pos + sizeof pcm_data + sizeof pcm_pos +
+			sizeof dac_amp + sizeof dac_disabled + sizeof fm_time_offset + sizeof psg;
+
+	if ( ym2612.enabled() )
+		size += ym2612.state_size();
+
+	if ( ym2413.enabled() )
+		size += ym2413.state_size();
+
+	return size;
+}
+
+void Vgm_Emu::save_snapshot_( byte* out ) const
+{
+	save_raw( out, vgm_time );
+	save_raw( out, pos );
+	save_raw( out, pcm_data );
+	save_raw( out, pcm_pos );
+	save_raw( out, dac_amp );
+	save_raw( out, dac_disabled );
+	save_raw( out, fm_time_offset );
+	save_raw( out, psg );
+
+	if ( ym2612.enabled() )
+	{
+		ym2612.save_state( out );
+		out += ym2612.state_size();
+	}
+
+	if ( ym2413.enabled() )
+		ym2413.save_state( out );
+}
+
+void Vgm_Emu::load_snapshot_( byte const* in )
+{
+	load_raw( in, vgm_time );
+	load_raw( in, pos );
+	load_raw( in, pcm_data );
+	load_raw( in, pcm_pos );
+	load_raw( in, dac_amp );
+	load_raw( in, dac_disabled );
+	load_raw( in, fm_time_offset );
+	load_raw( in, psg );
+
+	if ( ym2612.enabled() )
+	{
+		ym2612.load_state( in );
+		in += ym2612.state_size();
+	}
+
+	if ( ym2413.enabled() )
+		ym2413.load_state( in );
+
+	if ( uses_fm )
+	{
+		blip_buf.clear();
+		Dual_Resampler::clear();
+	}
+
+	snapshot_loaded();
+}
+
+long Vgm_Emu::snapshot_ahead_() const
+{
+	return uses_fm ? Dual_Resampler::samples_avail() : Classic_Emu::snapshot_ahead_();
+}
+
 blargg_err_t Vgm_Emu::run_clocks( blip_time_t& time_io, int msec )
 {
 	time_io = run_commands( msec * vgm_rate / 1000 );
@@ -414,3 +485,29 @@ blargg_err_t Vgm_Emu::play_( long count, sample_t* out )
 	Dual_Resampler::dual_play( count, out, blip_buf );
 	return 0;
 }
+
+blargg_err_t Vgm_Emu::skip_( long count )
+{
+	// Most of a long skip only applies the register writes, then the last half
+	// second is emulated (muted) so that envelopes settle before the target
+	long const settle = sample_rate() * stereo / 2;
+	long ahead = snapshot_ahead_();
+	long fast = count - ahead - settle;
+	if ( fast > settle )
+	{
+		if ( uses_fm )
+		{
+			blip_buf.clear();
+			Dual_Resampler::clear();
+		}
+		else
+		{
+			clear_buffer();
+		}
+
+		skip_commands( (vgm_time_t) ((double) (fast / stereo) * vgm_rate / sample_rate()) );
+		count -= ahead + fast;
+	}
+
+	return Classic_Emu::skip_( count );
+}
@@ -65,11 +65,16 @@ protected:
 	blargg_err_t set_sample_rate_( long sample_rate );
 	blargg_err_t start_track_( int );
 	blargg_err_t play_( long count, sample_t* );
+	blargg_err_t skip_( long count );
 	blargg_err_t run_clocks( blip_time_t&, int );
 	void set_tempo_( double );
 	void mute_voices_( int mask );
 	void set_voice( int, Blip_Buffer*, Blip_Buffer*, Blip_Buffer* );
 	void update_eq( blip_eq_t const& );
+	long snapshot_size_() const;
+	void save_snapshot_( byte* ) const;
+	void load_snapshot_( byte const* );
+	long snapshot_ahead_() const;
 private:
 	// removed; use disable_oversampling() and set_tempo() instead
 	Vgm_Emu( bool oversample, double tempo = 1.0 );
@@ -234,6 +234,121 @@ blip_time_t Vgm_Emu_Impl::run_commands( vgm_time_t end_time )
 	return to_blip_time( end_time );
 }
 
+// Same as run_commands(), but only applies register writes; nothing is synthesized,
+// so the chips' envelopes and counters stand still meanwhile
+void Vgm_Emu_Impl::skip_commands( vgm_time_t end_time )
+{
+	vgm_time_t vgm_time = this->vgm_time;
+	byte const* pos = this->pos;
+	int dac_amp = this->dac_amp;
+
+	while ( vgm_time < end_time && pos < data_end )
+	{
+		switch ( *pos++ )
+		{
+		case cmd_end:
+			pos = loop_begin;
+			break;
+
+		case cmd_delay_735:
+			vgm_time += 735;
+			break;
+
+		case cmd_delay_882:
+			vgm_time += 882;
+			break;
+
+		case cmd_gg_stereo:
+			psg.write_ggstereo( 0, *pos++ );
+			break;
+
+		case cmd_psg:
+			psg.write_data( 0, *pos++ );
+			break;
+
+		case cmd_delay:
+			vgm_time += pos [1] * 0x100L + pos [0];
+			pos += 2;
+			break;
+
+		case cmd_byte_delay:
+			vgm_time += *pos++;
+			break;
+
+		case cmd_ym2413:
+			if ( ym2413.enabled() )
+				ym2413.write( pos [0], pos [1] );
+			pos += 2;
+			break;
+
+		case cmd_ym2612_port0:
+			if ( pos [0] == ym2612_dac_port )
+			{
+				dac_amp = (dac_amp < 0 ? pos [1] | dac_disabled : pos [1]);
+			}
+			else if ( ym2612.enabled() )
+			{
+				if ( pos [0] == 0x2B )
+				{
+					dac_disabled = (pos [1] >> 7 & 1) - 1;
+					dac_amp |= dac_disabled;
+				}
+				ym2612.write0( pos [0], pos [1] );
+			}
+			pos += 2;
+			break;
+
+		case cmd_ym2612_port1:
+			if ( ym2612.enabled() )
+				ym2612.write1( pos [0], pos [1] );
+			pos += 2;
+			break;
+
+		case cmd_data_block: {
+			int type = pos [1];
+			long size = GET_LE32( pos + 2 );
+			pos += 6;
+			if ( type == pcm_block_type )
+				pcm_data = pos;
+			pos += size;
+			break;
+		}
+
+		case cmd_pcm_seek:
+			pcm_pos = pcm_data + pos [3] * 0x1000000L + pos [2] * 0x10000L +
+					pos [1] * 0x100L + pos [0];
+			pos += 4;
+			break;
+
+		default:
+			int cmd = pos [-1];
+			switch ( cmd & 0xF0 )
+			{
+				case cmd_pcm_delay:
+					dac_amp = (dac_amp < 0 ? *pcm_pos | dac_disabled : *pcm_pos);
+					pcm_pos++;
+					vgm_time += cmd & 0x0F;
+					break;
+
+				case cmd_short_delay:
+					vgm_time += (cmd & 0x0F) + 1;
+					break;
+
+				case 0x50:
+					pos += 2;
+					break;
+
+				default:
+					pos += command_len( cmd ) - 1;
+			}
+		}
+	}
+
+	this->vgm_time = vgm_time - end_time;
+	this->pos = pos;
+	this->dac_amp = dac_amp;
+}
+
 int Vgm_Emu_Impl::play_frame( blip_time_t blip_time, int sample_count, sample_t* buf )
 {
 	// to do: timing is working mostly by luck
@@ -50,6 +50,7 @@ protected:
 	vgm_time_t vgm_time;
 	byte const* pos;
 	blip_time_t run_commands( vgm_time_t );
+	void skip_commands( vgm_time_t );
 	int play_frame( blip_time_t blip_time, int sample_count, sample_t* buf );
 
 	byte const* pcm_data;
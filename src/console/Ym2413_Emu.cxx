@@ -2211,6 +2211,13 @@ void Ym2413_Emu::mute_voices( int mask )
 	OPLL_setMask( opll, mask );
 }
 
+// pointers within OPLL are to its own patches and to global tables
+long Ym2413_Emu::state_size() const { return sizeof *opll; }
+
+void Ym2413_Emu::save_state( void* out ) const { memcpy( out, opll, sizeof *opll ); }
+
+void Ym2413_Emu::load_state( void const* in ) { memcpy( opll, in, sizeof *opll ); }
+
 void Ym2413_Emu::run( int pair_count, sample_t* out )
 {
 	while ( pair_count-- )
@@ -961,6 +961,33 @@ void Ym2612_Emu::write1( int addr, int data )
 
 void Ym2612_Emu::mute_voices( int mask ) { impl->mute_mask = mask; }
 
+// The slots point into impl's own tables, so a raw copy stays valid in the
+// same emulator. The LFO counters are the only state kept with the tables.
+long Ym2612_Emu::state_size() const
+{
+	return sizeof impl->YM2612 + sizeof impl->g.LFOcnt + sizeof impl->g.LFOinc;
+}
+
+void Ym2612_Emu::save_state( void* out ) const
+{
+	char* p = (char*) out;
+	memcpy( p, &impl->YM2612, sizeof impl->YM2612 );
+	p += sizeof impl->YM2612;
+	memcpy( p, &impl->g.LFOcnt, sizeof impl->g.LFOcnt );
+	p += sizeof impl->g.LFOcnt;
+	memcpy( p, &impl->g.LFOinc, sizeof impl->g.LFOinc );
+}
+
+void Ym2612_Emu::load_state( void const* in )
+{
+	char const* p = (char const*) in;
+	memcpy( &impl->YM2612, p, sizeof impl->YM2612 );
+	p += sizeof impl->YM2612;
+	memcpy( &impl->g.LFOcnt, p, sizeof impl->g.LFOcnt );
+	p += sizeof impl->g.LFOcnt;
+	memcpy( &impl->g.LFOinc, p, sizeof impl->g.LFOinc );
+}
+
 static void update_envelope_( slot_t* sl )
 {
 	switch ( sl->Ecurp )
@@ -1031,15 +1058,15 @@ inline void update_envelope( slot_t& sl )
 		update_envelope_( &sl );
 }
 
-template<int algo>
+template<int algo, bool lfo>
 struct ym2612_update_chan {
 	static void func( tables_t&, channel_t&, Ym2612_Emu::sample_t*, int );
 };
 
 typedef void (*ym2612_update_chan_t)( tables_t&, channel_t&, Ym2612_Emu::sample_t*, int );
 
-template<int algo>
-void ym2612_update_chan<algo>::func( tables_t& g, channel_t& ch,
+template<int algo, bool lfo>
+void ym2612_update_chan<algo,lfo>::func( tables_t& g, channel_t& ch,
 		Ym2612_Emu::sample_t* buf, int length )
 {
 	int not_end = ch.SLOT [S3].Ecnt - ENV_END;
@@ -1070,16 +1097,32 @@ void ym2612_update_chan<algo>::func( tables_t& g, channel_t& ch,
 	if ( !not_end )
 		return;
 
+	// with the LFO stopped, its effect on envelopes and phases is the same for
+	// every sample
+	int const fixed_env_LFO = g.LFO_ENV_TAB [YM2612_LFOcnt >> LFO_LBITS & LFO_MASK];
+	unsigned const fixed_freq_LFO = ((g.LFO_FREQ_TAB [YM2612_LFOcnt >> LFO_LBITS & LFO_MASK] *
+			ch.FMS) >> (LFO_HBITS - 1 + 1)) + (1L << (LFO_FMS_LBITS - 1));
+
+	#define CALC_STEP( x ) \
+		int const am##x = fixed_env_LFO >> ch.SLOT [S##x].AMS;\
+		int const step##x = (ch.SLOT [S##x].Finc * fixed_freq_LFO) >> (LFO_FMS_LBITS - 1);
+
+	CALC_STEP( 0 )
+	CALC_STEP( 1 )
+	CALC_STEP( 2 )
+	CALC_STEP( 3 )
+
 	do
 	{
 		// envelope
-		int const env_LFO = g.LFO_ENV_TAB [YM2612_LFOcnt >> LFO_LBITS & LFO_MASK];
+		int const env_LFO = lfo ? g.LFO_ENV_TAB [YM2612_LFOcnt >> LFO_LBITS & LFO_MASK] : 0;
 
 		short const* const ENV_TAB = g.ENV_TAB;
 
 	#define CALC_EN( x ) \
 		int temp##x = ENV_TAB [ch.SLOT [S##x].Ecnt >> ENV_LBITS] + ch.SLOT [S##x].TLL;  \
-		int en##x = ((temp##x ^ ch.SLOT [S##x].env_xor) + (env_LFO >> ch.SLOT [S##x].AMS)) &    \
+		int en##x = ((temp##x ^ ch.SLOT [S##x].env_xor) +                                        \
+				(lfo ? env_LFO >> ch.SLOT [S##x].AMS : am##x)) &                                    \
 				((temp##x - ch.SLOT [S##x].env_max) >> 31);
 
 		CALC_EN( 0 )
@@ -1159,13 +1202,23 @@ void ym2612_update_chan<algo>::func( tables_t& g, channel_t& ch,
 		CH_OUTd >>= MAX_OUT_BITS - output_bits + 2;
 
 		// update phase
-		unsigned freq_LFO = ((g.LFO_FREQ_TAB [YM2612_LFOcnt >> LFO_LBITS & LFO_MASK] *
-				ch.FMS) >> (LFO_HBITS - 1 + 1)) + (1L << (LFO_FMS_LBITS - 1));
-		YM2612_LFOcnt += YM2612_LFOinc;
-		in0 += (ch.SLOT [S0].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
-		in1 += (ch.SLOT [S1].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
-		in2 += (ch.SLOT [S2].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
-		in3 += (ch.SLOT [S3].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
+		if ( lfo )
+		{
+			unsigned freq_LFO = ((g.LFO_FREQ_TAB [YM2612_LFOcnt >> LFO_LBITS & LFO_MASK] *
+					ch.FMS) >> (LFO_HBITS - 1 + 1)) + (1L << (LFO_FMS_LBITS - 1));
+			YM2612_LFOcnt += YM2612_LFOinc;
+			in0 += (ch.SLOT [S0].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
+			in1 += (ch.SLOT [S1].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
+			in2 += (ch.SLOT [S2].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
+			in3 += (ch.SLOT [S3].Finc * freq_LFO) >> (LFO_FMS_LBITS - 1);
+		}
+		else
+		{
+			in0 += step0;
+			in1 += step1;
+			in2 += step2;
+			in3 += step3;
+		}
 
 		int t0 = buf [0] + (CH_OUTd & ch.LEFT);
 		int t1 = buf [1] + (CH_OUTd & ch.RIGHT);
@@ -1190,15 +1243,27 @@ void ym2612_update_chan<algo>::func( tables_t& g, channel_t& ch,
 	ch.SLOT [S3].Fcnt = in3;
 }
 
-static const ym2612_update_chan_t UPDATE_CHAN [8] = {
-	&ym2612_update_chan<0>::func,
-	&ym2612_update_chan<1>::func,
-	&ym2612_update_chan<2>::func,
-	&ym2612_update_chan<3>::func,
-	&ym2612_update_chan<4>::func,
-	&ym2612_update_chan<5>::func,
-	&ym2612_update_chan<6>::func,
-	&ym2612_update_chan<7>::func
+static const ym2612_update_chan_t UPDATE_CHAN [2] [8] = {
+	{
+		&ym2612_update_chan<0,false>::func,
+		&ym2612_update_chan<1,false>::func,
+		&ym2612_update_chan<2,false>::func,
+		&ym2612_update_chan<3,false>::func,
+		&ym2612_update_chan<4,false>::func,
+		&ym2612_update_chan<5,false>::func,
+		&ym2612_update_chan<6,false>::func,
+		&ym2612_update_chan<7,false>::func
+	},
+	{
+		&ym2612_update_chan<0,true>::func,
+		&ym2612_update_chan<1,true>::func,
+		&ym2612_update_chan<2,true>::func,
+		&ym2612_update_chan<3,true>::func,
+		&ym2612_update_chan<4,true>::func,
+		&ym2612_update_chan<5,true>::func,
+		&ym2612_update_chan<6,true>::func,
+		&ym2612_update_chan<7,true>::func
+	}
 };
 
 void Ym2612_Impl::run_timer( int length )
@@ -1310,7 +1375,7 @@ void Ym2612_Impl::run( int pair_count, Ym2612_Emu::sample_t* out )
 	for ( int i = 0; i < channel_count; i++ )
 	{
 		if ( !(mute_mask & (1 << i)) && (i != 5 || !YM2612.DAC) )
-			UPDATE_CHAN [YM2612.CHANNEL [i].ALGO]( g, YM2612.CHANNEL [i], out, pair_count );
+			UPDATE_CHAN [g.LFOinc != 0] [YM2612.CHANNEL [i].ALGO]( g, YM2612.CHANNEL [i], out, pair_count );
 	}
 
 	g.LFOcnt += g.LFOinc * pair_count;
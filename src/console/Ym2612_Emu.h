@@ -33,6 +33,11 @@ public:
 	typedef short sample_t;
 	enum { out_chan_count = 2 }; // stereo
 	void run( int pair_count, sample_t* out );
+
+	// Save/load chip state, for loading back into the same emulator
+	long state_size() const;
+	void save_state( void* out ) const;
+	void load_state( void const* in );
 };
 
 #endif
@@ -99,6 +99,19 @@ blargg_err_t Zlib_Inflater::begin( mode_t mode, callback_t callback, void* user_
 	return 0;
 }
 
+long Zlib_Inflater::discard_copied( long count )
+{
+	if ( deflated_ )
+		return 0;
+
+	if ( count > (long) zbuf.avail_in )
+		count = zbuf.avail_in;
+	zbuf.next_in  += count;
+	zbuf.avail_in -= count;
+	if ( !zbuf.avail_in )
+		buf.clear(); // done with buffer
+	return count;
+}
 
 blargg_err_t Zlib_Inflater::read( void* out, long* count_io,
 		callback_t callback, void* user_data )
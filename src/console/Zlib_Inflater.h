@@ -28,6 +28,10 @@ public:
 	// Keeps buffer full with user-provided callback.
 	blargg_err_t read( void* out, long* count_io, callback_t, void* user_data );
 
+	// Discard at most count bytes of buffered data when not deflated and return
+	// number discarded. The caller can then skip the rest in the file itself.
+	long discard_copied( long count );
+
 	// End inflation and free memory
 	void end();
 
@@ -29,6 +29,8 @@ static const gchar * const console_defaults[] = {
  "ignore_spc_length", "FALSE",
  "echo", "0",
  "inc_spc_reverb", "FALSE",
+ "silence_lookahead", "0",
+ "silence_block_ms", "0",
  NULL};
 
 // TODO: add UI for echo
@@ -44,6 +46,8 @@ void console_cfg_load (void)
     audcfg.ignore_spc_length = aud_get_bool (CON_CFGID, "ignore_spc_length");
     audcfg.echo = aud_get_int (CON_CFGID, "echo");
     audcfg.inc_spc_reverb = aud_get_bool (CON_CFGID, "inc_spc_reverb");
+    audcfg.silence_lookahead = aud_get_int (CON_CFGID, "silence_lookahead");
+    audcfg.silence_block_ms = aud_get_int (CON_CFGID, "silence_block_ms");
 }
 
 void console_cfg_save (void)
@@ -56,6 +60,8 @@ void console_cfg_save (void)
     aud_set_bool (CON_CFGID, "ignore_spc_length", audcfg.ignore_spc_length);
     aud_set_int (CON_CFGID, "echo", audcfg.echo);
     aud_set_bool (CON_CFGID, "inc_spc_reverb", audcfg.inc_spc_reverb);
+    aud_set_int (CON_CFGID, "silence_lookahead", audcfg.silence_lookahead);
+    aud_set_int (CON_CFGID, "silence_block_ms", audcfg.silence_block_ms);
 }
 
 
@@ -20,6 +20,8 @@ typedef struct {
 	gboolean ignore_spc_length; /* if true, ignore length from SPC tags */
 	gint echo;                  /* 0 to +100 */
 	gboolean inc_spc_reverb;    /* if true, increases the default reverb */
+	gint silence_lookahead;     /* speed of end-of-track scan, 0 for default */
+	gint silence_block_ms;      /* length of a scan block in ms, 0 for default */
 } AudaciousConsoleConfig;
 
 extern AudaciousConsoleConfig audcfg;
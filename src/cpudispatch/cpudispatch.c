@@ -0,0 +1,162 @@
+/*
+ * Runtime CPU Dispatch for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "cpudispatch.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <audacious/debug.h>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define USE_X86
+#endif
+
+static const struct {
+    const char * name;
+    unsigned flag;
+} feature_names[] = {
+ {"sse2", CPU_SSE2},
+ {"ssse3", CPU_SSSE3},
+ {"sse4.1", CPU_SSE4_1},
+ {"avx", CPU_AVX},
+ {"avx2", CPU_AVX2},
+ {"fma", CPU_FMA},
+ {"neon", CPU_NEON}};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static unsigned features;
+
+static unsigned detect (void)
+{
+    unsigned found = 0;
+
+#if defined (USE_X86)
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("sse2"))
+        found |= CPU_SSE2;
+    if (__builtin_cpu_supports ("ssse3"))
+        found |= CPU_SSSE3;
+    if (__builtin_cpu_supports ("sse4.1"))
+        found |= CPU_SSE4_1;
+    if (__builtin_cpu_supports ("avx"))
+        found |= CPU_AVX;
+    if (__builtin_cpu_supports ("avx2"))
+        found |= CPU_AVX2;
+    if (__builtin_cpu_supports ("fma"))
+        found |= CPU_FMA;
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+    found |= CPU_NEON;
+#endif
+
+    return found;
+}
+
+static unsigned lookup (const char * name, int length)
+{
+    for (int i = 0; i < sizeof feature_names / sizeof feature_names[0]; i ++)
+    {
+        if (strlen (feature_names[i].name) == length &&
+         ! strncmp (feature_names[i].name, name, length))
+            return feature_names[i].flag;
+    }
+
+    fprintf (stderr, "AUD_CPU_FEATURES: unknown feature \"%.*s\".\n", length, name);
+    return 0;
+}
+
+/* "sse2,ssse3" keeps only those; "-avx2,-fma" keeps all but those. */
+static unsigned parse_mask (const char * list)
+{
+    if (! strcmp (list, "none"))
+        return 0;
+
+    unsigned keep = 0, drop = 0;
+    char only = 0;
+
+    while (* list)
+    {
+        char minus = (* list == '-');
+        const char * name = list + minus;
+        int length = strcspn (name, ",");
+
+        if (length)
+        {
+            if (minus)
+                drop |= lookup (name, length);
+            else
+            {
+                keep |= lookup (name, length);
+                only = 1;
+            }
+        }
+
+        list = name + length;
+        if (* list == ',')
+            list ++;
+    }
+
+    return (only ? keep : ~0u) & ~drop;
+}
+
+static void init (void)
+{
+    const char * mask = getenv ("AUD_CPU_FEATURES");
+
+    features = detect ();
+
+    if (mask)
+        features &= parse_mask (mask);
+}
+
+unsigned cpu_features (void)
+{
+    pthread_once (& once, init);
+    return features;
+}
+
+int cpu_dispatch (const char * kernel, const CpuVariant * first, int count,
+ size_t stride)
+{
+    unsigned have = cpu_features ();
+    int i = 0;
+
+    /* the last entry is taken whatever it needs */
+    for (; i < count - 1; i ++)
+    {
+        const CpuVariant * variant = (const CpuVariant *) ((const char *) first
+         + i * stride);
+
+        if ((variant->needs & have) == variant->needs)
+            break;
+    }
+
+    const char * name = ((const CpuVariant *) ((const char *) first + i *
+     stride))->name;
+
+    AUDDBG ("%s: %s\n", kernel, name);
+
+    if (getenv ("AUD_CPU_REPORT"))
+        fprintf (stderr, "%s: %s\n", kernel, name);
+
+    return i;
+}
@@ -0,0 +1,76 @@
+/*
+ * Runtime CPU Dispatch for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_CPUDISPATCH_H
+#define AUDACIOUS_CPUDISPATCH_H
+
+#include <stddef.h>
+
+/* Distributions build for the baseline of each architecture (SSE2 on x86-64),
+ * so a plugin with kernels for anything newer has to build them with
+ * __attribute__ ((target (...))) and pick one when it starts up.  It lists the
+ * versions of a kernel, or of a set of kernels that go together, in a table
+ * ordered from best to worst, each entry beginning with a CpuVariant that
+ * names the features it needs; the last entry is the plain C version, which
+ * needs none.  CPU_DISPATCH() returns the first entry the CPU can run:
+ *
+ *     static const struct {
+ *         CpuVariant variant;
+ *         float (* dot) (const float * a, const float * b, int length);
+ *     } dots[] = {
+ *      {{"avx2", CPU_AVX2 | CPU_FMA}, dot_avx2},
+ *      {{"sse2", CPU_SSE2}, dot_sse2},
+ *      {{"c"}, dot_c}};
+ *
+ *     dot = CPU_DISPATCH ("resample dot", dots)->dot;
+ *
+ * For benchmarking, the features used can be limited by setting
+ * AUD_CPU_FEATURES to a comma-separated list of them (e.g. "sse2,ssse3"), to
+ * "none" for plain C throughout, or to a list of features to leave out
+ * ("-avx2,-fma").  Each choice is logged in debug mode, and also written to
+ * standard error if AUD_CPU_REPORT is set. */
+
+enum {
+    CPU_SSE2 = 1 << 0,
+    CPU_SSSE3 = 1 << 1,
+    CPU_SSE4_1 = 1 << 2,
+    CPU_AVX = 1 << 3,
+    CPU_AVX2 = 1 << 4,
+    CPU_FMA = 1 << 5,
+    CPU_NEON = 1 << 6
+};
+
+typedef struct {
+    const char * name; /* "avx2", "sse2", "c" */
+    unsigned needs;    /* CPU_XXX */
+} CpuVariant;
+
+/* The features of the CPU this is running on, less any left out through
+ * AUD_CPU_FEATURES.  NEON counts only where the plugins are built for it. */
+unsigned cpu_features (void);
+
+/* Returns the index of the first usable entry of a table as above, whose
+ * entries are stride bytes apart.  kernel names it in the report. */
+int cpu_dispatch (const char * kernel, const CpuVariant * first, int count,
+ size_t stride);
+
+#define CPU_DISPATCH(kernel, table) (& (table)[cpu_dispatch (kernel, \
+ & (table)[0].variant, sizeof (table) / sizeof (table)[0], sizeof (table)[0])])
+
+#endif
@@ -17,6 +17,7 @@
  * the use of this software.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -25,6 +26,9 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../denormal/denormal.h"
+#include "../perfstat/perfstat.h"
+
 enum
 {
     STATE_OFF,
@@ -36,29 +40,36 @@ enum
 
 static const char * const crossfade_defaults[] = {
  "length", "3",
+ "flush_denormals", "TRUE",
  NULL};
 
+/* The tail of the current song is kept in a power-of-two ring, allocated in
+ * crossfade_start() with room for the whole overlap plus one second, so no
+ * allocation happens while playing.  Audio older than the overlap is handed
+ * back to the caller directly from the ring when it is contiguous; otherwise
+ * (or if a single block of input does not fit in the ring) it is copied out to
+ * the output buffer. */
+
 static char state = STATE_OFF;
 static int current_channels = 0, current_rate = 0;
+static int current_length = 0; /* overlap in samples */
 static float * buffer = NULL;
-static int buffer_size = 0, buffer_filled = 0;
+static int buffer_size = 0, buffer_mask = 0;
+static int buffer_at = 0, buffer_filled = 0;
 static int prebuffer_filled = 0;
 static float * output = NULL;
-static int output_size = 0;
+static int output_size = 0, output_filled = 0;
+static bool_t flush_denormals = FALSE;
 
 static void reset (void)
 {
     state = STATE_OFF;
     current_channels = 0;
     current_rate = 0;
-    free (buffer);
-    buffer = NULL;
-    buffer_size = 0;
+    buffer_at = 0;
     buffer_filled = 0;
     prebuffer_filled = 0;
-    free (output);
-    output = NULL;
-    output_size = 0;
+    output_filled = 0;
 }
 
 static bool_t crossfade_init (void)
@@ -70,6 +81,46 @@ static bool_t crossfade_init (void)
 static void crossfade_cleanup (void)
 {
     reset ();
+    free (buffer);
+    buffer = NULL;
+    buffer_size = 0;
+    free (output);
+    output = NULL;
+    output_size = 0;
+}
+
+/* Grows the ring if needed, keeping its contents.  Called only at the start of
+ * a song. */
+static void prepare_buffer (void)
+{
+    int needed = current_length + current_channels * current_rate;
+    int size = 1;
+
+    while (size < needed)
+        size <<= 1;
+
+    if (size > buffer_size)
+    {
+        float * old = buffer;
+        buffer = malloc (sizeof (float) * size);
+
+        int first = MIN (buffer_filled, buffer_size - buffer_at);
+        if (first)
+            memcpy (buffer, old + buffer_at, sizeof (float) * first);
+        if (buffer_filled - first)
+            memcpy (buffer + first, old, sizeof (float) * (buffer_filled - first));
+
+        free (old);
+        buffer_size = size;
+        buffer_mask = size - 1;
+        buffer_at = 0;
+    }
+
+    if (output_size < current_channels * current_rate)
+    {
+        output_size = current_channels * current_rate;
+        output = realloc (output, sizeof (float) * output_size);
+    }
 }
 
 static void crossfade_start (int * channels, int * rate)
@@ -94,32 +145,137 @@ static void crossfade_start (int * channels, int * rate)
     state = STATE_PREBUFFER;
     current_channels = * channels;
     current_rate = * rate;
+    current_length = current_channels * current_rate * aud_get_int ("crossfade", "length");
     prebuffer_filled = 0;
+    flush_denormals = aud_get_bool ("crossfade", "flush_denormals");
+
+    prepare_buffer ();
+}
+
+/* Equal-power fade curves: the gain at frame i of n is sin (pi/2 * i / n) when
+ * fading in and cos (pi/2 * i / n) when fading out, so that the summed power of
+ * the two songs stays constant through the overlap.  Successive gains are
+ * found by rotating a unit vector, which costs four multiplies per frame
+ * instead of a call to sin() and cos(). */
+
+typedef struct {
+    double sin, cos, step_sin, step_cos;
+} Curve;
+
+static void curve_init (Curve * curve, int frame, int frames)
+{
+    double step = M_PI / 2 / MAX (frames, 1);
+
+    curve->sin = sin (step * frame);
+    curve->cos = cos (step * frame);
+    curve->step_sin = sin (step);
+    curve->step_cos = cos (step);
+}
+
+static void curve_next (Curve * curve)
+{
+    double next_sin = curve->sin * curve->step_cos + curve->cos * curve->step_sin;
+    curve->cos = curve->cos * curve->step_cos - curve->sin * curve->step_sin;
+    curve->sin = next_sin;
 }
 
-static void do_ramp (float * data, int length, float a, float b)
+#define RING(i) buffer[(buffer_at + (i)) & buffer_mask]
+
+/* Fades out the whole tail in place. */
+static void fade_out (void)
 {
-    int count;
+    int frames = buffer_filled / current_channels;
+    Curve curve;
+
+    curve_init (& curve, 0, frames);
 
-    for (count = 0; count < length; count ++)
+    for (int f = 0, i = 0; f < frames; f ++)
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        float gain = curve.cos;
+
+        for (int c = 0; c < current_channels; c ++, i ++)
+            RING (i) *= gain;
+
+        curve_next (& curve);
+    }
+}
+
+/* Mixes new samples into the ring at the given offset, fading them in. */
+static void fade_in_mix (int offset, const float * data, int length)
+{
+    int frames = length / current_channels;
+    Curve curve;
+
+    curve_init (& curve, offset / current_channels, current_length / current_channels);
+
+    for (int f = 0; f < frames; f ++)
+    {
+        float gain = curve.sin;
+
+        for (int c = 0; c < current_channels; c ++)
+            RING (offset ++) += gain * (* data ++);
+
+        curve_next (& curve);
     }
 }
 
-static void mix (float * data, float * new, int length)
+static void mix (int offset, const float * data, int length)
 {
     while (length --)
-        (* data ++) += (* new ++);
+        RING (offset ++) += (* data ++);
 }
 
-static void enlarge_buffer (int length)
+static void output_append (int offset, int length)
 {
-    if (length > buffer_size)
+    if (output_size < output_filled + length)
     {
-        buffer = realloc (buffer, sizeof (float) * length);
-        buffer_size = length;
+        /* only if a single block is larger than the ring */
+        output_size = output_filled + length;
+        output = realloc (output, sizeof (float) * output_size);
+    }
+
+    int start = (buffer_at + offset) & buffer_mask;
+    int first = MIN (length, buffer_size - start);
+
+    memcpy (output + output_filled, buffer + start, sizeof (float) * first);
+    memcpy (output + output_filled + first, buffer, sizeof (float) * (length - first));
+    output_filled += length;
+}
+
+/* Moves everything older than the overlap out of the ring. */
+static void spill (void)
+{
+    int copy = buffer_filled - current_length;
+
+    if (copy <= 0)
+        return;
+
+    output_append (0, copy);
+    buffer_at = (buffer_at + copy) & buffer_mask;
+    buffer_filled -= copy;
+}
+
+static void append (const float * data, int length)
+{
+    while (length)
+    {
+        int writable = MIN (length, buffer_size - buffer_filled);
+
+        if (! writable)
+        {
+            spill ();
+            continue;
+        }
+
+        int start = (buffer_at + buffer_filled) & buffer_mask;
+        int first = MIN (writable, buffer_size - start);
+
+        memcpy (buffer + start, data, sizeof (float) * first);
+        memcpy (buffer, data + first, sizeof (float) * (writable - first));
+
+        buffer_filled += writable;
+        data += writable;
+        length -= writable;
     }
 }
 
@@ -127,24 +283,21 @@ static void add_data (float * data, int length)
 {
     if (state == STATE_PREBUFFER)
     {
-        int full = current_channels * current_rate * aud_get_int ("crossfade", "length");
+        int full = current_length;
 
         if (prebuffer_filled < full)
         {
             int copy = MIN (length, full - prebuffer_filled);
-            float a = (float) prebuffer_filled / full;
-            float b = (float) (prebuffer_filled + copy) / full;
 
             if (prebuffer_filled + copy > buffer_filled)
             {
-                enlarge_buffer (prebuffer_filled + copy);
-                memset (buffer + buffer_filled, 0, sizeof (float) *
-                 (prebuffer_filled + copy - buffer_filled));
+                for (int i = buffer_filled; i < prebuffer_filled + copy; i ++)
+                    RING (i) = 0;
+
                 buffer_filled = prebuffer_filled + copy;
             }
 
-            do_ramp (data, copy, a, b);
-            mix (buffer + prebuffer_filled, data, copy);
+            fade_in_mix (prebuffer_filled, data, copy);
             prebuffer_filled += copy;
             data += copy;
             length -= copy;
@@ -157,7 +310,7 @@ static void add_data (float * data, int length)
         {
             int copy = MIN (length, buffer_filled - prebuffer_filled);
 
-            mix (buffer + prebuffer_filled, data, copy);
+            mix (prebuffer_filled, data, copy);
             prebuffer_filled += copy;
             data += copy;
             length -= copy;
@@ -172,45 +325,55 @@ static void add_data (float * data, int length)
     if (state != STATE_RUNNING)
         return;
 
-    enlarge_buffer (buffer_filled + length);
-    memcpy (buffer + buffer_filled, data, sizeof (float) * length);
-    buffer_filled += length;
+    append (data, length);
 }
 
-static void enlarge_output (int length)
+/* Returns everything in the output buffer, plus everything in the ring beyond
+ * the given number of samples to keep. */
+static void return_data (float * * data, int * length, int keep)
 {
-    if (length > output_size)
+    int copy = buffer_filled - keep;
+
+    if (state != STATE_RUNNING && state != STATE_BETWEEN)
+        copy = 0;
+
+    if (! output_filled)
     {
-        output = realloc (output, sizeof (float) * length);
-        output_size = length;
-    }
-}
+        int start = buffer_at;
 
-static void return_data (float * * data, int * length)
-{
-    int full = current_channels * current_rate * aud_get_int ("crossfade", "length");
-    int copy = buffer_filled - full;
+        copy = MAX (copy, 0);
+
+        if (copy <= buffer_size - start)
+        {
+            buffer_at = (buffer_at + copy) & buffer_mask;
+            buffer_filled -= copy;
+            * data = buffer + start;
+            * length = copy;
+            return;
+        }
+    }
 
-    /* only return if we have at least 1/2 second -- this reduces memmove's */
-    if (state != STATE_RUNNING || copy < current_channels * (current_rate / 2))
+    if (copy > 0)
     {
-        * data = NULL;
-        * length = 0;
-        return;
+        output_append (0, copy);
+        buffer_at = (buffer_at + copy) & buffer_mask;
+        buffer_filled -= copy;
     }
 
-    enlarge_output (copy);
-    memcpy (output, buffer, sizeof (float) * copy);
-    buffer_filled -= copy;
-    memmove (buffer, buffer + copy, sizeof (float) * buffer_filled);
     * data = output;
-    * length = copy;
+    * length = output_filled;
+    output_filled = 0;
 }
 
 static void crossfade_process (float * * data, int * samples)
 {
+    DenormalState fpu;
+    denormal_begin (& fpu, flush_denormals);
+
     add_data (* data, * samples);
-    return_data (data, samples);
+    return_data (data, samples, current_length);
+
+    denormal_end (& fpu);
 }
 
 static void crossfade_flush (void)
@@ -224,25 +387,27 @@ static void crossfade_flush (void)
 
 static void crossfade_finish (float * * data, int * samples)
 {
+    DenormalState fpu;
+    denormal_begin (& fpu, flush_denormals);
+
     if (state == STATE_BETWEEN) /* second call, end of last song */
     {
-        enlarge_output (buffer_filled);
-        memcpy (output, buffer, sizeof (float) * buffer_filled);
-        * data = output;
-        * samples = buffer_filled;
-        buffer_filled = 0;
+        return_data (data, samples, 0);
         state = STATE_OFF;
-        return;
     }
-
-    add_data (* data, * samples);
-    return_data (data, samples);
-
-    if (state == STATE_PREBUFFER || state == STATE_RUNNING)
+    else
     {
-        do_ramp (buffer, buffer_filled, 1.0, 0.0);
-        state = STATE_BETWEEN;
+        add_data (* data, * samples);
+        return_data (data, samples, current_length);
+
+        if (state == STATE_PREBUFFER || state == STATE_RUNNING)
+        {
+            fade_out ();
+            state = STATE_BETWEEN;
+        }
     }
+
+    denormal_end (& fpu);
 }
 
 static int crossfade_adjust_delay (int delay)
@@ -258,12 +423,16 @@ static const PreferencesWidget crossfade_widgets[] = {
  {WIDGET_LABEL, N_("<b>Crossfade</b>")},
  {WIDGET_SPIN_BTN, N_("Overlap:"),
   .cfg_type = VALUE_INT, .csect = "crossfade", .cname = "length",
-  .data = {.spin_btn = {1, 10, 1, N_("seconds")}}}};
+  .data = {.spin_btn = {1, 10, 1, N_("seconds")}}},
+ {WIDGET_CHK_BTN, N_("Flush denormals (avoids slowdowns in silence)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "crossfade", .cname = "flush_denormals"}};
 
 static const PluginPreferences crossfade_prefs = {
  .widgets = crossfade_widgets,
  .n_widgets = sizeof crossfade_widgets / sizeof crossfade_widgets[0]};
 
+PERFSTAT_EFFECT (N_("Crossfade"), crossfade_start, crossfade_process, crossfade_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Crossfade"),
@@ -272,10 +441,10 @@ AUD_EFFECT_PLUGIN
     .prefs = & crossfade_prefs,
     .init = crossfade_init,
     .cleanup = crossfade_cleanup,
-    .start = crossfade_start,
-    .process = crossfade_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = crossfade_flush,
-    .finish = crossfade_finish,
+    .finish = perfstat_finish,
     .adjust_delay = crossfade_adjust_delay,
     .order = 5, /* must be after resample and mixer */
     .preserves_format = TRUE
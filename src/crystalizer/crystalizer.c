@@ -26,7 +26,10 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../perfstat/perfstat.h"
+
 static bool_t init (void);
+static void cryst_update_config (void);
 static void cryst_start (int * channels, int * rate);
 static void cryst_process (float * * data, int * samples);
 static void cryst_flush ();
@@ -40,31 +43,46 @@ static const PreferencesWidget cryst_widgets[] = {
  {WIDGET_LABEL, N_("<b>Crystalizer</b>")},
  {WIDGET_SPIN_BTN, N_("Intensity:"),
   .cfg_type = VALUE_FLOAT, .csect = "crystalizer", .cname = "intensity",
+  .callback = cryst_update_config,
   .data = {.spin_btn = {0, 10, 0.1}}}};
 
 static const PluginPreferences cryst_prefs = {
  .widgets = cryst_widgets,
  .n_widgets = sizeof cryst_widgets / sizeof cryst_widgets[0]};
 
+PERFSTAT_EFFECT (N_("Crystalizer"), cryst_start, cryst_process, cryst_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Crystalizer"),
     .domain = PACKAGE,
     .prefs = & cryst_prefs,
     .init = init,
-    .start = cryst_start,
-    .process = cryst_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = cryst_flush,
-    .finish = cryst_finish,
+    .finish = perfstat_finish,
     .preserves_format = TRUE
 )
 
 static int cryst_channels;
 static float * cryst_prev;
 
+/* An intensity of 0 leaves the audio as it is; the block is then only looked
+ * at to remember its last frame.  When the setting changes, the intensity
+ * glides from the old value to the new one over the next block. */
+static float target_value, current_value;
+
+static void cryst_update_config (void)
+{
+    target_value = aud_get_double ("crystalizer", "intensity");
+}
+
 static bool_t init (void)
 {
     aud_config_set_defaults ("crystalizer", cryst_defaults);
+    cryst_update_config ();
+    current_value = target_value;
     return TRUE;
 }
 
@@ -73,15 +91,29 @@ static void cryst_start (int * channels, int * rate)
     cryst_channels = * channels;
     cryst_prev = realloc (cryst_prev, sizeof (float) * cryst_channels);
     memset (cryst_prev, 0, sizeof (float) * cryst_channels);
+    current_value = target_value;
 }
 
 static void cryst_process (float * * data, int * samples)
 {
-    float value = aud_get_double ("crystalizer", "intensity");
+    float target = target_value;
+    float value = current_value;
     float * f = * data;
     float * end = f + (* samples);
     int channel;
 
+    if (* samples < cryst_channels)
+        return;
+
+    if (value == target && value == 0)
+    {
+        memcpy (cryst_prev, end - cryst_channels, sizeof (float) * cryst_channels);
+        return;
+    }
+
+    /* zero unless the intensity is gliding */
+    float step = (target - value) / (* samples / cryst_channels);
+
     while (f < end)
     {
         for (channel = 0; channel < cryst_channels; channel ++)
@@ -91,7 +123,11 @@ static void cryst_process (float * * data, int * samples)
             * f ++ = current + (current - cryst_prev[channel]) * value;
             cryst_prev[channel] = current;
         }
+
+        value += step;
     }
+
+    current_value = target;
 }
 
 static void cryst_flush ()
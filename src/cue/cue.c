@@ -17,8 +17,10 @@
  * the use of this software.
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <libcue/libcue.h>
 
@@ -27,37 +29,94 @@
 #include <audacious/plugin.h>
 #include <libaudcore/audstrings.h>
 
+/* Parsed sheets are kept around so that loading the same sheet again (adding
+ * a folder twice, reopening a saved playlist) needs neither libcue nor a probe
+ * of the audio files.  Entries are checked against the mtime and size of the
+ * sheet and of each audio file before use. */
+
+#define CACHE_SIZE 256
+
 typedef struct {
-    int tuple_type;
-    int pti;
-} TuplePTIMap;
+    char * filename;    /* pooled */
+    int begin, length;  /* length is -1 if the sheet does not give it */
+    char * title, * performer; /* pooled, may be NULL */
+} CueTrack;
 
-TuplePTIMap pti_map[] = {
-    { FIELD_ARTIST, PTI_PERFORMER },
-    { FIELD_TITLE, PTI_TITLE },
-};
+typedef struct {
+    char * filename;    /* pooled */
+    time_t mtime;
+    int64_t size;
+    bool_t scanned;
+    Tuple * tuple;      /* may be NULL if no decoder was found */
+} CueFile;
 
-static void
-tuple_attach_cdtext(Tuple *tuple, Track *track, int tuple_type, int pti)
+typedef struct {
+    char * filename;    /* pooled */
+    time_t mtime;
+    int64_t size;
+    int n_tracks, n_files;
+    CueTrack * tracks;
+    CueFile * files;
+} CueSheet;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Index * cache;
+
+static bool_t get_mtime (const char * uri, time_t * mtime, int64_t * size)
 {
-    Cdtext *cdtext;
-    const char *text;
+    if (strncmp (uri, "file://", 7))
+        return FALSE;
 
-    cdtext = track_get_cdtext(track);
-    if (cdtext == NULL)
-        return;
+    char * path = uri_to_filename (uri);
+    if (! path)
+        return FALSE;
 
-    text = cdtext_get(pti, cdtext);
-    if (text == NULL)
-        return;
+    struct stat st;
+    bool_t ok = ! stat (path, & st);
+    free (path);
 
-    tuple_set_str(tuple, tuple_type, NULL, text);
+    if (! ok)
+        return FALSE;
+
+    * mtime = st.st_mtime;
+    * size = st.st_size;
+    return TRUE;
 }
 
-static bool_t playlist_load_cue (const char * cue_filename, VFSFile * file,
- char * * title, Index * filenames, Index * tuples)
+static const char * get_cdtext (Track * track, int pti)
+{
+    Cdtext * cdtext = track_get_cdtext (track);
+    return cdtext ? cdtext_get (pti, cdtext) : NULL;
+}
+
+static void sheet_free (CueSheet * sheet)
+{
+    for (int i = 0; i < sheet->n_tracks; i ++)
+    {
+        str_unref (sheet->tracks[i].filename);
+        str_unref (sheet->tracks[i].title);
+        str_unref (sheet->tracks[i].performer);
+    }
+
+    for (int i = 0; i < sheet->n_files; i ++)
+    {
+        str_unref (sheet->files[i].filename);
+        if (sheet->files[i].tuple)
+            tuple_unref (sheet->files[i].tuple);
+    }
+
+    str_unref (sheet->filename);
+    free (sheet->tracks);
+    free (sheet->files);
+    free (sheet);
+}
+
+static CueSheet * sheet_parse (const char * cue_filename, VFSFile * file)
 {
     int64_t size = vfs_fsize (file);
+    if (size < 0)
+        return NULL;
+
     char * buffer = malloc (size + 1);
     size = vfs_fread (buffer, 1, size, file);
     buffer[size] = 0;
@@ -65,98 +124,237 @@ static bool_t playlist_load_cue (const char * cue_filename, VFSFile * file,
     char * text = str_to_utf8 (buffer);
     free (buffer);
     if (text == NULL)
-        return FALSE;
-
-    * title = NULL;
+        return NULL;
 
     Cd * cd = cue_parse_string (text);
     free (text);
     if (cd == NULL)
-        return FALSE;
+        return NULL;
 
     int tracks = cd_get_ntrack (cd);
     if (tracks == 0)
-        return FALSE;
-
-    Track * current = cd_get_track (cd, 1);
-    if (current == NULL)
-        return FALSE;
-
-    char * track_filename = track_get_filename (current);
-    if (track_filename == NULL)
-        return FALSE;
+    {
+        cd_delete (cd);
+        return NULL;
+    }
 
-    char * filename = aud_construct_uri (track_filename, cue_filename);
+    CueSheet * sheet = calloc (1, sizeof (CueSheet));
+    sheet->filename = str_get (cue_filename);
+    sheet->tracks = calloc (tracks, sizeof (CueTrack));
+    sheet->files = calloc (tracks, sizeof (CueFile));
 
-    Tuple * base_tuple = NULL;
-    bool_t base_tuple_scanned = FALSE;
+    char * filename = NULL;
 
     for (int track = 1; track <= tracks; track ++)
     {
-        if (current == NULL || filename == NULL)
-            return FALSE;
+        Track * current = cd_get_track (cd, track);
+        char * track_filename = current ? track_get_filename (current) : NULL;
 
-        if (base_tuple == NULL && ! base_tuple_scanned)
-        {
-            base_tuple_scanned = TRUE;
-            PluginHandle * decoder = aud_file_find_decoder (filename, FALSE);
-            if (decoder != NULL)
-                base_tuple = aud_file_read_tuple (filename, decoder);
-        }
+        if (track_filename == NULL)
+            goto ERR;
+
+        char * uri = aud_construct_uri (track_filename, cue_filename);
+        if (uri == NULL)
+            goto ERR;
+
+        str_unref (filename);
+        filename = str_get (uri);
+        free (uri);
+
+        if (! sheet->n_files || strcmp (sheet->files[sheet->n_files - 1].filename, filename))
+            sheet->files[sheet->n_files ++].filename = str_ref (filename);
 
         Track * next = (track + 1 <= tracks) ? cd_get_track (cd, track + 1) : NULL;
-        char * next_filename = (next != NULL) ? aud_construct_uri
-         (track_get_filename (next), cue_filename) : NULL;
-        bool_t last_track = (next_filename == NULL || strcmp (next_filename, filename));
+        char * next_filename = next ? track_get_filename (next) : NULL;
+        bool_t last_track = (next_filename == NULL || strcmp (next_filename,
+         track_filename));
+
+        CueTrack * t = & sheet->tracks[sheet->n_tracks ++];
+        t->filename = str_ref (filename);
+        t->begin = (int64_t) track_get_start (current) * 1000 / 75;
+        t->length = last_track ? -1 : (int64_t) track_get_length (current) * 1000 / 75;
+        t->title = str_get (get_cdtext (current, PTI_TITLE));
+        t->performer = str_get (get_cdtext (current, PTI_PERFORMER));
+    }
+
+    str_unref (filename);
+    cd_delete (cd);
+    return sheet;
+
+ERR:
+    str_unref (filename);
+    cd_delete (cd);
+    sheet_free (sheet);
+    return NULL;
+}
+
+/* Removes the sheet from the cache while it is in use, so that another thread
+ * loading the same sheet simply parses it again.  Called with cache_mutex
+ * held. */
+static CueSheet * cache_take (const char * cue_filename, time_t mtime, int64_t size)
+{
+    if (! cache)
+        return NULL;
+
+    for (int i = 0; i < index_count (cache); i ++)
+    {
+        CueSheet * sheet = index_get (cache, i);
+        if (strcmp (sheet->filename, cue_filename))
+            continue;
+
+        index_delete (cache, i, 1);
+
+        if (sheet->mtime == mtime && sheet->size == size)
+            return sheet;
+
+        /* stale */
+        sheet_free (sheet);
+        return NULL;
+    }
+
+    return NULL;
+}
+
+/* called with cache_mutex held */
+static void cache_add (CueSheet * sheet)
+{
+    if (! cache)
+        cache = index_new ();
+
+    if (index_count (cache) >= CACHE_SIZE)
+    {
+        sheet_free (index_get (cache, 0));
+        index_delete (cache, 0, 1);
+    }
+
+    index_append (cache, sheet);
+}
 
-        Tuple * tuple = (base_tuple != NULL) ? tuple_copy (base_tuple) :
-         tuple_new_from_filename (filename);
-        tuple_set_int (tuple, FIELD_TRACK_NUMBER, NULL, track);
+/* Probes an audio file unless the probe from an earlier load is still valid.
+ * The sheet is private to the caller here, so cache_mutex is not needed. */
+static void file_scan (CueFile * f)
+{
+    time_t mtime = 0;
+    int64_t size = 0;
+    bool_t local = get_mtime (f->filename, & mtime, & size);
+
+    if (f->scanned && local && f->mtime == mtime && f->size == size)
+        return;
+
+    if (f->tuple)
+    {
+        tuple_unref (f->tuple);
+        f->tuple = NULL;
+    }
+
+    PluginHandle * decoder = aud_file_find_decoder (f->filename, FALSE);
+    if (decoder != NULL)
+        f->tuple = aud_file_read_tuple (f->filename, decoder);
+
+    f->scanned = local;
+    f->mtime = mtime;
+    f->size = size;
+}
+
+static void sheet_make_tuples (CueSheet * sheet, Index * filenames, Index * tuples)
+{
+    CueFile * f = NULL;
+
+    for (int i = 0; i < sheet->n_tracks; i ++)
+    {
+        CueTrack * t = & sheet->tracks[i];
 
-        int begin = (int64_t) track_get_start (current) * 1000 / 75;
-        tuple_set_int (tuple, FIELD_SEGMENT_START, NULL, begin);
+        if (! f || strcmp (f->filename, t->filename))
+            f = f ? f + 1 : sheet->files;
 
-        if (last_track)
+        Tuple * tuple = f->tuple ? tuple_copy (f->tuple) :
+         tuple_new_from_filename (t->filename);
+        tuple_set_int (tuple, FIELD_TRACK_NUMBER, NULL, i + 1);
+        tuple_set_int (tuple, FIELD_SEGMENT_START, NULL, t->begin);
+
+        if (t->length < 0)
         {
-            if (base_tuple != NULL && tuple_get_value_type (base_tuple,
+            if (f->tuple != NULL && tuple_get_value_type (f->tuple,
              FIELD_LENGTH, NULL) == TUPLE_INT)
                 tuple_set_int (tuple, FIELD_LENGTH, NULL, tuple_get_int
-                 (base_tuple, FIELD_LENGTH, NULL) - begin);
+                 (f->tuple, FIELD_LENGTH, NULL) - t->begin);
         }
         else
         {
-            int length = (int64_t) track_get_length (current) * 1000 / 75;
-            tuple_set_int (tuple, FIELD_LENGTH, NULL, length);
-            tuple_set_int (tuple, FIELD_SEGMENT_END, NULL, begin + length);
+            tuple_set_int (tuple, FIELD_LENGTH, NULL, t->length);
+            tuple_set_int (tuple, FIELD_SEGMENT_END, NULL, t->begin + t->length);
         }
 
-        for (int i = 0; i < sizeof pti_map / sizeof pti_map[0]; i ++)
-            tuple_attach_cdtext (tuple, current, pti_map[i].tuple_type, pti_map[i].pti);
+        if (t->performer)
+            tuple_set_str (tuple, FIELD_ARTIST, NULL, t->performer);
+        if (t->title)
+            tuple_set_str (tuple, FIELD_TITLE, NULL, t->title);
 
-        index_append (filenames, str_get (filename));
+        index_append (filenames, str_ref (t->filename));
         index_append (tuples, tuple);
+    }
+}
 
-        current = next;
-        free (filename);
-        filename = next_filename;
+static bool_t playlist_load_cue (const char * cue_filename, VFSFile * file,
+ char * * title, Index * filenames, Index * tuples)
+{
+    * title = NULL;
 
-        if (last_track && base_tuple != NULL)
-        {
-            tuple_unref (base_tuple);
-            base_tuple = NULL;
-            base_tuple_scanned = FALSE;
-        }
+    time_t mtime = 0;
+    int64_t size = 0;
+    bool_t local = get_mtime (cue_filename, & mtime, & size);
+
+    CueSheet * sheet = NULL;
+
+    if (local)
+    {
+        pthread_mutex_lock (& cache_mutex);
+        sheet = cache_take (cue_filename, mtime, size);
+        pthread_mutex_unlock (& cache_mutex);
+    }
+
+    if (! sheet && ! (sheet = sheet_parse (cue_filename, file)))
+        return FALSE;
+
+    for (int i = 0; i < sheet->n_files; i ++)
+        file_scan (& sheet->files[i]);
+
+    sheet_make_tuples (sheet, filenames, tuples);
+
+    if (local)
+    {
+        sheet->mtime = mtime;
+        sheet->size = size;
+
+        pthread_mutex_lock (& cache_mutex);
+        cache_add (sheet);
+        pthread_mutex_unlock (& cache_mutex);
     }
+    else
+        sheet_free (sheet);
 
     return TRUE;
 }
 
+static void cue_cleanup (void)
+{
+    if (! cache)
+        return;
+
+    for (int i = 0; i < index_count (cache); i ++)
+        sheet_free (index_get (cache, i));
+
+    index_free (cache);
+    cache = NULL;
+}
+
 static const char * const cue_exts[] = {"cue", NULL};
 
 AUD_PLAYLIST_PLUGIN
 (
  .name = N_("Cue Sheet Plugin"),
  .domain = PACKAGE,
+ .cleanup = cue_cleanup,
  .extensions = cue_exts,
  .load = playlist_load_cue
 )
@@ -0,0 +1,307 @@
+/*
+ * Decode-ahead Thread for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "decodeahead.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <audacious/debug.h>
+#include <audacious/misc.h>
+
+#define MAX_AHEAD_MS 10000
+
+static const char * const decodeahead_defaults[] = {
+ "ahead_ms", "500",
+ NULL};
+
+static void * render_thread (void * data)
+{
+    DecodeAhead * d = data;
+    bool_t ok = d->func (d, d->user);
+
+    pthread_mutex_lock (& d->mutex);
+    d->ok = ok;
+    d->at_end = TRUE;
+    pthread_cond_broadcast (& d->cond);
+    pthread_mutex_unlock (& d->mutex);
+
+    return NULL;
+}
+
+/* Copies from the ring to the output until the render function is done and
+ * the ring is empty, or until stopped.  A seek flushes the output at once, and
+ * everything in the ring is thrown away until the render thread has moved to
+ * the new position. */
+static void copy_out (DecodeAhead * d)
+{
+    pthread_mutex_lock (& d->mutex);
+
+    while (! d->quit)
+    {
+        if (d->flushed_serial != d->seek_serial)
+        {
+            int time = d->seek_time;
+            d->flushed_serial = d->seek_serial;
+
+            pthread_mutex_unlock (& d->mutex);
+            d->playback->output->flush (time);
+            pthread_mutex_lock (& d->mutex);
+            continue;
+        }
+
+        if (d->done_serial != d->seek_serial)
+        {
+            d->head = d->tail;
+            pthread_cond_broadcast (& d->cond);
+            pthread_cond_wait (& d->cond, & d->mutex);
+            continue;
+        }
+
+        if (d->head < d->skip_to)
+            d->head = d->skip_to;
+
+        int avail = d->tail - d->head;
+
+        if (! avail)
+        {
+            if (d->at_end)
+            {
+                d->drained = TRUE;
+                pthread_cond_broadcast (& d->cond);
+                break;
+            }
+
+            pthread_cond_wait (& d->cond, & d->mutex);
+            continue;
+        }
+
+        int offset = d->head % d->size;
+        int len = MIN (MIN (avail, d->size - offset), d->chunk);
+
+        /* the render thread does not touch data that has been written */
+        pthread_mutex_unlock (& d->mutex);
+        d->playback->output->write_audio (d->ring + offset, len);
+        pthread_mutex_lock (& d->mutex);
+
+        d->head += len;
+        pthread_cond_broadcast (& d->cond);
+    }
+
+    pthread_mutex_unlock (& d->mutex);
+}
+
+bool_t decodeahead_play (DecodeAhead * d, InputPlayback * playback, int rate,
+ int frame_size, DecodeAheadFunc func, void * user)
+{
+    aud_config_set_defaults ("decodeahead", decodeahead_defaults);
+
+    int ms = CLAMP (aud_get_int ("decodeahead", "ahead_ms"), 0, MAX_AHEAD_MS);
+    int frames = (int64_t) rate * ms / 1000;
+
+    pthread_mutex_lock (& d->mutex);
+
+    d->playback = playback;
+    d->func = func;
+    d->user = user;
+    d->active = TRUE;
+    d->quit = d->at_end = d->drained = FALSE;
+    d->ok = TRUE;
+
+    d->size = frames * frame_size;
+    d->chunk = MAX (frames / 4, 1) * frame_size;
+    d->ring = d->size ? malloc (d->size) : NULL;
+    d->head = d->tail = d->skip_to = 0;
+
+    d->seek_time = d->taken_time = -1;
+    d->seek_serial = d->taken_serial = d->done_serial = d->flushed_serial = 0;
+
+    d->threaded = d->ring && ! pthread_create (& d->thread, NULL,
+     render_thread, d);
+
+    pthread_mutex_unlock (& d->mutex);
+
+    bool_t ok;
+
+    if (d->threaded)
+    {
+        AUDDBG ("Rendering up to %d ms ahead.\n", ms);
+
+        copy_out (d);
+
+        /* the render thread may still be waiting for room */
+        pthread_mutex_lock (& d->mutex);
+        d->quit = TRUE;
+        pthread_cond_broadcast (& d->cond);
+        pthread_mutex_unlock (& d->mutex);
+
+        pthread_join (d->thread, NULL);
+        ok = d->ok;
+    }
+    else
+        ok = func (d, user);
+
+    pthread_mutex_lock (& d->mutex);
+
+    d->active = d->threaded = FALSE;
+    free (d->ring);
+    d->ring = NULL;
+
+    pthread_mutex_unlock (& d->mutex);
+
+    return ok;
+}
+
+bool_t decodeahead_write (DecodeAhead * d, const void * data, int len)
+{
+    const unsigned char * in = data;
+
+    if (! d->threaded)
+    {
+        d->playback->output->write_audio ((void *) data, len);
+
+        pthread_mutex_lock (& d->mutex);
+        bool_t quit = d->quit;
+        pthread_mutex_unlock (& d->mutex);
+
+        return ! quit;
+    }
+
+    pthread_mutex_lock (& d->mutex);
+
+    while (len > 0 && ! d->quit)
+    {
+        int space = d->size - (int) (d->tail - d->head);
+
+        if (! space)
+        {
+            pthread_cond_wait (& d->cond, & d->mutex);
+            continue;
+        }
+
+        int offset = d->tail % d->size;
+        int copy = MIN (MIN (space, d->size - offset), len);
+
+        /* the play thread does not touch free space */
+        pthread_mutex_unlock (& d->mutex);
+        memcpy (d->ring + offset, in, copy);
+        pthread_mutex_lock (& d->mutex);
+
+        d->tail += copy;
+        in += copy;
+        len -= copy;
+
+        pthread_cond_broadcast (& d->cond);
+    }
+
+    bool_t quit = d->quit;
+    pthread_mutex_unlock (& d->mutex);
+
+    return ! quit;
+}
+
+int decodeahead_get_seek (DecodeAhead * d)
+{
+    int time = -1;
+
+    pthread_mutex_lock (& d->mutex);
+
+    if (d->done_serial != d->seek_serial)
+    {
+        d->taken_serial = d->seek_serial;
+        d->taken_time = time = d->seek_time;
+    }
+
+    pthread_mutex_unlock (& d->mutex);
+    return time;
+}
+
+void decodeahead_seek_done (DecodeAhead * d)
+{
+    pthread_mutex_lock (& d->mutex);
+
+    /* a later seek stays pending */
+    d->done_serial = d->taken_serial;
+    d->skip_to = d->tail;
+    d->at_end = FALSE;
+
+    pthread_cond_broadcast (& d->cond);
+
+    if (! d->threaded)
+    {
+        int time = d->taken_time;
+        d->flushed_serial = d->taken_serial;
+
+        pthread_mutex_unlock (& d->mutex);
+        d->playback->output->flush (time);
+        return;
+    }
+
+    pthread_mutex_unlock (& d->mutex);
+}
+
+bool_t decodeahead_finish (DecodeAhead * d)
+{
+    bool_t seek;
+
+    pthread_mutex_lock (& d->mutex);
+
+    if (d->threaded)
+    {
+        d->at_end = TRUE;
+        pthread_cond_broadcast (& d->cond);
+
+        while (! d->drained && ! d->quit && d->done_serial == d->seek_serial)
+            pthread_cond_wait (& d->cond, & d->mutex);
+    }
+
+    seek = (! d->drained && ! d->quit && d->done_serial != d->seek_serial);
+
+    pthread_mutex_unlock (& d->mutex);
+    return seek;
+}
+
+void decodeahead_seek (DecodeAhead * d, int time)
+{
+    pthread_mutex_lock (& d->mutex);
+
+    if (d->active && ! d->quit)
+    {
+        d->seek_time = time;
+        d->seek_serial ++;
+        d->playback->output->abort_write ();
+        pthread_cond_broadcast (& d->cond);
+    }
+
+    pthread_mutex_unlock (& d->mutex);
+}
+
+void decodeahead_stop (DecodeAhead * d)
+{
+    pthread_mutex_lock (& d->mutex);
+
+    if (d->active && ! d->quit)
+    {
+        d->quit = TRUE;
+        d->playback->output->abort_write ();
+        pthread_cond_broadcast (& d->cond);
+    }
+
+    pthread_mutex_unlock (& d->mutex);
+}
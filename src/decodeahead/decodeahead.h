@@ -0,0 +1,108 @@
+/*
+ * Decode-ahead Thread for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_DECODEAHEAD_H
+#define AUDACIOUS_DECODEAHEAD_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <audacious/plugin.h>
+
+/* Emulator plugins mostly render a block of audio and then pass it to
+ * write_audio, which blocks while the output buffer is full.  Nothing is
+ * rendered while it blocks, so a block that is slow to render can let the
+ * output run dry.  A DecodeAhead moves the rendering to a thread of its own,
+ * which keeps a ring filled some way ahead of the output, while the play
+ * thread only moves data from the ring to write_audio.  How far ahead is
+ * "ahead_ms" in the "decodeahead" config section (500 ms by default); 0 turns
+ * the thread off.
+ *
+ * The plugin's render function runs on the render thread.  It passes what it
+ * renders to decodeahead_write, and between blocks asks decodeahead_get_seek
+ * for a pending seek; after moving to the new position it calls
+ * decodeahead_seek_done, and the output continues from there with nothing
+ * rendered before heard.  At the end of the song it calls decodeahead_finish,
+ * which waits for the output to catch up, in case a seek comes in meanwhile.
+ * It returns once decodeahead_write or decodeahead_finish returns FALSE.
+ *
+ * The plugin's stop and mseek functions call decodeahead_stop and
+ * decodeahead_seek, which are safe to call at any time, playing or not.
+ *
+ * The ring is locked only to move its read and write positions, never while
+ * copying.  If the thread cannot be started or is turned off, the render
+ * function runs on the play thread and writes go straight to the output. */
+
+typedef struct _DecodeAhead DecodeAhead;
+
+/* Returns FALSE on error. */
+typedef bool_t (* DecodeAheadFunc) (DecodeAhead * d, void * user);
+
+struct _DecodeAhead {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    InputPlayback * playback;
+    DecodeAheadFunc func;
+    void * user;
+    pthread_t thread;
+    bool_t active, threaded, quit, at_end, drained, ok;
+
+    unsigned char * ring;
+    int size, chunk;            /* bytes */
+    int64_t head, tail;         /* bytes read and written so far */
+    int64_t skip_to;            /* data before this was rendered before a seek */
+
+    int seek_time, taken_time;
+    int seek_serial, taken_serial, done_serial, flushed_serial;
+};
+
+#define DECODEAHEAD_INIT {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Called on the play thread once the output is open.  Runs func and copies
+ * what it renders to the output until it returns; returns what it returned,
+ * or TRUE if stopped. */
+bool_t decodeahead_play (DecodeAhead * d, InputPlayback * playback, int rate,
+ int frame_size, DecodeAheadFunc func, void * user);
+
+/* Render thread only.  Waits for room in the ring; returns FALSE once
+ * playback is being stopped. */
+bool_t decodeahead_write (DecodeAhead * d, const void * data, int len);
+
+/* Render thread only.  Returns the time to seek to in milliseconds, or -1. */
+int decodeahead_get_seek (DecodeAhead * d);
+void decodeahead_seek_done (DecodeAhead * d);
+
+/* Render thread only, at the end of the song.  Returns TRUE if there is a
+ * seek to handle after all, FALSE once everything has been written out or
+ * playback is being stopped. */
+bool_t decodeahead_finish (DecodeAhead * d);
+
+void decodeahead_seek (DecodeAhead * d, int time);
+void decodeahead_stop (DecodeAhead * d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * Denormal Protection for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "denormal.h"
+
+#if defined (__SSE_MATH__)
+#include <xmmintrin.h>
+
+#define MXCSR_FTZ 0x8000
+#define MXCSR_DAZ 0x0040
+
+/* DAZ is missing on some early 32-bit SSE processors, where setting it
+ * faults; every x86-64 processor has it. */
+#if defined (__x86_64__)
+#define MXCSR_FLAGS (MXCSR_FTZ | MXCSR_DAZ)
+#else
+#define MXCSR_FLAGS MXCSR_FTZ
+#endif
+
+static unsigned int get_mode (void)
+{
+    return _mm_getcsr ();
+}
+
+static void set_mode (unsigned int mode)
+{
+    _mm_setcsr (mode);
+}
+
+#define FLUSH_FLAGS MXCSR_FLAGS
+#define HAVE_FLUSH
+
+#elif defined (__aarch64__)
+
+static unsigned int get_mode (void)
+{
+    unsigned long fpcr;
+    __asm__ __volatile__ ("mrs %0, fpcr" : "=r" (fpcr));
+    return fpcr;
+}
+
+static void set_mode (unsigned int mode)
+{
+    unsigned long fpcr = mode;
+    __asm__ __volatile__ ("msr fpcr, %0" : : "r" (fpcr));
+}
+
+#define FLUSH_FLAGS (1 << 24) /* FZ */
+#define HAVE_FLUSH
+
+#elif defined (__arm__) && defined (__ARM_FP)
+
+static unsigned int get_mode (void)
+{
+    unsigned int fpscr;
+    __asm__ __volatile__ ("vmrs %0, fpscr" : "=r" (fpscr));
+    return fpscr;
+}
+
+static void set_mode (unsigned int mode)
+{
+    __asm__ __volatile__ ("vmsr fpscr, %0" : : "r" (mode));
+}
+
+#define FLUSH_FLAGS (1 << 24) /* FZ */
+#define HAVE_FLUSH
+
+#endif
+
+bool_t denormal_begin (DenormalState * state, bool_t enable)
+{
+    state->saved = 0;
+    state->changed = FALSE;
+
+#ifdef HAVE_FLUSH
+    if (enable)
+    {
+        state->saved = get_mode ();
+
+        if ((state->saved & FLUSH_FLAGS) != FLUSH_FLAGS)
+        {
+            set_mode (state->saved | FLUSH_FLAGS);
+            state->changed = TRUE;
+        }
+
+        return TRUE;
+    }
+#endif
+
+    return FALSE;
+}
+
+void denormal_end (const DenormalState * state)
+{
+#ifdef HAVE_FLUSH
+    if (state->changed)
+        set_mode (state->saved);
+#endif
+}
@@ -0,0 +1,49 @@
+/*
+ * Denormal Protection for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_DENORMAL_H
+#define AUDACIOUS_DENORMAL_H
+
+#include <libaudcore/core.h>
+
+/* Subnormal ("denormal") floats turn up wherever a signal decays toward zero:
+ * echo and filter feedback, envelope followers, the tail of a fade.  Many CPUs
+ * take a slow path for them, up to a hundred times slower on x86, so that an
+ * effect can use more CPU on near-silence than on music.
+ *
+ * Effects wrap their processing in denormal_begin() and denormal_end().  These
+ * switch the floating point unit of the calling thread to flush subnormals to
+ * zero (and, where it can, to treat subnormal inputs as zero), and then put
+ * the previous mode back.  Where the hardware has no such mode, nothing
+ * changes and denormal_begin() returns FALSE; code with its own feedback loop
+ * can then add DENORMAL_DC to what it feeds back, which keeps the loop clear
+ * of the subnormal range at an inaudible cost. */
+
+#define DENORMAL_DC 1e-18f
+
+typedef struct {
+    unsigned int saved;
+    bool_t changed;
+} DenormalState;
+
+/* Does nothing (and returns FALSE) unless enable is set. */
+bool_t denormal_begin (DenormalState * state, bool_t enable);
+void denormal_end (const DenormalState * state);
+
+#endif
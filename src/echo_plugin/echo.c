@@ -1,47 +1,99 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../denormal/denormal.h"
+#include "../perfstat/perfstat.h"
+
 #define MAX_DELAY 1000
-#define MAX_SRATE 50000
-#define MAX_CHANNELS 2
-#define BYTES_PS sizeof(float)
-#define BUFFER_SAMPLES (MAX_SRATE * MAX_DELAY / 1000)
-#define BUFFER_SHORTS (BUFFER_SAMPLES * MAX_CHANNELS)
-#define BUFFER_BYTES (BUFFER_SHORTS * BYTES_PS)
+#define GLIDE_TIME 0.05 /* seconds */
 
 static const char * const echo_defaults[] = {
  "delay", "500",
  "feedback", "50",
  "volume", "50",
+ "flush_denormals", "TRUE",
  NULL};
 
+static void echo_update_config (void);
+
 static const PreferencesWidget echo_widgets[] = {
  {WIDGET_LABEL, N_("<b>Echo</b>")},
  {WIDGET_SPIN_BTN, N_("Delay:"),
   .cfg_type = VALUE_INT, .csect = "echo_plugin", .cname = "delay",
+  .callback = echo_update_config,
   .data = {.spin_btn = {0, MAX_DELAY, 10, N_("ms")}}},
  {WIDGET_SPIN_BTN, N_("Feedback:"),
   .cfg_type = VALUE_INT, .csect = "echo_plugin", .cname = "feedback",
+  .callback = echo_update_config,
   .data = {.spin_btn = {0, 100, 1, "%"}}},
  {WIDGET_SPIN_BTN, N_("Volume:"),
   .cfg_type = VALUE_INT, .csect = "echo_plugin", .cname = "volume",
-  .data = {.spin_btn = {0, 100, 1, "%"}}}};
+  .callback = echo_update_config,
+  .data = {.spin_btn = {0, 100, 1, "%"}}},
+ {WIDGET_CHK_BTN, N_("Flush denormals (avoids slowdowns in silence)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "echo_plugin", .cname = "flush_denormals",
+  .callback = echo_update_config}};
 
 static const PluginPreferences echo_prefs = {
  .widgets = echo_widgets,
  .n_widgets = sizeof echo_widgets / sizeof echo_widgets[0]};
 
-static float *buffer = NULL;
-static int w_ofs;
+/* The delay line holds interleaved frames in a power-of-two ring, long enough
+ * for MAX_DELAY at the current rate.  While the delay is steady, it is read at
+ * a whole number of frames behind the write position, in spans short enough
+ * that nothing written within a span is read back in the same span; the inner
+ * loop is then a plain multiply-add over contiguous memory.  When the delay
+ * setting changes, the read position glides toward the new delay and samples
+ * are interpolated between frames, which avoids clicks. */
+
+static float * buffer = NULL;
+static int buffer_frames, buffer_mask;
+static int w_ofs; /* in frames */
+
+static int echo_channels = 0;
+static int echo_rate = 0;
+
+/* parameter snapshot, updated when the settings change */
+static int config_delay;
+static float config_feedback, config_volume;
+static bool_t config_flush;
+
+/* added to the feedback where subnormals cannot be flushed in hardware */
+static float feedback_dc;
+
+static float target_delay, current_delay; /* in frames */
+
+/* With the volume at 0 the echo cannot be heard, so the audio is passed
+ * through untouched and the delay line is left to go stale.  It is cleared
+ * when the echo is turned back up, so that what comes back is only what was
+ * played after that. */
+static bool_t bypassed;
+
+static void echo_update_config (void)
+{
+    config_delay = aud_get_int ("echo_plugin", "delay");
+    config_feedback = aud_get_int ("echo_plugin", "feedback") / 100.0;
+    config_volume = aud_get_int ("echo_plugin", "volume") / 100.0;
+    config_flush = aud_get_bool ("echo_plugin", "flush_denormals");
+
+    if (echo_rate)
+        target_delay = fmaxf (1, roundf ((float) echo_rate * config_delay / 1000));
+}
 
 static bool_t init (void)
 {
     aud_config_set_defaults ("echo_plugin", echo_defaults);
+    echo_update_config ();
     return TRUE;
 }
 
@@ -51,58 +103,162 @@ static void cleanup(void)
     buffer = NULL;
 }
 
-static int echo_channels = 0;
-static int echo_rate = 0;
-
 static void echo_start(int *channels, int *rate)
 {
     static int old_srate, old_nch;
 
-    if (buffer == NULL)
-        buffer = malloc (BUFFER_BYTES);
-
     echo_channels = *channels;
     echo_rate = *rate;
 
-    if (echo_channels != old_nch || echo_rate != old_srate)
+    if (buffer == NULL || echo_channels != old_nch || echo_rate != old_srate)
     {
-        memset(buffer, 0, BUFFER_BYTES);
+        int needed = (int64_t) echo_rate * MAX_DELAY / 1000 + 2;
+
+        for (buffer_frames = 1; buffer_frames < needed; buffer_frames <<= 1)
+            ;
+
+        buffer_mask = buffer_frames - 1;
+
+        free (buffer);
+        buffer = calloc (buffer_frames * echo_channels, sizeof (float));
         w_ofs = 0;
         old_nch = echo_channels;
         old_srate = echo_rate;
     }
+
+    echo_update_config ();
+    current_delay = target_delay;
+}
+
+static void run_span (float * data, float * write, const float * read, int
+ samples, float volume, float feedback)
+{
+    float dc = feedback_dc;
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 vvol = _mm_set1_ps (volume);
+    __m128 vfb = _mm_set1_ps (feedback);
+    __m128 vdc = _mm_set1_ps (dc);
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128 in = _mm_loadu_ps (data + i);
+        __m128 echo = _mm_loadu_ps (read + i);
+        _mm_storeu_ps (data + i, _mm_add_ps (in, _mm_mul_ps (echo, vvol)));
+        _mm_storeu_ps (write + i, _mm_add_ps (_mm_add_ps (in, vdc), _mm_mul_ps (echo, vfb)));
+    }
+#endif
+
+    for (; i < samples; i ++)
+    {
+        float in = data[i];
+        float echo = read[i];
+        data[i] = in + echo * volume;
+        write[i] = in + dc + echo * feedback;
+    }
+}
+
+static void process_steady (float * data, int frames, int delay)
+{
+    float volume = config_volume, feedback = config_feedback;
+
+    while (frames > 0)
+    {
+        int r_ofs = (w_ofs - delay) & buffer_mask;
+        int span = frames;
+
+        if (span > delay)
+            span = delay;
+        if (span > buffer_frames - w_ofs)
+            span = buffer_frames - w_ofs;
+        if (span > buffer_frames - r_ofs)
+            span = buffer_frames - r_ofs;
+
+        run_span (data, buffer + w_ofs * echo_channels, buffer + r_ofs *
+         echo_channels, span * echo_channels, volume, feedback);
+
+        data += span * echo_channels;
+        frames -= span;
+        w_ofs = (w_ofs + span) & buffer_mask;
+    }
+}
+
+static void process_gliding (float * data, int frames)
+{
+    float volume = config_volume, feedback = config_feedback;
+    float glide = 1 - expf (-1 / (GLIDE_TIME * echo_rate));
+
+    for (; frames > 0; frames --)
+    {
+        current_delay += (target_delay - current_delay) * glide;
+        if (fabsf (target_delay - current_delay) < 0.01)
+            current_delay = target_delay;
+
+        float pos = w_ofs - current_delay;
+        int a = (int) floorf (pos);
+        float frac = pos - a;
+
+        float * read_a = buffer + (a & buffer_mask) * echo_channels;
+        float * read_b = buffer + ((a + 1) & buffer_mask) * echo_channels;
+        float * write = buffer + w_ofs * echo_channels;
+
+        for (int c = 0; c < echo_channels; c ++)
+        {
+            float in = data[c];
+            float echo = read_a[c] + (read_b[c] - read_a[c]) * frac;
+            data[c] = in + echo * volume;
+            write[c] = in + feedback_dc + echo * feedback;
+        }
+
+        data += echo_channels;
+        w_ofs = (w_ofs + 1) & buffer_mask;
+    }
 }
 
 static void echo_process(float **d, int *samples)
 {
-    int delay = aud_get_int ("echo_plugin", "delay");
-    int feedback = aud_get_int ("echo_plugin", "feedback");
-    int volume = aud_get_int ("echo_plugin", "volume");
+    float * data = * d;
+    int frames = * samples / echo_channels;
+
+    if (config_volume == 0)
+    {
+        bypassed = TRUE;
+        return;
+    }
+
+    if (bypassed)
+    {
+        memset (buffer, 0, sizeof (float) * buffer_frames * echo_channels);
+        current_delay = target_delay;
+        bypassed = FALSE;
+    }
 
-    float in, out, buf;
-    int r_ofs;
-    float *data = *d;
-    float *end = *d + *samples;
+    DenormalState fpu;
+    bool_t flushing = denormal_begin (& fpu, config_flush);
+    feedback_dc = (config_flush && ! flushing) ? DENORMAL_DC : 0;
+
+    while (frames > 0 && current_delay != target_delay)
+    {
+        /* glide in small steps so that a steady delay is detected quickly */
+        int step = frames < 64 ? frames : 64;
 
-    r_ofs = w_ofs - (echo_rate * delay / 1000) * echo_channels;
-    if (r_ofs < 0)
-        r_ofs += BUFFER_SHORTS;
+        process_gliding (data, step);
+        data += step * echo_channels;
+        frames -= step;
+    }
 
-    for (; data < end; data++)
+    if (frames > 0)
     {
-        in = *data;
-
-        buf = buffer[r_ofs];
-        out = in + buf * volume / 100;
-        buf = in + buf * feedback / 100;
-        buffer[w_ofs] = buf;
-        *data = out;
-
-        if (++r_ofs >= BUFFER_SHORTS)
-            r_ofs -= BUFFER_SHORTS;
-        if (++w_ofs >= BUFFER_SHORTS)
-            w_ofs -= BUFFER_SHORTS;
+        int delay = (int) current_delay;
+
+        if (delay == current_delay)
+            process_steady (data, frames, delay);
+        else
+            process_gliding (data, frames);
     }
+
+    denormal_end (& fpu);
 }
 
 static void echo_finish(float **d, int *samples)
@@ -115,6 +271,8 @@ static const char echo_about[] =
     "By Johan Levin, 1999\n\n"
     "Surround echo by Carl van Schaik, 1999");
 
+PERFSTAT_EFFECT (N_("Echo"), echo_start, echo_process, echo_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Echo"),
@@ -123,8 +281,8 @@ AUD_EFFECT_PLUGIN
     .prefs = & echo_prefs,
     .init = init,
     .cleanup = cleanup,
-    .start = echo_start,
-    .process = echo_process,
-    .finish = echo_finish,
+    .start = perfstat_start,
+    .process = perfstat_process,
+    .finish = perfstat_finish,
     .preserves_format = TRUE
 )
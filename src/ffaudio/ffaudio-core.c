@@ -25,7 +25,10 @@
  */
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #undef FFAUDIO_DOUBLECHECK  /* Doublecheck probing result for debugging purposes */
 #undef FFAUDIO_NO_BLACKLIST /* Don't blacklist any recognized codecs/formats */
@@ -36,13 +39,34 @@
 #include <audacious/audtag.h>
 #include <libaudcore/audstrings.h>
 
+#include "../pcmconv/pcmconv.h"
+#include "../warmup/warmup.h"
+
 static pthread_mutex_t ctrl_mutex = PTHREAD_MUTEX_INITIALIZER;
 static gint64 seek_value = -1;
 static gboolean stop_flag = FALSE;
+static Demuxer * demuxer; /* while playing */
 
 static pthread_mutex_t data_mutex = PTHREAD_MUTEX_INITIALIZER;
 static GHashTable * extension_dict = NULL;
 
+/* Probing by content runs every demuxer over the start of the file, and the
+ * same file is probed, read for its tuple and played in turn; so the result
+ * (including "unknown" and "cannot be opened") is remembered for as long as
+ * the file keeps its size and modification time. */
+typedef struct {
+    gint64 size, mtime;
+    AVInputFormat * format;     /* NULL if unknown */
+    gboolean open_failed;
+} ProbeEntry;
+
+#define PROBE_CACHE_MAX 4096
+
+/* samples per channel, when the codec does not say */
+#define DEFAULT_FRAME_SIZE 4608
+
+static GHashTable * probe_cache = NULL; /* filename -> ProbeEntry */
+
 /* str_unref() may be a macro */
 static void str_unref_cb (void * str)
 {
@@ -72,19 +96,46 @@ static gint lockmgr (void * * mutexp, enum AVLockOp op)
     return 0;
 }
 
-static gboolean ffaudio_init (void)
+static GHashTable * create_extension_dict (void);
+
+/* Registering every demuxer and codec, and indexing the demuxers by extension,
+ * is done in the background (see warmup.h), and waited for in get_format(),
+ * which is where every use of FFmpeg begins. */
+static void ffaudio_warm_up (void)
 {
     av_register_all();
+
+    GHashTable * dict = create_extension_dict ();
+
+    pthread_mutex_lock (& data_mutex);
+    if (extension_dict)
+        g_hash_table_destroy (extension_dict);
+    extension_dict = dict;
+    pthread_mutex_unlock (& data_mutex);
+}
+
+static Warmup warmup = WARMUP_INIT (N_("FFmpeg Plugin"), ffaudio_warm_up);
+
+static gboolean ffaudio_init (void)
+{
+    gint64 init_begin = perfstat_now ();
+
     av_lockmgr_register (lockmgr);
 
+    warmup_start (& warmup, init_begin);
     return TRUE;
 }
 
 static void
 ffaudio_cleanup(void)
 {
+    warmup_stop (& warmup);
+
     if (extension_dict)
         g_hash_table_destroy (extension_dict);
+    extension_dict = NULL;
+    if (probe_cache)
+        g_hash_table_destroy (probe_cache);
 
     av_lockmgr_register (NULL);
 }
@@ -201,10 +252,100 @@ static AVInputFormat * get_format_by_content (const gchar * name, VFSFile * file
     return f;
 }
 
+static void probe_entry_free (void * entry)
+{
+    g_slice_free (ProbeEntry, entry);
+}
+
+/* Streams are not cached, since they have no fixed contents. */
+static gboolean get_file_stamp (const gchar * name, VFSFile * file,
+ gint64 * size, gint64 * mtime)
+{
+    if (vfs_is_streaming (file) || (* size = vfs_fsize (file)) < 0)
+        return FALSE;
+
+    gchar * local = g_filename_from_uri (name, NULL, NULL);
+    struct stat st;
+
+    * mtime = 0;
+
+    if (local && ! g_stat (local, & st))
+        * mtime = (gint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    g_free (local);
+    return TRUE;
+}
+
+static gboolean probe_cache_lookup (const gchar * name, VFSFile * file,
+ ProbeEntry * out)
+{
+    gint64 size, mtime;
+    gboolean found = FALSE;
+
+    if (! get_file_stamp (name, file, & size, & mtime))
+        return FALSE;
+
+    pthread_mutex_lock (& data_mutex);
+
+    ProbeEntry * e = probe_cache ? g_hash_table_lookup (probe_cache, name) : NULL;
+
+    if (e && e->size == size && e->mtime == mtime)
+    {
+        * out = * e;
+        found = TRUE;
+    }
+
+    pthread_mutex_unlock (& data_mutex);
+    return found;
+}
+
+static void probe_cache_store (const gchar * name, VFSFile * file,
+ AVInputFormat * f, gboolean open_failed)
+{
+    gint64 size, mtime;
+
+    if (! get_file_stamp (name, file, & size, & mtime))
+        return;
+
+    ProbeEntry * e = g_slice_new (ProbeEntry);
+    e->size = size;
+    e->mtime = mtime;
+    e->format = f;
+    e->open_failed = open_failed;
+
+    pthread_mutex_lock (& data_mutex);
+
+    if (! probe_cache)
+        probe_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+         probe_entry_free);
+
+    /* A library scan can probe any number of files. */
+    if (g_hash_table_size (probe_cache) >= PROBE_CACHE_MAX)
+        g_hash_table_remove_all (probe_cache);
+
+    g_hash_table_replace (probe_cache, g_strdup (name), e);
+
+    pthread_mutex_unlock (& data_mutex);
+}
+
 static AVInputFormat * get_format (const gchar * name, VFSFile * file)
 {
+    ProbeEntry e;
+
+    warmup_wait (& warmup);
+
+    if (probe_cache_lookup (name, file, & e))
+    {
+        AUDDBG ("Format %s (cached).\n", e.format ? e.format->name : "unknown");
+        return e.open_failed ? NULL : e.format;
+    }
+
     AVInputFormat * f = get_format_by_extension (name);
-    return f ? f : get_format_by_content (name, file);
+    if (! f)
+        f = get_format_by_content (name, file);
+
+    probe_cache_store (name, file, f, FALSE);
+    return f;
 }
 
 static AVFormatContext * open_input_file (const gchar * name, VFSFile * file)
@@ -227,6 +368,7 @@ static AVFormatContext * open_input_file (const gchar * name, VFSFile * file)
     {
         fprintf (stderr, "ffaudio: avformat_open_input failed for %s: %s.\n", name, ffaudio_strerror (ret));
         io_context_free (io);
+        probe_cache_store (name, file, f, TRUE);
         return NULL;
     }
 
@@ -398,6 +540,51 @@ static gboolean ffaudio_write_tag (const Tuple * tuple, VFSFile * file)
     return tag_tuple_write(tuple, file, TAG_TYPE_NONE);
 }
 
+static void write_frame (InputPlayback * playback, AVFrame * frame,
+ gint out_fmt, gboolean planar, gint channels, void * * buf, gint * bufsize)
+{
+    gint size = FMT_SIZEOF (out_fmt) * channels * frame->nb_samples;
+
+    if (planar)
+    {
+        if (* bufsize < size)
+        {
+            * buf = realloc (* buf, size);
+            * bufsize = size;
+        }
+
+        pcm_interleave ((const void * const *) frame->data, out_fmt, channels,
+         * buf, frame->nb_samples);
+        playback->output->write_audio (* buf, size);
+    }
+    else
+        playback->output->write_audio (frame->data[0], size);
+}
+
+/* Decoders with a delay (including any using frame threads) keep frames
+ * back until they are given empty packets at the end. */
+static void drain_decoder (InputPlayback * playback, AVCodecContext * c,
+ AVFrame * frame, gint out_fmt, gboolean planar, void * * buf, gint * bufsize)
+{
+    if (! (c->codec->capabilities & CODEC_CAP_DELAY))
+        return;
+
+    while (! stop_flag)
+    {
+        AVPacket empty;
+        av_init_packet (& empty);
+        empty.data = NULL;
+        empty.size = 0;
+
+        int decoded = 0;
+
+        if (avcodec_decode_audio4 (c, frame, & decoded, & empty) < 0 || ! decoded)
+            break;
+
+        write_frame (playback, frame, out_fmt, planar, c->channels, buf, bufsize);
+    }
+}
+
 static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
  VFSFile * file, gint start_time, gint stop_time, gboolean pause)
 {
@@ -409,7 +596,8 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
     AVCodecContext *c = NULL;
     AVStream *s = NULL;
     AVPacket pkt = {.data = NULL};
-    gint i, stream_id, errcount;
+    AVFrame * frame = NULL;
+    gint i, stream_id;
     gboolean codec_opened = FALSE;
     gint out_fmt;
     gboolean planar;
@@ -445,6 +633,14 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
 
     AUDDBG("got codec %s for stream index %d, opening\n", codec->name, stream_id);
 
+    /* Only a few audio decoders can use threads, but those that can are
+     * slow ones. */
+    if (codec->capabilities & (CODEC_CAP_FRAME_THREADS | CODEC_CAP_SLICE_THREADS))
+    {
+        c->thread_count = MAX (1, sysconf (_SC_NPROCESSORS_ONLN));
+        c->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
+
     if (avcodec_open2 (c, codec, NULL) < 0)
         goto error_exit;
 
@@ -467,6 +663,20 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
         goto error_exit;
     }
 
+    /* The decoder's buffers are reused from one frame to the next, and so is
+     * the interleaving buffer, which is sized up front for the largest frame
+     * the codec says it will put out.  Codecs with variable frame sizes get a
+     * guess and grow it if needed. */
+    if (! (frame = avcodec_alloc_frame ()))
+        goto error_exit;
+
+    if (planar)
+    {
+        bufsize = FMT_SIZEOF (out_fmt) * c->channels *
+         ((c->frame_size > 0) ? c->frame_size : DEFAULT_FRAME_SIZE);
+        buf = malloc (bufsize);
+    }
+
     /* Open audio output */
     AUDDBG("opening audio output\n");
 
@@ -487,10 +697,16 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
 
     pthread_mutex_lock (& ctrl_mutex);
 
+    if (! (demuxer = demux_start (ic, stream_id)))
+    {
+        pthread_mutex_unlock (& ctrl_mutex);
+        error = TRUE;
+        goto error_exit;
+    }
+
     stop_flag = FALSE;
     seek_value = (start_time > 0) ? start_time : -1;
     playback->set_pb_ready(playback);
-    errcount = 0;
     seekable = ffaudio_codec_is_seekable(codec);
 
     pthread_mutex_unlock (& ctrl_mutex);
@@ -506,41 +722,29 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
         if (seek_value >= 0 && seekable)
         {
             playback->output->flush (seek_value);
-            if (av_seek_frame (ic, -1, (gint64) seek_value * AV_TIME_BASE /
-             1000, AVSEEK_FLAG_ANY) < 0)
-            {
+            if (demux_seek (demuxer, seek_value) < 0)
                 _ERROR("error while seeking\n");
-            } else
-                errcount = 0;
+            else
+                avcodec_flush_buffers (c);
         }
         seek_value = -1;
         pthread_mutex_unlock (& ctrl_mutex);
 
         /* Read next frame (or more) of data */
-        if ((ret = av_read_frame(ic, &pkt)) < 0)
+        if ((ret = demux_get (demuxer, & pkt)) < 0)
         {
+            if (ret == AVERROR (EAGAIN))
+                continue;
+
             if (ret == AVERROR_EOF)
             {
                 AUDDBG("eof reached\n");
-                break;
+                drain_decoder (playback, c, frame, out_fmt, planar, & buf, & bufsize);
             }
             else
-            {
-                if (++errcount > 4)
-                {
-                    _ERROR("av_read_frame error %d, giving up.\n", ret);
-                    break;
-                } else
-                    continue;
-            }
-        } else
-            errcount = 0;
+                _ERROR("av_read_frame error %d, giving up.\n", ret);
 
-        /* Ignore any other substreams */
-        if (pkt.stream_index != stream_id)
-        {
-            av_free_packet(&pkt);
-            continue;
+            break;
         }
 
         /* Decode and play packet/frame */
@@ -561,7 +765,6 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
             }
             pthread_mutex_unlock (& ctrl_mutex);
 
-            AVFrame * frame = avcodec_alloc_frame ();
             int decoded = 0;
             int len = avcodec_decode_audio4 (c, frame, & decoded, & tmp);
 
@@ -577,24 +780,7 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
             if (! decoded)
                 continue;
 
-            gint size = FMT_SIZEOF (out_fmt) * c->channels * frame->nb_samples;
-
-            if (planar)
-            {
-                if (bufsize < size)
-                {
-                    buf = realloc (buf, size);
-                    bufsize = size;
-                }
-
-                audio_interlace ((const void * *) frame->data, out_fmt,
-                 c->channels, buf, frame->nb_samples);
-                playback->output->write_audio (buf, size);
-            }
-            else
-                playback->output->write_audio (frame->data[0], size);
-
-            av_free (frame);
+            write_frame (playback, frame, out_fmt, planar, c->channels, & buf, & bufsize);
         }
 
         if (pkt.data)
@@ -602,7 +788,16 @@ static gboolean ffaudio_play (InputPlayback * playback, const gchar * filename,
     }
 
 error_exit:
+    pthread_mutex_lock (& ctrl_mutex);
     stop_flag = TRUE;
+    pthread_mutex_unlock (& ctrl_mutex);
+
+    /* ffaudio_stop and ffaudio_seek no longer see the demuxer */
+    if (demuxer)
+    {
+        demux_stop (demuxer);
+        demuxer = NULL;
+    }
 
     if (pkt.data)
         av_free_packet(&pkt);
@@ -611,6 +806,7 @@ error_exit:
     if (ic != NULL)
         close_input_file(ic);
 
+    av_free (frame);
     free (buf);
 
     return ! error;
@@ -624,6 +820,9 @@ static void ffaudio_stop(InputPlayback * playback)
     {
         stop_flag = TRUE;
         playback->output->abort_write();
+
+        if (demuxer)
+            demux_interrupt (demuxer);
     }
 
     pthread_mutex_unlock (& ctrl_mutex);
@@ -647,6 +846,9 @@ static void ffaudio_seek (InputPlayback * playback, gint time)
     {
         seek_value = time;
         playback->output->abort_write();
+
+        if (demuxer)
+            demux_interrupt (demuxer);
     }
 
     pthread_mutex_unlock (& ctrl_mutex);
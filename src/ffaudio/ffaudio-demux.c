@@ -0,0 +1,253 @@
+/*
+ * ffaudio-demux.c
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ */
+
+
+#include <pthread.h>
+
+#include <glib.h>
+
+#include "ffaudio-stdinc.h"
+#include <audacious/debug.h>
+
+/* The demux thread reads packets of one stream into a queue ahead of the
+ * decoder, so that a slow read does not leave the output waiting.  Seeks are
+ * done by the demux thread too, since the format context is not safe to use
+ * from two threads at once. */
+
+#define MAX_PACKETS 512
+#define MAX_BYTES (4 << 20)
+#define MAX_ERRORS 4
+
+typedef struct {
+    AVPacket pkt;
+} QueuedPacket;
+
+struct Demuxer {
+    AVFormatContext * ic;
+    gint stream_id;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+
+    GQueue queue;            /* of QueuedPacket */
+    gint bytes;
+
+    gint64 seek_to;          /* AV_TIME_BASE units, or -1 */
+    gint seek_result;
+    gboolean seek_done;
+
+    gint status;             /* AVERROR_EOF or a read error once finished */
+    gboolean finished, interrupt, quit;
+};
+
+static void clear_queue_locked (Demuxer * d)
+{
+    QueuedPacket * q;
+
+    while ((q = g_queue_pop_head (& d->queue)))
+    {
+        av_free_packet (& q->pkt);
+        g_slice_free (QueuedPacket, q);
+    }
+
+    d->bytes = 0;
+}
+
+static void do_seek_locked (Demuxer * d)
+{
+    gint64 ts = d->seek_to;
+
+    pthread_mutex_unlock (& d->mutex);
+    gint ret = av_seek_frame (d->ic, -1, ts, AVSEEK_FLAG_ANY);
+    pthread_mutex_lock (& d->mutex);
+
+    clear_queue_locked (d);
+
+    d->seek_to = -1;
+    d->seek_result = ret;
+    d->seek_done = TRUE;
+    d->finished = FALSE;
+
+    pthread_cond_broadcast (& d->cond);
+}
+
+static void * demux_thread (void * data)
+{
+    Demuxer * d = data;
+    gint errcount = 0;
+
+    pthread_mutex_lock (& d->mutex);
+
+    while (! d->quit)
+    {
+        if (d->seek_to >= 0)
+        {
+            do_seek_locked (d);
+            errcount = 0;
+            continue;
+        }
+
+        if (d->finished || g_queue_get_length (& d->queue) >= MAX_PACKETS ||
+         d->bytes >= MAX_BYTES)
+        {
+            pthread_cond_wait (& d->cond, & d->mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock (& d->mutex);
+
+        AVPacket pkt;
+        gint ret = av_read_frame (d->ic, & pkt);
+
+        /* Packets are only valid until the next read unless duplicated. */
+        if (ret >= 0 && (pkt.stream_index != d->stream_id || av_dup_packet (& pkt) < 0))
+        {
+            av_free_packet (& pkt);
+            pthread_mutex_lock (& d->mutex);
+            continue;
+        }
+
+        pthread_mutex_lock (& d->mutex);
+
+        if (d->seek_to >= 0)
+        {
+            /* read from before the seek */
+            if (ret >= 0)
+                av_free_packet (& pkt);
+            continue;
+        }
+
+        if (ret < 0)
+        {
+            if (ret == AVERROR_EOF || ++ errcount > MAX_ERRORS)
+            {
+                d->status = ret;
+                d->finished = TRUE;
+                pthread_cond_broadcast (& d->cond);
+            }
+
+            continue;
+        }
+
+        errcount = 0;
+
+        QueuedPacket * q = g_slice_new (QueuedPacket);
+        q->pkt = pkt;
+        g_queue_push_tail (& d->queue, q);
+        d->bytes += pkt.size;
+
+        pthread_cond_broadcast (& d->cond);
+    }
+
+    pthread_mutex_unlock (& d->mutex);
+    return NULL;
+}
+
+Demuxer * demux_start (AVFormatContext * ic, gint stream_id)
+{
+    Demuxer * d = g_slice_new0 (Demuxer);
+
+    d->ic = ic;
+    d->stream_id = stream_id;
+    d->seek_to = -1;
+
+    pthread_mutex_init (& d->mutex, NULL);
+    pthread_cond_init (& d->cond, NULL);
+    g_queue_init (& d->queue);
+
+    if (pthread_create (& d->thread, NULL, demux_thread, d))
+    {
+        _ERROR ("Failed to start demux thread.\n");
+        pthread_mutex_destroy (& d->mutex);
+        pthread_cond_destroy (& d->cond);
+        g_slice_free (Demuxer, d);
+        return NULL;
+    }
+
+    return d;
+}
+
+void demux_stop (Demuxer * d)
+{
+    pthread_mutex_lock (& d->mutex);
+    d->quit = TRUE;
+    pthread_cond_broadcast (& d->cond);
+    pthread_mutex_unlock (& d->mutex);
+
+    pthread_join (d->thread, NULL);
+
+    clear_queue_locked (d);
+    pthread_mutex_destroy (& d->mutex);
+    pthread_cond_destroy (& d->cond);
+    g_slice_free (Demuxer, d);
+}
+
+gint demux_get (Demuxer * d, AVPacket * pkt)
+{
+    gint ret = 0;
+
+    pthread_mutex_lock (& d->mutex);
+
+    while (! g_queue_get_length (& d->queue) && ! d->finished && ! d->interrupt)
+        pthread_cond_wait (& d->cond, & d->mutex);
+
+    QueuedPacket * q = g_queue_pop_head (& d->queue);
+
+    if (q)
+    {
+        * pkt = q->pkt;
+        d->bytes -= pkt->size;
+        g_slice_free (QueuedPacket, q);
+        pthread_cond_broadcast (& d->cond);
+    }
+    else if (d->interrupt)
+        ret = AVERROR (EAGAIN);
+    else
+        ret = d->status;
+
+    d->interrupt = FALSE;
+
+    pthread_mutex_unlock (& d->mutex);
+    return ret;
+}
+
+gint demux_seek (Demuxer * d, gint64 time)
+{
+    pthread_mutex_lock (& d->mutex);
+
+    d->seek_to = time * AV_TIME_BASE / 1000;
+    d->seek_done = FALSE;
+    pthread_cond_broadcast (& d->cond);
+
+    while (! d->seek_done)
+        pthread_cond_wait (& d->cond, & d->mutex);
+
+    gint ret = d->seek_result;
+
+    pthread_mutex_unlock (& d->mutex);
+    return ret;
+}
+
+void demux_interrupt (Demuxer * d)
+{
+    pthread_mutex_lock (& d->mutex);
+    d->interrupt = TRUE;
+    pthread_cond_broadcast (& d->cond);
+    pthread_mutex_unlock (& d->mutex);
+}
@@ -33,4 +33,18 @@
 AVIOContext * io_context_new (VFSFile * file);
 void io_context_free (AVIOContext * context);
 
+typedef struct Demuxer Demuxer;
+
+Demuxer * demux_start (AVFormatContext * ic, gint stream_id);
+void demux_stop (Demuxer * d);
+
+/* Waits for the next packet of the stream and returns 0, or returns
+ * AVERROR_EOF or the read error that ended the stream, or AVERROR (EAGAIN)
+ * if woken by demux_interrupt. */
+gint demux_get (Demuxer * d, AVPacket * pkt);
+
+/* Discards the queue and seeks to time (in milliseconds); returns the result
+ * of av_seek_frame. */
+gint demux_seek (Demuxer * d, gint64 time);
+void demux_interrupt (Demuxer * d);
 #endif
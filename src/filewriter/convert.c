@@ -1,45 +1,455 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "convert.h"
+#include "../cpudispatch/cpudispatch.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define USE_X86
+#include <immintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+/* The kernels below handle the native-endian formats Audacious actually hands
+ * to an output plugin; any other pair goes through libaudcore.  Integer to
+ * integer conversions go through float, in a buffer kept from block to
+ * block.  The scaling matches libaudcore (full scale is 32767, not 32768).
+ *
+ * Conversion to 16 bits adds triangular dither of +/- 1 LSB.  Both halves of
+ * one xorshift word serve as the two uniform variables. */
+
+typedef void (* ConvertFunc) (const void * in, void * out, gint samples);
 
 gpointer convert_output = NULL;
+
 static gint nch;
 static gint in_fmt;
 static gint out_fmt;
 
+static ConvertFunc to_float, from_float; /* NULL if libaudcore is to be used */
+
+static void * buffer, * temp;
+static gint buffer_size, temp_size;
+
+static uint32_t dither_seed = 0x9e3779b9;
+static uint32_t dither_lanes[4] = {0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35};
+
+static inline uint32_t xorshift(uint32_t x)
+{
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static void float_to_s16_c(const void * in, void * out, gint samples)
+{
+    const float * f = in;
+    int16_t * s = out;
+    uint32_t x = dither_seed;
+
+    for (gint i = 0; i < samples; i ++)
+    {
+        x = xorshift (x);
+
+        float d = ((gint) (x >> 16) - (gint) (x & 0xffff)) * (1.0f / 65536);
+        float v = f[i] * 32767 + d;
+
+        s[i] = lrintf (CLAMP (v, -32768, 32767));
+    }
+
+    dither_seed = x;
+}
+
+static void s16_to_float_c(const void * in, void * out, gint samples)
+{
+    const int16_t * s = in;
+    float * f = out;
+
+    for (gint i = 0; i < samples; i ++)
+        f[i] = s[i] * (1.0f / 32767);
+}
+
+static void s24_to_float_c(const void * in, void * out, gint samples)
+{
+    const int32_t * s = in;
+    float * f = out;
+
+    /* the top byte is not guaranteed to hold the sign */
+    for (gint i = 0; i < samples; i ++)
+        f[i] = ((int32_t) ((uint32_t) s[i] << 8) >> 8) * (1.0f / 8388607);
+}
+
+static void s32_to_float_c(const void * in, void * out, gint samples)
+{
+    const int32_t * s = in;
+    float * f = out;
+
+    for (gint i = 0; i < samples; i ++)
+        f[i] = s[i] / 2147483647.0;
+}
+
+static void pack24_c(const void * in, void * out, gint samples)
+{
+    const char * src = in;
+    char * dest = out;
+
+    for (gint i = 0; i < samples; i ++)
+    {
+        memcpy (dest, src, 3);
+        src += 4;
+        dest += 3;
+    }
+}
+
+#ifdef USE_X86
+
+__attribute__ ((target ("sse2")))
+static inline __m128 dither_sse2(__m128i * state)
+{
+    __m128i x = * state;
+
+    x = _mm_xor_si128 (x, _mm_slli_epi32 (x, 13));
+    x = _mm_xor_si128 (x, _mm_srli_epi32 (x, 17));
+    x = _mm_xor_si128 (x, _mm_slli_epi32 (x, 5));
+    * state = x;
+
+    __m128i d = _mm_sub_epi32 (_mm_srli_epi32 (x, 16), _mm_and_si128 (x, _mm_set1_epi32 (0xffff)));
+    return _mm_mul_ps (_mm_cvtepi32_ps (d), _mm_set1_ps (1.0f / 65536));
+}
+
+__attribute__ ((target ("sse2")))
+static void float_to_s16_sse2(const void * in, void * out, gint samples)
+{
+    const float * f = in;
+    int16_t * s = out;
+
+    const __m128 scale = _mm_set1_ps (32767);
+    const __m128 lo = _mm_set1_ps (-32768);
+    const __m128 hi = _mm_set1_ps (32767);
+    __m128i state = _mm_loadu_si128 ((const __m128i *) dither_lanes);
+    gint i = 0;
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128 a = _mm_add_ps (_mm_mul_ps (_mm_loadu_ps (f + i), scale), dither_sse2 (& state));
+        __m128 b = _mm_add_ps (_mm_mul_ps (_mm_loadu_ps (f + i + 4), scale), dither_sse2 (& state));
+
+        a = _mm_min_ps (_mm_max_ps (a, lo), hi);
+        b = _mm_min_ps (_mm_max_ps (b, lo), hi);
+
+        /* rounds to nearest, like lrintf */
+        __m128i packed = _mm_packs_epi32 (_mm_cvtps_epi32 (a), _mm_cvtps_epi32 (b));
+        _mm_storeu_si128 ((__m128i *) (s + i), packed);
+    }
+
+    _mm_storeu_si128 ((__m128i *) dither_lanes, state);
+
+    float_to_s16_c (f + i, s + i, samples - i);
+}
+
+__attribute__ ((target ("sse2")))
+static void s16_to_float_sse2(const void * in, void * out, gint samples)
+{
+    const int16_t * s = in;
+    float * f = out;
+
+    const __m128 scale = _mm_set1_ps (1.0f / 32767);
+    gint i = 0;
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (s + i));
+
+        /* sign-extend by unpacking into the high halves and shifting down */
+        __m128i a = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i b = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+
+        _mm_storeu_ps (f + i, _mm_mul_ps (_mm_cvtepi32_ps (a), scale));
+        _mm_storeu_ps (f + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (b), scale));
+    }
+
+    s16_to_float_c (s + i, f + i, samples - i);
+}
+
+__attribute__ ((target ("sse2")))
+static void s24_to_float_sse2(const void * in, void * out, gint samples)
+{
+    const int32_t * s = in;
+    float * f = out;
+
+    const __m128 scale = _mm_set1_ps (1.0f / 8388607);
+    gint i = 0;
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (s + i));
+        v = _mm_srai_epi32 (_mm_slli_epi32 (v, 8), 8);
+        _mm_storeu_ps (f + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+
+    s24_to_float_c (s + i, f + i, samples - i);
+}
+
+__attribute__ ((target ("sse2")))
+static void s32_to_float_sse2(const void * in, void * out, gint samples)
+{
+    const int32_t * s = in;
+    float * f = out;
+
+    const __m128 scale = _mm_set1_ps (1.0f / 2147483647);
+    gint i = 0;
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (s + i));
+        _mm_storeu_ps (f + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+
+    s32_to_float_c (s + i, f + i, samples - i);
+}
+
+__attribute__ ((target ("ssse3")))
+static void pack24_ssse3(const void * in, void * out, gint samples)
+{
+    const char * src = in;
+    char * dest = out;
+
+    const __m128i shuffle = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13,
+     14, -1, -1, -1, -1);
+    gint i = 0;
+
+    /* Each store writes 16 bytes but advances by 12; the next store covers
+     * the extra 4, and stopping 8 samples short keeps the last one inside
+     * the output. */
+    for (; i + 8 <= samples; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + 4 * i));
+        _mm_storeu_si128 ((__m128i *) (dest + 3 * i), _mm_shuffle_epi8 (v, shuffle));
+    }
+
+    pack24_c (src + 4 * i, dest + 3 * i, samples - i);
+}
+
+#endif /* USE_X86 */
+
+#ifdef USE_NEON
+
+static inline float32x4_t dither_neon(uint32x4_t * state)
+{
+    uint32x4_t x = * state;
+
+    x = veorq_u32 (x, vshlq_n_u32 (x, 13));
+    x = veorq_u32 (x, vshrq_n_u32 (x, 17));
+    x = veorq_u32 (x, vshlq_n_u32 (x, 5));
+    * state = x;
+
+    int32x4_t d = vsubq_s32 (vreinterpretq_s32_u32 (vshrq_n_u32 (x, 16)),
+     vreinterpretq_s32_u32 (vandq_u32 (x, vdupq_n_u32 (0xffff))));
+    return vmulq_n_f32 (vcvtq_f32_s32 (d), 1.0f / 65536);
+}
+
+static void float_to_s16_neon(const void * in, void * out, gint samples)
+{
+    const float * f = in;
+    int16_t * s = out;
+
+    const float32x4_t lo = vdupq_n_f32 (-32768);
+    const float32x4_t hi = vdupq_n_f32 (32767);
+    const float32x4_t half = vdupq_n_f32 (0.5f);
+    uint32x4_t state = vld1q_u32 (dither_lanes);
+    gint i = 0;
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        float32x4_t v = vmlaq_n_f32 (dither_neon (& state), vld1q_f32 (f + i), 32767);
+        v = vminq_f32 (vmaxq_f32 (v, lo), hi);
+
+        /* vcvtq truncates; add +/- 0.5 first to round to nearest */
+        uint32x4_t neg = vcltq_f32 (v, vdupq_n_f32 (0));
+        v = vaddq_f32 (v, vbslq_f32 (neg, vnegq_f32 (half), half));
+
+        vst1_s16 (s + i, vqmovn_s32 (vcvtq_s32_f32 (v)));
+    }
+
+    vst1q_u32 (dither_lanes, state);
+
+    float_to_s16_c (f + i, s + i, samples - i);
+}
+
+static void s16_to_float_neon(const void * in, void * out, gint samples)
+{
+    const int16_t * s = in;
+    float * f = out;
+    gint i = 0;
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        int32x4_t v = vmovl_s16 (vld1_s16 (s + i));
+        vst1q_f32 (f + i, vmulq_n_f32 (vcvtq_f32_s32 (v), 1.0f / 32767));
+    }
+
+    s16_to_float_c (s + i, f + i, samples - i);
+}
+
+static void s24_to_float_neon(const void * in, void * out, gint samples)
+{
+    const int32_t * s = in;
+    float * f = out;
+    gint i = 0;
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        int32x4_t v = vshrq_n_s32 (vshlq_n_s32 (vld1q_s32 (s + i), 8), 8);
+        vst1q_f32 (f + i, vmulq_n_f32 (vcvtq_f32_s32 (v), 1.0f / 8388607));
+    }
+
+    s24_to_float_c (s + i, f + i, samples - i);
+}
+
+static void s32_to_float_neon(const void * in, void * out, gint samples)
+{
+    const int32_t * s = in;
+    float * f = out;
+    gint i = 0;
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        int32x4_t v = vld1q_s32 (s + i);
+        vst1q_f32 (f + i, vmulq_n_f32 (vcvtq_f32_s32 (v), 1.0f / 2147483647));
+    }
+
+    s32_to_float_c (s + i, f + i, samples - i);
+}
+
+#endif /* USE_NEON */
+
+static ConvertFunc pack24 = pack24_c;
+
+typedef struct {
+    CpuVariant variant;
+    ConvertFunc float_to_s16, s16_to_float, s24_to_float, s32_to_float;
+} ConvertSet;
+
+static const ConvertSet convert_sets[] = {
+#if defined (USE_X86)
+ {{"sse2", CPU_SSE2}, float_to_s16_sse2, s16_to_float_sse2, s24_to_float_sse2, s32_to_float_sse2},
+#elif defined (USE_NEON)
+ {{"neon", CPU_NEON}, float_to_s16_neon, s16_to_float_neon, s24_to_float_neon, s32_to_float_neon},
+#endif
+ {{"c"}, float_to_s16_c, s16_to_float_c, s24_to_float_c, s32_to_float_c}};
+
+static const struct {
+    CpuVariant variant;
+    ConvertFunc pack24;
+} pack24_sets[] = {
+#if defined (USE_X86)
+ {{"ssse3", CPU_SSSE3}, pack24_ssse3},
+#endif
+ {{"c"}, pack24_c}};
+
+static void select_kernels(void)
+{
+    const ConvertSet * set = CPU_DISPATCH ("filewriter convert", convert_sets);
+
+    pack24 = CPU_DISPATCH ("filewriter pack24", pack24_sets)->pack24;
+
+    switch (in_fmt)
+    {
+        case FMT_S16_NE: to_float = set->s16_to_float; break;
+        case FMT_S24_NE: to_float = set->s24_to_float; break;
+        case FMT_S32_NE: to_float = set->s32_to_float; break;
+        default: to_float = NULL; break;
+    }
+
+    from_float = (out_fmt == FMT_S16_NE) ? set->float_to_s16 : NULL;
+}
+
 gboolean convert_init(gint input_fmt, gint output_fmt, gint channels)
 {
     in_fmt = input_fmt;
     out_fmt = output_fmt;
     nch = channels;
 
+    select_kernels ();
+
     return TRUE;
 }
 
+static void * grow(void * * buf, gint * size, gint needed)
+{
+    if (* size < needed)
+    {
+        * buf = g_realloc (* buf, needed);
+        * size = needed;
+    }
+
+    return * buf;
+}
+
+static void float_to_out(const float * in, void * out, gint samples)
+{
+    if (from_float)
+        from_float (in, out, samples);
+    else
+        audio_to_int (in, out, out_fmt, samples);
+}
+
+static void in_to_float(const void * in, float * out, gint samples)
+{
+    if (to_float)
+        to_float (in, out, samples);
+    else
+        audio_from_int (in, in_fmt, out, samples);
+}
+
 gint convert_process(gpointer ptr, gint length)
 {
     gint samples = length / FMT_SIZEOF (in_fmt);
-    gfloat * temp;
-
-    convert_output = g_realloc (convert_output, FMT_SIZEOF (out_fmt) * samples);
 
+    /* Nothing to do; the encoders only read the data, so they can have the
+     * block as it came. */
     if (in_fmt == out_fmt)
-        memcpy (convert_output, ptr, FMT_SIZEOF (in_fmt) * samples);
-    else if (in_fmt == FMT_FLOAT)
-        audio_to_int (ptr, convert_output, out_fmt, samples);
+    {
+        convert_output = ptr;
+        return length;
+    }
+
+    convert_output = grow (& buffer, & buffer_size, FMT_SIZEOF (out_fmt) * samples);
+
+    if (in_fmt == FMT_FLOAT)
+        float_to_out (ptr, convert_output, samples);
     else if (out_fmt == FMT_FLOAT)
-        audio_from_int (ptr, in_fmt, convert_output, samples);
+        in_to_float (ptr, convert_output, samples);
     else
     {
-        temp = g_malloc (sizeof (gfloat) * samples);
-        audio_from_int (ptr, in_fmt, temp, samples);
-        audio_to_int (temp, convert_output, out_fmt, samples);
-        g_free (temp);
+        /* S32 to S16 could use the output buffer for the floats, but S16
+         * to S32 could not; keep it simple. */
+        float * f = grow (& temp, & temp_size, sizeof (float) * samples);
+        in_to_float (ptr, f, samples);
+        float_to_out (f, convert_output, samples);
     }
 
     return FMT_SIZEOF (out_fmt) * samples;
 }
 
+void convert_pack24(const void *in, void *out, gint samples)
+{
+    pack24 (in, out, samples);
+}
+
 void convert_free(void)
 {
-    g_free (convert_output);
+    g_free (buffer);
+    buffer = NULL;
+    buffer_size = 0;
+
+    g_free (temp);
+    temp = NULL;
+    temp_size = 0;
+
     convert_output = NULL;
 }
@@ -3,12 +3,17 @@
 
 #include "filewriter.h"
 
-gpointer convert_output;
+/* Points either to the input block itself, when no conversion is needed, or
+ * to a buffer owned by convert.c. */
+extern gpointer convert_output;
 
 gboolean convert_init(gint input_fmt, gint output_fmt, gint channels);
 
 gint convert_process(gpointer ptr, gint length);
 
+/* Packs 24-bit little-endian samples held in 32 bits into 3 bytes each. */
+void convert_pack24(const void *in, void *out, gint samples);
+
 void convert_free(void);
 
 #endif
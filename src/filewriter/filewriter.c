@@ -32,6 +32,9 @@
 #include "filewriter.h"
 #include "plugins.h"
 #include "convert.h"
+#include "output.h"
+#include "pipeline.h"
+#include "../perfstat/perfstat.h"
 
 struct format_info input;
 
@@ -83,9 +86,11 @@ static gboolean use_suffix;
 static GtkWidget *prependnumber_toggle;
 static gboolean prependnumber;
 
+static GtkWidget *preallocate_toggle, *write_temp_toggle;
+static gboolean preallocate, write_temp;
+
 static gchar *file_path;
 
-VFSFile *output_file = NULL;
 Tuple *tuple = NULL;
 
 static gint64 samples_written;
@@ -113,7 +118,7 @@ static void set_plugin(void)
 
 static gint file_write_output (void * data, gint length)
 {
-    return vfs_fwrite (data, 1, length, output_file);
+    return output_write (data, length);
 }
 
 static const gchar * const filewriter_defaults[] = {
@@ -122,6 +127,8 @@ static const gchar * const filewriter_defaults[] = {
  "prependnumber", "FALSE",
  "save_original", "TRUE",
  "use_suffix", "FALSE",
+ "preallocate", "FALSE",
+ "write_temp", "FALSE",
  NULL};
 
 static gboolean file_init (void)
@@ -134,6 +141,8 @@ static gboolean file_init (void)
     prependnumber = aud_get_bool ("filewriter", "prependnumber");
     save_original = aud_get_bool ("filewriter", "save_original");
     use_suffix = aud_get_bool ("filewriter", "use_suffix");
+    preallocate = aud_get_bool ("filewriter", "preallocate");
+    write_temp = aud_get_bool ("filewriter", "write_temp");
 
     if (! file_path[0])
     {
@@ -155,10 +164,11 @@ static void file_cleanup (void)
     file_path = NULL;
 }
 
-static VFSFile * safe_create (const gchar * filename)
+/* Returns a name for the output file that is not taken yet, or NULL. */
+static gchar * safe_name (const gchar * filename)
 {
     if (! vfs_file_test (filename, G_FILE_TEST_EXISTS))
-        return vfs_fopen (filename, "w");
+        return g_strdup (filename);
 
     const gchar * extension = strrchr (filename, '.');
     gint length = strlen (filename);
@@ -174,12 +184,28 @@ static VFSFile * safe_create (const gchar * filename)
              filename, count, extension);
 
         if (! vfs_file_test (scratch, G_FILE_TEST_EXISTS))
-            return vfs_fopen (scratch, "w");
+            return g_strdup (scratch);
     }
 
     return NULL;
 }
 
+/* An estimate of the final file size to allocate up front: the size of the
+ * audio for WAV, and half that for the compressed formats, about what FLAC
+ * takes; whatever is not used is given back when the file is closed. */
+static gint64 estimate_size (gint nch, gint rate)
+{
+    gint length = tuple_get_int (tuple, FIELD_LENGTH, NULL);
+
+    if (! preallocate || length <= 0)
+        return 0;
+
+    gint64 size = (gint64) length * rate / 1000 * nch *
+     FMT_SIZEOF (plugin->format_required (input.format));
+
+    return plugin == & wav_plugin ? size : size / 2;
+}
+
 static gint file_open(gint fmt, gint rate, gint nch)
 {
     gchar *filename = NULL, *temp = NULL;
@@ -259,26 +285,42 @@ static gint file_open(gint fmt, gint rate, gint nch)
     g_free (filename);
     filename = temp;
 
-    output_file = safe_create (filename);
+    temp = safe_name (filename);
     g_free (filename);
+    filename = temp;
 
-    if (output_file == NULL)
+    if (filename == NULL || ! output_open (filename, estimate_size (nch, rate), write_temp))
+    {
+        g_free (filename);
         return 0;
+    }
+
+    g_free (filename);
 
     convert_init (fmt, plugin->format_required (fmt), nch);
 
     rv = (plugin->open)();
 
+    if (rv)
+    {
+        pipeline_start(plugin);
+        perfstat_output_open(&perfstat, FMT_SIZEOF(fmt) * nch * rate);
+    }
+
     samples_written = 0;
 
     return rv;
 }
 
+static PerfStatOutput perfstat = PERFSTAT_OUTPUT_INIT(N_("FileWriter Plugin"));
+
 static void file_write(void *ptr, gint length)
 {
+    int64_t begin = perfstat_output_begin(&perfstat, length);
     int len = convert_process (ptr, length);
 
-    plugin->write(convert_output, len);
+    pipeline_write(convert_output, len);
+    perfstat_output_end(&perfstat, begin, length);
 
     samples_written += length / FMT_SIZEOF (input.format);
 }
@@ -289,12 +331,11 @@ static void file_drain (void)
 
 static void file_close(void)
 {
+    pipeline_finish();
     plugin->close();
     convert_free();
 
-    if (output_file != NULL)
-        vfs_fclose(output_file);
-    output_file = NULL;
+    output_close();
 
     if (tuple)
     {
@@ -305,11 +346,13 @@ static void file_close(void)
 
 static void file_flush(gint time)
 {
+    perfstat_output_idle(&perfstat);
     samples_written = time * (gint64) input.channels * input.frequency / 1000;
 }
 
 static void file_pause (gboolean p)
 {
+    perfstat_output_idle(&perfstat);
 }
 
 static gint file_get_time (void)
@@ -336,12 +379,20 @@ static void configure_response_cb (GtkWidget * window, int response)
     prependnumber =
         gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(prependnumber_toggle));
 
+    preallocate =
+        gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(preallocate_toggle));
+
+    write_temp =
+        gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(write_temp_toggle));
+
     aud_set_int ("filewriter", "fileext", fileext);
     aud_set_bool ("filewriter", "filenamefromtags", filenamefromtags);
     aud_set_string ("filewriter", "file_path", file_path);
     aud_set_bool ("filewriter", "prependnumber", prependnumber);
     aud_set_bool ("filewriter", "save_original", save_original);
     aud_set_bool ("filewriter", "use_suffix", use_suffix);
+    aud_set_bool ("filewriter", "preallocate", preallocate);
+    aud_set_bool ("filewriter", "write_temp", write_temp);
 
     gtk_widget_destroy (window);
 }
@@ -507,6 +558,16 @@ static void file_configure(void)
         gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(prependnumber_toggle), prependnumber);
         gtk_box_pack_start(GTK_BOX(configure_vbox), prependnumber_toggle, FALSE, FALSE, 0);
 
+        gtk_box_pack_start(GTK_BOX(configure_vbox), gtk_separator_new(GTK_ORIENTATION_HORIZONTAL), FALSE, FALSE, 0);
+
+        preallocate_toggle = gtk_check_button_new_with_label(_("Allocate the estimated file size in advance"));
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(preallocate_toggle), preallocate);
+        gtk_box_pack_start(GTK_BOX(configure_vbox), preallocate_toggle, FALSE, FALSE, 0);
+
+        write_temp_toggle = gtk_check_button_new_with_label(_("Write to a temporary file, renamed when complete"));
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(write_temp_toggle), write_temp);
+        gtk_box_pack_start(GTK_BOX(configure_vbox), write_temp_toggle, FALSE, FALSE, 0);
+
         gtk_widget_show_all(configure_win);
     }
 }
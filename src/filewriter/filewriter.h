@@ -38,7 +38,6 @@ struct format_info {
 
 extern struct format_info input;
 
-extern VFSFile *output_file;
 extern guint64 offset;
 extern Tuple * tuple;
 
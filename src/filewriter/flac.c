@@ -20,18 +20,42 @@
  */
 
 #include "plugins.h"
+#include "output.h"
 
 #ifdef FILEWRITER_FLAC
 
 #include <FLAC/all.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#include <audacious/debug.h>
+#include <audacious/misc.h>
 
 static FLAC__StreamEncoder *flac_encoder;
 
+static FLAC__int32 *encbuffer;
+static gint encbuffer_size;
+
+static const gchar * const flac_defaults[] = {
+ "compression_level", "5",
+ "threads", "0",
+ NULL};
+
+static gint compression_level;
+static gint threads; /* 0 = one per processor */
+
+static void flac_init(write_output_callback write_output_func)
+{
+    aud_config_set_defaults ("filewriter_flac", flac_defaults);
+
+    compression_level = aud_get_int ("filewriter_flac", "compression_level");
+    threads = aud_get_int ("filewriter_flac", "threads");
+}
+
 static FLAC__StreamEncoderWriteStatus flac_write_cb(const FLAC__StreamEncoder *encoder,
     const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, gpointer data)
 {
-    if (vfs_fwrite (buffer, 1, bytes, data) != bytes)
+    if (output_write (buffer, bytes) != bytes)
         return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
 
     return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
@@ -40,9 +64,7 @@ static FLAC__StreamEncoderWriteStatus flac_write_cb(const FLAC__StreamEncoder *e
 static FLAC__StreamEncoderSeekStatus flac_seek_cb(const FLAC__StreamEncoder *encoder,
     FLAC__uint64 absolute_byte_offset, gpointer data)
 {
-    VFSFile *file = (VFSFile *) data;
-
-    if (vfs_fseek(file, absolute_byte_offset, SEEK_SET) < 0)
+    if (output_seek(absolute_byte_offset) < 0)
         return FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
 
     return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
@@ -51,9 +73,7 @@ static FLAC__StreamEncoderSeekStatus flac_seek_cb(const FLAC__StreamEncoder *enc
 static FLAC__StreamEncoderTellStatus flac_tell_cb(const FLAC__StreamEncoder *encoder,
     FLAC__uint64 *absolute_byte_offset, gpointer data)
 {
-    VFSFile *file = (VFSFile *) data;
-
-    *absolute_byte_offset = vfs_ftell(file);
+    *absolute_byte_offset = output_tell();
 
     return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
 }
@@ -91,14 +111,37 @@ static void insert_vorbis_comment (FLAC__StreamMetadata * meta,
     g_free (temp);
 }
 
+#ifdef HAVE_FLAC_NUM_THREADS
+/* libFLAC 1.5 encodes frames on a pool of threads of its own and puts them
+ * back in order, so the stream (STREAMINFO and all) is the same as with one
+ * thread. */
+static void set_threads(void)
+{
+    gint n = threads;
+
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    n = CLAMP(n, 1, 64);
+
+    if (FLAC__stream_encoder_set_num_threads(flac_encoder, n) !=
+     FLAC__STREAM_ENCODER_SET_NUM_THREADS_OK)
+        AUDDBG("libFLAC refused %d threads; encoding on one.\n", n);
+}
+#endif
+
 static gint flac_open(void)
 {
     flac_encoder = FLAC__stream_encoder_new();
 
     FLAC__stream_encoder_set_channels(flac_encoder, input.channels);
+    FLAC__stream_encoder_set_bits_per_sample(flac_encoder, 16);
     FLAC__stream_encoder_set_sample_rate(flac_encoder, input.frequency);
-    FLAC__stream_encoder_init_stream(flac_encoder, flac_write_cb, flac_seek_cb, flac_tell_cb,
-				     NULL, output_file);
+    FLAC__stream_encoder_set_compression_level(flac_encoder, compression_level);
+
+#ifdef HAVE_FLAC_NUM_THREADS
+    set_threads();
+#endif
 
     if (tuple)
     {
@@ -117,61 +160,114 @@ static gint flac_open(void)
         FLAC__stream_encoder_set_metadata(flac_encoder, &meta, 1);
     }
 
+    /* Everything above must be set before the encoder is initialized. */
+    if (FLAC__stream_encoder_init_stream(flac_encoder, flac_write_cb, flac_seek_cb,
+     flac_tell_cb, NULL, NULL) != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+    {
+        fprintf(stderr, "Could not initialize the FLAC encoder.\n");
+        FLAC__stream_encoder_delete(flac_encoder);
+        flac_encoder = NULL;
+        return 0;
+    }
+
     return 1;
 }
 
 static void flac_write(gpointer data, gint length)
 {
-#if 1
-    FLAC__int32 *encbuffer[2];
-    short int *tmpdata = data;
-    int i;
-
-    encbuffer[0] = g_new0(FLAC__int32, length / input.channels);
-    encbuffer[1] = g_new0(FLAC__int32, length / input.channels);
+    gint16 *tmpdata = data;
+    gint samples = length / 2;
+    gint i;
 
-    if (input.channels == 1)
+    if (encbuffer_size < samples)
     {
-        for (i = 0; i < (length / 2); i++)
-        {
-            encbuffer[0][i] = tmpdata[i];
-            encbuffer[1][i] = tmpdata[i];
-        }
+        encbuffer = g_renew(FLAC__int32, encbuffer, samples);
+        encbuffer_size = samples;
     }
-    else
+
+    for (i = 0; i < samples; i++)
+        encbuffer[i] = tmpdata[i];
+
+    FLAC__stream_encoder_process_interleaved(flac_encoder, encbuffer, samples / input.channels);
+}
+
+static void flac_close(void)
+{
+    if (flac_encoder)
     {
-        for (i = 0; i < (length / 4); i++)
-        {
-            encbuffer[0][i] = tmpdata[2 * i];
-            encbuffer[1][i] = tmpdata[2 * i + 1];
-        }
+        FLAC__stream_encoder_finish(flac_encoder);
+        FLAC__stream_encoder_delete(flac_encoder);
+        flac_encoder = NULL;
     }
 
-    FLAC__stream_encoder_process(flac_encoder, (const FLAC__int32 **)encbuffer, length / (input.channels * 2));
+    g_free(encbuffer);
+    encbuffer = NULL;
+    encbuffer_size = 0;
+}
 
-    g_free(encbuffer[0]);
-    g_free(encbuffer[1]);
-#else
-    FLAC__int32 *encbuffer;
-    gint16 *tmpdata = data;
-    int i;
+/* configuration stuff */
+static GtkWidget *configure_win = NULL;
+static GtkWidget *level_spin, *threads_spin;
 
-    encbuffer = g_new0(FLAC__int32, length);
+static void level_change(GtkSpinButton *spin, gpointer user_data)
+{
+    compression_level = gtk_spin_button_get_value_as_int(spin);
+    aud_set_int ("filewriter_flac", "compression_level", compression_level);
+}
 
-    for (i=0; i < length; i++) {
-        encbuffer[i] = tmpdata[i];
-    }
+static void threads_change(GtkSpinButton *spin, gpointer user_data)
+{
+    threads = gtk_spin_button_get_value_as_int(spin);
+    aud_set_int ("filewriter_flac", "threads", threads);
+}
+
+static GtkWidget *add_spin_row(GtkWidget *vbox, const gchar *text, gint min, gint max,
+ gint value, GCallback callback)
+{
+    GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
 
-    FLAC__stream_encoder_process_interleaved(flac_encoder, encbuffer, length);
+    GtkWidget *label = gtk_label_new(text);
+    gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+    gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, TRUE, 0);
 
-    g_free(encbuffer);
-#endif
+    GtkWidget *spin = gtk_spin_button_new_with_range(min, max, 1);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(spin), value);
+    gtk_box_pack_start(GTK_BOX(hbox), spin, FALSE, FALSE, 0);
+    g_signal_connect(spin, "value-changed", callback, NULL);
+
+    return spin;
 }
 
-static void flac_close(void)
+static void flac_configure(void)
 {
-    FLAC__stream_encoder_finish(flac_encoder);
-    FLAC__stream_encoder_delete(flac_encoder);
+    if (! configure_win)
+    {
+        configure_win = gtk_dialog_new_with_buttons
+         (_("FLAC Encoder Configuration"), NULL, 0, GTK_STOCK_CLOSE,
+         GTK_RESPONSE_CLOSE, NULL);
+
+        g_signal_connect (configure_win, "response", (GCallback) gtk_widget_destroy, NULL);
+        g_signal_connect (configure_win, "destroy", (GCallback)
+         gtk_widget_destroyed, & configure_win);
+
+        GtkWidget * vbox = gtk_dialog_get_content_area ((GtkDialog *) configure_win);
+        GtkWidget * inner = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+        gtk_container_set_border_width(GTK_CONTAINER(inner), 10);
+        gtk_box_pack_start(GTK_BOX(vbox), inner, FALSE, FALSE, 0);
+
+        level_spin = add_spin_row(inner, _("Compression level (0 - 8):"), 0, 8,
+         compression_level, (GCallback) level_change);
+        threads_spin = add_spin_row(inner, _("Encoder threads (0 = automatic):"), 0, 64,
+         threads, (GCallback) threads_change);
+
+#ifndef HAVE_FLAC_NUM_THREADS
+        /* needs libFLAC 1.5 */
+        gtk_widget_set_sensitive(threads_spin, FALSE);
+#endif
+    }
+
+    gtk_widget_show_all(configure_win);
 }
 
 static int flac_format_required (int fmt)
@@ -181,8 +277,8 @@ static int flac_format_required (int fmt)
 
 FileWriter flac_plugin =
 {
-    .init = NULL,
-    .configure = NULL,
+    .init = flac_init,
+    .configure = flac_configure,
     .open = flac_open,
     .write = flac_write,
     .close = flac_close,
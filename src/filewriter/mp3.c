@@ -23,6 +23,7 @@
 /* #define AUD_DEBUG 1 */
 
 #include "plugins.h"
+#include "output.h"
 
 #ifdef FILEWRITER_MP3
 
@@ -322,7 +323,7 @@ RETRY:
 
 static void mp3_close(void)
 {
-    if (output_file) {
+    if (output_is_open()) {
         int imp3, encout;
 
         /* write remaining mp3 data */
@@ -340,7 +341,7 @@ static void mp3_close(void)
         /* update v2 tag */
         imp3 = lame_get_id3v2_tag(gfp, encbuffer, sizeof(encbuffer));
         if (imp3 > 0) {
-            if (vfs_fseek(output_file, 0, SEEK_SET) != 0) {
+            if (output_seek(0) != 0) {
                 AUDDBG("can't rewind\n");
             }
             else {
@@ -350,7 +351,7 @@ static void mp3_close(void)
 
         /* update lame tag */
         if (id3v2_size) {
-            if (vfs_fseek(output_file, id3v2_size, SEEK_SET) != 0) {
+            if (output_seek(id3v2_size) != 0) {
                 AUDDBG("fatal error: can't update LAME-tag frame!\n");
             }
             else {
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE /* fallocate */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libaudcore/audstrings.h>
+
+#include "output.h"
+
+#define BLOCK_SIZE (1 << 20)
+
+/* Exactly one of file and fd is open at a time. */
+static VFSFile *file;
+static gint fd = -1;
+static gchar *path, *temp_path;         /* of a local file */
+
+static guchar *buffer;
+static gint buffered;
+static gint64 position;                 /* of the start of the buffer */
+static gint64 end;                      /* of everything written so far */
+
+static gboolean write_out(const void *ptr, gint length)
+{
+    if (file)
+        return vfs_fwrite(ptr, 1, length, file) == length;
+
+    while (length > 0)
+    {
+        gssize written = write(fd, ptr, length);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "filewriter: Cannot write to %s: %s.\n", path, strerror(errno));
+            return FALSE;
+        }
+
+        ptr = (const guchar *) ptr + written;
+        length -= written;
+    }
+
+    return TRUE;
+}
+
+static gboolean flush_buffer(void)
+{
+    gboolean success = write_out(buffer, buffered);
+
+    position += buffered;
+    end = MAX(end, position);
+    buffered = 0;
+
+    return success;
+}
+
+gboolean output_open(const gchar *filename, gint64 estimate, gboolean use_temp)
+{
+    buffer = g_malloc(BLOCK_SIZE);
+    buffered = 0;
+    position = end = 0;
+
+    if (strncmp(filename, "file://", 7) || !(path = uri_to_filename(filename)))
+    {
+        if (!(file = vfs_fopen(filename, "w")))
+            goto ERR;
+
+        return TRUE;
+    }
+
+    if (use_temp)
+        temp_path = g_strdup_printf("%s.part", path);
+
+    fd = open(temp_path ? temp_path : path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "filewriter: Cannot open %s: %s.\n", temp_path ? temp_path : path, strerror(errno));
+        goto ERR;
+    }
+
+#ifdef FALLOC_FL_KEEP_SIZE
+    /* Unlike posix_fallocate(), this fails rather than writing zeros where
+     * allocating is not supported; what is left over is truncated on close. */
+    if (estimate > 0)
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, estimate);
+#endif
+
+    return TRUE;
+
+ERR:
+    output_close();
+    return FALSE;
+}
+
+gint output_write(const void *ptr, gint length)
+{
+    gint done = 0;
+
+    while (done < length)
+    {
+        /* Fill up to the next block boundary in the file */
+        gint space = BLOCK_SIZE - (position + buffered) % BLOCK_SIZE;
+        gint copy = MIN(length - done, space);
+
+        memcpy(buffer + buffered, (const guchar *) ptr + done, copy);
+        buffered += copy;
+        done += copy;
+
+        if (copy == space && !flush_buffer())
+            return 0;
+    }
+
+    return done;
+}
+
+gint output_seek(gint64 offset)
+{
+    if (!flush_buffer())
+        return -1;
+
+    if (file ? vfs_fseek(file, offset, SEEK_SET) != 0 : lseek(fd, offset, SEEK_SET) < 0)
+        return -1;
+
+    position = offset;
+    return 0;
+}
+
+gint64 output_tell(void)
+{
+    return position + buffered;
+}
+
+gboolean output_is_open(void)
+{
+    return file || fd >= 0;
+}
+
+void output_close(void)
+{
+    if (output_is_open())
+        flush_buffer();
+
+    if (file)
+    {
+        vfs_fclose(file);
+        file = NULL;
+    }
+
+    if (fd >= 0)
+    {
+        /* Drop whatever was allocated beyond the end */
+        if (ftruncate(fd, end) < 0 || close(fd) < 0)
+            fprintf(stderr, "filewriter: Error closing %s: %s.\n", path, strerror(errno));
+
+        if (temp_path && rename(temp_path, path) < 0)
+            fprintf(stderr, "filewriter: Cannot rename %s: %s.\n", temp_path, strerror(errno));
+
+        fd = -1;
+    }
+
+    free(path);
+    path = NULL;
+    g_free(temp_path);
+    temp_path = NULL;
+
+    g_free(buffer);
+    buffer = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "filewriter.h"
+
+/* Writes the output file in large blocks, however small the pieces the
+ * encoders hand over, with the blocks aligned to their size in the file.
+ * Local files are written directly; they may have an estimated final size
+ * allocated up front, and may be written under a temporary name, renamed
+ * over the final one when closed.  Other files are written through VFS. */
+
+gboolean output_open(const gchar *filename, gint64 estimate, gboolean use_temp);
+
+/* Returns the number of bytes taken, which is less than length on error. */
+gint output_write(const void *ptr, gint length);
+
+/* Like vfs_fseek(), with SEEK_SET only; returns 0 on success. */
+gint output_seek(gint64 offset);
+
+gint64 output_tell(void);
+
+gboolean output_is_open(void);
+
+/* Writes out what is still buffered and closes the file. */
+void output_close(void);
+
+#endif
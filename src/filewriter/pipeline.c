@@ -0,0 +1,116 @@
+#include <pthread.h>
+
+#include "pipeline.h"
+
+#define QUEUE_BLOCKS 16
+
+typedef struct
+{
+    void *data;
+    gint size, length;
+} Block;
+
+/* Only the encoder thread moves queue_head and only pipeline_write adds to
+ * queue_count, so each side owns its slots without holding the lock. */
+static Block queue[QUEUE_BLOCKS];
+static gint queue_head, queue_count;
+static gboolean finishing;
+
+static FileWriter *encoder;
+static pthread_t encoder_thread;
+static gboolean running;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static void *encoder_main(void *unused)
+{
+    pthread_mutex_lock(&mutex);
+
+    while (queue_count || !finishing)
+    {
+        if (!queue_count)
+        {
+            pthread_cond_wait(&cond, &mutex);
+            continue;
+        }
+
+        Block *block = &queue[queue_head];
+        pthread_mutex_unlock(&mutex);
+
+        encoder->write(block->data, block->length);
+
+        pthread_mutex_lock(&mutex);
+        queue_head = (queue_head + 1) % QUEUE_BLOCKS;
+        queue_count--;
+        pthread_cond_broadcast(&cond);
+    }
+
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+
+void pipeline_start(FileWriter *plugin)
+{
+    encoder = plugin;
+    queue_head = queue_count = 0;
+    finishing = FALSE;
+
+    running = !pthread_create(&encoder_thread, NULL, encoder_main, NULL);
+
+    if (!running)
+        fprintf(stderr, "filewriter: Failed to start encoder thread.\n");
+}
+
+void pipeline_write(void *ptr, gint length)
+{
+    if (!running)
+    {
+        encoder->write(ptr, length);
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+
+    while (queue_count == QUEUE_BLOCKS)
+        pthread_cond_wait(&cond, &mutex);
+
+    Block *block = &queue[(queue_head + queue_count) % QUEUE_BLOCKS];
+
+    pthread_mutex_unlock(&mutex);
+
+    if (block->size < length)
+    {
+        block->data = g_realloc(block->data, length);
+        block->size = length;
+    }
+
+    memcpy(block->data, ptr, length);
+    block->length = length;
+
+    pthread_mutex_lock(&mutex);
+    queue_count++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+void pipeline_finish(void)
+{
+    if (running)
+    {
+        pthread_mutex_lock(&mutex);
+        finishing = TRUE;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+
+        pthread_join(encoder_thread, NULL);
+        running = FALSE;
+    }
+
+    for (gint i = 0; i < QUEUE_BLOCKS; i++)
+    {
+        g_free(queue[i].data);
+        queue[i].data = NULL;
+        queue[i].size = 0;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "filewriter.h"
+
+/* Runs the encoder on a thread of its own, so that encoding the previous
+ * blocks overlaps with decoding the next ones.  Blocks are copied into a
+ * bounded queue; pipeline_write only waits when the encoder falls that far
+ * behind.  If the thread cannot be started, blocks are encoded directly. */
+
+void pipeline_start(FileWriter *plugin);
+
+void pipeline_write(void *ptr, gint length);
+
+/* Waits until every queued block has been encoded and stops the thread. */
+void pipeline_finish(void);
+
+#endif
@@ -22,6 +22,8 @@
  */
 
 #include "plugins.h"
+#include "output.h"
+#include "convert.h"
 
 #pragma pack(push) /* must be byte-aligned */
 #pragma pack(1)
@@ -71,7 +73,7 @@ static gint wav_open(void)
     memcpy(&header.data_chunk, "data", 4);
     header.data_length = GUINT32_TO_LE(0);
 
-    if (vfs_fwrite (& header, 1, sizeof header, output_file) != sizeof header)
+    if (output_write (& header, sizeof header) != sizeof header)
         return 0;
 
     written = 0;
@@ -79,47 +81,45 @@ static gint wav_open(void)
     return 1;
 }
 
-static void pack24 (void * * data, int * len)
-{
-    int samples = (* len) / sizeof (int32_t);
-    char * new = g_malloc (samples * 3);
-    int32_t * data32 = * data;
-    int32_t * end = data32 + samples;
-
-    * data = new;
-    * len = samples * 3;
-
-    while (data32 < end)
-    {
-        memcpy (new, data32 ++, 3);
-        new += 3;
-    }
-}
+static void * pack_buf;
+static int pack_size;
 
 static void wav_write (void * data, gint len)
 {
     if (input.format == FMT_S24_LE)
-        pack24 (& data, & len);
+    {
+        int samples = len / sizeof (int32_t);
+
+        if (pack_size < samples * 3)
+        {
+            pack_size = samples * 3;
+            pack_buf = g_realloc (pack_buf, pack_size);
+        }
+
+        convert_pack24 (data, pack_buf, samples);
+        data = pack_buf;
+        len = samples * 3;
+    }
 
     written += len;
-    if (vfs_fwrite (data, 1, len, output_file) != len)
+    if (output_write (data, len) != len)
         fprintf (stderr, "Error while writing to .wav output file.\n");
-
-    if (input.format == FMT_S24_LE)
-        g_free (data);
 }
 
 static void wav_close(void)
 {
-    if (output_file)
+    if (output_is_open ())
     {
         header.length = GUINT32_TO_LE(written + sizeof (struct wavhead) - 8);
         header.data_length = GUINT32_TO_LE(written);
 
-        if (vfs_fseek (output_file, 0, SEEK_SET) || vfs_fwrite (& header, 1,
-         sizeof header, output_file) != sizeof header)
+        if (output_seek (0) || output_write (& header, sizeof header) != sizeof header)
             fprintf (stderr, "Error while writing to .wav output file.\n");
     }
+
+    g_free (pack_buf);
+    pack_buf = NULL;
+    pack_size = 0;
 }
 
 static int wav_format_required (int fmt)
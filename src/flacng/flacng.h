@@ -36,16 +36,25 @@
 #define SAMPLE_SIZE(a) (a == 8 ? 1 : (a == 16 ? 2 : 4))
 #define SAMPLE_FMT(a) (a == 8 ? FMT_S8 : (a == 16 ? FMT_S16_NE : (a == 24 ? FMT_S24_NE : FMT_S32_NE)))
 
+typedef struct {
+    int64_t sample;                     /* first sample of a frame */
+    int64_t offset;                     /* bytes from the start of the file */
+} SeekPoint;
+
 typedef struct callback_info {
     unsigned bits_per_sample;
     unsigned sample_rate;
     unsigned channels;
     unsigned long total_samples;
-    int32_t* output_buffer;
-    int32_t* write_pointer;
-    unsigned buffer_used;
+    char* output_buffer;                /* in the output format */
+    char* write_pointer;
+    unsigned buffer_used;               /* samples */
     VFSFile* fd;
     int bitrate;
+    int64_t audio_start;                /* offset of the first frame */
+    int64_t seek_target;                /* sample to skip ahead to, or -1 */
+    SeekPoint* seek_points;             /* sorted by sample */
+    int n_seek_points, seek_points_size;
 } callback_info;
 
 /* metadata.c */
@@ -63,6 +72,11 @@ FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder
 void error_callback(const FLAC__StreamDecoder *decoder, FLAC__StreamDecoderErrorStatus status, void *client_data);
 void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMetadata *metadata, void *client_data);
 
+/* seekpoints.c */
+void seek_points_reset(callback_info* info);
+void seek_points_add(callback_info* info, int64_t sample, int64_t offset);
+bool_t seek_points_seek(FLAC__StreamDecoder* decoder, callback_info* info, int64_t sample);
+
 /* tools.c */
 callback_info* init_callback_info(void);
 void clean_callback_info(callback_info* info);
@@ -21,6 +21,7 @@
 
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -188,57 +189,136 @@ ERR:
     return FALSE;
 }
 
-bool_t flac_get_image(const char *filename, VFSFile *fd, void **data, int64_t *length)
+/* Called with the contents of each metadata block asked for; returns FALSE
+ * to stop reading further blocks. */
+typedef bool_t (* BlockFunc) (int type, unsigned char * data, uint32_t length, void * user);
+
+static uint32_t get_be32 (const unsigned char * p)
 {
-    AUDDBG("Probe for song image.\n");
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
 
-    FLAC__Metadata_Iterator *iter;
-    FLAC__Metadata_Chain *chain;
-    FLAC__StreamMetadata *metadata = NULL;
-    FLAC__Metadata_ChainStatus status;
-    bool_t has_image = FALSE;
+static uint32_t get_le32 (const unsigned char * p)
+{
+    return (uint32_t) p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
 
-    chain = FLAC__metadata_chain_new();
+/* Walks the metadata block headers, seeking past the blocks whose types are
+ * not in the mask (a cover picture alone may be megabytes) and reading only
+ * those that are.  Unlike FLAC__metadata_chain_read_with_callbacks(), this
+ * touches little more than the blocks needed. */
+static bool_t read_blocks (VFSFile * fd, uint32_t types, BlockFunc func, void * user)
+{
+    unsigned char head[10];
 
-    if (!FLAC__metadata_chain_read_with_callbacks(chain, fd, io_callbacks))
-        goto ERR;
+    if (vfs_fseek (fd, 0, SEEK_SET) != 0 || vfs_fread (head, 1, 4, fd) != 4)
+        return FALSE;
 
-    iter = FLAC__metadata_iterator_new();
+    /* skip an ID3v2 tag in front, as libFLAC does */
+    if (! memcmp (head, "ID3", 3))
+    {
+        if (vfs_fread (head + 4, 1, 6, fd) != 6)
+            return FALSE;
 
-    FLAC__metadata_iterator_init(iter, chain);
+        int64_t skip = (head[6] & 0x7f) << 21 | (head[7] & 0x7f) << 14 |
+         (head[8] & 0x7f) << 7 | (head[9] & 0x7f);
+        if (head[5] & 0x10)
+            skip += 10; /* footer */
 
-    while (FLAC__metadata_iterator_next(iter))
-        if (FLAC__metadata_iterator_get_block_type(iter) == FLAC__METADATA_TYPE_PICTURE)
-            break;
+        if (vfs_fseek (fd, skip, SEEK_CUR) != 0 || vfs_fread (head, 1, 4, fd) != 4)
+            return FALSE;
+    }
+
+    if (memcmp (head, "fLaC", 4))
+        return FALSE;
 
-    if (FLAC__metadata_iterator_get_block_type(iter) == FLAC__METADATA_TYPE_PICTURE)
+    bool_t last = FALSE;
+
+    while (! last)
     {
-        metadata = FLAC__metadata_iterator_get_block(iter);
+        if (vfs_fread (head, 1, 4, fd) != 4)
+            return FALSE;
+
+        last = head[0] >> 7;
+        int type = head[0] & 0x7f;
+        uint32_t length = head[1] << 16 | head[2] << 8 | head[3];
 
-        if (metadata->data.picture.type == FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER)
+        if (type >= 32 || ! (types & (1u << type)))
         {
-            AUDDBG("FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER found.");
+            if (vfs_fseek (fd, length, SEEK_CUR) != 0)
+                return FALSE;
+
+            continue;
+        }
+
+        unsigned char * data = malloc (length + 1);
 
-            * data = malloc (metadata->data.picture.data_length);
-            * length = metadata->data.picture.data_length;
-            memcpy (* data, metadata->data.picture.data, * length);
-            has_image = TRUE;
+        if (vfs_fread (data, 1, length, fd) != length)
+        {
+            free (data);
+            return FALSE;
         }
+
+        bool_t more = func (type, data, length, user);
+        free (data);
+
+        if (! more)
+            break;
     }
 
-    FLAC__metadata_iterator_delete(iter);
-    FLAC__metadata_chain_delete(chain);
+    return TRUE;
+}
 
-    return has_image;
+typedef struct {
+    void * * data;
+    int64_t * length;
+    bool_t found;
+} ImageState;
 
-ERR:
-    status = FLAC__metadata_chain_status(chain);
-    FLAC__metadata_chain_delete(chain);
+static bool_t image_block (int type, unsigned char * data, uint32_t length, void * user)
+{
+    ImageState * state = user;
+    unsigned char * end = data + length;
+    unsigned char * p = data;
+
+    /* picture type, MIME type, description, then four numbers */
+    if (end - p < 4 || get_be32 (p) != FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER)
+        return TRUE;
+
+    p += 4;
+    for (int i = 0; i < 2; i ++)
+    {
+        if (end - p < 4 || end - p - 4 < (int64_t) get_be32 (p))
+            return TRUE;
+        p += 4 + get_be32 (p);
+    }
+
+    /* width, height, depth and colors, then the data */
+    if (end - p < 20 || end - p - 20 < (int64_t) get_be32 (p + 16))
+        return TRUE;
+
+    AUDDBG("FLAC__STREAM_METADATA_PICTURE_TYPE_FRONT_COVER found.");
+
+    * state->length = get_be32 (p + 16);
+    * state->data = malloc (* state->length);
+    memcpy (* state->data, p + 20, * state->length);
+    state->found = TRUE;
 
-    FLACNG_ERROR("An error occured: %s\n", FLAC__Metadata_ChainStatusString[status]);
     return FALSE;
 }
 
+bool_t flac_get_image(const char *filename, VFSFile *fd, void **data, int64_t *length)
+{
+    AUDDBG("Probe for song image.\n");
+
+    ImageState state = {data, length, FALSE};
+
+    if (! read_blocks (fd, 1u << FLAC__METADATA_TYPE_PICTURE, image_block, & state))
+        FLACNG_ERROR("Could not read the metadata of %s\n", filename);
+
+    return state.found;
+}
+
 static void parse_gain_text(const char *text, int *value, int *unit)
 {
     int sign = 1;
@@ -338,105 +418,112 @@ static void parse_comment (Tuple * tuple, const char * key, const char * value)
         set_gain_info(tuple, FIELD_GAIN_ALBUM_PEAK, FIELD_GAIN_PEAK_UNIT, value);
 }
 
-Tuple *flac_probe_for_tuple(const char *filename, VFSFile *fd)
+typedef struct {
+    Tuple * tuple;
+    VFSFile * fd;
+    int seen;
+} ProbeState;
+
+static void parse_stream_info (ProbeState * state, const unsigned char * data)
 {
-    AUDDBG("Probe for tuple.\n");
+    Tuple * tuple = state->tuple;
+    unsigned sample_rate = data[10] << 12 | data[11] << 4 | data[12] >> 4;
+    uint64_t total_samples = (uint64_t) (data[13] & 0x0f) << 32 | get_be32 (data + 14);
 
-    Tuple *tuple = NULL;
-    FLAC__Metadata_Iterator *iter;
-    FLAC__Metadata_Chain *chain;
-    FLAC__StreamMetadata *metadata = NULL;
-    FLAC__Metadata_ChainStatus status;
-    FLAC__StreamMetadata_VorbisComment_Entry *entry;
-    char *key;
-    char *value;
+    /* Calculate the stream length (milliseconds) */
+    if (sample_rate == 0)
+    {
+        FLACNG_ERROR("Invalid sample rate for stream!\n");
+        tuple_set_int(tuple, FIELD_LENGTH, NULL, -1);
+    }
+    else
+    {
+        tuple_set_int(tuple, FIELD_LENGTH, NULL, (total_samples / sample_rate) * 1000);
+        AUDDBG("Stream length: %d seconds\n", tuple_get_int(tuple, FIELD_LENGTH, NULL));
+    }
 
-    tuple = tuple_new_from_filename(filename);
+    int64_t size = vfs_fsize(state->fd);
 
-    tuple_set_str(tuple, FIELD_CODEC, NULL, "Free Lossless Audio Codec (FLAC)");
-    tuple_set_str(tuple, FIELD_QUALITY, NULL, _("lossless"));
+    if (size == -1 || total_samples == 0)
+        tuple_set_int(tuple, FIELD_BITRATE, NULL, 0);
+    else
+    {
+        int bitrate = 8 * size * (int64_t) sample_rate / total_samples;
 
-    chain = FLAC__metadata_chain_new();
+        tuple_set_int(tuple, FIELD_BITRATE, NULL, (bitrate + 500) / 1000);
+    }
+}
 
-    if (!FLAC__metadata_chain_read_with_callbacks(chain, fd, io_callbacks))
-        goto ERR;
+static void parse_vorbis_comment (ProbeState * state, unsigned char * data, uint32_t length)
+{
+    unsigned char * end = data + length;
+    unsigned char * p = data;
 
-    iter = FLAC__metadata_iterator_new();
+    /* vendor string, then the count and the comments, all little endian */
+    if (end - p < 4 || end - p - 4 < (int64_t) get_le32 (p))
+        return;
 
-    FLAC__metadata_iterator_init(iter, chain);
+    p += 4 + get_le32 (p);
+
+    if (end - p < 4)
+        return;
 
-    do
+    uint32_t count = get_le32 (p);
+    p += 4;
+
+    AUDDBG("Vorbis comment contains %d fields\n", (int) count);
+
+    for (uint32_t i = 0; i < count; i ++)
     {
-        switch (FLAC__metadata_iterator_get_block_type(iter))
+        if (end - p < 4 || end - p - 4 < (int64_t) get_le32 (p))
+            break;
+
+        uint32_t len = get_le32 (p);
+        char * key = strndup ((char *) p + 4, len);
+        char * value = strchr (key, '=');
+        p += 4 + len;
+
+        if (! value)
+            AUDDBG("Could not parse comment\n");
+        else
         {
-            case FLAC__METADATA_TYPE_VORBIS_COMMENT:
-
-                if (FLAC__metadata_iterator_get_block_type(iter) == FLAC__METADATA_TYPE_VORBIS_COMMENT)
-                {
-                    metadata = FLAC__metadata_iterator_get_block(iter);
-
-                    AUDDBG("Vorbis comment contains %d fields\n", metadata->data.vorbis_comment.num_comments);
-                    AUDDBG("Vendor string: %s\n", metadata->data.vorbis_comment.vendor_string.entry);
-
-                    entry = metadata->data.vorbis_comment.comments;
-
-                    for (int i = 0; i < metadata->data.vorbis_comment.num_comments; i++, entry++)
-                    {
-                        if (FLAC__metadata_object_vorbiscomment_entry_to_name_value_pair(*entry, &key, &value) == false)
-                            AUDDBG("Could not parse comment\n");
-                        else
-                        {
-                            parse_comment(tuple, key, value);
-                            free(key);
-                            free(value);
-                        }
-                    }
-                }
-                break;
-
-            case FLAC__METADATA_TYPE_STREAMINFO:
-                metadata = FLAC__metadata_iterator_get_block(iter);
-
-                /* Calculate the stream length (milliseconds) */
-                if (metadata->data.stream_info.sample_rate == 0)
-                {
-                    FLACNG_ERROR("Invalid sample rate for stream!\n");
-                    tuple_set_int(tuple, FIELD_LENGTH, NULL, -1);
-                }
-                else
-                {
-                    tuple_set_int(tuple, FIELD_LENGTH, NULL,
-                        (metadata->data.stream_info.total_samples / metadata->data.stream_info.sample_rate) * 1000);
-                    AUDDBG("Stream length: %d seconds\n", tuple_get_int(tuple, FIELD_LENGTH, NULL));
-                }
-
-                int64_t size = vfs_fsize(fd);
-
-                if (size == -1 || metadata->data.stream_info.total_samples == 0)
-                    tuple_set_int(tuple, FIELD_BITRATE, NULL, 0);
-                else
-                {
-                    int bitrate = 8 * size *
-                        (int64_t) metadata->data.stream_info.sample_rate / metadata->data.stream_info.total_samples;
-
-                    tuple_set_int(tuple, FIELD_BITRATE, NULL, (bitrate + 500) / 1000);
-                }
-                break;
-
-            default:
-                ;
+            * value ++ = 0;
+            parse_comment(state->tuple, key, value);
         }
-    } while (FLAC__metadata_iterator_next(iter));
 
-    FLAC__metadata_iterator_delete(iter);
-    FLAC__metadata_chain_delete(chain);
+        free (key);
+    }
+}
 
-    return tuple;
+static bool_t probe_block (int type, unsigned char * data, uint32_t length, void * user)
+{
+    ProbeState * state = user;
 
-ERR:
-    status = FLAC__metadata_chain_status(chain);
-    FLAC__metadata_chain_delete(chain);
+    if (type == FLAC__METADATA_TYPE_STREAMINFO && length >= 18)
+        parse_stream_info (state, data);
+    else if (type == FLAC__METADATA_TYPE_VORBIS_COMMENT)
+        parse_vorbis_comment (state, data, length);
 
-    FLACNG_ERROR("An error occured: %s\n", FLAC__Metadata_ChainStatusString[status]);
-    return tuple;
+    state->seen |= 1 << type;
+
+    /* there is only one of each */
+    return state->seen != (1 << FLAC__METADATA_TYPE_STREAMINFO | 1 << FLAC__METADATA_TYPE_VORBIS_COMMENT);
+}
+
+Tuple *flac_probe_for_tuple(const char *filename, VFSFile *fd)
+{
+    AUDDBG("Probe for tuple.\n");
+
+    ProbeState state = {NULL, fd, 0};
+
+    state.tuple = tuple_new_from_filename(filename);
+
+    tuple_set_str(state.tuple, FIELD_CODEC, NULL, "Free Lossless Audio Codec (FLAC)");
+    tuple_set_str(state.tuple, FIELD_QUALITY, NULL, _("lossless"));
+
+    if (! read_blocks (fd, 1u << FLAC__METADATA_TYPE_STREAMINFO |
+     1u << FLAC__METADATA_TYPE_VORBIS_COMMENT, probe_block, & state))
+        FLACNG_ERROR("Could not read the metadata of %s\n", filename);
+
+    return state.tuple;
 }
@@ -51,6 +51,8 @@ static bool_t flac_init (void)
         return FALSE;
     }
 
+    FLAC__stream_decoder_set_metadata_respond(decoder, FLAC__METADATA_TYPE_SEEKTABLE);
+
     if (FLAC__STREAM_DECODER_INIT_STATUS_OK != (ret = FLAC__stream_decoder_init_stream(
         decoder,
         read_callback,
@@ -92,44 +94,12 @@ bool_t flac_is_our_fd(const char *filename, VFSFile *fd)
     return ! strncmp (buf, "fLaC", sizeof buf);
 }
 
-static void squeeze_audio(int32_t* src, void* dst, unsigned count, unsigned res)
-{
-    int i;
-    int32_t* rp = src;
-    int8_t*  wp = dst;
-    int16_t* wp2 = dst;
-    int32_t* wp4 = dst;
-
-    switch (res)
-    {
-        case 8:
-            for (i = 0; i < count; i++, wp++, rp++)
-                *wp = *rp & 0xff;
-            break;
-
-        case 16:
-            for (i = 0; i < count; i++, wp2++, rp++)
-                *wp2 = *rp & 0xffff;
-            break;
-
-        case 24:
-        case 32:
-            for (i = 0; i < count; i++, wp4++, rp++)
-                *wp4 = *rp;
-            break;
-
-        default:
-            FLACNG_ERROR("Can not convert to %d bps\n", res);
-    }
-}
-
 static bool_t flac_play (InputPlayback * playback, const char * filename,
  VFSFile * file, int start_time, int stop_time, bool_t pause)
 {
     if (!file)
         return FALSE;
 
-    void * play_buffer = NULL;
     bool_t error = FALSE;
 
     info->fd = file;
@@ -141,13 +111,6 @@ static bool_t flac_play (InputPlayback * playback, const char * filename,
         goto ERR_NO_CLOSE;
     }
 
-    if ((play_buffer = malloc (BUFFER_SIZE_BYTE)) == NULL)
-    {
-        FLACNG_ERROR("Could not allocate conversion buffer\n");
-        error = TRUE;
-        goto ERR_NO_CLOSE;
-    }
-
     if (! playback->output->open_audio (SAMPLE_FMT (info->bits_per_sample),
         info->sample_rate, info->channels))
     {
@@ -183,9 +146,13 @@ static bool_t flac_play (InputPlayback * playback, const char * filename,
 
         if (seek_value >= 0)
         {
+            int64_t sample = (int64_t) seek_value * info->sample_rate / 1000;
+
             playback->output->flush (seek_value);
-            FLAC__stream_decoder_seek_absolute (decoder, (int64_t)
-             seek_value * info->sample_rate / 1000);
+            reset_info(info);
+
+            if (! seek_points_seek(decoder, info, sample))
+                FLAC__stream_decoder_seek_absolute (decoder, sample);
 
             if (stop_time >= 0)
                 samples_remaining = (int64_t) (stop_time - seek_value) *
@@ -207,8 +174,7 @@ static bool_t flac_play (InputPlayback * playback, const char * filename,
         if (info->buffer_used >= samples_remaining)
             info->buffer_used = samples_remaining;
 
-        squeeze_audio(info->output_buffer, play_buffer, info->buffer_used, info->bits_per_sample);
-        playback->output->write_audio(play_buffer, info->buffer_used * SAMPLE_SIZE(info->bits_per_sample));
+        playback->output->write_audio(info->output_buffer, info->buffer_used * SAMPLE_SIZE(info->bits_per_sample));
 
         samples_remaining -= info->buffer_used;
 
@@ -220,7 +186,6 @@ static bool_t flac_play (InputPlayback * playback, const char * filename,
     pthread_mutex_unlock (& mutex);
 
 ERR_NO_CLOSE:
-    free (play_buffer);
     reset_info(info);
 
     if (FLAC__stream_decoder_flush(decoder) == FALSE)
@@ -24,6 +24,7 @@
 #include <audacious/debug.h>
 
 #include "flacng.h"
+#include "../pcmconv/pcmconv.h"
 
 FLAC__StreamDecoderReadStatus read_callback(const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes, void *client_data)
 {
@@ -80,8 +81,6 @@ FLAC__StreamDecoderTellStatus tell_callback(const FLAC__StreamDecoder *decoder,
         return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
     }
 
-    AUDDBG ("Current position: %d\n", (int) * offset);
-
     return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
 
@@ -122,15 +121,40 @@ FLAC__StreamDecoderWriteStatus write_callback(const FLAC__StreamDecoder *decoder
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
     }
 
-    for (long sample = 0; sample < frame->header.blocksize; sample++)
+    const FLAC__int32* channels[FLAC__MAX_CHANNELS];
+    unsigned blocksize = frame->header.blocksize;
+    unsigned skip = 0;
+    FLAC__uint64 next_frame;
+
+    /* libFLAC gives sample numbers, even for fixed-blocksize streams */
+    int64_t first = frame->header.number.sample_number;
+
+    if (frame->header.number_type == FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER &&
+     FLAC__stream_decoder_get_decode_position(decoder, &next_frame))
+        seek_points_add(info, first + blocksize, next_frame);
+
+    if (info->seek_target >= 0)
     {
-        for (short channel = 0; channel < frame->header.channels; channel++)
-        {
-            *(info->write_pointer++) = buffer[channel][sample];
-            info->buffer_used += 1;
-        }
+        if (first + blocksize <= info->seek_target)
+            return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+
+        if (first < info->seek_target)
+            skip = info->seek_target - first;
+
+        info->seek_target = -1;
     }
 
+    for (unsigned c = 0; c < frame->header.channels; c++)
+        channels[c] = buffer[c] + skip;
+
+    unsigned samples = (blocksize - skip) * frame->header.channels;
+
+    pcm_pack(channels, info->bits_per_sample, frame->header.channels,
+     info->write_pointer, SAMPLE_FMT(info->bits_per_sample), blocksize - skip);
+
+    info->write_pointer += samples * SAMPLE_SIZE(info->bits_per_sample);
+    info->buffer_used += samples;
+
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -167,4 +191,18 @@ void metadata_callback(const FLAC__StreamDecoder *decoder, const FLAC__StreamMet
 
         AUDDBG("bitrate=%d\n", info->bitrate);
     }
+    else if (metadata->type == FLAC__METADATA_TYPE_SEEKTABLE)
+    {
+        const FLAC__StreamMetadata_SeekTable* table = &metadata->data.seek_table;
+
+        /* Offsets are from the first frame until read_metadata fixes them. */
+        for (unsigned i = 0; i < table->num_points; i++)
+        {
+            if (table->points[i].sample_number != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER)
+                seek_points_add(info, table->points[i].sample_number,
+                 table->points[i].stream_offset);
+        }
+
+        AUDDBG("seek points=%d\n", info->n_seek_points);
+    }
 }
@@ -0,0 +1,119 @@
+/*
+ *  Seek point cache for the FLAC decoder plugin
+ *  Copyright (C) 2014 Audacious developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <audacious/debug.h>
+
+#include "flacng.h"
+
+/*
+ * libFLAC's seek_absolute bisects the file whenever the SEEKTABLE (if any)
+ * does not land it close enough, which means many scattered reads on a slow
+ * mount.  We keep our own list of frame positions instead, taken from the
+ * SEEKTABLE and from the frames played so far.  To seek, we move to the
+ * nearest known frame at or before the target and decode forward from there,
+ * throwing away samples in the write callback until the target is reached.
+ */
+
+/* How far ahead of a known frame we are willing to decode, in seconds. */
+#define MAX_SKIP 5
+
+void seek_points_reset(callback_info* info)
+{
+    info->n_seek_points = 0;
+    info->seek_target = -1;
+    info->audio_start = 0;
+}
+
+/* Returns the index of the last point at or before sample, or -1. */
+static int find_point(callback_info* info, int64_t sample)
+{
+    int lo = 0, hi = info->n_seek_points;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+
+        if (info->seek_points[mid].sample <= sample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo - 1;
+}
+
+void seek_points_add(callback_info* info, int64_t sample, int64_t offset)
+{
+    int i = find_point(info, sample);
+
+    if (i >= 0 && info->seek_points[i].sample == sample)
+        return;
+
+    /* One point a second is plenty, given MAX_SKIP. */
+    if (i >= 0 && sample - info->seek_points[i].sample < info->sample_rate &&
+     (i + 1 == info->n_seek_points ||
+     info->seek_points[i + 1].sample - sample < info->sample_rate))
+        return;
+
+    if (info->n_seek_points == info->seek_points_size)
+    {
+        int size = info->seek_points_size ? 2 * info->seek_points_size : 256;
+        SeekPoint* points = realloc(info->seek_points, size * sizeof (SeekPoint));
+
+        if (points == NULL)
+            return;
+
+        info->seek_points = points;
+        info->seek_points_size = size;
+    }
+
+    i ++;
+    memmove(info->seek_points + i + 1, info->seek_points + i,
+     (info->n_seek_points - i) * sizeof (SeekPoint));
+
+    info->seek_points[i].sample = sample;
+    info->seek_points[i].offset = offset;
+    info->n_seek_points ++;
+}
+
+bool_t seek_points_seek(FLAC__StreamDecoder* decoder, callback_info* info,
+ int64_t sample)
+{
+    int i = find_point(info, sample);
+
+    if (i < 0 || sample - info->seek_points[i].sample > (int64_t) MAX_SKIP *
+     info->sample_rate || (info->total_samples && sample >= info->total_samples))
+        return FALSE;
+
+    /* Flushing makes the decoder look for a frame header wherever the file
+     * position is afterwards. */
+    if (! FLAC__stream_decoder_flush(decoder) ||
+     vfs_fseek(info->fd, info->seek_points[i].offset, SEEK_SET) != 0)
+        return FALSE;
+
+    AUDDBG("Seeking to sample %ld from the frame at %ld.\n", (long) sample,
+     (long) info->seek_points[i].sample);
+
+    info->seek_target = sample;
+    return TRUE;
+}
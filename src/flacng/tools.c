@@ -51,6 +51,7 @@ callback_info *init_callback_info(void)
 
 void clean_callback_info(callback_info *info)
 {
+    free (info->seek_points);
     free (info->output_buffer);
     free (info);
 }
@@ -64,8 +65,10 @@ void reset_info(callback_info *info)
 bool_t read_metadata(FLAC__StreamDecoder *decoder, callback_info *info)
 {
     FLAC__StreamDecoderState ret;
+    FLAC__uint64 start;
 
     reset_info(info);
+    seek_points_reset(info);
 
     /* Reset the decoder */
     if (FLAC__stream_decoder_reset(decoder) == false)
@@ -84,5 +87,18 @@ bool_t read_metadata(FLAC__StreamDecoder *decoder, callback_info *info)
         return FALSE;
     }
 
+    /* The metadata has been read, so this is where the first frame starts. */
+    if (FLAC__stream_decoder_get_decode_position(decoder, &start))
+    {
+        info->audio_start = start;
+
+        for (int i = 0; i < info->n_seek_points; i++)
+            info->seek_points[i].offset += start;
+
+        seek_points_add(info, 0, start);
+    }
+    else
+        seek_points_reset(info);
+
     return TRUE;
 }
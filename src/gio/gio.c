@@ -17,6 +17,7 @@
  * the use of this software.
  */
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,12 +29,29 @@
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
 
+/* Files opened read-only are read through a buffer of this size.  Each
+ * request to a gvfs backend is a round trip to the daemon (and often over the
+ * network), so small reads are served from the buffer, seeks within it cost
+ * nothing, and once reading is sequential the next block is fetched by a
+ * helper thread while the current one is consumed. */
+#define READ_BUFSIZE (256 * 1024)
+
 typedef struct {
     GFile * file;
     GIOStream * iostream;
     GInputStream * istream;
     GOutputStream * ostream;
     GSeekable * seekable;
+
+    bool_t buffered;
+    unsigned char * buf, * next;
+    int64_t buf_pos;        /* stream position of buf[0] */
+    int buf_len, buf_off;
+    int next_len;           /* -1 if next holds nothing */
+    GError * next_error;
+    bool_t prefetching;
+    pthread_t prefetch_thread;
+    int sequential;         /* refills since the last seek */
 } FileData;
 
 #define gio_error(...) do { \
@@ -74,6 +92,8 @@ static void * gio_fopen (const char * filename, const char * mode)
             data->istream = (GInputStream *) g_file_read (data->file, 0, & error);
             CHECK_ERROR ("open", filename);
             data->seekable = (GSeekable *) data->istream;
+            data->buffered = TRUE;
+            data->next_len = -1;
         }
         break;
     case 'w':
@@ -117,11 +137,188 @@ FAILED:
     return 0;
 }
 
+static void * prefetch_worker (void * arg)
+{
+    FileData * data = arg;
+    gsize readed = 0;
+
+    g_input_stream_read_all (data->istream, data->next, READ_BUFSIZE, & readed,
+     0, & data->next_error);
+    data->next_len = readed;
+
+    return 0;
+}
+
+/* The stream must not be touched while a prefetch is running. */
+static void prefetch_wait (FileData * data)
+{
+    if (data->prefetching)
+    {
+        pthread_join (data->prefetch_thread, 0);
+        data->prefetching = FALSE;
+    }
+}
+
+static void prefetch_discard (FileData * data)
+{
+    prefetch_wait (data);
+
+    if (data->next_error)
+    {
+        g_error_free (data->next_error);
+        data->next_error = 0;
+    }
+
+    data->next_len = -1;
+}
+
+static void prefetch_start (FileData * data)
+{
+    if (! data->next)
+        data->next = malloc (READ_BUFSIZE);
+
+    data->next_len = -1;
+    data->prefetching = ! pthread_create (& data->prefetch_thread, 0,
+     prefetch_worker, data);
+}
+
+/* Moves on to the block following the current buffer. */
+static bool_t buffer_refill (FileData * data, const char * filename)
+{
+    GError * error = 0;
+
+    data->buf_pos += data->buf_len;
+    data->buf_off = data->buf_len = 0;
+
+    if (! data->buf)
+        data->buf = malloc (READ_BUFSIZE);
+
+    if (data->prefetching || data->next_len >= 0)
+    {
+        prefetch_wait (data);
+
+        unsigned char * swap = data->buf;
+        data->buf = data->next;
+        data->next = swap;
+        data->buf_len = data->next_len;
+        data->next_len = -1;
+
+        error = data->next_error;
+        data->next_error = 0;
+    }
+    else
+    {
+        gsize readed = 0;
+        g_input_stream_read_all (data->istream, data->buf, READ_BUFSIZE,
+         & readed, 0, & error);
+        data->buf_len = readed;
+    }
+
+    CHECK_ERROR ("read from", filename);
+
+    /* a short block means end of file; nothing more to fetch */
+    if (data->buf_len == READ_BUFSIZE && ++ data->sequential >= 2)
+        prefetch_start (data);
+
+    return TRUE;
+
+FAILED:
+    return FALSE;
+}
+
+static int64_t buffer_read (FileData * data, unsigned char * buf, int64_t len,
+ const char * filename)
+{
+    GError * error = 0;
+    int64_t done = 0;
+
+    while (done < len)
+    {
+        if (data->buf_off == data->buf_len)
+        {
+            /* large reads go straight to the caller if nothing is queued */
+            if (len - done >= READ_BUFSIZE && ! data->prefetching && data->next_len < 0)
+            {
+                gsize readed = 0;
+                g_input_stream_read_all (data->istream, buf + done, len - done,
+                 & readed, 0, & error);
+
+                data->buf_pos += data->buf_len + readed;
+                data->buf_off = data->buf_len = 0;
+                done += readed;
+
+                CHECK_ERROR ("read from", filename);
+                break;
+            }
+
+            if (! buffer_refill (data, filename) || ! data->buf_len)
+                break;
+        }
+
+        int copy = MIN (len - done, data->buf_len - data->buf_off);
+        memcpy (buf + done, data->buf + data->buf_off, copy);
+        data->buf_off += copy;
+        done += copy;
+    }
+
+    return done;
+
+FAILED:
+    return done;
+}
+
+static int buffer_seek (FileData * data, int64_t offset, int whence,
+ const char * filename)
+{
+    GError * error = 0;
+
+    if (whence == SEEK_CUR)
+    {
+        offset += data->buf_pos + data->buf_off;
+        whence = SEEK_SET;
+    }
+
+    if (whence == SEEK_SET && offset >= data->buf_pos &&
+     offset <= data->buf_pos + data->buf_len)
+    {
+        data->buf_off = offset - data->buf_pos;
+        return 0;
+    }
+
+    prefetch_discard (data);
+    data->buf_off = data->buf_len = 0;
+    data->sequential = 0;
+
+    if (whence == SEEK_SET)
+    {
+        g_seekable_seek (data->seekable, offset, G_SEEK_SET, NULL, & error);
+        CHECK_ERROR ("seek within", filename);
+        data->buf_pos = offset;
+    }
+    else
+    {
+        g_seekable_seek (data->seekable, offset, G_SEEK_END, NULL, & error);
+        CHECK_ERROR ("seek within", filename);
+        data->buf_pos = g_seekable_tell (data->seekable);
+    }
+
+    return 0;
+
+FAILED:
+    /* the stream position is unknown now; go by what GIO reports */
+    data->buf_pos = g_seekable_tell (data->seekable);
+    return -1;
+}
+
 static int gio_fclose (VFSFile * file)
 {
     FileData * data = vfs_get_handle (file);
     GError * error = 0;
 
+    prefetch_discard (data);
+    free (data->buf);
+    free (data->next);
+
     if (data->iostream)
     {
         g_io_stream_close (data->iostream, 0, & error);
@@ -164,6 +361,12 @@ static int64_t gio_fread (void * buf, int64_t size, int64_t nitems, VFSFile * fi
         return 0;
     }
 
+    if (data->buffered)
+    {
+        int64_t readed = buffer_read (data, buf, size * nitems, vfs_get_filename (file));
+        return (size > 0) ? readed / size : 0;
+    }
+
     int64_t readed = g_input_stream_read (data->istream, buf, size * nitems, 0, & error);
     CHECK_ERROR ("read from", vfs_get_filename (file));
 
@@ -215,6 +418,9 @@ static int gio_fseek (VFSFile * file, int64_t offset, int whence)
         return -1;
     }
 
+    if (data->buffered)
+        return buffer_seek (data, offset, whence, vfs_get_filename (file));
+
     g_seekable_seek (data->seekable, offset, gwhence, NULL, & error);
     CHECK_ERROR ("seek within", vfs_get_filename (file));
 
@@ -227,6 +433,10 @@ FAILED:
 static int64_t gio_ftell (VFSFile * file)
 {
     FileData * data = vfs_get_handle (file);
+
+    if (data->buffered)
+        return data->buf_pos + data->buf_off;
+
     return g_seekable_tell (data->seekable);
 }
 
@@ -22,6 +22,8 @@
  */
 
 #include <math.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
 #include <audacious/i18n.h>
@@ -31,16 +33,36 @@
 #include <gtk/gtk.h>
 
 #include <GL/gl.h>
+#include <GL/glext.h>
 #include <GL/glx.h>
 
+#include "../visbands/visbands.h"
+#include "../vislimit/vislimit.h"
+
 #define NUM_BANDS 32
 #define DB_RANGE 40
 
 #define BAR_SPACING (3.2f / NUM_BANDS)
 #define BAR_WIDTH (0.8f * BAR_SPACING)
 
-static float logscale[NUM_BANDS + 1];
-static float colors[NUM_BANDS][NUM_BANDS][3];
+/* position and color of each bar, row by row from back to front */
+typedef struct {
+    float x, z;
+    float r, g, b;
+} BarInstance;
+
+/* the faces of a unit cube that can be seen: x, y, z and shading factor */
+static const float cube_faces[4][4][4] = {
+ {{0, 1, 0, 1}, {1, 1, 0, 1}, {1, 1, 1, 1}, {0, 1, 1, 1}},                  /* top */
+ {{0, 0, 0, 0.65f}, {0, 1, 0, 0.65f}, {0, 1, 1, 0.65f}, {0, 0, 1, 0.65f}},  /* left */
+ {{1, 1, 0, 0.65f}, {1, 0, 0, 0.65f}, {1, 0, 1, 0.65f}, {1, 1, 1, 0.65f}},  /* right */
+ {{0, 0, 0, 0.8f}, {1, 0, 0, 0.8f}, {1, 1, 0, 0.8f}, {0, 1, 0, 0.8f}}};     /* front */
+
+#define NUM_BARS (NUM_BANDS * NUM_BANDS)
+#define CUBE_VERTS 24 /* as triangles */
+
+static VisBands * s_bands;
+static BarInstance s_instances[NUM_BARS];
 
 static GLXContext s_context;
 static GtkWidget * s_widget = NULL;
@@ -48,130 +70,366 @@ static GtkWidget * s_widget = NULL;
 static int s_pos = 0;
 static float s_angle = 25, s_anglespeed = 0.05f;
 static float s_bars[NUM_BANDS][NUM_BANDS];
+static float s_heights[NUM_BARS]; /* in the order of s_instances */
+
+/* The bars are drawn in a single call: instanced from buffer objects with a
+ * small shader where the driver supports it, otherwise from client-side
+ * vertex arrays.  Function pointers are looked up for the current context. */
+enum {ATTR_CORNER, ATTR_SHADE, ATTR_ORIGIN, ATTR_COLOR, ATTR_HEIGHT};
+
+static bool_t s_gl_ready, s_instanced;
+static GLuint s_program, s_cube_vbo, s_instance_vbo, s_height_vbo;
+
+static struct {
+    PFNGLGENBUFFERSPROC GenBuffers;
+    PFNGLBINDBUFFERPROC BindBuffer;
+    PFNGLBUFFERDATAPROC BufferData;
+    PFNGLBUFFERSUBDATAPROC BufferSubData;
+    PFNGLCREATESHADERPROC CreateShader;
+    PFNGLSHADERSOURCEPROC ShaderSource;
+    PFNGLCOMPILESHADERPROC CompileShader;
+    PFNGLGETSHADERIVPROC GetShaderiv;
+    PFNGLDELETESHADERPROC DeleteShader;
+    PFNGLCREATEPROGRAMPROC CreateProgram;
+    PFNGLATTACHSHADERPROC AttachShader;
+    PFNGLBINDATTRIBLOCATIONPROC BindAttribLocation;
+    PFNGLLINKPROGRAMPROC LinkProgram;
+    PFNGLGETPROGRAMIVPROC GetProgramiv;
+    PFNGLUSEPROGRAMPROC UseProgram;
+    PFNGLGETUNIFORMLOCATIONPROC GetUniformLocation;
+    PFNGLUNIFORM1FPROC Uniform1f;
+    PFNGLENABLEVERTEXATTRIBARRAYPROC EnableVertexAttribArray;
+    PFNGLDISABLEVERTEXATTRIBARRAYPROC DisableVertexAttribArray;
+    PFNGLVERTEXATTRIBPOINTERPROC VertexAttribPointer;
+    PFNGLVERTEXATTRIBDIVISORARBPROC VertexAttribDivisor;
+    PFNGLDRAWARRAYSINSTANCEDARBPROC DrawArraysInstanced;
+} gl;
+
+static const char vertex_shader[] =
+ "#version 120\n"
+ "attribute vec3 corner;\n"
+ "attribute float shade;\n"
+ "attribute vec2 origin;\n"
+ "attribute vec3 color;\n"
+ "attribute float height;\n"
+ "uniform float bar_width;\n"
+ "varying vec3 v_color;\n"
+ "void main ()\n"
+ "{\n"
+ "    vec3 pos = vec3 (origin.x + corner.x * bar_width, corner.y * height,\n"
+ "     origin.y + corner.z * bar_width);\n"
+ "    gl_Position = gl_ModelViewProjectionMatrix * vec4 (pos, 1.0);\n"
+ "    v_color = color * (0.2 + 0.8 * height) * shade;\n"
+ "}\n";
+
+static const char fragment_shader[] =
+ "#version 120\n"
+ "varying vec3 v_color;\n"
+ "void main ()\n"
+ "{\n"
+ "    gl_FragColor = vec4 (v_color, 1.0);\n"
+ "}\n";
 
 static bool_t init (void)
 {
-    for (int i = 0; i <= NUM_BANDS; i ++)
-        logscale[i] = powf (256, (float) i / NUM_BANDS) - 0.5f;
+    s_bands = visbands_new (NUM_BANDS);
 
-    for (int y = 0; y < NUM_BANDS; y ++)
+    for (int i = 0; i < NUM_BANDS; i ++)
     {
-        float yf = (float) y / (NUM_BANDS - 1);
+        float xf = (float) i / (NUM_BANDS - 1);
 
-        for (int x = 0; x < NUM_BANDS; x ++)
+        for (int j = 0; j < NUM_BANDS; j ++)
         {
-            float xf = (float) x / (NUM_BANDS - 1);
-
-            colors[x][y][0] = (1 - xf) * (1 - yf);
-            colors[x][y][1] = xf;
-            colors[x][y][2] = yf;
+            float yf = (float) j / (NUM_BANDS - 1);
+            BarInstance * bar = & s_instances[i * NUM_BANDS + j];
+
+            bar->x = 1.6f - BAR_SPACING * j;
+            bar->z = -1.6f + (NUM_BANDS - i) * BAR_SPACING;
+            bar->r = (1 - xf) * (1 - yf);
+            bar->g = xf;
+            bar->b = yf;
         }
     }
 
     return TRUE;
 }
 
-/* stolen from the skins plugin */
-/* convert linear frequency graph to logarithmic one */
-static void make_log_graph (const float * freq, float * graph)
+static void cleanup (void)
 {
-    for (int i = 0; i < NUM_BANDS; i ++)
-    {
-        /* sum up values in freq array between logscale[i] and logscale[i + 1],
-           including fractional parts */
-        int a = ceilf (logscale[i]);
-        int b = floorf (logscale[i + 1]);
-        float sum = 0;
-
-        if (b < a)
-            sum += freq[b] * (logscale[i + 1] - logscale[i]);
-        else
-        {
-            if (a > 0)
-                sum += freq[a - 1] * (a - logscale[i]);
-            for (; a < b; a ++)
-                sum += freq[a];
-            if (b < 256)
-                sum += freq[b] * (logscale[i + 1] - b);
-        }
-
-        /* fudge factor to make the graph have the same overall height as a
-           12-band one no matter how many bands there are */
-        sum *= (float) NUM_BANDS / 12;
-
-        /* convert to dB */
-        float val = 20 * log10f (sum);
-
-        /* scale (-DB_RANGE, 0.0) to (0.0, 1.0) */
-        val = 1 + val / DB_RANGE;
-
-        graph[i] = CLAMP (val, 0, 1);
-    }
+    visbands_free (s_bands);
+    s_bands = NULL;
 }
 
 static void render_freq (const float * freq)
 {
-    make_log_graph (freq, s_bars[s_pos]);
+    /* nothing to animate if the graph cannot be seen */
+    if (! s_widget || ! vislimit_visible (s_widget))
+        return;
+
+    visbands_compute (s_bands, freq, DB_RANGE, s_bars[s_pos]);
     s_pos = (s_pos + 1) % NUM_BANDS;
 
+    for (int i = 0; i < NUM_BANDS; i ++)
+    {
+        const float * row = s_bars[(s_pos + i) % NUM_BANDS];
+
+        for (int j = 0; j < NUM_BANDS; j ++)
+            s_heights[i * NUM_BANDS + j] = row[j] * 1.6f;
+    }
+
     s_angle += s_anglespeed;
     if (s_angle > 45 || s_angle < -45)
         s_anglespeed = -s_anglespeed;
 
-    if (s_widget)
+    /* the graph turns on every frame */
+    if (vislimit_frame_due (s_widget, TRUE))
         gtk_widget_queue_draw (s_widget);
 }
 
 static void clear (void)
 {
     memset (s_bars, 0, sizeof s_bars);
+    memset (s_heights, 0, sizeof s_heights);
 
     if (s_widget)
         gtk_widget_queue_draw (s_widget);
 }
 
-static void draw_rectangle (float x1, float y1, float z1, float x2, float y2,
- float z2, float r, float g, float b)
+static bool_t gl_version_at_least (int major, int minor)
+{
+    const char * version = (const char *) glGetString (GL_VERSION);
+    int a, b;
+
+    if (! version || sscanf (version, "%d.%d", & a, & b) < 2)
+        return FALSE;
+
+    return a > major || (a == major && b >= minor);
+}
+
+static bool_t gl_has_extension (const char * name)
+{
+    const char * list = (const char *) glGetString (GL_EXTENSIONS);
+    int len = strlen (name);
+
+    for (const char * p = list; p && (p = strstr (p, name)); p += len)
+    {
+        if ((p == list || p[-1] == ' ') && (p[len] == ' ' || ! p[len]))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static GLuint compile_shader (GLenum type, const char * source)
+{
+    GLuint shader = gl.CreateShader (type);
+    GLint ok = GL_FALSE;
+
+    gl.ShaderSource (shader, 1, & source, NULL);
+    gl.CompileShader (shader);
+    gl.GetShaderiv (shader, GL_COMPILE_STATUS, & ok);
+
+    if (! ok)
+    {
+        gl.DeleteShader (shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+#define LOAD(func, name) \
+    (gl.func = (void *) glXGetProcAddressARB ((const GLubyte *) (name)))
+
+/* needs OpenGL 2.0 plus instanced arrays, either from 3.3 or by extension */
+static bool_t setup_instanced (void)
+{
+    const char * divisor, * instanced;
+
+    if (! gl_version_at_least (2, 0))
+        return FALSE;
+
+    if (gl_version_at_least (3, 3))
+    {
+        divisor = "glVertexAttribDivisor";
+        instanced = "glDrawArraysInstanced";
+    }
+    else if (gl_has_extension ("GL_ARB_instanced_arrays") &&
+     gl_has_extension ("GL_ARB_draw_instanced"))
+    {
+        divisor = "glVertexAttribDivisorARB";
+        instanced = "glDrawArraysInstancedARB";
+    }
+    else
+        return FALSE;
+
+    if (! LOAD (GenBuffers, "glGenBuffers") ||
+     ! LOAD (BindBuffer, "glBindBuffer") ||
+     ! LOAD (BufferData, "glBufferData") ||
+     ! LOAD (BufferSubData, "glBufferSubData") ||
+     ! LOAD (CreateShader, "glCreateShader") ||
+     ! LOAD (ShaderSource, "glShaderSource") ||
+     ! LOAD (CompileShader, "glCompileShader") ||
+     ! LOAD (GetShaderiv, "glGetShaderiv") ||
+     ! LOAD (DeleteShader, "glDeleteShader") ||
+     ! LOAD (CreateProgram, "glCreateProgram") ||
+     ! LOAD (AttachShader, "glAttachShader") ||
+     ! LOAD (BindAttribLocation, "glBindAttribLocation") ||
+     ! LOAD (LinkProgram, "glLinkProgram") ||
+     ! LOAD (GetProgramiv, "glGetProgramiv") ||
+     ! LOAD (UseProgram, "glUseProgram") ||
+     ! LOAD (GetUniformLocation, "glGetUniformLocation") ||
+     ! LOAD (Uniform1f, "glUniform1f") ||
+     ! LOAD (EnableVertexAttribArray, "glEnableVertexAttribArray") ||
+     ! LOAD (DisableVertexAttribArray, "glDisableVertexAttribArray") ||
+     ! LOAD (VertexAttribPointer, "glVertexAttribPointer") ||
+     ! LOAD (VertexAttribDivisor, divisor) ||
+     ! LOAD (DrawArraysInstanced, instanced))
+        return FALSE;
+
+    GLuint vs = compile_shader (GL_VERTEX_SHADER, vertex_shader);
+    GLuint fs = compile_shader (GL_FRAGMENT_SHADER, fragment_shader);
+
+    if (! vs || ! fs)
+    {
+        if (vs)
+            gl.DeleteShader (vs);
+        if (fs)
+            gl.DeleteShader (fs);
+
+        return FALSE;
+    }
+
+    s_program = gl.CreateProgram ();
+    gl.AttachShader (s_program, vs);
+    gl.AttachShader (s_program, fs);
+    gl.BindAttribLocation (s_program, ATTR_CORNER, "corner");
+    gl.BindAttribLocation (s_program, ATTR_SHADE, "shade");
+    gl.BindAttribLocation (s_program, ATTR_ORIGIN, "origin");
+    gl.BindAttribLocation (s_program, ATTR_COLOR, "color");
+    gl.BindAttribLocation (s_program, ATTR_HEIGHT, "height");
+    gl.LinkProgram (s_program);
+
+    /* flagged for deletion; freed along with the program */
+    gl.DeleteShader (vs);
+    gl.DeleteShader (fs);
+
+    GLint ok = GL_FALSE;
+    gl.GetProgramiv (s_program, GL_LINK_STATUS, & ok);
+    if (! ok)
+        return FALSE;
+
+    gl.UseProgram (s_program);
+    gl.Uniform1f (gl.GetUniformLocation (s_program, "bar_width"), BAR_WIDTH);
+    gl.UseProgram (0);
+
+    /* split the cube faces into triangles */
+    float cube[CUBE_VERTS][4];
+    int n = 0;
+
+    for (int f = 0; f < 4; f ++)
+    {
+        static const int order[6] = {0, 1, 2, 0, 2, 3};
+
+        for (int v = 0; v < 6; v ++)
+            memcpy (cube[n ++], cube_faces[f][order[v]], sizeof cube[0]);
+    }
+
+    GLuint buffers[3];
+    gl.GenBuffers (3, buffers);
+    s_cube_vbo = buffers[0];
+    s_instance_vbo = buffers[1];
+    s_height_vbo = buffers[2];
+
+    gl.BindBuffer (GL_ARRAY_BUFFER, s_cube_vbo);
+    gl.BufferData (GL_ARRAY_BUFFER, sizeof cube, cube, GL_STATIC_DRAW);
+    gl.BindBuffer (GL_ARRAY_BUFFER, s_instance_vbo);
+    gl.BufferData (GL_ARRAY_BUFFER, sizeof s_instances, s_instances, GL_STATIC_DRAW);
+    gl.BindBuffer (GL_ARRAY_BUFFER, s_height_vbo);
+    gl.BufferData (GL_ARRAY_BUFFER, sizeof s_heights, NULL, GL_STREAM_DRAW);
+    gl.BindBuffer (GL_ARRAY_BUFFER, 0);
+
+    return TRUE;
+}
+
+static void instance_attrib (int attr, int size, size_t offset, GLsizei stride)
+{
+    gl.EnableVertexAttribArray (attr);
+    gl.VertexAttribPointer (attr, size, GL_FLOAT, GL_FALSE, stride, (void *) offset);
+    gl.VertexAttribDivisor (attr, 1);
+}
+
+static void draw_bars_instanced (void)
 {
-    glColor3f (r, g, b);
-
-    glBegin (GL_POLYGON);
-    glVertex3f (x1, y2, z1);
-    glVertex3f (x2, y2, z1);
-    glVertex3f (x2, y2, z2);
-    glVertex3f (x1, y2, z2);
-    glEnd ();
-
-    glColor3f (0.65f * r, 0.65f * g, 0.65f * b);
-
-    glBegin (GL_POLYGON);
-    glVertex3f (x1, y1, z1);
-    glVertex3f (x1, y2, z1);
-    glVertex3f (x1, y2, z2);
-    glVertex3f (x1, y1, z2);
-    glEnd ();
-
-    glBegin (GL_POLYGON);
-    glVertex3f (x2, y2, z1);
-    glVertex3f (x2, y1, z1);
-    glVertex3f (x2, y1, z2);
-    glVertex3f (x2, y2, z2);
-    glEnd ();
-
-    glColor3f (0.8f * r, 0.8f * g, 0.8f * b);
-
-    glBegin (GL_POLYGON);
-    glVertex3f (x1, y1, z1);
-    glVertex3f (x2, y1, z1);
-    glVertex3f (x2, y2, z1);
-    glVertex3f (x1, y2, z1);
-    glEnd ();
+    gl.UseProgram (s_program);
+
+    gl.BindBuffer (GL_ARRAY_BUFFER, s_cube_vbo);
+    gl.EnableVertexAttribArray (ATTR_CORNER);
+    gl.VertexAttribPointer (ATTR_CORNER, 3, GL_FLOAT, GL_FALSE,
+     4 * sizeof (float), (void *) 0);
+    gl.EnableVertexAttribArray (ATTR_SHADE);
+    gl.VertexAttribPointer (ATTR_SHADE, 1, GL_FLOAT, GL_FALSE,
+     4 * sizeof (float), (void *) (3 * sizeof (float)));
+
+    gl.BindBuffer (GL_ARRAY_BUFFER, s_instance_vbo);
+    instance_attrib (ATTR_ORIGIN, 2, offsetof (BarInstance, x), sizeof (BarInstance));
+    instance_attrib (ATTR_COLOR, 3, offsetof (BarInstance, r), sizeof (BarInstance));
+
+    gl.BindBuffer (GL_ARRAY_BUFFER, s_height_vbo);
+    gl.BufferSubData (GL_ARRAY_BUFFER, 0, sizeof s_heights, s_heights);
+    instance_attrib (ATTR_HEIGHT, 1, 0, sizeof (float));
+
+    gl.DrawArraysInstanced (GL_TRIANGLES, 0, CUBE_VERTS, NUM_BARS);
+
+    for (int attr = ATTR_CORNER; attr <= ATTR_HEIGHT; attr ++)
+    {
+        gl.VertexAttribDivisor (attr, 0);
+        gl.DisableVertexAttribArray (attr);
+    }
+
+    gl.BindBuffer (GL_ARRAY_BUFFER, 0);
+    gl.UseProgram (0);
 }
 
-static void draw_bar (float x, float z, float h, float r, float g, float b)
+/* fallback for older drivers: the same geometry, built on the CPU */
+static void draw_bars_arrays (void)
 {
-    draw_rectangle (x, 0, z, x + BAR_WIDTH, h, z + BAR_WIDTH,
-     r * (0.2f + 0.8f * h), g * (0.2f + 0.8f * h), b * (0.2f + 0.8f * h));
+    static float verts[NUM_BARS * 16][3];
+    static float cols[NUM_BARS * 16][3];
+    int n = 0;
+
+    for (int i = 0; i < NUM_BARS; i ++)
+    {
+        const BarInstance * bar = & s_instances[i];
+        float h = s_heights[i];
+        float scale = 0.2f + 0.8f * h;
+
+        for (int f = 0; f < 4; f ++)
+        {
+            for (int v = 0; v < 4; v ++)
+            {
+                const float * c = cube_faces[f][v];
+
+                verts[n][0] = bar->x + c[0] * BAR_WIDTH;
+                verts[n][1] = c[1] * h;
+                verts[n][2] = bar->z + c[2] * BAR_WIDTH;
+                cols[n][0] = bar->r * scale * c[3];
+                cols[n][1] = bar->g * scale * c[3];
+                cols[n][2] = bar->b * scale * c[3];
+                n ++;
+            }
+        }
+    }
+
+    glEnableClientState (GL_VERTEX_ARRAY);
+    glEnableClientState (GL_COLOR_ARRAY);
+    glVertexPointer (3, GL_FLOAT, 0, verts);
+    glColorPointer (3, GL_FLOAT, 0, cols);
+
+    glDrawArrays (GL_QUADS, 0, n);
+
+    glDisableClientState (GL_COLOR_ARRAY);
+    glDisableClientState (GL_VERTEX_ARRAY);
 }
 
 static void draw_bars (void)
@@ -182,17 +440,10 @@ static void draw_bars (void)
     glRotatef (s_angle + 180.0f, 0.0f, 1.0f, 0.0f);
     glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
 
-    for (int i = 0; i < NUM_BANDS; i ++)
-    {
-        float z = -1.6f + (NUM_BANDS - i) * BAR_SPACING;
-
-        for (int j = 0; j < NUM_BANDS; j ++)
-        {
-            draw_bar (1.6f - BAR_SPACING * j, z,
-             s_bars[(s_pos + i) % NUM_BANDS][j] * 1.6,
-             colors[i][j][0], colors[i][j][1], colors[i][j][2]);
-        }
-    }
+    if (s_instanced)
+        draw_bars_instanced ();
+    else
+        draw_bars_arrays ();
 
     glPolygonMode (GL_FRONT_AND_BACK, GL_FILL);
     glPopMatrix ();
@@ -205,6 +456,12 @@ static bool_t draw_cb (GtkWidget * widget, cairo_t * cr)
 
     glXMakeCurrent (xdisplay, xwindow, s_context);
 
+    if (! s_gl_ready)
+    {
+        s_instanced = setup_instanced ();
+        s_gl_ready = TRUE;
+    }
+
     GtkAllocation alloc;
     gtk_widget_get_allocation (widget, & alloc);
     glViewport (0, 0, alloc.width, alloc.height);
@@ -250,6 +507,8 @@ static /* GtkWidget * */ void * get_widget (void)
     g_signal_connect (s_widget, "draw", (GCallback) draw_cb, NULL);
     g_signal_connect (s_widget, "destroy", (GCallback) gtk_widget_destroyed, & s_widget);
 
+    vislimit_attach (s_widget, NULL, NULL);
+
     GdkScreen * screen = gdk_screen_get_default ();
     Display * xdisplay = GDK_SCREEN_XDISPLAY (screen);
     int nscreen = GDK_SCREEN_XNUMBER (screen);
@@ -268,6 +527,7 @@ static /* GtkWidget * */ void * get_widget (void)
 
     XVisualInfo * xvinfo = glXChooseVisual (xdisplay, nscreen, attribs);
     s_context = glXCreateContext (xdisplay, xvinfo, 0, True);
+    s_gl_ready = FALSE;
 
     /* Fix up visual/colormap */
     GdkVisual * visual = gdk_x11_screen_lookup_visual (screen, xvinfo->visualid);
@@ -293,6 +553,7 @@ AUD_VIS_PLUGIN
     .domain = PACKAGE,
     .about_text = about_text,
     .init = init,
+    .cleanup = cleanup,
     .render_freq = render_freq,
     .clear = clear,
     .get_widget = get_widget,
@@ -34,7 +34,7 @@ GtkWidget * playlist_get_treeview (gint playlist)
     if (!page)
         return NULL;
 
-    return g_object_get_data ((GObject *) page, "treeview");
+    return ui_playlist_notebook_get_treeview (page);
 }
 
 gint playlist_count_selected_in_range (gint list, gint top, gint length)
@@ -29,6 +29,8 @@
 #include <libaudgui/libaudgui-gtk.h>
 
 #include "ui_infoarea.h"
+#include "../visbands/visbands.h"
+#include "../vislimit/vislimit.h"
 
 #define SPACING 8
 #define ICON_SIZE 64
@@ -55,58 +57,40 @@ typedef struct {
 
 static struct {
     GtkWidget * widget;
-    gchar bars[VIS_BANDS];
-    gchar delay[VIS_BANDS];
+    gint bars[VIS_BANDS];
+    gint delay[VIS_BANDS];
+    gboolean colors_valid;
+    gfloat colors[VIS_BANDS][3];
 } vis;
 
+static VisBands * vis_bands;
+
 /****************************************************************************/
 
 static UIInfoArea * area = NULL;
 
 static void vis_render_cb (const gfloat * freq)
 {
-    /* xscale[i] = pow (256, i / VIS_BANDS) - 0.5; */
-    const gfloat xscale[VIS_BANDS + 1] = {0.5, 1.09, 2.02, 3.5, 5.85, 9.58,
-     15.5, 24.9, 39.82, 63.5, 101.09, 160.77, 255.5};
-
-    for (gint i = 0; i < VIS_BANDS; i ++)
-    {
-        gint a = ceilf (xscale[i]);
-        gint b = floorf (xscale[i + 1]);
-        gfloat n = 0;
-
-        if (b < a)
-            n += freq[b] * (xscale[i + 1] - xscale[i]);
-        else
-        {
-            if (a > 0)
-                n += freq[a - 1] * (a - xscale[i]);
-            for (; a < b; a ++)
-                n += freq[a];
-            if (b < 256)
-                n += freq[b] * (xscale[i + 1] - b);
-        }
+    gfloat levels[VIS_BANDS];
 
-        /* 40 dB range */
-        gint x = 40 + 20 * log10f (n);
-        x = CLAMP (x, 0, 40);
+    visbands_compute (vis_bands, freq, 40, levels);
 
-        vis.bars[i] -= MAX (0, VIS_FALLOFF - vis.delay[i]);
+    gboolean changed = visbands_falloff (levels, VIS_BANDS, 40, VIS_DELAY,
+     VIS_FALLOFF, vis.bars, vis.delay);
 
-        if (vis.delay[i])
-            vis.delay[i] --;
-
-        if (x > vis.bars[i])
-        {
-            vis.bars[i] = x;
-            vis.delay[i] = VIS_DELAY;
-        }
-    }
-
-    if (vis.widget)
+    if (vis.widget && vislimit_frame_due (vis.widget, changed))
         gtk_widget_queue_draw (vis.widget);
 }
 
+/* listen for data only while the bars are on screen */
+static void vis_visible_cb (gboolean visible)
+{
+    if (visible)
+        aud_vis_func_add (AUD_VIS_TYPE_FREQ, (VisFunc) vis_render_cb);
+    else
+        aud_vis_func_remove ((VisFunc) vis_render_cb);
+}
+
 static void vis_clear_cb (void)
 {
     memset (vis.bars, 0, sizeof vis.bars);
@@ -224,52 +208,56 @@ static void hsv_to_rgb (gfloat h, gfloat s, gfloat v, gfloat * r, gfloat * g,
     * b = v * (1 - s * (1 - * b));
 }
 
-static void get_color (gint i, gfloat * r, gfloat * g, gfloat * b)
+/* recomputed only when the theme changes */
+static void update_colors (void)
 {
-    static GdkRGBA c;
-    static bool_t valid = FALSE;
-
-    if (! valid)
-    {
-        /* we want a color that matches the current theme
-         * selected color of a GtkEntry should be reasonable */
-        GtkStyleContext * style = gtk_style_context_new ();
-        GtkWidgetPath * path = gtk_widget_path_new ();
-        gtk_widget_path_append_type (path, GTK_TYPE_ENTRY);
-        gtk_style_context_set_path (style, path);
-        gtk_widget_path_free (path);
-        gtk_style_context_get_background_color (style, GTK_STATE_FLAG_SELECTED, & c);
-        g_object_unref (style);
-        valid = TRUE;
-    }
+    /* we want a color that matches the current theme
+     * selected color of a GtkEntry should be reasonable */
+    GdkRGBA c;
+    GtkStyleContext * style = gtk_style_context_new ();
+    GtkWidgetPath * path = gtk_widget_path_new ();
+    gtk_widget_path_append_type (path, GTK_TYPE_ENTRY);
+    gtk_style_context_set_path (style, path);
+    gtk_widget_path_free (path);
+    gtk_style_context_get_background_color (style, GTK_STATE_FLAG_SELECTED, & c);
+    g_object_unref (style);
 
     gfloat h, s, v;
     rgb_to_hsv (c.red, c.green, c.blue, & h, & s, & v);
 
     if (s < 0.1) /* monochrome theme? use blue instead */
-    {
         h = 5;
-        s = 0.75;
+
+    for (gint i = 0; i < VIS_BANDS; i ++)
+    {
+        s = 1 - 0.9 * i / (VIS_BANDS - 1);
+        v = 0.75 + 0.25 * i / (VIS_BANDS - 1);
+
+        hsv_to_rgb (h, s, v, & vis.colors[i][0], & vis.colors[i][1], & vis.colors[i][2]);
     }
 
-    s = 1 - 0.9 * i / (VIS_BANDS - 1);
-    v = 0.75 + 0.25 * i / (VIS_BANDS - 1);
+    vis.colors_valid = TRUE;
+}
 
-    hsv_to_rgb (h, s, v, r, g, b);
+static void vis_style_updated (GtkWidget * widget)
+{
+    vis.colors_valid = FALSE;
 }
 
 static gboolean draw_vis_cb (GtkWidget * widget, cairo_t * cr)
 {
     clear (widget, cr);
 
+    if (! vis.colors_valid)
+        update_colors ();
+
     for (gint i = 0; i < VIS_BANDS; i++)
     {
         gint x = SPACING + 8 * i;
         gint t = VIS_CENTER - vis.bars[i];
         gint m = MIN (VIS_CENTER + vis.bars[i], HEIGHT);
 
-        gfloat r, g, b;
-        get_color (i, & r, & g, & b);
+        gfloat r = vis.colors[i][0], g = vis.colors[i][1], b = vis.colors[i][2];
 
         cairo_set_source_rgb (cr, r, g, b);
         cairo_rectangle (cr, x, t, 6, VIS_CENTER - t);
@@ -399,6 +387,59 @@ static void ui_infoarea_set_title (void)
     gtk_widget_queue_draw (area->main);
 }
 
+/* Decodes the current song's art straight to the size it will be shown at,
+ * which lets the JPEG loader skip most of the work for large covers. */
+static void art_size_prepared (GdkPixbufLoader * loader, int width, int height,
+ void * size)
+{
+    int max = GPOINTER_TO_INT (size);
+
+    if (width > max || height > max)
+    {
+        if (width > height)
+            gdk_pixbuf_loader_set_size (loader, max, MAX (1, height * max / width));
+        else
+            gdk_pixbuf_loader_set_size (loader, MAX (1, width * max / height), max);
+    }
+}
+
+static GdkPixbuf * art_request_current_scaled (int size)
+{
+    int list = aud_playlist_get_playing ();
+    int entry = aud_playlist_get_position (list);
+    if (entry < 0)
+        return NULL;
+
+    char * filename = aud_playlist_entry_get_filename (list, entry);
+    const void * data;
+    int64_t len;
+    GdkPixbuf * pixbuf = NULL;
+
+    aud_art_request_data (filename, & data, & len);
+
+    if (data)
+    {
+        GdkPixbufLoader * loader = gdk_pixbuf_loader_new ();
+        g_signal_connect (loader, "size-prepared", (GCallback) art_size_prepared,
+         GINT_TO_POINTER (size));
+
+        if (gdk_pixbuf_loader_write (loader, data, len, NULL) &&
+         gdk_pixbuf_loader_close (loader, NULL))
+        {
+            if ((pixbuf = gdk_pixbuf_loader_get_pixbuf (loader)))
+                g_object_ref (pixbuf);
+        }
+        else
+            gdk_pixbuf_loader_close (loader, NULL);
+
+        g_object_unref (loader);
+        aud_art_unref (filename);
+    }
+
+    str_unref (filename);
+    return pixbuf;
+}
+
 static void set_album_art (void)
 {
     g_return_if_fail (area);
@@ -406,7 +447,7 @@ static void set_album_art (void)
     if (area->pb)
         g_object_unref (area->pb);
 
-    area->pb = audgui_pixbuf_request_current ();
+    area->pb = art_request_current_scaled (ICON_SIZE);
     if (! area->pb)
         area->pb = audgui_pixbuf_fallback ();
     if (area->pb)
@@ -494,10 +535,14 @@ void ui_infoarea_show_vis (gboolean show)
         gtk_box_pack_start ((GtkBox *) area->box, vis.widget, FALSE, FALSE, 0);
 
         g_signal_connect (vis.widget, "draw", (GCallback) draw_vis_cb, NULL);
-        gtk_widget_show (vis.widget);
+        g_signal_connect (vis.widget, "style-updated", (GCallback) vis_style_updated, NULL);
+
+        vis_bands = visbands_new (VIS_BANDS);
 
         aud_vis_func_add (AUD_VIS_TYPE_CLEAR, (VisFunc) vis_clear_cb);
-        aud_vis_func_add (AUD_VIS_TYPE_FREQ, (VisFunc) vis_render_cb);
+        vislimit_attach (vis.widget, (VisLimitFunc) vis_visible_cb, NULL);
+
+        gtk_widget_show (vis.widget);
     }
     else
     {
@@ -510,6 +555,9 @@ void ui_infoarea_show_vis (gboolean show)
         gtk_widget_destroy (vis.widget);
 
         memset (& vis, 0, sizeof vis);
+
+        visbands_free (vis_bands);
+        vis_bands = NULL;
     }
 }
 
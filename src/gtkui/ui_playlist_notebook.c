@@ -41,6 +41,28 @@ static gint highlighted = -1;
 
 static gint switch_handler = 0;
 static gint reorder_handler = 0;
+static gint park_source = 0;
+
+/* The tree view for a tab is created only when the tab is first shown, and
+ * destroyed again once the tab has been hidden for this long.  Until then the
+ * page is an empty scrolled window. */
+#define PARK_DELAY 60 /* seconds */
+
+static gint page_get_id (GtkWidget * page)
+{
+    return GPOINTER_TO_INT (g_object_get_data ((GObject *) page, "playlist-id"));
+}
+
+/* returns NULL if the tab has no tree view at the moment */
+static GtkWidget * page_get_treeview (GtkWidget * page)
+{
+    return g_object_get_data ((GObject *) page, "treeview");
+}
+
+static gint now_seconds (void)
+{
+    return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
 
 static void add_button_cb (GtkButton * button, void * unused)
 {
@@ -129,7 +151,11 @@ GtkNotebook *ui_playlist_get_notebook(void)
 static void save_column_widths ()
 {
     int current = gtk_notebook_get_current_page ((GtkNotebook *) notebook);
-    GtkWidget * treeview = playlist_get_treeview (current);
+    GtkWidget * page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, current);
+    GtkWidget * treeview = page ? page_get_treeview (page) : NULL;
+
+    if (! treeview)
+        return;
 
     char * widths, * expand;
     ui_playlist_widget_get_column_widths (treeview, & widths, & expand);
@@ -196,20 +222,102 @@ static gboolean tab_button_press_cb(GtkWidget *ebox, GdkEventButton *event, gpoi
     return FALSE;
 }
 
+GtkWidget * ui_playlist_notebook_get_treeview (GtkWidget * page)
+{
+    GtkWidget * treeview = page_get_treeview (page);
+    if (treeview)
+        return treeview;
+
+    gint list = aud_playlist_by_unique_id (page_get_id (page));
+    g_return_val_if_fail (list >= 0, NULL);
+
+    treeview = ui_playlist_widget_new (list);
+    apply_column_widths (treeview);
+
+    audgui_list_set_highlight (treeview, aud_playlist_get_position (list));
+    audgui_list_set_focus (treeview, aud_playlist_get_focus (list));
+
+    GtkAdjustment * vscroll = gtk_scrolled_window_get_vadjustment
+     ((GtkScrolledWindow *) page);
+    g_signal_connect_swapped (vscroll, "value-changed",
+     G_CALLBACK (ui_playlist_widget_scroll), treeview);
+
+    gtk_container_add ((GtkContainer *) page, treeview);
+    gtk_widget_show (treeview);
+
+    g_object_set_data ((GObject *) page, "treeview", treeview);
+    g_object_set_data ((GObject *) page, "hidden-since", GINT_TO_POINTER (now_seconds ()));
+    return treeview;
+}
+
+static void park_page (GtkWidget * page)
+{
+    GtkWidget * treeview = page_get_treeview (page);
+    GtkAdjustment * vscroll = gtk_scrolled_window_get_vadjustment
+     ((GtkScrolledWindow *) page);
+
+    g_signal_handlers_disconnect_by_func (vscroll,
+     (void *) ui_playlist_widget_scroll, treeview);
+
+    g_object_set_data ((GObject *) page, "treeview", NULL);
+    gtk_widget_destroy (treeview);
+}
+
+static gboolean park_cb (void * unused)
+{
+    gint now = now_seconds ();
+    gint current = gtk_notebook_get_current_page ((GtkNotebook *) notebook);
+    gint pages = gtk_notebook_get_n_pages ((GtkNotebook *) notebook);
+    gboolean waiting = FALSE;
+
+    for (gint i = 0; i < pages; i ++)
+    {
+        GtkWidget * page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, i);
+
+        if (i == current || ! page_get_treeview (page))
+            continue;
+
+        gint since = GPOINTER_TO_INT (g_object_get_data ((GObject *) page, "hidden-since"));
+
+        if (now - since >= PARK_DELAY)
+            park_page (page);
+        else
+            waiting = TRUE;
+    }
+
+    if (! waiting)
+        park_source = 0;
+
+    return waiting;
+}
+
 static void tab_changed (GtkNotebook * notebook, GtkWidget * page, gint
  page_num, void * unused)
 {
     save_column_widths ();
-    apply_column_widths (playlist_get_treeview (page_num));
+
+    /* start the clock on the tab being hidden */
+    gint current = gtk_notebook_get_current_page (notebook);
+    GtkWidget * old = (current >= 0) ? gtk_notebook_get_nth_page (notebook, current) : NULL;
+
+    if (old && old != page)
+    {
+        g_object_set_data ((GObject *) old, "hidden-since", GINT_TO_POINTER (now_seconds ()));
+
+        if (! park_source)
+            park_source = g_timeout_add_seconds (PARK_DELAY, park_cb, NULL);
+    }
+
+    apply_column_widths (ui_playlist_notebook_get_treeview (page));
 
     aud_playlist_set_active (page_num);
 }
 
 static void tab_reordered(GtkNotebook *notebook, GtkWidget *child, guint page_num, gpointer user_data)
 {
-    GtkWidget * widget = g_object_get_data ((GObject *) child, "treeview");
-    g_return_if_fail (widget);
-    aud_playlist_reorder (ui_playlist_widget_get_playlist (widget), page_num, 1);
+    gint list = aud_playlist_by_unique_id (page_get_id (child));
+    g_return_if_fail (list >= 0);
+    aud_playlist_reorder (list, page_num, 1);
 }
 
 static GtkLabel *get_tab_label(gint playlist)
@@ -254,20 +362,11 @@ void ui_playlist_notebook_edit_tab_title (int playlist)
 
 void ui_playlist_notebook_create_tab(gint playlist)
 {
-    GtkWidget *scrollwin, *treeview;
+    GtkWidget *scrollwin;
     GtkWidget *label, *entry, *ebox, *hbox;
-    GtkAdjustment *vscroll;
     gint position = aud_playlist_get_position (playlist);
 
     scrollwin = gtk_scrolled_window_new(NULL, NULL);
-    vscroll = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrollwin));
-
-    treeview = ui_playlist_widget_new(playlist);
-    apply_column_widths (treeview);
-
-    g_object_set_data(G_OBJECT(scrollwin), "treeview", treeview);
-
-    gtk_container_add(GTK_CONTAINER(scrollwin), treeview);
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrollwin), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
     gtk_widget_show_all(scrollwin);
 
@@ -297,22 +396,18 @@ void ui_playlist_notebook_create_tab(gint playlist)
 
     int id = aud_playlist_get_unique_id (playlist);
     g_object_set_data ((GObject *) ebox, "playlist-id", GINT_TO_POINTER (id));
-    g_object_set_data ((GObject *) treeview, "playlist-id", GINT_TO_POINTER (id));
+    g_object_set_data ((GObject *) scrollwin, "playlist-id", GINT_TO_POINTER (id));
 
     if (position >= 0)
     {
         aud_playlist_select_all (playlist, FALSE);
         aud_playlist_entry_set_selected (playlist, position, TRUE);
         aud_playlist_set_focus (playlist, position);
-        audgui_list_set_highlight (treeview, position);
-        audgui_list_set_focus (treeview, position);
     }
 
     g_signal_connect(ebox, "button-press-event", G_CALLBACK(tab_button_press_cb), NULL);
     g_signal_connect(ebox, "key-press-event", G_CALLBACK(tab_key_press_cb), NULL);
     g_signal_connect(entry, "activate", G_CALLBACK(tab_title_save), ebox);
-    g_signal_connect_swapped (vscroll, "value-changed",
-     G_CALLBACK(ui_playlist_widget_scroll), treeview);
 }
 
 void ui_playlist_notebook_populate(void)
@@ -364,8 +459,7 @@ static void add_remove_pages (void)
     for (gint i = 0; i < pages; )
     {
         GtkWidget * page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, i);
-        GtkWidget * tree = g_object_get_data ((GObject *) page, "treeview");
-        gint tree_id = GPOINTER_TO_INT (g_object_get_data ((GObject *) tree, "playlist-id"));
+        gint tree_id = page_get_id (page);
 
         /* do we have an orphaned treeview? */
         if (aud_playlist_by_unique_id (tree_id) < 0)
@@ -380,7 +474,10 @@ static void add_remove_pages (void)
 
         if (tree_id == list_id)
         {
-            ui_playlist_widget_set_playlist (tree, i);
+            GtkWidget * tree = page_get_treeview (page);
+            if (tree)
+                ui_playlist_widget_set_playlist (tree, i);
+
             i ++;
             continue;
         }
@@ -391,8 +488,7 @@ static void add_remove_pages (void)
         for (gint j = i + 1; j < pages; j ++)
         {
             page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, j);
-            tree = g_object_get_data ((GObject *) page, "treeview");
-            tree_id = GPOINTER_TO_INT (g_object_get_data ((GObject *) tree, "playlist-id"));
+            tree_id = page_get_id (page);
 
             /* found it? move it to the right place */
             if (tree_id == list_id)
@@ -441,7 +537,11 @@ void ui_playlist_notebook_update (void * data, void * user)
         if (global_level >= PLAYLIST_UPDATE_METADATA)
             set_tab_label (list, get_tab_label (list));
 
-        GtkWidget * treeview = playlist_get_treeview (list);
+        /* tabs without a tree view catch up when they are next shown */
+        GtkWidget * page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, list);
+        GtkWidget * treeview = page_get_treeview (page);
+        if (! treeview)
+            continue;
 
         gint at, count;
         gint level = aud_playlist_updated_range (list, & at, & count);
@@ -467,8 +567,11 @@ void ui_playlist_notebook_position (void * data, void * user)
         aud_playlist_set_focus (list, row);
     }
 
-    if (! aud_playlist_update_pending ())
-        audgui_list_set_highlight (playlist_get_treeview (list), row);
+    GtkWidget * page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, list);
+    GtkWidget * treeview = page ? page_get_treeview (page) : NULL;
+
+    if (treeview && ! aud_playlist_update_pending ())
+        audgui_list_set_highlight (treeview, row);
 }
 
 void ui_playlist_notebook_activate (void * data, void * user)
@@ -489,8 +592,7 @@ void ui_playlist_notebook_set_playing (void * data, void * user)
     for (gint i = 0; i < pages; i ++)
     {
         GtkWidget * page = gtk_notebook_get_nth_page ((GtkNotebook *) notebook, i);
-        GtkWidget * tree = g_object_get_data ((GObject *) page, "treeview");
-        gint tree_id = GPOINTER_TO_INT (g_object_get_data ((GObject *) tree, "playlist-id"));
+        gint tree_id = page_get_id (page);
 
         if (tree_id == highlighted || tree_id == new)
             set_tab_label (i, get_tab_label (i));
@@ -503,6 +605,12 @@ static void destroy_cb (void)
 {
     hook_dissociate ("config save", (HookFunction) save_column_widths);
 
+    if (park_source)
+    {
+        g_source_remove (park_source);
+        park_source = 0;
+    }
+
     notebook = NULL;
     switch_handler = 0;
     reorder_handler = 0;
@@ -27,6 +27,7 @@
 GtkNotebook *ui_playlist_get_notebook(void);
 GtkWidget *ui_playlist_notebook_new();
 void ui_playlist_notebook_create_tab(gint playlist);
+GtkWidget * ui_playlist_notebook_get_treeview (GtkWidget * page);
 void ui_playlist_notebook_edit_tab_title (int playlist);
 void ui_playlist_notebook_populate(void);
 void ui_playlist_notebook_empty (void);
@@ -43,28 +43,45 @@ static const gboolean pw_col_widths[PW_COLS] = {7, -1, -1, 4, -1, 2, -1, 3, 7,
 static const gboolean pw_col_label[PW_COLS] = {FALSE, TRUE, TRUE, TRUE, TRUE,
  FALSE, TRUE, FALSE, FALSE, TRUE, TRUE, TRUE, FALSE};
 
+/* The tree view asks for one cell at a time, and redraws the same rows many
+ * times while scrolling.  The text of recently drawn rows is kept here, so
+ * that each row costs one round of playlist lookups until it changes.  Slot
+ * <row % ROW_CACHE_SIZE> holds <row>, which is enough for any visible window
+ * plus a generous margin. */
+#define ROW_CACHE_SIZE 512
+
+typedef struct {
+    gint row; /* -1 if empty */
+    gchar * text[PW_COLS]; /* pooled, only for the columns shown */
+} CachedRow;
+
 typedef struct {
     gint list;
     GList * queue;
     gint popup_source, popup_pos;
     gboolean popup_shown;
+    CachedRow cache[ROW_CACHE_SIZE];
+
+    /* Type-ahead search: the lowercased title, artist and album of each row,
+     * joined by newlines and filled in as the search gets to them, the keys
+     * of the current search, and a range of rows known not to match them. */
+    gchar * * search_index;
+    gint search_rows;
+    gchar * search_key;
+    gchar * * search_keys;
+    gint search_nkeys;
+    gint skip_from, skip_to;
 } PlaylistWidgetData;
 
-static void set_int_from_tuple (GValue * value, const Tuple * tuple, gint field)
+static gchar * int_from_tuple (const Tuple * tuple, gint field)
 {
     gint i = tuple ? tuple_get_int (tuple, field, NULL) : 0;
-    if (i > 0)
-        g_value_take_string (value, g_strdup_printf ("%d", i));
-    else
-        g_value_set_string (value, "");
+    return (i > 0) ? str_printf ("%d", i) : str_get ("");
 }
 
-static void set_string_from_tuple (GValue * value, const Tuple * tuple,
- gint field)
+static gchar * string_from_tuple (const Tuple * tuple, gint field)
 {
-    gchar *str = tuple ? tuple_get_str (tuple, field, NULL) : NULL;
-    g_value_set_string (value, str);
-    str_unref(str);
+    return tuple ? tuple_get_str (tuple, field, NULL) : NULL;
 }
 
 static void set_queued (GValue * value, gint list, gint row)
@@ -76,90 +93,138 @@ static void set_queued (GValue * value, gint list, gint row)
         g_value_take_string (value, g_strdup_printf ("#%d", 1 + q));
 }
 
-static void set_length (GValue * value, gint list, gint row)
+static gchar * format_length (gint list, gint row)
 {
     gint len = aud_playlist_entry_get_length (list, row, TRUE);
-    if (len)
+    if (! len)
+        return str_get ("");
+
+    len /= 1000;
+
+    if (len < 3600)
+        return str_printf (aud_get_bool (NULL, "leading_zero") ? "%02d:%02d" :
+         "%d:%02d", len / 60, len % 60);
+    else
+        return str_printf ("%d:%02d:%02d", len / 3600, (len / 60) % 60, len % 60);
+}
+
+static void cache_clear_row (CachedRow * cached)
+{
+    for (gint i = 0; i < PW_COLS; i ++)
     {
-        len /= 1000;
+        str_unref (cached->text[i]);
+        cached->text[i] = NULL;
+    }
+
+    cached->row = -1;
+}
 
-        gchar s[16];
-        if (len < 3600)
-            snprintf (s, sizeof s, aud_get_bool (NULL, "leading_zero") ?
-             "%02d:%02d" : "%d:%02d", len / 60, len % 60);
-        else
-            snprintf (s, sizeof s, "%d:%02d:%02d", len / 3600, (len / 60) % 60,
-             len % 60);
+static void cache_invalidate (PlaylistWidgetData * data, gint at, gint count)
+{
+    if (count >= ROW_CACHE_SIZE)
+    {
+        for (gint i = 0; i < ROW_CACHE_SIZE; i ++)
+        {
+            CachedRow * cached = & data->cache[i];
+            if (cached->row >= at && cached->row - at < count)
+                cache_clear_row (cached);
+        }
 
-        g_value_set_string (value, s);
+        return;
+    }
+
+    for (gint row = at; row < at + count; row ++)
+    {
+        CachedRow * cached = & data->cache[row % ROW_CACHE_SIZE];
+        if (cached->row == row)
+            cache_clear_row (cached);
     }
-    else
-        g_value_set_string (value, "");
 }
 
-static void get_value (void * user, gint row, gint column, GValue * value)
+/* fetches the text of every shown column at once */
+static CachedRow * cache_lookup (PlaylistWidgetData * data, gint row)
 {
-    PlaylistWidgetData * data = user;
-    g_return_if_fail (column >= 0 && column < pw_num_cols);
-    g_return_if_fail (row >= 0 && row < aud_playlist_entry_count (data->list));
+    CachedRow * cached = & data->cache[row % ROW_CACHE_SIZE];
+    if (cached->row == row)
+        return cached;
 
-    column = pw_cols[column];
+    cache_clear_row (cached);
+
+    gboolean need_describe = FALSE, need_tuple = FALSE;
+
+    for (gint i = 0; i < pw_num_cols; i ++)
+    {
+        switch (pw_cols[i])
+        {
+        case PW_COL_TITLE:
+        case PW_COL_ARTIST:
+        case PW_COL_ALBUM:
+            need_describe = TRUE;
+            break;
+        case PW_COL_YEAR:
+        case PW_COL_TRACK:
+        case PW_COL_GENRE:
+        case PW_COL_FILENAME:
+        case PW_COL_PATH:
+        case PW_COL_BITRATE:
+            need_tuple = TRUE;
+            break;
+        }
+    }
 
     gchar * title = NULL, * artist = NULL, * album = NULL;
     Tuple * tuple = NULL;
 
-    if (column == PW_COL_TITLE || column == PW_COL_ARTIST || column ==
-     PW_COL_ALBUM)
+    if (need_describe)
         aud_playlist_entry_describe (data->list, row, & title, & artist,
          & album, TRUE);
-    else if (column == PW_COL_YEAR || column == PW_COL_TRACK || column ==
-     PW_COL_GENRE || column == PW_COL_FILENAME || column == PW_COL_PATH ||
-     column == PW_COL_BITRATE)
+    if (need_tuple)
         tuple = aud_playlist_entry_get_tuple (data->list, row, TRUE);
 
-    switch (column)
+    for (gint i = 0; i < pw_num_cols; i ++)
     {
-    case PW_COL_NUMBER:
-        g_value_set_int (value, 1 + row);
-        break;
-    case PW_COL_TITLE:
-        g_value_set_string (value, title);
-        break;
-    case PW_COL_ARTIST:
-        g_value_set_string (value, artist);
-        break;
-    case PW_COL_YEAR:
-        set_int_from_tuple (value, tuple, FIELD_YEAR);
-        break;
-    case PW_COL_ALBUM:
-        g_value_set_string (value, album);
-        break;
-    case PW_COL_TRACK:
-        set_int_from_tuple (value, tuple, FIELD_TRACK_NUMBER);
-        break;
-    case PW_COL_GENRE:
-        set_string_from_tuple (value, tuple, FIELD_GENRE);
-        break;
-    case PW_COL_QUEUED:
-        set_queued (value, data->list, row);
-        break;
-    case PW_COL_LENGTH:
-        set_length (value, data->list, row);
-        break;
-    case PW_COL_FILENAME:
-        set_string_from_tuple (value, tuple, FIELD_FILE_NAME);
-        break;
-    case PW_COL_PATH:
-        set_string_from_tuple (value, tuple, FIELD_FILE_PATH);
-        break;
-    case PW_COL_CUSTOM:;
-        gchar * custom = aud_playlist_entry_get_title (data->list, row, TRUE);
-        g_value_set_string (value, custom);
-        str_unref (custom);
-        break;
-    case PW_COL_BITRATE:
-        set_int_from_tuple (value, tuple, FIELD_BITRATE);
-        break;
+        gint column = pw_cols[i];
+        gchar * text = NULL;
+
+        switch (column)
+        {
+        case PW_COL_TITLE:
+            text = str_ref (title);
+            break;
+        case PW_COL_ARTIST:
+            text = str_ref (artist);
+            break;
+        case PW_COL_YEAR:
+            text = int_from_tuple (tuple, FIELD_YEAR);
+            break;
+        case PW_COL_ALBUM:
+            text = str_ref (album);
+            break;
+        case PW_COL_TRACK:
+            text = int_from_tuple (tuple, FIELD_TRACK_NUMBER);
+            break;
+        case PW_COL_GENRE:
+            text = string_from_tuple (tuple, FIELD_GENRE);
+            break;
+        case PW_COL_LENGTH:
+            text = format_length (data->list, row);
+            break;
+        case PW_COL_FILENAME:
+            text = string_from_tuple (tuple, FIELD_FILE_NAME);
+            break;
+        case PW_COL_PATH:
+            text = string_from_tuple (tuple, FIELD_FILE_PATH);
+            break;
+        case PW_COL_CUSTOM:
+            text = aud_playlist_entry_get_title (data->list, row, TRUE);
+            break;
+        case PW_COL_BITRATE:
+            text = int_from_tuple (tuple, FIELD_BITRATE);
+            break;
+        }
+
+        str_unref (cached->text[column]); /* in case a column is shown twice */
+        cached->text[column] = text;
     }
 
     str_unref (title);
@@ -167,6 +232,26 @@ static void get_value (void * user, gint row, gint column, GValue * value)
     str_unref (album);
     if (tuple)
         tuple_unref (tuple);
+
+    cached->row = row;
+    return cached;
+}
+
+static void get_value (void * user, gint row, gint column, GValue * value)
+{
+    PlaylistWidgetData * data = user;
+    g_return_if_fail (column >= 0 && column < pw_num_cols);
+    g_return_if_fail (row >= 0 && row < aud_playlist_entry_count (data->list));
+
+    column = pw_cols[column];
+
+    /* these change without a metadata update, and are cheap anyway */
+    if (column == PW_COL_NUMBER)
+        g_value_set_int (value, 1 + row);
+    else if (column == PW_COL_QUEUED)
+        set_queued (value, data->list, row);
+    else
+        g_value_set_string (value, cache_lookup (data, row)->text[column]);
 }
 
 static gboolean get_selected (void * user, gint row)
@@ -305,61 +390,179 @@ static const AudguiListCallbacks callbacks = {
  .get_data = get_data,
  .receive_data = receive_data};
 
+static void search_index_clear (PlaylistWidgetData * data)
+{
+    for (gint i = 0; i < data->search_rows; i ++)
+        g_free (data->search_index[i]);
+
+    g_free (data->search_index);
+    data->search_index = NULL;
+    data->search_rows = 0;
+    data->skip_from = data->skip_to = 0;
+}
+
+/* follows <removed> rows at <at> being replaced by <added> new ones */
+static void search_index_splice (PlaylistWidgetData * data, gint at,
+ gint removed, gint added)
+{
+    if (! data->search_index)
+        return;
+
+    if (at < 0 || removed < 0 || at + removed > data->search_rows)
+    {
+        search_index_clear (data);
+        return;
+    }
+
+    gint rows = data->search_rows - removed + added;
+
+    for (gint i = at; i < at + removed; i ++)
+        g_free (data->search_index[i]);
+
+    if (added > removed)
+        data->search_index = g_renew (gchar *, data->search_index, rows);
+
+    memmove (data->search_index + at + added, data->search_index + at +
+     removed, sizeof (gchar *) * (data->search_rows - at - removed));
+    memset (data->search_index + at, 0, sizeof (gchar *) * added);
+
+    data->search_rows = rows;
+    data->skip_from = data->skip_to = 0;
+}
+
+static void search_index_invalidate (PlaylistWidgetData * data, gint at,
+ gint count)
+{
+    for (gint i = at; i < at + count && i < data->search_rows; i ++)
+    {
+        g_free (data->search_index[i]);
+        data->search_index[i] = NULL;
+    }
+
+    data->skip_from = data->skip_to = 0;
+}
+
+static const gchar * search_index_get (PlaylistWidgetData * data, gint row)
+{
+    if (data->search_index[row])
+        return data->search_index[row];
+
+    gchar * s[3] = {NULL, NULL, NULL};
+    aud_playlist_entry_describe (data->list, row, & s[0], & s[1], & s[2], FALSE);
+
+    GString * text = g_string_new (NULL);
+
+    for (gint i = 0; i < G_N_ELEMENTS (s); i ++)
+    {
+        if (! s[i])
+            continue;
+
+        gchar * temp = g_utf8_strdown (s[i], -1);
+        g_string_append (text, temp);
+        g_string_append_c (text, '\n');
+        g_free (temp);
+        str_unref (s[i]);
+    }
+
+    return data->search_index[row] = g_string_free (text, FALSE);
+}
+
+static void search_set_key (PlaylistWidgetData * data, const gchar * key)
+{
+    if (data->search_key && ! strcmp (data->search_key, key))
+        return;
+
+    g_free (data->search_key);
+    g_strfreev (data->search_keys);
+
+    data->search_key = g_strdup (key);
+
+    gchar * temp = g_utf8_strdown (key, -1);
+    data->search_keys = g_strsplit (temp, " ", 0);
+    g_free (temp);
+
+    data->search_nkeys = 0;
+    for (gint j = 0; data->search_keys[j]; j ++)
+    {
+        if (data->search_keys[j][0])
+            data->search_nkeys ++;
+    }
+
+    data->skip_from = data->skip_to = 0;
+}
+
+static gboolean search_matches (PlaylistWidgetData * data, gint row)
+{
+    const gchar * text = search_index_get (data, row);
+
+    for (gint j = 0; data->search_keys[j]; j ++)
+    {
+        if (data->search_keys[j][0] && ! strstr (text, data->search_keys[j]))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* The tree view calls this for one row after another until it finds a match.
+ * Rather than describing each row every time, the text is looked up in the
+ * index, and a row that does not match is scanned past in one go to the next
+ * one that does, so that the rows in between are answered right away. */
 static gboolean search_cb (GtkTreeModel * model, gint column, const gchar * key,
  GtkTreeIter * iter, void * user)
 {
+    PlaylistWidgetData * data = user;
+
     GtkTreePath * path = gtk_tree_model_get_path (model, iter);
     g_return_val_if_fail (path, TRUE);
     gint row = gtk_tree_path_get_indices (path)[0];
-    g_return_val_if_fail (row >= 0, TRUE);
-    gchar * s[3] = {NULL, NULL, NULL};
-    aud_playlist_entry_describe (((PlaylistWidgetData *) user)->list, row,
-     & s[0], & s[1], & s[2], FALSE);
     gtk_tree_path_free (path);
 
-    gchar * temp = g_utf8_strdown (key, -1);
-    gchar * * keys = g_strsplit (temp, " ", 0);
-    g_free (temp);
+    gint entries = aud_playlist_entry_count (data->list);
+
+    if (data->search_index && data->search_rows != entries)
+        search_index_clear (data);
 
-    gint remain = 0; /* number of keys remaining to be matched */
-    for (gint j = 0; keys[j]; j ++)
+    if (! data->search_index)
     {
-        if (keys[j][0])
-            remain ++;
+        data->search_index = g_new0 (gchar *, entries);
+        data->search_rows = entries;
     }
-    if (! remain)
-        remain ++; /* force non-match if there are no non-blank keys */
 
-    for (gint i = 0; i < G_N_ELEMENTS (s); i ++)
-    {
-        if (! s[i])
-            continue;
+    g_return_val_if_fail (row >= 0 && row < data->search_rows, TRUE);
 
-        if (remain)
-        {
-            temp = g_utf8_strdown (s[i], -1);
-
-            for (gint j = 0; keys[j] && remain; j ++)
-            {
-                if (keys[j][0] && strstr (temp, keys[j]))
-                {
-                    keys[j][0] = 0; /* don't look for this one again */
-                    remain --;
-                }
-            }
-
-            g_free (temp);
-        }
+    search_set_key (data, key);
 
-        str_unref (s[i]);
+    /* force non-match if there are no non-blank keys */
+    if (! data->search_nkeys)
+        return TRUE;
+
+    if (row >= data->skip_from && row < data->skip_to)
+        return TRUE;
+
+    gint next = row;
+
+    while (next < data->search_rows && ! search_matches (data, next))
+    {
+        if (++ next == data->skip_from)
+            next = data->skip_to; /* already known not to match */
     }
 
-    g_strfreev (keys);
-    return remain ? TRUE : FALSE; /* TRUE == not matched, FALSE == matched */
+    data->skip_from = row;
+    data->skip_to = next;
+
+    return next != row; /* TRUE == not matched, FALSE == matched */
 }
 
 static void destroy_cb (PlaylistWidgetData * data)
 {
+    /* hidden tabs can now be destroyed at any time; don't leave a popup
+     * timeout pointing at freed data */
+    popup_hide (data);
+    cache_invalidate (data, 0, G_MAXINT);
+    search_index_clear (data);
+    g_free (data->search_key);
+    g_strfreev (data->search_keys);
     g_list_free (data->queue);
     g_free (data);
 }
@@ -373,6 +576,9 @@ GtkWidget * ui_playlist_widget_new (gint playlist)
     data->popup_pos = -1;
     data->popup_shown = FALSE;
 
+    for (gint i = 0; i < ROW_CACHE_SIZE; i ++)
+        data->cache[i].row = -1;
+
     GtkWidget * list = audgui_list_new (& callbacks, data,
      aud_playlist_entry_count (playlist));
 
@@ -409,6 +615,8 @@ void ui_playlist_widget_set_playlist (GtkWidget * widget, gint list)
     PlaylistWidgetData * data = audgui_list_get_user (widget);
     g_return_if_fail (data);
     data->list = list;
+    cache_invalidate (data, 0, G_MAXINT);
+    search_index_clear (data);
 }
 
 static void update_queue (GtkWidget * widget, PlaylistWidgetData * data)
@@ -438,6 +646,10 @@ void ui_playlist_widget_update (GtkWidget * widget, gint type, gint at,
         gint old_entries = audgui_list_row_count (widget);
         gint entries = aud_playlist_entry_count (data->list);
 
+        /* rows from the change onward have moved */
+        cache_invalidate (data, at, G_MAXINT - at);
+        search_index_splice (data, at, old_entries - (entries - count), count);
+
         audgui_list_delete_rows (widget, at, old_entries - (entries - count));
         audgui_list_insert_rows (widget, at, count);
 
@@ -450,7 +662,11 @@ void ui_playlist_widget_update (GtkWidget * widget, gint type, gint at,
         ui_playlist_widget_scroll (widget);
     }
     else if (type == PLAYLIST_UPDATE_METADATA)
+    {
+        cache_invalidate (data, at, count);
+        search_index_invalidate (data, at, count);
         audgui_list_update_rows (widget, at, count);
+    }
 
     audgui_list_update_selection (widget, at, count);
     audgui_list_set_focus (widget, aud_playlist_get_focus (data->list));
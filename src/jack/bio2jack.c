@@ -58,6 +58,11 @@
 
 #define DEFAULT_RB_SIZE         4096
 
+/* the largest period JACK_SetBufferPeriods() has to allow for when sizing */
+/* the playback ringbuffer up front */
+#define MAX_JACK_PERIOD         8192
+#define MAX_BUFFER_PERIODS      32
+
 #define OUTFILE stderr
 
 #if TIMER_ENABLE
@@ -139,6 +144,7 @@ typedef struct jack_driver_s
   unsigned long bytes_per_jack_input_frame;     /* (num_input_channels * bits_per_channel) / 8 */
 
   long clientBytesInJack;       /* number of INPUT bytes(from the client of bio2jack) we wrote to jack(not necessary the number of bytes we wrote to jack) */
+  int position_seq;             /* odd while JACK_callback() is updating the position counters */
   long jack_buffer_size;        /* size of the buffer jack will pass in to the process callback */
 
   unsigned long callback_buffer1_size;  /* number of bytes in the buffer allocated for processing data in JACK_Callback */
@@ -149,8 +155,6 @@ typedef struct jack_driver_s
   unsigned long rw_buffer1_size;        /* number of bytes in the buffer allocated for processing data in JACK_(Read|Write) */
   char *rw_buffer1;
 
-  struct timeval previousTime;  /* time of last JACK_Callback() write to jack, allows for MS accurate bytes played  */
-
   unsigned long written_client_bytes;   /* input bytes we wrote to jack, not necessarily actual bytes we wrote to jack due to channel and other conversion */
   unsigned long played_client_bytes;    /* input bytes that jack has played */
 
@@ -169,6 +173,8 @@ typedef struct jack_driver_s
 
   jack_ringbuffer_t *pPlayPtr;  /* the playback ringbuffer */
   jack_ringbuffer_t *pRecPtr;   /* the recording ringbuffer */
+  int buffer_periods;           /* playback buffer depth in jack periods, 0 to use the whole ringbuffer */
+  long playback_latency;        /* latency from our output ports to the speakers in jack frames */
 
   SRC_STATE *output_src;        /* SRC object for the output stream */
   SRC_STATE *input_src;         /* SRC object for the output stream */
@@ -209,6 +215,8 @@ static bool init_done = 0;      /* just to prevent clients from calling JACK_Ini
 
 static enum JACK_PORT_CONNECTION_MODE port_connection_mode = CONNECT_ALL;
 
+static int buffer_periods = 0;  /* for the next Open()d device, see JACK_SetBufferPeriods() */
+
 /* enable/disable code that allows us to close a device without actually closing the jack device */
 /* this works around the issue where jack doesn't always close devices by the time the close function call returns */
 #define JACK_CLOSE_HACK 1
@@ -408,29 +416,6 @@ mux(sample_t * dst, sample_t * src, unsigned long nsamples,
   }
 }
 
-/* pull one channel out of a multi-channel stream */
-static void
-demux(sample_t * dst, sample_t * src, unsigned long nsamples,
-      unsigned long src_skip)
-{
-  /* ALERT: signed sign-extension portability !!! */
-  while(nsamples--)
-  {
-    *dst = *src;
-    dst++;
-    src += src_skip;
-  }
-}
-
-/* copy floating point samples */
-static inline void
-sample_move_float_float(sample_t * dst, float * src, unsigned long nsamples)
-{
-  unsigned long i;
-  for(i = 0; i < nsamples; i++)
-    dst[i] = (sample_t) (src[i]);
-}
-
 /* convert from 32 bit samples to floating point */
 static inline void
 sample_move_int32_float(sample_t * dst, int32_t * src, unsigned long nsamples)
@@ -489,6 +474,30 @@ sample_move_float_char(unsigned char *dst, sample_t * src, unsigned long nsample
     dst[i] = (char) ((src[i]) * SAMPLE_MAX_8BIT);
 }
 
+/* convert nsamples in the client's format to floating point */
+static void
+sample_move_client_float(jack_driver_t * drv, sample_t * dst,
+                         unsigned char *src, unsigned long nsamples)
+{
+  switch (drv->bits_per_channel)
+  {
+  case 8:
+    sample_move_char_float(dst, src, nsamples);
+    break;
+  case 16:
+    sample_move_short_float(dst, (short *) src, nsamples);
+    break;
+  case 32:
+    if (drv->sample_format == SAMPLE_FMT_FLOAT)
+      memcpy(dst, src, nsamples * sizeof(sample_t));
+    else if (drv->sample_format == SAMPLE_FMT_PACKED_24B)
+      sample_move_int24_float(dst, (int32_t *) src, nsamples);
+    else
+      sample_move_int32_float(dst, (int32_t *) src, nsamples);
+    break;
+  }
+}
+
 /* fill dst buffer with nsamples worth of silence */
 static void inline
 sample_silence_float(sample_t * dst, unsigned long nsamples)
@@ -520,6 +529,125 @@ ensure_buffer_size(char **buffer, unsigned long *cur_size,
   return FALSE;
 }
 
+/* size callback_buffer1 and 2 for the largest period JACK_callback can see */
+/* with the current buffer size and rate ratios, so that it never allocates */
+static bool
+JACK_AllocCallbackBuffers(jack_driver_t * drv)
+{
+  double frames = drv->jack_buffer_size;
+  unsigned long size1 = 0, size2 = 0;
+
+  if(drv->num_output_channels > 0)
+  {
+    size2 = frames * drv->bytes_per_jack_output_frame;
+    if(drv->output_sample_rate_ratio > 0)
+      size1 = (frames / drv->output_sample_rate_ratio + 2) *
+        drv->bytes_per_jack_output_frame;
+  }
+
+  if(drv->num_input_channels > 0)
+  {
+    size1 = max(size1, frames * drv->bytes_per_jack_input_frame);
+    size2 = max(size2, (frames + drv->input_sample_rate_ratio + 1) *
+                drv->input_sample_rate_ratio * drv->bytes_per_jack_input_frame);
+  }
+
+  return ensure_buffer_size(&drv->callback_buffer1, &drv->callback_buffer1_size, size1) &&
+    ensure_buffer_size(&drv->callback_buffer2, &drv->callback_buffer2_size, size2);
+}
+
+/* compute the gain to apply to each output channel, between 0.0 and 1.0 */
+static void
+get_volume_factors(jack_driver_t * drv, float *factor)
+{
+  unsigned int i;
+  for(i = 0; i < drv->num_output_channels; i++)
+  {
+    float volume;
+
+    /* with dbAttenuation, the volume setting is dB of attenuation, a volume */
+    /* of 0 is 0dB attenuation */
+    if(drv->volumeEffectType == dbAttenuation)
+      volume = powf(10.0, -((float) drv->volume[i]) / 20.0);
+    else
+      volume = (float) drv->volume[i] / 100.0;
+
+    factor[i] = (volume < 0) ? 0 : (volume > 1.0) ? 1.0 : volume;
+  }
+}
+
+/* pull every channel out of a multi-channel stream into its port buffer, */
+/* applying the gain on the way */
+static void
+demux_volume(sample_t ** dst, sample_t * src, unsigned long nframes,
+             unsigned long channels, const float *factor)
+{
+  unsigned long frame, channel;
+  for(frame = 0; frame < nframes; frame++)
+    for(channel = 0; channel < channels; channel++)
+      dst[channel][frame] = *src++ * factor[channel];
+}
+
+/* like demux_volume(), but reading straight out of the ringbuffer; the read */
+/* vector always wraps at a sample boundary, though not always at a frame one */
+static void
+ringbuffer_demux_volume(jack_ringbuffer_t * rb, sample_t ** dst,
+                        unsigned long nframes, unsigned long channels,
+                        const float *factor)
+{
+  jack_ringbuffer_data_t vec[2];
+  unsigned long frame = 0, channel = 0, left = nframes * channels;
+  int v;
+
+  jack_ringbuffer_get_read_vector(rb, vec);
+
+  for(v = 0; v < 2 && left; v++)
+  {
+    sample_t *src = (sample_t *) vec[v].buf;
+    unsigned long n = min(vec[v].len / sizeof(sample_t), left);
+
+    left -= n;
+    while(n--)
+    {
+      dst[channel][frame] = *src++ * factor[channel];
+      if(++channel == channels)
+      {
+        channel = 0;
+        frame++;
+      }
+    }
+  }
+
+  jack_ringbuffer_read_advance(rb, nframes * channels * sizeof(sample_t));
+}
+
+/* JACK_callback() updates the position counters without taking the device */
+/* lock, so it brackets the update with position_seq, and readers retry */
+/* until they see the same even value before and after */
+static void
+position_update_begin(jack_driver_t * drv)
+{
+  __atomic_store_n(&drv->position_seq, drv->position_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+position_update_end(jack_driver_t * drv)
+{
+  __atomic_store_n(&drv->position_seq, drv->position_seq + 1, __ATOMIC_RELEASE);
+}
+
+/* the playback buffer depth in client frames, 0 if it is not limited */
+static long
+JACK_GetBufferDepthFrames(jack_driver_t * drv)
+{
+  if(drv->buffer_periods == 0 || drv->output_sample_rate_ratio <= 0)
+    return 0;
+
+  return (long) (drv->buffer_periods * drv->jack_buffer_size /
+                 drv->output_sample_rate_ratio);
+}
+
 /******************************************************************
  *    JACK_callback
  *
@@ -536,14 +664,15 @@ JACK_callback(nframes_t nframes, void *arg)
   int src_error = 0;
 
   TIMER("start\n");
-  gettimeofday(&drv->previousTime, 0);  /* record the current time */
+
+  /* NOTE: this runs in the JACK realtime thread, so nothing in here may */
+  /* lock, allocate or print; the buffers are sized up front by */
+  /* JACK_AllocCallbackBuffers() and the ringbuffers are lock-free as long */
+  /* as each end is only touched by one thread */
 
   CALLBACK_TRACE("nframes %ld, sizeof(sample_t) == %d\n", (long) nframes,
                  sizeof(sample_t));
 
-  if(!drv->client)
-    ERR("client is closed, this is weird...\n");
-
   sample_t *out_buffer[MAX_OUTPUT_PORTS];
   /* retrieve the buffers for the output ports */
   for(i = 0; i < drv->num_output_channels; i++)
@@ -564,9 +693,9 @@ JACK_callback(nframes_t nframes, void *arg)
       unsigned long numFramesToWrite;   /* num frames we are writing */
       size_t inputBytesAvailable = jack_ringbuffer_read_space(drv->pPlayPtr);
       unsigned long inputFramesAvailable;       /* frames we have available */
+      float factor[MAX_OUTPUT_PORTS];
 
       inputFramesAvailable = inputBytesAvailable / drv->bytes_per_jack_output_frame;
-      size_t jackBytesAvailable = jackFramesAvailable * drv->bytes_per_jack_output_frame;
 
       long read = 0;
 
@@ -584,51 +713,23 @@ JACK_callback(nframes_t nframes, void *arg)
       }
 #endif
 
-      /* make sure our buffer is large enough for the data we are writing */
-      /* ie. callback_buffer2_size < (bytes we already wrote + bytes we are going to write in this loop) */
-      if(!ensure_buffer_size
-         (&drv->callback_buffer2, &drv->callback_buffer2_size,
-          jackBytesAvailable))
-      {
-        ERR("allocated %lu bytes, need %lu bytes\n",
-            drv->callback_buffer2_size, (unsigned long)jackBytesAvailable);
-        return -1;
-      }
+      get_volume_factors(drv, factor);
 
       /* do sample rate conversion if needed & requested */
       if(drv->output_src && drv->output_sample_rate_ratio != 1.0)
       {
-        long bytes_needed_write = nframes * drv->bytes_per_jack_output_frame;
+        unsigned long output_frames = min(nframes,
+                                          drv->callback_buffer2_size / drv->bytes_per_jack_output_frame);
 
         /* make a very good guess at how many raw bytes we'll need to satisfy jack's request after conversion */
         long bytes_needed_read = min(inputBytesAvailable,
-                                     (double) (bytes_needed_write +
-                                               drv->
-                                               output_sample_rate_ratio
-                                               *
-                                               drv->
-                                               bytes_per_jack_output_frame)
+                                     (double) (output_frames * drv->bytes_per_jack_output_frame +
+                                               drv->output_sample_rate_ratio *
+                                               drv->bytes_per_jack_output_frame)
                                      / drv->output_sample_rate_ratio);
-        DEBUG("guessing that we need %ld bytes in and %ld out for rate conversion ratio = %f\n",
-           bytes_needed_read, bytes_needed_write,
-           drv->output_sample_rate_ratio);
+        bytes_needed_read = min(bytes_needed_read, drv->callback_buffer1_size);
 
-        if(!ensure_buffer_size(&drv->callback_buffer1,
-                               &drv->callback_buffer1_size,
-                               bytes_needed_read))
-        {
-          ERR("could not realloc callback_buffer2!\n");
-          return 1;
-        }
-        if(!ensure_buffer_size(&drv->callback_buffer2,
-                               &drv->callback_buffer2_size,
-                               bytes_needed_write))
-        {
-          ERR("could not realloc callback_buffer2!\n");
-          return 1;
-        }
-
-        if(jackFramesAvailable && inputBytesAvailable > 0)
+        if(output_frames && bytes_needed_read > 0)
         {
           /* read in the data, but don't move the read pointer until we know how much SRC used */
           jack_ringbuffer_peek(drv->pPlayPtr, drv->callback_buffer1,
@@ -639,15 +740,10 @@ JACK_callback(nframes_t nframes, void *arg)
           srcdata.input_frames = bytes_needed_read / drv->bytes_per_jack_output_frame;
           srcdata.src_ratio = drv->output_sample_rate_ratio;
           srcdata.data_out = (sample_t *) drv->callback_buffer2;
-          srcdata.output_frames = nframes;
+          srcdata.output_frames = output_frames;
           srcdata.end_of_input = 0;     // it's a stream, it never ends
-          DEBUG("input_frames = %ld, output_frames = %ld\n",
-                srcdata.input_frames, srcdata.output_frames);
           /* convert the sample rate */
           src_error = src_process(drv->output_src, &srcdata);
-          DEBUG("used = %ld, generated = %ld, error = %d: %s.\n",
-                srcdata.input_frames_used, srcdata.output_frames_gen,
-                src_error, src_strerror(src_error));
 
           if(src_error == 0)
           {
@@ -659,84 +755,56 @@ JACK_callback(nframes_t nframes, void *arg)
             /* add on what we wrote */
             read = srcdata.input_frames_used * drv->bytes_per_output_frame;
             jackFramesAvailable -= srcdata.output_frames_gen;   /* take away what was used */
+
+            demux_volume(out_buffer, (sample_t *) drv->callback_buffer2,
+                         srcdata.output_frames_gen, drv->num_output_channels, factor);
           }
         }
       }
       else                      /* no resampling needed or requested */
       {
-        /* read as much data from the buffer as is available */
-        if(jackFramesAvailable && inputBytesAvailable > 0)
+        /* write as many frames as we have space remaining, or as much as we have data to write, */
+        /* straight from the ringbuffer into the port buffers */
+        numFramesToWrite = min(jackFramesAvailable, inputFramesAvailable);
+
+        if(numFramesToWrite)
         {
-          /* write as many bytes as we have space remaining, or as much as we have data to write */
-          numFramesToWrite = min(jackFramesAvailable, inputFramesAvailable);
-          jack_ringbuffer_read(drv->pPlayPtr, drv->callback_buffer2,
-                               jackBytesAvailable);
+          ringbuffer_demux_volume(drv->pPlayPtr, out_buffer, numFramesToWrite,
+                                  drv->num_output_channels, factor);
           /* add on what we wrote */
           read = numFramesToWrite * drv->bytes_per_output_frame;
           jackFramesAvailable -= numFramesToWrite;      /* take away what was written */
         }
       }
 
+      position_update_begin(drv);
       drv->written_client_bytes += read;
       drv->played_client_bytes += drv->clientBytesInJack;       /* move forward by the previous bytes we wrote since those must have finished by now */
       drv->clientBytesInJack = read;    /* record the input bytes we wrote to jack */
+      position_update_end(drv);
 
       /* see if we still have jackBytesLeft here, if we do that means that we
          ran out of wave data to play and had a buffer underrun, fill in
          the rest of the space with zero bytes so at least there is silence */
       if(jackFramesAvailable)
       {
-        WARN("buffer underrun of %ld frames\n", jackFramesAvailable);
         for(i = 0; i < drv->num_output_channels; i++)
           sample_silence_float(out_buffer[i] +
                                (nframes - jackFramesAvailable),
                                jackFramesAvailable);
       }
-
-      /* if we aren't converting or we are converting and src_error == 0 then we should */
-      /* apply volume and demux */
-      if(!(drv->output_src && drv->output_sample_rate_ratio != 1.0) || (src_error == 0))
-      {
-          /* apply volume */
-          for(i = 0; i < drv->num_output_channels; i++)
-          {
-              if(drv->volumeEffectType == dbAttenuation)
-              {
-                  /* assume the volume setting is dB of attenuation, a volume of 0 */
-                  /* is 0dB attenuation */
-                  float volume = powf(10.0, -((float) drv->volume[i]) / 20.0);
-                  float_volume_effect((sample_t *) drv->callback_buffer2 + i,
-                                      (nframes - jackFramesAvailable), volume, drv->num_output_channels);
-              } else
-              {
-                  float_volume_effect((sample_t *) drv->callback_buffer2 + i, (nframes - jackFramesAvailable),
-                                      ((float) drv->volume[i] / 100.0),
-                                      drv->num_output_channels);
-              }
-          }
-
-          /* demux the stream: we skip over the number of samples we have output channels as the channel data */
-          /* is encoded like chan1,chan2,chan3,chan1,chan2,chan3... */
-          for(i = 0; i < drv->num_output_channels; i++)
-          {
-              demux(out_buffer[i],
-                    (sample_t *) drv->callback_buffer2 + i,
-                    (nframes - jackFramesAvailable), drv->num_output_channels);
-          }
-      }
     }
 
     /* handle record data, if any */
     if(drv->num_input_channels > 0)
     {
       long jack_bytes = nframes * drv->bytes_per_jack_input_frame;      /* how many bytes jack is feeding us */
+      char *record_buffer = drv->callback_buffer1;
+      long record_bytes = jack_bytes;
 
-      if(!ensure_buffer_size(&drv->callback_buffer1, &drv->callback_buffer1_size, jack_bytes))
-      {
-        ERR("allocated %lu bytes, need %lu bytes\n",
-            drv->callback_buffer1_size, jack_bytes);
+      /* the buffers are sized for the largest period, this can't happen */
+      if(jack_bytes > drv->callback_buffer1_size)
         return -1;
-      }
 
       /* mux the invividual channels into one stream */
       for(i = 0; i < drv->num_input_channels; i++)
@@ -748,23 +816,6 @@ JACK_callback(nframes_t nframes, void *arg)
       /* do sample rate conversion if needed & requested */
       if(drv->input_src && drv->input_sample_rate_ratio != 1.0)
       {
-        /* make a very good guess at how many raw bytes we'll need to read all the data jack gave us */
-        long bytes_needed_write = (double) (jack_bytes +
-                                            drv->input_sample_rate_ratio *
-                                            drv->bytes_per_jack_input_frame) *
-          drv->input_sample_rate_ratio;
-        DEBUG("guessing that we need %ld bytes in and %ld out for rate conversion ratio = %f\n",
-              nframes * drv->bytes_per_jack_input_frame,
-              bytes_needed_write, drv->input_sample_rate_ratio);
-
-        if(!ensure_buffer_size(&drv->callback_buffer2,
-                               &drv->callback_buffer2_size,
-                               bytes_needed_write))
-        {
-          ERR("could not realloc callback_buffer2!\n");
-          return 1;
-        }
-
         SRC_DATA srcdata;
         srcdata.data_in = (sample_t *) drv->callback_buffer1;
         srcdata.input_frames = nframes;
@@ -772,74 +823,21 @@ JACK_callback(nframes_t nframes, void *arg)
         srcdata.data_out = (sample_t *) drv->callback_buffer2;
         srcdata.output_frames = drv->callback_buffer2_size / drv->bytes_per_jack_input_frame;
         srcdata.end_of_input = 0;       // it's a stream, it never ends
-        DEBUG("input_frames = %ld, output_frames = %ld\n",
-              srcdata.input_frames, srcdata.output_frames);
         /* convert the sample rate */
         src_error = src_process(drv->input_src, &srcdata);
-        DEBUG("used = %ld, generated = %ld, error = %d: %s.\n",
-              srcdata.input_frames_used, srcdata.output_frames_gen,
-              src_error, src_strerror(src_error));
-
-        if(src_error == 0)
-        {
-          long write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-          long bytes_used =  srcdata.output_frames_gen * drv->bytes_per_jack_input_frame;
-          /* if there isn't enough room, make some.  sure this discards data, but when dealing with input sources
-             it seems like it's better to throw away old data than new */
-          if(write_space < bytes_used)
-          {
-            /* the ringbuffer is designed such that only one thread should ever access each pointer.
-               since calling read_advance here will be touching the read pointer which is also accessed
-               by JACK_Read, we need to lock the mutex first for safety */
-            jack_driver_t *d = tryGetDriver(drv->deviceID);
-            if( d )
-            {
-              /* double check the write space after we've gained the lock, just
-                 in case JACK_Read was being called before we gained it */
-              write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-              if(write_space < bytes_used)
-              {
-                /* hey, we warn about underruns, we might as well warn about overruns as well */
-                WARN("buffer overrun of %ld bytes\n", jack_bytes - write_space);
-                jack_ringbuffer_read_advance(drv->pRecPtr, bytes_used - write_space);
-              }
-
-              releaseDriver(drv);
-            }
-          }
 
-          jack_ringbuffer_write(drv->pRecPtr, drv->callback_buffer2,
-                                bytes_used);
-        }
+        record_buffer = drv->callback_buffer2;
+        record_bytes = (src_error == 0) ?
+          srcdata.output_frames_gen * drv->bytes_per_jack_input_frame : 0;
       }
-      else                      /* no resampling needed */
-      {
-        long write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-        /* if there isn't enough room, make some.  sure this discards data, but when dealing with input sources
-           it seems like it's better to throw away old data than new */
-        if(write_space < jack_bytes)
-        {
-          /* the ringbuffer is designed such that only one thread should ever access each pointer.
-             since calling read_advance here will be touching the read pointer which is also accessed
-             by JACK_Read, we need to lock the mutex first for safety */
-	        jack_driver_t *d = tryGetDriver(drv->deviceID);
-          if( d )
-          {
-            /* double check the write space after we've gained the lock, just
-               in case JACK_Read was being called before we gained it */
-            write_space = jack_ringbuffer_write_space(drv->pRecPtr);
-            if(write_space < jack_bytes)
-            {
-             ERR("buffer overrun of %ld bytes\n", jack_bytes - write_space);
-             jack_ringbuffer_read_advance(drv->pRecPtr, jack_bytes - write_space);
-            }
-	          releaseDriver(drv);
-          }
-        }
 
-        jack_ringbuffer_write(drv->pRecPtr, drv->callback_buffer1,
-                              jack_bytes);
-      }
+      /* if there isn't enough room, drop what doesn't fit; making room by */
+      /* moving the read pointer would race with JACK_Read */
+      long write_space = jack_ringbuffer_write_space(drv->pRecPtr);
+      write_space -= write_space % drv->bytes_per_jack_input_frame;
+
+      jack_ringbuffer_write(drv->pRecPtr, record_buffer,
+                            min(record_bytes, write_space));
     }
   }
   else if(drv->state == PAUSED  ||
@@ -852,6 +850,12 @@ JACK_callback(nframes_t nframes, void *arg)
     for(i = 0; i < drv->num_output_channels; i++)
       sample_silence_float(out_buffer[i], nframes);
 
+    /* whatever we wrote last time has been played by now, and nothing */
+    /* more is being played until we are PLAYING again */
+    position_update_begin(drv);
+    drv->played_client_bytes += drv->clientBytesInJack;
+    drv->clientBytesInJack = 0;
+
     /* if we were told to reset then zero out some variables */
     /* and transition to STOPPED */
     if(drv->state == RESET)
@@ -861,8 +865,6 @@ JACK_callback(nframes_t nframes, void *arg)
 
       drv->client_bytes = 0;    /* bytes that the client wrote to use */
 
-      drv->clientBytesInJack = 0;       /* number of input bytes in jack(not necessary the number of bytes written to jack) */
-
       drv->position_byte_offset = 0;
 
       if(drv->pPlayPtr)
@@ -873,6 +875,8 @@ JACK_callback(nframes_t nframes, void *arg)
 
       drv->state = STOPPED;     /* transition to STOPPED */
     }
+
+    position_update_end(drv);
   }
 
   CALLBACK_TRACE("done\n");
@@ -896,9 +900,55 @@ JACK_bufsize(nframes_t nframes, void *arg)
 
   drv->jack_buffer_size = nframes;
 
+  if(!JACK_AllocCallbackBuffers(drv))
+  {
+    ERR("could not allocate callback buffers\n");
+  }
+
   return 0;
 }
 
+/******************************************************************
+ *             JACK_latency
+ *
+ *             Called whenever the latencies in the jack graph change.  Our
+ *             output ports carry audio that has been sitting in the
+ *             playback buffer, so that is the capture latency we publish
+ *             for them; the playback latency is what lies between them and
+ *             the speakers, which we keep for JACK_GetPositionFromDriver()
+ */
+static void
+JACK_latency(jack_latency_callback_mode_t mode, void *arg)
+{
+  jack_driver_t *drv = (jack_driver_t *) arg;
+  jack_latency_range_t range;
+  unsigned int i;
+
+  if(drv->num_output_channels == 0)
+    return;
+
+  if(mode == JackCaptureLatency)
+  {
+    range.min = range.max = drv->buffer_periods * drv->jack_buffer_size;
+
+    for(i = 0; i < drv->num_output_channels; i++)
+      jack_port_set_latency_range(drv->output_port[i], JackCaptureLatency, &range);
+  }
+  else
+  {
+    long latency = 0;
+
+    for(i = 0; i < drv->num_output_channels; i++)
+    {
+      jack_port_get_latency_range(drv->output_port[i], JackPlaybackLatency, &range);
+      latency = max(latency, (long) range.max);
+    }
+
+    __atomic_store_n(&drv->playback_latency, latency, __ATOMIC_RELAXED);
+    TRACE("playback latency is now %ld frames\n", latency);
+  }
+}
+
 /******************************************************************
  *		JACK_srate
  */
@@ -916,6 +966,11 @@ JACK_srate(nframes_t nframes, void *arg)
   drv->input_sample_rate_ratio = (double) drv->client_sample_rate / (double) drv->jack_sample_rate;
   if(drv->input_src) src_set_ratio(drv->input_src, drv->input_sample_rate_ratio);
 
+  if(!JACK_AllocCallbackBuffers(drv))
+  {
+    ERR("could not allocate callback buffers\n");
+  }
+
   TRACE("the sample rate is now %lu/sec\n", (long) nframes);
   return 0;
 }
@@ -1033,6 +1088,9 @@ JACK_OpenDevice(jack_driver_t * drv)
   /* setup a buffer size callback */
   jack_set_buffer_size_callback(drv->client, JACK_bufsize, drv);
 
+  /* keep track of the latency between our ports and the speakers */
+  jack_set_latency_callback(drv->client, JACK_latency, drv);
+
   /* tell the JACK server to call `srate()' whenever
      the sample rate of the system changes. */
   jack_set_sample_rate_callback(drv->client, JACK_srate, drv);
@@ -1054,6 +1112,14 @@ JACK_OpenDevice(jack_driver_t * drv)
 
   drv->jack_buffer_size = jack_get_buffer_size(drv->client);
 
+  if(!JACK_AllocCallbackBuffers(drv))
+  {
+    ERR("could not allocate callback buffers\n");
+    jack_client_close(drv->client);
+    drv->client = 0;
+    return ERR_OPENING_JACK;
+  }
+
   /* create the output ports */
   TRACE("creating output ports\n");
   for(i = 0; i < drv->num_output_channels; i++)
@@ -1613,6 +1679,8 @@ JACK_OpenEx(int *deviceID, unsigned int bits_per_channel,
   drv->sample_format = sample_format;
   drv->num_input_channels = input_channels;
   drv->num_output_channels = output_channels;
+  drv->buffer_periods = buffer_periods;
+  drv->playback_latency = 0;
   drv->bytes_per_input_frame = (drv->bits_per_channel * drv->num_input_channels) / 8;
   drv->bytes_per_output_frame = (drv->bits_per_channel * drv->num_output_channels) / 8;
   drv->bytes_per_jack_output_frame = sizeof(sample_t) * drv->num_output_channels;
@@ -1620,9 +1688,13 @@ JACK_OpenEx(int *deviceID, unsigned int bits_per_channel,
 
   if(drv->num_output_channels > 0)
   {
-    drv->pPlayPtr = jack_ringbuffer_create(drv->num_output_channels *
-                                           drv->bytes_per_jack_output_frame *
-                                           DEFAULT_RB_SIZE);
+    /* with a limited depth, make room for it at the largest period jack */
+    /* is likely to use; the limit itself follows the actual period */
+    unsigned long frames = drv->num_output_channels * DEFAULT_RB_SIZE;
+    if(drv->buffer_periods)
+      frames = max(frames, (unsigned long) drv->buffer_periods * MAX_JACK_PERIOD);
+
+    drv->pPlayPtr = jack_ringbuffer_create(drv->bytes_per_jack_output_frame * frames);
   }
 
   if(drv->num_input_channels > 0)
@@ -1781,6 +1853,13 @@ JACK_Write(int deviceID, unsigned char *data, unsigned long bytes)
   frames_free =
     jack_ringbuffer_write_space(drv->pPlayPtr) /
     drv->bytes_per_jack_output_frame;
+
+  /* and that it stays within the buffer depth we were asked for */
+  long depth = JACK_GetBufferDepthFrames(drv);
+  if(depth)
+    frames_free = min(frames_free, depth -
+                      (long) (jack_ringbuffer_read_space(drv->pPlayPtr) /
+                              drv->bytes_per_jack_output_frame));
   frames = bytes / drv->bytes_per_output_frame;
   TRACE("frames free == %ld, bytes = %lu\n", frames_free, bytes);
 
@@ -1805,45 +1884,31 @@ JACK_Write(int deviceID, unsigned char *data, unsigned long bytes)
 
   frames = min(frames, frames_free);
   long jack_bytes = frames * drv->bytes_per_jack_output_frame;
-  if(!ensure_buffer_size(&drv->rw_buffer1, &drv->rw_buffer1_size, jack_bytes))
-  {
-    ERR("couldn't allocate enough space for the buffer\n");
-    releaseDriver(drv);
-    return 0;
-  }
   /* adjust bytes to be how many client bytes we're actually writing */
   bytes = frames * drv->bytes_per_output_frame;
 
-  /* convert from client samples to jack samples
-     we have to tell it how many samples there are, which is frames * channels */
-  switch (drv->bits_per_channel)
-  {
-  case 8:
-    sample_move_char_float((sample_t *) drv->rw_buffer1, (unsigned char *) data,
-                           frames * drv->num_output_channels);
-    break;
-  case 16:
-    sample_move_short_float((sample_t *) drv->rw_buffer1, (short *) data,
-                            frames * drv->num_output_channels);
-    break;
-  case 32:
-    if (drv->sample_format == SAMPLE_FMT_FLOAT)
-      sample_move_float_float((sample_t *) drv->rw_buffer1, (float *) data,
-                            frames * drv->num_output_channels);
-    else if (drv->sample_format == SAMPLE_FMT_PACKED_24B)
-      sample_move_int24_float((sample_t *) drv->rw_buffer1, (int32_t *) data,
-			      frames * drv->num_output_channels);
-    else
-      sample_move_int32_float((sample_t *) drv->rw_buffer1, (int32_t *) data,
-			      frames * drv->num_output_channels);
-    break;
-  }
-
   DEBUG("ringbuffer read space = %d, write space = %d\n",
         jack_ringbuffer_read_space(drv->pPlayPtr),
         jack_ringbuffer_write_space(drv->pPlayPtr));
 
-  jack_ringbuffer_write(drv->pPlayPtr, drv->rw_buffer1, jack_bytes);
+  /* convert from client samples straight into the ringbuffer, float data is */
+  /* just copied; the write vector always wraps at a sample boundary */
+  jack_ringbuffer_data_t vec[2];
+  unsigned long samples = frames * drv->num_output_channels;
+  int v;
+
+  jack_ringbuffer_get_write_vector(drv->pPlayPtr, vec);
+
+  for(v = 0; v < 2 && samples; v++)
+  {
+    unsigned long n = min(vec[v].len / sizeof(sample_t), samples);
+
+    sample_move_client_float(drv, (sample_t *) vec[v].buf, data, n);
+    data += n * (drv->bits_per_channel / 8);
+    samples -= n;
+  }
+
+  jack_ringbuffer_write_advance(drv->pPlayPtr, jack_bytes);
   DEBUG("wrote %lu bytes, %lu jack_bytes\n", bytes, jack_bytes);
 
   DEBUG("ringbuffer read space = %d, write space = %d\n",
@@ -2213,8 +2278,21 @@ JACK_GetBytesFreeSpaceFromDriver(jack_driver_t * drv)
   if(drv->pPlayPtr == 0 || drv->bytes_per_jack_output_frame == 0)
     return 0;
 
-  /* leave at least one frame in the buffer at all times to prevent underruns */
-  long return_val = jack_ringbuffer_write_space(drv->pPlayPtr) - drv->jack_buffer_size;
+  long return_val;
+  long depth = JACK_GetBufferDepthFrames(drv);
+
+  if(depth)
+  {
+    /* fill up to the buffer depth we were asked for, no further */
+    return_val = min((long) jack_ringbuffer_write_space(drv->pPlayPtr),
+                     (long) ((depth * drv->bytes_per_jack_output_frame) -
+                             jack_ringbuffer_read_space(drv->pPlayPtr)));
+  } else
+  {
+    /* leave at least one frame in the buffer at all times to prevent underruns */
+    return_val = jack_ringbuffer_write_space(drv->pPlayPtr) - drv->jack_buffer_size;
+  }
+
   if(return_val <= 0)
   {
     return_val = 0;
@@ -2280,8 +2358,6 @@ JACK_GetPositionFromDriver(jack_driver_t * drv, enum pos_enum position,
                            int type)
 {
   long return_val = 0;
-  struct timeval now;
-  long elapsedMS;
   double sec2msFactor = 1000;
 
 #if TRACE_ENABLE
@@ -2312,26 +2388,36 @@ JACK_GetPositionFromDriver(jack_driver_t * drv, enum pos_enum position,
 #if TRACE_ENABLE
     type_str = "PLAYED";
 #endif
-    return_val = drv->played_client_bytes;
-    gettimeofday(&now, 0);
-
-    elapsedMS = TimeValDifference(&drv->previousTime, &now);    /* find the elapsed milliseconds since last JACK_Callback() */
-
-    TRACE("elapsedMS since last callback is '%ld'\n", elapsedMS);
-
-    /* account for the bytes played since the last JACK_Callback() */
-    /* NOTE: [Xms * (Bytes/Sec)] * (1 sec/1,000ms) */
-    /* NOTE: don't do any compensation if no data has been sent to jack since the last callback */
-    /* as this would result a bogus computed result */
-    if(drv->clientBytesInJack != 0)
+    /* the bytes that have left the ringbuffer (what the client wrote, less */
+    /* the ringbuffer fill) before the current period, plus as much of the */
+    /* current period as jack has got through, less the latency between */
+    /* our ports and the speakers */
+    long in_jack;
+    int seq;
+
+    do
     {
-      return_val += (long) ((double) elapsedMS *
-                            ((double) JACK_GetOutputBytesPerSecondFromDriver(drv) /
-                             sec2msFactor));
-    } else
+      seq = __atomic_load_n(&drv->position_seq, __ATOMIC_ACQUIRE);
+      return_val = drv->played_client_bytes;
+      in_jack = drv->clientBytesInJack;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while((seq & 1) || seq != __atomic_load_n(&drv->position_seq, __ATOMIC_RELAXED));
+
+    if(drv->client && in_jack && drv->output_sample_rate_ratio > 0)
     {
-      TRACE("clientBytesInJack == 0\n");
+      long elapsed = (long) (jack_frames_since_cycle_start(drv->client) /
+                             drv->output_sample_rate_ratio) *
+        drv->bytes_per_output_frame;
+      return_val += min(elapsed, in_jack);
     }
+
+    if(drv->output_sample_rate_ratio > 0)
+      return_val -= (long) (__atomic_load_n(&drv->playback_latency, __ATOMIC_RELAXED) /
+                            drv->output_sample_rate_ratio) *
+        drv->bytes_per_output_frame;
+
+    return_val = max(return_val, 0);
   }
 
   /* add on the offset */
@@ -2527,7 +2613,7 @@ JACK_CleanupDriver(jack_driver_t * drv)
   drv->output_sample_rate_ratio = 1.0;
   drv->input_sample_rate_ratio = 1.0;
   drv->jackd_died = FALSE;
-  gettimeofday(&drv->previousTime, 0);  /* record the current time */
+  drv->playback_latency = 0;
   gettimeofday(&drv->last_reconnect_attempt, 0);
 }
 
@@ -2589,11 +2675,8 @@ JACK_GetJackOutputLatency(int deviceID)
 
   if(drv->client && drv->num_output_channels)
   {
-    /* Disclaimer: I have no experience with JACK and don't know if this is
-     * correct. -jlindgren */
-    jack_latency_range_t range;
-    jack_port_get_latency_range(drv->output_port[0], JackPlaybackLatency, & range);
-    return_val = (range.min + range.max) / 2;
+    /* kept up to date by JACK_latency() */
+    return_val = __atomic_load_n(&drv->playback_latency, __ATOMIC_RELAXED);
   }
 
   TRACE("got latency of %ld frames\n", return_val);
@@ -2668,3 +2751,9 @@ JACK_SetPortConnectionMode(enum JACK_PORT_CONNECTION_MODE mode)
 {
     port_connection_mode = mode;
 }
+
+void
+JACK_SetBufferPeriods(int periods)
+{
+    buffer_periods = min(max(periods, 0), MAX_BUFFER_PERIODS);
+}
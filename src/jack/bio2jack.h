@@ -138,6 +138,11 @@ enum JACK_PORT_CONNECTION_MODE
 /* defaults to CONNECT_ALL */
 void JACK_SetPortConnectionMode(enum JACK_PORT_CONNECTION_MODE mode);
 
+/* limit the playback buffer of the next Open()d device to this many jack */
+/* periods (the limit follows later changes of the period size); */
+/* defaults to 0, meaning no limit beyond the size of the ringbuffer */
+void JACK_SetBufferPeriods(int periods);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,6 +17,8 @@
 
 #include "bio2jack.h" /* includes for the bio2jack library */
 #include "jack.h"
+#include "../perfstat/perfstat.h"
+#include "../ratepref/ratepref.h"
 
 /* set to 1 for verbose output */
 #define VERBOSE_OUTPUT          0
@@ -56,6 +58,8 @@ static format_info_t output;
 static bool_t output_opened; /* true if we have a connection to jack */
 static bool_t paused;
 
+static PerfStatOutput perfstat = PERFSTAT_OUTPUT_INIT(N_("JACK Output"));
+
 
 /* Giacomo's note: removed the destructor from the original xmms-jack, cause
    destructors + thread join + NPTL currently leads to problems; solved this
@@ -121,7 +125,9 @@ static void jack_get_volume(int *l, int *r)
 
 
 /* Return the current number of milliseconds of audio data that has */
-/* been played out of the audio device, not including the buffer */
+/* been played out of the audio device, not including the buffer; bio2jack */
+/* works this out from the position within the current jack period and */
+/* the playback latency jack reports for our ports */
 static int jack_get_output_time(void)
 {
   int return_val;
@@ -186,6 +192,7 @@ static const char * const jack_defaults[] = {
  "port_connection_mode", "CONNECT_ALL",
  "volume_left", "25",
  "volume_right", "25",
+ "buffer_periods", "0",
  NULL};
 
 /* Initialize necessary things */
@@ -197,6 +204,7 @@ static bool_t jack_init (void)
   jack_cfg.port_connection_mode = aud_get_string ("jack", "port_connection_mode");
   jack_cfg.volume_left = aud_get_int ("jack", "volume_left");
   jack_cfg.volume_right = aud_get_int ("jack", "volume_right");
+  jack_cfg.buffer_periods = aud_get_int ("jack", "buffer_periods");
 
   TRACE("initializing\n");
   JACK_Init(); /* initialize the driver */
@@ -208,6 +216,10 @@ static bool_t jack_init (void)
   /* set the port connection mode */
   jack_set_port_connection_mode();
 
+  /* limit the playback buffer to so many jack periods, 0 for no limit */
+  /* (the core keeps a buffer of its own in front of ours either way) */
+  JACK_SetBufferPeriods(jack_cfg.buffer_periods);
+
   output_opened = FALSE;
 
   /* Always return OK, as we don't know about physical devices here */
@@ -294,6 +306,8 @@ static int jack_open(int fmt, int sample_rate, int num_channels)
   input.bps       = bits_per_sample * sample_rate * num_channels;
   input.channels  = num_channels;
 
+  perfstat_output_open(&perfstat, FMT_SIZEOF(fmt) * num_channels * sample_rate);
+
   /* setup the effect as matching the input format */
   effect.format    = input.format;
   effect.frequency = input.frequency;
@@ -331,6 +345,11 @@ static int jack_open(int fmt, int sample_rate, int num_channels)
   retval = JACK_Open(&driver, bits_per_sample, floating_point, &rate, output.channels);
   output.frequency = rate; /* avoid compile warning as output.frequency differs in type
                               from what JACK_Open() wants for the type of the rate parameter */
+
+  /* either way, rate is now that of the jack server, which we cannot change */
+  if(retval == ERR_SUCCESS || retval == ERR_RATE_MISMATCH)
+    ratepref_set_native(rate);
+
   if(retval == ERR_RATE_MISMATCH)
   {
     TRACE("set the resampling rate properly");
@@ -350,7 +369,7 @@ static int jack_open(int fmt, int sample_rate, int num_channels)
 
 
 /* write some audio out to the device */
-static void jack_write(void * ptr, int length)
+static void write_data(void * ptr, int length)
 {
   long written;
 
@@ -369,6 +388,11 @@ static void jack_write(void * ptr, int length)
   TRACE("finished\n");
 }
 
+static void jack_write(void * ptr, int length)
+{
+  perfstat_output_write(&perfstat, write_data(ptr, length), length);
+}
+
 
 /* Flush any output currently buffered */
 /* and set the number of bytes written based on ms_offset_time, */
@@ -379,6 +403,8 @@ static void jack_flush(int ms_offset_time)
 {
   TRACE("setting values for ms_offset_time of %d\n", ms_offset_time);
 
+  perfstat_output_idle(&perfstat);
+
   JACK_Reset(driver); /* flush buffers and set state to STOPPED */
 
   /* update the internal driver values to correspond to the input time given */
@@ -397,6 +423,7 @@ static void jack_pause (bool_t p)
   TRACE("p == %d\n", p);
 
   paused = p;
+  perfstat_output_idle(&perfstat);
 
   /* pause the device if p is non-zero, unpause the device if p is zero and */
   /* we are currently paused */
@@ -18,12 +18,45 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "ladspa.h"
 #include "plugin.h"
+#include "../denormal/denormal.h"
+
+/* With worker threads, the audio is split into one plane per channel (a
+ * Block), and each plugin instance becomes a job that reads and writes only its
+ * own channels of a block.  Without pipelining, the plugins in the list run
+ * over the same block one after another, each with its instances in parallel.
+ * With pipelining, every process() call adds a new block and all the plugins
+ * run at once, each on a different block: the first plugin on the newest one,
+ * the last on the block that then leaves the pipeline.  That holds back one
+ * block per plugin after the first, which ladspa_adjust_delay() reports. */
+
+typedef struct {
+    float * * planes;
+    int frames, size;
+    int done; /* plugins already run */
+} Block;
+
+typedef struct {
+    LoadedPlugin * loaded;
+    int instance;
+    Block * block;
+} Job;
 
 static int ladspa_channels, ladspa_rate;
+static char use_pool, use_pipeline;
+
+static GQueue pipeline = G_QUEUE_INIT; /* (Block *), oldest first */
+static GSList * spare_blocks; /* (Block *) */
+static GPtrArray * stages; /* (LoadedPlugin *) */
+static GArray * jobs; /* (Job) */
+
+static float * out_buf;
+static int out_size;
 
 static void start_plugin (LoadedPlugin * loaded)
 {
@@ -164,6 +197,287 @@ static void flush_plugin (LoadedPlugin * loaded)
     }
 }
 
+static Block * get_block (int frames)
+{
+    Block * block;
+
+    if (spare_blocks)
+    {
+        block = spare_blocks->data;
+        spare_blocks = g_slist_delete_link (spare_blocks, spare_blocks);
+    }
+    else
+    {
+        block = g_slice_new0 (Block);
+        block->planes = g_new0 (float *, ladspa_channels);
+    }
+
+    if (block->size < frames)
+    {
+        for (int channel = 0; channel < ladspa_channels; channel ++)
+            block->planes[channel] = g_renew (float, block->planes[channel], frames);
+
+        block->size = frames;
+    }
+
+    block->frames = frames;
+    block->done = 0;
+    return block;
+}
+
+static void put_block (Block * block)
+{
+    spare_blocks = g_slist_prepend (spare_blocks, block);
+}
+
+static void drop_pipeline (void)
+{
+    Block * block;
+    while ((block = g_queue_pop_head (& pipeline)))
+        put_block (block);
+}
+
+static void split_channels (Block * block, const float * data)
+{
+    for (int channel = 0; channel < ladspa_channels; channel ++)
+    {
+        const float * get = data + channel;
+        float * set = block->planes[channel];
+        float * set_end = set + block->frames;
+
+        while (set < set_end)
+        {
+            * set ++ = * get;
+            get += ladspa_channels;
+        }
+    }
+}
+
+static void join_channels (Block * block, float * data)
+{
+    for (int channel = 0; channel < ladspa_channels; channel ++)
+    {
+        const float * get = block->planes[channel];
+        const float * get_end = get + block->frames;
+        float * set = data + channel;
+
+        while (get < get_end)
+        {
+            * set = * get ++;
+            set += ladspa_channels;
+        }
+    }
+}
+
+static void run_job (void * data, int i)
+{
+    Job * job = & g_array_index ((GArray *) data, Job, i);
+    LoadedPlugin * loaded = job->loaded;
+    Block * block = job->block;
+
+    const LADSPA_Descriptor * desc = loaded->plugin->desc;
+    LADSPA_Handle * handle = index_get (loaded->instances, job->instance);
+
+    int ports = loaded->plugin->in_ports->len;
+    int first = ports * job->instance;
+
+    /* the floating point mode is per thread */
+    DenormalState fpu;
+    denormal_begin (& fpu, flush_denormals);
+
+    for (int offset = 0; offset < block->frames; offset += LADSPA_BUFLEN)
+    {
+        int frames = MIN (block->frames - offset, LADSPA_BUFLEN);
+
+        for (int channel = first; channel < first + ports; channel ++)
+            memcpy (loaded->in_bufs[channel], block->planes[channel] + offset, sizeof (float) * frames);
+
+        desc->run (handle, frames);
+
+        for (int channel = first; channel < first + ports; channel ++)
+            memcpy (block->planes[channel] + offset, loaded->out_bufs[channel], sizeof (float) * frames);
+    }
+
+    denormal_end (& fpu);
+}
+
+static void add_jobs (LoadedPlugin * loaded, Block * block)
+{
+    int instances = index_count (loaded->instances);
+
+    for (int i = 0; i < instances; i ++)
+    {
+        Job job = {loaded, i, block};
+        g_array_append_val (jobs, job);
+    }
+}
+
+static void run_parallel (float * data, int samples)
+{
+    Block * block = get_block (samples / ladspa_channels);
+    split_channels (block, data);
+
+    int count = index_count (loadeds);
+    for (int i = 0; i < count; i ++)
+    {
+        LoadedPlugin * loaded = index_get (loadeds, i);
+        if (! loaded->instances)
+            continue;
+
+        g_array_set_size (jobs, 0);
+        add_jobs (loaded, block);
+        pool_run (run_job, jobs, jobs->len);
+    }
+
+    join_channels (block, data);
+    put_block (block);
+}
+
+/* Runs each block in the pipeline through its next plugin, all at once. */
+static void pipeline_step (void)
+{
+    g_array_set_size (jobs, 0);
+
+    for (GList * node = pipeline.head; node; node = node->next)
+    {
+        Block * block = node->data;
+        if (block->done < stages->len)
+            add_jobs (g_ptr_array_index (stages, block->done), block);
+    }
+
+    pool_run (run_job, jobs, jobs->len);
+
+    for (GList * node = pipeline.head; node; node = node->next)
+    {
+        Block * block = node->data;
+        if (block->done < stages->len)
+            block->done ++;
+    }
+}
+
+/* If plugins were added, removed or reordered since the last call, the blocks
+ * in the pipeline are finished with the new list, one plugin at a time. */
+static void update_stages (void)
+{
+    GPtrArray * list = g_ptr_array_new ();
+
+    int count = index_count (loadeds);
+    for (int i = 0; i < count; i ++)
+    {
+        LoadedPlugin * loaded = index_get (loadeds, i);
+        if (loaded->instances)
+            g_ptr_array_add (list, loaded);
+    }
+
+    if (stages && list->len == stages->len && ! memcmp (list->pdata,
+     stages->pdata, sizeof (void *) * list->len))
+    {
+        g_ptr_array_free (list, TRUE);
+        return;
+    }
+
+    for (GList * node = pipeline.head; node; node = node->next)
+    {
+        Block * block = node->data;
+
+        for (; block->done < list->len; block->done ++)
+        {
+            g_array_set_size (jobs, 0);
+            add_jobs (g_ptr_array_index (list, block->done), block);
+            pool_run (run_job, jobs, jobs->len);
+        }
+    }
+
+    if (stages)
+        g_ptr_array_free (stages, TRUE);
+
+    stages = list;
+}
+
+/* Moves the blocks that have been through every plugin to out_buf, after the
+ * given number of frames already there. */
+static int take_finished (int out_frames)
+{
+    Block * block;
+
+    while ((block = g_queue_peek_head (& pipeline)) && block->done >= stages->len)
+    {
+        g_queue_pop_head (& pipeline);
+
+        int samples = ladspa_channels * (out_frames + block->frames);
+
+        if (out_size < samples)
+        {
+            out_size = samples;
+            out_buf = g_renew (float, out_buf, out_size);
+        }
+
+        join_channels (block, out_buf + ladspa_channels * out_frames);
+        out_frames += block->frames;
+        put_block (block);
+    }
+
+    return out_frames;
+}
+
+static void run_pipeline (float * * data, int * samples, char finish)
+{
+    update_stages ();
+
+    int frames = * samples / ladspa_channels;
+
+    if (frames)
+    {
+        Block * block = get_block (frames);
+        split_channels (block, * data);
+        g_queue_push_tail (& pipeline, block);
+    }
+
+    int out_frames = take_finished (0);
+
+    if (frames || finish)
+    {
+        do
+        {
+            pipeline_step ();
+            out_frames = take_finished (out_frames);
+        }
+        while (finish && ! g_queue_is_empty (& pipeline));
+    }
+
+    * data = out_buf;
+    * samples = ladspa_channels * out_frames;
+}
+
+void release_buffers_locked (void)
+{
+    drop_pipeline ();
+
+    for (GSList * node = spare_blocks; node; node = node->next)
+    {
+        Block * block = node->data;
+
+        for (int channel = 0; channel < ladspa_channels; channel ++)
+            g_free (block->planes[channel]);
+
+        g_free (block->planes);
+        g_slice_free (Block, block);
+    }
+
+    g_slist_free (spare_blocks);
+    spare_blocks = NULL;
+
+    if (stages)
+    {
+        g_ptr_array_free (stages, TRUE);
+        stages = NULL;
+    }
+
+    g_free (out_buf);
+    out_buf = NULL;
+    out_size = 0;
+}
+
 void shutdown_plugin_locked (LoadedPlugin * loaded)
 {
     loaded->active = 0;
@@ -210,24 +524,48 @@ void ladspa_start (int * channels, int * rate)
         shutdown_plugin_locked (loaded);
     }
 
+    /* blocks are sized for the old channel count */
+    release_buffers_locked ();
+
     ladspa_channels = * channels;
     ladspa_rate = * rate;
 
+    pool_start (worker_threads);
+    use_pool = (pool_threads () > 0);
+    use_pipeline = use_pool && pipeline_mode;
+
+    if (use_pool && ! jobs)
+        jobs = g_array_new (0, 0, sizeof (Job));
+
     pthread_mutex_unlock (& mutex);
 }
 
-void ladspa_process (float * * data, int * samples)
+static void run_all (float * * data, int * samples, char finish)
 {
-    pthread_mutex_lock (& mutex);
+    DenormalState fpu;
+    denormal_begin (& fpu, flush_denormals);
 
     int count = index_count (loadeds);
     for (int i = 0; i < count; i ++)
+        start_plugin (index_get (loadeds, i));
+
+    if (use_pipeline)
+        run_pipeline (data, samples, finish);
+    else if (use_pool)
+        run_parallel (* data, * samples);
+    else
     {
-        LoadedPlugin * loaded = index_get (loadeds, i);
-        start_plugin (loaded);
-        run_plugin (loaded, * data, * samples);
+        for (int i = 0; i < count; i ++)
+            run_plugin (index_get (loadeds, i), * data, * samples);
     }
 
+    denormal_end (& fpu);
+}
+
+void ladspa_process (float * * data, int * samples)
+{
+    pthread_mutex_lock (& mutex);
+    run_all (data, samples, 0);
     pthread_mutex_unlock (& mutex);
 }
 
@@ -235,6 +573,8 @@ void ladspa_flush (void)
 {
     pthread_mutex_lock (& mutex);
 
+    drop_pipeline ();
+
     int count = index_count (loadeds);
     for (int i = 0; i < count; i ++)
     {
@@ -249,14 +589,26 @@ void ladspa_finish (float * * data, int * samples)
 {
     pthread_mutex_lock (& mutex);
 
+    run_all (data, samples, 1);
+
     int count = index_count (loadeds);
     for (int i = 0; i < count; i ++)
-    {
-        LoadedPlugin * loaded = index_get (loadeds, i);
-        start_plugin (loaded);
-        run_plugin (loaded, * data, * samples);
-        shutdown_plugin_locked (loaded);
-    }
+        shutdown_plugin_locked (index_get (loadeds, i));
+
+    pthread_mutex_unlock (& mutex);
+}
+
+int ladspa_adjust_delay (int delay)
+{
+    pthread_mutex_lock (& mutex);
+
+    int64_t frames = 0;
+    for (GList * node = pipeline.head; node; node = node->next)
+        frames += ((Block *) node->data)->frames;
+
+    if (ladspa_rate)
+        delay += frames * 1000 / ladspa_rate;
 
     pthread_mutex_unlock (& mutex);
+    return delay;
 }
@@ -34,9 +34,14 @@
 #include <libaudgui/libaudgui-gtk.h>
 
 #include "plugin.h"
+#include "../perfstat/perfstat.h"
+#include "../warmup/warmup.h"
 
 static const gchar * const ladspa_defaults[] = {
  "plugin_count", "0",
+ "worker_threads", "0",
+ "pipeline", "FALSE",
+ "flush_denormals", "TRUE",
  NULL};
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -45,6 +50,15 @@ Index * modules; /* (void *) */
 Index * plugins; /* (PluginData *) */
 Index * loadeds; /* (LoadedPlugin *) */
 
+int worker_threads;
+char pipeline_mode;
+char flush_denormals;
+
+/* Whether every module in the search paths has been opened.  At startup only
+ * the modules holding enabled plugins are; the rest wait until the list of
+ * available plugins is needed. */
+static char scanned_all;
+
 GtkWidget * config_win;
 GtkWidget * plugin_list;
 GtkWidget * loaded_list;
@@ -187,6 +201,18 @@ static void * open_module (const char * path)
     return handle;
 }
 
+static int module_is_open (const char * filename)
+{
+    int count = index_count (modules);
+    for (int i = 0; i < count; i ++)
+    {
+        if (! strcmp (g_module_name (index_get (modules, i)), filename))
+            return 1;
+    }
+
+    return 0;
+}
+
 static void open_modules_for_path (const char * path)
 {
     DIR * folder = opendir (path);
@@ -205,6 +231,9 @@ static void open_modules_for_path (const char * path)
         char filename[strlen (path) + strlen (entry->d_name) + 2];
         snprintf (filename, sizeof filename, "%s" G_DIR_SEPARATOR_S "%s", path, entry->d_name);
 
+        if (module_is_open (filename))
+            continue;
+
         void * handle = open_module (filename);
         if (handle)
             index_append (modules, handle);
@@ -213,23 +242,29 @@ static void open_modules_for_path (const char * path)
     closedir (folder);
 }
 
-static void open_modules_for_paths (const char * paths)
+/* LADSPA_PATH first, then our own paths */
+static char * * get_module_dirs (void)
 {
-    if (! paths || ! paths[0])
-        return;
-
+    const char * env = getenv ("LADSPA_PATH");
+    char * paths = g_strjoin (":", env ? env : "", module_path ? module_path : "", NULL);
     char * * split = g_strsplit (paths, ":", -1);
 
-    for (int i = 0; split[i]; i ++)
-        open_modules_for_path (split[i]);
-
-    g_strfreev (split);
+    g_free (paths);
+    return split;
 }
 
 static void open_modules (void)
 {
-    open_modules_for_paths (getenv ("LADSPA_PATH"));
-    open_modules_for_paths (module_path);
+    char * * dirs = get_module_dirs ();
+
+    for (int i = 0; dirs[i]; i ++)
+    {
+        if (dirs[i][0])
+            open_modules_for_path (dirs[i]);
+    }
+
+    g_strfreev (dirs);
+    scanned_all = 1;
 }
 
 static void close_modules (void)
@@ -245,6 +280,7 @@ static void close_modules (void)
         g_module_close (index_get (modules, i));
 
     index_delete (modules, 0, count);
+    scanned_all = 0;
 }
 
 LoadedPlugin * enable_plugin_locked (PluginData * plugin)
@@ -301,6 +337,42 @@ static PluginData * find_plugin (const char * path, const char * label)
     return NULL;
 }
 
+/* Finds a plugin by the name of its module and its label, opening just the
+ * module it is in if the search paths have not been scanned yet.  As with a
+ * full scan, the first module by that name in the search paths that has the
+ * plugin wins. */
+static PluginData * find_or_open_plugin (const char * path, const char * label)
+{
+    PluginData * plugin = find_plugin (path, label);
+    if (plugin || scanned_all || strchr (path, G_DIR_SEPARATOR))
+        return plugin;
+
+    char * * dirs = get_module_dirs ();
+
+    for (int i = 0; dirs[i] && ! plugin; i ++)
+    {
+        if (! dirs[i][0])
+            continue;
+
+        char * filename = g_build_filename (dirs[i], path, NULL);
+
+        if (! module_is_open (filename) && g_file_test (filename, G_FILE_TEST_IS_REGULAR))
+        {
+            void * handle = open_module (filename);
+            if (handle)
+            {
+                index_append (modules, handle);
+                plugin = find_plugin (path, label);
+            }
+        }
+
+        g_free (filename);
+    }
+
+    g_strfreev (dirs);
+    return plugin;
+}
+
 static void save_enabled_to_config (void)
 {
     int count = index_count (loadeds);
@@ -342,7 +414,7 @@ static void load_enabled_from_config (void)
         snprintf (key, sizeof key, "plugin%d_label", i);
         char * label = aud_get_string ("ladspa", key);
 
-        PluginData * plugin = find_plugin (path, label);
+        PluginData * plugin = find_or_open_plugin (path, label);
         if (plugin)
         {
             LoadedPlugin * loaded = enable_plugin_locked (plugin);
@@ -360,8 +432,21 @@ static void load_enabled_from_config (void)
     }
 }
 
+/* Opening the enabled modules can take a while with a long chain; it is done
+ * in the background (see warmup.h) and waited for on first use. */
+static void load_enabled (void)
+{
+    pthread_mutex_lock (& mutex);
+    load_enabled_from_config ();
+    pthread_mutex_unlock (& mutex);
+}
+
+static Warmup warmup = WARMUP_INIT (N_("LADSPA Host"), load_enabled);
+
 static int init (void)
 {
+    int64_t init_begin = perfstat_now ();
+
     pthread_mutex_lock (& mutex);
 
     modules = index_new ();
@@ -371,11 +456,14 @@ static int init (void)
     aud_config_set_defaults ("ladspa", ladspa_defaults);
 
     module_path = aud_get_string ("ladspa", "module_path");
-
-    open_modules ();
-    load_enabled_from_config ();
+    worker_threads = aud_get_int ("ladspa", "worker_threads");
+    pipeline_mode = aud_get_bool ("ladspa", "pipeline");
+    flush_denormals = aud_get_bool ("ladspa", "flush_denormals");
 
     pthread_mutex_unlock (& mutex);
+
+    /* the other modules are opened when the settings window is shown */
+    warmup_start (& warmup, init_begin);
     return 1;
 }
 
@@ -384,13 +472,23 @@ static void cleanup (void)
     if (config_win)
         gtk_widget_destroy (config_win);
 
+    /* what is enabled must be known before it is saved */
+    warmup_wait (& warmup);
+    warmup_stop (& warmup);
+
     pthread_mutex_lock (& mutex);
 
     aud_config_clear_section ("ladspa");
     aud_set_string ("ladspa", "module_path", module_path);
+    aud_set_int ("ladspa", "worker_threads", worker_threads);
+    aud_set_bool ("ladspa", "pipeline", pipeline_mode);
+    aud_set_bool ("ladspa", "flush_denormals", flush_denormals);
     save_enabled_to_config ();
     close_modules ();
 
+    release_buffers_locked ();
+    pool_stop ();
+
     index_free (modules);
     modules = NULL;
     index_free (plugins);
@@ -425,6 +523,27 @@ static void set_module_path (GtkEntry * entry)
         update_loaded_list (loaded_list);
 }
 
+static void set_worker_threads (GtkSpinButton * spin)
+{
+    pthread_mutex_lock (& mutex);
+    worker_threads = gtk_spin_button_get_value_as_int (spin);
+    pthread_mutex_unlock (& mutex);
+}
+
+static void set_pipeline (GtkToggleButton * toggle)
+{
+    pthread_mutex_lock (& mutex);
+    pipeline_mode = gtk_toggle_button_get_active (toggle) ? 1 : 0;
+    pthread_mutex_unlock (& mutex);
+}
+
+static void set_flush_denormals (GtkToggleButton * toggle)
+{
+    pthread_mutex_lock (& mutex);
+    flush_denormals = gtk_toggle_button_get_active (toggle) ? 1 : 0;
+    pthread_mutex_unlock (& mutex);
+}
+
 static void enable_selected (void)
 {
     pthread_mutex_lock (& mutex);
@@ -558,6 +677,15 @@ static void configure (void)
         return;
     }
 
+    warmup_wait (& warmup);
+
+    if (! scanned_all)
+    {
+        pthread_mutex_lock (& mutex);
+        open_modules ();
+        pthread_mutex_unlock (& mutex);
+    }
+
     config_win = gtk_dialog_new_with_buttons (_("LADSPA Host Settings"), NULL,
      0, GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE, NULL);
     gtk_window_set_default_size ((GtkWindow *) config_win, 480, 360);
@@ -582,6 +710,34 @@ static void configure (void)
     GtkWidget * entry = gtk_entry_new ();
     gtk_box_pack_start ((GtkBox *) hbox, entry, 1, 1, 0);
 
+    hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_box_pack_start ((GtkBox *) vbox, hbox, 0, 0, 0);
+
+    label = gtk_label_new (_("Worker threads:"));
+    gtk_box_pack_start ((GtkBox *) hbox, label, 0, 0, 0);
+
+    GtkWidget * threads_spin = gtk_spin_button_new_with_range (0, MAX_WORKER_THREADS, 1);
+    gtk_spin_button_set_value ((GtkSpinButton *) threads_spin, worker_threads);
+    gtk_box_pack_start ((GtkBox *) hbox, threads_spin, 0, 0, 0);
+
+    GtkWidget * pipeline_check = gtk_check_button_new_with_label
+     (_("Run plugins in a pipeline (adds latency)"));
+    gtk_toggle_button_set_active ((GtkToggleButton *) pipeline_check, pipeline_mode);
+    gtk_box_pack_start ((GtkBox *) hbox, pipeline_check, 0, 0, 0);
+
+    GtkWidget * denormal_check = gtk_check_button_new_with_label
+     (_("Flush denormals"));
+    gtk_toggle_button_set_active ((GtkToggleButton *) denormal_check, flush_denormals);
+    gtk_box_pack_start ((GtkBox *) hbox, denormal_check, 0, 0, 0);
+
+    label = gtk_label_new (0);
+    gtk_label_set_markup ((GtkLabel *) label,
+     _("<small>With worker threads, the channels of each plugin are processed in parallel.\n"
+     "Thread settings take effect at the start of the next song.</small>"));
+    gtk_misc_set_padding ((GtkMisc *) label, 12, 6);
+    gtk_misc_set_alignment ((GtkMisc *) label, 0, 0);
+    gtk_box_pack_start ((GtkBox *) vbox, label, 0, 0, 0);
+
     hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
     gtk_box_pack_start ((GtkBox *) vbox, hbox, 1, 1, 0);
 
@@ -632,6 +788,9 @@ static void configure (void)
     g_signal_connect (config_win, "response", (GCallback) gtk_widget_destroy, NULL);
     g_signal_connect (config_win, "destroy", (GCallback) gtk_widget_destroyed, & config_win);
     g_signal_connect (entry, "activate", (GCallback) set_module_path, NULL);
+    g_signal_connect (threads_spin, "value-changed", (GCallback) set_worker_threads, NULL);
+    g_signal_connect (pipeline_check, "toggled", (GCallback) set_pipeline, NULL);
+    g_signal_connect (denormal_check, "toggled", (GCallback) set_flush_denormals, NULL);
     g_signal_connect (plugin_list, "destroy", (GCallback) gtk_widget_destroyed, & plugin_list);
     g_signal_connect (enable_button, "clicked", (GCallback) enable_selected, NULL);
     g_signal_connect (loaded_list, "destroy", (GCallback) gtk_widget_destroyed, & loaded_list);
@@ -645,6 +804,14 @@ static const char about[] =
  N_("LADSPA Host for Audacious\n"
     "Copyright 2011 John Lindgren");
 
+static void start (int * channels, int * rate)
+{
+    warmup_wait (& warmup);
+    ladspa_start (channels, rate);
+}
+
+PERFSTAT_EFFECT (N_("LADSPA Host"), start, ladspa_process, ladspa_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("LADSPA Host"),
@@ -653,9 +820,10 @@ AUD_EFFECT_PLUGIN
     .init = init,
     .cleanup = cleanup,
     .configure = configure,
-    .start = ladspa_start,
-    .process = ladspa_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = ladspa_flush,
-    .finish = ladspa_finish,
+    .finish = perfstat_finish,
+    .adjust_delay = ladspa_adjust_delay,
     .preserves_format = 1,
 )
@@ -27,6 +27,7 @@
 #include "ladspa.h"
 
 #define LADSPA_BUFLEN 1024
+#define MAX_WORKER_THREADS 16
 
 typedef struct {
     int port;
@@ -65,6 +66,16 @@ extern Index * modules; /* (GModule *) */
 extern Index * plugins; /* (PluginData *) */
 extern Index * loadeds; /* (LoadedPlugin *) */
 
+/* Takes effect when the next song starts.  With no worker threads, all
+ * plugins run on the audio thread. */
+extern int worker_threads;
+extern char pipeline_mode;
+
+/* Whether subnormal numbers are flushed to zero while the plugins run, on the
+ * audio thread and the worker threads alike.  Filters ringing out into silence
+ * can otherwise slow down by orders of magnitude. */
+extern char flush_denormals;
+
 extern GtkWidget * about_win;
 extern GtkWidget * config_win;
 extern GtkWidget * plugin_list;
@@ -76,11 +87,22 @@ void disable_plugin_locked (int i);
 /* effect.c */
 
 void shutdown_plugin_locked (LoadedPlugin * loaded);
+void release_buffers_locked (void);
 
 void ladspa_start (gint * channels, gint * rate);
 void ladspa_process (gfloat * * data, gint * samples);
 void ladspa_flush (void);
 void ladspa_finish (gfloat * * data, gint * samples);
+int ladspa_adjust_delay (int delay);
+
+/* pool.c */
+
+typedef void (* PoolFunc) (void * data, int job);
+
+void pool_start (int threads);
+void pool_stop (void);
+int pool_threads (void);
+void pool_run (PoolFunc func, void * data, int jobs);
 
 /* plugin-list.c */
 
@@ -0,0 +1,147 @@
+/*
+ * LADSPA Host for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* A small pool of worker threads.  pool_run() hands out the jobs one at a time
+ * to the workers and to the calling thread, and returns once all of them are
+ * done.  Only the audio thread submits work, so there is one batch at a
+ * time. */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <glib.h>
+
+#include "plugin.h"
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t * threads;
+static int n_threads;
+static char quit;
+
+static PoolFunc job_func;
+static void * job_data;
+static int job_count, job_next, job_pending;
+
+/* Runs jobs until none are left to take; called with pool_mutex locked. */
+static void take_jobs (void)
+{
+    while (job_next < job_count)
+    {
+        int i = job_next ++;
+
+        pthread_mutex_unlock (& pool_mutex);
+        job_func (job_data, i);
+        pthread_mutex_lock (& pool_mutex);
+
+        if (! -- job_pending)
+            pthread_cond_signal (& done_cond);
+    }
+}
+
+static void * worker (void * unused)
+{
+    pthread_mutex_lock (& pool_mutex);
+
+    while (! quit)
+    {
+        take_jobs ();
+        pthread_cond_wait (& work_cond, & pool_mutex);
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+    return NULL;
+}
+
+void pool_stop (void)
+{
+    if (! n_threads)
+        return;
+
+    pthread_mutex_lock (& pool_mutex);
+    quit = 1;
+    pthread_cond_broadcast (& work_cond);
+    pthread_mutex_unlock (& pool_mutex);
+
+    for (int i = 0; i < n_threads; i ++)
+        pthread_join (threads[i], NULL);
+
+    g_free (threads);
+    threads = NULL;
+    n_threads = 0;
+    quit = 0;
+}
+
+void pool_start (int count)
+{
+    if (count == n_threads)
+        return;
+
+    pool_stop ();
+
+    threads = g_new (pthread_t, count);
+
+    for (int i = 0; i < count; i ++)
+    {
+        if (pthread_create (& threads[n_threads], NULL, worker, NULL))
+        {
+            fprintf (stderr, "ladspa: Failed to create worker thread.\n");
+            break;
+        }
+
+        n_threads ++;
+    }
+}
+
+int pool_threads (void)
+{
+    return n_threads;
+}
+
+void pool_run (PoolFunc func, void * data, int count)
+{
+    if (! n_threads || count < 2)
+    {
+        for (int i = 0; i < count; i ++)
+            func (data, i);
+
+        return;
+    }
+
+    pthread_mutex_lock (& pool_mutex);
+
+    job_func = func;
+    job_data = data;
+    job_count = count;
+    job_next = 0;
+    job_pending = count;
+
+    pthread_cond_broadcast (& work_cond);
+    take_jobs ();
+
+    while (job_pending)
+        pthread_cond_wait (& done_cond, & pool_mutex);
+
+    job_count = 0;
+    job_next = 0;
+
+    pthread_mutex_unlock (& pool_mutex);
+}
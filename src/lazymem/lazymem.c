@@ -0,0 +1,106 @@
+/*
+ * Lazily Allocated Memory for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "lazymem.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include <audacious/debug.h>
+
+/* mutex must be locked */
+static void free_locked (LazyMem * lazy)
+{
+    if (lazy->mem)
+    {
+        AUDDBG ("%s: freeing %d kB.\n", lazy->name, (int) (lazy->size >> 10));
+        free (lazy->mem);
+        lazy->mem = NULL;
+    }
+}
+
+/* main thread only */
+static gboolean idle_timeout (void * data)
+{
+    LazyMem * lazy = data;
+    unsigned self = g_source_get_id (g_main_current_source ());
+
+    pthread_mutex_lock (& lazy->mutex);
+
+    /* a new user may have removed this timeout as it fired */
+    if (lazy->source == self)
+    {
+        free_locked (lazy);
+        lazy->source = 0;
+    }
+
+    pthread_mutex_unlock (& lazy->mutex);
+    return FALSE;
+}
+
+void * lazymem_get (LazyMem * lazy)
+{
+    pthread_mutex_lock (& lazy->mutex);
+
+    if (lazy->source)
+    {
+        g_source_remove (lazy->source);
+        lazy->source = 0;
+    }
+
+    if (! lazy->mem)
+    {
+        AUDDBG ("%s: allocating %d kB.\n", lazy->name, (int) (lazy->size >> 10));
+        lazy->mem = calloc (1, lazy->size);
+    }
+
+    void * mem = lazy->mem;
+
+    if (mem)
+        lazy->users ++;
+
+    pthread_mutex_unlock (& lazy->mutex);
+    return mem;
+}
+
+void lazymem_put (LazyMem * lazy)
+{
+    pthread_mutex_lock (& lazy->mutex);
+
+    if (! -- lazy->users && ! lazy->source)
+        lazy->source = g_timeout_add_seconds (LAZYMEM_IDLE_SECONDS,
+         idle_timeout, lazy);
+
+    pthread_mutex_unlock (& lazy->mutex);
+}
+
+void lazymem_free (LazyMem * lazy)
+{
+    pthread_mutex_lock (& lazy->mutex);
+
+    if (lazy->source)
+    {
+        g_source_remove (lazy->source);
+        lazy->source = 0;
+    }
+
+    free_locked (lazy);
+    pthread_mutex_unlock (& lazy->mutex);
+}
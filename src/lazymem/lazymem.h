@@ -0,0 +1,65 @@
+/*
+ * Lazily Allocated Memory for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_LAZYMEM_H
+#define AUDACIOUS_LAZYMEM_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* Emulator cores tend to keep the RAM of the machine they emulate in static
+ * arrays, megabytes of it, which count against the player whether or not the
+ * format is ever played.  A LazyMem holds such memory on the heap instead: it
+ * is allocated (zeroed) by the first lazymem_get() and, once the last user has
+ * called lazymem_put(), freed after LAZYMEM_IDLE_SECONDS without a new user,
+ * so that playing one song after another does not allocate it each time.
+ *
+ * The timeout runs on the main loop.  Plugins call lazymem_free() from their
+ * cleanup function, after playback has stopped. */
+
+#define LAZYMEM_IDLE_SECONDS 30
+
+typedef struct {
+    const char * name;
+    size_t size;
+
+    pthread_mutex_t mutex;
+    void * mem;
+    int users;
+    unsigned source;
+} LazyMem;
+
+#define LAZYMEM_INIT(name, size) {name, size, PTHREAD_MUTEX_INITIALIZER}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns NULL if out of memory.  The contents are left as the last user left
+ * them, unless the memory had been freed meanwhile. */
+void * lazymem_get (LazyMem * lazy);
+void lazymem_put (LazyMem * lazy);
+
+void lazymem_free (LazyMem * lazy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,7 +20,9 @@
 
 #include <stdio.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
+#include <time.h>
 #include <gtk/gtk.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -46,6 +48,25 @@ typedef struct {
 
 static LyricsState state;
 
+/* a lookup in flight; the strings are pooled */
+typedef struct {
+	char *title, *artist;
+	char *uri; /* URI this step is retrieving */
+	bool_t prefetch; /* only fill the cache, leave the window alone */
+} LyricsRequest;
+
+/* search URI of the prefetch in flight, if any (pooled) */
+static char *prefetch_uri;
+
+/* how long to remember that a song has no lyrics */
+#define NEGATIVE_TTL (7 * 24 * 60 * 60)
+
+enum {
+	CACHE_MISS,
+	CACHE_FOUND,
+	CACHE_NO_LYRICS
+};
+
 /*
  * Suppress libxml warnings, because lyricwiki does not generate anything near
  * valid HTML.
@@ -54,7 +75,7 @@ static void libxml_error_handler(void *ctx, const char *msg, ...)
 {
 }
 
-/* free() returned text */
+/* free() returned text, which is empty if the song has no lyrics yet */
 static char *scrape_lyrics_from_lyricwiki_edit_page(const char *buf, int64_t len)
 {
 	xmlDocPtr doc;
@@ -113,8 +134,9 @@ give_up:
 				ret = g_match_info_fetch(match_info, 2);
 				if (!g_utf8_collate(ret, "<!-- PUT LYRICS HERE (and delete this entire line) -->"))
 				{
+					/* the page exists but nobody has filled it in */
 					free(ret);
-					ret = strdup(_("No lyrics available"));
+					ret = strdup("");
 				}
 
 				g_regex_unref(reg);
@@ -190,78 +212,219 @@ static char *scrape_uri_from_lyricwiki_search_result(const char *buf, int64_t le
 	return uri;
 }
 
-static void update_lyrics_window(const char *title, const char *artist, const char *lyrics);
+/*
+ * Lookups are cached on disk under the user directory, one file per song,
+ * named after a hash of the case-folded artist and title with runs of white
+ * space collapsed.  An empty file records that lyricwiki has nothing for the
+ * song; it is trusted for NEGATIVE_TTL seconds, after which we ask again.
+ */
+/* g_free() returned string */
+static char *normalise(const char *str)
+{
+	char *folded = g_utf8_casefold(str, -1);
+	char *out = folded;
+
+	for (const char *in = folded; *in; in++)
+	{
+		if (!g_ascii_isspace(*in))
+			*out++ = *in;
+		else if (out > folded && out[-1] != ' ')
+			*out++ = ' ';
+	}
+
+	if (out > folded && out[-1] == ' ')
+		out--;
 
-static bool_t get_lyrics_step_3(void *buf, int64_t len, void *requri)
+	*out = 0;
+	return folded;
+}
+
+static char *cache_path(const char *artist, const char *title)
 {
-	if (strcmp(state.uri, requri))
+	char *norm_artist = normalise(artist);
+	char *norm_title = normalise(title);
+	char *key = g_strconcat(norm_artist, "\n", norm_title, NULL);
+	char *sum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+	char *path = g_build_filename(aud_get_path(AUD_PATH_USER_DIR), "lyrics", sum, NULL);
+
+	g_free(sum);
+	g_free(key);
+	g_free(norm_title);
+	g_free(norm_artist);
+	return path;
+}
+
+/* g_free() *lyrics if CACHE_FOUND is returned */
+static int cache_lookup(const char *artist, const char *title, char **lyrics)
+{
+	char *path = cache_path(artist, title);
+	int result = CACHE_MISS;
+	GStatBuf st;
+
+	if (g_stat(path, &st) == 0)
 	{
-		free(buf);
-		str_unref(requri);
-		return FALSE;
+		if (st.st_size > 0)
+		{
+			if (g_file_get_contents(path, lyrics, NULL, NULL))
+				result = CACHE_FOUND;
+		}
+		else if (time(NULL) - st.st_mtime < NEGATIVE_TTL)
+			result = CACHE_NO_LYRICS;
 	}
-	str_unref(requri);
+
+	g_free(path);
+	return result;
+}
+
+/* lyrics may be NULL or empty if the song has none */
+static void cache_store(const char *artist, const char *title, const char *lyrics)
+{
+	char *path = cache_path(artist, title);
+	char *dir = g_path_get_dirname(path);
+
+	if (g_mkdir_with_parents(dir, 0755) == 0)
+		g_file_set_contents(path, lyrics ? lyrics : "", -1, NULL);
+
+	g_free(dir);
+	g_free(path);
+}
+
+static LyricsRequest *request_new(const char *title, const char *artist, const char *uri, bool_t prefetch)
+{
+	LyricsRequest *req = g_slice_new(LyricsRequest);
+	req->title = str_get(title);
+	req->artist = str_get(artist);
+	req->uri = str_get(uri);
+	req->prefetch = prefetch;
+	return req;
+}
+
+static void request_free(LyricsRequest *req)
+{
+	if (req->prefetch && prefetch_uri)
+	{
+		str_unref(prefetch_uri);
+		prefetch_uri = NULL;
+	}
+
+	str_unref(req->title);
+	str_unref(req->artist);
+	str_unref(req->uri);
+	g_slice_free(LyricsRequest, req);
+}
+
+/* FALSE if the song has changed since the request was made */
+static bool_t request_current(LyricsRequest *req)
+{
+	return req->prefetch || (state.uri && !strcmp(state.uri, req->uri));
+}
+
+static void update_lyrics_window(const char *title, const char *artist, const char *lyrics);
+
+static void show_error(const char *format, const char *uri)
+{
+	SPRINTF(error, format, uri);
+	update_lyrics_window(_("Error"), NULL, error);
+}
+
+static void show_lyrics(const char *title, const char *artist, const char *lyrics)
+{
+	update_lyrics_window(title, artist, (lyrics && lyrics[0]) ? lyrics : _("No lyrics available"));
+}
+
+static bool_t get_lyrics_step_3(void *buf, int64_t len, void *_req)
+{
+	LyricsRequest *req = _req;
+
+	if (!request_current(req))
+		goto DONE;
 
 	if(!len)
 	{
-		SPRINTF(error, _("Unable to fetch %s"), state.uri);
-		update_lyrics_window(_("Error"), NULL, error);
-		free(buf);
-		return FALSE;
+		if (!req->prefetch)
+			show_error(_("Unable to fetch %s"), req->uri);
+		goto DONE;
 	}
 
 	char *lyrics = scrape_lyrics_from_lyricwiki_edit_page(buf, len);
 
 	if(!lyrics)
 	{
-		SPRINTF(error, _("Unable to parse %s"), state.uri);
-		update_lyrics_window(_("Error"), NULL, error);
-		free(buf);
-		return FALSE;
+		if (!req->prefetch)
+			show_error(_("Unable to parse %s"), req->uri);
+		goto DONE;
 	}
 
-	update_lyrics_window(state.title, state.artist, lyrics);
+	cache_store(req->artist, req->title, lyrics);
+
+	if (!req->prefetch)
+		show_lyrics(req->title, req->artist, lyrics);
 
 	free(lyrics);
-	return TRUE;
+
+DONE:
+	free(buf);
+	request_free(req);
+	return FALSE;
 }
 
-static bool_t get_lyrics_step_2(void *buf, int64_t len, void *requri)
+static bool_t get_lyrics_step_2(void *buf, int64_t len, void *_req)
 {
-	if (strcmp(state.uri, requri))
-	{
-		free(buf);
-		str_unref(requri);
-		return FALSE;
-	}
-	str_unref(requri);
+	LyricsRequest *req = _req;
+
+	if (!request_current(req))
+		goto DONE;
 
 	if(!len)
 	{
-		SPRINTF(error, _("Unable to fetch %s"), state.uri);
-		update_lyrics_window(_("Error"), NULL, error);
-		free(buf);
-		return FALSE;
+		if (!req->prefetch)
+			show_error(_("Unable to fetch %s"), req->uri);
+		goto DONE;
 	}
 
 	char *uri = scrape_uri_from_lyricwiki_search_result(buf, len);
 
 	if(!uri)
 	{
-		SPRINTF(error, _("Unable to parse %s"), state.uri);
-		update_lyrics_window(_("Error"), NULL, error);
-		free(buf);
-		return FALSE;
+		/* lyricwiki does not know the song */
+		cache_store(req->artist, req->title, NULL);
+
+		if (!req->prefetch)
+			show_error(_("Unable to parse %s"), req->uri);
+		goto DONE;
 	}
 
-	str_unref(state.uri);
-	state.uri = uri;
+	str_unref(req->uri);
+	req->uri = uri;
 
-	update_lyrics_window(state.title, state.artist, _("Looking for lyrics ..."));
-	vfs_async_file_get_contents(uri, get_lyrics_step_3, str_ref(state.uri));
+	if (!req->prefetch)
+	{
+		str_unref(state.uri);
+		state.uri = str_ref(uri);
+		update_lyrics_window(req->title, req->artist, _("Looking for lyrics ..."));
+	}
+
+	vfs_async_file_get_contents(uri, get_lyrics_step_3, req);
 
 	free(buf);
 	return TRUE;
+
+DONE:
+	free(buf);
+	request_free(req);
+	return FALSE;
+}
+
+/* pooled */
+static char *search_uri(const char *artist, const char *title)
+{
+	char title_buf[strlen(title) * 3 + 1];
+	char artist_buf[strlen(artist) * 3 + 1];
+	str_encode_percent(title, -1, title_buf);
+	str_encode_percent(artist, -1, artist_buf);
+
+	return str_printf("http://lyrics.wikia.com/api.php?action=lyrics&"
+	 "artist=%s&song=%s&fmt=xml", artist_buf, title_buf);
 }
 
 static void get_lyrics_step_1(void)
@@ -272,17 +435,46 @@ static void get_lyrics_step_1(void)
 		return;
 	}
 
-	char title_buf[strlen(state.title) * 3 + 1];
-	char artist_buf[strlen(state.artist) * 3 + 1];
-	str_encode_percent(state.title, -1, title_buf);
-	str_encode_percent(state.artist, -1, artist_buf);
+	char *lyrics = NULL;
+
+	switch (cache_lookup(state.artist, state.title, &lyrics))
+	{
+	case CACHE_FOUND:
+		show_lyrics(state.title, state.artist, lyrics);
+		g_free(lyrics);
+		return;
+	case CACHE_NO_LYRICS:
+		show_lyrics(state.title, state.artist, NULL);
+		return;
+	}
 
 	str_unref(state.uri);
-	state.uri = str_printf("http://lyrics.wikia.com/api.php?action=lyrics&"
-	 "artist=%s&song=%s&fmt=xml", artist_buf, title_buf);
+	state.uri = search_uri(state.artist, state.title);
 
 	update_lyrics_window(state.title, state.artist, _("Connecting to lyrics.wikia.com ..."));
-	vfs_async_file_get_contents(state.uri, get_lyrics_step_2, str_ref(state.uri));
+	vfs_async_file_get_contents(state.uri, get_lyrics_step_2,
+	 request_new(state.title, state.artist, state.uri, FALSE));
+}
+
+/* looks up the song after the current one so its lyrics are ready in time */
+static void prefetch_next(int playlist, int pos)
+{
+	if (prefetch_uri || pos < 0 || pos + 1 >= aud_playlist_entry_count(playlist))
+		return;
+
+	char *title = NULL, *artist = NULL, *lyrics = NULL;
+	aud_playlist_entry_describe(playlist, pos + 1, &title, &artist, NULL, TRUE);
+
+	if (title && artist && cache_lookup(artist, title, &lyrics) == CACHE_MISS)
+	{
+		prefetch_uri = search_uri(artist, title);
+		vfs_async_file_get_contents(prefetch_uri, get_lyrics_step_2,
+		 request_new(title, artist, prefetch_uri, TRUE));
+	}
+
+	g_free(lyrics);
+	str_unref(title);
+	str_unref(artist);
 }
 
 static GtkWidget *scrollview, *vbox;
@@ -367,6 +559,7 @@ static void lyricwiki_playback_began(void)
 	state.uri = NULL;
 
 	get_lyrics_step_1();
+	prefetch_next(playlist, pos);
 }
 
 static gboolean init (void)
@@ -21,24 +21,16 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <glib.h>
+
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
 #include <audacious/playlist.h>
 #include <audacious/plugin.h>
 #include <libaudcore/audstrings.h>
 
-static void strip_char (char * text, char c)
-{
-    char * set = text;
-    char a;
-
-    while ((a = * text ++))
-        if (a != c)
-            * set ++ = a;
-
-    * set = 0;
-}
-
+/* Reads the whole file.  Text that is already valid UTF-8 (as M3U8 files
+ * always are) is parsed in place; anything else is converted once. */
 static char * read_win_text (VFSFile * file)
 {
     int64_t size = vfs_fsize (file);
@@ -49,7 +41,9 @@ static char * read_win_text (VFSFile * file)
     size = vfs_fread (raw, 1, size, file);
     raw[size] = 0;
 
-    strip_char (raw, '\r');
+    if (g_utf8_validate (raw, size, NULL))
+        return raw;
+
     char * text = str_to_utf8 (raw);
     free (raw);
     return text;
@@ -61,10 +55,80 @@ static char * split_line (char * line)
     if (! feed)
         return NULL;
 
+    if (feed > line && feed[-1] == '\r')
+        feed[-1] = 0;
+
     * feed = 0;
     return feed + 1;
 }
 
+/* #EXTINF:<seconds>,<title> */
+static Tuple * parse_extinf (const char * info, const char * uri)
+{
+    char * end;
+    long seconds = strtol (info, & end, 10);
+
+    /* skip attributes some writers put between the length and the comma */
+    const char * comma = strchr (end, ',');
+    if (! comma)
+        return NULL;
+
+    Tuple * tuple = tuple_new_from_filename (uri);
+
+    if (seconds > 0)
+        tuple_set_int (tuple, FIELD_LENGTH, NULL, seconds * 1000);
+
+    while (* ++ comma == ' ')
+        ;
+
+    if (* comma)
+        tuple_set_str (tuple, FIELD_TITLE, NULL, comma);
+
+    return tuple;
+}
+
+/* Longest URI built on the stack; longer ones (from a malformed playlist, as
+ * a rule) go to the heap instead of overflowing the stack. */
+#define MAX_STACK_URI 4096
+
+/* Same rules as aud_construct_uri(), but built on the stack so that the only
+ * allocation, for any sensible line, is the pooled string that goes into the
+ * playlist. */
+static char * make_uri (const char * name, const char * path, int baselen)
+{
+    if (strstr (name, "://"))
+        return str_get (name);
+
+    if (name[0] != '/' && ! baselen)
+        return NULL;
+
+    size_t len = strlen (name);
+    size_t size = MAX (baselen, 7) + 3 * len + 1;
+    char stack_buf[size <= MAX_STACK_URI ? size : 1];
+    char * buf = (size <= MAX_STACK_URI) ? stack_buf : malloc (size);
+
+    if (! buf)
+        return NULL;
+
+    if (name[0] == '/')
+    {
+        memcpy (buf, "file://", 7);
+        str_encode_percent (name, len, buf + 7);
+    }
+    else
+    {
+        memcpy (buf, path, baselen);
+        str_encode_percent (name, len, buf + baselen);
+    }
+
+    char * uri = str_get (buf);
+
+    if (buf != stack_buf)
+        free (buf);
+
+    return uri;
+}
+
 static bool_t playlist_load_m3u (const char * path, VFSFile * file,
  char * * title, Index * filenames, Index * tuples)
 {
@@ -74,6 +138,11 @@ static bool_t playlist_load_m3u (const char * path, VFSFile * file,
 
     * title = NULL;
 
+    /* relative names are resolved against this prefix of the playlist URI */
+    const char * slash = strrchr (path, '/');
+    int baselen = slash ? slash + 1 - path : 0;
+    const char * extinf = NULL;
+
     char * parse = text;
 
     while (parse)
@@ -87,13 +156,22 @@ static bool_t playlist_load_m3u (const char * path, VFSFile * file,
             goto NEXT;
 
         if (* parse == '#')
+        {
+            if (! strncmp (parse, "#EXTINF:", 8))
+                extinf = parse + 8;
+
             goto NEXT;
+        }
+
+        char * uri = make_uri (parse, path, baselen);
 
-        char * s = aud_construct_uri (parse, path);
-        if (s)
-            index_append (filenames, str_get (s));
+        if (uri)
+        {
+            index_append (filenames, uri);
+            index_append (tuples, extinf ? parse_extinf (extinf, uri) : NULL);
+        }
 
-        free (s);
+        extinf = NULL;
 
 NEXT:
         parse = next;
@@ -32,6 +32,7 @@
 #define BUF_SAMPLES     512
 #define BUF_BYTES       (BUF_SAMPLES * 2)
 #define MAX_AMPL        0x7fff
+#define CLICK_MAX       256     /* well short of a beat at MAX_BPM */
 
 typedef struct
 {
@@ -41,6 +42,12 @@ typedef struct
     int id;
 } metronom_t;
 
+typedef struct
+{
+    int16_t data[CLICK_MAX];
+    int length;
+} click_t;
+
 int tact_id[TACT_ID_MAX][2] = {
     {1, 1},
     {2, 2},
@@ -131,17 +138,61 @@ static bool_t metronom_get_cp(const char *filename, metronom_t *pmetronom, char
     return TRUE;
 }
 
+/* Renders one click of the given amplitude, starting from silence and ending
+ * when it has died away. */
+static void metronom_render_click(click_t *click, int ampl)
+{
+    int t, datagoal = 0;
+    int datamiddle = 0;
+    int datacurrent = datamiddle;
+    int datalast = datamiddle;
+
+    for (t = 0; t < CLICK_MAX; t++)
+    {
+        if (t == 0)
+            datagoal = ampl;
+        else if (t == 10)
+            datagoal = -ampl;
+        else if (t == 25)
+            datagoal = ampl;
+
+        /* makes curve a little bit smoother  */
+        click->data[t] = (datalast + datacurrent + datagoal) / 3;
+        datalast = datacurrent;
+        datacurrent = click->data[t];
+        if (t > 35)
+        {
+            datagoal = (datamiddle + 7 * datagoal) / 8;
+            if (!datagoal && !datacurrent && !datalast)
+                break;
+        }
+    }
+
+    click->length = t;
+}
+
+/* Mixes the click into the block from the given point on, starting at the
+ * given offset into the click; returns the offset reached. */
+static int metronom_mix_click(int16_t *data, int at, const click_t *click, int offset)
+{
+    int i, count = MIN(click->length - offset, BUF_SAMPLES - at);
+
+    for (i = 0; i < count; i++)
+        data[at + i] = CLAMP(data[at + i] + click->data[offset + i], -32768, 32767);
+
+    return offset + count;
+}
+
 static bool_t metronom_play(InputPlayback *playback, const char *filename,
     VFSFile *file, int start_time, int stop_time, bool_t pause)
 {
     metronom_t pmetronom;
     int16_t data[BUF_SAMPLES];
-    int t = 0, tact, num;
-    int datagoal = 0;
-    int datamiddle = 0;
-    int datacurrent = datamiddle;
-    int datalast = datamiddle;
-    int data_form[TACT_FORM_MAX];
+    int num;
+    click_t clicks[TACT_FORM_MAX];
+    const click_t *playing = NULL;
+    int played = 0;
+    int64_t pos = 0, beats = 0, next_beat = 0;
     bool_t error = FALSE;
 
     if (playback->output->open_audio(FMT_S16_NE, AUDIO_FREQ, 1) == 0)
@@ -161,50 +212,47 @@ static bool_t metronom_play(InputPlayback *playback, const char *filename,
 
     playback->set_params(playback, sizeof(data[0]) * 8 * AUDIO_FREQ, AUDIO_FREQ, 1);
 
-    tact = 60 * AUDIO_FREQ / pmetronom.bpm;
-
-    /* prepare weighted amplitudes */
+    /* prepare a click for each beat of the tact, with weighted amplitudes */
     for (num = 0; num < pmetronom.num; num++)
-    {
-        data_form[num] = MAX_AMPL * tact_form[pmetronom.id][num];
-    }
+        metronom_render_click(&clicks[num], MAX_AMPL * tact_form[pmetronom.id][num]);
 
     stop_flag = FALSE;
     playback->set_pb_ready(playback);
 
+    /* Beats are placed at the nearest sample to where they fall, counting
+     * from the start, so the tempo does not drift however long it plays.  A
+     * click never lasts as long as a beat, so at most one is playing at a
+     * time; one that runs past the end of a block is finished in the next. */
     num = 0;
     while (!stop_flag)
     {
-        int i;
+        memset(data, 0, sizeof(data));
 
-        for (i = 0; i < BUF_SAMPLES; i++)
+        if (playing)
         {
-            if (t == tact)
-            {
-                t = 0;
-                datagoal = data_form[num];
-            }
-            else if (t == 10)
-            {
-                datagoal = -data_form[num];
-            }
-            else if (t == 25)
-            {
-                datagoal = data_form[num];
-                /* circle through weighted amplitudes */
-                num++;
-                if (num >= pmetronom.num)
-                    num = 0;
-            }
-            /* makes curve a little bit smoother  */
-            data[i] = (datalast + datacurrent + datagoal) / 3;
-            datalast = datacurrent;
-            datacurrent = data[i];
-            if (t > 35)
-                datagoal = (datamiddle + 7 * datagoal) / 8;
-            t++;
+            played = metronom_mix_click(data, 0, playing, played);
+            if (played == playing->length)
+                playing = NULL;
         }
 
+        while (next_beat < pos + BUF_SAMPLES)
+        {
+            playing = &clicks[num];
+            played = metronom_mix_click(data, next_beat - pos, playing, 0);
+            if (played == playing->length)
+                playing = NULL;
+
+            /* circle through weighted amplitudes */
+            num++;
+            if (num >= pmetronom.num)
+                num = 0;
+
+            beats++;
+            next_beat = (beats * 60 * AUDIO_FREQ + pmetronom.bpm / 2) / pmetronom.bpm;
+        }
+
+        pos += BUF_SAMPLES;
+
         if (!stop_flag)
             playback->output->write_audio(data, BUF_BYTES);
     }
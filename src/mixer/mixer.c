@@ -17,136 +17,326 @@
  * the use of this software.
  */
 
-/* TODO: implement more surround converters */
+/* Every conversion is a matrix of gains, one row per output channel and one
+ * column per input channel.  Built-in matrices cover the usual downmixes; any
+ * of them can be replaced (or a missing one added) with a config key
+ * "matrix_<in>_<out>" in the "mixer" section holding the rows separated by
+ * semicolons, e.g. "matrix_6_2" = "1 0 0.7 0 0.7 0; 0 1 0.7 0 0 0.7".
+ *
+ * The common layouts have kernels with the channel counts fixed at compile
+ * time, so that the inner loops unroll completely; downmixes to stereo from
+ * 5.1 and 7.1 have SSE versions.  When there are no more output channels than
+ * input channels, the output is written over the input. */
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
 
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
+#include <libaudcore/audstrings.h>
+
+#include "../perfstat/perfstat.h"
 
 #define MAX_CHANNELS 8
 
-typedef void (* Converter) (float * * data, int * samples);
+typedef void (* Kernel) (const float * get, float * set, int frames);
+
+typedef struct {
+    int in, out;
+    float gains[MAX_CHANNELS * MAX_CHANNELS];
+} Layout;
+
+/* channel order: front left/right, center, LFE, rear left/right, side left/right */
+static const Layout builtin_layouts[] = {
+ {1, 2, {1,
+         1}},
+ {2, 1, {0.5, 0.5}},
+ {4, 2, {1, 0, 0.7, 0,
+         0, 1, 0, 0.7}},
+ {6, 2, {1, 0, 0.5, 0.5, 0.5, 0,
+         0, 1, 0.5, 0.5, 0, 0.5}},
+ {8, 2, {1, 0, 0.5, 0.5, 0.5, 0, 0.5, 0,
+         0, 1, 0.5, 0.5, 0, 0.5, 0, 0.5}},
+ {8, 6, {1, 0, 0, 0, 0, 0, 0, 0,
+         0, 1, 0, 0, 0, 0, 0, 0,
+         0, 0, 1, 0, 0, 0, 0, 0,
+         0, 0, 0, 1, 0, 0, 0, 0,
+         0, 0, 0, 0, 1, 0, 0.7, 0,
+         0, 0, 0, 0, 0, 1, 0, 0.7}}};
+
+static int input_channels, output_channels;
+static float matrix[MAX_CHANNELS][MAX_CHANNELS]; /* [out][in] */
+static Kernel kernel;
 
 static float * mixer_buf;
+static int mixer_buf_size;
 
-static void mono_to_stereo (float * * data, int * samples)
+static void mix_any (const float * get, float * set, int frames)
 {
-    int frames = * samples;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * 2 * frames);
-
-    * data = mixer_buf;
-    * samples = 2 * frames;
+    int in_ch = input_channels, out_ch = output_channels;
 
     while (frames --)
     {
-        float val = * get ++;
-        * set ++ = val;
-        * set ++ = val;
+        float in[MAX_CHANNELS];
+        memcpy (in, get, sizeof (float) * in_ch);
+
+        for (int o = 0; o < out_ch; o ++)
+        {
+            float sum = 0;
+            for (int i = 0; i < in_ch; i ++)
+                sum += matrix[o][i] * in[i];
+
+            set[o] = sum;
+        }
+
+        get += in_ch;
+        set += out_ch;
     }
 }
 
-static void stereo_to_mono (float * * data, int * samples)
-{
-    int frames = * samples / 2;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * frames);
+/* The gains are copied to a local array so that the compiler knows that
+ * writing the output cannot change them. */
+#define DEFINE_KERNEL(IN, OUT) \
+static void mix_##IN##_##OUT (const float * get, float * set, int frames) \
+{ \
+    float m[OUT][IN]; \
+    for (int o = 0; o < OUT; o ++) \
+    { \
+        for (int i = 0; i < IN; i ++) \
+            m[o][i] = matrix[o][i]; \
+    } \
+ \
+    while (frames --) \
+    { \
+        float in[IN], out[OUT]; \
+        for (int i = 0; i < IN; i ++) \
+            in[i] = get[i]; \
+ \
+        for (int o = 0; o < OUT; o ++) \
+        { \
+            out[o] = 0; \
+            for (int i = 0; i < IN; i ++) \
+                out[o] += m[o][i] * in[i]; \
+        } \
+ \
+        for (int o = 0; o < OUT; o ++) \
+            set[o] = out[o]; \
+ \
+        get += IN; \
+        set += OUT; \
+    } \
+}
 
-    * data = mixer_buf;
-    * samples = frames;
+DEFINE_KERNEL (1, 2)
+DEFINE_KERNEL (2, 1)
+DEFINE_KERNEL (4, 2)
+DEFINE_KERNEL (6, 2)
+DEFINE_KERNEL (8, 2)
+DEFINE_KERNEL (8, 6)
 
-    while (frames --)
-    {
-        float val = * get ++;
-        val += * get ++;
-        * set ++ = val / 2;
-    }
+#ifdef __SSE__
+
+/* Sums each of four vectors across its lanes: (sum a, sum b, sum c, sum d). */
+static inline __m128 sum_across (__m128 a, __m128 b, __m128 c, __m128 d)
+{
+    __m128 ab = _mm_add_ps (_mm_unpacklo_ps (a, b), _mm_unpackhi_ps (a, b));
+    __m128 cd = _mm_add_ps (_mm_unpacklo_ps (c, d), _mm_unpackhi_ps (c, d));
+    return _mm_add_ps (_mm_movelh_ps (ab, cd), _mm_movehl_ps (cd, ab));
 }
 
-static void quadro_to_stereo (float * * data, int * samples)
+/* Two frames per step: each output sample is the dot product of an input frame
+ * (as two vectors, zero-padded past IN) with a row of gains. */
+#define DEFINE_STEREO_KERNEL_SSE(IN) \
+static void mix_##IN##_2_sse (const float * get, float * set, int frames) \
+{ \
+    float pad[2][8] = {{0}}; \
+    for (int o = 0; o < 2; o ++) \
+        memcpy (pad[o], matrix[o], sizeof (float) * IN); \
+ \
+    __m128 l0 = _mm_loadu_ps (pad[0]), l1 = _mm_loadu_ps (pad[0] + 4); \
+    __m128 r0 = _mm_loadu_ps (pad[1]), r1 = _mm_loadu_ps (pad[1] + 4); \
+ \
+    for (; frames >= 2; frames -= 2) \
+    { \
+        __m128 a0 = _mm_loadu_ps (get), a1 = LOAD_HIGH (get + 4); \
+        __m128 b0 = _mm_loadu_ps (get + IN), b1 = LOAD_HIGH (get + IN + 4); \
+ \
+        __m128 la = _mm_add_ps (_mm_mul_ps (a0, l0), _mm_mul_ps (a1, l1)); \
+        __m128 ra = _mm_add_ps (_mm_mul_ps (a0, r0), _mm_mul_ps (a1, r1)); \
+        __m128 lb = _mm_add_ps (_mm_mul_ps (b0, l0), _mm_mul_ps (b1, l1)); \
+        __m128 rb = _mm_add_ps (_mm_mul_ps (b0, r0), _mm_mul_ps (b1, r1)); \
+ \
+        _mm_storeu_ps (set, sum_across (la, ra, lb, rb)); \
+ \
+        get += 2 * IN; \
+        set += 4; \
+    } \
+ \
+    if (frames) \
+        mix_##IN##_2 (get, set, frames); \
+}
+
+#define LOAD_HIGH(p) _mm_loadl_pi (_mm_setzero_ps (), (const __m64 *) (p))
+DEFINE_STEREO_KERNEL_SSE (6)
+#undef LOAD_HIGH
+
+#define LOAD_HIGH(p) _mm_loadu_ps (p)
+DEFINE_STEREO_KERNEL_SSE (8)
+#undef LOAD_HIGH
+
+#endif /* __SSE__ */
+
+static const struct {
+    int in, out;
+    Kernel kernel;
+} kernels[] = {
+#ifdef __SSE__
+ {6, 2, mix_6_2_sse},
+ {8, 2, mix_8_2_sse},
+#endif
+ {1, 2, mix_1_2},
+ {2, 1, mix_2_1},
+ {4, 2, mix_4_2},
+ {6, 2, mix_6_2},
+ {8, 2, mix_8_2},
+ {8, 6, mix_8_6}};
+
+/* Reads "matrix_<in>_<out>" from the config into the matrix. */
+static bool_t load_custom_matrix (int in_ch, int out_ch)
 {
-    int frames = * samples / 4;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * 2 * frames);
+    SPRINTF (key, "matrix_%d_%d", in_ch, out_ch);
+    char * str = aud_get_string ("mixer", key);
 
-    * data = mixer_buf;
-    * samples = 2 * frames;
+    if (! str || ! str[0])
+    {
+        g_free (str);
+        return FALSE;
+    }
 
-    while (frames --)
+    float gains[MAX_CHANNELS][MAX_CHANNELS];
+    char * get = str;
+    bool_t valid = TRUE;
+
+    for (int o = 0; o < out_ch && valid; o ++)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float back_left   = * get ++;
-        float back_right  = * get ++;
-        * set ++ = front_left + (back_left * 0.7);
-        * set ++ = front_right + (back_right * 0.7);
+        for (int i = 0; i < in_ch && valid; i ++)
+        {
+            char * end;
+            gains[o][i] = strtof (get, & end);
+
+            if (end == get)
+                valid = FALSE;
+
+            get = end + strspn (end, " ,\t");
+        }
+
+        if (o < out_ch - 1)
+        {
+            if (* get == ';')
+                get ++;
+            else
+                valid = FALSE;
+        }
     }
+
+    if (valid && get[strspn (get, " ;\t")])
+        valid = FALSE;
+
+    if (valid)
+        memcpy (matrix, gains, sizeof matrix);
+    else
+        fprintf (stderr, "mixer: %s should be %d rows of %d gains.\n", key,
+         out_ch, in_ch);
+
+    g_free (str);
+    return valid;
 }
 
-static void surround_5p1_to_stereo (float * * data, int * samples)
+static bool_t load_builtin_matrix (int in_ch, int out_ch)
 {
-    int frames = * samples / 6;
-    float * get = * data;
-    float * set = mixer_buf = realloc (mixer_buf, sizeof (float) * 2 * frames);
+    for (int l = 0; l < G_N_ELEMENTS (builtin_layouts); l ++)
+    {
+        const Layout * layout = & builtin_layouts[l];
+        if (layout->in != in_ch || layout->out != out_ch)
+            continue;
 
-    * data = mixer_buf;
-    * samples = 2 * frames;
+        for (int o = 0; o < out_ch; o ++)
+        {
+            for (int i = 0; i < in_ch; i ++)
+                matrix[o][i] = layout->gains[in_ch * o + i];
+        }
 
-    while (frames --)
-    {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float center = * get ++;
-        float lfe    = * get ++;
-        float rear_left   = * get ++;
-        float rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + (lfe * 0.5) + (rear_left * 0.5);
-        * set ++ = front_right + (center * 0.5) + (lfe * 0.5) + (rear_right * 0.5);
+        return TRUE;
     }
-}
-
-static const Converter converters[MAX_CHANNELS + 1][MAX_CHANNELS + 1] = {
- [1][2] = mono_to_stereo,
- [2][1] = stereo_to_mono,
- [4][2] = quadro_to_stereo,
- [6][2] = surround_5p1_to_stereo};
 
-static int input_channels, output_channels;
+    return FALSE;
+}
 
 void mixer_start (int * channels, int * rate)
 {
     input_channels = * channels;
     output_channels = aud_get_int ("mixer", "channels");
     output_channels = CLAMP (output_channels, 1, MAX_CHANNELS);
+    kernel = NULL;
 
     if (input_channels == output_channels)
         return;
 
     if (input_channels < 1 || input_channels > MAX_CHANNELS ||
-     ! converters[input_channels][output_channels])
+     ! (load_custom_matrix (input_channels, output_channels) ||
+     load_builtin_matrix (input_channels, output_channels)))
     {
         fprintf (stderr, "Converting %d to %d channels is not implemented.\n",
          input_channels, output_channels);
         return;
     }
 
+    kernel = mix_any;
+
+    for (int k = 0; k < G_N_ELEMENTS (kernels); k ++)
+    {
+        if (kernels[k].in == input_channels && kernels[k].out == output_channels)
+        {
+            kernel = kernels[k].kernel;
+            break;
+        }
+    }
+
     * channels = output_channels;
 }
 
 void mixer_process (float * * data, int * samples)
 {
-    if (input_channels == output_channels)
+    if (! kernel)
         return;
 
-    if (input_channels < 1 || input_channels > MAX_CHANNELS ||
-     ! converters[input_channels][output_channels])
-        return;
+    int frames = * samples / input_channels;
+    float * set = * data;
 
-    converters[input_channels][output_channels] (data, samples);
+    if (output_channels > input_channels)
+    {
+        if (mixer_buf_size < output_channels * frames)
+        {
+            mixer_buf_size = output_channels * frames;
+            mixer_buf = realloc (mixer_buf, sizeof (float) * mixer_buf_size);
+        }
+
+        set = mixer_buf;
+    }
+
+    kernel (* data, set, frames);
+
+    * data = set;
+    * samples = output_channels * frames;
 }
 
 static const char * const mixer_defaults[] = {
@@ -163,6 +353,7 @@ static void mixer_cleanup (void)
 {
     free (mixer_buf);
     mixer_buf = 0;
+    mixer_buf_size = 0;
 }
 
 static const char mixer_about[] =
@@ -179,6 +370,8 @@ static const PluginPreferences mixer_prefs = {
  .widgets = mixer_widgets,
  .n_widgets = sizeof mixer_widgets / sizeof mixer_widgets[0]};
 
+PERFSTAT_EFFECT (N_("Channel Mixer"), mixer_start, mixer_process, mixer_process)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Channel Mixer"),
@@ -187,8 +380,8 @@ AUD_EFFECT_PLUGIN
     .prefs = & mixer_prefs,
     .init = mixer_init,
     .cleanup = mixer_cleanup,
-    .start = mixer_start,
-    .process = mixer_process,
-    .finish = mixer_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
+    .finish = perfstat_finish,
     .order = 2, /* must be before crossfade */
 )
@@ -17,43 +17,306 @@
  * the use of this software.
  */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <libmms/mms.h>
 #include <libmms/mmsh.h>
 
 #include <audacious/debug.h>
 #include <audacious/i18n.h>
+#include <audacious/misc.h>
 #include <audacious/plugin.h>
+#include <audacious/preferences.h>
 
+#define ARRAY_LEN(x) (sizeof (x) / sizeof (x)[0])
+
+#define LOAD(p) __atomic_load_n ((p), __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n ((p), (v), __ATOMIC_SEQ_CST)
+
+/* libmms returns only once a read is filled completely, so the reader thread
+ * asks for small pieces to keep the buffer moving on slow streams. */
+#define READ_CHUNK 4096
+
+#define MAX_BUFFER_KB 8192
+
+static const char * const mms_defaults[] = {
+ "buffer_size", "256",      /* KiB */
+ "prebuffer", "64",         /* KiB */
+ "reconnect", "3",          /* attempts, 0 disables */
+ NULL};
+
+/*
+ * Data is read from the network by a separate thread into a ring buffer and
+ * taken out by fread(), so that network jitter is absorbed by the buffer
+ * instead of stalling the decoder.  head and tail count the bytes written
+ * and read, modulo 2^32; only the reader thread stores head and only fread()
+ * stores tail, so the buffer needs no lock.  The mutex and condition only
+ * serve to put one side to sleep when the buffer is full or empty, and each
+ * side raises its *_waiting flag while it sleeps, so that the other side
+ * takes the mutex only when there is someone to wake.
+ *
+ * While the reader thread runs, it alone touches the connection; seeking
+ * stops it first.
+ */
 typedef struct
 {
+    char * path;
     mms_t * mms;
     mmsh_t * mmsh;
+    int64_t length;
+
+    char * buf;
+    unsigned size, mask;
+    unsigned head, tail;
+    int64_t pos;                /* stream position of tail */
+    int64_t read_pos;           /* stream position of head */
+    unsigned prebuffer;
+    bool_t prebuffering;
+    int reconnect;
+
+    pthread_t reader;
+    bool_t running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool_t quit, eof;
+    bool_t reader_waiting, consumer_waiting;
 }
 MMSHandle;
 
+static bool_t mms_init (void)
+{
+    aud_config_set_defaults ("mms", mms_defaults);
+    return TRUE;
+}
+
+static bool_t mms_connect_any (MMSHandle * h)
+{
+    if ((h->mmsh = mmsh_connect (NULL, NULL, h->path, 128 * 1024)))
+    {
+        h->length = mmsh_get_length (h->mmsh);
+        return TRUE;
+    }
+
+    AUDDBG ("Failed to connect with MMSH protocol; trying MMS.\n");
+
+    if ((h->mms = mms_connect (NULL, NULL, h->path, 128 * 1024)))
+    {
+        h->length = mms_get_length (h->mms);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void mms_disconnect (MMSHandle * h)
+{
+    if (h->mms)
+        mms_close (h->mms);
+    if (h->mmsh)
+        mmsh_close (h->mmsh);
+
+    h->mms = NULL;
+    h->mmsh = NULL;
+}
+
+static int64_t mms_seek_raw (MMSHandle * h, int64_t offset)
+{
+    if (h->mms)
+        return mms_seek (NULL, h->mms, offset, SEEK_SET);
+    else if (h->mmsh)
+        return mmsh_seek (NULL, h->mmsh, offset, SEEK_SET);
+    else
+        return -1;
+}
+
+static int64_t mms_tell_raw (MMSHandle * h)
+{
+    if (h->mms)
+        return mms_get_current_pos (h->mms);
+    else if (h->mmsh)
+        return mmsh_get_current_pos (h->mmsh);
+    else
+        return 0;
+}
+
+/* sleeps unless told to quit */
+static void reader_sleep (MMSHandle * h, int seconds)
+{
+    struct timespec until;
+    clock_gettime (CLOCK_REALTIME, & until);
+    until.tv_sec += seconds;
+
+    pthread_mutex_lock (& h->mutex);
+
+    while (! LOAD (& h->quit) && pthread_cond_timedwait (& h->cond, & h->mutex,
+     & until) != ETIMEDOUT)
+        ;
+
+    pthread_mutex_unlock (& h->mutex);
+}
+
+/* Connects again after a dropped connection and, if the stream has a length
+ * (i.e. it is not live), resumes where the last read ended. */
+static bool_t mms_reconnect (MMSHandle * h)
+{
+    for (int attempt = 0; attempt < h->reconnect && ! LOAD (& h->quit); attempt ++)
+    {
+        fprintf (stderr, "mms: Connection lost; reconnecting (%d/%d).\n",
+         attempt + 1, h->reconnect);
+
+        mms_disconnect (h);
+        reader_sleep (h, 1 << MIN (attempt, 3));
+
+        if (LOAD (& h->quit) || ! mms_connect_any (h))
+            continue;
+
+        if (h->length <= 0 || ! h->read_pos || mms_seek_raw (h, h->read_pos) == h->read_pos)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void wake (MMSHandle * h, bool_t * waiting)
+{
+    if (LOAD (waiting))
+    {
+        pthread_mutex_lock (& h->mutex);
+        pthread_cond_broadcast (& h->cond);
+        pthread_mutex_unlock (& h->mutex);
+    }
+}
+
+static void * reader_thread (void * data)
+{
+    MMSHandle * h = data;
+
+    while (! LOAD (& h->quit))
+    {
+        unsigned head = h->head;
+        unsigned space = h->size - (head - LOAD (& h->tail));
+        unsigned offset = head & h->mask;
+
+        if (! space)
+        {
+            pthread_mutex_lock (& h->mutex);
+            STORE (& h->reader_waiting, TRUE);
+
+            /* raise the flag first, then look at the buffer (see fread) */
+            while (! LOAD (& h->quit) && head - LOAD (& h->tail) == h->size)
+                pthread_cond_wait (& h->cond, & h->mutex);
+
+            STORE (& h->reader_waiting, FALSE);
+            pthread_mutex_unlock (& h->mutex);
+            continue;
+        }
+
+        if (space > h->size - offset)
+            space = h->size - offset;
+        if (space > READ_CHUNK)
+            space = READ_CHUNK;
+
+        int64_t readsize = -1;
+
+        if (h->mms)
+            readsize = mms_read (NULL, h->mms, h->buf + offset, space);
+        else if (h->mmsh)
+            readsize = mmsh_read (NULL, h->mmsh, h->buf + offset, space);
+
+        if (readsize > 0)
+        {
+            h->read_pos += readsize;
+            STORE (& h->head, head + readsize);
+            wake (h, & h->consumer_waiting);
+            continue;
+        }
+
+        /* a live stream never ends on its own, so running out means the
+         * connection dropped; so does a read error */
+        if (readsize < 0 || h->length <= 0 || h->read_pos < h->length)
+        {
+            if (readsize < 0)
+                fprintf (stderr, "mms: Read failed.\n");
+
+            if (mms_reconnect (h))
+                continue;
+        }
+
+        break;
+    }
+
+    STORE (& h->eof, TRUE);
+    wake (h, & h->consumer_waiting);
+    return NULL;
+}
+
+static void reader_start (MMSHandle * h)
+{
+    h->head = h->tail = 0;
+    h->read_pos = h->pos;
+    h->quit = FALSE;
+    h->eof = FALSE;
+    h->prebuffering = TRUE;
+
+    if (pthread_create (& h->reader, NULL, reader_thread, h))
+    {
+        fprintf (stderr, "mms: Failed to start reader thread.\n");
+        h->eof = TRUE;
+        return;
+    }
+
+    h->running = TRUE;
+}
+
+static void reader_stop (MMSHandle * h)
+{
+    if (! h->running)
+        return;
+
+    pthread_mutex_lock (& h->mutex);
+    STORE (& h->quit, TRUE);
+    pthread_cond_broadcast (& h->cond);
+    pthread_mutex_unlock (& h->mutex);
+
+    pthread_join (h->reader, NULL);
+    h->running = FALSE;
+}
+
 static void * mms_vfs_fopen_impl (const char * path, const char * mode)
 {
     AUDDBG ("Opening %s.\n", path);
 
     MMSHandle * h = malloc (sizeof (MMSHandle));
     memset (h, 0, sizeof (MMSHandle));
+    h->path = strdup (path);
 
-    if (! (h->mmsh = mmsh_connect (NULL, NULL, path, 128 * 1024)))
+    if (! mms_connect_any (h))
     {
-        AUDDBG ("Failed to connect with MMSH protocol; trying MMS.\n");
-
-        if (! (h->mms = mms_connect (NULL, NULL, path, 128 * 1024)))
-        {
-            fprintf (stderr, "mms: Failed to open %s.\n", path);
-            free (h);
-            return NULL;
-        }
+        fprintf (stderr, "mms: Failed to open %s.\n", path);
+        free (h->path);
+        free (h);
+        return NULL;
     }
 
+    int kb = aud_get_int ("mms", "buffer_size");
+    h->size = 1024;
+    while (h->size < 1024 * (unsigned) CLAMP (kb, 16, MAX_BUFFER_KB))
+        h->size <<= 1;
+
+    h->mask = h->size - 1;
+    h->buf = malloc (h->size);
+    h->prebuffer = MIN (1024 * (unsigned) MAX (aud_get_int ("mms", "prebuffer"), 0), h->size);
+    h->reconnect = MAX (aud_get_int ("mms", "reconnect"), 0);
+
+    pthread_mutex_init (& h->mutex, NULL);
+    pthread_cond_init (& h->cond, NULL);
+
+    reader_start (h);
     return h;
 }
 
@@ -61,11 +324,14 @@ static int mms_vfs_fclose_impl (VFSFile * file)
 {
     MMSHandle * h = (MMSHandle *) vfs_get_handle (file);
 
-    if (h->mms)
-        mms_close (h->mms);
-    else
-        mmsh_close (h->mmsh);
+    reader_stop (h);
+    mms_disconnect (h);
 
+    pthread_mutex_destroy (& h->mutex);
+    pthread_cond_destroy (& h->cond);
+
+    free (h->buf);
+    free (h->path);
     free (h);
     return 0;
 }
@@ -78,20 +344,43 @@ static int64_t mms_vfs_fread_impl (void * buf, int64_t size, int64_t count, VFSF
 
     while (bytes_read < bytes_total)
     {
-        int64_t readsize;
+        unsigned tail = h->tail;
+        unsigned used = LOAD (& h->head) - tail;
 
-        if (h->mms)
-            readsize = mms_read (NULL, h->mms, (char *) buf + bytes_read, bytes_total - bytes_read);
+        /* after opening or seeking, wait until the buffer has some margin */
+        if (h->prebuffering && used < h->prebuffer && ! LOAD (& h->eof))
+            used = 0;
         else
-            readsize = mmsh_read (NULL, h->mmsh, (char *) buf + bytes_read, bytes_total - bytes_read);
+            h->prebuffering = FALSE;
+
+        if (! used)
+        {
+            if (LOAD (& h->eof) && LOAD (& h->head) == tail)
+                break;
 
-        if (readsize < 0)
-            fprintf (stderr, "mms: Read failed.\n");
+            pthread_mutex_lock (& h->mutex);
+            STORE (& h->consumer_waiting, TRUE);
 
-        if (readsize <= 0)
-            break;
+            /* raise the flag first, then look at the buffer (see reader) */
+            while (! LOAD (& h->eof) && LOAD (& h->head) - tail <
+             (h->prebuffering ? h->prebuffer : 1))
+                pthread_cond_wait (& h->cond, & h->mutex);
 
-        bytes_read += readsize;
+            STORE (& h->consumer_waiting, FALSE);
+            pthread_mutex_unlock (& h->mutex);
+            continue;
+        }
+
+        unsigned offset = tail & h->mask;
+        unsigned copy = MIN (used, h->size - offset);
+        copy = MIN (copy, bytes_total - bytes_read);
+
+        memcpy ((char *) buf + bytes_read, h->buf + offset, copy);
+        STORE (& h->tail, tail + copy);
+        h->pos += copy;
+        bytes_read += copy;
+
+        wake (h, & h->reader_waiting);
     }
 
     return size ? bytes_read / size : 0;
@@ -108,54 +397,46 @@ static int mms_vfs_fseek_impl (VFSFile * file, int64_t offset, int whence)
     MMSHandle * h = vfs_get_handle (file);
 
     if (whence == SEEK_CUR)
-    {
-        if (h->mms)
-            offset += mms_get_current_pos (h->mms);
-        else
-            offset += mmsh_get_current_pos (h->mmsh);
-    }
+        offset += h->pos;
     else if (whence == SEEK_END)
+        offset += h->length;
+
+    /* short forward seeks are served from the buffer */
+    if (offset >= h->pos && offset - h->pos <= LOAD (& h->head) - h->tail)
     {
-        if (h->mms)
-            offset += mms_get_length (h->mms);
-        else
-            offset += mmsh_get_length (h->mmsh);
+        STORE (& h->tail, h->tail + (unsigned) (offset - h->pos));
+        h->pos = offset;
+        wake (h, & h->reader_waiting);
+        return 0;
     }
 
-    int64_t ret;
+    reader_stop (h);
 
-    if (h->mms)
-        ret = mms_seek (NULL, h->mms, offset, SEEK_SET);
-    else
-        ret = mmsh_seek (NULL, h->mmsh, offset, SEEK_SET);
+    int64_t ret = mms_seek_raw (h, offset);
 
     if (ret < 0 || ret != offset)
     {
         fprintf (stderr, "mms: Seek failed.\n");
+        h->pos = mms_tell_raw (h);
+        reader_start (h);
         return -1;
     }
 
+    h->pos = offset;
+    reader_start (h);
     return 0;
 }
 
 static int64_t mms_vfs_ftell_impl (VFSFile * file)
 {
     MMSHandle * h = vfs_get_handle (file);
-
-    if (h->mms)
-        return mms_get_current_pos (h->mms);
-    else
-        return mmsh_get_current_pos (h->mmsh);
+    return h->pos;
 }
 
 static bool_t mms_vfs_feof_impl (VFSFile * file)
 {
     MMSHandle * h = vfs_get_handle (file);
-
-    if (h->mms)
-        return (mms_get_current_pos (h->mms) < mms_get_length (h->mms));
-    else
-        return (mmsh_get_current_pos (h->mmsh) < mmsh_get_length (h->mmsh));
+    return LOAD (& h->eof) && LOAD (& h->head) == h->tail;
 }
 
 static int mms_vfs_truncate_impl (VFSFile * file, int64_t size)
@@ -167,13 +448,26 @@ static int mms_vfs_truncate_impl (VFSFile * file, int64_t size)
 static int64_t mms_vfs_fsize_impl (VFSFile * file)
 {
     MMSHandle * h = vfs_get_handle (file);
-
-    if (h->mms)
-        return mms_get_length (h->mms);
-    else
-        return mmsh_get_length (h->mmsh);
+    return h->length;
 }
 
+static const PreferencesWidget mms_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Buffering</b>")},
+ {WIDGET_SPIN_BTN, N_("Buffer size:"),
+  .cfg_type = VALUE_INT, .csect = "mms", .cname = "buffer_size",
+  .data = {.spin_btn = {16, MAX_BUFFER_KB, 16, N_("KiB")}}},
+ {WIDGET_SPIN_BTN, N_("Fill before playing:"),
+  .cfg_type = VALUE_INT, .csect = "mms", .cname = "prebuffer",
+  .data = {.spin_btn = {0, MAX_BUFFER_KB, 16, N_("KiB")}}},
+ {WIDGET_SPIN_BTN, N_("Reconnect attempts:"),
+  .cfg_type = VALUE_INT, .csect = "mms", .cname = "reconnect",
+  .data = {.spin_btn = {0, 10, 1, NULL}}},
+ {WIDGET_LABEL, N_("Changes apply to streams opened afterwards.")}};
+
+static const PluginPreferences mms_prefs = {
+ .widgets = mms_widgets,
+ .n_widgets = ARRAY_LEN (mms_widgets)};
+
 static const char * const mms_schemes[] = {"mms", NULL};
 
 static VFSConstructor constructor =
@@ -193,6 +487,8 @@ AUD_TRANSPORT_PLUGIN
 (
     .name = N_("MMS Plugin"),
     .domain = PACKAGE,
+    .prefs = & mms_prefs,
     .schemes = mms_schemes,
+    .init = mms_init,
     .vtable = & constructor
 )
@@ -0,0 +1,101 @@
+/* Modplug XMMS Plugin
+ * Authors: Kenton Varda <temporal@gauge3d.org>
+ *
+ * This source code is public domain.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+#include "arch_gzip.h"
+
+using namespace std;
+
+#define CHUNK_SIZE 32768
+#define MAX_MODULE_SIZE (256 << 20)
+
+arch_Gzip::arch_Gzip(VFSFile* aFile)
+{
+    unsigned char lIn[CHUNK_SIZE];
+    unsigned char lTrailer[4];
+    unsigned char* lOut;
+    uint32_t lAlloc = 0, lSize = 0;
+    int64_t lFileSize;
+    z_stream lStream;
+    int lResult = Z_OK;
+
+    //the trailer holds the uncompressed size, so the buffer can be
+    //allocated once and inflated into directly
+    lFileSize = vfs_fsize(aFile);
+    if (lFileSize >= 18 && ! vfs_fseek(aFile, lFileSize - 4, SEEK_SET)
+     && vfs_fread(lTrailer, 1, 4, aFile) == 4)
+        lAlloc = lTrailer[0] | lTrailer[1] << 8 | lTrailer[2] << 16
+         | (uint32_t)lTrailer[3] << 24;
+    if (lAlloc == 0 || lAlloc > MAX_MODULE_SIZE)
+        lAlloc = 1 << 20;
+
+    if (vfs_fseek(aFile, 0, SEEK_SET))
+        return;
+
+    memset(&lStream, 0, sizeof lStream);
+    if (inflateInit2(&lStream, 16 + MAX_WBITS) != Z_OK)
+        return;
+
+    lOut = (unsigned char*)malloc(lAlloc);
+
+    while (lOut && lResult != Z_STREAM_END)
+    {
+        if (lStream.avail_in == 0)
+        {
+            int64_t lRead = vfs_fread(lIn, 1, CHUNK_SIZE, aFile);
+            if (lRead <= 0)
+                break;
+
+            lStream.next_in = lIn;
+            lStream.avail_in = lRead;
+        }
+
+        //only if the trailer was wrong (streamed or concatenated files)
+        if (lSize == lAlloc)
+        {
+            unsigned char* lGrown;
+
+            if (lAlloc >= MAX_MODULE_SIZE
+             || ! (lGrown = (unsigned char*)realloc(lOut, lAlloc * 2)))
+                break;
+
+            lOut = lGrown;
+            lAlloc *= 2;
+        }
+
+        lStream.next_out = lOut + lSize;
+        lStream.avail_out = lAlloc - lSize;
+        lResult = inflate(&lStream, Z_NO_FLUSH);
+        lSize = lAlloc - lStream.avail_out;
+
+        if (lResult != Z_OK && lResult != Z_STREAM_END)
+            break;
+    }
+
+    inflateEnd(&lStream);
+
+    if (lResult != Z_STREAM_END || lSize == 0)
+    {
+        free(lOut);
+        return;
+    }
+
+    mMap = lOut;
+    mSize = lSize;
+}
+
+arch_Gzip::~arch_Gzip()
+{
+    free(mMap);
+}
+
+bool arch_Gzip::IsOurMagic(const unsigned char* aMagic)
+{
+    return aMagic[0] == 0x1f && aMagic[1] == 0x8b && aMagic[2] == 8;
+}
@@ -0,0 +1,25 @@
+/* Modplug XMMS Plugin
+ * Authors: Kenton Varda <temporal@gauge3d.org>
+ *
+ * This source code is public domain.
+ */
+
+#ifndef __MODPLUG_ARCH_GZIP_H__INCLUDED__
+#define __MODPLUG_ARCH_GZIP_H__INCLUDED__
+
+#include "archive.h"
+
+extern "C" {
+#include <libaudcore/vfs.h>
+}
+
+class arch_Gzip: public Archive
+{
+public:
+    arch_Gzip(VFSFile* aFile);
+    virtual ~arch_Gzip();
+
+    static bool IsOurMagic(const unsigned char* aMagic);
+};
+
+#endif
@@ -0,0 +1,194 @@
+/* Modplug XMMS Plugin
+ * Authors: Kenton Varda <temporal@gauge3d.org>
+ *
+ * This source code is public domain.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+
+#include "arch_zip.h"
+
+using namespace std;
+
+#define CHUNK_SIZE 32768
+#define MAX_MODULE_SIZE (256 << 20)
+#define MAX_DIRECTORY_SIZE (1 << 20)
+
+#define EOCD_SIZE 22
+#define DIR_ENTRY_SIZE 46
+#define LOCAL_HEADER_SIZE 30
+
+static inline uint16_t Get16(const unsigned char* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline uint32_t Get32(const unsigned char* p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+arch_Zip::arch_Zip(VFSFile* aFile)
+{
+    unsigned char* lTail;
+    unsigned char* lDir;
+    const unsigned char* lBest = NULL;
+    bool lBestIsMod = false;
+    uint32_t lTailSize, lDirSize, lDirOffset, lPos;
+    int64_t lFileSize;
+    int lEntries, i;
+
+    //the end of central directory record is followed by a comment of at
+    //most 64k, so it is somewhere in the tail of the file
+    lFileSize = vfs_fsize(aFile);
+    if (lFileSize < EOCD_SIZE)
+        return;
+
+    lTailSize = lFileSize < EOCD_SIZE + 65535 ? lFileSize : EOCD_SIZE + 65535;
+    lTail = (unsigned char*)malloc(lTailSize);
+    if (vfs_fseek(aFile, lFileSize - lTailSize, SEEK_SET)
+     || vfs_fread(lTail, 1, lTailSize, aFile) < lTailSize)
+    {
+        free(lTail);
+        return;
+    }
+
+    for (i = lTailSize - EOCD_SIZE; i >= 0; i--)
+    {
+        if (! memcmp(lTail + i, "PK\5\6", 4))
+            break;
+    }
+
+    if (i < 0)
+    {
+        free(lTail);
+        return;
+    }
+
+    lEntries = Get16(lTail + i + 10);
+    lDirSize = Get32(lTail + i + 12);
+    lDirOffset = Get32(lTail + i + 16);
+    free(lTail);
+
+    if (lDirSize > MAX_DIRECTORY_SIZE || (int64_t)lDirOffset + lDirSize > lFileSize)
+        return;
+
+    //pick the entry to extract from the directory alone; only that one is
+    //ever decompressed
+    lDir = (unsigned char*)malloc(lDirSize);
+    if (vfs_fseek(aFile, lDirOffset, SEEK_SET)
+     || vfs_fread(lDir, 1, lDirSize, aFile) < lDirSize)
+    {
+        free(lDir);
+        return;
+    }
+
+    for (i = 0, lPos = 0; i < lEntries && lPos + DIR_ENTRY_SIZE <= lDirSize; i++)
+    {
+        const unsigned char* lEntry = lDir + lPos;
+        uint16_t lMethod = Get16(lEntry + 10);
+        uint32_t lUnpacked = Get32(lEntry + 24);
+        uint16_t lNameLen = Get16(lEntry + 28);
+        bool lIsMod;
+
+        if (memcmp(lEntry, "PK\1\2", 4)
+         || lPos + DIR_ENTRY_SIZE + lNameLen > lDirSize)
+            break;
+
+        lPos += DIR_ENTRY_SIZE + lNameLen + Get16(lEntry + 30) + Get16(lEntry + 32);
+
+        //skip encrypted entries and anything we cannot inflate
+        if ((Get16(lEntry + 8) & 1) || (lMethod != 0 && lMethod != 8)
+         || lUnpacked == 0 || lUnpacked > MAX_MODULE_SIZE)
+            continue;
+
+        //prefer a name that looks like a module, otherwise take the largest
+        lIsMod = IsOurFile(string((const char*)lEntry + DIR_ENTRY_SIZE, lNameLen));
+        if (! lBest || (lIsMod && ! lBestIsMod)
+         || (lIsMod == lBestIsMod && lUnpacked > Get32(lBest + 24)))
+        {
+            lBest = lEntry;
+            lBestIsMod = lIsMod;
+        }
+    }
+
+    if (lBest && ! Extract(aFile, lBest))
+    {
+        free(mMap);
+        mMap = 0;
+        mSize = 0;
+    }
+
+    free(lDir);
+}
+
+bool arch_Zip::Extract(VFSFile* aFile, const unsigned char* aEntry)
+{
+    unsigned char lIn[CHUNK_SIZE];
+    unsigned char lHeader[LOCAL_HEADER_SIZE];
+    uint16_t lMethod = Get16(aEntry + 10);
+    uint32_t lCrc = Get32(aEntry + 16);
+    uint32_t lPacked = Get32(aEntry + 20);
+    uint32_t lUnpacked = Get32(aEntry + 24);
+    uint32_t lOffset = Get32(aEntry + 42);
+    z_stream lStream;
+    int lResult = Z_OK;
+
+    if (vfs_fseek(aFile, lOffset, SEEK_SET)
+     || vfs_fread(lHeader, 1, LOCAL_HEADER_SIZE, aFile) < LOCAL_HEADER_SIZE
+     || memcmp(lHeader, "PK\3\4", 4)
+     || vfs_fseek(aFile, (int64_t)lOffset + LOCAL_HEADER_SIZE
+     + Get16(lHeader + 26) + Get16(lHeader + 28), SEEK_SET))
+        return false;
+
+    if (! (mMap = malloc(lUnpacked)))
+        return false;
+    mSize = lUnpacked;
+
+    if (lMethod == 0)
+    {
+        if (lPacked != lUnpacked
+         || vfs_fread(mMap, 1, lUnpacked, aFile) < lUnpacked)
+            return false;
+    }
+    else
+    {
+        memset(&lStream, 0, sizeof lStream);
+        if (inflateInit2(&lStream, -MAX_WBITS) != Z_OK)
+            return false;
+
+        lStream.next_out = (Bytef*)mMap;
+        lStream.avail_out = lUnpacked;
+
+        while (lResult == Z_OK && lPacked)
+        {
+            int64_t lRead = vfs_fread(lIn, 1, lPacked < CHUNK_SIZE ? lPacked : CHUNK_SIZE, aFile);
+            if (lRead <= 0)
+                break;
+
+            lPacked -= lRead;
+            lStream.next_in = lIn;
+            lStream.avail_in = lRead;
+            lResult = inflate(&lStream, Z_NO_FLUSH);
+        }
+
+        inflateEnd(&lStream);
+
+        if (lResult != Z_STREAM_END || lStream.avail_out)
+            return false;
+    }
+
+    return crc32(crc32(0, Z_NULL, 0), (const Bytef*)mMap, lUnpacked) == lCrc;
+}
+
+arch_Zip::~arch_Zip()
+{
+    free(mMap);
+}
+
+bool arch_Zip::IsOurMagic(const unsigned char* aMagic)
+{
+    return ! memcmp(aMagic, "PK\3\4", 4);
+}
@@ -0,0 +1,27 @@
+/* Modplug XMMS Plugin
+ * Authors: Kenton Varda <temporal@gauge3d.org>
+ *
+ * This source code is public domain.
+ */
+
+#ifndef __MODPLUG_ARCH_ZIP_H__INCLUDED__
+#define __MODPLUG_ARCH_ZIP_H__INCLUDED__
+
+#include "archive.h"
+
+extern "C" {
+#include <libaudcore/vfs.h>
+}
+
+class arch_Zip: public Archive
+{
+    bool Extract(VFSFile* aFile, const unsigned char* aEntry);
+
+public:
+    arch_Zip(VFSFile* aFile);
+    virtual ~arch_Zip();
+
+    static bool IsOurMagic(const unsigned char* aMagic);
+};
+
+#endif
@@ -20,6 +20,7 @@ protected:
     static bool IsOurFile(const std::string& aFileName);
 
 public:
+    Archive() : mSize(0), mMap(0) {}
     virtual ~Archive();
 
     inline uint32_t Size() {return mSize;}
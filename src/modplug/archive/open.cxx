@@ -4,12 +4,196 @@
  * This source code is public domain.
  */
 
+#include <pthread.h>
+#include <cctype>
+#include <cstring>
+
 #include "open.h"
 #include "arch_raw.h"
+#include "arch_gzip.h"
+#include "arch_zip.h"
 
 using namespace std;
 
+// Extracted module cache =====================================
+
+// The probe, the tuple scan and playback each open the file in turn, so the
+// last few extracted modules are kept and shared instead of being inflated
+// again every time.
+
+#define CACHE_ENTRIES 4
+
+struct CachedModule
+{
+    string mFileName;
+    int64_t mFileSize;
+    Archive* mArchive;
+    int mRefs;    //one of these is the cache's own while it is listed
+};
+
+static pthread_mutex_t sCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static CachedModule* sCache[CACHE_ENTRIES];    //most recently used first
+
+//call with sCacheMutex held
+static void ReleaseModule(CachedModule* aModule)
+{
+    if (--aModule->mRefs == 0)
+    {
+        delete aModule->mArchive;
+        delete aModule;
+    }
+}
+
+class arch_Cached: public Archive
+{
+    CachedModule* mModule;
+
+public:
+    //call with sCacheMutex held
+    arch_Cached(CachedModule* aModule) : mModule(aModule)
+    {
+        mModule->mRefs++;
+        mSize = mModule->mArchive->Size();
+        mMap = mModule->mArchive->Map();
+    }
+
+    virtual ~arch_Cached()
+    {
+        pthread_mutex_lock(&sCacheMutex);
+        ReleaseModule(mModule);
+        pthread_mutex_unlock(&sCacheMutex);
+    }
+};
+
+static Archive* LookupModule(const string& aFileName, int64_t aFileSize)
+{
+    Archive* lArchive = NULL;
+
+    pthread_mutex_lock(&sCacheMutex);
+
+    for (int i = 0; i < CACHE_ENTRIES && sCache[i]; i++)
+    {
+        CachedModule* lModule = sCache[i];
+
+        if (lModule->mFileSize == aFileSize && lModule->mFileName == aFileName)
+        {
+            memmove(sCache + 1, sCache, i * sizeof sCache[0]);
+            sCache[0] = lModule;
+            lArchive = new arch_Cached(lModule);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&sCacheMutex);
+    return lArchive;
+}
+
+static Archive* InsertModule(const string& aFileName, int64_t aFileSize, Archive* aArchive)
+{
+    CachedModule* lModule = new CachedModule;
+    Archive* lArchive;
+
+    lModule->mFileName = aFileName;
+    lModule->mFileSize = aFileSize;
+    lModule->mArchive = aArchive;
+    lModule->mRefs = 1;
+
+    pthread_mutex_lock(&sCacheMutex);
+
+    if (sCache[CACHE_ENTRIES - 1])
+        ReleaseModule(sCache[CACHE_ENTRIES - 1]);
+
+    memmove(sCache + 1, sCache, (CACHE_ENTRIES - 1) * sizeof sCache[0]);
+    sCache[0] = lModule;
+    lArchive = new arch_Cached(lModule);
+
+    pthread_mutex_unlock(&sCacheMutex);
+    return lArchive;
+}
+
+void CloseArchiveCache()
+{
+    pthread_mutex_lock(&sCacheMutex);
+
+    for (int i = 0; i < CACHE_ENTRIES && sCache[i]; i++)
+    {
+        ReleaseModule(sCache[i]);
+        sCache[i] = NULL;
+    }
+
+    pthread_mutex_unlock(&sCacheMutex);
+}
+
+// ============================================================
+
+//Compressed modules are recognized by name, so that the probe does not have
+//to extract them; the next open will, and it goes into the cache.
+bool IsCompressedModule(const string& aFileName, const unsigned char* aMagic)
+{
+    static const char* const lZipExts[] = {".mdz", ".s3z", ".xmz", ".itz", NULL};
+    static const char* const lGzipExts[] = {".mdgz", ".s3gz", ".xmgz", ".itgz", NULL};
+    const char* const* lExts;
+    string lExt;
+    uint32_t lPos;
+
+    if (arch_Gzip::IsOurMagic(aMagic))
+        lExts = lGzipExts;
+    else if (arch_Zip::IsOurMagic(aMagic))
+        lExts = lZipExts;
+    else
+        return false;
+
+    lPos = aFileName.find_last_of('.');
+    if((int)lPos == -1)
+        return false;
+    lExt = aFileName.substr(lPos);
+    for(uint32_t i = 0; i < lExt.length(); i++)
+        lExt[i] = tolower(lExt[i]);
+
+    for (; *lExts; lExts++)
+    {
+        if (lExt == *lExts)
+            return true;
+    }
+
+    return false;
+}
+
 Archive* OpenArchive(const string& aFileName) //aFilename is url --yaz
 {
-    return new arch_Raw(aFileName);
+    unsigned char lMagic[4];
+    VFSFile* lFile;
+    int64_t lFileSize;
+    Archive* lArchive;
+    bool lGzip;
+
+    lFile = vfs_fopen(aFileName.c_str(), "r");
+    if (!lFile)
+        return new Archive;
+
+    if (vfs_fread(lMagic, 1, 4, lFile) < 4
+     || ! ((lGzip = arch_Gzip::IsOurMagic(lMagic)) || arch_Zip::IsOurMagic(lMagic)))
+    {
+        vfs_fclose(lFile);
+        return new arch_Raw(aFileName);
+    }
+
+    lFileSize = vfs_fsize(lFile);
+    if ((lArchive = LookupModule(aFileName, lFileSize)))
+    {
+        vfs_fclose(lFile);
+        return lArchive;
+    }
+
+    if (lGzip)
+        lArchive = new arch_Gzip(lFile);
+    else
+        lArchive = new arch_Zip(lFile);
+
+    vfs_fclose(lFile);
+
+    if (lArchive->Size() == 0)
+        return lArchive;
+
+    return InsertModule(aFileName, lFileSize, lArchive);
 }
@@ -11,5 +11,7 @@
 
 Archive* OpenArchive(const std::string& aFileName);
 bool ContainsMod(const std::string& aFileName);
+void CloseArchiveCache();
+bool IsCompressedModule(const std::string& aFileName, const unsigned char* aMagic);
 
 #endif
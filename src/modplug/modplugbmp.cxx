@@ -21,6 +21,8 @@ extern "C" {
 }
 
 #include "archive/open.h"
+#include "../pcmconv/pcmconv.h"
+#include "../ratepref/ratepref.h"
 
 using namespace std;
 
@@ -31,12 +33,16 @@ ModplugXMMS::ModplugXMMS()
     memset (this, 0, sizeof (* this));
     mSoundFile = new CSoundFile;
     pthread_mutex_init (& mutex, 0);
+    pthread_mutex_init (& decodeahead.mutex, 0);
+    pthread_cond_init (& decodeahead.cond, 0);
 }
 
 ModplugXMMS::~ModplugXMMS()
 {
     delete mSoundFile;
     pthread_mutex_destroy (& mutex);
+    pthread_mutex_destroy (& decodeahead.mutex);
+    pthread_cond_destroy (& decodeahead.cond);
 }
 
 bool ModplugXMMS::CanPlayFileFromVFS(const string& aFilename, VFSFile *file)
@@ -48,6 +54,8 @@ bool ModplugXMMS::CanPlayFileFromVFS(const string& aFilename, VFSFile *file)
 
     if (vfs_fread(magic, 1, magicSize, file) < magicSize)
         return false;
+    if (IsCompressedModule(aFilename, (unsigned char*)magic))
+        return true;
     if (!memcmp(magic, UMX_MAGIC, 4))
         return true;
     if (!memcmp(magic, "Extended Module:", 16))
@@ -146,15 +154,14 @@ bool ModplugXMMS::CanPlayFileFromVFS(const string& aFilename, VFSFile *file)
     return false;
 }
 
-void ModplugXMMS::PlayLoop(InputPlayback *playback)
+bool_t ModplugXMMS::RenderFunc(DecodeAhead *d, void *user)
 {
-    uint32_t lLength;
+    return ((ModplugXMMS *) user)->Render(d);
+}
 
-    pthread_mutex_lock (& mutex);
-    seek_time = -1;
-    stop_flag = FALSE;
-    playback->set_pb_ready (playback);
-    pthread_mutex_unlock (& mutex);
+bool_t ModplugXMMS::Render(DecodeAhead *d)
+{
+    uint32_t lLength;
 
     while (1)
     {
@@ -166,53 +173,54 @@ void ModplugXMMS::PlayLoop(InputPlayback *playback)
             break;
         }
 
+        pthread_mutex_unlock (& mutex);
+
+        int seek_time = decodeahead_get_seek (d);
+
         if (seek_time != -1)
         {
             mSoundFile->SetCurrentPos (seek_time * (int64_t)
              mSoundFile->GetMaxPosition () / (mSoundFile->GetSongTime () * 1000));
-            playback->output->flush (seek_time);
-            seek_time = -1;
+            decodeahead_seek_done (d);
         }
 
-        pthread_mutex_unlock (& mutex);
-
         lLength = mSoundFile->Read (mBuffer, mBufSize);
 
         if (! lLength)
+        {
+            if (decodeahead_finish (d))
+                continue;
             break;
+        }
 
         if(mModProps.mPreamp)
         {
-            //apply preamp
-            if(mModProps.mBits == 16)
-            {
-                unsigned n = mBufSize >> 1;
-                for(unsigned i = 0; i < n; i++) {
-                    short old = ((short*)mBuffer)[i];
-                    ((short*)mBuffer)[i] *= (short int)mPreampFactor;
-                    // detect overflow and clip!
-                    if ((old & 0x8000) !=
-                     (((short*)mBuffer)[i] & 0x8000))
-                      ((short*)mBuffer)[i] = old | 0x7FFF;
-
-                }
-            }
+            //apply preamp, saturating
+            if(mModProps.mBits == 32)
+                pcm_gain(mBuffer, FMT_S32_NE, mBufSize >> 2, mPreampFactor, FALSE);
+            else if(mModProps.mBits == 16)
+                pcm_gain(mBuffer, FMT_S16_NE, mBufSize >> 1, mPreampFactor, FALSE);
             else
-            {
-                for(unsigned i = 0; i < mBufSize; i++) {
-                    unsigned char old = ((unsigned char*)mBuffer)[i];
-                    ((unsigned char*)mBuffer)[i] *= (short int)mPreampFactor;
-                    // detect overflow and clip!
-                    if ((old & 0x80) !=
-                     (((unsigned char*)mBuffer)[i] & 0x80))
-                      ((unsigned char*)mBuffer)[i] = old | 0x7F;
-                }
-            }
+                pcm_gain(mBuffer, FMT_U8, mBufSize, mPreampFactor, FALSE);
         }
 
-        playback->output->write_audio (mBuffer, mBufSize);
+        if (! decodeahead_write (d, mBuffer, mBufSize))
+            break;
     }
 
+    return TRUE;
+}
+
+void ModplugXMMS::PlayLoop(InputPlayback *playback)
+{
+    pthread_mutex_lock (& mutex);
+    stop_flag = FALSE;
+    playback->set_pb_ready (playback);
+    pthread_mutex_unlock (& mutex);
+
+    decodeahead_play (& decodeahead, playback, mFrequency,
+     mModProps.mChannels * (mModProps.mBits / 8), RenderFunc, this);
+
     pthread_mutex_lock (& mutex);
     stop_flag = TRUE;
     pthread_mutex_unlock (& mutex);
@@ -241,11 +249,14 @@ bool ModplugXMMS::PlayFile(const string& aFilename, InputPlayback *ipb)
     if (mBuffer)
         delete [] mBuffer;
 
+    //the mixer resamples anyway, so mix at the output's rate if known
+    mFrequency = ratepref_get(mModProps.mFrequency);
+
     //find buftime to get approx. 512 samples/block
-    mBufTime = 512000 / mModProps.mFrequency + 1;
+    mBufTime = 512000 / mFrequency + 1;
 
     mBufSize = mBufTime;
-    mBufSize *= mModProps.mFrequency;
+    mBufSize *= mFrequency;
     mBufSize /= 1000;    //milliseconds
     mBufSize *= mModProps.mChannels;
     mBufSize *= mModProps.mBits / 8;
@@ -256,7 +267,7 @@ bool ModplugXMMS::PlayFile(const string& aFilename, InputPlayback *ipb)
 
     CSoundFile::SetWaveConfig
     (
-        mModProps.mFrequency,
+        mFrequency,
         mModProps.mBits,
         mModProps.mChannels
     );
@@ -313,10 +324,11 @@ bool ModplugXMMS::PlayFile(const string& aFilename, InputPlayback *ipb)
         ipb->set_tuple(ipb,ti);
     }
 
-    ipb->set_params(ipb, mSoundFile->GetNumChannels() * 1000, mModProps.mFrequency, mModProps.mChannels);
+    ipb->set_params(ipb, mSoundFile->GetNumChannels() * 1000, mFrequency, mModProps.mChannels);
 
-    int fmt = (mModProps.mBits == 16) ? FMT_S16_NE : FMT_U8;
-    if (! ipb->output->open_audio (fmt, mModProps.mFrequency, mModProps.mChannels))
+    int fmt = (mModProps.mBits == 32) ? FMT_S32_NE :
+              (mModProps.mBits == 16) ? FMT_S16_NE : FMT_U8;
+    if (! ipb->output->open_audio (fmt, mFrequency, mModProps.mChannels))
         return false;
 
     this->PlayLoop(ipb);
@@ -331,7 +343,7 @@ void ModplugXMMS::Stop (InputPlayback * playback)
     if (!stop_flag)
     {
         stop_flag = TRUE;
-        playback->output->abort_write();
+        decodeahead_stop (& decodeahead);
     }
 
     pthread_mutex_unlock (& mutex);
@@ -352,10 +364,7 @@ void ModplugXMMS::mseek (InputPlayback * playback, int time)
     pthread_mutex_lock (& mutex);
 
     if (!stop_flag)
-    {
-        seek_time = time;
-        playback->output->abort_write();
-    }
+        decodeahead_seek (& decodeahead, time);
 
     pthread_mutex_unlock (& mutex);
 }
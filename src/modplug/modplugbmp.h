@@ -15,6 +15,7 @@ extern "C" {
 }
 
 #include "settings.h"
+#include "../decodeahead/decodeahead.h"
 
 /* Module files have their magic deep inside the file, at offset 1080; source: http://www.onicos.com/staff/iz/formats/mod.html and information by Michael Doering from UADE */
 #define MOD_MAGIC_PROTRACKER4   "M.K."  // Protracker 4 channel
@@ -65,12 +66,14 @@ private:
     uint32_t  mBufSize;
 
     pthread_mutex_t mutex;
-    int seek_time;
     bool stop_flag;
 
+    DecodeAhead decodeahead;
+
     ModplugSettings mModProps;
 
     uint32_t  mBufTime;     //milliseconds
+    int       mFrequency;   //the rate playing at, maybe not mModProps'
 
     CSoundFile* mSoundFile;
     Archive*    mArchive;
@@ -78,6 +81,8 @@ private:
     float mPreampFactor;
 
     void PlayLoop(InputPlayback *);
+    bool_t Render(DecodeAhead *);
+    static bool_t RenderFunc(DecodeAhead *, void *);
 };
 
 #endif //included
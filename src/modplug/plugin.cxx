@@ -6,11 +6,17 @@
 
 #include "plugin.h"
 #include "modplugbmp.h"
+#include "archive/open.h"
 
 static ModplugXMMS gModplugXMMS;
 
 extern "C" {
 
+void Cleanup (void)
+{
+    CloseArchiveCache ();
+}
+
 void InitSettings (const ModplugSettings * settings)
 {
     gModplugXMMS.SetModProps (* settings);
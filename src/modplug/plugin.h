@@ -9,6 +9,7 @@ extern "C" {
 
 #include <audacious/plugin.h>
 
+void Cleanup (void);
 void InitSettings (const ModplugSettings * settings);
 int CanPlayFileFromVFS (const char * filename, VFSFile * file);
 bool_t PlayFile (InputPlayback * data, const char * filename, VFSFile * file,
@@ -20,7 +20,7 @@
 static const char * fmts[] =
     { "amf", "ams", "dbm", "dbf", "dsm", "far", "mdl", "stm", "ult", "mt2",
       "mod", "s3m", "dmf", "umx", "it", "669", "xm", "mtm", "psm", "ft2",
-      NULL };
+      "mdz", "s3z", "xmz", "itz", "mdgz", "s3gz", "xmgz", "itgz", NULL };
 
 static const char * const modplug_defaults[] = {
  "Bits", "16",
@@ -59,6 +59,8 @@ static const PreferencesWidget quality_widgets[] = {
      .cfg = & modplug_settings.mBits, .data = {.radio_btn = {8}}},
     {WIDGET_RADIO_BTN, N_("16-bit"), .cfg_type = VALUE_INT,
      .cfg = & modplug_settings.mBits, .data = {.radio_btn = {16}}},
+    {WIDGET_RADIO_BTN, N_("32-bit"), .cfg_type = VALUE_INT,
+     .cfg = & modplug_settings.mBits, .data = {.radio_btn = {32}}},
     {WIDGET_LABEL, N_("<b>Channels</b>")},
     {WIDGET_RADIO_BTN, N_("Mono"), .cfg_type = VALUE_INT,
      .cfg = & modplug_settings.mChannels, .data = {.radio_btn = {1}}},
@@ -239,6 +241,7 @@ AUD_INPUT_PLUGIN
     .domain = PACKAGE,
     .prefs = &modplug_prefs,
     .init = modplug_init,
+    .cleanup = Cleanup,
     .play = PlayFile,
     .stop = Stop,
     .pause = Pause,
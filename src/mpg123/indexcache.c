@@ -0,0 +1,186 @@
+/*
+ * Frame index cache for the mpg123 plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <audacious/debug.h>
+
+#include "indexcache.h"
+
+#define CACHE_MAGIC "AUDMI01" /* 8 bytes, including the nul */
+#define MAX_FILL (1 << 20)
+
+typedef struct {
+	char magic[8];
+	int64_t size, mtime; /* mtime in nanoseconds */
+	int64_t samples;
+	int64_t step, fill;
+} CacheHeader;
+
+/* Returns the name of the cache file and sets size and mtime, or returns NULL
+ * if the file is not local or cannot be found. */
+static char * cache_path (const char * filename, int64_t * size, int64_t * mtime)
+{
+	char * local = g_filename_from_uri (filename, NULL, NULL);
+	struct stat st;
+
+	if (! local)
+		return NULL;
+
+	if (g_stat (local, & st) < 0)
+	{
+		g_free (local);
+		return NULL;
+	}
+
+	g_free (local);
+
+	* size = st.st_size;
+	* mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+	char * hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, filename, -1);
+	char * path = g_build_filename (g_get_user_cache_dir (), "audacious",
+	 "mpg123", hash, NULL);
+
+	g_free (hash);
+	return path;
+}
+
+bool_t index_cache_load (const char * filename, mpg123_handle * dec,
+ int64_t * samples)
+{
+	int64_t size, mtime;
+	char * path = cache_path (filename, & size, & mtime);
+
+	if (! path)
+		return FALSE;
+
+	FILE * file = g_fopen (path, "rb");
+	bool_t ok = FALSE;
+
+	g_free (path);
+
+	if (! file)
+		return FALSE;
+
+	CacheHeader head;
+
+	if (fread (& head, sizeof head, 1, file) != 1 || memcmp (head.magic,
+	 CACHE_MAGIC, 8) || head.size != size || head.mtime != mtime ||
+	 head.fill <= 0 || head.fill > MAX_FILL || head.step <= 0)
+		goto DONE;
+
+	if (! dec)
+	{
+		ok = TRUE;
+		goto FOUND;
+	}
+
+	int64_t * stored = g_new (int64_t, head.fill);
+	off_t * offsets = g_new (off_t, head.fill);
+
+	if (fread (stored, sizeof (int64_t), head.fill, file) == head.fill)
+	{
+		for (int64_t i = 0; i < head.fill; i ++)
+			offsets[i] = stored[i];
+
+		/* mpg123 copies the offsets */
+		ok = (mpg123_set_index (dec, offsets, head.step, head.fill) == MPG123_OK);
+	}
+
+	g_free (stored);
+	g_free (offsets);
+
+FOUND:
+	if (ok && samples)
+		* samples = head.samples;
+
+DONE:
+	fclose (file);
+	AUDDBG ("%s index for %s.\n", ok ? "Using cached" : "No cached", filename);
+	return ok;
+}
+
+void index_cache_save (const char * filename, mpg123_handle * dec,
+ int64_t samples)
+{
+	off_t * offsets;
+	off_t step;
+	size_t fill;
+
+	if (samples <= 0 || mpg123_index (dec, & offsets, & step, & fill) !=
+	 MPG123_OK || ! fill || fill > MAX_FILL)
+		return;
+
+	int64_t size, mtime;
+	char * path = cache_path (filename, & size, & mtime);
+
+	if (! path)
+		return;
+
+	char * dir = g_path_get_dirname (path);
+	char * temp = g_strconcat (path, ".tmp", NULL);
+	FILE * file = NULL;
+	bool_t ok = FALSE;
+
+	if (g_mkdir_with_parents (dir, 0700) < 0 || ! (file = g_fopen (temp, "wb")))
+		goto DONE;
+
+	CacheHeader head;
+	memset (& head, 0, sizeof head);
+	memcpy (head.magic, CACHE_MAGIC, 8);
+	head.size = size;
+	head.mtime = mtime;
+	head.samples = samples;
+	head.step = step;
+	head.fill = fill;
+
+	int64_t * stored = g_new (int64_t, fill);
+
+	for (size_t i = 0; i < fill; i ++)
+		stored[i] = offsets[i];
+
+	ok = (fwrite (& head, sizeof head, 1, file) == 1 && fwrite (stored,
+	 sizeof (int64_t), fill, file) == fill);
+	ok = (fclose (file) == 0) && ok;
+
+	g_free (stored);
+
+	/* Written under a temporary name, so that a reader never sees half of
+	 * an entry. */
+	if (ok && g_rename (temp, path) == 0)
+		AUDDBG ("Cached index of %d frames for %s.\n", (int) fill, filename);
+	else
+	{
+		fprintf (stderr, "mpg123: Could not save index cache %s.\n", path);
+		g_unlink (temp);
+	}
+
+DONE:
+	g_free (dir);
+	g_free (temp);
+	g_free (path);
+}
@@ -0,0 +1,50 @@
+/*
+ * Frame index cache for the mpg123 plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AUD_MPG123_INDEXCACHE_H
+#define AUD_MPG123_INDEXCACHE_H
+
+#include <stdint.h>
+
+#include <mpg123.h>
+
+#include <libaudcore/core.h>
+
+/* Finding the exact length of an MP3 means reading every frame header, and
+ * mpg123 only knows where each frame starts once it has done so.  Once a file
+ * has been read to the end (by playing it through or by mpg123_scan), its
+ * frame index and exact length are kept in the user's cache directory, keyed
+ * by URI and checked against the file's size and modification time.  Only
+ * local files are cached. */
+
+/* Feeds a cached index to the decoder, which must just have been opened, or
+ * only looks up the length if dec is NULL.  If samples is not NULL, it is set
+ * to the exact length in samples.  Returns FALSE if there is no valid entry
+ * for the file. */
+bool_t index_cache_load (const char * filename, mpg123_handle * dec,
+ int64_t * samples);
+
+/* Stores the decoder's index, which must cover the whole file, along with the
+ * exact length in samples. */
+void index_cache_save (const char * filename, mpg123_handle * dec,
+ int64_t samples);
+
+#endif
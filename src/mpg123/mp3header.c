@@ -0,0 +1,279 @@
+/*
+ * MP3 header parser for the mpg123 plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <audacious/debug.h>
+
+#include "mp3header.h"
+
+#define SCAN_SIZE 4096   /* how far past the ID3v2 tags to look for a frame */
+#define MAX_ID3_TAGS 4
+
+static const short bitrates[2][3][15] = {
+	{{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+	 {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+	 {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}},
+	{{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+	 {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+	 {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}}};
+
+static const int rates[3][3] = {
+	{44100, 48000, 32000},
+	{22050, 24000, 16000},
+	{11025, 12000, 8000}};
+
+typedef struct {
+	int version, layer;
+	int bitrate, rate, channels;
+	int length;          /* bytes */
+	int samples;         /* per frame */
+	int side_info;       /* bytes, layer 3 only */
+} Frame;
+
+static uint32_t get_be32 (const unsigned char * p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static uint32_t get_le32 (const unsigned char * p)
+{
+	return (uint32_t) p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0];
+}
+
+static bool_t parse_frame (const unsigned char * p, Frame * f)
+{
+	if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0)
+		return FALSE;
+
+	int ver_bits = (p[1] >> 3) & 3;
+	int layer_bits = (p[1] >> 1) & 3;
+	int br_index = p[2] >> 4;
+	int rate_index = (p[2] >> 2) & 3;
+	int padding = (p[2] >> 1) & 1;
+
+	/* free format is rare enough to be left to the decoder */
+	if (ver_bits == 1 || ! layer_bits || ! br_index || br_index == 15 ||
+	 rate_index == 3)
+		return FALSE;
+
+	f->version = (ver_bits == 3) ? 0 : (ver_bits == 2) ? 1 : 2;
+	f->layer = 4 - layer_bits;
+	f->bitrate = bitrates[f->version > 0][f->layer - 1][br_index];
+	f->rate = rates[f->version][rate_index];
+	f->channels = ((p[3] >> 6) == 3) ? 1 : 2;
+
+	int lsf = (f->version > 0);
+
+	if (f->layer == 1)
+	{
+		f->samples = 384;
+		f->length = (12000 * f->bitrate / f->rate + padding) * 4;
+	}
+	else
+	{
+		f->samples = (f->layer == 3 && lsf) ? 576 : 1152;
+		f->length = f->samples / 8 * 1000 * f->bitrate / f->rate + padding;
+	}
+
+	if (f->layer == 3)
+		f->side_info = lsf ? ((f->channels == 1) ? 9 : 17) : ((f->channels == 1) ? 17 : 32);
+	else
+		f->side_info = 0;
+
+	return TRUE;
+}
+
+/* Returns the offset of the first audio frame, following any ID3v2 tags. */
+static int64_t skip_id3v2 (VFSFile * file)
+{
+	int64_t offset = 0;
+
+	for (int i = 0; i < MAX_ID3_TAGS; i ++)
+	{
+		unsigned char head[10];
+
+		if (vfs_fseek (file, offset, SEEK_SET) < 0 || vfs_fread (head, 1,
+		 sizeof head, file) != sizeof head || memcmp (head, "ID3", 3))
+			break;
+
+		/* sync-safe integer, plus a footer if the flags say so */
+		offset += 10 + ((head[6] & 0x7f) << 21 | (head[7] & 0x7f) << 14 |
+		 (head[8] & 0x7f) << 7 | (head[9] & 0x7f)) + ((head[5] & 0x10) ? 10 : 0);
+	}
+
+	return offset;
+}
+
+/* Returns the number of bytes taken up by ID3v1 and APEv2 tags at the end. */
+static int64_t tag_bytes_at_end (VFSFile * file, int64_t size)
+{
+	unsigned char buf[160];
+	int64_t tags = 0;
+
+	if (size < (int64_t) sizeof buf || vfs_fseek (file, size - sizeof buf,
+	 SEEK_SET) < 0 || vfs_fread (buf, 1, sizeof buf, file) != sizeof buf)
+		return 0;
+
+	if (! memcmp (buf + 32, "TAG", 3))
+		tags = 128;
+
+	const unsigned char * ape = buf + sizeof buf - tags - 32;
+
+	if (! memcmp (ape, "APETAGEX", 8))
+	{
+		/* The size counts the footer but not the header. */
+		uint32_t ape_size = get_le32 (ape + 12);
+		uint32_t flags = get_le32 (ape + 20);
+
+		tags += ape_size + ((flags & 0x80000000) ? 32 : 0);
+	}
+
+	return (tags < size) ? tags : 0;
+}
+
+/* Looks for a Xing/Info or VBRI header in the first frame.  Returns FALSE if
+ * there is neither, in which case the frame is audio. */
+static bool_t parse_vbr (const unsigned char * p, int avail, const Frame * f,
+ MP3Header * header, int64_t * bytes)
+{
+	int64_t frames = -1;
+	int delay = 0, padding = 0;
+	int xing = 4 + f->side_info;
+
+	if (f->layer == 3 && xing + 8 <= avail && (! memcmp (p + xing, "Xing", 4)
+	 || ! memcmp (p + xing, "Info", 4)))
+	{
+		uint32_t flags = get_be32 (p + xing + 4);
+		int pos = xing + 8;
+
+		if ((flags & 1) && pos + 4 <= avail)
+		{
+			frames = get_be32 (p + pos);
+			pos += 4;
+		}
+
+		if ((flags & 2) && pos + 4 <= avail)
+		{
+			* bytes = get_be32 (p + pos);
+			pos += 4;
+		}
+
+		/* The LAME tag is at a fixed offset, whichever fields are present. */
+		const unsigned char * lame = p + xing + 120;
+
+		if (xing + 120 + 24 <= avail && (! memcmp (lame, "LAME", 4) ||
+		 ! memcmp (lame, "Lavf", 4) || ! memcmp (lame, "Lavc", 4)))
+		{
+			delay = lame[21] << 4 | lame[22] >> 4;
+			padding = (lame[22] & 0x0f) << 8 | lame[23];
+		}
+	}
+	else if (f->layer == 3 && 36 + 18 <= avail && ! memcmp (p + 36, "VBRI", 4))
+	{
+		* bytes = get_be32 (p + 36 + 10);
+		frames = get_be32 (p + 36 + 14);
+	}
+	else
+		return FALSE;
+
+	/* "Info" marks a CBR file; it still counts its frames. */
+	header->vbr = memcmp (p + xing, "Info", 4) != 0;
+
+	if (frames > 0)
+	{
+		header->samples = frames * f->samples - delay - padding;
+		if (header->samples < 0)
+			header->samples = 0;
+	}
+
+	return TRUE;
+}
+
+bool_t mp3_header_read (VFSFile * file, MP3Header * header)
+{
+	int64_t size = vfs_fsize (file);
+	int64_t start = skip_id3v2 (file);
+	unsigned char buf[SCAN_SIZE];
+	int avail;
+
+	if (size <= 0 || start >= size || vfs_fseek (file, start, SEEK_SET) < 0 ||
+	 (avail = vfs_fread (buf, 1, sizeof buf, file)) < 4)
+		return FALSE;
+
+	Frame f;
+	int pos;
+
+	/* Take the first header that is followed by another like it; a single
+	 * sync word may be junk. */
+	for (pos = 0; pos + 4 <= avail; pos ++)
+	{
+		Frame next;
+
+		if (! parse_frame (buf + pos, & f))
+			continue;
+
+		if (pos + f.length + 4 > avail || (parse_frame (buf + pos + f.length,
+		 & next) && next.version == f.version && next.layer == f.layer &&
+		 next.rate == f.rate))
+			break;
+	}
+
+	if (pos + 4 > avail)
+		return FALSE;
+
+	int64_t audio_bytes = size - start - pos - tag_bytes_at_end (file, size);
+	int64_t bytes = -1;
+
+	memset (header, 0, sizeof (MP3Header));
+	header->version = f.version;
+	header->layer = f.layer;
+	header->rate = f.rate;
+	header->channels = f.channels;
+	header->bitrate = f.bitrate;
+	header->samples = -1;
+
+	if (parse_vbr (buf + pos, avail - pos, & f, header, & bytes))
+	{
+		/* the Xing frame itself is silent */
+		if (bytes <= 0)
+			bytes = audio_bytes - f.length;
+	}
+	else
+		bytes = audio_bytes;
+
+	if (header->samples < 0 && bytes > 0)
+	{
+		/* no frame count: assume a constant bitrate */
+		header->samples = bytes * 8 * f.rate / (f.bitrate * 1000);
+	}
+	else if (header->vbr && header->samples > 0 && bytes > 0)
+		header->bitrate = bytes * 8 * f.rate / (header->samples * 1000);
+
+	static const char * vers[] = {"1", "2", "2.5"};
+
+	AUDDBG ("MPEG-%s layer %d, %d Hz, %d kbps%s, %" PRId64 " samples.\n",
+	 vers[f.version], f.layer, f.rate, header->bitrate, header->vbr ? " VBR" : "",
+	 header->samples);
+
+	return TRUE;
+}
@@ -0,0 +1,45 @@
+/*
+ * MP3 header parser for the mpg123 plugin
+ * Copyright 2014 Audacious developers
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AUD_MPG123_MP3HEADER_H
+#define AUD_MPG123_MP3HEADER_H
+
+#include <stdint.h>
+
+#include <audacious/plugin.h>
+
+/* Reads what a tuple needs straight from the file, without a decoder: the
+ * first frame header, the Xing/Info or VBRI header that may follow it, and the
+ * ID3v2, ID3v1 and APE tags at either end, which are not counted as audio.
+ * Only a few kilobytes at each end of the file are read. */
+
+typedef struct {
+	int version;         /* 0 = MPEG-1, 1 = MPEG-2, 2 = MPEG-2.5 */
+	int layer;
+	int rate, channels;
+	int bitrate;         /* kbps, of the first frame or the VBR average */
+	bool_t vbr;          /* found a Xing or VBRI header */
+	int64_t samples;     /* after removing LAME's encoder delay and padding */
+} MP3Header;
+
+bool_t mp3_header_read (VFSFile * file, MP3Header * header);
+
+#endif
@@ -20,6 +20,7 @@
  */
 
 #include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <mpg123.h>
@@ -33,11 +34,23 @@
 #include <libaudcore/audstrings.h>
 #include <audacious/debug.h>
 #include <audacious/i18n.h>
+#include <audacious/misc.h>
 #include <audacious/plugin.h>
+#include <audacious/preferences.h>
 #include <audacious/audtag.h>
 
-/* Define to read all frame headers when calculating file length */
-/* #define FULL_SCAN */
+#include "indexcache.h"
+#include "mp3header.h"
+
+static const char * const mpg123_defaults[] = {
+ "full_scan", "FALSE", /* read all frame headers to find the exact length */
+ "large_reads", "TRUE", /* feed the decoder in FEED_BLOCK chunks */
+ NULL};
+
+/* In feed mode the file is read in blocks of this size and fed to the
+ * decoder, rather than read in the frame-sized pieces mpg123 asks for, which
+ * over a network is one round trip per frame. */
+#define FEED_BLOCK 131072
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -60,6 +73,7 @@ static off_t replace_lseek_dummy (void * file, off_t to, int whence)
 static bool_t aud_mpg123_init (void)
 {
 	AUDDBG("initializing mpg123 library\n");
+	aud_config_set_defaults ("mpg123", mpg123_defaults);
 	mpg123_init();
 
 	return TRUE;
@@ -138,11 +152,6 @@ ERR:
 		return FALSE;
 	}
 
-#ifdef FULL_SCAN
-	if (mpg123_scan (dec) < 0)
-		goto ERR;
-#endif
-
 RETRY:;
 	long rate;
 	int chan, enc;
@@ -170,12 +179,54 @@ RETRY:;
 	return TRUE;
 }
 
-static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
+static void set_quality (Tuple * tuple, int channels, int rate)
 {
-	if (! file)
+	char scratch[32];
+	snprintf (scratch, sizeof scratch, "%s, %d Hz", (channels == 2)
+	 ? _("Stereo") : (channels > 2) ? _("Surround") : _("Mono"), rate);
+	tuple_set_str (tuple, FIELD_QUALITY, NULL, scratch);
+}
+
+static void set_length (Tuple * tuple, VFSFile * file, int64_t samples,
+ long rate)
+{
+	int64_t size = vfs_fsize (file);
+	int length = (samples > 0 && rate > 0) ? samples * 1000 / rate : 0;
+
+	if (length > 0)
+		tuple_set_int (tuple, FIELD_LENGTH, NULL, length);
+	if (size > 0 && length > 0)
+		tuple_set_int (tuple, FIELD_BITRATE, NULL, 8 * size / length);
+}
+
+/* Reading the headers directly avoids setting up a decoder, which matters when
+ * a large library is being imported. */
+static Tuple * probe_from_headers (const char * filename, VFSFile * file)
+{
+	static const char * vers[] = {"1", "2", "2.5"};
+	MP3Header header;
+	char scratch[32];
+
+	if (! mp3_header_read (file, & header))
 		return NULL;
 
-	bool_t stream = vfs_is_streaming (file);
+	/* an exact length, if the file has been played through before */
+	index_cache_load (filename, NULL, & header.samples);
+
+	Tuple * tuple = tuple_new_from_filename (filename);
+	snprintf (scratch, sizeof scratch, "MPEG-%s layer %d",
+	 vers[header.version], header.layer);
+	tuple_set_str (tuple, FIELD_CODEC, NULL, scratch);
+	set_quality (tuple, header.channels, header.rate);
+	tuple_set_int (tuple, FIELD_BITRATE, NULL, header.bitrate);
+	set_length (tuple, file, header.samples, header.rate);
+
+	return tuple;
+}
+
+static Tuple * probe_with_decoder (const char * filename, VFSFile * file,
+ bool_t stream)
+{
 	mpg123_handle * decoder = mpg123_new (NULL, NULL);
 	int result;
 	long rate;
@@ -193,10 +244,20 @@ static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
 	if ((result = mpg123_open_handle (decoder, file)) < 0)
 		goto ERR;
 
-#ifdef FULL_SCAN
-	if (mpg123_scan (decoder) < 0)
-		goto ERR;
-#endif
+	/* Without an exact length from the cache, mpg123 estimates one from the
+	 * Xing or LAME header, or failing that from the file size. */
+	int64_t samples = -1;
+	bool_t cached = ! stream && index_cache_load (filename, decoder, & samples);
+
+	if (! stream && ! cached && aud_get_bool ("mpg123", "full_scan"))
+	{
+		if (mpg123_scan (decoder) < 0)
+			goto ERR;
+
+		samples = mpg123_length (decoder);
+		index_cache_save (filename, decoder, samples);
+		cached = TRUE;
+	}
 
 	if ((result = mpg123_getformat (decoder, & rate, & channels, & encoding)) <
 	 0)
@@ -207,24 +268,39 @@ static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
 	Tuple * tuple = tuple_new_from_filename (filename);
 	make_format_string (& info, scratch, sizeof scratch);
 	tuple_set_str (tuple, FIELD_CODEC, NULL, scratch);
-	snprintf (scratch, sizeof scratch, "%s, %d Hz", (channels == 2)
-	 ? _("Stereo") : (channels > 2) ? _("Surround") : _("Mono"), (int) rate);
-	tuple_set_str (tuple, FIELD_QUALITY, NULL, scratch);
+	set_quality (tuple, channels, rate);
 	tuple_set_int (tuple, FIELD_BITRATE, NULL, info.bitrate);
 
 	if (! stream)
-	{
-		int64_t size = vfs_fsize (file);
-		int64_t samples = mpg123_length (decoder);
-		int length = (samples > 0 && rate > 0) ? samples * 1000 / rate : 0;
-
-		if (length > 0)
-			tuple_set_int (tuple, FIELD_LENGTH, NULL, length);
-		if (size > 0 && length > 0)
-			tuple_set_int (tuple, FIELD_BITRATE, NULL, 8 * size / length);
-	}
+		set_length (tuple, file, cached ? samples : mpg123_length (decoder), rate);
+
+	mpg123_delete (decoder);
+	return tuple;
 
+ERR:
+	fprintf (stderr, "mpg123 probe error for %s: %s\n", filename, mpg123_plain_strerror (result));
 	mpg123_delete (decoder);
+	return NULL;
+}
+
+static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
+{
+	if (! file)
+		return NULL;
+
+	bool_t stream = vfs_is_streaming (file);
+	Tuple * tuple = NULL;
+
+	if (! stream && ! aud_get_bool ("mpg123", "full_scan"))
+		tuple = probe_from_headers (filename, file);
+
+	if (! tuple)
+	{
+		if (! stream)
+			vfs_rewind (file);
+		if (! (tuple = probe_with_decoder (filename, file, stream)))
+			return NULL;
+	}
 
 	if (! stream)
 	{
@@ -233,11 +309,6 @@ static Tuple * mpg123_probe_for_tuple (const char * filename, VFSFile * file)
 	}
 
 	return tuple;
-
-ERR:
-	fprintf (stderr, "mpg123 probe error for %s: %s\n", filename, mpg123_plain_strerror (result));
-	mpg123_delete (decoder);
-	return NULL;
 }
 
 typedef struct {
@@ -250,8 +321,66 @@ typedef struct {
 	bool_t stop;
 	bool_t stream;
 	Tuple *tu;
+	unsigned char *feed;	/* FEED_BLOCK bytes in feed mode, else NULL */
 } MPG123PlaybackContext;
 
+/* Feed mode only.  Returns FALSE at the end of the file or on error. */
+static bool_t feed_block (MPG123PlaybackContext * ctx)
+{
+	int64_t len = vfs_fread (ctx->feed, 1, FEED_BLOCK, ctx->fd);
+
+	MPG123_IODBG ("feeding %d bytes\n", (int) len);
+
+	return len > 0 && mpg123_feed (ctx->decoder, ctx->feed, len) == MPG123_OK;
+}
+
+static int get_format (MPG123PlaybackContext * ctx)
+{
+	int ret;
+
+	while ((ret = mpg123_getformat (ctx->decoder, & ctx->rate, & ctx->channels,
+	 & ctx->encoding)) == MPG123_NEED_MORE && ctx->feed)
+	{
+		if (! feed_block (ctx))
+			return MPG123_ERR;
+	}
+
+	return ret;
+}
+
+/* Like mpg123_read(), but feeds the decoder as needed in feed mode. */
+static int read_decoded (MPG123PlaybackContext * ctx, float * out, size_t size,
+ size_t * done)
+{
+	int ret;
+
+	while ((ret = mpg123_read (ctx->decoder, (void *) out, size, done)) ==
+	 MPG123_NEED_MORE && ctx->feed)
+	{
+		if (* done)
+			return MPG123_OK;
+		if (! feed_block (ctx))
+			return MPG123_DONE;
+	}
+
+	return ret;
+}
+
+/* Returns the sample seeked to, or < 0. */
+static int64_t seek_decoded (MPG123PlaybackContext * ctx, int64_t sample)
+{
+	if (! ctx->feed)
+		return mpg123_seek (ctx->decoder, sample, SEEK_SET);
+
+	off_t offset;
+	off_t res = mpg123_feedseek (ctx->decoder, sample, SEEK_SET, & offset);
+
+	if (res < 0 || vfs_fseek (ctx->fd, offset, SEEK_SET))
+		return -1;
+
+	return res;
+}
+
 static char *
 get_stream_metadata(VFSFile *file, const char *name)
 {
@@ -337,6 +466,12 @@ static bool_t mpg123_playback_worker (InputPlayback * data, const char *
 	mpg123_param (ctx.decoder, MPG123_ADD_FLAGS, MPG123_GAPLESS, 0);
 	mpg123_param (ctx.decoder, MPG123_ADD_FLAGS, MPG123_SEEKBUFFER, 0);
 
+	/* A stream would have to fill a whole block before playback could start.
+	 * A full scan needs mpg123 to do its own reading. */
+	if (! ctx.stream && aud_get_bool ("mpg123", "large_reads") &&
+	 ! aud_get_bool ("mpg123", "full_scan"))
+		ctx.feed = malloc (FEED_BLOCK);
+
 	if (ctx.stream)
 		mpg123_replace_reader_handle (ctx.decoder, replace_read, replace_lseek_dummy, NULL);
 	else
@@ -344,7 +479,8 @@ static bool_t mpg123_playback_worker (InputPlayback * data, const char *
 
 	set_format (ctx.decoder);
 
-	if (mpg123_open_handle (ctx.decoder, file) < 0)
+	if ((ctx.feed ? mpg123_open_feed (ctx.decoder) : mpg123_open_handle
+	 (ctx.decoder, file)) < 0)
 	{
 OPEN_ERROR:
 		fprintf (stderr, "mpg123: Error opening %s: %s.\n", filename,
@@ -356,18 +492,26 @@ OPEN_ERROR:
 	float outbuf[8192];
 	size_t outbuf_size = 0;
 
-#ifdef FULL_SCAN
-	if (mpg123_scan (ctx.decoder) < 0)
-		goto OPEN_ERROR;
-#endif
+	/* An index that covers the whole file makes seeking exact.  If there is
+	 * none yet, the one mpg123 builds while playing is saved once the file
+	 * has been played through. */
+	bool_t cached = ! ctx.stream && index_cache_load (filename, ctx.decoder, NULL);
+	bool_t complete = ! ctx.stream && ! cached && start_time <= 0;
+
+	if (! ctx.stream && ! cached && aud_get_bool ("mpg123", "full_scan"))
+	{
+		if (mpg123_scan (ctx.decoder) < 0)
+			goto OPEN_ERROR;
+
+		index_cache_save (filename, ctx.decoder, mpg123_length (ctx.decoder));
+		complete = FALSE;
+	}
 
 GET_FORMAT:
-	if (mpg123_getformat (ctx.decoder, & ctx.rate, & ctx.channels,
-	 & ctx.encoding) < 0)
+	if (get_format (& ctx) < 0)
 		goto OPEN_ERROR;
 
-	while ((ret = mpg123_read (ctx.decoder, (void *) outbuf, sizeof outbuf,
-	 & outbuf_size)) < 0)
+	while ((ret = read_decoded (& ctx, outbuf, sizeof outbuf, & outbuf_size)) < 0)
 	{
 		if (ret == MPG123_NEW_FORMAT)
 			goto GET_FORMAT;
@@ -415,7 +559,7 @@ GET_FORMAT:
 
 		if (ctx.seek >= 0)
 		{
-			if (mpg123_seek (ctx.decoder, (int64_t) ctx.seek * ctx.rate / 1000, SEEK_SET) < 0)
+			if (seek_decoded (& ctx, (int64_t) ctx.seek * ctx.rate / 1000) < 0)
 			{
 				fprintf (stderr, "mpg123 error in %s: %s\n", filename,
 				 mpg123_strerror (ctx.decoder));
@@ -425,6 +569,7 @@ GET_FORMAT:
 				data->output->flush (ctx.seek);
 				frames_played = (int64_t) (ctx.seek - start_time) * ctx.rate / 1000;
 				outbuf_size = 0;
+				complete = FALSE;
 			}
 
             ctx.seek = -1;
@@ -450,9 +595,12 @@ GET_FORMAT:
 		if (ctx.stream)
 			update_stream_tuple (data, file, ctx.tu);
 
-		if (! outbuf_size && (ret = mpg123_read (ctx.decoder, (void *) outbuf,
-		 sizeof outbuf, & outbuf_size)) < 0)
+		if (! outbuf_size && (ret = read_decoded (& ctx, outbuf, sizeof outbuf,
+		 & outbuf_size)) < 0)
 		{
+			if (ret == MPG123_DONE && complete)
+				index_cache_save (filename, ctx.decoder, mpg123_tell (ctx.decoder));
+
 			if (ret == MPG123_DONE || ret == MPG123_ERR_READER)
 				goto decode_cleanup;
 
@@ -500,6 +648,7 @@ decode_cleanup:
 
 cleanup:
 	mpg123_delete(ctx.decoder);
+	free (ctx.feed);
 	if (ctx.tu)
 		tuple_unref (ctx.tu);
 	return ! error;
@@ -562,12 +711,26 @@ static bool_t mpg123_get_image (const char * filename, VFSFile * handle,
 }
 
 /** plugin description header **/
+static const PreferencesWidget mpg123_widgets[] = {
+ {WIDGET_CHK_BTN, N_("Read whole files to find their exact length"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "mpg123", .cname = "full_scan"},
+ {WIDGET_LABEL, N_("Otherwise the length is taken from the Xing or VBRI header, "
+  "or estimated from the file size.  Lengths found by playing a file through "
+  "are remembered either way.")},
+ {WIDGET_CHK_BTN, N_("Read local files in large blocks"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "mpg123", .cname = "large_reads"}};
+
+static const PluginPreferences mpg123_prefs = {
+ .widgets = mpg123_widgets,
+ .n_widgets = sizeof mpg123_widgets / sizeof mpg123_widgets[0]};
+
 static const char *mpg123_fmts[] = { "mp3", "mp2", "mp1", "bmu", NULL };
 
 AUD_INPUT_PLUGIN
 (
 	.name = N_("MPG123 Plugin"),
 	.domain = PACKAGE,
+	.prefs = & mpg123_prefs,
 	.init = aud_mpg123_init,
 	.cleanup = aud_mpg123_deinit,
 	.extensions = mpg123_fmts,
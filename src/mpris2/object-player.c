@@ -38,6 +38,7 @@ typedef struct
   GDBusPropertyInfo parent_struct;
   const gchar *hyphen_name;
   gboolean use_gvariant;
+  gboolean emits_changed_signal;
 } _ExtendedGDBusPropertyInfo;
 
 typedef struct
@@ -364,7 +365,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "can-control",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_can_go_next =
@@ -377,7 +379,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "can-go-next",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_can_go_previous =
@@ -390,7 +393,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "can-go-previous",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_can_pause =
@@ -403,7 +407,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "can-pause",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_can_play =
@@ -416,7 +421,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "can-play",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_can_seek =
@@ -429,7 +435,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "can-seek",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_metadata =
@@ -442,7 +449,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "metadata",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_playback_status =
@@ -455,7 +463,22 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "playback-status",
-  FALSE
+  FALSE,
+  TRUE
+};
+
+static const GDBusAnnotationInfo _mpris_media_player2_player_property_position_annotation_info_0 =
+{
+  -1,
+  "org.freedesktop.DBus.Property.EmitsChangedSignal",
+  "false",
+  NULL
+};
+
+static const GDBusAnnotationInfo * const _mpris_media_player2_player_property_position_annotation_info_pointers[] =
+{
+  &_mpris_media_player2_player_property_position_annotation_info_0,
+  NULL
 };
 
 static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_info_position =
@@ -465,9 +488,10 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     "Position",
     "x",
     G_DBUS_PROPERTY_INFO_FLAGS_READABLE,
-    NULL
+    (GDBusAnnotationInfo **) &_mpris_media_player2_player_property_position_annotation_info_pointers
   },
   "position",
+  FALSE,
   FALSE
 };
 
@@ -481,7 +505,8 @@ static const _ExtendedGDBusPropertyInfo _mpris_media_player2_player_property_inf
     NULL
   },
   "volume",
-  FALSE
+  FALSE,
+  TRUE
 };
 
 static const _ExtendedGDBusPropertyInfo * const _mpris_media_player2_player_property_info_pointers[] =
@@ -3077,14 +3102,17 @@ mpris_media_player2_player_skeleton_set_property (GObject      *object,
   const GValue *value,
   GParamSpec   *pspec)
 {
+  const _ExtendedGDBusPropertyInfo *info;
   MprisMediaPlayer2PlayerSkeleton *skeleton = MPRIS_MEDIA_PLAYER2_PLAYER_SKELETON (object);
   g_assert (prop_id != 0 && prop_id - 1 < 10);
+  info = _mpris_media_player2_player_property_info_pointers[prop_id - 1];
   g_mutex_lock (&skeleton->priv->lock);
   g_object_freeze_notify (object);
   if (!_g_value_equal (value, &skeleton->priv->properties[prop_id - 1]))
     {
-      if (g_dbus_interface_skeleton_get_connection (G_DBUS_INTERFACE_SKELETON (skeleton)) != NULL)
-        _mpris_media_player2_player_schedule_emit_changed (skeleton, _mpris_media_player2_player_property_info_pointers[prop_id - 1], prop_id, &skeleton->priv->properties[prop_id - 1]);
+      if (g_dbus_interface_skeleton_get_connection (G_DBUS_INTERFACE_SKELETON (skeleton)) != NULL &&
+          info->emits_changed_signal)
+        _mpris_media_player2_player_schedule_emit_changed (skeleton, info, prop_id, &skeleton->priv->properties[prop_id - 1]);
       g_value_copy (value, &skeleton->priv->properties[prop_id - 1]);
       g_object_notify_by_pspec (object, pspec);
     }
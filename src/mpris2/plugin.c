@@ -38,7 +38,7 @@ static int last_length;
 static const char * image_file;
 static bool_t recheck_image;
 static GVariantType * metadata_type;
-static int update_timer;
+static int update_timer, update_interval;
 
 static bool_t quit_cb (MprisMediaPlayer2 * object, GDBusMethodInvocation * call,
  void * unused)
@@ -204,6 +204,18 @@ static void update_playback_status (void * data, GObject * object)
 
     g_object_set (object, "playback-status", status, NULL);
     update (object);
+
+    /* the position only moves while playing; otherwise just watch the volume */
+    int interval = (aud_drct_get_playing () && ! aud_drct_get_paused ()) ? 250 : 1000;
+
+    if (interval != update_interval)
+    {
+        if (update_timer)
+            g_source_remove (update_timer);
+
+        update_timer = g_timeout_add (interval, (GSourceFunc) update, object);
+        update_interval = interval;
+    }
 }
 
 static void emit_seek (void * data, GObject * object)
@@ -301,6 +313,7 @@ void mpris2_cleanup (void)
     {
         g_source_remove (update_timer);
         update_timer = 0;
+        update_interval = 0;
     }
 
     g_dbus_connection_close_sync (bus, NULL, NULL);
@@ -365,7 +378,6 @@ bool_t mpris2_init (void)
      "can-seek", TRUE,
      NULL);
 
-    update_timer = g_timeout_add (250, (GSourceFunc) update, object_player);
     update_playback_status (NULL, object_player);
 
     if (aud_drct_get_playing () && aud_drct_get_ready ())
@@ -0,0 +1,359 @@
+/*
+ *  Disk cache for the neon HTTP transport.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "cache.h"
+#include "debug.h"
+
+#define CACHE_BLOCK (64 * 1024)
+#define CACHE_MAGIC "AUDNC01"           /* 8 bytes, including the nul */
+
+struct neon_cache {
+    gchar* data_path;
+    gchar* map_path;
+    gint fd;
+    gint64 length;
+    gint64 max_size;
+    gint64 n_blocks;
+    guchar* map;                        /* One bit per complete block */
+    gboolean dirty;                     /* map has blocks not yet saved */
+    gint64 run_start, run_end;          /* Contiguous range written so far */
+};
+
+/* Held while map files are merged and while entries are evicted. */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static gchar* cache_dir(void) {
+    return g_build_filename(g_get_user_cache_dir(), "audacious", "neon", NULL);
+}
+
+#define HAS_BLOCK(c, b) ((c)->map[(b) / 8] & (1 << ((b) % 8)))
+#define SET_BLOCK(c, b) ((c)->map[(b) / 8] |= (1 << ((b) % 8)))
+
+/*
+ * -----
+ */
+
+/*
+ * ORs the blocks recorded in the map file into c->map.  Another handle may
+ * have cached other parts of the same resource since we read it.
+ */
+static void load_map_locked(struct neon_cache* c) {
+
+    FILE* file = g_fopen(c->map_path, "rb");
+    gchar magic[8];
+    gint64 length;
+    gint64 bytes = (c->n_blocks + 7) / 8;
+
+    if (NULL == file)
+        return;
+
+    if (1 == fread(magic, 8, 1, file) && ! memcmp(magic, CACHE_MAGIC, 8) &&
+     1 == fread(&length, sizeof length, 1, file) && length == c->length) {
+        guchar* map = g_malloc(bytes);
+
+        if (1 == fread(map, bytes, 1, file)) {
+            for (gint64 i = 0; i < bytes; i ++)
+                c->map[i] |= map[i];
+        }
+
+        g_free(map);
+    }
+
+    fclose(file);
+}
+
+static void save_map_locked(struct neon_cache* c) {
+
+    gchar* tmp = g_strconcat(c->map_path, ".tmp", NULL);
+    FILE* file = g_fopen(tmp, "wb");
+    gboolean ok = FALSE;
+
+    if (NULL != file) {
+        ok = (1 == fwrite(CACHE_MAGIC, 8, 1, file) &&
+         1 == fwrite(&c->length, sizeof c->length, 1, file) &&
+         1 == fwrite(c->map, (c->n_blocks + 7) / 8, 1, file));
+        ok = (0 == fclose(file)) && ok;
+    }
+
+    if (ok && 0 == g_rename(tmp, c->map_path))
+        c->dirty = FALSE;
+    else {
+        _ERROR("Could not save cache map %s: %s", c->map_path, strerror(errno));
+        g_unlink(tmp);
+    }
+
+    g_free(tmp);
+}
+
+/*
+ * -----
+ */
+
+struct cache_entry {
+    gchar* name;                        /* without the extension */
+    gint64 mtime;                       /* nanoseconds */
+    gint64 size;
+};
+
+static gint compare_mtime(gconstpointer a, gconstpointer b) {
+
+    const struct cache_entry* ea = a;
+    const struct cache_entry* eb = b;
+
+    return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/*
+ * Removes the least recently used entries until the data files take up no
+ * more than max_size bytes on disk.  Using the blocks actually allocated
+ * keeps partially cached entries from counting with their full length.
+ */
+static void evict_locked(const gchar* dir, gint64 max_size) {
+
+    GDir* gdir = g_dir_open(dir, 0, NULL);
+    const gchar* name;
+    GArray* entries;
+    gint64 total = 0;
+
+    if (NULL == gdir)
+        return;
+
+    entries = g_array_new(FALSE, FALSE, sizeof(struct cache_entry));
+
+    while (NULL != (name = g_dir_read_name(gdir))) {
+        if (! g_str_has_suffix(name, ".data"))
+            continue;
+
+        gchar* path = g_build_filename(dir, name, NULL);
+        struct stat st;
+
+        if (0 == stat(path, &st)) {
+            struct cache_entry e = {g_strndup(name, strlen(name) - 5),
+             (gint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec,
+             (gint64) st.st_blocks * 512};
+            g_array_append_val(entries, e);
+            total += e.size;
+        }
+
+        g_free(path);
+    }
+
+    g_dir_close(gdir);
+    g_array_sort(entries, compare_mtime);
+
+    for (guint i = 0; i < entries->len; i ++) {
+        struct cache_entry* e = &g_array_index(entries, struct cache_entry, i);
+
+        if (total > max_size) {
+            _DEBUG("Evicting cache entry %s (%ld bytes)", e->name, (long) e->size);
+
+            gchar* base = g_build_filename(dir, e->name, NULL);
+            gchar* path = g_strconcat(base, ".map", NULL);
+            g_unlink(path);
+            g_free(path);
+            path = g_strconcat(base, ".data", NULL);
+            g_unlink(path);
+            g_free(path);
+            g_free(base);
+
+            total -= e->size;
+        }
+
+        g_free(e->name);
+    }
+
+    g_array_free(entries, TRUE);
+}
+
+/*
+ * -----
+ */
+
+struct neon_cache* cache_open(const gchar* url, const gchar* validator,
+ gint64 length, gint64 max_size) {
+
+    if (length <= 0 || length > max_size)
+        return NULL;
+
+    gchar* dir = cache_dir();
+
+    if (0 != g_mkdir_with_parents(dir, 0700)) {
+        _ERROR("Could not create cache directory %s: %s", dir, strerror(errno));
+        g_free(dir);
+        return NULL;
+    }
+
+    gchar* key = g_strdup_printf("%s\n%s", url, validator);
+    gchar* hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    gchar* base = g_build_filename(dir, hash, NULL);
+    g_free(key);
+    g_free(hash);
+    g_free(dir);
+
+    struct neon_cache* c = g_new0(struct neon_cache, 1);
+    c->data_path = g_strconcat(base, ".data", NULL);
+    c->map_path = g_strconcat(base, ".map", NULL);
+    c->length = length;
+    c->max_size = max_size;
+    c->n_blocks = (length + CACHE_BLOCK - 1) / CACHE_BLOCK;
+    c->map = g_malloc0((c->n_blocks + 7) / 8);
+    c->run_start = c->run_end = -1;
+    g_free(base);
+
+    pthread_mutex_lock(&cache_mutex);
+
+    c->fd = g_open(c->data_path, O_RDWR | O_CREAT, 0600);
+
+    if (c->fd >= 0) {
+        struct stat st;
+
+        if (0 != fstat(c->fd, &st)) {
+            close(c->fd);
+            c->fd = -1;
+        } else if (st.st_size == length) {
+            /* Mark as recently used for eviction. */
+            utime(c->data_path, NULL);
+            load_map_locked(c);
+        } else if (0 != ftruncate(c->fd, length)) {
+            /* Reserved as a sparse file of the full length */
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (c->fd < 0) {
+        _ERROR("Could not open cache file %s: %s", c->data_path, strerror(errno));
+        g_free(c->map);
+        g_free(c->data_path);
+        g_free(c->map_path);
+        g_free(c);
+        return NULL;
+    }
+
+    _DEBUG("Opened cache %s for %s", c->data_path, url);
+    return c;
+}
+
+void cache_close(struct neon_cache* c) {
+
+    struct stat st_fd, st_path;
+    gchar* dir = cache_dir();
+
+    pthread_mutex_lock(&cache_mutex);
+
+    /*
+     * Save the map only if our data file is still the one in the cache;
+     * if it has been evicted meanwhile, a map written now would describe
+     * blocks that are not there.
+     */
+    if (c->dirty && 0 == fstat(c->fd, &st_fd) && 0 == stat(c->data_path, &st_path) &&
+     st_fd.st_ino == st_path.st_ino && st_fd.st_dev == st_path.st_dev) {
+        load_map_locked(c);
+        save_map_locked(c);
+    }
+
+    close(c->fd);
+    evict_locked(dir, c->max_size);
+
+    pthread_mutex_unlock(&cache_mutex);
+
+    g_free(dir);
+    g_free(c->map);
+    g_free(c->data_path);
+    g_free(c->map_path);
+    g_free(c);
+}
+
+gboolean cache_has(struct neon_cache* c, gint64 pos) {
+
+    return (pos >= 0 && pos < c->length && HAS_BLOCK(c, pos / CACHE_BLOCK));
+}
+
+gint64 cache_read(struct neon_cache* c, gint64 pos, void* buf, gint64 len) {
+
+    gint64 done = 0;
+
+    while (done < len && cache_has(c, pos)) {
+        gint64 block_end = MIN((pos / CACHE_BLOCK + 1) * CACHE_BLOCK, c->length);
+        gint64 chunk = MIN(len - done, block_end - pos);
+        gssize got = pread(c->fd, (gchar*)buf + done, chunk, pos);
+
+        if (got <= 0)
+            break;
+
+        done += got;
+        pos += got;
+    }
+
+    return done;
+}
+
+void cache_write(struct neon_cache* c, gint64 pos, const void* buf, gint64 len) {
+
+    gint64 written = 0;
+
+    if (len <= 0 || pos < 0 || pos + len > c->length)
+        return;
+
+    while (written < len) {
+        gssize ret = pwrite(c->fd, (const gchar*)buf + written, len - written, pos + written);
+
+        if (ret <= 0) {
+            /* Probably a full disk; drop the run so nothing gets marked. */
+            c->run_start = c->run_end = -1;
+            return;
+        }
+
+        written += ret;
+    }
+
+    /*
+     * Data arrives in arbitrary pieces, so a block is only marked once a
+     * single run of consecutive writes has covered all of it.
+     */
+    if (pos != c->run_end)
+        c->run_start = pos;
+
+    c->run_end = pos + len;
+
+    gint64 b = (c->run_start + CACHE_BLOCK - 1) / CACHE_BLOCK;
+
+    /* Blocks that ended before this write were settled by earlier calls. */
+    b = MAX(b, pos / CACHE_BLOCK);
+
+    for (; b < c->n_blocks && MIN((b + 1) * CACHE_BLOCK, c->length) <= c->run_end; b ++) {
+        if (! HAS_BLOCK(c, b)) {
+            SET_BLOCK(c, b);
+            c->dirty = TRUE;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ *  Disk cache for the neon HTTP transport.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <glib.h>
+
+/*
+ * Each cached resource is a sparse data file holding the bytes at their
+ * offsets in the resource, and a map file recording which fixed-size
+ * blocks of it are complete.  Entries are named after a hash of the URL and
+ * the validator (ETag or Last-Modified) the server sent, so a changed
+ * resource simply gets a new entry; old ones are evicted least recently
+ * used first once the cache exceeds its size limit.
+ *
+ * A cache object belongs to a single handle and is not locked; only the
+ * shared files are.
+ */
+struct neon_cache;
+
+/* Returns NULL if the resource cannot be cached. */
+struct neon_cache* cache_open(const gchar* url, const gchar* validator,
+ gint64 length, gint64 max_size);
+
+/* Saves the block map and enforces the size limit. */
+void cache_close(struct neon_cache* c);
+
+/* TRUE if the block containing pos is cached. */
+gboolean cache_has(struct neon_cache* c, gint64 pos);
+
+/* Copies up to len cached bytes starting at pos; returns the number copied. */
+gint64 cache_read(struct neon_cache* c, gint64 pos, void* buf, gint64 len);
+
+/* Stores len bytes delivered from the network at pos. */
+void cache_write(struct neon_cache* c, gint64 pos, const void* buf, gint64 len);
+
+#endif
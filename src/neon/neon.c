@@ -29,6 +29,7 @@
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
+#include <audacious/preferences.h>
 #include <libaudcore/audstrings.h>
 
 #include <ne_socket.h>
@@ -41,15 +42,153 @@
 #include "rb.h"
 #include "cert_verification.h"
 
-#define NEON_BUFSIZE        (128u*1024u)
-#define NEON_NETBLKSIZE     (4096u)
+#define NEON_MIN_BUFSIZE_KB 16
+#define NEON_MAX_BUFSIZE_KB 16384
+#define NEON_MAX_NETBLKSIZE_KB 256
 #define NEON_ICY_BUFSIZE    (4096)
+
+/* In adaptive mode, aim for this many reads per second of throughput. */
+#define NEON_READS_PER_SEC 20
+#define NEON_RATE_INTERVAL  250000      /* microseconds */
 #define NEON_RETRY_COUNT 6
+#define NEON_MAX_POOL_SIZE 32
+#define NEON_MAX_CACHE_SIZE_MB 65536
+#define NEON_PREFETCH_SIZE (64 * 1024)
+#define NEON_PREFETCH_TAIL 0            /* slot for the end of the file */
+#define NEON_PREFETCH_AHEAD 1           /* slot for the predicted next seek */
+#define NEON_SESSION_PRIV "audacious-neon"
+
+#define ATOMIC_GET(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define ATOMIC_SET(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+
+static const gchar * const neon_defaults[] = {
+ "buffer_size", "128",                  /* KiB */
+ "read_size", "4",                      /* KiB */
+ "adaptive_read", "TRUE",
+ "pool_size", "4",                      /* idle sessions kept, 0 disables */
+ "pool_timeout", "30",                  /* seconds */
+ "disk_cache", "FALSE",
+ "cache_size", "512",                   /* MiB */
+ "prefetch", "TRUE",
+ NULL};
+
+/*
+ * Idle sessions, kept so that the next request to the same server (the next
+ * track, or a seek in the current one) can reuse the kept-alive connection
+ * instead of doing a new TCP and TLS handshake.  Even if the connection had
+ * to be closed, neon resumes the cached TLS session on reconnect.  A session
+ * is in the pool only while no handle is using it.
+ */
+struct pooled_session {
+    gchar* key;
+    ne_session* session;
+    gint64 idle_since;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GQueue session_pool = G_QUEUE_INIT;     /* most recently used first */
+
+static void pooled_session_free(struct pooled_session* ps) {
+    ne_session_destroy(ps->session);
+    g_free(ps->key);
+    g_free(ps);
+}
+
+/*
+ * Takes expired sessions and those beyond the size limit out of the pool and
+ * returns them in a list, so that they can be destroyed without the lock held.
+ */
+static GList* pool_expire_locked(void) {
+
+    gint size = CLAMP(aud_get_int("neon", "pool_size"), 0, NEON_MAX_POOL_SIZE);
+    gint64 timeout = (gint64) MAX(aud_get_int("neon", "pool_timeout"), 0) * 1000000;
+    gint64 now = g_get_monotonic_time();
+    GList* expired = NULL;
+
+    while (g_queue_get_length(&session_pool) > (guint) size ||
+     (! g_queue_is_empty(&session_pool) &&
+      now - ((struct pooled_session*) g_queue_peek_tail(&session_pool))->idle_since > timeout))
+        expired = g_list_prepend(expired, g_queue_pop_tail(&session_pool));
+
+    return expired;
+}
+
+static void pool_destroy_list(GList* list) {
+    g_list_free_full(list, (GDestroyNotify) pooled_session_free);
+}
+
+static ne_session* pool_acquire(const gchar* key) {
+
+    ne_session* session = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    GList* expired = pool_expire_locked();
+
+    for (GList* node = session_pool.head; node; node = node->next) {
+        struct pooled_session* ps = node->data;
+
+        if (! strcmp(ps->key, key)) {
+            session = ps->session;
+            g_queue_delete_link(&session_pool, node);
+            g_free(ps->key);
+            g_free(ps);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+    pool_destroy_list(expired);
+
+    return session;
+}
+
+/*
+ * Gives the handle's session back to the pool.  Unless the last response was
+ * read to the end, the connection is in an unknown state and is closed first.
+ */
+static void release_session(struct neon_handle* h, gboolean clean) {
+
+    if (NULL == h->session)
+        return;
+
+    if (! clean)
+        ne_close_connection(h->session);
+
+    ne_set_session_private(h->session, NEON_SESSION_PRIV, NULL);
+
+    struct pooled_session* ps = g_new(struct pooled_session, 1);
+    ps->key = h->session_key;
+    ps->session = h->session;
+    ps->idle_since = g_get_monotonic_time();
+
+    h->session = NULL;
+    h->session_key = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    g_queue_push_head(&session_pool, ps);
+    GList* expired = pool_expire_locked();
+    pthread_mutex_unlock(&pool_mutex);
+
+    pool_destroy_list(expired);
+}
+
+static void destroy_session(struct neon_handle* h) {
+
+    if (NULL != h->session) {
+        ne_session_destroy(h->session);
+        h->session = NULL;
+    }
+
+    g_free(h->session_key);
+    h->session_key = NULL;
+}
 
 static gboolean neon_plugin_init(void) {
 
     gint ret;
 
+    aud_config_set_defaults("neon", neon_defaults);
+
     if (0 != (ret = ne_sock_init())) {
         _ERROR("Could not initialize neon library: %d\n", ret);
         return FALSE;
@@ -63,10 +202,24 @@ static gboolean neon_plugin_init(void) {
  */
 
 static void neon_plugin_fini(void) {
+
+    pthread_mutex_lock(&pool_mutex);
+    GList* all = session_pool.head;
+    g_queue_init(&session_pool);
+    pthread_mutex_unlock(&pool_mutex);
+
+    pool_destroy_list(all);
+
     ne_sock_exit();
 }
 
-static struct neon_handle* handle_init(void) {
+static void handle_free(struct neon_handle* h);
+static void stop_prefetch(struct neon_prefetch* p);
+
+/*
+ * Allocates a handle without a ringbuffer, as used for prefetch requests.
+ */
+static struct neon_handle* handle_new(void) {
 
     struct neon_handle* h;
 
@@ -80,15 +233,47 @@ static struct neon_handle* handle_init(void) {
     h->reader_status.reading = FALSE;
     h->reader_status.status = NEON_READER_INIT;
 
-    if (init_rb_with_lock(&(h->rb), NEON_BUFSIZE, &h->reader_status.mutex) != 0)
+    pthread_mutex_init(&h->prefetch_mutex, NULL);
+    pthread_cond_init(&h->prefetch_cond, NULL);
+    h->last_seek = -1;
+
+    h->purl = g_new0(ne_uri, 1);
+    h->content_length = -1;
+    h->icy_metalen = -1;
+
+    return h;
+}
+
+static struct neon_handle* handle_init(void) {
+
+    struct neon_handle* h;
+
+    if (NULL == (h = handle_new()))
+        return NULL;
+
+    gint bufsize = aud_get_int("neon", "buffer_size");
+    bufsize = CLAMP(bufsize, NEON_MIN_BUFSIZE_KB, NEON_MAX_BUFSIZE_KB);
+
+    if (init_rb(&(h->rb), bufsize * 1024u) != 0)
     {
         _ERROR("Could not initialize buffer");
-        g_free(h);
+        handle_free(h);
         return NULL;
     }
 
-    h->purl = g_new0(ne_uri, 1);
-    h->content_length = -1;
+    /*
+     * Reads are kept to a quarter of the buffer or less, so that the
+     * reader thread does not wait for the buffer to drain almost
+     * completely before reading again.
+     */
+    gint blksize = aud_get_int("neon", "read_size");
+    blksize = CLAMP(blksize, 1, NEON_MAX_NETBLKSIZE_KB) * 1024;
+
+    h->max_blksize = aud_get_bool("neon", "adaptive_read") ?
+     NEON_MAX_NETBLKSIZE_KB * 1024 : blksize;
+    h->max_blksize = MIN(h->max_blksize, h->rb.size / 4);
+    h->min_blksize = MIN(blksize, h->max_blksize);
+    h->blksize = h->min_blksize;
 
     return h;
 }
@@ -100,17 +285,27 @@ static struct neon_handle* handle_init(void) {
 static void handle_free(struct neon_handle* h) {
     _DEBUG("<%p> freeing handle", h);
 
+    for (gint i = 0; i < NEON_PREFETCH_SLOTS; i ++)
+        stop_prefetch(&h->prefetch[i]);
+
     ne_uri_free(h->purl);
     g_free(h->purl);
     destroy_rb(&h->rb);
 
     pthread_mutex_destroy(&h->reader_status.mutex);
     pthread_cond_destroy(&h->reader_status.cond);
+    pthread_mutex_destroy(&h->prefetch_mutex);
+    pthread_cond_destroy(&h->prefetch_cond);
 
     g_free(h->icy_metadata.stream_name);
     g_free(h->icy_metadata.stream_title);
     g_free(h->icy_metadata.stream_url);
     g_free(h->icy_metadata.stream_contenttype);
+    if (NULL != h->cache)
+        cache_close(h->cache);
+
+    g_free(h->validator);
+    g_free(h->session_key);
     g_free(h->url);
     g_free(h);
 }
@@ -124,17 +319,22 @@ static gboolean neon_strcmp(const gchar *str, const gchar *cmp)
 }
 
 
+static void set_icy(gchar** field, const gchar* value) {
+    if (NULL == *field || strcmp(*field, value)) {
+        g_free(*field);
+        *field = g_strdup(value);
+    }
+}
+
 static void add_icy(struct icy_metadata* m, gchar* name, gchar* value) {
     if (neon_strcmp(name, "StreamTitle")) {
         _DEBUG("Found StreamTitle: %s", value);
-        g_free(m->stream_title);
-        m->stream_title = g_strdup(value);
+        set_icy(&m->stream_title, value);
     }
 
     if (neon_strcmp(name, "StreamUrl")) {
         _DEBUG("Found StreamUrl: %s", value);
-        g_free(m->stream_url);
-        m->stream_url = g_strdup(value);
+        set_icy(&m->stream_url, value);
     }
 }
 
@@ -227,6 +427,67 @@ static void parse_icy(struct icy_metadata* m, gchar* metadata, gsize len) {
     }
 }
 
+/*
+ * Reads the metadata block due at this point of the stream, once it is all
+ * in the buffer.  Stations mostly send the same block over and over until
+ * the title changes, so a block like the last one is not parsed again.
+ * Returns FALSE if the block has not fully arrived yet; the length byte, if
+ * read, is remembered for the next try.
+ */
+static gboolean read_icy(struct neon_handle* h) {
+    gchar block[NEON_ICY_MAXLEN + 1];
+    guchar len;
+
+    if (h->icy_metalen < 0) {
+        if (0 == used_rb(&h->rb))
+            return FALSE;
+
+        read_rb(&h->rb, &len, 1);
+        h->icy_metalen = len * 16;
+        _DEBUG("<%p> Expecting %d bytes of ICY metadata", h, h->icy_metalen);
+    }
+
+    if (used_rb(&h->rb) < (guint) h->icy_metalen)
+        return FALSE;
+
+    if (h->icy_metalen > 0) {
+        read_rb(&h->rb, block, h->icy_metalen);
+
+        if ((guint) h->icy_metalen != h->icy_prev_len ||
+         memcmp(block, h->icy_prev, h->icy_metalen)) {
+            memcpy(h->icy_prev, block, h->icy_metalen);
+            h->icy_prev_len = h->icy_metalen;
+            block[h->icy_metalen] = '\0';
+            parse_icy(&h->icy_metadata, block, h->icy_metalen);
+        }
+    }
+
+    h->icy_metalen = -1;
+    h->icy_metaleft = h->icy_metaint;
+    return TRUE;
+}
+
+/*
+ * Whether fread() can deliver at least one element, after reading a
+ * metadata block that is due.
+ */
+static gboolean can_deliver(struct neon_handle* h, gint64 size) {
+    if (0 != h->icy_metaint && 0 == h->icy_metaleft && !read_icy(h))
+        return FALSE;
+
+    return used_rb(&h->rb) / size > 0;
+}
+
+/*
+ * -----
+ */
+
+static void wake_other_side(struct neon_handle* h) {
+    pthread_mutex_lock(&h->reader_status.mutex);
+    pthread_cond_broadcast(&h->reader_status.cond);
+    pthread_mutex_unlock(&h->reader_status.mutex);
+}
+
 /*
  * -----
  */
@@ -238,7 +499,7 @@ static void kill_reader(struct neon_handle* h) {
 
     _DEBUG("Signaling reader thread to terminate");
     pthread_mutex_lock(&h->reader_status.mutex);
-    h->reader_status.reading = FALSE;
+    ATOMIC_SET(&h->reader_status.reading, FALSE);
     pthread_cond_broadcast(&h->reader_status.cond);
     pthread_mutex_unlock(&h->reader_status.mutex);
 
@@ -253,11 +514,12 @@ static void kill_reader(struct neon_handle* h) {
 
 static int server_auth_callback(void* userdata, const char* realm, int attempt, char* username, char* password) {
 
-    struct neon_handle* h = (struct neon_handle*)userdata;
+    /* Sessions outlive handles, so look up the one currently using it. */
+    struct neon_handle* h = ne_get_session_private((ne_session*)userdata, NEON_SESSION_PRIV);
     gchar* authcpy;
     gchar** authtok;
 
-    if ((NULL == h->purl->userinfo) || ('\0' == *(h->purl->userinfo))) {
+    if ((NULL == h) || (NULL == h->purl->userinfo) || ('\0' == *(h->purl->userinfo))) {
         _ERROR("Authentication required, but no credentials set");
         return 1;
     }
@@ -300,6 +562,8 @@ static void handle_headers(struct neon_handle* h) {
     void* cursor = NULL;
     long len;
     gchar* endptr;
+    const gchar* etag = NULL;
+    const gchar* last_modified = NULL;
 
     _DEBUG("Header responses:");
     while(NULL != (cursor = ne_response_header_iterate(h->request, cursor, &name, &value))) {
@@ -341,6 +605,22 @@ static void handle_headers(struct neon_handle* h) {
             continue;
         }
 
+        if (neon_strcmp(name, "etag")) {
+            /*
+             * Weak ETags do not promise identical bytes, so they are no
+             * use for validating cached data.
+             */
+            if (! neon_strcmp(value, "W/"))
+                etag = value;
+
+            continue;
+        }
+
+        if (neon_strcmp(name, "last-modified")) {
+            last_modified = value;
+            continue;
+        }
+
         if (neon_strcmp(name, "content-type")) {
             /*
              * The server sent us a content type. Save it for later
@@ -364,6 +644,7 @@ static void handle_headers(struct neon_handle* h) {
                 _DEBUG("ICY MetaInt as advertised by server: %ld", len);
                 h->icy_metaint = len;
                 h->icy_metaleft = len;
+                h->icy_metalen = -1;
             } else {
                 _ERROR("Invalid ICY MetaInt header: %s", value);
             }
@@ -390,6 +671,9 @@ static void handle_headers(struct neon_handle* h) {
 
         continue;
     }
+
+    g_free(h->validator);
+    h->validator = g_strdup(etag ? etag : last_modified);
 }
 
 /*
@@ -431,7 +715,9 @@ static int open_request(struct neon_handle* handle, gulong startbyte) {
         handle->request = ne_request_create(handle->session, "GET", handle->purl->path);
     }
 
-    if (0 < startbyte) {
+    if (0 < handle->range_end) {
+        ne_print_request_header(handle->request, "Range", "bytes=%ld-%ld", startbyte, (long) handle->range_end);
+    } else if (0 < startbyte) {
         ne_print_request_header(handle->request, "Range", "bytes=%ld-", startbyte);
     }
     ne_print_request_header(handle->request, "Icy-MetaData", "1");
@@ -479,6 +765,7 @@ static int open_request(struct neon_handle* handle, gulong startbyte) {
                 _DEBUG("<%p> URL opened OK", handle);
                 handle->content_start = startbyte;
                 handle->pos = startbyte;
+                handle->response_done = FALSE;
                 handle_headers(handle);
                 return 0;
             }
@@ -516,6 +803,44 @@ static int open_request(struct neon_handle* handle, gulong startbyte) {
     return -1;
 }
 
+/*
+ * -----
+ */
+
+static void create_session(struct neon_handle* handle, const gchar* proxy_host,
+ guint proxy_port, gboolean proxy_use_auth) {
+
+    _DEBUG("<%p> Creating session to %s://%s:%d", handle, handle->purl->scheme, handle->purl->host, handle->purl->port);
+    handle->session = ne_session_create(handle->purl->scheme, handle->purl->host, handle->purl->port);
+    ne_set_session_private(handle->session, NEON_SESSION_PRIV, handle);
+    ne_redirect_register(handle->session);
+    ne_add_server_auth(handle->session, NE_AUTH_BASIC, server_auth_callback, (void *)handle->session);
+    ne_set_session_flag(handle->session, NE_SESSFLAG_ICYPROTO, 1);
+    ne_set_session_flag(handle->session, NE_SESSFLAG_PERSIST, aud_get_int("neon", "pool_size") > 0);
+
+#ifdef HAVE_NE_SET_CONNECT_TIMEOUT
+    ne_set_connect_timeout(handle->session, 10);
+#endif
+
+    ne_set_read_timeout(handle->session, 10);
+    ne_set_useragent(handle->session, "Audacious/" PACKAGE_VERSION );
+
+    if (proxy_host) {
+        _DEBUG("<%p> Using proxy: %s:%d", handle, proxy_host, proxy_port);
+        ne_session_proxy(handle->session, proxy_host, proxy_port);
+
+        if (proxy_use_auth) {
+            _DEBUG("<%p> Using proxy authentication", handle);
+            ne_add_proxy_auth(handle->session, NE_AUTH_BASIC, neon_proxy_auth_cb, NULL);
+        }
+    }
+
+    if (! strcmp("https", handle->purl->scheme)) {
+        ne_ssl_trust_default_ca(handle->session);
+        ne_ssl_set_verify(handle->session, neon_vfs_verify_environment_ssl_certs, handle->session);
+    }
+}
+
 /*
  * -----
  */
@@ -549,33 +874,25 @@ static gint open_handle(struct neon_handle* handle, gulong startbyte) {
             handle->purl->port = ne_uri_defaultport(handle->purl->scheme);
         }
 
-        _DEBUG("<%p> Creating session to %s://%s:%d", handle, handle->purl->scheme, handle->purl->host, handle->purl->port);
-        handle->session = ne_session_create(handle->purl->scheme, handle->purl->host, handle->purl->port);
-        ne_redirect_register(handle->session);
-        ne_add_server_auth(handle->session, NE_AUTH_BASIC, server_auth_callback, (void *)handle);
-        ne_set_session_flag(handle->session, NE_SESSFLAG_ICYPROTO, 1);
-        ne_set_session_flag(handle->session, NE_SESSFLAG_PERSIST, 0);
-
-#ifdef HAVE_NE_SET_CONNECT_TIMEOUT
-        ne_set_connect_timeout(handle->session, 10);
-#endif
-
-        ne_set_read_timeout(handle->session, 10);
-        ne_set_useragent(handle->session, "Audacious/" PACKAGE_VERSION );
-
-        if (use_proxy) {
-            _DEBUG("<%p> Using proxy: %s:%d", handle, proxy_host, proxy_port);
-            ne_session_proxy(handle->session, proxy_host, proxy_port);
-
-            if (proxy_use_auth) {
-                _DEBUG("<%p> Using proxy authentication", handle);
-                ne_add_proxy_auth(handle->session, NE_AUTH_BASIC, neon_proxy_auth_cb, (void *)handle);
-            }
-        }
+        /*
+         * Everything that determines how the session talks to the server
+         * goes into the key, so that a pooled session is only reused
+         * where a new one would behave the same.
+         */
+        handle->session_key = g_strdup_printf("%s://%s@%s:%u %s:%u %d",
+         handle->purl->scheme, handle->purl->userinfo ? handle->purl->userinfo : "",
+         handle->purl->host, handle->purl->port, proxy_host ? proxy_host : "",
+         proxy_port, proxy_use_auth);
 
-        if (! strcmp("https", handle->purl->scheme)) {
-            ne_ssl_trust_default_ca(handle->session);
-            ne_ssl_set_verify(handle->session, neon_vfs_verify_environment_ssl_certs, handle->session);
+        if (NULL != (handle->session = pool_acquire(handle->session_key))) {
+            /*
+             * If the server has dropped the idle connection meanwhile,
+             * neon notices and retries the request on a new one.
+             */
+            _DEBUG("<%p> Reusing session to %s://%s:%d", handle, handle->purl->scheme, handle->purl->host, handle->purl->port);
+            ne_set_session_private(handle->session, NEON_SESSION_PRIV, handle);
+        } else {
+            create_session(handle, proxy_host, proxy_port, proxy_use_auth);
         }
 
         _DEBUG("<%p> Creating request", handle);
@@ -588,15 +905,14 @@ static gint open_handle(struct neon_handle* handle, gulong startbyte) {
         }
         else if (ret == -1)
         {
-            ne_session_destroy(handle->session);
-            handle->session = NULL;
+            destroy_session(handle);
             g_free (proxy_host);
             return -1;
         }
 
+        /* The redirect response has been read completely. */
         _DEBUG("<%p> Following redirect...", handle);
-        ne_session_destroy(handle->session);
-        handle->session = NULL;
+        release_session(handle, TRUE);
     }
 
     /*
@@ -614,18 +930,301 @@ static gint open_handle(struct neon_handle* handle, gulong startbyte) {
  * -----
  */
 
+/*
+ * Only seekable resources of known length whose version the server
+ * identifies are cached: the length lays out the cache file, Range requests
+ * fetch what is missing, and the validator tells whether cached data is
+ * still current.  The original URL is used as key, since redirects often
+ * lead to short-lived signed URLs.
+ */
+static void open_cache(struct neon_handle* h) {
+
+    if (! aud_get_bool("neon", "disk_cache") || ! h->can_ranges ||
+     0 != h->content_start || 0 >= h->content_length || 0 != h->icy_metaint ||
+     NULL == h->validator)
+        return;
+
+    gint max_size = CLAMP(aud_get_int("neon", "cache_size"), 1, NEON_MAX_CACHE_SIZE_MB);
+    h->cache = cache_open(h->url, h->validator, h->content_length, (gint64) max_size << 20);
+}
+
+/*
+ * Stops reading from the network and drops the buffered data.
+ */
+static void stop_network(struct neon_handle* h) {
+
+    if (h->reader_status.reading)
+        kill_reader(h);
+
+    if (NULL != h->request) {
+        ne_request_destroy(h->request);
+        h->request = NULL;
+    }
+
+    /* A new request will most likely get the same session back. */
+    release_session(h, h->response_done);
+    reset_rb(&h->rb);
+}
+
+/*
+ * -----
+ */
+
+/*
+ * Fetches one prefetch range over a session of its own, so that it runs in
+ * parallel to the main request.  The bounded range lets the response end
+ * cleanly and the session go back to the pool with its connection open.
+ */
+static gpointer prefetch_thread(void* data) {
+
+    struct neon_prefetch* p = (struct neon_prefetch*)data;
+    struct neon_handle* h = p->owner;
+    struct neon_handle* ph = handle_new();
+    gboolean ok = FALSE;
+
+    if (NULL != ph) {
+        ph->url = g_strdup(h->url);
+        ph->range_end = p->start + p->length - 1;
+
+        /* A server that ignores the Range header would send the whole file. */
+        ok = (0 == open_handle(ph, p->start) && 206 == ne_get_status(ph->request)->code);
+    }
+
+    while (ok) {
+        gint64 filled;
+
+        pthread_mutex_lock(&h->prefetch_mutex);
+        ok = ! p->cancel;
+        filled = p->filled;
+        pthread_mutex_unlock(&h->prefetch_mutex);
+
+        if (! ok || filled == p->length)
+            break;
+
+        gssize got = ne_read_response_block(ph->request, p->data + filled, p->length - filled);
+
+        if (0 >= got)
+            break;
+
+        pthread_mutex_lock(&h->prefetch_mutex);
+        p->filled += got;
+        pthread_cond_broadcast(&h->prefetch_cond);
+        pthread_mutex_unlock(&h->prefetch_mutex);
+    }
+
+    if (NULL != ph) {
+        if (NULL != ph->request) {
+            if (p->filled == p->length && NE_OK == ne_end_request(ph->request))
+                ph->response_done = TRUE;
+
+            ne_request_destroy(ph->request);
+            ph->request = NULL;
+        }
+
+        release_session(ph, ph->response_done);
+        handle_free(ph);
+    }
+
+    _DEBUG("<%p> Prefetch of %ld bytes at %ld finished", h, (long) p->filled, (long) p->start);
+
+    pthread_mutex_lock(&h->prefetch_mutex);
+    p->finished = TRUE;
+    pthread_cond_broadcast(&h->prefetch_cond);
+    pthread_mutex_unlock(&h->prefetch_mutex);
+
+    return NULL;
+}
+
+static void stop_prefetch(struct neon_prefetch* p) {
+
+    if (! p->active)
+        return;
+
+    pthread_mutex_lock(&p->owner->prefetch_mutex);
+    p->cancel = TRUE;
+    pthread_mutex_unlock(&p->owner->prefetch_mutex);
+
+    pthread_join(p->thread, NULL);
+
+    g_free(p->data);
+    p->data = NULL;
+    p->active = FALSE;
+}
+
+/*
+ * Starts fetching the given range into a prefetch slot, unless it is
+ * already there, in the disk cache, or (mostly) outside the file.
+ */
+static void start_prefetch(struct neon_handle* h, gint slot, gint64 start, gint64 length) {
+
+    struct neon_prefetch* p = &h->prefetch[slot];
+    gint64 total = h->content_start + h->content_length;
+
+    if (! aud_get_bool("neon", "prefetch") || ! h->can_ranges || 0 > h->content_length ||
+     0 != h->icy_metaint)
+        return;
+
+    length = MIN(length, total - start);
+
+    if (0 > start || 0 >= length)
+        return;
+
+    if (p->active && p->start <= start && start + length <= p->start + p->length)
+        return;
+
+    if (NULL != h->cache && cache_has(h->cache, start) && cache_has(h->cache, start + length - 1))
+        return;
+
+    stop_prefetch(p);
+
+    _DEBUG("<%p> Prefetching %ld bytes at %ld", h, (long) length, (long) start);
+
+    p->owner = h;
+    p->start = start;
+    p->length = length;
+    p->data = g_malloc(length);
+    p->filled = 0;
+    p->finished = FALSE;
+    p->cancel = FALSE;
+
+    if (0 != pthread_create(&p->thread, NULL, prefetch_thread, p)) {
+        g_free(p->data);
+        p->data = NULL;
+        return;
+    }
+
+    p->active = TRUE;
+}
+
+/*
+ * Returns the prefetch slot that has or will have the byte at pos.
+ */
+static struct neon_prefetch* find_prefetch(struct neon_handle* h, gint64 pos) {
+
+    for (gint i = 0; i < NEON_PREFETCH_SLOTS; i ++) {
+        struct neon_prefetch* p = &h->prefetch[i];
+        gboolean found;
+
+        if (! p->active || pos < p->start || pos >= p->start + p->length)
+            continue;
+
+        pthread_mutex_lock(&h->prefetch_mutex);
+        found = (p->filled > pos - p->start || ! p->finished);
+        pthread_mutex_unlock(&h->prefetch_mutex);
+
+        if (found)
+            return p;
+    }
+
+    return NULL;
+}
+
+/*
+ * Copies prefetched data at h->pos, waiting for it to arrive if necessary.
+ */
+static gint64 read_prefetched(struct neon_handle* h, void* ptr, gint64 bytes) {
+
+    struct neon_prefetch* p = find_prefetch(h, h->pos);
+    gint64 offset, avail;
+
+    if (NULL == p)
+        return 0;
+
+    offset = h->pos - p->start;
+
+    pthread_mutex_lock(&h->prefetch_mutex);
+
+    while (p->filled <= offset && ! p->finished)
+        pthread_cond_wait(&h->prefetch_cond, &h->prefetch_mutex);
+
+    avail = p->filled - offset;
+    pthread_mutex_unlock(&h->prefetch_mutex);
+
+    if (0 >= avail)
+        return 0;
+
+    bytes = MIN(bytes, avail);
+    memcpy(ptr, p->data + offset, bytes);
+
+    return bytes;
+}
+
+/*
+ * Decoders probing for tags read the start of the file, then the end, then
+ * seek back: the end is fetched as soon as the file is opened.  Beyond
+ * that, two seeks by the same distance are taken as a pattern, and the
+ * next target is fetched ahead.
+ */
+static void predict_seek(struct neon_handle* h, gint64 newpos) {
+
+    gint64 stride = newpos - h->last_seek;
+
+    if (0 <= h->last_seek && 0 != stride && stride == h->seek_stride)
+        start_prefetch(h, NEON_PREFETCH_AHEAD, newpos + stride, NEON_PREFETCH_SIZE);
+
+    h->seek_stride = stride;
+    h->last_seek = newpos;
+}
+
+/*
+ * -----
+ */
+
+/*
+ * Adaptive read size: measure the throughput over short intervals and size
+ * the reads so that there are about NEON_READS_PER_SEC of them per second,
+ * twice as large while the buffer is less than a quarter full.  Fast
+ * streams then need far fewer calls into neon, while slow ones keep small
+ * reads and thus low latency.
+ */
+static void adapt_blksize(struct neon_handle* h, guint bytes) {
+
+    gint64 now = g_get_monotonic_time();
+
+    if (! h->rate_time)
+        h->rate_time = now;
+
+    h->rate_bytes += bytes;
+
+    if (now - h->rate_time < NEON_RATE_INTERVAL)
+        return;
+
+    guint64 rate = (guint64) h->rate_bytes * 1000000 / (now - h->rate_time);
+    guint64 target = rate / NEON_READS_PER_SEC;
+
+    if (used_rb(&h->rb) < h->rb.size / 4)
+        target *= 2;
+
+    /* round to whole KiB */
+    target = (target + 1023) & ~(guint64) 1023;
+    h->blksize = CLAMP(target, h->min_blksize, h->max_blksize);
+
+    _DEBUG("<%p> %d bytes/s, read size now %d", h, (gint) rate, (gint) h->blksize);
+
+    h->rate_time = now;
+    h->rate_bytes = 0;
+}
+
 static gint fill_buffer(struct neon_handle* h) {
 
     gssize bsize;
-    gchar buffer[NEON_NETBLKSIZE];
+    gchar* buffer;
     gssize to_read;
 
-    bsize = free_rb(&h->rb);
-    to_read = MIN(bsize, NEON_NETBLKSIZE);
+    /* Read straight into the free space at the write position. */
+    to_read = MIN(write_space_rb(&h->rb, &buffer), h->blksize);
+
+    if (0 == to_read)
+        return 0;
 
     if (0 >= (bsize = ne_read_response_block(h->request, buffer, to_read))) {
         if (0 == bsize) {
             _DEBUG("<%p> End of file encountered", h);
+
+            /* Finish the response so that the connection can be reused. */
+            if (NE_OK == ne_end_request(h->request))
+                h->response_done = TRUE;
+
             return 1;
         } else {
             _ERROR ("<%p> Error while reading from the network", (void *) h);
@@ -637,10 +1236,10 @@ static gint fill_buffer(struct neon_handle* h) {
 
     _DEBUG("<%p> Read %d bytes of %d", h, (gint) bsize, (gint) to_read);
 
-    if (0 != write_rb(&(h->rb), buffer, bsize)) {
-        _ERROR ("<%p> Error putting data into buffer", (void *) h);
-        return -1;
-    }
+    commit_write_rb(&h->rb, bsize);
+
+    if (h->min_blksize < h->max_blksize)
+        adapt_blksize(h, bsize);
 
     return 0;
 }
@@ -654,23 +1253,14 @@ static gpointer reader_thread(void* data) {
     struct neon_handle* h = (struct neon_handle*)data;
     gint ret;
 
-    pthread_mutex_lock(&h->reader_status.mutex);
-
-    while(h->reader_status.reading) {
+    while(ATOMIC_GET(&h->reader_status.reading)) {
 
         /*
-         * Hit the network only if we have more than NEON_NETBLKSIZE of free buffer
+         * Hit the network only if we have more than one read block of free buffer
          */
-        if (NEON_NETBLKSIZE < free_rb_locked(&h->rb)) {
-            pthread_mutex_unlock(&h->reader_status.mutex);
-
+        if (h->blksize < free_rb(&h->rb)) {
             ret = fill_buffer(h);
 
-            pthread_mutex_lock(&h->reader_status.mutex);
-
-            /* Wake up main thread if it is waiting. */
-            pthread_cond_broadcast(&h->reader_status.cond);
-
             if (-1 == ret) {
                 /*
                  * Error encountered while reading from the network.
@@ -679,7 +1269,9 @@ static gpointer reader_thread(void* data) {
                  */
                 _ERROR ("<%p> Error while reading from the network. "
                  "Terminating reader thread", (void *) h);
-                h->reader_status.status = NEON_READER_ERROR;
+                pthread_mutex_lock(&h->reader_status.mutex);
+                ATOMIC_SET(&h->reader_status.status, NEON_READER_ERROR);
+                pthread_cond_broadcast(&h->reader_status.cond);
                 pthread_mutex_unlock(&h->reader_status.mutex);
                 return NULL;
             } else if (1 == ret) {
@@ -688,21 +1280,37 @@ static gpointer reader_thread(void* data) {
                  * network. Set the EOF status and exit.
                  */
                 _DEBUG("<%p> EOF encountered while reading from the network. Terminating reader thread", h);
-                h->reader_status.status = NEON_READER_EOF;
+                pthread_mutex_lock(&h->reader_status.mutex);
+                ATOMIC_SET(&h->reader_status.status, NEON_READER_EOF);
+                pthread_cond_broadcast(&h->reader_status.cond);
                 pthread_mutex_unlock(&h->reader_status.mutex);
                 return NULL;
             }
+
+            /* Wake up main thread if it is waiting. */
+            if (ATOMIC_GET(&h->reader_status.consumer_waiting))
+                wake_other_side(h);
         } else {
             /*
              * Not enough free space in the buffer.
-             * Sleep until the main thread wakes us up.
+             * Sleep until the main thread wakes us up.  The flag is
+             * raised before the buffer is checked again, so a read
+             * that frees space in between is sure to see it.
              */
-            pthread_cond_wait(&h->reader_status.cond, &h->reader_status.mutex);
+            pthread_mutex_lock(&h->reader_status.mutex);
+            ATOMIC_SET(&h->reader_status.reader_waiting, TRUE);
+
+            while (h->reader_status.reading && h->blksize >= free_rb(&h->rb))
+                pthread_cond_wait(&h->reader_status.cond, &h->reader_status.mutex);
+
+            ATOMIC_SET(&h->reader_status.reader_waiting, FALSE);
+            pthread_mutex_unlock(&h->reader_status.mutex);
         }
     }
 
     _DEBUG("<%p> Reader thread terminating gracefully", h);
-    h->reader_status.status = NEON_READER_TERM;
+    pthread_mutex_lock(&h->reader_status.mutex);
+    ATOMIC_SET(&h->reader_status.status, NEON_READER_TERM);
     pthread_mutex_unlock(&h->reader_status.mutex);
 
     return NULL;
@@ -734,6 +1342,22 @@ void * neon_vfs_fopen_impl (const gchar * path, const gchar * mode)
         return NULL;
     }
 
+    open_cache(handle);
+
+    /*
+     * The request has only served to validate the cache; the body will
+     * come from disk.
+     */
+    if (NULL != handle->cache && cache_has(handle->cache, 0)) {
+        _DEBUG("<%p> Reading from disk cache", handle);
+        stop_network(handle);
+        handle->from_local = TRUE;
+    }
+
+    if (handle->content_length > 2 * NEON_PREFETCH_SIZE)
+        start_prefetch(handle, NEON_PREFETCH_TAIL,
+         handle->content_length - NEON_PREFETCH_SIZE, NEON_PREFETCH_SIZE);
+
     return handle;
 }
 
@@ -753,10 +1377,8 @@ gint neon_vfs_fclose_impl(VFSFile* file) {
         ne_request_destroy(h->request);
     }
 
-    _DEBUG("<%p> Destroying session", h);
-    if (NULL != h->session) {
-        ne_session_destroy(h->session);
-    }
+    _DEBUG("<%p> Releasing session", h);
+    release_session(h, h->response_done);
 
     handle_free(h);
 
@@ -767,17 +1389,69 @@ gint neon_vfs_fclose_impl(VFSFile* file) {
  * -----
  */
 
+/*
+ * Serves a read from prefetched data or the disk cache.  Where neither has
+ * the data at the current position, a Range request is opened there and the
+ * caller goes on reading from the network.
+ */
+static gint64 read_local(struct neon_handle* h, void* ptr, gint64 size, gint64 nmemb) {
+
+    gint64 total = h->content_start + h->content_length;
+    gint64 relem = read_prefetched(h, ptr, size * nmemb) / size;
+    gchar* validator;
+
+    if (0 < relem) {
+        if (NULL != h->cache)
+            cache_write(h->cache, h->pos, ptr, relem * size);
+    } else if (NULL != h->cache) {
+        relem = cache_read(h->cache, h->pos, ptr, size * nmemb) / size;
+    }
+
+    if (0 < relem) {
+        h->pos += relem * size;
+
+        if (h->pos >= total)
+            h->eof = TRUE;
+
+        return relem;
+    }
+
+    h->from_local = FALSE;
+
+    if (h->pos >= total) {
+        h->eof = TRUE;
+        return 0;
+    }
+
+    _DEBUG("<%p> Local data ends at %ld, continuing from the network", h, h->pos);
+    validator = g_strdup(h->validator);
+
+    if (0 != open_handle(h, h->pos)) {
+        _ERROR ("<%p> Error while creating new request!", (void *) h);
+        h->request = NULL;
+    } else if (NULL != h->cache && (NULL == h->validator || strcmp(validator, h->validator))) {
+        /* The resource has changed on the server; stop caching it. */
+        _DEBUG("<%p> Resource changed, disabling cache", h);
+        cache_close(h->cache);
+        h->cache = NULL;
+    }
+
+    g_free(validator);
+    return 0;
+}
+
 static gint64 neon_fread_real (void * ptr_, gint64 size, gint64 nmemb,
  VFSFile * file)
 {
     struct neon_handle* h = (struct neon_handle*)vfs_get_handle (file);
-    gint belem;
-    gint relem;
+    gint64 relem;
+    gint64 done;
     gint ret;
-    gchar icy_metadata[NEON_ICY_BUFSIZE];
-    guchar icy_metalen;
     gint retries;
 
+    if (h->from_local && 0 < (ret = read_local(h, ptr_, size, nmemb)))
+        return ret;
+
     if (NULL == h->request) {
         _ERROR ("<%p> No request to read from, seek gone wrong?", (void *) h);
         return 0;
@@ -791,12 +1465,19 @@ static gint64 neon_fread_real (void * ptr_, gint64 size, gint64 nmemb,
 
     for (retries = 0; retries < NEON_RETRY_COUNT; retries ++)
     {
-        if (used_rb_locked(&h->rb) / size > 0 || !h->reader_status.reading ||
-         h->reader_status.status != NEON_READER_RUN)
+        if (!h->reader_status.reading || h->reader_status.status != NEON_READER_RUN)
+            break;
+
+        /* Raise the flag first, then look at the buffer (see reader_thread). */
+        ATOMIC_SET(&h->reader_status.consumer_waiting, TRUE);
+
+        if (can_deliver(h, size)) {
+            ATOMIC_SET(&h->reader_status.consumer_waiting, FALSE);
             break;
+        }
 
-        pthread_cond_broadcast(&h->reader_status.cond);
         pthread_cond_wait(&h->reader_status.cond, &h->reader_status.mutex);
+        ATOMIC_SET(&h->reader_status.consumer_waiting, FALSE);
     }
 
     pthread_mutex_unlock(&h->reader_status.mutex);
@@ -871,7 +1552,7 @@ static gint64 neon_fread_real (void * ptr_, gint64 size, gint64 nmemb,
                  * If there still is data in the buffer, carry on.
                  * If not, terminate the reader thread and return 0.
                  */
-                if (0 == used_rb_locked(&h->rb)) {
+                if (0 == used_rb(&h->rb)) {
                     _DEBUG("<%p> Reached end of stream", h);
                     pthread_mutex_unlock(&h->reader_status.mutex);
 
@@ -908,70 +1589,49 @@ static gint64 neon_fread_real (void * ptr_, gint64 size, gint64 nmemb,
         return 0;
     }
 
-    if (0 != h->icy_metaint) {
-        if (0 == h->icy_metaleft) {
-            /*
-             * The next data in the buffer is a ICY metadata announcement.
-             * Get the length byte
-             */
-            read_rb(&h->rb, &icy_metalen, 1);
+    /*
+     * Audio goes straight from the buffer to the caller, span by span
+     * between metadata blocks, until the request is met or the buffer runs
+     * dry (or holds only part of the next metadata block).
+     */
+    for (done = 0; done < nmemb; done += relem) {
+        if (0 != h->icy_metaint && 0 == h->icy_metaleft && !read_icy(h))
+            break;
 
-            /*
-             * We need enough data in the buffer to
-             * a) Read the complete ICY metadata block
-             * b) deliver at least one byte to the reader
-             */
-            _DEBUG("<%p> Expecting %d bytes of ICY metadata", h, (icy_metalen*16));
+        guint avail = used_rb(&h->rb);
 
-            if ((free_rb(&h->rb)-(icy_metalen*16)) < size) {
-                /* There is not enough data. We do not have much choice at this point,
-                 * so we'll deliver the metadata as normal data to the reader and
-                 * hope for the best.
-                 */
-                _ERROR ("<%p> Buffer underrun when reading metadata. Expect "
-                 "audio degradation", (void *) h);
-                h->icy_metaleft = h->icy_metaint + (icy_metalen*16);
-            } else {
-                /*
-                 * Grab the metadata from the buffer and send it to the parser
-                 */
-                read_rb(&h->rb, icy_metadata, (icy_metalen*16));
-                parse_icy(&h->icy_metadata, icy_metadata, (icy_metalen*16));
-                h->icy_metaleft = h->icy_metaint;
-            }
-        }
+        if (0 != h->icy_metaint)
+            avail = MIN(avail, h->icy_metaleft);
 
-        /*
-         * The maximum number of bytes we can deliver is determined
-         * by the number of bytes left until the next metadata announcement
-         */
-        belem = MIN(used_rb(&h->rb), h->icy_metaleft) / size;
-    } else {
-        belem = used_rb(&h->rb) / size;
-    }
+        if (0 == (relem = MIN(avail / size, nmemb - done)))
+            break;
+
+        gchar* out = (gchar*)ptr_ + done*size;
+        read_rb(&h->rb, out, relem*size);
 
-    relem = MIN(belem, nmemb);
-    read_rb(&h->rb, ptr_, relem*size);
+        if (NULL != h->cache)
+            cache_write(h->cache, h->pos, out, relem*size);
+
+        h->pos += (relem*size);
+
+        if (0 != h->icy_metaint)
+            h->icy_metaleft -= (relem*size);
+    }
 
     /*
-     * Signal the network thread to continue reading
+     * Signal the network thread to continue reading, if it is
+     * waiting for space
      */
-    pthread_mutex_lock(&h->reader_status.mutex);
-    if (NEON_READER_EOF == h->reader_status.status) {
-        if (0 == free_rb_locked(&h->rb)) {
+    if (NEON_READER_EOF == ATOMIC_GET(&h->reader_status.status)) {
+        if (0 == used_rb(&h->rb)) {
             _DEBUG("<%p> stream EOF reached and buffer empty", h);
             h->eof = TRUE;
         }
     }
-    else
-        pthread_cond_broadcast(&h->reader_status.cond);
-
-    pthread_mutex_unlock(&h->reader_status.mutex);
+    else if (ATOMIC_GET(&h->reader_status.reader_waiting))
+        wake_other_side(h);
 
-    h->pos += (relem*size);
-    h->icy_metaleft -= (relem*size);
-
-    return relem;
+    return done;
 }
 
 /* neon_fread_real will do only a partial read if the buffer underruns, so we
@@ -1104,19 +1764,20 @@ gint neon_vfs_fseek_impl (VFSFile * file, gint64 offset, gint whence)
      * - stop the current reader thread, if there is one
      * - destroy the current request
      * - dump all data currently in the ringbuffer
-     * - create a new request starting at newpos
+     * - read prefetched or cached data, or create a new request starting at newpos
      */
-    if (h->reader_status.reading)
-        kill_reader(h);
-
-    if (NULL != h->request) {
-        ne_request_destroy(h->request);
-    }
-    if (NULL != h->session) {
-        ne_session_destroy(h->session);
-        h->session = NULL;
+    stop_network(h);
+    predict_seek(h, newpos);
+
+    if ((NULL != h->cache && cache_has(h->cache, newpos)) || NULL != find_prefetch(h, newpos)) {
+        _DEBUG("<%p> Seeking within prefetched or cached data", h);
+        h->pos = newpos;
+        h->from_local = TRUE;
+        h->eof = FALSE;
+        return 0;
     }
-    reset_rb(&h->rb);
+
+    h->from_local = FALSE;
 
     if (0 != open_handle(h, newpos)) {
         /*
@@ -1153,6 +1814,8 @@ gchar *neon_vfs_metadata_impl(VFSFile* file, const gchar* field) {
         return str_to_utf8 (h->icy_metadata.stream_contenttype);
     if (! strcmp (field, "content-bitrate"))
         return g_strdup_printf ("%d", h->icy_metadata.stream_bitrate * 1000);
+    if (! strcmp (field, "buffer-fill"))
+        return g_strdup_printf ("%d", (gint) ((guint64) used_rb (&h->rb) * 100 / h->rb.size));
 
     return NULL;
 }
@@ -1173,6 +1836,37 @@ gint64 neon_vfs_fsize_impl (VFSFile * file)
     return (h->content_start + h->content_length);
 }
 
+static const PreferencesWidget neon_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Buffering</b>")},
+ {WIDGET_SPIN_BTN, N_("Buffer size:"),
+  .cfg_type = VALUE_INT, .csect = "neon", .cname = "buffer_size",
+  .data = {.spin_btn = {NEON_MIN_BUFSIZE_KB, NEON_MAX_BUFSIZE_KB, 16, N_("KiB")}}},
+ {WIDGET_SPIN_BTN, N_("Network read size:"),
+  .cfg_type = VALUE_INT, .csect = "neon", .cname = "read_size",
+  .data = {.spin_btn = {1, NEON_MAX_NETBLKSIZE_KB, 1, N_("KiB")}}},
+ {WIDGET_CHK_BTN, N_("Grow read size with stream throughput"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "neon", .cname = "adaptive_read"},
+ {WIDGET_LABEL, N_("Changes apply to streams opened afterwards.")},
+ {WIDGET_LABEL, N_("<b>Connections</b>")},
+ {WIDGET_SPIN_BTN, N_("Keep up to"),
+  .cfg_type = VALUE_INT, .csect = "neon", .cname = "pool_size",
+  .data = {.spin_btn = {0, NEON_MAX_POOL_SIZE, 1, N_("idle connections")}}},
+ {WIDGET_SPIN_BTN, N_("for"),
+  .cfg_type = VALUE_INT, .csect = "neon", .cname = "pool_timeout",
+  .data = {.spin_btn = {1, 300, 1, N_("seconds")}}},
+ {WIDGET_CHK_BTN, N_("Fetch the end of files and predicted seek targets ahead"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "neon", .cname = "prefetch"},
+ {WIDGET_LABEL, N_("<b>Disk Cache</b>")},
+ {WIDGET_CHK_BTN, N_("Keep downloaded files for seeking and replay"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "neon", .cname = "disk_cache"},
+ {WIDGET_SPIN_BTN, N_("Cache size:"),
+  .cfg_type = VALUE_INT, .csect = "neon", .cname = "cache_size", .child = TRUE,
+  .data = {.spin_btn = {1, NEON_MAX_CACHE_SIZE_MB, 64, N_("MiB")}}}};
+
+static const PluginPreferences neon_prefs = {
+ .widgets = neon_widgets,
+ .n_widgets = G_N_ELEMENTS (neon_widgets)};
+
 static const gchar * const neon_schemes[] = {"http", "https", NULL};
 
 static VFSConstructor constructor = {
@@ -1192,6 +1886,7 @@ AUD_TRANSPORT_PLUGIN
 (
  .name = N_("Neon HTTP/HTTPS Plugin"),
  .domain = PACKAGE,
+ .prefs = & neon_prefs,
  .schemes = neon_schemes,
  .init = neon_plugin_init,
  .cleanup = neon_plugin_fini,
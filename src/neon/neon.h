@@ -28,6 +28,7 @@
 #include <ne_request.h>
 #include <ne_uri.h>
 #include "rb.h"
+#include "cache.h"
 
 typedef enum {
     NEON_READER_INIT=0,
@@ -37,11 +38,39 @@ typedef enum {
     NEON_READER_TERM
 } neon_reader_t;
 
+/*
+ * The ringbuffer itself needs no lock.  The mutex and condition only serve
+ * to put one side to sleep when the buffer is full (reader thread) or empty
+ * (fread), and each side raises its *_waiting flag while it sleeps, so that
+ * the other side takes the mutex only when there is someone to wake.
+ */
 struct reader_status {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     gboolean reading;
     neon_reader_t status;
+    gboolean reader_waiting;            /* Reader thread is waiting for free space */
+    gboolean consumer_waiting;          /* fread() is waiting for data */
+};
+
+#define NEON_PREFETCH_SLOTS 2
+
+#define NEON_ICY_MAXLEN (255 * 16)      /* Longest ICY metadata block */
+
+/*
+ * A byte range fetched ahead by a separate request, in the hope that the
+ * decoder will seek there.  filled and finished are guarded by
+ * neon_handle.prefetch_mutex.
+ */
+struct neon_prefetch {
+    struct neon_handle* owner;
+    gboolean active;                    /* Thread started, data allocated */
+    pthread_t thread;
+    gint64 start, length;
+    gchar* data;
+    gint64 filled;                      /* Bytes of data received so far */
+    gboolean finished;                  /* No more data will arrive */
+    gboolean cancel;
 };
 
 struct icy_metadata {
@@ -63,12 +92,30 @@ struct neon_handle {
     gboolean can_ranges;                /* TRUE if the webserver advertised accept-range: bytes */
     gulong icy_metaint;                 /* Interval in which the server will send metadata announcements. 0 if no announcments */
     gulong icy_metaleft;                /* Bytes left until the next metadata block */
+    gint icy_metalen;                   /* Length of the metadata block due, -1 until its length byte is read */
     struct icy_metadata icy_metadata;   /* Current ICY metadata */
+    guint icy_prev_len;                 /* The last metadata block parsed, to skip repeats */
+    gchar icy_prev[NEON_ICY_MAXLEN];
     ne_session* session;
+    gchar* session_key;                 /* Pool key of the session (server, credentials, proxy) */
+    gboolean response_done;             /* Response fully read, connection can be reused */
     ne_request* request;
     pthread_t reader;
     struct reader_status reader_status;
     gboolean eof;
+    gchar* validator;                   /* ETag or Last-Modified of the response, if any */
+    struct neon_cache* cache;           /* Disk cache for this resource, or NULL */
+    gboolean from_local;                /* Reading from prefetched data or the cache, no request open */
+    gint64 range_end;                   /* Last byte to request, if > 0 */
+    struct neon_prefetch prefetch[NEON_PREFETCH_SLOTS];
+    pthread_mutex_t prefetch_mutex;
+    pthread_cond_t prefetch_cond;
+    gint64 last_seek;                   /* Target of the last seek, -1 if none */
+    gint64 seek_stride;                 /* Distance between the last two seek targets */
+    guint blksize;                      /* Current network read size */
+    guint min_blksize, max_blksize;     /* Range for blksize (equal unless adaptive) */
+    gint64 rate_time;                   /* Start of the current throughput measurement */
+    guint rate_bytes;                   /* Bytes read since rate_time */
 };
 
 
@@ -23,6 +23,9 @@
 #include "rb.h"
 #include "debug.h"
 
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+
 #ifdef RB_DEBUG
 /*
  * An internal assertion function to make sure that the
@@ -33,15 +36,16 @@
  */
 static void _assert_rb(struct ringbuf* rb) {
 
-    unsigned int realused;
+    unsigned int used;
 
     _ENTER;
 
-    _DEBUG("rb->buf=%p, rb->end=%p, rb->wp=%p, rb->rp=%p, rb->free=%u, rb->used=%u, rb->size=%u",
-            rb->buf, rb->end, rb->wp, rb->rp, rb->free, rb->used, rb->size);
+    used = LOAD(&rb->head) - LOAD(&rb->tail);
+
+    _DEBUG("rb->buf=%p, rb->size=%u, used=%u", rb->buf, rb->size, used);
 
-    if (0 == rb->size) {
-        _ERROR("Buffer size is 0");
+    if (0 == rb->size || (rb->size & rb->mask)) {
+        _ERROR("Buffer size is not a power of two");
         abort();
     }
 
@@ -50,34 +54,8 @@ static void _assert_rb(struct ringbuf* rb) {
         abort();
     }
 
-    if (rb->used+rb->free != rb->size) {
-        _ERROR("rb->free and rb->used do not add up to rb->size");
-        abort();
-    }
-
-    if (rb->buf+(rb->size-1) != rb->end) {
-        _ERROR("rb->buf and rb->end not rb->size bytes apart");
-        abort();
-    }
-
-    if ((rb->wp < rb->buf) || (rb->wp > rb->end)) {
-        _ERROR("Write pointer outside buffer space");
-        abort();
-    }
-
-    if ((rb->rp < rb->buf) || (rb->rp > rb->end)) {
-        _ERROR("Read pointer outside buffer space");
-        abort();
-    }
-
-    if (rb->rp <= rb->wp) {
-        realused = rb->wp - rb->rp;
-    } else {
-        realused = (rb->end - rb->rp) + 1 + (rb->wp-rb->buf);
-    }
-
-    if (rb->used != realused) {
-        _ERROR("Usage count is inconsistient (is %d, should be %d)", rb->used, realused);
+    if (used > rb->size) {
+        _ERROR("Usage count is inconsistient (is %u, size is %u)", used, rb->size);
         abort();
     }
 
@@ -93,53 +71,38 @@ void reset_rb(struct ringbuf* rb) {
 
     _ENTER;
 
-    _RB_LOCK(rb->lock);
-
-    rb->wp = rb->buf;
-    rb->rp = rb->buf;
-    rb->free = rb->size;
-    rb->used = 0;
-    rb->end = rb->buf+(rb->size-1);
-
-    _RB_UNLOCK(rb->lock);
+    STORE(&rb->head, 0);
+    STORE(&rb->tail, 0);
 
     _LEAVE;
 }
 
 /*
  * Initialize a ringbuffer structure (including
- * memory allocation.
+ * memory allocation).  The size is rounded up to
+ * a power of two.
  *
  * Return -1 on error
  */
 int init_rb(struct ringbuf* rb, unsigned int size) {
 
+    unsigned int real_size = 1;
+
     _ENTER;
 
-    if (0 == size) {
+    if (0 == size || size > (1u << 31)) {
         _LEAVE -1;
     }
 
-    if (NULL == (rb->buf = malloc(size))) {
-        _LEAVE -1;
-    }
-    rb->size = size;
+    while (real_size < size)
+        real_size <<= 1;
 
-#ifdef _RB_USE_GLIB
-    if (NULL == (rb->lock = g_mutex_new())) {
-        _LEAVE -1;
-    }
-#else
-    if (NULL == (rb->lock = malloc(sizeof(pthread_mutex_t)))) {
+    if (NULL == (rb->buf = malloc(real_size))) {
         _LEAVE -1;
     }
 
-    if (0 != pthread_mutex_init(rb->lock, NULL)) {
-        free(rb->lock);
-        _LEAVE -1;
-    }
-#endif
-    rb->_free_lock = 1;
+    rb->size = real_size;
+    rb->mask = real_size - 1;
 
     reset_rb(rb);
 
@@ -149,33 +112,41 @@ int init_rb(struct ringbuf* rb, unsigned int size) {
 }
 
 /*
- * Initialize a ringbuffer structure (including
- * memory allocation.
- * The mutex to be used is passed in the function call.
- * The mutex must not be held while calling this function.
- *
- * Return -1 on error
+ * Return the contiguous free space at the write position
+ * and point *ptr at it.  The producer may fill it and then
+ * publish the data with commit_write_rb().
  */
-int init_rb_with_lock(struct ringbuf* rb, unsigned int size, rb_mutex_t* lock) {
+unsigned int write_space_rb(struct ringbuf* rb, char** ptr) {
+
+    unsigned int head, offset, space;
 
     _ENTER;
 
-    if (0 == size) {
-        _LEAVE -1;
-    }
+    head = rb->head; /* only we store it */
+    offset = head & rb->mask;
+    space = rb->size - (head - LOAD(&rb->tail));
 
-    rb->lock = lock;
-    rb->_free_lock = 0;
+    * ptr = rb->buf + offset;
 
-    if (NULL == (rb->buf = malloc(size))) {
-        _LEAVE -1;
-    }
-    rb->size = size;
-    reset_rb(rb);
+    if (space > rb->size - offset)
+        space = rb->size - offset;
+
+    _LEAVE space;
+}
+
+/*
+ * Make size bytes written at the pointer returned by
+ * write_space_rb() visible to the consumer.
+ */
+void commit_write_rb(struct ringbuf* rb, unsigned int size) {
+
+    _ENTER;
+
+    STORE(&rb->head, rb->head + size);
 
     ASSERT_RB(rb);
 
-    _LEAVE 0;
+    _LEAVE;
 }
 
 /*
@@ -184,54 +155,37 @@ int init_rb_with_lock(struct ringbuf* rb, unsigned int size, rb_mutex_t* lock) {
  */
 int write_rb(struct ringbuf* rb, void* buf, unsigned int size) {
 
-    int ret = -1;
-    int endfree;
+    unsigned int head, offset, endfree;
 
     _ENTER;
 
-    _RB_LOCK(rb->lock);
-
     ASSERT_RB(rb);
 
-    if (rb->free < size) {
-        ret = -1;
-        goto out;
+    head = rb->head;
+
+    if (rb->size - (head - LOAD(&rb->tail)) < size) {
+        _LEAVE -1;
     }
 
-    endfree = (rb->end - rb->wp)+1;
+    offset = head & rb->mask;
+    endfree = rb->size - offset;
+
     if (endfree < size) {
         /*
          * There is enough space in the buffer, but not in
          * one piece. We need to split the copy into two parts.
          */
-        memcpy(rb->wp, buf, endfree);
+        memcpy(rb->buf + offset, buf, endfree);
         memcpy(rb->buf, (char *) buf + endfree, size - endfree);
-        rb->wp = rb->buf + (size-endfree);
-    } else if (endfree > size) {
-        /*
-         * There is more space than needed at the end
-         */
-        memcpy(rb->wp, buf, size);
-        rb->wp += size;
     } else {
-        /*
-         * There is exactly the space needed at the end.
-         * We need to wrap around the read pointer.
-         */
-        memcpy(rb->wp, buf, size);
-        rb->wp = rb->buf;
+        memcpy(rb->buf + offset, buf, size);
     }
 
-    rb->free -= size;
-    rb->used += size;
-
-    ret = 0;
+    STORE(&rb->head, head + size);
 
-out:
     ASSERT_RB(rb);
-    _RB_UNLOCK(rb->lock);
 
-    _LEAVE ret;
+    _LEAVE 0;
 }
 
 /*
@@ -240,65 +194,33 @@ out:
  */
 int read_rb(struct ringbuf* rb, void* buf, unsigned int size) {
 
-    int ret;
-
-    _ENTER;
-
-    _RB_LOCK(rb->lock);
-    ret = read_rb_locked(rb, buf, size);
-    _RB_UNLOCK(rb->lock);
-
-    _LEAVE ret;
-}
-
-/*
- * Read size bytes from buffer into buf, assuming the buffer lock
- * is already held.
- * Return -1 on error (not enough data in buffer)
- */
-int read_rb_locked(struct ringbuf* rb, void* buf, unsigned int size) {
-
-    int endused;
+    unsigned int tail, offset, endused;
 
     _ENTER;
 
     ASSERT_RB(rb);
 
-    if (rb->used < size) {
+    tail = rb->tail;
+
+    if (LOAD(&rb->head) - tail < size) {
         /* Not enough bytes in buffer */
         _LEAVE -1;
     }
 
-    if (rb->rp < rb->wp) {
-        /*
-        Read pointer is behind write pointer, all the data is available in one chunk
-        */
-        memcpy(buf, rb->rp, size);
-        rb->rp += size;
-    } else {
+    offset = tail & rb->mask;
+    endused = rb->size - offset;
+
+    if (endused < size) {
         /*
-         * Read pointer is before write pointer
+         * There is enough data in the buffer, but it is fragmented.
          */
-        endused = (rb->end - rb->rp)+1;
-
-        if (size < endused) {
-            /*
-             * Data is available in one chunk
-             */
-            memcpy(buf, rb->rp, size);
-            rb->rp += size;
-        } else {
-            /*
-             * There is enough data in the buffer, but it is fragmented.
-             */
-            memcpy(buf, rb->rp, endused);
-            memcpy((char *) buf + endused, rb->buf, size - endused);
-            rb->rp = rb->buf + (size-endused);
-        }
+        memcpy(buf, rb->buf + offset, endused);
+        memcpy((char *) buf + endused, rb->buf, size - endused);
+    } else {
+        memcpy(buf, rb->buf + offset, size);
     }
 
-    rb->free += size;
-    rb->used -= size;
+    STORE(&rb->tail, tail + size);
 
     ASSERT_RB(rb);
 
@@ -310,72 +232,30 @@ int read_rb_locked(struct ringbuf* rb, void* buf, unsigned int size) {
  */
 unsigned int free_rb(struct ringbuf* rb) {
 
-    unsigned int f;
-
-    _ENTER;
-
-    _RB_LOCK(rb->lock);
-    f = free_rb_locked(rb);
-    _RB_UNLOCK(rb->lock);
-
-    _LEAVE f;
-}
-
-/*
- * Return the amount of free space currently in the rb.
- * Assume the rb lock is already being held.
- */
-unsigned int free_rb_locked(struct ringbuf* rb) {
-
     _ENTER;
 
-    _LEAVE rb->free;
+    _LEAVE rb->size - (LOAD(&rb->head) - LOAD(&rb->tail));
 }
 
-
 /*
  * Return the amount of used space currently in the rb
  */
 unsigned int used_rb(struct ringbuf* rb) {
 
-    unsigned int u;
-
     _ENTER;
 
-    _RB_LOCK(rb->lock);
-    u = used_rb_locked(rb);
-    _RB_UNLOCK(rb->lock);
-
-    _LEAVE u;
+    _LEAVE LOAD(&rb->head) - LOAD(&rb->tail);
 }
 
-/*
- * Return the amount of used space currently in the rb.
- * Assume the rb lock is already being held.
- */
-unsigned int used_rb_locked(struct ringbuf* rb) {
-
-    _ENTER;
-
-    _LEAVE rb->used;
-}
-
-
 /*
  * destroy a ringbuffer
  */
 void destroy_rb(struct ringbuf* rb) {
 
     _ENTER;
+
     free(rb->buf);
-    if (rb->_free_lock) {
-#ifdef _RB_USE_GLIB
-        g_mutex_free(rb->lock);
-#else
-        pthread_mutex_destroy(rb->lock);
-        free(rb->lock);
-#endif
-    }
+    rb->buf = NULL;
 
     _LEAVE;
 }
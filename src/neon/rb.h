@@ -17,21 +17,6 @@
 #ifndef _RB_H
 #define _RB_H
 
-#ifdef _RB_USE_GLIB
-#include <glib.h>
-
-typedef GMutex rb_mutex_t;
-#define _RB_LOCK(L) g_mutex_lock(L)
-#define _RB_UNLOCK(L) g_mutex_unlock(L)
-
-#else
-#include <pthread.h>
-
-typedef pthread_mutex_t rb_mutex_t;
-#define _RB_LOCK(L) pthread_mutex_lock(L)
-#define _RB_UNLOCK(L) pthread_mutex_unlock(L)
-#endif
-
 #include <stdlib.h>
 
 #ifdef RB_DEBUG
@@ -40,28 +25,35 @@ typedef pthread_mutex_t rb_mutex_t;
 #define ASSERT_RB(buf)
 #endif
 
+/*
+ * Single-producer, single-consumer ringbuffer.
+ *
+ * head and tail count the bytes written and read since the last reset,
+ * modulo 2^32; the size is a power of two, so they map onto the buffer with
+ * a mask.  Only the producer stores head and only the consumer stores tail,
+ * so neither side needs a lock.  The counters are accessed with sequentially
+ * consistent atomics, which lets callers build sleep/wakeup handshakes on top
+ * (see reader_thread() in neon.c).
+ *
+ * reset_rb() and destroy_rb() must only be called while neither side is
+ * using the buffer.
+ */
 struct ringbuf {
-    rb_mutex_t* lock;
-    char _free_lock;
     char* buf;
-    char* end;
-    char* wp;
-    char* rp;
-    unsigned int free;
-    unsigned int used;
     unsigned int size;
+    unsigned int mask;
+    unsigned int head;
+    unsigned int tail;
 };
 
 int init_rb(struct ringbuf* rb, unsigned int size);
-int init_rb_with_lock(struct ringbuf* rb, unsigned int size, rb_mutex_t* lock);
 int write_rb(struct ringbuf* rb, void* buf, unsigned int size);
+unsigned int write_space_rb(struct ringbuf* rb, char** ptr);
+void commit_write_rb(struct ringbuf* rb, unsigned int size);
 int read_rb(struct ringbuf* rb, void* buf, unsigned int size);
-int read_rb_locked(struct ringbuf* rb, void* buf, unsigned int size);
 void reset_rb(struct ringbuf* rb);
 unsigned int free_rb(struct ringbuf* rb);
-unsigned int free_rb_locked(struct ringbuf* rb);
 unsigned int used_rb(struct ringbuf* rb);
-unsigned int used_rb_locked(struct ringbuf* rb);
 void destroy_rb(struct ringbuf* rb);
 
 #endif
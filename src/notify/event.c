@@ -29,16 +29,43 @@
 
 #include "osd.h"
 
+/* when skipping through songs, only the one that plays for this long gets a
+ * notification */
+#define SETTLE_DELAY 300 /* ms */
+
 static char * last_title = NULL, * last_message = NULL; /* pooled */
+static char * last_file = NULL; /* pooled */
+static const char * last_image = NULL;
 static GdkPixbuf * last_pixbuf = NULL;
+static int show_source = 0;
+
+static void cancel_show (void)
+{
+    if (show_source)
+    {
+        g_source_remove (show_source);
+        show_source = 0;
+    }
+}
 
 static void clear_cache (void)
 {
+    cancel_show ();
+
     str_unref (last_title);
     last_title = NULL;
     str_unref (last_message);
     last_message = NULL;
 
+    if (last_image)
+    {
+        aud_art_unref (last_file);
+        last_image = NULL;
+    }
+
+    str_unref (last_file);
+    last_file = NULL;
+
     if (last_pixbuf)
     {
         g_object_unref (last_pixbuf);
@@ -46,12 +73,79 @@ static void clear_cache (void)
     }
 }
 
+/* Decodes the current song's art straight to the size it will be shown at,
+ * which lets the JPEG loader skip most of the work for large covers. */
+static void art_size_prepared (GdkPixbufLoader * loader, int width, int height,
+ void * size)
+{
+    int max = GPOINTER_TO_INT (size);
+
+    if (width > max || height > max)
+    {
+        if (width > height)
+            gdk_pixbuf_loader_set_size (loader, max, MAX (1, height * max / width));
+        else
+            gdk_pixbuf_loader_set_size (loader, MAX (1, width * max / height), max);
+    }
+}
+
+static GdkPixbuf * art_request_current_scaled (int size)
+{
+    int list = aud_playlist_get_playing ();
+    int entry = aud_playlist_get_position (list);
+    if (entry < 0)
+        return NULL;
+
+    char * filename = aud_playlist_entry_get_filename (list, entry);
+    const void * data;
+    int64_t len;
+    GdkPixbuf * pixbuf = NULL;
+
+    aud_art_request_data (filename, & data, & len);
+
+    if (data)
+    {
+        GdkPixbufLoader * loader = gdk_pixbuf_loader_new ();
+        g_signal_connect (loader, "size-prepared", (GCallback) art_size_prepared,
+         GINT_TO_POINTER (size));
+
+        if (gdk_pixbuf_loader_write (loader, data, len, NULL) &&
+         gdk_pixbuf_loader_close (loader, NULL))
+        {
+            if ((pixbuf = gdk_pixbuf_loader_get_pixbuf (loader)))
+                g_object_ref (pixbuf);
+        }
+        else
+            gdk_pixbuf_loader_close (loader, NULL);
+
+        g_object_unref (loader);
+        aud_art_unref (filename);
+    }
+
+    str_unref (filename);
+    return pixbuf;
+}
+
 static bool_t get_album_art (void)
 {
-    if (last_pixbuf)
+    if (last_image || last_pixbuf)
         return FALSE;
 
-    last_pixbuf = audgui_pixbuf_request_current ();
+    /* prefer handing the daemon a file it can load itself */
+    if (! last_file)
+    {
+        int list = aud_playlist_get_playing ();
+        int entry = aud_playlist_get_position (list);
+        if (entry < 0)
+            return FALSE;
+
+        last_file = aud_playlist_entry_get_filename (list, entry);
+    }
+
+    if (last_file && (last_image = aud_art_request_file (last_file)))
+        return TRUE;
+
+    last_pixbuf = art_request_current_scaled (96);
     if (! last_pixbuf)
         return FALSE;
 
@@ -61,13 +155,28 @@ static bool_t get_album_art (void)
 
 static void show_stopped (void)
 {
-    osd_show (_("Stopped"), _("Audacious is not playing."), "audacious", NULL);
+    osd_show (_("Stopped"), _("Audacious is not playing."), "audacious", NULL, NULL);
 }
 
 static void show_playing (void)
 {
     if (last_title && last_message)
-        osd_show (last_title, last_message, "audio-x-generic", last_pixbuf);
+        osd_show (last_title, last_message, "audio-x-generic", last_image, last_pixbuf);
+}
+
+static bool_t settled_cb (void * unused)
+{
+    show_source = 0;
+    get_album_art ();
+    show_playing ();
+    return FALSE;
+}
+
+static void show_now (void)
+{
+    cancel_show ();
+    get_album_art ();
+    show_playing ();
 }
 
 static void playback_update (void)
@@ -110,12 +219,16 @@ static void playback_update (void)
     str_unref (last_message);
     last_message = message;
 
-    get_album_art ();
-    show_playing ();
+    cancel_show ();
+    show_source = g_timeout_add (SETTLE_DELAY, (GSourceFunc) settled_cb, NULL);
 }
 
 static void art_ready (void)
 {
+    /* a pending notification picks up the art when it is shown */
+    if (show_source)
+        return;
+
     if (aud_drct_get_playing () && get_album_art ())
         show_playing ();
 }
@@ -123,7 +236,7 @@ static void art_ready (void)
 static void playback_paused (void)
 {
     if (aud_get_bool ("notify", "resident"))
-        show_playing ();
+        show_now ();
 }
 
 static void playback_stopped (void)
@@ -137,7 +250,7 @@ static void playback_stopped (void)
 static void force_show (void)
 {
     if (aud_drct_get_playing ())
-        show_playing ();
+        show_now ();
     else
         show_stopped ();
 }
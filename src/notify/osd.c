@@ -74,12 +74,15 @@ void osd_setup_buttons (NotifyNotification *notification)
 
 static NotifyNotification * notification = NULL;
 
+/* <image> is the URI of a local image file; the notification daemon reads it
+ * directly, which saves sending the pixels over the bus.  <pixbuf> is used
+ * only when there is no such file. */
 void osd_show (const char * title, const char * _message, const char * icon,
- GdkPixbuf * pixbuf)
+ const char * image, GdkPixbuf * pixbuf)
 {
     char * message = g_markup_escape_text (_message, -1);
 
-    if (pixbuf)
+    if (image || pixbuf)
         icon = NULL;
 
     if (notification)
@@ -90,8 +93,10 @@ void osd_show (const char * title, const char * _message, const char * icon,
         osd_setup (notification);
     }
 
-    if (pixbuf)
-        notify_notification_set_image_from_pixbuf (notification, pixbuf);
+    /* a NULL value clears whatever image the last update used */
+    notify_notification_set_hint (notification, "image-path", image ?
+     g_variant_new_string (image) : NULL);
+    notify_notification_set_image_from_pixbuf (notification, image ? NULL : pixbuf);
 
     osd_setup_buttons (notification);
     notify_notification_show (notification, NULL);
@@ -19,5 +19,6 @@
 
 #include <gdk-pixbuf/gdk-pixbuf.h>
 
-void osd_show (const char * title, const char * message, const char * icon, GdkPixbuf * pixbuf);
+void osd_show (const char * title, const char * message, const char * icon,
+ const char * image, GdkPixbuf * pixbuf);
 void osd_hide (void);
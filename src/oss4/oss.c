@@ -30,15 +30,20 @@ static const char * const oss_defaults[] = {
  "volume", "12850", /* 0x3232 */
  "cookedmode", "TRUE",
  "exclusive", "FALSE",
+ "fragment_ms", "0",
+ "fragment_count", "0",
+ "use_mmap", "FALSE",
  NULL};
 
 oss_data_t *oss_data;
-static int64_t oss_time; /* microseconds */
-static bool_t oss_paused;
-static int oss_paused_time;
-static int oss_delay; /* miliseconds */
 static bool_t oss_ioctl_vol = FALSE;
 
+/* State of the mmap path; mmap_buf is NULL when writing with write(). */
+static char *mmap_buf;
+static int64_t mmap_written, mmap_played, mmap_cleared; /* bytes */
+static int mmap_last_bytes, mmap_base;
+static bool_t mmap_triggered;
+
 bool_t oss_init(void)
 {
     AUDDBG("Init.\n");
@@ -93,12 +98,42 @@ FAILED:
     return FALSE;
 }
 
+/* Asks for the configured fragment layout.  This has to come before the format
+ * is set, since that makes the driver set up its buffer, and the driver is free to round or
+ * ignore it, so what we get is read back afterward with SNDCTL_DSP_GETOSPACE.
+ * The size is a power of two in bytes, the largest not over what was asked
+ * for; without a size, the count alone is not worth asking for. */
+static void set_fragments(int format, int rate, int channels)
+{
+    int ms = aud_get_int("oss4", "fragment_ms");
+    int count = aud_get_int("oss4", "fragment_count");
+    int bytes, shift, param;
+
+    if (ms <= 0)
+        return;
+
+    bytes = (int64_t) rate * ms / 1000 * channels * (oss_format_to_bits(format) / 8);
+    for (shift = 4; shift < 16 && (2 << shift) <= bytes; shift++)
+        ;
+
+    /* 0x7fff fragments means as many as the driver likes */
+    count = (count >= 2) ? MIN(count, 0x7fff) : 0x7fff;
+    param = (count << 16) | shift;
+
+    AUDDBG("Asking for %d fragments of %d bytes.\n", count, 1 << shift);
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SETFRAGMENT, &param);
+
+FAILED:
+    return;
+}
+
 static int open_device(void)
 {
     int res = -1;
-    int flags = O_WRONLY;
+    int flags = 0;
     char *device = aud_get_string("oss4", "device");
     char *alt_device = aud_get_string("oss4", "alt_device");
+    const char *path = DEFAULT_DSP;
 
     if (aud_get_bool("oss4", "exclusive"))
     {
@@ -107,11 +142,15 @@ static int open_device(void)
     }
 
     if (aud_get_bool("oss4", "use_alt_device") && alt_device != NULL)
-        res = open(alt_device, flags);
+        path = alt_device;
     else if (device != NULL)
-        res = open(device, flags);
-    else
-        res = open(DEFAULT_DSP, flags);
+        path = device;
+
+    /* a shared mapping needs the device open for reading as well */
+    if (aud_get_bool("oss4", "use_mmap"))
+        res = open(path, flags | O_RDWR);
+    if (res < 0)
+        res = open(path, flags | O_WRONLY);
 
     free(device);
     free(alt_device);
@@ -125,144 +164,360 @@ static void close_device(void)
     oss_data->fd = -1;
 }
 
-int oss_open_audio(int aud_format, int rate, int channels)
+static void sleep_bytes(int bytes)
 {
-    AUDDBG("Opening audio.\n");
+    int64_t ns = (int64_t) oss_bytes_to_frames(bytes) * 1000000000 / oss_data->rate;
+    struct timespec ts = {ns / 1000000000, ns % 1000000000};
+    nanosleep(&ts, NULL);
+}
 
-    int format;
-    int vol_left, vol_right;
-    audio_buf_info buf_info;
+/* The driver frees its buffer a fragment at a time, so rather than blocking in
+ * write() (or polling for free space), the writer thread sleeps for as long as
+ * it takes the device to play enough of what is queued to make room for the
+ * next block.  With blocks the size of a fragment, that is until the next
+ * fragment boundary. */
+static void wait_for_room(int queued, int length)
+{
+    int missing = queued + MIN(length, oss_data->fragment_size) - oss_data->buffer_size;
 
-    CHECK_NOISY(oss_data->fd = open_device);
+    /* a virtual mixer may report more than its buffer holds; never sleep for
+     * more than a fragment, write() blocks for whatever is left */
+    if (missing > 0)
+        sleep_bytes(MIN(missing, oss_data->fragment_size));
+}
 
-    format = oss_convert_aud_format(aud_format);
+static int write_device(const void *data, int length)
+{
+    int queued;
 
-    if (!set_format(format, rate, channels))
-        goto FAILED;
+    if (ioctl(oss_data->fd, SNDCTL_DSP_GETODELAY, &queued) == 0)
+        wait_for_room(queued, length);
 
-    CHECK_NOISY(ioctl, oss_data->fd, SNDCTL_DSP_GETOSPACE, &buf_info);
+    int written = write(oss_data->fd, data, length);
 
-    AUDDBG("Buffer information, fragstotal: %d, fragsize: %d, bytes: %d.\n",
-        buf_info.fragstotal,
-        buf_info.fragsize,
-        buf_info.bytes);
+    if (written < 0)
+    {
+        if (errno == EINTR)
+            return 0;
 
-    oss_time = 0;
-    oss_paused = FALSE;
-    oss_paused_time = 0;
-    oss_delay = oss_bytes_to_frames(buf_info.fragstotal * buf_info.fragsize) * 1000 / oss_data->rate;
-    oss_ioctl_vol = TRUE;
+        DESCRIBE_ERROR;
+    }
 
-    AUDDBG("Internal OSS buffer size: %dms.\n", oss_delay);
+    return written;
+}
 
-    if (aud_get_bool("oss4", "save_volume"))
-    {
-        vol_right = (aud_get_int("oss4", "volume") & 0xFF00) >> 8;
-        vol_left  = (aud_get_int("oss4", "volume") & 0x00FF);
-        oss_set_volume(vol_left, vol_right);
-    }
+static int device_delay(void)
+{
+    int delay;
 
-    return 1;
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_GETODELAY, &delay);
+
+    return oss_bytes_to_frames(delay);
 
 FAILED:
-    close_device();
     return 0;
 }
 
-void oss_close_audio(void)
+static void pause_device(bool_t pause)
 {
-    AUDDBG ("Closing audio.\n");
+    if (pause)
+        CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SILENCE, NULL);
+    else
+        CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SKIP, NULL);
 
-    close_device();
+FAILED:
+    return;
+}
+
+static void flush_device(void)
+{
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_RESET, NULL);
+
+FAILED:
+    return;
+}
+
+static void drain_device(void)
+{
+    AUDDBG("Drain.\n");
+
+    if (ioctl(oss_data->fd, SNDCTL_DSP_SYNC, NULL) == -1)
+        DESCRIBE_ERROR;
 }
 
-void oss_write_audio(void *data, int length)
+static const OutCoreOps oss_ops = {
+    .name = N_("OSS4 Output"),
+    .write = write_device,
+    .delay = device_delay,
+    .pause = pause_device,
+    .flush = flush_device,
+    .drain = drain_device
+};
+
+/* In mmap mode, we write straight into the driver's buffer, which the device
+ * plays over and over.  Our position in it is counted from the total number of
+ * bytes played that SNDCTL_DSP_GETOPTR reports, and whatever has been played
+ * is overwritten with silence, so that the device plays silence rather than
+ * old audio when we fall behind. */
+
+static void fill_silence(char *data, int length)
 {
-    int written = 0, start = 0;
+    switch (oss_data->format)
+    {
+    case AFMT_U8:
+        memset(data, 0x80, length);
+        break;
+    case AFMT_U16_LE:
+    case AFMT_U16_BE:
+        for (int i = 0; i < length; i++)
+            data[i] = ((i & 1) == (oss_data->format == AFMT_U16_LE)) ? 0x80 : 0;
+        break;
+    default:
+        memset(data, 0, length);
+        break;
+    }
+}
 
+/* Copies length bytes to the part of the mapped buffer that holds position
+ * pos, or fills them with silence if data is NULL. */
+static void put_mapped(int64_t pos, const char *data, int length)
+{
     while (length > 0)
     {
-        written = write(oss_data->fd, (char *) data + start, length);
+        int offset = (mmap_base + pos) % oss_data->buffer_size;
+        int part = MIN(length, oss_data->buffer_size - offset);
 
-        if (written < 0)
+        if (data)
         {
-            DESCRIBE_ERROR;
-            return;
+            memcpy(mmap_buf + offset, data, part);
+            data += part;
         }
+        else
+            fill_silence(mmap_buf + offset, part);
 
-        length -= written;
-        start += written;
-        oss_time += (int64_t) oss_bytes_to_frames(written) * 1000000 / oss_data->rate;
+        pos += part;
+        length -= part;
     }
 }
 
-void oss_drain(void)
+static void update_mmap(void)
 {
-    AUDDBG("Drain.\n");
+    count_info info;
 
-    if (ioctl(oss_data->fd, SNDCTL_DSP_SYNC, NULL) == -1)
-        DESCRIBE_ERROR;
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_GETOPTR, &info);
+
+    mmap_played += (unsigned) info.bytes - (unsigned) mmap_last_bytes;
+    mmap_last_bytes = info.bytes;
+
+    /* after an underrun, carry on from where the device is now */
+    if (mmap_written < mmap_played)
+        mmap_written = mmap_played;
+
+    /* positions a buffer behind what we have written share its space */
+    int64_t from = MAX(mmap_cleared, mmap_written - oss_data->buffer_size);
+
+    if (mmap_played > from)
+        put_mapped(from, NULL, mmap_played - from);
+
+    mmap_cleared = MAX(mmap_cleared, mmap_played);
+
+FAILED:
+    return;
 }
 
-int oss_buffer_free(void)
+/* Stops the device and starts over at the beginning of an empty buffer. */
+static void reset_mmap(void)
 {
-    audio_buf_info buf_info;
+    int trigger = 0;
+    count_info info;
 
-    if (oss_paused)
-        return 0;
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SETTRIGGER, &trigger);
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_GETOPTR, &info);
 
-    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_GETOSPACE, &buf_info);
+    fill_silence(mmap_buf, oss_data->buffer_size);
 
-    return MAX(0, buf_info.fragments - 1) * buf_info.fragsize;
+    mmap_last_bytes = info.bytes;
+    mmap_base = info.ptr;
+    mmap_written = mmap_played = mmap_cleared = 0;
+    mmap_triggered = FALSE;
 
 FAILED:
-    return 0;
+    return;
 }
 
-static int real_output_time()
+static int write_mmap(const void *data, int length)
 {
-    int  time = 0;
+    int room;
 
-    time = (oss_time - (int64_t) (oss_delay * 1000)) / 1000;
-    return time;
+    while (1)
+    {
+        update_mmap();
+        room = oss_data->buffer_size - (mmap_written - mmap_played);
+
+        if (room >= MIN(length, oss_data->fragment_size))
+            break;
+
+        wait_for_room(mmap_written - mmap_played, length);
+    }
+
+    length = MIN(length, room);
+    length -= length % oss_frames_to_bytes(1);
+
+    put_mapped(mmap_written, data, length);
+    mmap_written += length;
+
+    if (!mmap_triggered)
+    {
+        int trigger = PCM_ENABLE_OUTPUT;
+
+        CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SETTRIGGER, &trigger);
+        mmap_triggered = TRUE;
+    }
+
+    return length;
+
+FAILED:
+    return -1;
 }
 
-int oss_output_time(void)
+static int delay_mmap(void)
 {
-    int time = 0;
+    update_mmap();
 
-    if (oss_paused)
-        time = oss_paused_time;
-    else
-        time = real_output_time();
-    return time;
+    return oss_bytes_to_frames(mmap_written - mmap_played);
 }
 
-void oss_flush(int time)
+static void pause_mmap(bool_t pause)
 {
-    AUDDBG("Flush.\n");
+    int trigger = pause ? 0 : PCM_ENABLE_OUTPUT;
 
-    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_RESET, NULL);
+    if (mmap_triggered)
+        CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SETTRIGGER, &trigger);
 
 FAILED:
-    oss_time = (int64_t) time * 1000;
-    oss_paused_time = time;
+    return;
 }
 
-void oss_pause(bool_t pause)
+static void flush_mmap(void)
 {
-    AUDDBG("%sause.\n", pause ? "P" : "Unp");
+    if (ioctl(oss_data->fd, SNDCTL_DSP_RESET, NULL) == -1)
+        DESCRIBE_ERROR;
 
-    if (pause)
+    reset_mmap();
+}
+
+static void drain_mmap(void)
+{
+    int queued;
+
+    AUDDBG("Drain.\n");
+
+    while ((queued = delay_mmap()) > 0)
+        sleep_bytes(oss_frames_to_bytes(queued));
+}
+
+static const OutCoreOps oss_mmap_ops = {
+    .name = N_("OSS4 Output"),
+    .write = write_mmap,
+    .delay = delay_mmap,
+    .pause = pause_mmap,
+    .flush = flush_mmap,
+    .drain = drain_mmap
+};
+
+static void open_mmap(void)
+{
+    int caps;
+    void *buf = MAP_FAILED;
+
+    CHECK(ioctl, oss_data->fd, SNDCTL_DSP_GETCAPS, &caps);
+    CHECK_VAL((caps & PCM_CAP_MMAP) && (caps & PCM_CAP_TRIGGER), ERROR,
+     "The device cannot be used with mmap, using write() instead.\n");
+
+    buf = mmap(NULL, oss_data->buffer_size, PROT_WRITE, MAP_SHARED, oss_data->fd, 0);
+    CHECK_VAL(buf != MAP_FAILED, ERROR, "mmap failed, using write() instead: %s\n",
+     oss_describe_error());
+
+    mmap_buf = buf;
+    reset_mmap();
+
+    AUDDBG("Writing to the device through mmap.\n");
+
+FAILED:
+    return;
+}
+
+static void close_mmap(void)
+{
+    if (mmap_buf)
+        munmap(mmap_buf, oss_data->buffer_size);
+
+    mmap_buf = NULL;
+}
+
+int oss_open_audio(int aud_format, int rate, int channels)
+{
+    AUDDBG("Opening audio.\n");
+
+    int format;
+    int vol_left, vol_right;
+    audio_buf_info buf_info;
+
+    CHECK_NOISY(oss_data->fd = open_device);
+
+    format = oss_convert_aud_format(aud_format);
+
+    set_fragments(format, rate, channels);
+
+    if (!set_format(format, rate, channels))
+        goto FAILED;
+
+    CHECK_NOISY(ioctl, oss_data->fd, SNDCTL_DSP_GETOSPACE, &buf_info);
+
+    oss_data->fragment_size = buf_info.fragsize;
+    oss_data->buffer_size = buf_info.fragstotal * buf_info.fragsize;
+
+    AUDDBG("Buffer information, fragstotal: %d, fragsize: %d, bytes: %d.\n",
+        buf_info.fragstotal,
+        buf_info.fragsize,
+        buf_info.bytes);
+
+    AUDDBG("Internal OSS buffer size: %dms.\n",
+        oss_bytes_to_frames(buf_info.fragstotal * buf_info.fragsize) * 1000 / oss_data->rate);
+
+    if (aud_get_bool("oss4", "use_mmap"))
+        open_mmap();
+
+    /* Writing a fragment at a time means the writer thread wakes up once per
+     * fragment boundary. */
+    if (!outcore_open(mmap_buf ? &oss_mmap_ops : &oss_ops, rate,
+     oss_frames_to_bytes(1), oss_bytes_to_frames(buf_info.fragsize)))
+        goto FAILED;
+
+    oss_ioctl_vol = TRUE;
+
+    if (aud_get_bool("oss4", "save_volume"))
     {
-        oss_paused_time = real_output_time();
-        CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SILENCE, NULL);
+        vol_right = (aud_get_int("oss4", "volume") & 0xFF00) >> 8;
+        vol_left  = (aud_get_int("oss4", "volume") & 0x00FF);
+        oss_set_volume(vol_left, vol_right);
     }
-    else
-        CHECK(ioctl, oss_data->fd, SNDCTL_DSP_SKIP, NULL);
+
+    return 1;
 
 FAILED:
-    oss_paused = pause;
+    close_mmap();
+    close_device();
+    return 0;
+}
+
+void oss_close_audio(void)
+{
+    AUDDBG ("Closing audio.\n");
+
+    outcore_close();
+    close_mmap();
+    close_device();
 }
 
 void oss_get_volume(int *left, int *right)
@@ -27,6 +27,8 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #ifdef HAVE_SYS_SOUNDCARD_H
 #include <sys/soundcard.h>
@@ -39,6 +41,8 @@
 #include <audacious/debug.h>
 #include <audacious/misc.h>
 
+#include "../outcore/outcore.h"
+
 #define ERROR(...) \
 do { \
     fprintf(stderr, "OSS4 %s:%d [%s]: ", __FILE__, __LINE__, __FUNCTION__); \
@@ -93,6 +97,8 @@ typedef struct
     int rate;
     int channels;
     int bits_per_sample;
+    int fragment_size;  /* bytes */
+    int buffer_size;    /* bytes, all fragments together */
 } oss_data_t;
 
 extern oss_data_t *oss_data;
@@ -102,12 +108,6 @@ bool_t oss_init(void);
 void oss_cleanup(void);
 int oss_open_audio(int aud_format, int rate, int channels);
 void oss_close_audio(void);
-void oss_write_audio(void *data, int length);
-void oss_drain(void);
-int oss_buffer_free(void);
-int oss_output_time(void);
-void oss_flush(int time);
-void oss_pause(bool_t pause);
 void oss_get_volume(int *left, int *right);
 void oss_set_volume(int left, int right);
 
@@ -84,6 +84,15 @@ static PreferencesWidget oss_widgets[] = {
   .cfg_type = VALUE_BOOLEAN, .csect = "oss4", .cname = "cookedmode"},
  {WIDGET_CHK_BTN, N_("Enable exclusive mode to prevent virtual mixing."),
   .cfg_type = VALUE_BOOLEAN, .csect = "oss4", .cname = "exclusive"},
+ {WIDGET_LABEL, N_("<b>Buffering</b>")},
+ {WIDGET_SPIN_BTN, N_("Fragment size:"),
+  .cfg_type = VALUE_INT, .csect = "oss4", .cname = "fragment_ms",
+  .data = {.spin_btn = {0, 500, 1, N_("ms (0 for the driver's choice)")}}},
+ {WIDGET_SPIN_BTN, N_("Number of fragments:"),
+  .cfg_type = VALUE_INT, .csect = "oss4", .cname = "fragment_count",
+  .data = {.spin_btn = {0, 64, 1, N_("(0 for as many as the driver likes)")}}},
+ {WIDGET_CHK_BTN, N_("Write to the device through mmap if it allows."),
+  .cfg_type = VALUE_BOOLEAN, .csect = "oss4", .cname = "use_mmap"},
 };
 
 static void prefs_init()
@@ -119,12 +128,13 @@ AUD_OUTPUT_PLUGIN
     .cleanup = oss_cleanup,
     .open_audio = oss_open_audio,
     .close_audio = oss_close_audio,
-    .write_audio = oss_write_audio,
-    .drain = oss_drain,
-    .buffer_free = oss_buffer_free,
-    .output_time = oss_output_time,
-    .flush = oss_flush,
-    .pause = oss_pause,
+    .write_audio = outcore_write,
+    .drain = outcore_drain,
+    .buffer_free = outcore_buffer_free,
+    .period_wait = outcore_period_wait,
+    .output_time = outcore_output_time,
+    .flush = outcore_flush,
+    .pause = outcore_pause,
     .set_volume = oss_set_volume,
     .get_volume = oss_get_volume,
     .about_text = oss_about,
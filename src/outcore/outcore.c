@@ -0,0 +1,497 @@
+/*
+ * Shared Output Core for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <audacious/debug.h>
+#include <audacious/misc.h>
+
+#include "outcore.h"
+#include "../perfstat/perfstat.h"
+
+/* read_pos is advanced only by the consumer and write_pos only by
+ * outcore_write; each side reads the other's index with acquire semantics, so
+ * that the ring data itself never needs the lock.  Both are reset together by
+ * outcore_flush, which runs in the producer's thread while the consumer is
+ * idle. */
+#define LOAD(v) __atomic_load_n (& (v), __ATOMIC_ACQUIRE)
+#define STORE(v, x) __atomic_store_n (& (v), (x), __ATOMIC_RELEASE)
+
+static pthread_mutex_t core_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t core_cond = PTHREAD_COND_INITIALIZER;
+
+static const OutCoreOps * core_ops;
+static int core_rate, core_frame_size, core_chunk;
+
+static unsigned char * ring;
+static int ring_size;
+static int64_t read_pos, write_pos; /* bytes since the last flush */
+
+static pthread_t writer;
+static char writer_running, writer_quit;
+
+static char started, paused, draining, playing;
+static char busy; /* the consumer is working on the ring or the device */
+static int serial; /* incremented by each flush */
+
+static int flush_time; /* milliseconds */
+
+/* The device had timed_delay frames queued when timed_pos bytes had been taken
+ * from the ring, at time timed_ns. */
+static int64_t timed_pos, timed_ns;
+static int timed_delay;
+
+static OutCoreStats stats;
+
+static PerfStatOutput perfstat = PERFSTAT_OUTPUT_INIT (NULL);
+static PerfStat device_perfstat = PERFSTAT_INIT (NULL, "device");
+
+static int64_t time_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_frames (int frames)
+{
+    int64_t ns = (int64_t) frames * 1000000000 / core_rate;
+    struct timespec ts = {ns / 1000000000, ns % 1000000000};
+    nanosleep (& ts, NULL);
+}
+
+static void record_delay_locked (int delay)
+{
+    timed_pos = read_pos;
+    timed_delay = MAX (delay, 0);
+    timed_ns = time_ns ();
+
+    stats.max_delay = MAX (stats.max_delay, timed_delay);
+}
+
+/* Frames still queued in the device, extrapolated from the last delay
+ * measurement. */
+static int remaining_locked (void)
+{
+    if (! started || paused)
+        return timed_delay;
+
+    int64_t elapsed = (time_ns () - timed_ns) * core_rate / 1000000000;
+    return (elapsed < timed_delay) ? timed_delay - elapsed : 0;
+}
+
+static void start_locked (void)
+{
+    AUDDBG ("Starting playback.\n");
+
+    started = TRUE;
+    timed_ns = time_ns ();
+
+    if (core_ops->start)
+        core_ops->start ();
+
+    pthread_cond_broadcast (& core_cond);
+}
+
+/* Returns the number of bytes the consumer may take now. */
+static int readable_locked (void)
+{
+    if (! started || paused)
+        return 0;
+
+    int fill = LOAD (write_pos) - read_pos;
+
+    if (! fill)
+    {
+        if (playing && ! draining)
+            stats.underruns ++;
+
+        playing = FALSE;
+    }
+
+    return fill;
+}
+
+static void count_write_locked (int len, int64_t ns)
+{
+    perfstat_add (& device_perfstat, ns, (int64_t) len / core_frame_size *
+     1000000000 / core_rate);
+
+    stats.writes ++;
+    stats.bytes_written += len;
+    stats.max_write = MAX (stats.max_write, len);
+    stats.write_ns += ns;
+    stats.max_write_ns = MAX (stats.max_write_ns, ns);
+}
+
+static void wait_idle_locked (void)
+{
+    while (busy)
+        pthread_cond_wait (& core_cond, & core_mutex);
+}
+
+static void * writer_thread (void * unused)
+{
+    pthread_mutex_lock (& core_mutex);
+
+    while (! writer_quit)
+    {
+        int fill = readable_locked ();
+
+        if (! fill)
+        {
+            pthread_cond_wait (& core_cond, & core_mutex);
+            stats.wakeups ++;
+            continue;
+        }
+
+        int offset = read_pos % ring_size;
+        int len = MIN (fill, MIN (ring_size - offset, core_chunk));
+
+        busy = TRUE;
+        pthread_mutex_unlock (& core_mutex);
+
+        int64_t start = time_ns ();
+        int written = core_ops->write (ring + offset, len);
+        int64_t spent = time_ns () - start;
+        int delay = 0;
+
+        if (written < 0)
+        {
+            /* Throw the block away at the rate it would have played; this
+             * keeps Audacious from waiting forever on a dead device. */
+            sleep_frames (len / core_frame_size);
+        }
+        else if (core_ops->delay)
+            delay = core_ops->delay ();
+
+        pthread_mutex_lock (& core_mutex);
+
+        if (written < 0)
+        {
+            stats.errors ++;
+            written = len;
+        }
+
+        busy = FALSE;
+        STORE (read_pos, read_pos + written);
+        playing = TRUE;
+
+        record_delay_locked (delay);
+        count_write_locked (written, spent);
+
+        pthread_cond_broadcast (& core_cond);
+    }
+
+    pthread_mutex_unlock (& core_mutex);
+    return NULL;
+}
+
+bool_t outcore_open (const OutCoreOps * ops, int rate, int frame_size, int period)
+{
+    int buffer_ms = aud_get_int (NULL, "output_buffer_size");
+
+    core_ops = ops;
+    core_rate = rate;
+    core_frame_size = frame_size;
+
+    ring_size = frame_size * (int) ((int64_t) buffer_ms * rate / 1000);
+    ring = malloc (ring_size);
+
+    if (period > 0)
+        core_chunk = MIN (period * frame_size, ring_size);
+    else
+        core_chunk = ring_size / 4 / frame_size * frame_size;
+
+    read_pos = write_pos = 0;
+    started = paused = draining = playing = busy = FALSE;
+    serial = 0;
+    flush_time = 0;
+    timed_pos = timed_ns = 0;
+    timed_delay = 0;
+
+    memset (& stats, 0, sizeof stats);
+    stats.rate = rate;
+    stats.frame_size = frame_size;
+    stats.buffer_ms = buffer_ms;
+
+    perfstat.write.plugin = perfstat.decode.plugin = ops->name;
+    perfstat_output_open (& perfstat, frame_size * rate);
+
+    if (ops->write)
+    {
+        device_perfstat.plugin = ops->name;
+        perfstat_register (& device_perfstat);
+    }
+
+    AUDDBG ("Ring buffer: %d ms, %d bytes; blocks of %d bytes.\n", buffer_ms,
+     ring_size, core_chunk);
+
+    if (ops->write)
+    {
+        writer_quit = FALSE;
+
+        if (pthread_create (& writer, NULL, writer_thread, NULL))
+        {
+            fprintf (stderr, "Failed to start output thread.\n");
+            free (ring);
+            ring = NULL;
+            return FALSE;
+        }
+
+        writer_running = TRUE;
+    }
+
+    return TRUE;
+}
+
+void outcore_close (void)
+{
+    if (writer_running)
+    {
+        pthread_mutex_lock (& core_mutex);
+        writer_quit = TRUE;
+        pthread_cond_broadcast (& core_cond);
+        pthread_mutex_unlock (& core_mutex);
+
+        pthread_join (writer, NULL);
+        writer_running = FALSE;
+    }
+
+    AUDDBG ("%" PRId64 " writes of up to %d bytes, %d underruns, %d errors, "
+     "longest write %d us, largest delay %d frames.\n", stats.writes,
+     stats.max_write, stats.underruns, stats.errors,
+     (int) (stats.max_write_ns / 1000), stats.max_delay);
+
+    free (ring);
+    ring = NULL;
+}
+
+int outcore_buffer_free (void)
+{
+    if (paused)
+        return 0;
+
+    return ring_size - (int) (write_pos - LOAD (read_pos));
+}
+
+void outcore_period_wait (void)
+{
+    pthread_mutex_lock (& core_mutex);
+
+    int old_serial = serial;
+
+    /* Audacious waits only when it has filled the buffer as far as it can. */
+    if (! started && ! paused)
+        start_locked ();
+
+    int64_t wait_begin = perfstat_now ();
+
+    while (serial == old_serial && (paused || ring_size - (write_pos - read_pos) < core_chunk))
+        pthread_cond_wait (& core_cond, & core_mutex);
+
+    perfstat.waited += perfstat_now () - wait_begin;
+
+    pthread_mutex_unlock (& core_mutex);
+}
+
+void outcore_write (void * data, int len)
+{
+    int64_t perfstat_begin = perfstat_output_begin (& perfstat, len);
+
+    int64_t pos = write_pos;
+    int offset = pos % ring_size;
+    int part = MIN (len, ring_size - offset);
+
+    assert (len <= ring_size - (int) (pos - LOAD (read_pos)));
+
+    memcpy (ring + offset, data, part);
+    memcpy (ring, (char *) data + part, len - part);
+
+    STORE (write_pos, pos + len);
+
+    pthread_mutex_lock (& core_mutex);
+
+    if (! started && ! paused && write_pos - read_pos == ring_size)
+        start_locked ();
+    else
+        pthread_cond_broadcast (& core_cond);
+
+    pthread_mutex_unlock (& core_mutex);
+
+    perfstat_output_end (& perfstat, perfstat_begin, len);
+}
+
+void outcore_drain (void)
+{
+    AUDDBG ("Draining.\n");
+    pthread_mutex_lock (& core_mutex);
+
+    if (! started)
+        start_locked ();
+
+    draining = TRUE;
+
+    while (! paused && (busy || write_pos - read_pos > 0))
+        pthread_cond_wait (& core_cond, & core_mutex);
+
+    draining = FALSE;
+
+    int remaining = remaining_locked ();
+
+    /* Keep outcore_lock_device callers out while we wait without the lock. */
+    busy = TRUE;
+    pthread_mutex_unlock (& core_mutex);
+
+    if (core_ops->drain)
+        core_ops->drain ();
+    else if (remaining > 0)
+        sleep_frames (remaining);
+
+    pthread_mutex_lock (& core_mutex);
+    busy = FALSE;
+    pthread_cond_broadcast (& core_cond);
+    pthread_mutex_unlock (& core_mutex);
+}
+
+int outcore_output_time (void)
+{
+    pthread_mutex_lock (& core_mutex);
+
+    int64_t frames = timed_pos / core_frame_size - remaining_locked ();
+    int time = flush_time + (int) (MAX (frames, 0) * 1000 / core_rate);
+
+    pthread_mutex_unlock (& core_mutex);
+    return time;
+}
+
+void outcore_pause (bool_t pause)
+{
+    AUDDBG ("%sause.\n", pause ? "P" : "Unp");
+    pthread_mutex_lock (& core_mutex);
+
+    wait_idle_locked ();
+
+    if (pause)
+        timed_delay = remaining_locked ();
+
+    paused = pause;
+    perfstat_output_idle (& perfstat);
+
+    if (started && core_ops->pause)
+    {
+        core_ops->pause (pause);
+
+        /* The device may have dropped what it had queued. */
+        if (pause && core_ops->delay)
+            timed_delay = MIN (timed_delay, MAX (core_ops->delay (), 0));
+    }
+
+    if (! pause)
+        timed_ns = time_ns ();
+
+    pthread_cond_broadcast (& core_cond);
+    pthread_mutex_unlock (& core_mutex);
+}
+
+void outcore_flush (int time)
+{
+    AUDDBG ("Seek requested; discarding buffer.\n");
+    pthread_mutex_lock (& core_mutex);
+
+    wait_idle_locked ();
+
+    if (core_ops->flush)
+        core_ops->flush ();
+
+    STORE (read_pos, 0);
+    STORE (write_pos, 0);
+
+    flush_time = time;
+    started = playing = FALSE;
+    perfstat_output_idle (& perfstat);
+    serial ++;
+
+    record_delay_locked (0);
+
+    pthread_cond_broadcast (& core_cond);
+    pthread_mutex_unlock (& core_mutex);
+}
+
+int outcore_read (void * data, int len)
+{
+    pthread_mutex_lock (& core_mutex);
+
+    int fill = readable_locked ();
+
+    if (! fill)
+    {
+        pthread_mutex_unlock (& core_mutex);
+        return 0;
+    }
+
+    busy = TRUE;
+    pthread_mutex_unlock (& core_mutex);
+
+    int copy = MIN (len, fill);
+    int offset = read_pos % ring_size;
+    int part = MIN (copy, ring_size - offset);
+
+    memcpy (data, ring + offset, part);
+    memcpy ((char *) data + part, ring, copy - part);
+
+    pthread_mutex_lock (& core_mutex);
+
+    busy = FALSE;
+    STORE (read_pos, read_pos + copy);
+    playing = TRUE;
+
+    /* The block just handed over is the only delay we know of. */
+    record_delay_locked (copy / core_frame_size);
+    count_write_locked (copy, 0);
+
+    pthread_cond_broadcast (& core_cond);
+    pthread_mutex_unlock (& core_mutex);
+
+    return copy;
+}
+
+void outcore_lock_device (void)
+{
+    pthread_mutex_lock (& core_mutex);
+    wait_idle_locked ();
+}
+
+void outcore_unlock_device (void)
+{
+    pthread_mutex_unlock (& core_mutex);
+}
+
+void outcore_get_stats (OutCoreStats * out)
+{
+    pthread_mutex_lock (& core_mutex);
+    * out = stats;
+    pthread_mutex_unlock (& core_mutex);
+}
@@ -0,0 +1,114 @@
+/*
+ * Shared Output Core for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_OUTCORE_H
+#define AUDACIOUS_OUTCORE_H
+
+#include <stdint.h>
+
+#include <libaudcore/core.h>
+
+/* The output core sits between Audacious and a device backend.  Audacious
+ * writes into a single-producer, single-consumer ring buffer whose indices are
+ * updated atomically, so write_audio never waits for the device.  The data is
+ * taken out of the ring either by a writer thread owned by the core, which
+ * calls the backend's write function ("push" backends such as OSS and sndio),
+ * or by the backend itself calling outcore_read from a callback of its own
+ * ("pull" backends such as SDL).
+ *
+ * After each block is handed to the device, the core records how many frames
+ * the device still had queued and when.  output_time is the number of frames
+ * taken from the ring, minus that delay, plus the time elapsed since; this is
+ * accurate to the device's own reporting rather than to the size of its
+ * buffer.
+ *
+ * The backend functions are never called concurrently with each other.  All
+ * but write are called with the core's lock held, so they must not wait for a
+ * thread that may itself be calling into the core (SDL's audio callback, for
+ * example).  Backends whose device cannot be used from two threads at once
+ * bracket any other calls (to change the volume, say) with outcore_lock_device
+ * and outcore_unlock_device. */
+
+typedef struct {
+    /* The plugin's name, under which the core's timing statistics are shown
+     * (see perfstat.h). */
+    const char * name;
+
+    /* Writes up to len bytes, blocking until at least some of them are taken.
+     * Returns the number of bytes written or -1 on a fatal error.  NULL for
+     * pull backends. */
+    int (* write) (const void * data, int len);
+
+    /* Returns the number of frames written but not yet played.  Optional; the
+     * delay is taken to be zero if missing. */
+    int (* delay) (void);
+
+    /* Called once the ring has been filled after opening or flushing.
+     * Optional. */
+    void (* start) (void);
+
+    /* Optional; called only once playback has started. */
+    void (* pause) (bool_t pause);
+
+    /* Discards whatever the device has queued.  Optional. */
+    void (* flush) (void);
+
+    /* Waits until the device has played everything it has queued.  Optional;
+     * if missing, the core sleeps for the last known delay instead. */
+    void (* drain) (void);
+} OutCoreOps;
+
+typedef struct {
+    int rate, frame_size;
+    int buffer_ms;          /* size of the ring */
+    int64_t writes;         /* blocks handed to the device */
+    int64_t bytes_written;
+    int max_write;          /* bytes */
+    int64_t write_ns;       /* time spent in the backend's write function */
+    int64_t max_write_ns;
+    int64_t wakeups;        /* times the writer thread was woken up */
+    int underruns;          /* times the ring ran empty during playback */
+    int errors;             /* failed backend writes */
+    int max_delay;          /* frames */
+} OutCoreStats;
+
+/* frame_size is in bytes; period is the preferred block size in frames, or 0
+ * to let the core choose.  Returns FALSE if the writer thread could not be
+ * started. */
+bool_t outcore_open (const OutCoreOps * ops, int rate, int frame_size, int period);
+void outcore_close (void);
+
+int outcore_buffer_free (void);
+void outcore_period_wait (void);
+void outcore_write (void * data, int len);
+void outcore_drain (void);
+int outcore_output_time (void);
+void outcore_pause (bool_t pause);
+void outcore_flush (int time);
+
+/* For pull backends: copies up to len bytes out of the ring and returns the
+ * number copied, which is zero before playback has started and while paused. */
+int outcore_read (void * data, int len);
+
+void outcore_lock_device (void);
+void outcore_unlock_device (void);
+
+void outcore_get_stats (OutCoreStats * stats);
+
+#endif
@@ -0,0 +1,834 @@
+/*
+ * PCM Conversion for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "pcmconv.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <libaudcore/audio.h>
+
+#include "../cpudispatch/cpudispatch.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define USE_X86
+#include <immintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+#define CHUNK 256
+
+typedef void (* InterleaveFunc) (const void * const * planes, void * out, int frames);
+typedef void (* DeinterleaveFunc) (const void * in, void * const * planes, int frames);
+typedef void (* PackFunc) (const int32_t * const * in, void * out, int frames, int shift);
+typedef void (* NarrowFunc) (const int32_t * in, void * out, int samples);
+typedef void (* GainFunc) (int16_t * data, int samples, float gain);
+
+static int width_of (int format)
+{
+    switch (format)
+    {
+        case FMT_U8: case FMT_S8: return 8;
+        case FMT_S16_NE: return 16;
+        case FMT_S24_NE: return 24;
+        default: return 32;
+    }
+}
+
+static int32_t saturate (int64_t v, int width)
+{
+    int64_t max = ((int64_t) 1 << (width - 1)) - 1;
+    return (v > max) ? max : (v < -max - 1) ? -max - 1 : v;
+}
+
+/* ---- plain C ---- */
+
+/* With the channel count a constant, the compiler unrolls the inner loop. */
+#define INTERLEAVE_C(name, type, nch) \
+static void name (const void * const * planes, void * out, int frames) \
+{ \
+    const type * const * in = (const type * const *) planes; \
+    type * wp = out; \
+    for (int i = 0; i < frames; i ++) \
+        for (int c = 0; c < nch; c ++) \
+            * wp ++ = in[c][i]; \
+}
+
+INTERLEAVE_C (interleave_16_2_c, int16_t, 2)
+INTERLEAVE_C (interleave_16_6_c, int16_t, 6)
+INTERLEAVE_C (interleave_16_8_c, int16_t, 8)
+INTERLEAVE_C (interleave_32_2_c, int32_t, 2)
+INTERLEAVE_C (interleave_32_6_c, int32_t, 6)
+INTERLEAVE_C (interleave_32_8_c, int32_t, 8)
+
+#define INTERLEAVE_ANY(type) do { \
+    const type * const * in = (const type * const *) planes; \
+    type * wp = out; \
+    for (int i = 0; i < frames; i ++) \
+        for (int c = 0; c < channels; c ++) \
+            * wp ++ = in[c][i]; \
+} while (0)
+
+static void interleave_any (const void * const * planes, int size, int channels,
+ void * out, int frames)
+{
+    if (size == 1)
+        INTERLEAVE_ANY (int8_t);
+    else if (size == 2)
+        INTERLEAVE_ANY (int16_t);
+    else
+        INTERLEAVE_ANY (int32_t);
+}
+
+static void deinterleave_32_2_c (const void * in, void * const * planes, int frames)
+{
+    const int32_t * rp = in;
+    int32_t * l = planes[0], * r = planes[1];
+
+    for (int i = 0; i < frames; i ++)
+    {
+        l[i] = rp[2 * i];
+        r[i] = rp[2 * i + 1];
+    }
+}
+
+#define DEINTERLEAVE_ANY(type) do { \
+    const type * rp = in; \
+    type * const * out = (type * const *) planes; \
+    for (int i = 0; i < frames; i ++) \
+        for (int c = 0; c < channels; c ++) \
+            out[c][i] = * rp ++; \
+} while (0)
+
+static void deinterleave_any (const void * in, int size, int channels,
+ void * const * planes, int frames)
+{
+    if (size == 1)
+        DEINTERLEAVE_ANY (int8_t);
+    else if (size == 2)
+        DEINTERLEAVE_ANY (int16_t);
+    else
+        DEINTERLEAVE_ANY (int32_t);
+}
+
+static void pack_s16_2_c (const int32_t * const * in, void * out, int frames, int shift)
+{
+    int16_t * wp = out;
+
+    for (int i = 0; i < frames; i ++)
+    {
+        * wp ++ = saturate (in[0][i], 16);
+        * wp ++ = saturate (in[1][i], 16);
+    }
+}
+
+static void pack_s32_2_c (const int32_t * const * in, void * out, int frames, int shift)
+{
+    int32_t * wp = out;
+
+    for (int i = 0; i < frames; i ++)
+    {
+        * wp ++ = (uint32_t) in[0][i] << shift;
+        * wp ++ = (uint32_t) in[1][i] << shift;
+    }
+}
+
+static void narrow_s16_c (const int32_t * in, void * out, int samples)
+{
+    int16_t * wp = out;
+
+    for (int i = 0; i < samples; i ++)
+        wp[i] = saturate (in[i], 16);
+}
+
+static void narrow_s8_c (const int32_t * in, void * out, int samples)
+{
+    int8_t * wp = out;
+
+    for (int i = 0; i < samples; i ++)
+        wp[i] = saturate (in[i], 8);
+}
+
+/* Rounds toward zero, as a cast does. */
+static void gain_s16_c (int16_t * data, int samples, float gain)
+{
+    for (int i = 0; i < samples; i ++)
+    {
+        float v = data[i] * gain;
+        v = v < -32768.0f ? -32768.0f : v;
+        v = v > 32767.0f ? 32767.0f : v;
+        data[i] = (int16_t) v;
+    }
+}
+
+/* Finishes the frames a vector loop left over. */
+static void tail (InterleaveFunc func, const void * const * planes, int nch,
+ int size, void * out, int done, int frames)
+{
+    const void * rest[8];
+
+    for (int c = 0; c < nch; c ++)
+        rest[c] = (const char *) planes[c] + size * done;
+
+    func (rest, (char *) out + size * nch * done, frames - done);
+}
+
+/* ---- SSE2 ---- */
+
+#ifdef USE_X86
+
+__attribute__ ((target ("sse2")))
+static void interleave_16_2_sse2 (const void * const * planes, void * out, int frames)
+{
+    const int16_t * l = planes[0], * r = planes[1];
+    int16_t * wp = out;
+    int i = 0;
+
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (l + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (r + i));
+
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i), _mm_unpacklo_epi16 (a, b));
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i + 8), _mm_unpackhi_epi16 (a, b));
+    }
+
+    tail (interleave_16_2_c, planes, 2, 2, out, i, frames);
+}
+
+__attribute__ ((target ("sse2")))
+static void interleave_32_2_sse2 (const void * const * planes, void * out, int frames)
+{
+    const int32_t * l = planes[0], * r = planes[1];
+    int32_t * wp = out;
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (l + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (r + i));
+
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i), _mm_unpacklo_epi32 (a, b));
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i + 4), _mm_unpackhi_epi32 (a, b));
+    }
+
+    tail (interleave_32_2_c, planes, 2, 4, out, i, frames);
+}
+
+/* Loads four frames of channels c to c + 3 and transposes them, so that
+ * v[k] holds those channels of frame i + k. */
+__attribute__ ((target ("sse2")))
+static inline void transpose4 (const int32_t * const * in, int c, int i, __m128i v[4])
+{
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (in[c] + i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (in[c + 1] + i));
+    __m128i d = _mm_loadu_si128 ((const __m128i *) (in[c + 2] + i));
+    __m128i e = _mm_loadu_si128 ((const __m128i *) (in[c + 3] + i));
+
+    __m128i ab_lo = _mm_unpacklo_epi32 (a, b), ab_hi = _mm_unpackhi_epi32 (a, b);
+    __m128i de_lo = _mm_unpacklo_epi32 (d, e), de_hi = _mm_unpackhi_epi32 (d, e);
+
+    v[0] = _mm_unpacklo_epi64 (ab_lo, de_lo);
+    v[1] = _mm_unpackhi_epi64 (ab_lo, de_lo);
+    v[2] = _mm_unpacklo_epi64 (ab_hi, de_hi);
+    v[3] = _mm_unpackhi_epi64 (ab_hi, de_hi);
+}
+
+__attribute__ ((target ("sse2")))
+static void interleave_32_6_sse2 (const void * const * planes, void * out, int frames)
+{
+    const int32_t * const * in = (const int32_t * const *) planes;
+    int32_t * wp = out;
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i v[4];
+        transpose4 (in, 0, i, v);
+
+        __m128i e = _mm_loadu_si128 ((const __m128i *) (in[4] + i));
+        __m128i f = _mm_loadu_si128 ((const __m128i *) (in[5] + i));
+        __m128i ef_lo = _mm_unpacklo_epi32 (e, f), ef_hi = _mm_unpackhi_epi32 (e, f);
+        __m128i ef[4] = {ef_lo, _mm_srli_si128 (ef_lo, 8), ef_hi, _mm_srli_si128 (ef_hi, 8)};
+
+        for (int k = 0; k < 4; k ++)
+        {
+            _mm_storeu_si128 ((__m128i *) (wp + 6 * (i + k)), v[k]);
+            _mm_storel_epi64 ((__m128i *) (wp + 6 * (i + k) + 4), ef[k]);
+        }
+    }
+
+    tail (interleave_32_6_c, planes, 6, 4, out, i, frames);
+}
+
+__attribute__ ((target ("sse2")))
+static void interleave_32_8_sse2 (const void * const * planes, void * out, int frames)
+{
+    const int32_t * const * in = (const int32_t * const *) planes;
+    int32_t * wp = out;
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i lo[4], hi[4];
+        transpose4 (in, 0, i, lo);
+        transpose4 (in, 4, i, hi);
+
+        for (int k = 0; k < 4; k ++)
+        {
+            _mm_storeu_si128 ((__m128i *) (wp + 8 * (i + k)), lo[k]);
+            _mm_storeu_si128 ((__m128i *) (wp + 8 * (i + k) + 4), hi[k]);
+        }
+    }
+
+    tail (interleave_32_8_c, planes, 8, 4, out, i, frames);
+}
+
+__attribute__ ((target ("sse2")))
+static void deinterleave_32_2_sse2 (const void * in, void * const * planes, int frames)
+{
+    const int32_t * rp = in;
+    int32_t * l = planes[0], * r = planes[1];
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        /* l0 r0 l1 r1 -> l0 l1 r0 r1 */
+        __m128i a = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) (rp + 2 * i)), 0xd8);
+        __m128i b = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) (rp + 2 * i + 4)), 0xd8);
+
+        _mm_storeu_si128 ((__m128i *) (l + i), _mm_unpacklo_epi64 (a, b));
+        _mm_storeu_si128 ((__m128i *) (r + i), _mm_unpackhi_epi64 (a, b));
+    }
+
+    void * rest[2] = {l + i, r + i};
+    deinterleave_32_2_c (rp + 2 * i, rest, frames - i);
+}
+
+__attribute__ ((target ("sse2")))
+static void pack_s16_2_sse2 (const int32_t * const * in, void * out, int frames, int shift)
+{
+    int16_t * wp = out;
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i l = _mm_loadu_si128 ((const __m128i *) (in[0] + i));
+        __m128i r = _mm_loadu_si128 ((const __m128i *) (in[1] + i));
+
+        __m128i v = _mm_packs_epi32 (_mm_unpacklo_epi32 (l, r), _mm_unpackhi_epi32 (l, r));
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i), v);
+    }
+
+    const int32_t * rest[2] = {in[0] + i, in[1] + i};
+    pack_s16_2_c (rest, wp + 2 * i, frames - i, 0);
+}
+
+__attribute__ ((target ("sse2")))
+static void pack_s32_2_sse2 (const int32_t * const * in, void * out, int frames, int shift)
+{
+    int32_t * wp = out;
+    __m128i count = _mm_cvtsi32_si128 (shift);
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128i l = _mm_sll_epi32 (_mm_loadu_si128 ((const __m128i *) (in[0] + i)), count);
+        __m128i r = _mm_sll_epi32 (_mm_loadu_si128 ((const __m128i *) (in[1] + i)), count);
+
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i), _mm_unpacklo_epi32 (l, r));
+        _mm_storeu_si128 ((__m128i *) (wp + 2 * i + 4), _mm_unpackhi_epi32 (l, r));
+    }
+
+    const int32_t * rest[2] = {in[0] + i, in[1] + i};
+    pack_s32_2_c (rest, wp + 2 * i, frames - i, shift);
+}
+
+/* Each step loads before it stores, and stores no further than it loaded,
+ * so these work in place. */
+__attribute__ ((target ("sse2")))
+static void narrow_s16_sse2 (const int32_t * in, void * out, int samples)
+{
+    int16_t * wp = out;
+    int i = 0;
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i a = _mm_loadu_si128 ((const __m128i *) (in + i));
+        __m128i b = _mm_loadu_si128 ((const __m128i *) (in + i + 4));
+        _mm_storeu_si128 ((__m128i *) (wp + i), _mm_packs_epi32 (a, b));
+    }
+
+    narrow_s16_c (in + i, wp + i, samples - i);
+}
+
+__attribute__ ((target ("sse2")))
+static void narrow_s8_sse2 (const int32_t * in, void * out, int samples)
+{
+    int8_t * wp = out;
+    int i = 0;
+
+    for (; i + 16 <= samples; i += 16)
+    {
+        __m128i a = _mm_packs_epi32 (_mm_loadu_si128 ((const __m128i *) (in + i)),
+         _mm_loadu_si128 ((const __m128i *) (in + i + 4)));
+        __m128i b = _mm_packs_epi32 (_mm_loadu_si128 ((const __m128i *) (in + i + 8)),
+         _mm_loadu_si128 ((const __m128i *) (in + i + 12)));
+        _mm_storeu_si128 ((__m128i *) (wp + i), _mm_packs_epi16 (a, b));
+    }
+
+    narrow_s8_c (in + i, wp + i, samples - i);
+}
+
+/* Clamped before converting, so that the packing never saturates and the
+ * result is that of the C version. */
+__attribute__ ((target ("sse2")))
+static void gain_s16_sse2 (int16_t * data, int samples, float gain)
+{
+    __m128 g = _mm_set1_ps (gain);
+    __m128 lo = _mm_set1_ps (-32768.0f), hi = _mm_set1_ps (32767.0f);
+    int i = 0;
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (data + i));
+        __m128i a = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i b = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+
+        __m128 fa = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_cvtepi32_ps (a), g), lo), hi);
+        __m128 fb = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_cvtepi32_ps (b), g), lo), hi);
+
+        _mm_storeu_si128 ((__m128i *) (data + i), _mm_packs_epi32
+         (_mm_cvttps_epi32 (fa), _mm_cvttps_epi32 (fb)));
+    }
+
+    gain_s16_c (data + i, samples - i, gain);
+}
+
+#endif /* USE_X86 */
+
+/* ---- NEON ---- */
+
+#ifdef USE_NEON
+
+static void interleave_16_2_neon (const void * const * planes, void * out, int frames)
+{
+    const int16_t * l = planes[0], * r = planes[1];
+    int16_t * wp = out;
+    int i = 0;
+
+    for (; i + 8 <= frames; i += 8)
+    {
+        int16x8x2_t v = {{vld1q_s16 (l + i), vld1q_s16 (r + i)}};
+        vst2q_s16 (wp + 2 * i, v);
+    }
+
+    tail (interleave_16_2_c, planes, 2, 2, out, i, frames);
+}
+
+static void interleave_32_2_neon (const void * const * planes, void * out, int frames)
+{
+    const int32_t * l = planes[0], * r = planes[1];
+    int32_t * wp = out;
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        int32x4x2_t v = {{vld1q_s32 (l + i), vld1q_s32 (r + i)}};
+        vst2q_s32 (wp + 2 * i, v);
+    }
+
+    tail (interleave_32_2_c, planes, 2, 4, out, i, frames);
+}
+
+static void deinterleave_32_2_neon (const void * in, void * const * planes, int frames)
+{
+    const int32_t * rp = in;
+    int32_t * l = planes[0], * r = planes[1];
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        int32x4x2_t v = vld2q_s32 (rp + 2 * i);
+        vst1q_s32 (l + i, v.val[0]);
+        vst1q_s32 (r + i, v.val[1]);
+    }
+
+    void * rest[2] = {l + i, r + i};
+    deinterleave_32_2_c (rp + 2 * i, rest, frames - i);
+}
+
+static void pack_s16_2_neon (const int32_t * const * in, void * out, int frames, int shift)
+{
+    int16_t * wp = out;
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        int16x4x2_t v = {{vqmovn_s32 (vld1q_s32 (in[0] + i)),
+         vqmovn_s32 (vld1q_s32 (in[1] + i))}};
+        vst2_s16 (wp + 2 * i, v);
+    }
+
+    const int32_t * rest[2] = {in[0] + i, in[1] + i};
+    pack_s16_2_c (rest, wp + 2 * i, frames - i, 0);
+}
+
+static void pack_s32_2_neon (const int32_t * const * in, void * out, int frames, int shift)
+{
+    int32_t * wp = out;
+    int32x4_t count = vdupq_n_s32 (shift);
+    int i = 0;
+
+    for (; i + 4 <= frames; i += 4)
+    {
+        int32x4x2_t v = {{vshlq_s32 (vld1q_s32 (in[0] + i), count),
+         vshlq_s32 (vld1q_s32 (in[1] + i), count)}};
+        vst2q_s32 (wp + 2 * i, v);
+    }
+
+    const int32_t * rest[2] = {in[0] + i, in[1] + i};
+    pack_s32_2_c (rest, wp + 2 * i, frames - i, shift);
+}
+
+static void narrow_s16_neon (const int32_t * in, void * out, int samples)
+{
+    int16_t * wp = out;
+    int i = 0;
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x4_t a = vqmovn_s32 (vld1q_s32 (in + i));
+        int16x4_t b = vqmovn_s32 (vld1q_s32 (in + i + 4));
+        vst1q_s16 (wp + i, vcombine_s16 (a, b));
+    }
+
+    narrow_s16_c (in + i, wp + i, samples - i);
+}
+
+static void narrow_s8_neon (const int32_t * in, void * out, int samples)
+{
+    int8_t * wp = out;
+    int i = 0;
+
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x4_t a = vqmovn_s32 (vld1q_s32 (in + i));
+        int16x4_t b = vqmovn_s32 (vld1q_s32 (in + i + 4));
+        vst1_s8 (wp + i, vqmovn_s16 (vcombine_s16 (a, b)));
+    }
+
+    narrow_s8_c (in + i, wp + i, samples - i);
+}
+
+#endif /* USE_NEON */
+
+/* ---- dispatch ---- */
+
+typedef struct {
+    CpuVariant variant;
+    InterleaveFunc interleave[2][3]; /* 16- and 32-bit; 2, 6 and 8 channels */
+    DeinterleaveFunc deinterleave_32_2;
+    PackFunc pack_s16_2, pack_s32_2;
+    NarrowFunc narrow_s16, narrow_s8;
+    GainFunc gain_s16;
+} KernelSet;
+
+static const KernelSet kernel_sets[] = {
+#if defined (USE_X86)
+ {{"sse2", CPU_SSE2},
+  {{interleave_16_2_sse2, interleave_16_6_c, interleave_16_8_c},
+   {interleave_32_2_sse2, interleave_32_6_sse2, interleave_32_8_sse2}},
+  deinterleave_32_2_sse2, pack_s16_2_sse2, pack_s32_2_sse2, narrow_s16_sse2,
+  narrow_s8_sse2, gain_s16_sse2},
+#elif defined (USE_NEON)
+ {{"neon", CPU_NEON},
+  {{interleave_16_2_neon, interleave_16_6_c, interleave_16_8_c},
+   {interleave_32_2_neon, interleave_32_6_c, interleave_32_8_c}},
+  deinterleave_32_2_neon, pack_s16_2_neon, pack_s32_2_neon, narrow_s16_neon,
+  narrow_s8_neon, gain_s16_c},
+#endif
+ {{"c"},
+  {{interleave_16_2_c, interleave_16_6_c, interleave_16_8_c},
+   {interleave_32_2_c, interleave_32_6_c, interleave_32_8_c}},
+  deinterleave_32_2_c, pack_s16_2_c, pack_s32_2_c, narrow_s16_c, narrow_s8_c,
+  gain_s16_c}};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static const KernelSet * kernels;
+
+static void select_kernels (void)
+{
+    kernels = CPU_DISPATCH ("pcmconv", kernel_sets);
+}
+
+static const KernelSet * get_kernels (void)
+{
+    pthread_once (& once, select_kernels);
+    return kernels;
+}
+
+/* ---- entry points ---- */
+
+void pcm_interleave (const void * const * planes, int format, int channels,
+ void * out, int frames)
+{
+    int size = FMT_SIZEOF (format);
+    int layout = (channels == 2) ? 0 : (channels == 6) ? 1 : (channels == 8) ? 2 : -1;
+
+    if (channels == 1)
+        memmove (out, planes[0], size * frames);
+    else if ((size == 2 || size == 4) && layout >= 0)
+        get_kernels ()->interleave[size == 4][layout] (planes, out, frames);
+    else
+        interleave_any (planes, size, channels, out, frames);
+}
+
+void pcm_deinterleave (const void * in, int format, int channels,
+ void * const * planes, int frames)
+{
+    int size = FMT_SIZEOF (format);
+
+    if (channels == 1)
+        memmove (planes[0], in, size * frames);
+    else if (size == 4 && channels == 2)
+        get_kernels ()->deinterleave_32_2 (in, planes, frames);
+    else
+        deinterleave_any (in, size, channels, planes, frames);
+}
+
+void pcm_pack (const int32_t * const * planes, int bits, int channels,
+ void * out, int format, int frames)
+{
+    const KernelSet * k = get_kernels ();
+    int width = width_of (format);
+    int shift = width - bits;
+
+    if (channels == 2 && width == 16 && ! shift)
+        k->pack_s16_2 (planes, out, frames, 0);
+    else if (channels == 2 && width >= 24 && shift >= 0)
+        k->pack_s32_2 (planes, out, frames, shift);
+    else if (channels == 1 && width == 16 && ! shift)
+        k->narrow_s16 (planes[0], out, frames);
+    else if (channels == 1 && width == 8 && ! shift)
+        k->narrow_s8 (planes[0], out, frames);
+    else
+    {
+        for (int i = 0; i < frames; i ++)
+        {
+            for (int c = 0; c < channels; c ++)
+            {
+                int32_t v = planes[c][i];
+                int32_t s = (shift >= 0) ? (int32_t) ((uint32_t) v << shift) :
+                 saturate (v >> -shift, width);
+                int n = i * channels + c;
+
+                switch (width)
+                {
+                    case 8: ((int8_t *) out)[n] = saturate (s, 8); break;
+                    case 16: ((int16_t *) out)[n] = saturate (s, 16); break;
+                    default: ((int32_t *) out)[n] = s; break;
+                }
+            }
+        }
+    }
+}
+
+/* Integer samples go through 32 bits, aligned to the top. */
+static void to_aligned (const void * in, int format, int32_t * a, int n)
+{
+    switch (format)
+    {
+    case FMT_U8:
+        for (int i = 0; i < n; i ++)
+            a[i] = (uint32_t) (((const uint8_t *) in)[i] ^ 0x80) << 24;
+        break;
+    case FMT_S8:
+        for (int i = 0; i < n; i ++)
+            a[i] = (uint32_t) ((const uint8_t *) in)[i] << 24;
+        break;
+    case FMT_S16_NE:
+        for (int i = 0; i < n; i ++)
+            a[i] = (uint32_t) ((const uint16_t *) in)[i] << 16;
+        break;
+    case FMT_S24_NE:
+        for (int i = 0; i < n; i ++)
+            a[i] = (uint32_t) ((const int32_t *) in)[i] << 8;
+        break;
+    default:
+        memcpy (a, in, sizeof (int32_t) * n);
+        break;
+    }
+}
+
+static void from_aligned (const int32_t * a, void * out, int format, int n)
+{
+    switch (format)
+    {
+    case FMT_U8:
+        for (int i = 0; i < n; i ++)
+            ((uint8_t *) out)[i] = (a[i] >> 24) ^ 0x80;
+        break;
+    case FMT_S8:
+        for (int i = 0; i < n; i ++)
+            ((int8_t *) out)[i] = a[i] >> 24;
+        break;
+    case FMT_S16_NE:
+        for (int i = 0; i < n; i ++)
+            ((int16_t *) out)[i] = a[i] >> 16;
+        break;
+    case FMT_S24_NE:
+        for (int i = 0; i < n; i ++)
+            ((int32_t *) out)[i] = a[i] >> 8;
+        break;
+    default:
+        memmove (out, a, sizeof (int32_t) * n);
+        break;
+    }
+}
+
+/* Rounds to nearest, clipping to the range of the format. */
+static void from_float (const float * f, void * out, int format, int n)
+{
+    int width = width_of (format);
+    double scale = (double) ((int64_t) 1 << (width - 1));
+    int32_t a[CHUNK];
+
+    for (int i = 0; i < n; i ++)
+    {
+        double v = f[i] * scale;
+        v = v < -scale ? -scale : v;
+        v = v > scale - 1 ? scale - 1 : v;
+        a[i] = (int32_t) (v < 0 ? v - 0.5 : v + 0.5);
+    }
+
+    switch (format)
+    {
+    case FMT_U8:
+        for (int i = 0; i < n; i ++)
+            ((uint8_t *) out)[i] = a[i] ^ 0x80;
+        break;
+    case FMT_S8:
+        for (int i = 0; i < n; i ++)
+            ((int8_t *) out)[i] = a[i];
+        break;
+    case FMT_S16_NE:
+        for (int i = 0; i < n; i ++)
+            ((int16_t *) out)[i] = a[i];
+        break;
+    default:
+        memcpy (out, a, sizeof (int32_t) * n);
+        break;
+    }
+}
+
+void pcm_convert (const void * in, int in_format, void * out, int out_format,
+ int samples)
+{
+    int in_size = FMT_SIZEOF (in_format), out_size = FMT_SIZEOF (out_format);
+
+    if (in_format == out_format)
+    {
+        memmove (out, in, in_size * samples);
+        return;
+    }
+
+    /* a chunk is read in full before any of it is written */
+    for (int done = 0; done < samples; done += CHUNK)
+    {
+        int n = MIN (CHUNK, samples - done);
+        const char * rp = (const char *) in + in_size * done;
+        char * wp = (char *) out + out_size * done;
+        int32_t a[CHUNK];
+
+        if (in_format == FMT_FLOAT)
+        {
+            float f[CHUNK];
+            memcpy (f, rp, sizeof (float) * n);
+            from_float (f, wp, out_format, n);
+        }
+        else if (out_format == FMT_FLOAT)
+        {
+            to_aligned (rp, in_format, a, n);
+            for (int i = 0; i < n; i ++)
+                ((float *) wp)[i] = a[i] * (1.0f / 2147483648.0f);
+        }
+        else
+        {
+            to_aligned (rp, in_format, a, n);
+            from_aligned (a, wp, out_format, n);
+        }
+    }
+}
+
+void pcm_gain (void * data, int format, int samples, float gain, bool_t clip)
+{
+    switch (format)
+    {
+    case FMT_FLOAT:
+    {
+        float * f = data;
+
+        for (int i = 0; i < samples; i ++)
+            f[i] *= gain;
+
+        if (clip)
+        {
+            for (int i = 0; i < samples; i ++)
+                f[i] = f[i] < -1 ? -1 : f[i] > 1 ? 1 : f[i];
+        }
+
+        break;
+    }
+    case FMT_U8:
+    case FMT_S8:
+    {
+        uint8_t * p = data;
+        int bias = (format == FMT_U8) ? 0x80 : 0;
+
+        for (int i = 0; i < samples; i ++)
+        {
+            float v = (int8_t) (p[i] ^ bias) * gain;
+            v = v < -128.0f ? -128.0f : v;
+            v = v > 127.0f ? 127.0f : v;
+            p[i] = (uint8_t) (int8_t) v ^ bias;
+        }
+
+        break;
+    }
+    case FMT_S16_NE:
+        get_kernels ()->gain_s16 (data, samples, gain);
+        break;
+    case FMT_S24_NE:
+    case FMT_S32_NE:
+    {
+        /* 16.16 fixed point, exact for the whole 32-bit range */
+        int32_t * p = data;
+        int64_t g = (int64_t) (gain * 65536.0f);
+        int width = width_of (format);
+
+        for (int i = 0; i < samples; i ++)
+            p[i] = saturate ((p[i] * g) >> 16, width);
+
+        break;
+    }
+    }
+}
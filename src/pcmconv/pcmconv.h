@@ -0,0 +1,68 @@
+/*
+ * PCM Conversion for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_PCMCONV_H
+#define AUDACIOUS_PCMCONV_H
+
+#include <stdint.h>
+
+#include <libaudcore/core.h>
+
+/* Sample conversions shared by the input plugins, so that each does not need
+ * its own copy, vectorized or not.  Formats are the native-endian FMT_XXX of
+ * libaudcore/audio.h (U8, S8, S16_NE, S24_NE, S32_NE and FLOAT); S24 is in
+ * the low bytes of 32 bits.  Conversions to a narrower integer format
+ * saturate rather than wrap.  The common cases (stereo, 5.1 and 7.1 layouts;
+ * 16- and 32-bit samples) have SSE2 and NEON versions, picked through
+ * cpudispatch, and give the same results as the plain C ones. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Planar to interleaved and back, in any one format.  For interleave, the
+ * first plane may be the tail end of out itself (starting channels - 1
+ * samples per frame in), which lets a decoder render one channel in place. */
+void pcm_interleave (const void * const * planes, int format, int channels,
+ void * out, int frames);
+void pcm_deinterleave (const void * in, int format, int channels,
+ void * const * planes, int frames);
+
+/* Interleaves 32-bit planes of signed samples with the given number of
+ * significant bits into an integer format, shifting them up or down to fit.
+ * With one channel, this narrows interleaved samples, and out may be the same
+ * buffer as the input. */
+void pcm_pack (const int32_t * const * planes, int bits, int channels,
+ void * out, int format, int frames);
+
+/* Converts between any two formats.  Integer samples are narrowed by
+ * dropping low bits; float is clipped when converted to integer.  out may be
+ * the same buffer as in if its samples are no larger. */
+void pcm_convert (const void * in, int in_format, void * out, int out_format,
+ int samples);
+
+/* Amplifies in place.  Integer samples saturate; float samples are clipped to
+ * [-1, 1] only if clip is set. */
+void pcm_gain (void * data, int format, int samples, float gain, bool_t clip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Plugin Timing Statistics for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "perfstat.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <libaudcore/hook.h>
+
+#define ADD(v, x) __atomic_fetch_add (& (v), (x), __ATOMIC_RELAXED)
+
+/* This file is built into every plugin that uses it, so each plugin has its
+ * own list and its own hook function. */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static PerfStat * registered;
+static char hooked;
+
+int64_t perfstat_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void collect (void * data, void * unused)
+{
+    PerfStatCollector * collector = data;
+
+    pthread_mutex_lock (& mutex);
+
+    for (PerfStat * stat = registered; stat; stat = stat->next)
+        collector->add (stat, collector->user);
+
+    pthread_mutex_unlock (& mutex);
+}
+
+void perfstat_register (PerfStat * stat)
+{
+    pthread_mutex_lock (& mutex);
+
+    PerfStat * * link = & registered;
+    while (* link && * link != stat)
+        link = & (* link)->next;
+
+    if (! * link)
+        * link = stat;
+
+    if (! hooked)
+    {
+        hook_associate ("perfstat collect", collect, NULL);
+        hooked = 1;
+    }
+
+    pthread_mutex_unlock (& mutex);
+}
+
+/* The plugin may be unloaded without being told; the hook must not outlive
+ * it. */
+static void __attribute__ ((destructor)) unregister (void)
+{
+    if (hooked)
+        hook_dissociate ("perfstat collect", collect);
+}
+
+void perfstat_add (PerfStat * stat, int64_t elapsed_ns, int64_t audio_ns)
+{
+    ADD (stat->calls, 1);
+    ADD (stat->total_ns, elapsed_ns);
+    ADD (stat->audio_ns, audio_ns);
+
+    if (audio_ns && elapsed_ns > audio_ns)
+        ADD (stat->late, 1);
+
+    int64_t max = __atomic_load_n (& stat->max_ns, __ATOMIC_RELAXED);
+    while (elapsed_ns > max && ! __atomic_compare_exchange_n (& stat->max_ns,
+     & max, elapsed_ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    int bucket = 0;
+    for (int64_t us = elapsed_ns / 1000; us && bucket < PERFSTAT_BUCKETS - 1;
+     us >>= 1)
+        bucket ++;
+
+    ADD (stat->hist[bucket], 1);
+}
+
+int64_t perfstat_audio_ns (int64_t samples, int channels, int rate)
+{
+    if (channels < 1 || rate < 1)
+        return 0;
+
+    return samples * 1000000000 / ((int64_t) channels * rate);
+}
+
+void perfstat_output_open (PerfStatOutput * out, int bytes_per_second)
+{
+    out->bytes_per_second = bytes_per_second;
+    perfstat_output_idle (out);
+
+    perfstat_register (& out->write);
+    perfstat_register (& out->decode);
+}
+
+void perfstat_output_idle (PerfStatOutput * out)
+{
+    out->last_end = 0;
+    out->waited = 0;
+}
+
+int64_t perfstat_output_begin (PerfStatOutput * out, int length)
+{
+    int64_t now = perfstat_now ();
+    int64_t audio = out->bytes_per_second ? (int64_t) length * 1000000000 /
+     out->bytes_per_second : 0;
+
+    /* The first write after opening has nothing before it to measure. */
+    if (out->last_end)
+        perfstat_add (& out->decode, MAX (now - out->last_end - out->waited,
+         0), audio);
+
+    out->waited = 0;
+    return now;
+}
+
+void perfstat_output_end (PerfStatOutput * out, int64_t begin, int length)
+{
+    int64_t now = perfstat_now ();
+    int64_t audio = out->bytes_per_second ? (int64_t) length * 1000000000 /
+     out->bytes_per_second : 0;
+
+    perfstat_add (& out->write, now - begin, audio);
+    out->last_end = now;
+}
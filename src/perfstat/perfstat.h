@@ -0,0 +1,143 @@
+/*
+ * Plugin Timing Statistics for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_PERFSTAT_H
+#define AUDACIOUS_PERFSTAT_H
+
+#include <stdint.h>
+
+#include <libaudcore/core.h>
+
+/* Each plugin that is timed keeps one PerfStat per thing it times: an effect
+ * its processing, an output its writes and the time between them.  A call is
+ * timed with perfstat_now() before and after, and the result added together
+ * with the length of the audio it covered, so that the time taken can be read
+ * as a share of real time.  The counters are only ever added to, atomically,
+ * so they can be read from any thread while audio is playing.
+ *
+ * Stats are registered on first use.  Whoever wants to see them calls the
+ * "perfstat collect" hook with a PerfStatCollector, whose add function is
+ * then called once for every registered stat.  The stats stay valid until the
+ * plugin that owns them is unloaded, so they are best collected afresh each
+ * time they are shown. */
+
+#define PERFSTAT_BUCKETS 16 /* under 1 us, under 2 us, ... over 16 ms */
+
+typedef struct _PerfStat {
+    const char * plugin; /* "Echo", "ALSA Output" */
+    const char * what;   /* "process", "write", "decode" */
+
+    int64_t calls, total_ns, max_ns, audio_ns;
+    int64_t late;        /* calls taking longer than the audio they covered */
+    int64_t hist[PERFSTAT_BUCKETS];
+
+    struct _PerfStat * next;
+} PerfStat;
+
+typedef struct {
+    void (* add) (PerfStat * stat, void * user);
+    void * user;
+} PerfStatCollector;
+
+#define PERFSTAT_INIT(plugin, what) {plugin, what}
+
+int64_t perfstat_now (void);
+
+/* Registers the stat with the "perfstat collect" hook, if not done already. */
+void perfstat_register (PerfStat * stat);
+
+/* Counts one call that took elapsed_ns over audio lasting audio_ns. */
+void perfstat_add (PerfStat * stat, int64_t elapsed_ns, int64_t audio_ns);
+
+/* The length in nanoseconds of a number of samples (not frames). */
+int64_t perfstat_audio_ns (int64_t samples, int channels, int rate);
+
+/* Wraps the start, process and finish functions of an effect in timed
+ * versions named perfstat_start, perfstat_process and perfstat_finish, to be
+ * used in the plugin header in their place.  process and finish may be the
+ * same function. */
+#define PERFSTAT_EFFECT(name, start, process, finish) \
+static PerfStat perfstat_effect = PERFSTAT_INIT (name, "process"); \
+static int perfstat_channels, perfstat_rate; \
+\
+static void perfstat_start (int * channels, int * rate) \
+{ \
+    perfstat_channels = * channels; \
+    perfstat_rate = * rate; \
+    perfstat_register (& perfstat_effect); \
+    start (channels, rate); \
+} \
+\
+static void perfstat_process (float * * data, int * samples) \
+{ \
+    int64_t audio = perfstat_audio_ns (* samples, perfstat_channels, \
+     perfstat_rate); \
+    int64_t begin = perfstat_now (); \
+    process (data, samples); \
+    perfstat_add (& perfstat_effect, perfstat_now () - begin, audio); \
+} \
+\
+static void perfstat_finish (float * * data, int * samples) \
+{ \
+    int64_t audio = perfstat_audio_ns (* samples, perfstat_channels, \
+     perfstat_rate); \
+    int64_t begin = perfstat_now (); \
+    finish (data, samples); \
+    perfstat_add (& perfstat_effect, perfstat_now () - begin, audio); \
+}
+
+/* Times the write_audio function of an output.  perfstat_output_open() is
+ * called from open_audio with the data rate of the audio to come, and
+ * perfstat_output_write() wraps each write.  Besides the writes themselves,
+ * this records the time from the end of one write to the start of the next,
+ * which is the time the rest of the chain (decoder, effects and the core's own
+ * conversion) took to produce the audio; it is counted as "decode".  Time
+ * spent in period_wait is not part of it, so an output that has period_wait
+ * wraps it in perfstat_output_wait(), and one that is paused or flushed calls
+ * perfstat_output_idle() so that the gap is not counted at all. */
+
+typedef struct {
+    PerfStat write, decode;
+    int bytes_per_second;
+    int64_t last_end, waited;
+} PerfStatOutput;
+
+#define PERFSTAT_OUTPUT_INIT(name) \
+ {PERFSTAT_INIT (name, "write"), PERFSTAT_INIT (name, "decode")}
+
+void perfstat_output_open (PerfStatOutput * out, int bytes_per_second);
+
+#define perfstat_output_write(out, call, length) do { \
+    int64_t perfstat_begin_ = perfstat_output_begin (out, length); \
+    call; \
+    perfstat_output_end (out, perfstat_begin_, length); \
+} while (0)
+
+#define perfstat_output_wait(out, call) do { \
+    int64_t perfstat_begin_ = perfstat_now (); \
+    call; \
+    (out)->waited += perfstat_now () - perfstat_begin_; \
+} while (0)
+
+void perfstat_output_idle (PerfStatOutput * out);
+
+int64_t perfstat_output_begin (PerfStatOutput * out, int length);
+void perfstat_output_end (PerfStatOutput * out, int64_t begin, int length);
+
+#endif
@@ -29,6 +29,29 @@
 #include <libaudcore/audstrings.h>
 #include <libaudcore/inifile.h>
 
+/* Radio station lists in particular come with a title for every entry and no
+ * length (-1); passing those on spares probing each stream just to show it. */
+static Tuple * pls_make_tuple (INIFile * inifile, int i, const char * uri)
+{
+    SPRINTF (title_key, "title%d", i);
+    SPRINTF (length_key, "length%d", i);
+
+    const char * title = inifile_lookup (inifile, "playlist", title_key);
+    const char * length = inifile_lookup (inifile, "playlist", length_key);
+
+    if (! (title && title[0]) && ! (length && atoi (length) > 0))
+        return NULL;
+
+    Tuple * tuple = tuple_new_from_filename (uri);
+
+    if (title && title[0])
+        tuple_set_str (tuple, FIELD_TITLE, NULL, title);
+    if (length && atoi (length) > 0)
+        tuple_set_int (tuple, FIELD_LENGTH, NULL, atoi (length) * 1000);
+
+    return tuple;
+}
+
 static bool_t playlist_load_pls (const char * filename, VFSFile * file,
  char * * title, Index * filenames, Index * tuples)
 {
@@ -59,6 +82,7 @@ static bool_t playlist_load_pls (const char * filename, VFSFile * file,
             continue;
 
         index_append (filenames, str_get (uri));
+        index_append (tuples, pls_make_tuple (inifile, i, uri));
         free (uri);
     }
 
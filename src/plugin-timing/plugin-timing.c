@@ -0,0 +1,414 @@
+/*
+ * Plugin Timing for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include <audacious/drct.h>
+#include <audacious/i18n.h>
+#include <audacious/misc.h>
+#include <audacious/playlist.h>
+#include <audacious/plugin.h>
+#include <audacious/plugins.h>
+#include <audacious/preferences.h>
+#include <libaudcore/hook.h>
+
+#include "../perfstat/perfstat.h"
+
+/* Shows what the effect and output plugins record through perfstat.h.  Once a
+ * second, the stats are collected and shown in a table, and written out to the
+ * "dump-file" setting if it is set.
+ *
+ * The outputs' "decode" time is the time taken by everything before them in
+ * the chain; it is also split up here by the input plugin that was playing,
+ * by adding what was recorded between each collection to the input plugin
+ * current at the time.  The longest single call can only be credited to an
+ * input plugin when it happened while that plugin was playing. */
+
+#define REFRESH_MS 1000
+
+#define LOAD(v) __atomic_load_n (& (v), __ATOMIC_RELAXED)
+
+enum {
+    COL_PLUGIN,
+    COL_STAGE,
+    COL_CALLS,
+    COL_AVERAGE,
+    COL_MAX,
+    COL_P99,
+    COL_LOAD,
+    COL_LATE,
+    N_COLS
+};
+
+static const char * const timing_defaults[] = {
+ "dump-file", "",
+ NULL};
+
+static GHashTable * decoders; /* input plugin name -> PerfStat */
+static const char * decoder; /* input plugin playing, or NULL */
+static PerfStat decode_seen; /* sum of the outputs' decode stats */
+
+static GtkListStore * store;
+static int timer;
+
+static void add_stat (PerfStat * stat, void * list)
+{
+    * (GList * *) list = g_list_prepend (* (GList * *) list, stat);
+}
+
+static GList * collect (void)
+{
+    GList * list = NULL;
+    PerfStatCollector collector = {add_stat, & list};
+
+    hook_call ("perfstat collect", & collector);
+    return g_list_reverse (list);
+}
+
+static void snapshot (const PerfStat * stat, PerfStat * copy)
+{
+    copy->plugin = stat->plugin;
+    copy->what = stat->what;
+    copy->calls = LOAD (stat->calls);
+    copy->total_ns = LOAD (stat->total_ns);
+    copy->max_ns = LOAD (stat->max_ns);
+    copy->audio_ns = LOAD (stat->audio_ns);
+    copy->late = LOAD (stat->late);
+
+    for (int i = 0; i < PERFSTAT_BUCKETS; i ++)
+        copy->hist[i] = LOAD (stat->hist[i]);
+}
+
+static void account_decode (GList * stats)
+{
+    PerfStat sum = {0};
+
+    for (GList * node = stats; node; node = node->next)
+    {
+        PerfStat copy;
+        snapshot (node->data, & copy);
+
+        if (strcmp (copy.what, "decode"))
+            continue;
+
+        sum.calls += copy.calls;
+        sum.total_ns += copy.total_ns;
+        sum.max_ns = MAX (sum.max_ns, copy.max_ns);
+        sum.audio_ns += copy.audio_ns;
+        sum.late += copy.late;
+
+        for (int i = 0; i < PERFSTAT_BUCKETS; i ++)
+            sum.hist[i] += copy.hist[i];
+    }
+
+    /* The sums go backward only when an output has been unloaded or switched;
+     * then there is nothing to credit, only a new starting point. */
+    if (decoder && sum.calls > decode_seen.calls && sum.total_ns >=
+     decode_seen.total_ns)
+    {
+        PerfStat * stat = g_hash_table_lookup (decoders, decoder);
+
+        if (! stat)
+        {
+            stat = g_slice_new0 (PerfStat);
+            stat->plugin = decoder;
+            stat->what = "decode-input";
+            g_hash_table_insert (decoders, (void *) decoder, stat);
+        }
+
+        stat->calls += sum.calls - decode_seen.calls;
+        stat->total_ns += sum.total_ns - decode_seen.total_ns;
+        stat->audio_ns += sum.audio_ns - decode_seen.audio_ns;
+        stat->late += sum.late - decode_seen.late;
+
+        for (int i = 0; i < PERFSTAT_BUCKETS; i ++)
+            stat->hist[i] += MAX (sum.hist[i] - decode_seen.hist[i], 0);
+
+        if (sum.max_ns > decode_seen.max_ns)
+            stat->max_ns = MAX (stat->max_ns, sum.max_ns);
+    }
+
+    decode_seen = sum;
+}
+
+static void update_decoder (void * unused, void * unused2)
+{
+    GList * stats = collect ();
+    account_decode (stats);
+    g_list_free (stats);
+
+    decoder = NULL;
+
+    if (aud_drct_get_playing ())
+    {
+        int list = aud_playlist_get_playing ();
+        PluginHandle * plugin = aud_playlist_entry_get_decoder (list,
+         aud_playlist_get_position (list), TRUE);
+
+        if (plugin)
+            decoder = aud_plugin_get_name (plugin);
+    }
+}
+
+/* Returns the upper bound, in microseconds, of the histogram bucket holding
+ * the given fraction of the calls; for the last bucket, the longest call. */
+static int64_t percentile_us (const PerfStat * stat, double fraction)
+{
+    int64_t want = stat->calls * fraction, seen = 0;
+
+    for (int i = 0; i < PERFSTAT_BUCKETS - 1; i ++)
+    {
+        seen += stat->hist[i];
+        if (seen > want)
+            return (int64_t) 1 << i;
+    }
+
+    return stat->max_ns / 1000;
+}
+
+static void add_row (const PerfStat * stat)
+{
+    char calls[24], average[24], max[24], p99[24], load[24], late[24];
+
+    snprintf (calls, sizeof calls, "%" PRId64, stat->calls);
+    snprintf (average, sizeof average, "%" PRId64, stat->calls ?
+     stat->total_ns / stat->calls / 1000 : 0);
+    snprintf (max, sizeof max, "%" PRId64, stat->max_ns / 1000);
+    snprintf (p99, sizeof p99, "%" PRId64, percentile_us (stat, 0.99));
+    snprintf (load, sizeof load, "%.2f", stat->audio_ns ? 100.0 *
+     stat->total_ns / stat->audio_ns : 0.0);
+    snprintf (late, sizeof late, "%" PRId64, stat->late);
+
+    GtkTreeIter iter;
+    gtk_list_store_append (store, & iter);
+    gtk_list_store_set (store, & iter, COL_PLUGIN, _(stat->plugin),
+     COL_STAGE, stat->what, COL_CALLS, calls, COL_AVERAGE, average,
+     COL_MAX, max, COL_P99, p99, COL_LOAD, load, COL_LATE, late, -1);
+}
+
+static void dump_stat (FILE * file, const PerfStat * stat)
+{
+    fprintf (file, "%s\t%s\t%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%" PRId64
+     "\t%" PRId64 "\t", stat->plugin, stat->what, stat->calls, stat->total_ns,
+     stat->max_ns, stat->audio_ns, stat->late);
+
+    for (int i = 0; i < PERFSTAT_BUCKETS; i ++)
+        fprintf (file, i ? ",%" PRId64 : "%" PRId64, stat->hist[i]);
+
+    fputc ('\n', file);
+}
+
+/* One line per stat, tab-separated; the histogram counts calls taking under
+ * 1 us, under 2 us, and so on, up to 16 ms or longer.  The file is replaced
+ * as a whole, so that it can be read at any time. */
+static void dump (const PerfStat * stats, int n_stats)
+{
+    char * path = aud_get_string ("plugin-timing", "dump-file");
+
+    if (! path[0])
+        goto DONE;
+
+    char * temp = g_strdup_printf ("%s.tmp", path);
+    FILE * file = fopen (temp, "w");
+
+    if (! file)
+    {
+        fprintf (stderr, "plugin-timing: Cannot open %s: %s.\n", temp,
+         strerror (errno));
+        g_free (temp);
+        goto DONE;
+    }
+
+    fprintf (file, "# plugin\tstage\tcalls\ttotal-ns\tmax-ns\taudio-ns\t"
+     "late\thistogram-log2-us\n");
+
+    for (int i = 0; i < n_stats; i ++)
+        dump_stat (file, & stats[i]);
+
+    GHashTableIter iter;
+    void * stat;
+
+    g_hash_table_iter_init (& iter, decoders);
+    while (g_hash_table_iter_next (& iter, NULL, & stat))
+        dump_stat (file, stat);
+
+    if (fclose (file) || rename (temp, path))
+    {
+        fprintf (stderr, "plugin-timing: Cannot write %s: %s.\n", path,
+         strerror (errno));
+        unlink (temp);
+    }
+
+    g_free (temp);
+
+DONE:
+    g_free (path);
+}
+
+static gboolean refresh (void * unused)
+{
+    GList * list = collect ();
+    account_decode (list);
+
+    /* Copy everything first; the counters keep moving while we work. */
+    int n_stats = g_list_length (list);
+    PerfStat * stats = g_new (PerfStat, n_stats);
+
+    int i = 0;
+    for (GList * node = list; node; node = node->next)
+        snapshot (node->data, & stats[i ++]);
+
+    g_list_free (list);
+
+    if (store)
+    {
+        gtk_list_store_clear (store);
+
+        for (i = 0; i < n_stats; i ++)
+            add_row (& stats[i]);
+
+        GHashTableIter iter;
+        void * stat;
+
+        g_hash_table_iter_init (& iter, decoders);
+        while (g_hash_table_iter_next (& iter, NULL, & stat))
+            add_row (stat);
+    }
+
+    dump (stats, n_stats);
+
+    g_free (stats);
+    return TRUE;
+}
+
+static void free_stat (PerfStat * stat)
+{
+    g_slice_free (PerfStat, stat);
+}
+
+static bool_t timing_init (void)
+{
+    aud_config_set_defaults ("plugin-timing", timing_defaults);
+
+    decoders = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+     (GDestroyNotify) free_stat);
+
+    hook_associate ("playback ready", update_decoder, NULL);
+    hook_associate ("playback stop", update_decoder, NULL);
+    update_decoder (NULL, NULL);
+
+    timer = g_timeout_add (REFRESH_MS, refresh, NULL);
+    return TRUE;
+}
+
+static void timing_cleanup (void)
+{
+    g_source_remove (timer);
+    timer = 0;
+
+    hook_dissociate ("playback ready", update_decoder);
+    hook_dissociate ("playback stop", update_decoder);
+
+    g_hash_table_destroy (decoders);
+    decoders = NULL;
+    decoder = NULL;
+    memset (& decode_seen, 0, sizeof decode_seen);
+}
+
+static void add_column (GtkWidget * view, const char * title, int column,
+ bool_t numeric)
+{
+    GtkCellRenderer * renderer = gtk_cell_renderer_text_new ();
+
+    if (numeric)
+        g_object_set (renderer, "xalign", (float) 1, NULL);
+
+    gtk_tree_view_insert_column_with_attributes ((GtkTreeView *) view, -1,
+     title, renderer, "text", column, NULL);
+}
+
+static void widget_destroyed (void)
+{
+    g_object_unref (store);
+    store = NULL;
+}
+
+static void * timing_get_widget (void)
+{
+    store = gtk_list_store_new (N_COLS, G_TYPE_STRING, G_TYPE_STRING,
+     G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+     G_TYPE_STRING);
+
+    GtkWidget * view = gtk_tree_view_new_with_model ((GtkTreeModel *) store);
+
+    add_column (view, _("Plugin"), COL_PLUGIN, FALSE);
+    add_column (view, _("Stage"), COL_STAGE, FALSE);
+    add_column (view, _("Calls"), COL_CALLS, TRUE);
+    add_column (view, _("Average (µs)"), COL_AVERAGE, TRUE);
+    add_column (view, _("Longest (µs)"), COL_MAX, TRUE);
+    add_column (view, _("99% under (µs)"), COL_P99, TRUE);
+    add_column (view, _("Real time (%)"), COL_LOAD, TRUE);
+    add_column (view, _("Late"), COL_LATE, TRUE);
+
+    GtkWidget * scrolled = gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_policy ((GtkScrolledWindow *) scrolled,
+     GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add ((GtkContainer *) scrolled, view);
+    gtk_widget_show_all (scrolled);
+
+    g_signal_connect (scrolled, "destroy", (GCallback) widget_destroyed, NULL);
+
+    refresh (NULL);
+    return scrolled;
+}
+
+static const PreferencesWidget timing_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Statistics File</b>")},
+ {WIDGET_ENTRY, N_("Write to:"), .cfg_type = VALUE_STRING,
+  .csect = "plugin-timing", .cname = "dump-file"},
+ {WIDGET_LABEL, N_("Rewritten every second while Audacious runs; leave empty "
+  "to write nothing.")}};
+
+static const PluginPreferences timing_prefs = {
+ .widgets = timing_widgets,
+ .n_widgets = sizeof timing_widgets / sizeof timing_widgets[0]};
+
+static const char timing_about[] =
+ N_("Plugin Timing\n\n"
+    "Shows how long effect and output plugins take with the audio they are "
+    "given, and how long the input plugin takes to decode it.  \"Real time\" "
+    "is the time taken as a share of the length of the audio; \"Late\" counts "
+    "calls that took longer than the audio they handled.");
+
+AUD_GENERAL_PLUGIN
+(
+    .name = N_("Plugin Timing"),
+    .domain = PACKAGE,
+    .about_text = timing_about,
+    .prefs = & timing_prefs,
+    .init = timing_init,
+    .cleanup = timing_cleanup,
+    .get_widget = timing_get_widget,
+)
@@ -33,3 +33,6 @@ typedef struct {
 int corlett_decode(uint8_t *input, uint32_t input_len, uint8_t **output, uint64_t *size, corlett_t **c);
 uint32_t psfTimeToMS(char *str);
 
+// in plugin.c: a cached ao_get_lib() + corlett_decode() rolled into one
+int ao_get_lib_image(char *filename, uint8_t **output, uint64_t *size, corlett_t **c);
+
@@ -18,3 +18,7 @@ int   spx_seek(uint32_t);
 int32_t spx_stop(void);
 
 extern bool_t stop_flag;
+
+int32_t psx_ram_get(void);
+void psx_ram_put(void);
+void psx_ram_free(void);
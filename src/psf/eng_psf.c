@@ -54,9 +54,9 @@ int			psf_refresh  = -1;
 
 
 // main RAM
-extern uint32_t psx_ram[((2*1024*1024)/4)+4];
+extern uint32_t *psx_ram;
 extern uint32_t psx_scratch[0x400];
-extern uint32_t initial_ram[((2*1024*1024)/4)+4];
+extern uint32_t *initial_ram;
 extern uint32_t initial_scratch[0x400];
 static uint32_t initialPC, initialGP, initialSP;
 
@@ -66,14 +66,16 @@ extern int mips_execute( int cycles );
 extern void mips_set_info(uint32_t state, union cpuinfo *info);
 extern void psx_hw_init(void);
 extern void psx_hw_slice(void);
+extern int psx_hw_idle_slices(int max);
+extern void psx_hw_idle(int slices);
 extern void psx_hw_frame(void);
 extern void setlength(int32_t stop, int32_t fade);
 
 int32_t psf_start(uint8_t *buffer, uint32_t length)
 {
-	uint8_t *file, *lib_decoded, *lib_raw_file, *alib_decoded;
+	uint8_t *file, *lib_decoded, *alib_decoded;
 	uint32_t offset, plength, PC, SP, GP, lengthMS, fadeMS;
-	uint64_t file_len, lib_len, lib_raw_length, alib_len;
+	uint64_t file_len, lib_len, alib_len;
 	corlett_t *lib;
 	int i;
 	union cpuinfo mipsinfo;
@@ -126,32 +128,18 @@ int32_t psf_start(uint8_t *buffer, uint32_t length)
 	// Get the library file, if any
 	if (c->lib[0] != 0)
 	{
-		uint64_t tmp_length;
-
 		#if DEBUG_LOADER
 		printf("Loading library: %s\n", c->lib);
 		#endif
-		if (ao_get_lib(c->lib, &lib_raw_file, &tmp_length) != AO_SUCCESS)
+		if (ao_get_lib_image(c->lib, &lib_decoded, &lib_len, &lib) != AO_SUCCESS)
 		{
 			return AO_FAIL;
 		}
-		lib_raw_length = tmp_length;
-
-		if (lib_raw_file == NULL)
-			return AO_FAIL;
-
-		if (corlett_decode(lib_raw_file, lib_raw_length, &lib_decoded, &lib_len, &lib) != AO_SUCCESS)
-		{
-			free(lib_raw_file);
-			return AO_FAIL;
-		}
-
-		// Free up raw file
-		free(lib_raw_file);
 
 		if (strncmp((char *)lib_decoded, "PS-X EXE", 8))
 		{
 			printf("Major error!  PSF was OK, but referenced library is not!\n");
+			free(lib_decoded);
 			free(lib);
 			return AO_FAIL;
 		}
@@ -202,7 +190,8 @@ int32_t psf_start(uint8_t *buffer, uint32_t length)
 		#endif
 		memcpy(&psx_ram[offset/4], lib_decoded + 2048, plength);
 
-		// Dispose the corlett structure for the lib - we don't use it
+		// Dispose the lib image and corlett structure - we don't use them
+		free(lib_decoded);
 		free(lib);
 	}
 
@@ -222,33 +211,19 @@ int32_t psf_start(uint8_t *buffer, uint32_t length)
 	{
 		if (c->libaux[i][0] != 0)
 		{
-			uint64_t tmp_length;
-
 			#if DEBUG_LOADER
 			printf("Loading aux library: %s\n", c->libaux[i]);
 			#endif
 
-			if (ao_get_lib(c->libaux[i], &lib_raw_file, &tmp_length) != AO_SUCCESS)
+			if (ao_get_lib_image(c->libaux[i], &alib_decoded, &alib_len, &lib) != AO_SUCCESS)
 			{
 				return AO_FAIL;
 			}
-			lib_raw_length = tmp_length;
-
-			if (lib_raw_file == NULL)
-				return AO_FAIL;
-
-			if (corlett_decode(lib_raw_file, lib_raw_length, &alib_decoded, &alib_len, &lib) != AO_SUCCESS)
-			{
-				free(lib_raw_file);
-				return AO_FAIL;
-			}
-
-			// Free up raw file
-			free(lib_raw_file);
 
 			if (strncmp((char *)alib_decoded, "PS-X EXE", 8))
 			{
 				printf("Major error!  PSF was OK, but referenced library is not!\n");
+				free(alib_decoded);
 				free(lib);
 				return AO_FAIL;
 			}
@@ -272,13 +247,13 @@ int32_t psf_start(uint8_t *buffer, uint32_t length)
 
 			memcpy(&psx_ram[offset/4], alib_decoded + 2048, plength);
 
-			// Dispose the corlett structure for the lib - we don't use it
+			// Dispose the lib image and corlett structure - we don't use them
+			free(alib_decoded);
 			free(lib);
 		}
 	}
 
 	free(file);
-//	free(lib_decoded);
 
 	// Finally, set psfby tag
 	strcpy(psfby, "n/a");
@@ -376,12 +351,24 @@ int32_t psf_start(uint8_t *buffer, uint32_t length)
 
 int32_t psf_execute(InputPlayback *playback)
 {
-	int i;
+	int i, quiet;
 
 	while (!stop_flag) {
-		for (i = 0; i < 44100 / 60; i++) {
-			psx_hw_slice();
-			SPUasync(384, (void *) playback);
+		for (i = 0; i < 44100 / 60; i += quiet) {
+			// run the stretches where the CPU is waiting as one block
+			quiet = psx_hw_idle_slices(44100 / 60 - i);
+
+			if (quiet > SPUblocksamples())
+				quiet = SPUblocksamples();
+
+			if (quiet > 0) {
+				psx_hw_idle(quiet);
+				SPUasync(384 * quiet, (void *) playback);
+			} else {
+				psx_hw_slice();
+				SPUasync(384, (void *) playback);
+				quiet = 1;
+			}
 		}
 
 		psx_hw_frame();
@@ -75,8 +75,8 @@
 static corlett_t	*c = NULL;
 
 // main RAM
-extern uint32_t psx_ram[(2*1024*1024)/4];
-extern uint32_t initial_ram[(2*1024*1024)/4];
+extern uint32_t *psx_ram;
+extern uint32_t *initial_ram;
 static uint32_t initialPC, initialSP;
 static uint32_t loadAddr, lengthMS, fadeMS;
 
@@ -271,14 +271,13 @@ uint32_t psf2_load_elf(uint8_t *start, uint32_t len)
 	return entry;
 }
 
-static uint32_t load_file_ex(uint8_t *top, uint8_t *start, uint32_t len, char *file, uint8_t *buf, uint32_t buflen)
+// find a file in a filesystem; returns its directory entry, whose offsets are
+// relative to top, or NULL
+static uint8_t *find_file_ex(uint8_t *top, uint8_t *start, uint32_t len, char *file)
 {
-	int32_t numfiles, i, j;
+	int32_t numfiles, i;
 	uint8_t *cptr;
-	uint32_t offs, uncomp, bsize, cofs, uofs;
-	uint32_t X;
-	uLongf dlength;
-	int uerr;
+	uint32_t offs, uncomp, bsize;
 	char matchname[512], *remainder;
 
 	// strip out to only the directory name
@@ -312,46 +311,200 @@ static uint32_t load_file_ex(uint8_t *top, uint8_t *start, uint32_t len, char *f
 				#if DEBUG_LOADER
 				printf("Drilling into subdirectory [%s] with [%s] at offset %x\n", matchname, remainder, offs);
 				#endif
-				return load_file_ex(top, &top[offs], len-offs, remainder, buf, buflen);
+				return find_file_ex(top, &top[offs], len-offs, remainder);
 			}
 
-			X = (uncomp + bsize - 1) / bsize;
+			return cptr;
+		}
+		else
+		{
+			cptr += 48;
+		}
+	}
 
-			cofs = offs + (X*4);
-			uofs = 0;
-			for (j = 0; j < X; j++)
-			{
-				uint32_t usize;
+	return NULL;
+}
 
-				usize = top[offs+(j*4)] | top[offs+1+(j*4)]<<8 | top[offs+2+(j*4)]<<16 | top[offs+3+(j*4)]<<24;
+// Decompressed files are kept across tracks, keyed by their compressed data:
+// the tracks of a set load the same IRX modules and sequence data, mostly from
+// a shared library, and a file seen before is handed out again rather than
+// inflated again.  The IOP file slots use the cached data in place (it is
+// never written to), so an entry is only dropped once nobody is using it.
+#define FILE_CACHE_MAX	(32*1024*1024)
+#define MAX_FILE_SIZE	(6*1024*1024)
 
-				dlength = buflen - uofs;
+typedef struct
+{
+	uint32_t crc, comp_len;
+	uint8_t *comp;
+	uint32_t size;
+	uint8_t *data;
+	int refs;
+} cached_file;
 
-				uerr = uncompress(&buf[uofs], &dlength, &top[cofs], usize);
-				if (uerr != Z_OK)
-				{
-					printf("Decompress fail: %lx %d!\n", dlength, uerr);
-					return 0xffffffff;
-				}
+static GQueue file_cache = G_QUEUE_INIT;	// most recently used first
+static uint32_t file_cache_size;
 
-				cofs += usize;
-				uofs += dlength;
-			}
+static void free_cached_file(cached_file *f)
+{
+	file_cache_size -= f->comp_len + f->size;
+	free(f->comp);
+	free(f->data);
+	free(f);
+}
+
+static void trim_file_cache(void)
+{
+	GList *node, *prev;
 
-			return uncomp;
+	for (node = file_cache.tail; node && file_cache_size > FILE_CACHE_MAX; node = prev)
+	{
+		cached_file *f = node->data;
+
+		prev = node->prev;
+		if (!f->refs)
+		{
+			g_queue_delete_link(&file_cache, node);
+			free_cached_file(f);
 		}
-		else
+	}
+}
+
+static cached_file *get_file(char *file)
+{
+	uint8_t *top = NULL, *entry = NULL;
+	uint32_t offs, uncomp, bsize, blocks, comp_len, fs_len = 0, cofs, uofs, crc;
+	uLongf dlength;
+	cached_file *f;
+	GList *node;
+	int i, uerr;
+
+	for (i = 0; i < num_fs && !entry; i++)
+	{
+		top = filesys[i];
+		fs_len = fssize[i];
+		entry = find_file_ex(top, top, fs_len, file);
+	}
+
+	if (!entry)
+		return NULL;
+
+	offs = entry[36] | entry[37]<<8 | entry[38]<<16 | entry[39]<<24;
+	uncomp = entry[40] | entry[41]<<8 | entry[42]<<16 | entry[43]<<24;
+	bsize = entry[44] | entry[45]<<8 | entry[46]<<16 | entry[47]<<24;
+
+	if ((bsize == 0) || (uncomp > MAX_FILE_SIZE))
+		return NULL;
+
+	// the block size table, then the blocks
+	blocks = (uncomp + bsize - 1) / bsize;
+	if ((offs > fs_len) || (blocks > (fs_len - offs) / 4))
+		return NULL;
+
+	comp_len = blocks * 4;
+	for (i = 0; i < blocks; i++)
+	{
+		uint32_t usize;
+
+		usize = top[offs+(i*4)] | top[offs+1+(i*4)]<<8 | top[offs+2+(i*4)]<<16 | top[offs+3+(i*4)]<<24;
+		if (usize > fs_len - offs - comp_len)
+			return NULL;
+
+		comp_len += usize;
+	}
+
+	crc = crc32(0, &top[offs], comp_len);
+
+	for (node = file_cache.head; node; node = node->next)
+	{
+		f = node->data;
+
+		if ((f->crc == crc) && (f->comp_len == comp_len) && (f->size == uncomp) && !memcmp(f->comp, &top[offs], comp_len))
 		{
-			cptr += 48;
+			g_queue_unlink(&file_cache, node);
+			g_queue_push_head_link(&file_cache, node);
+			return f;
 		}
 	}
 
-	return 0xffffffff;
+	f = (cached_file *)calloc(1, sizeof(cached_file));
+	if (!f)
+		return NULL;
+
+	f->crc = crc;
+	f->comp_len = comp_len;
+	f->size = uncomp;
+	f->comp = (uint8_t *)malloc(comp_len ? comp_len : 1);
+	f->data = (uint8_t *)calloc(1, uncomp ? uncomp : 1);
+	file_cache_size += comp_len + uncomp;
+
+	if (!f->comp || !f->data)
+	{
+		free_cached_file(f);
+		return NULL;
+	}
+
+	memcpy(f->comp, &top[offs], comp_len);
+
+	cofs = offs + (blocks*4);
+	uofs = 0;
+	for (i = 0; i < blocks; i++)
+	{
+		uint32_t usize;
+
+		usize = top[offs+(i*4)] | top[offs+1+(i*4)]<<8 | top[offs+2+(i*4)]<<16 | top[offs+3+(i*4)]<<24;
+
+		dlength = uncomp - uofs;
+
+		uerr = uncompress(&f->data[uofs], &dlength, &top[cofs], usize);
+		if (uerr != Z_OK)
+		{
+			printf("Decompress fail: %lx %d!\n", dlength, uerr);
+			free_cached_file(f);
+			return NULL;
+		}
+
+		cofs += usize;
+		uofs += dlength;
+	}
+
+	g_queue_push_head(&file_cache, f);
+	return f;
 }
 
-static uint32_t load_file(int fs, char *file, uint8_t *buf, uint32_t buflen)
+// find a file on our filesystems and return its contents, or NULL.  The data
+// is shared with the cache: it must not be written to, and is given back with
+// psf2_unmap_file().
+uint8_t *psf2_map_file(char *file, uint32_t *len)
 {
-	return load_file_ex(filesys[fs], filesys[fs], fssize[fs], file, buf, buflen);
+	cached_file *f = get_file(file);
+
+	if (!f)
+		return NULL;
+
+	f->refs++;
+	*len = f->size;
+
+	trim_file_cache();
+	return f->data;
+}
+
+void psf2_unmap_file(uint8_t *data)
+{
+	GList *node;
+
+	for (node = file_cache.head; node; node = node->next)
+	{
+		cached_file *f = node->data;
+
+		if (f->data == data)
+		{
+			f->refs--;
+			break;
+		}
+	}
+
+	trim_file_cache();
 }
 
 #if 0
@@ -427,27 +580,9 @@ static dump_files(int fs, uint8_t *buf, uint32_t buflen)
 }
 #endif
 
-// find a file on our filesystems
-uint32_t psf2_load_file(char *file, uint8_t *buf, uint32_t buflen)
-{
-	int i;
-	uint32_t flen;
-
-	for (i = 0; i < num_fs; i++)
-	{
-		flen = load_file(i, file, buf, buflen);
-		if (flen != 0xffffffff)
-		{
-			return flen;
-		}
-	}
-
-	return 0xffffffff;
-}
-
 int32_t psf2_start(uint8_t *buffer, uint32_t length)
 {
-	uint8_t *file, *lib_decoded;
+	uint8_t *file, *lib_decoded, *irx;
 	uint32_t irx_len;
 	uint64_t file_len, lib_raw_length, lib_len;
 	uint8_t *buf;
@@ -519,15 +654,14 @@ int32_t psf2_start(uint8_t *buffer, uint32_t length)
 	#endif
 
 	// load psf2.irx, which kicks everything off
-	buf = (uint8_t *)malloc(512*1024);
-	irx_len = psf2_load_file("psf2.irx", buf, 512*1024);
+	irx = psf2_map_file("psf2.irx", &irx_len);
 
-	if (irx_len != 0xffffffff)
+	if (irx)
 	{
-		initialPC = psf2_load_elf(buf, irx_len);
+		initialPC = psf2_load_elf(irx, irx_len);
 		initialSP = 0x801ffff0;
+		psf2_unmap_file(irx);
 	}
-	free(buf);
 
 	if (initialPC == 0xffffffff)
 	{
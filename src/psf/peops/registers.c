@@ -371,6 +371,7 @@ static void SoundOn(int start,int end,u16 val)     // SOUND ON PSX COMAND
     {
      s_chan[ch].bIgnoreLoop=0;
      s_chan[ch].bNew=1;
+     dwPlayChannel|=(1<<ch);
     }
   }
 }
@@ -113,6 +113,7 @@ static int             iVolume;
 // MAIN infos struct for each channel
 
 static SPUCHAN         s_chan[MAXCHAN+1];                     // channel + 1 infos (1 is security for fmod handling)
+static u32             dwPlayChannel=0;                       // bit set for each channel that may be new or playing
 static REVERBInfo      rvb;
 
 static u32   dwNoiseVal=1;                          // global noise generator
@@ -216,6 +217,19 @@ void setlength(s32 stop, s32 fade)
  }
 }
 
+// How many samples SPUasync can mix in one call: the output buffer is only
+// handed on (or thrown away while seeking) at the end of a call, so a block
+// must not run past the end of the buffer or past the seek target.
+int SPUblocksamples(void)
+{
+ int left=735-(int)((((unsigned char *)pS)-((unsigned char *)pSpuBuffer))/4);
+
+ if(seektime!=0 && sampcount<seektime && seektime-sampcount<(u32)left)
+  left=seektime-sampcount;
+
+ return(left);
+}
+
 #define CLIP(_x) {if(_x>32767) _x=32767; if(_x<-32767) _x=-32767;}
 int SPUasync(u32 cycles, void *data)
 {
@@ -242,8 +256,13 @@ int SPUasync(u32 cycles, void *data)
     {
      for(ch=0;ch<MAXCHAN;ch++)                         // loop em all.
       {
+       if(!(dwPlayChannel&(1<<ch))) continue;          // silent since we last looked? next
        if(s_chan[ch].bNew) StartSound(ch);             // start new sound
-       if(!s_chan[ch].bOn) continue;                   // channel not playing? next
+       if(!s_chan[ch].bOn)                             // channel not playing? forget it and next
+        {
+         dwPlayChannel&=~(1<<ch);
+         continue;
+        }
 
 
        if(s_chan[ch].iActFreq!=s_chan[ch].iUsedFreq)   // new psx frequency?
@@ -557,6 +576,7 @@ int SPUinit(void)
 {
  spuMemC=(u8*)spuMem;                      // just small setup
  memset((void *)s_chan,0,MAXCHAN*sizeof(SPUCHAN));
+ dwPlayChannel=0;
  memset((void *)&rvb,0,sizeof(REVERBInfo));
  memset(regArea,0,sizeof(regArea));
  memset(spuMem,0,sizeof(spuMem));
@@ -626,6 +646,7 @@ int SPUopen(void)
 
  spuMemC=(u8*)spuMem;
  memset((void *)s_chan,0,(MAXCHAN+1)*sizeof(SPUCHAN));
+ dwPlayChannel=0;
  pSpuIrq=0;
 
  iVolume=255; //85;
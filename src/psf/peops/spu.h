@@ -27,6 +27,7 @@
 void sexyd_update(unsigned char* pSound,long lBytes);
 
 int SPUasync(u32 cycles, void *data);
+int SPUblocksamples(void);
 void SPU_flushboot(void);
 int SPUinit(void);
 int SPUopen(void);
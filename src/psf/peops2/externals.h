@@ -295,6 +295,7 @@ extern int      iCycle;
 extern short *  pS;
 extern unsigned long dwNewChannel2[];
 extern unsigned long dwEndChannel2[];
+extern unsigned long dwPlayChannel2[];
 
 extern int iSpuAsyncWait;
 
@@ -1125,6 +1125,7 @@ void SoundOn(int start,int end,unsigned short val)     // SOUND ON PSX COMAND
      s_chan[ch].bIgnoreLoop=0;
      s_chan[ch].bNew=1;
      dwNewChannel2[ch/24]|=(1<<(ch%24));               // bitfield for faster testing
+     dwPlayChannel2[ch/24]|=(1<<(ch%24));
     }
   }
 }
@@ -146,6 +146,7 @@ int             bSPUIsOpen=0;
 
 unsigned long dwNewChannel2[2];                        // flags for faster testing, if new channel starts
 unsigned long dwEndChannel2[2];
+unsigned long dwPlayChannel2[2];                       // set for each channel that may be new or playing
 
 // UNUSED IN PS2 YET
 void (CALLBACK *irqCallback)(void)=0;                  // func of main emu, called on spu irq
@@ -423,8 +424,13 @@ static void *MAINThread(int samp2run, void *data)
     {
      for(ch=0;ch<MAXCHAN;ch++)                         // loop em all... we will collect 1 ms of sound of each playing channel
       {
+       if(!(dwPlayChannel2[ch/24]&(1<<(ch%24)))) continue; // silent since we last looked? next
        if(s_chan[ch].bNew) StartSound(ch);             // start new sound
-       if(!s_chan[ch].bOn) continue;                   // channel not playing? next
+       if(!s_chan[ch].bOn)                             // channel not playing? forget it and next
+        {
+         dwPlayChannel2[ch/24]&=~(1<<(ch%24));
+         continue;
+        }
 
        if(s_chan[ch].iActFreq!=s_chan[ch].iUsedFreq)   // new psx frequency?
         {
@@ -948,6 +954,8 @@ EXPORT_GCC long CALLBACK SPU2open(void *pDsp)
  dwNewChannel2[1]=0;
  dwEndChannel2[0]=0;
  dwEndChannel2[1]=0;
+ dwPlayChannel2[0]=0;
+ dwPlayChannel2[1]=0;
  spuCtrl2[0]=0;
  spuCtrl2[1]=0;
  spuStat2[0]=0;
@@ -29,6 +29,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
 
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
@@ -37,6 +40,7 @@
 #include "ao.h"
 #include "corlett.h"
 #include "eng_protos.h"
+#include "../decodeahead/decodeahead.h"
 
 typedef enum {
     ENG_NONE = 0,
@@ -80,14 +84,25 @@ static PSFEngine psf_probe(uint8_t *buffer)
 /* ao_get_lib: called to load secondary files */
 static char *path;
 
+/* Libraries are named relative to the file being played.  dirname() may
+ * modify its argument, so work on a copy of the path. */
+static char *ao_lib_path(const char *filename)
+{
+	char *dir = strdup(path);
+	char *full = g_strdup_printf("%s/%s", dirname(dir), filename);
+
+	free(dir);
+	return full;
+}
+
 int ao_get_lib(char *filename, uint8_t **buffer, uint64_t *length)
 {
 	void *filebuf;
 	int64_t size;
 
-	char *dirpath = dirname(path);
-	SPRINTF(path2, "%s/%s", dirpath, filename);
-	vfs_file_get_contents(path2, &filebuf, &size);
+	char *uri = ao_lib_path(filename);
+	vfs_file_get_contents(uri, &filebuf, &size);
+	g_free(uri);
 
 	*buffer = filebuf;
 	*length = (uint64_t)size;
@@ -95,23 +110,272 @@ int ao_get_lib(char *filename, uint8_t **buffer, uint64_t *length)
 	return AO_SUCCESS;
 }
 
+/* Decoded libraries, most recently used first.  All the tracks of a set
+ * usually share one large library, which every track (and every seek, since
+ * seeking restarts the engine) would otherwise read and inflate again. */
+#define LIB_CACHE_MAX (32 << 20)
+
+typedef struct {
+	char *uri;
+	time_t mtime;
+	off_t file_size;
+	uint8_t *image;
+	uint64_t size;
+	corlett_t *tags;
+} LibCacheEntry;
+
+static GQueue lib_cache = G_QUEUE_INIT;
+static uint64_t lib_cache_size = 0;
+static pthread_mutex_t lib_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *memdup(const void *mem, size_t size)
+{
+	void *copy = malloc(size);
+
+	if (copy)
+		memcpy(copy, mem, size);
+
+	return copy;
+}
+
+static void lib_cache_free(LibCacheEntry *e)
+{
+	lib_cache_size -= e->size;
+	g_free(e->uri);
+	free(e->image);
+	free(e->tags);
+	free(e);
+}
+
+/* Only local files are cached, since nothing else tells us reliably
+ * whether the library changed. */
+static bool_t lib_stat(const char *uri, struct stat *st)
+{
+	char *local = uri_to_filename(uri);
+	bool_t ok = local && !stat(local, st);
+
+	free(local);
+	return ok;
+}
+
+static GList *lib_cache_find(const char *uri)
+{
+	GList *node;
+
+	for (node = lib_cache.head; node; node = node->next)
+	{
+		if (!strcmp(((LibCacheEntry *)node->data)->uri, uri))
+			return node;
+	}
+
+	return NULL;
+}
+
+/* Copies an entry out to the caller, who frees the copies as it would the
+ * results of corlett_decode(). */
+static int lib_cache_copy(LibCacheEntry *e, uint8_t **image, uint64_t *size, corlett_t **c)
+{
+	*image = memdup(e->image, e->size);
+	*c = memdup(e->tags, sizeof(corlett_t));
+
+	if (!*image || !*c)
+	{
+		free(*image);
+		free(*c);
+		return AO_FAIL;
+	}
+
+	*size = e->size;
+	return AO_SUCCESS;
+}
+
+/* ao_get_lib_image: like ao_get_lib followed by corlett_decode, but decodes
+ * each library only once.  The reserved section of the library is not
+ * available (res_section is NULL). */
+int ao_get_lib_image(char *filename, uint8_t **image, uint64_t *size, corlett_t **c)
+{
+	char *uri = ao_lib_path(filename);
+	struct stat st;
+	bool_t cacheable = lib_stat(uri, &st);
+	void *raw;
+	int64_t raw_size;
+	int ret;
+
+	if (cacheable)
+	{
+		GList *node;
+
+		pthread_mutex_lock(&lib_cache_mutex);
+
+		if ((node = lib_cache_find(uri)))
+		{
+			LibCacheEntry *e = node->data;
+
+			if (e->mtime == st.st_mtime && e->file_size == st.st_size)
+			{
+				g_queue_unlink(&lib_cache, node);
+				g_queue_push_head_link(&lib_cache, node);
+
+				ret = lib_cache_copy(e, image, size, c);
+
+				pthread_mutex_unlock(&lib_cache_mutex);
+				g_free(uri);
+				return ret;
+			}
+
+			/* the file has changed */
+			g_queue_delete_link(&lib_cache, node);
+			lib_cache_free(e);
+		}
+
+		pthread_mutex_unlock(&lib_cache_mutex);
+	}
+
+	vfs_file_get_contents(uri, &raw, &raw_size);
+
+	if (!raw)
+	{
+		g_free(uri);
+		return AO_FAIL;
+	}
+
+	ret = corlett_decode(raw, raw_size, image, size, c);
+	free(raw);
+
+	if (ret != AO_SUCCESS)
+	{
+		g_free(uri);
+		return ret;
+	}
+
+	/* pointed into the raw file */
+	(*c)->res_section = NULL;
+	(*c)->res_size = 0;
+
+	if (cacheable && *size <= LIB_CACHE_MAX)
+	{
+		LibCacheEntry *e = malloc(sizeof(LibCacheEntry));
+
+		if (e && (e->image = memdup(*image, *size)) && (e->tags = memdup(*c, sizeof(corlett_t))))
+		{
+			GList *node;
+
+			e->uri = uri;
+			e->mtime = st.st_mtime;
+			e->file_size = st.st_size;
+			e->size = *size;
+			uri = NULL;
+
+			pthread_mutex_lock(&lib_cache_mutex);
+
+			/* someone else may have decoded it meanwhile */
+			if ((node = lib_cache_find(e->uri)))
+			{
+				lib_cache_free(node->data);
+				g_queue_delete_link(&lib_cache, node);
+			}
+
+			g_queue_push_head(&lib_cache, e);
+			lib_cache_size += e->size;
+
+			while (lib_cache_size > LIB_CACHE_MAX)
+				lib_cache_free(g_queue_pop_tail(&lib_cache));
+
+			pthread_mutex_unlock(&lib_cache_mutex);
+		}
+		else if (e)
+		{
+			free(e->image);
+			free(e);
+		}
+	}
+
+	g_free(uri);
+	return AO_SUCCESS;
+}
+
+static void lib_cache_clear(void)
+{
+	LibCacheEntry *e;
+
+	pthread_mutex_lock(&lib_cache_mutex);
+
+	while ((e = g_queue_pop_head(&lib_cache)))
+		lib_cache_free(e);
+
+	pthread_mutex_unlock(&lib_cache_mutex);
+}
+
+static void psf2_cleanup(void)
+{
+	lib_cache_clear();
+	psx_ram_free();
+}
+
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static int seek = 0;
+static DecodeAhead decodeahead = DECODEAHEAD_INIT;
+static PSFEngineFunctors *engine;
 bool_t stop_flag = FALSE;
 
-Tuple *psf2_tuple(const char *filename, VFSFile *file)
+/* Reads only the header and tags of a PSF file, skipping the reserved area
+ * and the program, which may be megabytes.  corlett_decode() gets the header
+ * with both marked empty in front of the tags, so it only parses the tags. */
+static corlett_t *psf_read_tags(const char *filename, VFSFile *file)
 {
-	Tuple *t;
+	uint8_t header[16], *buf;
+	int64_t size, skip, tags_size;
 	corlett_t *c;
-	void *buf;
-	int64_t sz;
 
-	vfs_file_get_contents (filename, & buf, & sz);
+	if ((size = vfs_fsize(file)) < 0)
+	{
+		/* no size to go by; fall back to reading it all */
+		void *all;
+
+		vfs_file_get_contents(filename, &all, &size);
+		if (!all)
+			return NULL;
+
+		if (corlett_decode(all, size, NULL, NULL, &c) != AO_SUCCESS)
+			c = NULL;
+		else
+			c->res_section = NULL;
+
+		free(all);
+		return c;
+	}
+
+	if (vfs_fseek(file, 0, SEEK_SET) || vfs_fread(header, 1, 16, file) < 16)
+		return NULL;
+
+	skip = (int64_t)(header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24) +
+	       (int64_t)(header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24);
+	if (16 + skip > size)
+		return NULL;
 
-	if (!buf)
+	tags_size = size - 16 - skip;
+	if (!(buf = malloc(16 + tags_size)))
 		return NULL;
 
-	if (corlett_decode(buf, sz, NULL, NULL, &c) != AO_SUCCESS)
+	memcpy(buf, header, 4);
+	memset(buf + 4, 0, 12);
+
+	if (vfs_fseek(file, 16 + skip, SEEK_SET) ||
+	    vfs_fread(buf + 16, 1, tags_size, file) < tags_size ||
+	    corlett_decode(buf, 16 + tags_size, NULL, NULL, &c) != AO_SUCCESS)
+		c = NULL;
+	else
+		c->res_section = NULL;
+
+	free(buf);
+	return c;
+}
+
+Tuple *psf2_tuple(const char *filename, VFSFile *file)
+{
+	Tuple *t;
+	corlett_t *c;
+
+	if (!(c = psf_read_tags(filename, file)))
 		return NULL;
 
 	t = tuple_new_from_filename(filename);
@@ -127,33 +391,79 @@ Tuple *psf2_tuple(const char *filename, VFSFile *file)
 	tuple_set_str(t, -1, "console", "PlayStation 1/2");
 
 	free(c);
-	free(buf);
 
 	return t;
 }
 
-static bool_t psf2_play(InputPlayback * data, const char * filename, VFSFile * file, int start_time, int stop_time, bool_t pause)
-{
+typedef struct {
+	InputPlayback *playback;
 	void *buffer;
 	int64_t size;
+} render_state;
+
+/* The engines push their output through psf2_update(), which hands it on to
+ * the decode-ahead ring.  An engine returns from execute() at the end of the
+ * song, when stopped, and on a backward seek, which it cannot do itself and
+ * which is done here by starting it over. */
+static bool_t psf2_render(DecodeAhead *d, void *user)
+{
+	render_state *rs = user;
+
+	for (;;)
+	{
+		engine->execute(rs->playback);
+
+		int time = decodeahead_get_seek(d);
+
+		if (time < 0)
+		{
+			if (!decodeahead_finish(d))
+				break;
+
+			time = decodeahead_get_seek(d);
+		}
+
+		engine->stop();
+
+		if (engine->start(rs->buffer, rs->size) != AO_SUCCESS)
+			return FALSE;
+
+		engine->seek(time);
+		stop_flag = FALSE;
+		decodeahead_seek_done(d);
+	}
+
+	engine->stop();
+	return TRUE;
+}
+
+static bool_t psf2_play(InputPlayback * data, const char * filename, VFSFile * file, int start_time, int stop_time, bool_t pause)
+{
+	render_state rs = {data};
 	PSFEngine eng;
-	PSFEngineFunctors *f;
 	bool_t error = FALSE;
 
 	path = strdup(filename);
-	vfs_file_get_contents (filename, & buffer, & size);
+	vfs_file_get_contents (filename, & rs.buffer, & rs.size);
 
-	eng = psf_probe(buffer);
+	eng = psf_probe(rs.buffer);
 	if (eng == ENG_NONE || eng == ENG_COUNT)
 	{
-		free(buffer);
+		free(rs.buffer);
+		return FALSE;
+	}
+
+	if (psx_ram_get() != AO_SUCCESS)
+	{
+		free(rs.buffer);
 		return FALSE;
 	}
 
-	f = &psf_functor_map[eng];
-	if (f->start(buffer, size) != AO_SUCCESS)
+	engine = &psf_functor_map[eng];
+	if (engine->start(rs.buffer, rs.size) != AO_SUCCESS)
 	{
-		free(buffer);
+		psx_ram_put();
+		free(rs.buffer);
 		return FALSE;
 	}
 
@@ -164,35 +474,14 @@ static bool_t psf2_play(InputPlayback * data, const char * filename, VFSFile * f
 	stop_flag = FALSE;
 	data->set_pb_ready(data);
 
-	for (;;)
-	{
-		f->execute(data);
-
-		if (seek)
-		{
-			data->output->flush(seek);
-
-			f->stop();
-
-			if (f->start(buffer, size) == AO_SUCCESS)
-			{
-				f->seek(seek);
-				seek = 0;
-				continue;
-			}
-			else
-				break;
-		}
-
-		f->stop();
-		break;
-	}
+	error = ! decodeahead_play(&decodeahead, data, 44100, 4, psf2_render, &rs);
+	psx_ram_put();
 
 	pthread_mutex_lock (& mutex);
 	stop_flag = TRUE;
 	pthread_mutex_unlock (& mutex);
 
-	free(buffer);
+	free(rs.buffer);
 	free(path);
 
 	return ! error;
@@ -200,27 +489,21 @@ static bool_t psf2_play(InputPlayback * data, const char * filename, VFSFile * f
 
 void psf2_update(unsigned char *buffer, long count, InputPlayback *playback)
 {
-	if (buffer == NULL)
+	if (buffer == NULL || !decodeahead_write(&decodeahead, buffer, count))
 	{
 		stop_flag = TRUE;
-
 		return;
 	}
 
-	playback->output->write_audio (buffer, count);
+	int time = decodeahead_get_seek(&decodeahead);
 
-	if (seek)
+	if (time >= 0)
 	{
-		if (psf2_seek(seek))
-		{
-			playback->output->flush(seek);
-			seek = 0;
-		}
+		/* the engine skips forward on its own, leaving out the output */
+		if (engine->seek(time))
+			decodeahead_seek_done(&decodeahead);
 		else
-		{
 			stop_flag = TRUE;
-			return;
-		}
 	}
 }
 
@@ -230,7 +513,7 @@ void psf2_Stop(InputPlayback *playback)
 	if (! stop_flag)
 	{
 		stop_flag = TRUE;
-		playback->output->abort_write ();
+		decodeahead_stop(&decodeahead);
 	}
 	pthread_mutex_unlock (& mutex);
 }
@@ -252,7 +535,7 @@ int psf2_is_our_fd(const char *filename, VFSFile *file)
 
 static void psf2_Seek(InputPlayback *playback, int time)
 {
-	seek = time;
+	decodeahead_seek(&decodeahead, time);
 }
 
 static const char *psf2_fmts[] = { "psf", "minipsf", "psf2", "minipsf2", "spu", "spx", NULL };
@@ -261,6 +544,7 @@ AUD_INPUT_PLUGIN
 (
 	.name = N_("OpenPSF PSF1/PSF2 Decoder"),
 	.domain = PACKAGE,
+	.cleanup = psf2_cleanup,
 	.play = psf2_play,
 	.stop = psf2_Stop,
 	.pause = psf2_pause,
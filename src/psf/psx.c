@@ -15,6 +15,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <glib.h>
+
 #include "ao.h"
 #include "cpuintrf.h"
 #include "psx.h"
@@ -61,6 +63,8 @@
 #define CAUSE_CE2 ( 2L << 28 )
 #define CAUSE_BD ( 1L << 31 )
 
+#define LE32(x) GUINT32_FROM_LE(x)
+
 extern void psx_bios_hle(uint32_t pc);
 extern void psx_iop_call(uint32_t pc, uint32_t callnum);
 extern uint8_t program_read_byte_32le(offs_t address);
@@ -69,6 +73,7 @@ extern uint32_t program_read_dword_32le(offs_t address);
 extern void program_write_byte_32le(offs_t address, uint8_t data);
 extern void program_write_word_32le(offs_t address, uint16_t data);
 extern void program_write_dword_32le(offs_t address, uint32_t data);
+extern uint32_t *psx_ram;
 
 static uint8_t mips_reg_layout[] =
 {
@@ -398,6 +403,17 @@ void psx_hw_runcounters(void);
 
 int psxcpu_verbose = 0;
 
+/* the driver code runs from main RAM (kuseg/kseg0), so fetch it directly
+   instead of going through the full bus decode in psx_hw_read() */
+static inline uint32_t mips_fetch( uint32_t pc )
+{
+	if( ( pc & 0x7f800000 ) == 0 )
+	{
+		return LE32( psx_ram[ ( pc & 0x1fffff ) >> 2 ] );
+	}
+	return cpu_readop32( pc );
+}
+
 int mips_execute( int cycles )
 {
 	uint32_t n_res;
@@ -409,7 +425,7 @@ int mips_execute( int cycles )
 
 //		psx_hw_runcounters();
 
-		mipscpu.op = cpu_readop32( mipscpu.pc );
+		mipscpu.op = mips_fetch( mipscpu.pc );
 
 #if 0
 		while (mipscpu.prevpc == mipscpu.pc)
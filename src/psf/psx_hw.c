@@ -52,6 +52,7 @@
 #include "ao.h"
 #include "cpuintrf.h"
 #include "psx.h"
+#include "../lazymem/lazymem.h"
 
 #define DEBUG_HLE_BIOS	(0)		// debug PS1 HLE BIOS
 #define DEBUG_SPU	(0)		// debug PS1 SPU read/write
@@ -71,7 +72,8 @@ extern void SPUwriteDMAMem(uint32_t usPSXMem,int iSize);
 extern void SPUreadDMAMem(uint32_t usPSXMem,int iSize);
 extern void mips_shorten_frame(void);
 extern int mips_execute( int cycles );
-extern uint32_t psf2_load_file(char *file, uint8_t *buf, uint32_t buflen);
+extern uint8_t *psf2_map_file(char *file, uint32_t *len);
+extern void psf2_unmap_file(uint8_t *data);
 extern uint32_t psf2_load_elf(uint8_t *start, uint32_t len);
 void psx_hw_runcounters(void);
 int mips_get_icount(void);
@@ -236,13 +238,40 @@ static EvtCtrlBlk *CounterEvent;
 #define EvMdINTR	0x1000
 #define EvMdNOINTR	0x2000
 
-// PSX main RAM
-uint32_t psx_ram[(2*1024*1024)/4];
+// PSX main RAM and a backup image to restart songs, allocated on first play
+// (see lazymem.h); a few spare words past the end as eng_psf.c has always had
+#define PSX_RAM_WORDS	(((2*1024*1024)/4)+4)
+
+uint32_t *psx_ram;
+uint32_t *initial_ram;
 uint32_t psx_scratch[0x400];
-// backup image to restart songs
-uint32_t initial_ram[(2*1024*1024)/4];
 uint32_t initial_scratch[0x400];
 
+static LazyMem ram_mem = LAZYMEM_INIT("PSF RAM", 2 * PSX_RAM_WORDS * sizeof(uint32_t));
+
+int32_t psx_ram_get(void)
+{
+	uint32_t *mem = lazymem_get(&ram_mem);
+
+	if (!mem)
+		return AO_FAIL;
+
+	psx_ram = mem;
+	initial_ram = mem + PSX_RAM_WORDS;
+	return AO_SUCCESS;
+}
+
+void psx_ram_put(void)
+{
+	lazymem_put(&ram_mem);
+}
+
+void psx_ram_free(void)
+{
+	lazymem_free(&ram_mem);
+	psx_ram = initial_ram = NULL;
+}
+
 static uint32_t spu_delay, dma_icr, irq_data, irq_mask, dma_timer, WAI;
 static uint32_t dma4_madr, dma4_bcr, dma4_chcr, dma4_delay;
 static uint32_t dma7_madr, dma7_bcr, dma7_chcr, dma7_delay;
@@ -887,6 +916,73 @@ void psx_hw_slice(void)
 	}
 }
 
+// While the CPU is halted in WaitEvent/TestEvent, nothing it could see
+// happens until an IRQ source fires, so the slices up to that point can be
+// run as a block: the counters move on in one step and the SPU mixes all the
+// samples in one call.  The result is the same as running them one by one.
+// Returns how many of the next max slices are quiet in this way (0 if the
+// CPU is running).
+int psx_hw_idle_slices(int max)
+{
+	int i, quiet = max;
+
+	if (WAI == 0 || dma4_delay || dma7_delay || iNumThreads || iNumTimers)
+	{
+		return 0;
+	}
+
+	if (dma_timer && (int)dma_timer - 1 < quiet)
+	{
+		quiet = dma_timer - 1;
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		if ((!(root_cnts[i].mode & RC_EN)) && (root_cnts[i].mode != 0))
+		{
+			uint32_t step = (root_cnts[i].mode & RC_DIV8) ? 768/8 : 768;
+			uint32_t left = 0;
+
+			// slices before the counter reaches its target
+			if (root_cnts[i].count < root_cnts[i].target)
+			{
+				left = (root_cnts[i].target - root_cnts[i].count - 1) / step;
+			}
+
+			if (left < (uint32_t)quiet)
+			{
+				quiet = left;
+			}
+		}
+	}
+
+	return quiet;
+}
+
+// skip ahead by a number of slices found quiet by psx_hw_idle_slices()
+void psx_hw_idle(int slices)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		if ((!(root_cnts[i].mode & RC_EN)) && (root_cnts[i].mode != 0))
+		{
+			root_cnts[i].count += slices * ((root_cnts[i].mode & RC_DIV8) ? 768/8 : 768);
+		}
+	}
+
+	if (!intr_susp)
+	{
+		sys_time += 836 * (uint64_t)slices;
+	}
+
+	if (dma_timer)
+	{
+		dma_timer -= slices;
+	}
+}
+
 void ps2_hw_slice(void)
 {
 	int i = 0;
@@ -1280,8 +1376,17 @@ static uint32_t calc_spec(uint32_t a1)
 
 void psx_hw_init(void)
 {
+	int i;
+
 	timerexp = 0;
 
+	// files left open by the last track
+	for (i = 0; i < MAX_FILE_SLOTS; i++)
+	{
+		if (filedata[i])
+			psf2_unmap_file(filedata[i]);
+	}
+
 	memset(filestat, 0, sizeof(filestat));
 	memset(filedata, 0, sizeof(filedata));
 
@@ -3242,6 +3347,7 @@ void psx_iop_call(uint32_t pc, uint32_t callnum)
 	else if (!strcmp(name, "modload"))
 	{
 		uint8_t *tempmem;
+		uint32_t templen;
 		uint32_t newAlloc;
 
 		switch (callnum)
@@ -3264,13 +3370,13 @@ void psx_iop_call(uint32_t pc, uint32_t callnum)
 				}
 				psf2_set_loadaddr(newAlloc + 2048);
 
-				tempmem = (uint8_t *)malloc(2*1024*1024);
-				if (psf2_load_file(mname, tempmem, 2*1024*1024) != 0xffffffff)
+				tempmem = psf2_map_file(mname, &templen);
+				if (tempmem)
 				{
 					uint32_t start;
 					int i;
 
-					start = psf2_load_elf(tempmem, 2*1024*1024);
+					start = psf2_load_elf(tempmem, templen);
 
 					if (start != 0xffffffff)
 					{
@@ -3320,8 +3426,9 @@ void psx_iop_call(uint32_t pc, uint32_t callnum)
 						mipsinfo.i = start - 4;
 						mips_set_info(CPUINFO_INT_PC, &mipsinfo);
 					}
+
+					psf2_unmap_file(tempmem);
 				}
-				free(tempmem);
 				break;
 
 			default:
@@ -3377,17 +3484,17 @@ void psx_iop_call(uint32_t pc, uint32_t callnum)
 					printf("IOP: open(\"%s\") (PC=%08x)\n", mname, mipsinfo.i);
 					#endif
 
-					filedata[slot2use] = malloc(6*1024*1024);
-					filesize[slot2use] = psf2_load_file(mname, filedata[slot2use], 6*1024*1024);
+					filedata[slot2use] = psf2_map_file(mname, &filesize[slot2use]);
 					filepos[slot2use] = 0;
-					filestat[slot2use] = 1;
 
-					if (filesize[slot2use] == 0xffffffff)
+					if (!filedata[slot2use])
 					{
-						mipsinfo.i = filesize[slot2use];
+						filesize[slot2use] = 0;
+						mipsinfo.i = 0xffffffff;
 					}
 					else
 					{
+						filestat[slot2use] = 1;
 						mipsinfo.i = slot2use;
 					}
 				}
@@ -3399,7 +3506,7 @@ void psx_iop_call(uint32_t pc, uint32_t callnum)
 				mips_get_info(CPUINFO_INT_REGISTER + MIPS_R31, &mipsinfo);
 				printf("IOP: close(%d) (PC=%08x)\n", a0, mipsinfo.i);
 				#endif
-				free(filedata[a0]);
+				psf2_unmap_file(filedata[a0]);
 				filedata[a0] = (uint8_t *)NULL;
 				filepos[a0] = 0;
 				filesize[a0] = 0;
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 
 #include <pulse/pulseaudio.h>
 
@@ -31,6 +32,10 @@
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
 #include <audacious/i18n.h>
+#include <audacious/preferences.h>
+
+#include "../perfstat/perfstat.h"
+#include "../ratepref/ratepref.h"
 
 #define ERROR(...) do {fprintf (stderr, "pulseaudio: " __VA_ARGS__); putchar ('\n');} while (0)
 
@@ -48,8 +53,33 @@ static int bytes_per_second;
 
 static int connected = 0;
 
+static PerfStatOutput perfstat = PERFSTAT_OUTPUT_INIT (N_("PulseAudio Output"));
+
 static pa_time_event *volume_time_event = NULL;
 
+/* The output time is published as a snapshot, taken with the mainloop locked
+ * whenever the latency information changes (after writes, flushes, pauses and
+ * the server's automatic timing updates), and read without any lock.  Readers
+ * extrapolate from the snapshot while the stream is playing, so that frequent
+ * calls from the UI and visualizers cause no traffic with the server.  The
+ * sequence number is odd while a snapshot is being written. */
+static int clock_seq;
+static int64_t clock_time; /* output time at clock_stamp, microseconds */
+static int64_t clock_stamp; /* monotonic, microseconds */
+static int64_t clock_limit; /* time written so far, microseconds */
+static int clock_floor; /* milliseconds */
+static char clock_running;
+
+#define LOAD(v) __atomic_load_n (& (v), __ATOMIC_RELAXED)
+#define STORE(v, x) __atomic_store_n (& (v), (x), __ATOMIC_RELAXED)
+
+/* A latency of zero means the output buffer size set in the core; a minimum
+ * request of zero leaves it to the server. */
+static const char * const pulse_defaults[] = {
+ "latency", "0",
+ "minreq", "0",
+ NULL};
+
 #define CHECK_DEAD_GOTO(label, warn) do { \
 if (!mainloop || \
     !context || pa_context_get_state(context) != PA_CONTEXT_READY || \
@@ -75,6 +105,14 @@ static void info_cb(struct pa_context *c, const struct pa_sink_input_info *i, in
     volume_valid = 1;
 }
 
+static void sink_info_cb(struct pa_context *c, const struct pa_sink_info *i, int is_last, void *userdata) {
+    assert(c);
+
+    /* the server resamples anything else to this */
+    if (i)
+        ratepref_set_native(i->sample_spec.rate);
+}
+
 static void subscribe_cb(struct pa_context *c, enum pa_subscription_event_type t, uint32_t index, void *userdata) {
     pa_operation *o;
 
@@ -153,9 +191,47 @@ static void stream_request_cb(pa_stream *s, size_t length, void *userdata) {
     pa_threaded_mainloop_signal(mainloop, 0);
 }
 
+static int64_t monotonic_usec (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Must be called with the mainloop locked. */
+static void clock_update (void)
+{
+    if (!stream || !bytes_per_second)
+        return;
+
+    int64_t limit = written * (int64_t) 1000000 / bytes_per_second;
+    int64_t time = limit;
+
+    pa_usec_t usec;
+    int neg;
+    if (pa_stream_get_latency (stream, & usec, & neg) == PA_OK)
+        time += neg ? (int64_t) usec : - (int64_t) usec;
+
+    const pa_timing_info * info = pa_stream_get_timing_info (stream);
+    char running = info && info->playing && pa_stream_is_corked (stream) == 0;
+
+    int seq = LOAD (clock_seq);
+    STORE (clock_seq, seq + 1);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    STORE (clock_time, time);
+    STORE (clock_stamp, monotonic_usec ());
+    STORE (clock_limit, limit);
+    STORE (clock_floor, flush_time);
+    STORE (clock_running, running);
+
+    __atomic_store_n (& clock_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
 static void stream_latency_update_cb(pa_stream *s, void *userdata) {
     assert(s);
 
+    clock_update ();
     pa_threaded_mainloop_signal(mainloop, 0);
 }
 
@@ -236,6 +312,7 @@ static void pulse_pause (bool_t b)
     int success = 0;
 
     CHECK_CONNECTED();
+    perfstat_output_idle (& perfstat);
 
     pa_threaded_mainloop_lock(mainloop);
     CHECK_DEAD_GOTO(fail, 1);
@@ -258,6 +335,7 @@ fail:
     if (o)
         pa_operation_unref(o);
 
+    clock_update ();
     pa_threaded_mainloop_unlock(mainloop);
 }
 
@@ -296,8 +374,10 @@ static int pulse_free(void) {
     }
 
 fail:
-    if (o)
+    if (o) {
         pa_operation_unref(o);
+        clock_update ();
+    }
 
     pa_threaded_mainloop_unlock(mainloop);
 
@@ -307,28 +387,34 @@ fail:
 
 static int pulse_get_output_time (void)
 {
-    int time = 0;
+    int seq, floor_ms;
+    int64_t time, stamp, limit;
+    char running;
 
     CHECK_CONNECTED(0);
 
-    pa_threaded_mainloop_lock(mainloop);
+    do {
+        seq = __atomic_load_n (& clock_seq, __ATOMIC_ACQUIRE);
 
-    time = written * (int64_t) 1000 / bytes_per_second;
+        time = LOAD (clock_time);
+        stamp = LOAD (clock_stamp);
+        limit = LOAD (clock_limit);
+        floor_ms = LOAD (clock_floor);
+        running = LOAD (clock_running);
 
-    pa_usec_t usec;
-    int neg;
-    if (pa_stream_get_latency (stream, & usec, & neg) == PA_OK)
-        time -= usec / 1000;
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || LOAD (clock_seq) != seq);
+
+    if (running)
+        time += monotonic_usec () - stamp;
+
+    /* playback cannot get ahead of what has been written */
+    time = MIN (time, limit) / 1000;
 
     /* fix for AUDPLUG-308: pa_stream_get_latency() still returns positive even
      * immediately after a flush; fix the result so that we don't return less
      * than the flush time */
-    if (time < flush_time)
-        time = flush_time;
-
-    pa_threaded_mainloop_unlock(mainloop);
-
-    return time;
+    return MAX ((int) time, floor_ms);
 }
 
 static void pulse_drain(void) {
@@ -365,6 +451,7 @@ static void pulse_flush(int time) {
     int success = 0;
 
     CHECK_CONNECTED();
+    perfstat_output_idle(&perfstat);
 
     pa_threaded_mainloop_lock(mainloop);
     CHECK_DEAD_GOTO(fail, 1);
@@ -389,44 +476,65 @@ fail:
     if (o)
         pa_operation_unref(o);
 
+    clock_update ();
     pa_threaded_mainloop_unlock(mainloop);
 }
 
-static void pulse_write(void* ptr, int length) {
-    int writeoffs, remain, writable;
-
+static void write_data(void* ptr, int length) {
     CHECK_CONNECTED();
 
     pa_threaded_mainloop_lock(mainloop);
     CHECK_DEAD_GOTO(fail, 1);
 
-    /* break large fragments into smaller fragments. --nenolod */
-    for (writeoffs = 0, remain = length;
-         writeoffs < length;
-         writeoffs += writable, remain -= writable)
-    {
-         void * pptr = (char *) ptr + writeoffs;
+    do_trigger = 0;
 
-         writable = length - writeoffs;
-         size_t fragsize = pa_stream_writable_size(stream);
+    /* Copy straight into memory from the server's pool instead of having
+     * pa_stream_write() copy our buffer.  Never write more than what PA is
+     * willing to handle right now; wait for stream_request_cb instead. */
+    while (length > 0) {
+        size_t size = pa_stream_writable_size(stream);
+        void * buf;
 
-         /* don't write more than what PA is willing to handle right now. */
-         if (writable > fragsize)
-             writable = fragsize;
+        if (size == (size_t) -1) {
+            AUDDBG("pa_stream_writable_size() failed: %s", pa_strerror(pa_context_errno(context)));
+            goto fail;
+        }
 
-         if (pa_stream_write(stream, pptr, writable, NULL, PA_SEEK_RELATIVE, 0) < 0) {
-             AUDDBG("pa_stream_write() failed: %s", pa_strerror(pa_context_errno(context)));
-             goto fail;
-         }
-    }
+        if (!size) {
+            pa_threaded_mainloop_wait(mainloop);
+            CHECK_DEAD_GOTO(fail, 1);
+            continue;
+        }
 
-    do_trigger = 0;
-    written += length;
+        size = MIN(size, (size_t) length);
+
+        if (pa_stream_begin_write(stream, &buf, &size) < 0) {
+            AUDDBG("pa_stream_begin_write() failed: %s", pa_strerror(pa_context_errno(context)));
+            goto fail;
+        }
+
+        size = MIN(size, (size_t) length);
+        memcpy(buf, ptr, size);
+
+        if (pa_stream_write(stream, buf, size, NULL, 0, PA_SEEK_RELATIVE) < 0) {
+            AUDDBG("pa_stream_write() failed: %s", pa_strerror(pa_context_errno(context)));
+            goto fail;
+        }
+
+        ptr = (char *) ptr + size;
+        length -= size;
+        written += size;
+    }
 
 fail:
+    clock_update ();
     pa_threaded_mainloop_unlock(mainloop);
 }
 
+static void pulse_write(void* ptr, int length) {
+    perfstat_output_write(&perfstat, write_data(ptr, length), length);
+}
+
 static void pulse_close(void)
 {
     connected = 0;
@@ -507,6 +615,13 @@ static int pulse_open(int fmt, int rate, int nch) {
     if (!pa_sample_spec_valid(&ss))
         return FALSE;
 
+    /* set before the stream exists, for clock_update() */
+    do_trigger = 0;
+    written = 0;
+    flush_time = 0;
+    bytes_per_second = FMT_SIZEOF (fmt) * nch * rate;
+    perfstat_output_open (& perfstat, bytes_per_second);
+
     if (!(mainloop = pa_threaded_mainloop_new())) {
         ERROR ("Failed to allocate main loop");
         goto fail;
@@ -552,11 +667,22 @@ static int pulse_open(int fmt, int rate, int nch) {
     /* Connect stream with sink and default volume */
     /* Buffer struct */
 
-    int aud_buffer = aud_get_int(NULL, "output_buffer_size");
-    size_t buffer_size = pa_usec_to_bytes(aud_buffer, &ss) * 1000;
-    pa_buffer_attr buffer = {(uint32_t) -1, buffer_size, (uint32_t) -1, (uint32_t) -1, buffer_size};
+    int latency = aud_get_int("pulse", "latency");
+    int minreq = aud_get_int("pulse", "minreq");
+    pa_stream_flags_t flags = PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE;
+
+    /* An explicit target should hold end to end, so let the server set the
+     * sink latency to match. */
+    if (latency > 0)
+        flags |= PA_STREAM_ADJUST_LATENCY;
+    else
+        latency = aud_get_int(NULL, "output_buffer_size");
+
+    size_t buffer_size = pa_usec_to_bytes((pa_usec_t) latency * 1000, &ss);
+    uint32_t minreq_size = (minreq > 0) ? pa_usec_to_bytes((pa_usec_t) minreq * 1000, &ss) : (uint32_t) -1;
+    pa_buffer_attr buffer = {(uint32_t) -1, buffer_size, (uint32_t) -1, minreq_size, buffer_size};
 
-    if (pa_stream_connect_playback(stream, NULL, &buffer, PA_STREAM_INTERPOLATE_TIMING|PA_STREAM_AUTO_TIMING_UPDATE, NULL, NULL) < 0) {
+    if (pa_stream_connect_playback(stream, NULL, &buffer, flags, NULL, NULL) < 0) {
         ERROR ("Failed to connect stream: %s", pa_strerror(pa_context_errno(context)));
         goto unlock_and_fail;
     }
@@ -570,6 +696,12 @@ static int pulse_open(int fmt, int rate, int nch) {
         goto unlock_and_fail;
     }
 
+    /* Learn the rate of the sink we ended up on; nothing waits for it */
+    pa_operation *sink_op = pa_context_get_sink_info_by_index(context, pa_stream_get_device_index(stream), sink_info_cb, NULL);
+
+    if (sink_op)
+        pa_operation_unref(sink_op);
+
     /* Now subscribe to events */
     if (!(o = pa_context_subscribe(context, PA_SUBSCRIPTION_MASK_SINK_INPUT, context_success_cb, &success))) {
         ERROR ("pa_context_subscribe() failed: %s", pa_strerror(pa_context_errno(context)));
@@ -606,10 +738,7 @@ static int pulse_open(int fmt, int rate, int nch) {
     }
     pa_operation_unref(o);
 
-    do_trigger = 0;
-    written = 0;
-    flush_time = 0;
-    bytes_per_second = FMT_SIZEOF (fmt) * nch * rate;
+    clock_update ();
     connected = 1;
     volume_time_event = NULL;
 
@@ -633,6 +762,8 @@ fail:
 
 static bool_t pulse_init (void)
 {
+    aud_config_set_defaults ("pulse", pulse_defaults);
+
     if (! pulse_open (FMT_S16_NE, 44100, 2))
         return FALSE;
 
@@ -657,11 +788,28 @@ static const char pulse_about[] =
     "Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301,\n"
     "USA.");
 
+static const PreferencesWidget pulse_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Latency</b>")},
+ {WIDGET_SPIN_BTN, N_("Target latency:"),
+  .cfg_type = VALUE_INT, .csect = "pulse", .cname = "latency",
+  .data = {.spin_btn = {0, 10000, 10, N_("ms")}}},
+ {WIDGET_SPIN_BTN, N_("Minimum request:"),
+  .cfg_type = VALUE_INT, .csect = "pulse", .cname = "minreq",
+  .data = {.spin_btn = {0, 1000, 5, N_("ms")}}},
+ {WIDGET_LABEL, N_("Zero uses the output buffer size and the server's "
+  "default request size. Changes take effect when playback restarts.")}
+};
+
+static const PluginPreferences pulse_prefs = {
+ .widgets = pulse_widgets,
+ .n_widgets = sizeof pulse_widgets / sizeof pulse_widgets[0]};
+
 AUD_OUTPUT_PLUGIN
 (
     .name = N_("PulseAudio Output"),
     .domain = PACKAGE,
     .about_text = pulse_about,
+    .prefs = & pulse_prefs,
     .probe_priority = 8,
     .init = pulse_init,
     .get_volume = pulse_get_volume,
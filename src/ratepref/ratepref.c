@@ -0,0 +1,68 @@
+/*
+ * Sample Rate Negotiation for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "ratepref.h"
+
+#include <audacious/debug.h>
+#include <audacious/misc.h>
+#include <audacious/plugin.h>
+
+#define MIN_RATE 8000
+#define MAX_RATE 192000
+
+static const char * const ratepref_defaults[] = {
+ "match_output", "TRUE",
+ "native_rate", "0",
+ NULL};
+
+void ratepref_init (void)
+{
+    aud_config_set_defaults ("ratepref", ratepref_defaults);
+}
+
+void ratepref_set_native (int rate)
+{
+    if (rate < MIN_RATE || rate > MAX_RATE)
+        return;
+
+    ratepref_init ();
+
+    if (aud_get_int ("ratepref", "native_rate") != rate)
+    {
+        AUDDBG ("Output runs natively at %d Hz.\n", rate);
+        aud_set_int ("ratepref", "native_rate", rate);
+    }
+}
+
+int ratepref_get_native (void)
+{
+    ratepref_init ();
+
+    if (! aud_get_bool ("ratepref", "match_output"))
+        return 0;
+
+    int rate = aud_get_int ("ratepref", "native_rate");
+    return (rate >= MIN_RATE && rate <= MAX_RATE) ? rate : 0;
+}
+
+int ratepref_get (int fallback)
+{
+    int rate = ratepref_get_native ();
+    return rate ? rate : fallback;
+}
@@ -0,0 +1,58 @@
+/*
+ * Sample Rate Negotiation for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_RATEPREF_H
+#define AUDACIOUS_RATEPREF_H
+
+/* Emulators and synths can render at any rate, but each picks its own (SPC
+ * at 32 kHz, the others mostly at 44.1 kHz), after which a resample effect
+ * may convert it and the output (ALSA's plug layer, PulseAudio) may convert
+ * it again to what the device runs at.  Outputs that can tell the device's
+ * native rate publish it with ratepref_set_native(), from open_audio; input
+ * plugins that choose their own rate render at it, and the resample effects
+ * convert to it, so that they have nothing left to do.
+ *
+ * The rate is kept in the config, in the "ratepref" section, so it is known
+ * from the first song after a restart; it comes from whichever output was
+ * opened last.  "match_output" (TRUE by default) turns all of this off, in
+ * which case each plugin uses its own configured rate as before. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sets the config defaults; only needed before showing "match_output" in a
+ * preferences window. */
+void ratepref_init (void);
+
+void ratepref_set_native (int rate);
+
+/* Returns the output's native rate, or 0 if it is not known or matching is
+ * turned off. */
+int ratepref_get_native (void);
+
+/* For input plugins: returns the rate to render at, which is the output's
+ * native rate if known, else fallback (the plugin's configured rate). */
+int ratepref_get (int fallback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * Sample Rate Converter Plugin for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* The conversion ratio is reduced to L/M.  Conceptually, the input is
+ * upsampled by L (inserting zeros), low-pass filtered, and downsampled by M.
+ * Only the filter taps that meet nonzero input samples are ever evaluated, so
+ * each output sample costs one dot product of TAPS coefficients (one "phase" of
+ * the filter, chosen by the output position) with the most recent input
+ * samples of that channel.  Input is kept per channel so that the dot product
+ * runs over contiguous memory.
+ *
+ * The prototype filter is a Kaiser-windowed sinc (beta = 8, about 80 dB
+ * stopband) with its cutoff at 91% of the lower of the two Nyquist
+ * frequencies. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "polyphase.h"
+#include "../cpudispatch/cpudispatch.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define USE_X86
+#include <immintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+#define MAX_PHASES 4096
+#define BASE_TAPS 32
+#define ROLLOFF 0.91
+#define KAISER_BETA 8.0
+#define MAX_BANKS 4
+
+typedef struct {
+    int L, M, taps;
+    float * coefs; /* phase-major, each phase reversed */
+} Bank;
+
+struct _Polyphase {
+    Bank * bank;
+    int channels;
+    float * * hist;
+    int hist_len, hist_size;
+    int64_t t; /* next output position in 1/L input samples */
+};
+
+static Bank * banks[MAX_BANKS];
+static int next_bank;
+
+static float (* dot) (const float * a, const float * b, int n);
+
+static float dot_c (const float * a, const float * b, int n)
+{
+    float sum = 0;
+    for (int i = 0; i < n; i ++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+#ifdef USE_X86
+
+__attribute__ ((target ("sse2")))
+static float dot_sse2 (const float * a, const float * b, int n)
+{
+    __m128 sum0 = _mm_setzero_ps (), sum1 = _mm_setzero_ps ();
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        sum0 = _mm_add_ps (sum0, _mm_mul_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+        sum1 = _mm_add_ps (sum1, _mm_mul_ps (_mm_loadu_ps (a + i + 4), _mm_loadu_ps (b + i + 4)));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps (lanes, _mm_add_ps (sum0, sum1));
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < n; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+__attribute__ ((target ("avx2,fma")))
+static float dot_avx2 (const float * a, const float * b, int n)
+{
+    __m256 sum0 = _mm256_setzero_ps (), sum1 = _mm256_setzero_ps ();
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        sum0 = _mm256_fmadd_ps (_mm256_loadu_ps (a + i), _mm256_loadu_ps (b + i), sum0);
+        sum1 = _mm256_fmadd_ps (_mm256_loadu_ps (a + i + 8), _mm256_loadu_ps (b + i + 8), sum1);
+    }
+
+    __m256 sum8 = _mm256_add_ps (sum0, sum1);
+    __m128 sum4 = _mm_add_ps (_mm256_castps256_ps128 (sum8), _mm256_extractf128_ps (sum8, 1));
+
+    float lanes[4];
+    _mm_storeu_ps (lanes, sum4);
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < n; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+#endif /* USE_X86 */
+
+#ifdef USE_NEON
+
+static float dot_neon (const float * a, const float * b, int n)
+{
+    float32x4_t sum0 = vdupq_n_f32 (0), sum1 = vdupq_n_f32 (0);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        sum0 = vmlaq_f32 (sum0, vld1q_f32 (a + i), vld1q_f32 (b + i));
+        sum1 = vmlaq_f32 (sum1, vld1q_f32 (a + i + 4), vld1q_f32 (b + i + 4));
+    }
+
+    float32x4_t sum4 = vaddq_f32 (sum0, sum1);
+    float32x2_t sum2 = vadd_f32 (vget_low_f32 (sum4), vget_high_f32 (sum4));
+    float sum = vget_lane_f32 (vpadd_f32 (sum2, sum2), 0);
+
+    for (; i < n; i ++)
+        sum += a[i] * b[i];
+
+    return sum;
+}
+
+#endif /* USE_NEON */
+
+static const struct {
+    CpuVariant variant;
+    float (* dot) (const float * a, const float * b, int n);
+} dots[] = {
+#if defined (USE_X86)
+ {{"avx2", CPU_AVX2 | CPU_FMA}, dot_avx2},
+ {{"sse2", CPU_SSE2}, dot_sse2},
+#elif defined (USE_NEON)
+ {{"neon", CPU_NEON}, dot_neon},
+#endif
+ {{"c"}, dot_c}};
+
+static void select_dot (void)
+{
+    dot = CPU_DISPATCH ("resample dot", dots)->dot;
+}
+
+static int gcd (int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static double bessel_i0 (double x)
+{
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50; k ++)
+    {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+
+        if (term < sum * 1e-12)
+            break;
+    }
+
+    return sum;
+}
+
+static Bank * bank_new (int L, int M)
+{
+    Bank * b = malloc (sizeof (Bank));
+
+    b->L = L;
+    b->M = M;
+
+    /* Downsampling narrows the passband, so the filter must be longer to
+     * keep the same transition width relative to it. */
+    b->taps = BASE_TAPS * ((M + L - 1) / L);
+    b->taps = (b->taps + 7) & ~7;
+
+    int N = b->taps;
+    int P = N * L;
+    double cutoff = ROLLOFF * (L < M ? (double) L / M : 1.0);
+    double center = P / 2.0;
+    double norm = bessel_i0 (KAISER_BETA);
+
+    b->coefs = malloc (sizeof (float) * P);
+
+    for (int k = 0; k < P; k ++)
+    {
+        double x = (k - center) / L; /* in input samples */
+        double arg = M_PI * cutoff * x;
+        double sinc = (fabs (arg) < 1e-9) ? 1 : sin (arg) / arg;
+        double r = (k - center) / center;
+        double window = bessel_i0 (KAISER_BETA * sqrt (fmax (0, 1 - r * r))) / norm;
+
+        int phase = k % L;
+        int j = k / L;
+
+        b->coefs[phase * N + (N - 1 - j)] = cutoff * sinc * window;
+    }
+
+    return b;
+}
+
+static Bank * bank_get (int L, int M)
+{
+    for (int i = 0; i < MAX_BANKS; i ++)
+    {
+        if (banks[i] && banks[i]->L == L && banks[i]->M == M)
+            return banks[i];
+    }
+
+    /* Replace the oldest bank.  Banks are only replaced between streams, when
+     * no converter is using them. */
+    Bank * * slot = & banks[next_bank];
+    next_bank = (next_bank + 1) % MAX_BANKS;
+
+    if (* slot)
+    {
+        free ((* slot)->coefs);
+        free (* slot);
+    }
+
+    return (* slot = bank_new (L, M));
+}
+
+Polyphase * polyphase_new (int in_rate, int out_rate, int channels)
+{
+    int div = gcd (in_rate, out_rate);
+    int L = out_rate / div;
+    int M = in_rate / div;
+
+    if (L > MAX_PHASES)
+        return NULL;
+
+    if (! dot)
+        select_dot ();
+
+    Polyphase * p = malloc (sizeof (Polyphase));
+
+    p->bank = bank_get (L, M);
+    p->channels = channels;
+    p->hist = calloc (channels, sizeof (float *));
+    p->hist_len = 0;
+    p->hist_size = 0;
+
+    polyphase_reset (p);
+    return p;
+}
+
+void polyphase_free (Polyphase * p)
+{
+    for (int c = 0; c < p->channels; c ++)
+        free (p->hist[c]);
+
+    free (p->hist);
+    free (p);
+}
+
+void polyphase_cleanup (void)
+{
+    for (int i = 0; i < MAX_BANKS; i ++)
+    {
+        if (banks[i])
+        {
+            free (banks[i]->coefs);
+            free (banks[i]);
+            banks[i] = NULL;
+        }
+    }
+
+    next_bank = 0;
+}
+
+static void reserve (Polyphase * p, int len)
+{
+    if (len <= p->hist_size)
+        return;
+
+    p->hist_size = len;
+
+    for (int c = 0; c < p->channels; c ++)
+        p->hist[c] = realloc (p->hist[c], sizeof (float) * len);
+}
+
+void polyphase_reset (Polyphase * p)
+{
+    int N = p->bank->taps;
+
+    /* Prime the history with half a filter of silence and start with the
+     * filter centered on the first input sample. */
+    reserve (p, N);
+
+    for (int c = 0; c < p->channels; c ++)
+        memset (p->hist[c], 0, sizeof (float) * (N / 2));
+
+    p->hist_len = N / 2;
+    p->t = (int64_t) N * p->bank->L;
+}
+
+int polyphase_max_output (Polyphase * p, int frames)
+{
+    Bank * b = p->bank;
+    return ((int64_t) (frames + b->taps) * b->L) / b->M + 2;
+}
+
+int polyphase_process (Polyphase * p, const float * in, int frames, float * out)
+{
+    Bank * b = p->bank;
+    int N = b->taps, L = b->L, M = b->M;
+    int channels = p->channels;
+
+    reserve (p, p->hist_len + frames);
+
+    for (int c = 0; c < channels; c ++)
+    {
+        float * set = p->hist[c] + p->hist_len;
+        const float * get = in + c;
+
+        for (int f = 0; f < frames; f ++, get += channels)
+            set[f] = * get;
+    }
+
+    p->hist_len += frames;
+
+    int produced = 0;
+
+    while (1)
+    {
+        int64_t base = p->t / L;
+        if (base >= p->hist_len)
+            break;
+
+        const float * coefs = b->coefs + (p->t - base * L) * N;
+
+        for (int c = 0; c < channels; c ++)
+            * out ++ = dot (coefs, p->hist[c] + base - (N - 1), N);
+
+        produced ++;
+        p->t += M;
+    }
+
+    /* Keep only the input that later outputs still need. */
+    int64_t drop = p->t / L - (N - 1);
+
+    if (drop > p->hist_len)
+        drop = p->hist_len;
+
+    if (drop > 0)
+    {
+        for (int c = 0; c < channels; c ++)
+            memmove (p->hist[c], p->hist[c] + drop, sizeof (float) * (p->hist_len - drop));
+
+        p->hist_len -= drop;
+        p->t -= drop * L;
+    }
+
+    return produced;
+}
+
+int polyphase_drain (Polyphase * p, float * out)
+{
+    int frames = p->bank->taps / 2;
+    float * silence = calloc ((size_t) frames * p->channels, sizeof (float));
+
+    int produced = polyphase_process (p, silence, frames, out);
+
+    free (silence);
+    return produced;
+}
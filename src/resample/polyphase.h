@@ -0,0 +1,48 @@
+/*
+ * Sample Rate Converter Plugin for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef RESAMPLE_POLYPHASE_H
+#define RESAMPLE_POLYPHASE_H
+
+/* Built-in polyphase FIR resampler, used instead of libsamplerate when the
+ * "method" setting is POLYPHASE_METHOD.  Filter banks are computed once per
+ * rate pair and kept until polyphase_cleanup(). */
+
+#define POLYPHASE_METHOD 10
+
+typedef struct _Polyphase Polyphase;
+
+/* Returns NULL if the ratio between the rates is too awkward (more than
+ * MAX_PHASES filter phases would be needed). */
+Polyphase * polyphase_new (int in_rate, int out_rate, int channels);
+void polyphase_free (Polyphase * p);
+void polyphase_reset (Polyphase * p);
+void polyphase_cleanup (void);
+
+/* Upper bound of the frames produced from the given number of input frames,
+ * including the frames released by polyphase_drain(). */
+int polyphase_max_output (Polyphase * p, int frames);
+
+/* Converts interleaved input; returns the number of frames written. */
+int polyphase_process (Polyphase * p, const float * in, int frames, float * out);
+
+/* Pushes the audio still held in the filter out at the end of a stream. */
+int polyphase_drain (Polyphase * p, float * out);
+
+#endif
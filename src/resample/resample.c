@@ -27,6 +27,10 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "polyphase.h"
+#include "../perfstat/perfstat.h"
+#include "../ratepref/ratepref.h"
+
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
@@ -47,7 +51,9 @@ static const char * const resample_defaults[] = {
  NULL};
 
 static SRC_STATE * state;
+static Polyphase * poly;
 static int stored_channels;
+static int stored_method, stored_rate, stored_new_rate;
 static double ratio;
 static float * buffer;
 static int buffer_samples;
@@ -55,10 +61,11 @@ static int buffer_samples;
 bool_t resample_init (void)
 {
     aud_config_set_defaults ("resample", resample_defaults);
+    ratepref_init ();
     return TRUE;
 }
 
-void resample_cleanup (void)
+static void close_engine (void)
 {
     if (state)
     {
@@ -66,22 +73,40 @@ void resample_cleanup (void)
         state = NULL;
     }
 
+    if (poly)
+    {
+        polyphase_free (poly);
+        poly = NULL;
+    }
+}
+
+void resample_cleanup (void)
+{
+    close_engine ();
+    polyphase_cleanup ();
+
     free (buffer);
     buffer = NULL;
     buffer_samples = 0;
 }
 
-void resample_start (int * channels, int * rate)
+/* Sizes the output buffer for blocks of up to half a second so that it is
+ * normally allocated once per stream rather than grown in do_resample(). */
+static void reserve_buffer (int samples)
 {
-    if (state)
-    {
-        src_delete (state);
-        state = NULL;
-    }
+    if (buffer_samples >= samples)
+        return;
+
+    buffer_samples = samples;
+    buffer = realloc (buffer, sizeof (float) * buffer_samples);
+}
 
-    int new_rate = 0;
+void resample_start (int * channels, int * rate)
+{
+    /* converting to what the output runs at spares it converting again */
+    int new_rate = ratepref_get_native ();
 
-    if (aud_get_bool ("resample", "use-mappings"))
+    if (! new_rate && aud_get_bool ("resample", "use-mappings"))
     {
         SPRINTF (rate_s, "%d", * rate);
         new_rate = aud_get_int ("resample", rate_s);
@@ -93,32 +118,83 @@ void resample_start (int * channels, int * rate)
     new_rate = CLAMP (new_rate, MIN_RATE, MAX_RATE);
 
     if (new_rate == * rate)
+    {
+        close_engine ();
         return;
+    }
 
     int method = aud_get_int ("resample", "method");
     int error;
 
-    if ((state = src_new (method, * channels, & error)) == NULL)
+    /* The same conversion as for the last song, as through an album: keep
+     * the engine, which resample_finish() or resample_flush() has reset if
+     * the last song ended, and which carries on seamlessly if it did not. */
+    if ((state || poly) && method == stored_method && * channels ==
+     stored_channels && * rate == stored_rate && new_rate == stored_new_rate)
+    {
+        * rate = new_rate;
+        return;
+    }
+
+    close_engine ();
+    stored_method = method;
+
+    if (method == POLYPHASE_METHOD)
+    {
+        if (! (poly = polyphase_new (* rate, new_rate, * channels)))
+        {
+            fprintf (stderr, "resample: Cannot convert %d Hz to %d Hz with the "
+             "built-in resampler; using fast sinc interpolation.\n", * rate, new_rate);
+            method = SRC_SINC_FASTEST;
+        }
+    }
+
+    if (! poly && (state = src_new (method, * channels, & error)) == NULL)
     {
         RESAMPLE_ERROR (error);
         return;
     }
 
     stored_channels = * channels;
+    stored_rate = * rate;
+    stored_new_rate = new_rate;
     ratio = (double) new_rate / * rate;
+
+    if (poly)
+        reserve_buffer (* channels * polyphase_max_output (poly, * rate / 2));
+    else
+        reserve_buffer ((int) (* channels * (* rate / 2) * ratio) + 256);
+
     * rate = new_rate;
 }
 
+static void poly_resample (float * * data, int * samples, bool_t finish)
+{
+    int frames = * samples / stored_channels;
+
+    reserve_buffer (stored_channels * polyphase_max_output (poly, frames));
+
+    int out_frames = polyphase_process (poly, * data, frames, buffer);
+
+    if (finish)
+        out_frames += polyphase_drain (poly, buffer + stored_channels * out_frames);
+
+    * data = buffer;
+    * samples = stored_channels * out_frames;
+}
+
 void do_resample (float * * data, int * samples, bool_t finish)
 {
+    if (poly)
+    {
+        poly_resample (data, samples, finish);
+        return;
+    }
+
     if (! state || ! * samples)
         return;
 
-    if (buffer_samples < (int) (* samples * ratio) + 256)
-    {
-        buffer_samples = (int) (* samples * ratio) + 256;
-        buffer = realloc (buffer, sizeof (float) * buffer_samples);
-    }
+    reserve_buffer ((int) (* samples * ratio) + 256);
 
     SRC_DATA d = {
      .data_in = * data,
@@ -149,6 +225,9 @@ void resample_flush (void)
     int error;
     if (state && (error = src_reset (state)))
         RESAMPLE_ERROR (error);
+
+    if (poly)
+        polyphase_reset (poly);
 }
 
 void resample_finish (float * * data, int * samples)
@@ -166,7 +245,8 @@ static const ComboBoxElements method_list[] = {
  {"4", N_("Linear interpolation")}, /* SRC_LINEAR */
  {"2", N_("Fast sinc interpolation")}, /* SRC_SINC_FASTEST */
  {"1", N_("Medium sinc interpolation")}, /* SRC_SINC_MEDIUM_QUALITY */
- {"0", N_("Best sinc interpolation")}}; /* SRC_SINC_BEST_QUALITY */
+ {"0", N_("Best sinc interpolation")}, /* SRC_SINC_BEST_QUALITY */
+ {"10", N_("Built-in polyphase filter")}}; /* POLYPHASE_METHOD */
 
 static const PreferencesWidget resample_widgets[] = {
  {WIDGET_LABEL, N_("<b>Conversion</b>")},
@@ -176,6 +256,8 @@ static const PreferencesWidget resample_widgets[] = {
  {WIDGET_SPIN_BTN, N_("Rate:"),
   .cfg_type = VALUE_INT, .csect = "resample", .cname = "default-rate",
   .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}},
+ {WIDGET_CHK_BTN, N_("Use the output's native rate when known"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "ratepref", .cname = "match_output"},
  {WIDGET_LABEL, N_("<b>Rate Mappings</b>")},
  {WIDGET_CHK_BTN, N_("Use rate mappings"),
   .cfg_type = VALUE_BOOLEAN, .csect = "resample", .cname = "use-mappings"},
@@ -205,6 +287,8 @@ static const PluginPreferences resample_prefs = {
  .widgets = resample_widgets,
  .n_widgets = sizeof resample_widgets / sizeof resample_widgets[0]};
 
+PERFSTAT_EFFECT (N_("Sample Rate Converter"), resample_start, resample_process, resample_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Sample Rate Converter"),
@@ -213,9 +297,9 @@ AUD_EFFECT_PLUGIN
     .prefs = & resample_prefs,
     .init = resample_init,
     .cleanup = resample_cleanup,
-    .start = resample_start,
-    .process = resample_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = resample_flush,
-    .finish = resample_finish,
+    .finish = perfstat_finish,
     .order = 2 /* must be before crossfade */
 )
@@ -1,6 +1,7 @@
 
 //external includes
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <curl/curl.h>
@@ -77,6 +78,37 @@ static char *scrobbler_get_signature(int nparams, API_Parameter *parameters) {
 
 
 
+/*
+ * Builds the POST data for the given parameters, the first of which must be
+ * the method name, and appends their signature.  Takes ownership of the
+ * names and arguments, which must be allocated with g_malloc().
+ */
+static gchar *create_message_from_params (int nparams, API_Parameter *params) {
+    GString *message = g_string_new(NULL);
+
+    for (int i = 0; i < nparams; i++) {
+        char *escaped_argument = curl_easy_escape(curlHandle, params[i].argument, 0);
+
+        g_string_append_printf(message, "%s%s=%s", (i == 0 ? "" : "&"),
+                               params[i].paramName, escaped_argument);
+        curl_free(escaped_argument);
+    }
+
+    gchar *api_sig = scrobbler_get_signature(nparams, params);
+    g_string_append_printf(message, "&api_sig=%s", api_sig);
+    g_free(api_sig);
+
+    AUDDBG("FINAL message: %s.\n", message->str);
+
+    for (int i = 0; i < nparams; i++) {
+        g_free(params[i].paramName);
+        g_free(params[i].argument);
+    }
+
+    return g_string_free(message, FALSE);
+}
+
+
 /*
  * n_args should count with the given authentication parameters
  * At most 2: api_key, session_key.
@@ -89,62 +121,30 @@ static char *scrobbler_get_signature(int nparams, API_Parameter *parameters) {
  * Returns NULL if an error occurrs
  */
 static gchar *create_message_to_lastfm (char *method_name, int n_args, ...) {
-    //TODO: Improve this f-ugly mess.
-    gchar *result = NULL;
-
     //parameters to be sent to the get_signature() function
     API_Parameter signable_params[n_args+1];
     signable_params[0].paramName = g_strdup("method");
     signable_params[0].argument  = g_strdup(method_name);
 
-    size_t msg_size = 2; // First '=' and final '\0'
-    msg_size = msg_size + strlen("method") + strlen(method_name);
-
     va_list vl;
     va_start(vl, n_args);
     for (int i = 0; i < n_args; i++) {
-
         signable_params[i+1].paramName = g_strdup(va_arg(vl, gchar *));
         signable_params[i+1].argument  = g_strdup(va_arg(vl, gchar *));
-
-        msg_size += strlen( signable_params[i+1].paramName );
-        msg_size += strlen( signable_params[i+1].argument );
-        msg_size += 2; //Counting '&' and '='
     }
     va_end(vl);
 
-    gchar *aux;
-    result = g_strconcat("method=", method_name, NULL);
-    char *escaped_argument;
-
-    for (int i = 0; i < n_args; i++) {
-        escaped_argument = curl_easy_escape(curlHandle, signable_params[i+1].argument, 0);
-
-        aux = g_strdup_printf("%s&%s=%s", result, signable_params[i+1].paramName, escaped_argument);
-        g_free(result);
-        curl_free(escaped_argument);
-        result = aux;
-    }
-
-    gchar *api_sig = scrobbler_get_signature(n_args+1, signable_params);
-
-    aux = g_strdup_printf("%s&api_sig=%s", result, api_sig);
-    result = aux;
-
-    AUDDBG("FINAL message: %s.\n", result);
-    g_free(api_sig);
-    for (int i = 0; i < n_args+1; i++) {
-        g_free(signable_params[i].paramName);
-        g_free(signable_params[i].argument);
-    }
-
-    return result;
+    return create_message_from_params(n_args+1, signable_params);
 }
 
 
 static bool_t send_message_to_lastfm(gchar *data) {
     AUDDBG("This message will be sent to last.fm:\n%s\n%%%%End of message%%%%\n", data);//Enter?\n", data);
     curl_easy_setopt(curlHandle, CURLOPT_POSTFIELDS, data);
+
+    //drop whatever is left of an answer that was never read
+    received_data_size = 0;
+
     CURLcode curl_requests_result = curl_easy_perform(curlHandle);
 
     if (curl_requests_result != CURLE_OK) {
@@ -326,166 +326,275 @@ bool_t scrobbler_communication_init() {
         return FALSE;
     }
 
+    //All requests go through this one handle, which keeps its connection to
+    //last.fm open between them.  These only help that along, so failing to
+    //set them is not an error.
+#if LIBCURL_VERSION_NUM >= 0x071900
+    curl_easy_setopt(curlHandle, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    curl_easy_setopt(curlHandle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+#endif
+
     return TRUE;
 }
 
 
-static void delete_lines_from_scrobble_log (GSList **lines_to_remove_ptr, gchar *queuepath) {
-    GSList *lines_to_remove = *lines_to_remove_ptr;
+/*
+ * The queue in scrobbler.log is only ever appended to.  How far it has been
+ * submitted is kept as a byte offset in scrobbler.log.offset, which is
+ * replaced atomically after each batch, and the log itself is only rewritten
+ * once everything in it has been submitted or the submitted part grows large.
+ */
+#define SCROBBLE_BATCH 50
+#define COMPACT_THRESHOLD (1 << 20)
+
+enum submit_result {
+    SUBMIT_OK,       //accepted, or ignored by last.fm
+    SUBMIT_REJECTED, //will never be accepted, drop it
+    SUBMIT_RETRY     //keep it and try again later
+};
+
+static gint64 read_queue_offset (const gchar *offsetpath) {
     gchar *contents = NULL;
-    gchar **lines = NULL;
-    gchar **finallines = g_malloc_n(1, sizeof(gchar *));
-    int n_finallines;
+    gint64 offset = 0;
 
-    if (lines_to_remove == NULL) {
-        return;
+    if (g_file_get_contents(offsetpath, &contents, NULL, NULL)) {
+        offset = g_ascii_strtoll(contents, NULL, 10);
+        g_free(contents);
     }
-    lines_to_remove = g_slist_reverse(lines_to_remove);
 
+    return MAX(offset, 0);
+}
 
-    pthread_mutex_lock(&log_access_mutex);
+static void write_queue_offset (const gchar *offsetpath, gint64 offset) {
+    gchar *contents = g_strdup_printf("%"G_GINT64_FORMAT"\n", offset);
 
-    gboolean success = g_file_get_contents(queuepath, &contents, NULL, NULL);
-    if (!success) {
-        AUDDBG("Could not read scrobbler.log contents.\n");
-    } else {
-        lines = g_strsplit(contents, "\n", 0);
+    if (!g_file_set_contents(offsetpath, contents, -1, NULL)) {
+        AUDDBG("Could not write to scrobbler.log.offset!\n");
+    }
 
-        n_finallines = 0;
-        for (int i = 0 ; lines[i] != NULL && strlen(lines[i]) > 0; i++) {
-            if (lines_to_remove != NULL && *((int *) (lines_to_remove->data)) == i) {
-                //this line is to remove
-                lines_to_remove = g_slist_next(lines_to_remove);
-            } else {
-                //keep this line
-                n_finallines++;
-                finallines = g_realloc_n(finallines, n_finallines, sizeof(gchar *));
-                finallines[n_finallines-1] = g_strdup(lines[i]);
-            }
+    g_free(contents);
+}
+
+//reads everything past the offset; the caller must hold log_access_mutex
+static gchar *read_queue_tail (const gchar *queuepath, gint64 offset, gint64 *size) {
+    FILE *f = fopen(queuepath, "r");
+    if (f == NULL) {
+        *size = 0;
+        return NULL;
+    }
+
+    gchar *contents = NULL;
+    *size = 0;
+
+    if (fseeko(f, 0, SEEK_END) == 0) {
+        gint64 length = ftello(f);
+
+        if (length > offset && fseeko(f, offset, SEEK_SET) == 0) {
+            contents = g_malloc(length - offset + 1);
+            *size = fread(contents, 1, length - offset, f);
+            contents[*size] = 0;
         }
+    }
 
-        finallines = g_realloc_n(finallines, n_finallines+2, sizeof(gchar *));
-        finallines[n_finallines] = g_strdup("");
-        finallines[n_finallines+1] = NULL;
-        g_free(contents);
-        contents = g_strjoinv("\n", finallines);
-        success = g_file_set_contents(queuepath, contents, -1, NULL);
-        if (!success) {
+    fclose(f);
+    return contents;
+}
+
+//drops the submitted part of the log once it is no longer worth keeping
+static void compact_scrobble_log (const gchar *queuepath, const gchar *offsetpath, gint64 offset) {
+    pthread_mutex_lock(&log_access_mutex);
+
+    gint64 size;
+    gchar *tail = read_queue_tail(queuepath, offset, &size);
+
+    if (size == 0) {
+        FILE *f = fopen(queuepath, "w");
+        if (f != NULL) {
+            fclose(f);
+            write_queue_offset(offsetpath, 0);
+        }
+    } else if (offset > COMPACT_THRESHOLD) {
+        if (g_file_set_contents(queuepath, tail, size, NULL)) {
+            write_queue_offset(offsetpath, 0);
+        } else {
             AUDDBG("Could not write to scrobbler.log!\n");
         }
-
     }
 
     pthread_mutex_unlock(&log_access_mutex);
+    g_free(tail);
+}
 
+//line[0] line[1] line[2] line[3] line[4] line[5] line[6]   line[7]
+//artist  album   title   number  length  "L"     timestamp NULL
+static gchar **parse_scrobble_line (const gchar *text) {
+    gchar **line = g_strsplit(text, "\t", 0);
 
-    g_strfreev(finallines);
-    g_strfreev(lines);
-    g_free(contents);
+    if (g_strv_length(line) == 7 && strcmp(line[5], "L") == 0) {
+        return line;
+    }
+
+    AUDDBG("Unscrobbable line.\n");
+    g_strfreev(line);
+    return NULL;
 }
 
-static void save_line_to_remove(GSList **lines_to_remove, int linenumber) {
-    int *rem = g_malloc(sizeof(int));
-    *rem = linenumber;
-    (*lines_to_remove) = g_slist_prepend((*lines_to_remove), rem);
+static enum submit_result submit_scrobbles (gchar ***tracks, int n_tracks) {
+    static const char * const fields[] = {"artist", "album", "track", "trackNumber", "duration", NULL, "timestamp"};
+
+    int nparams = 3 + 6 * n_tracks;
+    API_Parameter params[nparams];
+    int p = 0;
+
+    params[p].paramName = g_strdup("method");
+    params[p++].argument = g_strdup("track.scrobble");
+
+    for (int t = 0; t < n_tracks; t++) {
+        for (int f = 0; f < G_N_ELEMENTS(fields); f++) {
+            if (fields[f] == NULL) {
+                continue;
+            }
+
+            params[p].paramName = g_strdup_printf("%s[%d]", fields[f], t);
+            params[p++].argument = g_strdup(tracks[t][f]);
+        }
+    }
+
+    params[p].paramName = g_strdup("api_key");
+    params[p++].argument = g_strdup(SCROBBLER_API_KEY);
+    params[p].paramName = g_strdup("sk");
+    params[p++].argument = g_strdup(session_key);
+
+    gchar *scrobblemsg = create_message_from_params(nparams, params);
+    bool_t sent = send_message_to_lastfm(scrobblemsg);
+    g_free(scrobblemsg);
+
+    if (!sent) {
+        AUDDBG("Could not scrobble the tracks on the queue. Network problem?\n");
+        scrobbling_enabled = FALSE;
+        return SUBMIT_RETRY;
+    }
+
+    enum submit_result result;
+    gchar *error_code = NULL;
+    gchar *error_detail = NULL;
+
+    if (read_scrobble_result(&error_code, &error_detail) == TRUE) {
+        //TODO: a track might not be scrobbled due to "daily scrobble limit exeeded".
+        //This message comes on the ignoredMessage attribute, inside the XML of the response.
+        //We are not dealing with this case currently and are losing that scrobble.
+        AUDDBG("SCROBBLE OK.\n");
+        result = SUBMIT_OK;
+    } else {
+        AUDDBG("SCROBBLE NOT OK. Error code: %s. Error detail: %s.\n", error_code, error_detail);
+
+        if (error_code == NULL) { //net error(?) or the answer from last.fm was not well read
+            result = SUBMIT_RETRY;
+        }
+        else if (g_strcmp0(error_code, "11") == 0 ||
+                 g_strcmp0(error_code, "16") == 0){
+            //error code 11: Service Offline - This service is temporarily offline. Try again later.
+            //error code 16: The service is temporarily unavailable, please try again.
+            result = SUBMIT_RETRY;
+        }
+        else if (g_strcmp0(error_code,  "9") == 0) {
+            //Bad Session. Reauth.
+            scrobbling_enabled = FALSE;
+            g_free(session_key);
+            session_key = NULL;
+            aud_set_string("scrobbler", "session_key", "");
+            result = SUBMIT_RETRY;
+        }
+        else {
+            result = SUBMIT_REJECTED;
+        }
+    }
+
+    g_free(error_code);
+    g_free(error_detail);
+    return result;
 }
 
 static void scrobble_cached_queue() {
 
     gchar *queuepath = g_build_filename(aud_get_path(AUD_PATH_USER_DIR),"scrobbler.log", NULL);
-    gchar *contents = NULL;
-    gboolean success;
-    gchar **lines = NULL;
-    gchar **line;
-    gchar *scrobblemsg;
-    GSList *lines_to_remove = NULL;
-    gchar *error_code = NULL;
-    gchar *error_detail = NULL;
+    gchar *offsetpath = g_build_filename(aud_get_path(AUD_PATH_USER_DIR),"scrobbler.log.offset", NULL);
+    gint64 size;
+
     pthread_mutex_lock(&log_access_mutex);
-    success = g_file_get_contents(queuepath, &contents, NULL, NULL);
+    gint64 offset = read_queue_offset(offsetpath);
+    gchar *contents = read_queue_tail(queuepath, offset, &size);
     pthread_mutex_unlock(&log_access_mutex);
-    if (!success) {
-        AUDDBG("Couldn't access the queue file.\n");
-    } else {
 
-        lines = g_strsplit(contents, "\n", 0);
-
-        for (int i = 0; lines[i] != NULL && strlen(lines[i]) > 0 && scrobbling_enabled; i++) {
-            line = g_strsplit(lines[i], "\t", 0);
-
-            //line[0] line[1] line[2] line[3] line[4] line[5] line[6]   line[7]
-            //artist  album   title   number  length  "L"     timestamp NULL
-
-            if (line[0] && line[2] && (strcmp(line[5], "L") == 0) && line[6] && (line[7] == NULL)) {
-                scrobblemsg = create_message_to_lastfm("track.scrobble",
-                                                       8,
-                                                       "artist", line[0],
-                                                       "album", line[1],
-                                                       "track", line[2],
-                                                       "trackNumber", line[3],
-                                                       "duration", line[4],
-                                                       "timestamp", line[6],
-                                                       "api_key", SCROBBLER_API_KEY,
-                                                       "sk", session_key);
-                if (send_message_to_lastfm(scrobblemsg) == TRUE) {
-                    error_code = NULL;
-                    error_detail = NULL;
-                    if (read_scrobble_result(&error_code, &error_detail) == TRUE) {
-                        //TODO: a track might not be scrobbled due to "daily scrobble limit exeeded".
-                        //This message comes on the ignoredMessage attribute, inside the XML of the response.
-                        //We are not dealing with this case currently and are losing that scrobble.
-                        AUDDBG("SCROBBLE OK.\n");
-                        save_line_to_remove(&lines_to_remove, i);
-                    } else {
-                        AUDDBG("SCROBBLE NOT OK. Error code: %s. Error detail: %s.\n", error_code, error_detail);
-
-                        if (error_code == NULL) { //net error(?) or the answer from last.fm was not well read
-                            //scrobble to be retried
-                        }
-                        else if (g_strcmp0(error_code, "11") == 0 ||
-                                 g_strcmp0(error_code, "16") == 0){
-                            //error code 11: Service Offline - This service is temporarily offline. Try again later.
-                            //error code 16: The service is temporarily unavailable, please try again.
-                            //scrobble to be retried
-                        }
-                        else if (g_strcmp0(error_code,  "9") == 0) {
-                            //Bad Session. Reauth.
-                            scrobbling_enabled = FALSE;
-                            g_free(session_key);
-                            session_key = NULL;
-                            aud_set_string("scrobbler", "session_key", "");
-                        }
-                        else {
-                            save_line_to_remove(&lines_to_remove, i);
-                        }
-                    }
-
-                    g_free(error_code);
-                    g_free(error_detail);
+    gchar **tracks[SCROBBLE_BATCH];
+    gchar *parse = contents;
+    gint64 submitted = offset;
+
+    //after a batch is rejected, its tracks are retried one at a time up to
+    //this point so that one bad track does not take the others with it
+    gint64 singles_until = offset;
+
+    //a "now playing" update should not wait for a long queue to be flushed;
+    //the scrobbling thread comes back here once it has been sent
+    while (parse != NULL && scrobbling_enabled && !now_playing_requested) {
+        gchar *batch_start = parse;
+        int n_tracks = 0;
+        int limit = (offset + (parse - contents) < singles_until) ? 1 : SCROBBLE_BATCH;
+
+        //only complete lines are read; the last one may still be being written
+        gchar *newline;
+        while (n_tracks < limit && (newline = strchr(parse, '\n')) != NULL) {
+            *newline = 0;
+            gchar **line = parse_scrobble_line(parse);
+            *newline = '\n';
+            parse = newline + 1;
+
+            if (line != NULL) {
+                tracks[n_tracks++] = line;
+            }
+        }
 
-                } else {
-                    AUDDBG("Could not scrobble a track on the queue. Network problem?\n");
-                    //scrobble to be retried
-                    scrobbling_enabled = FALSE;
-                }
+        gint64 batch_end = offset + (parse - contents);
 
-                g_free(scrobblemsg);
-            } else {
-                AUDDBG("Unscrobbable line.\n");
-                //leave entry on the cache file
+        if (n_tracks == 0) {
+            //nothing but unscrobbable lines, which can be skipped for good
+            if (batch_end > submitted) {
+                submitted = batch_end;
+                write_queue_offset(offsetpath, submitted);
             }
-            g_strfreev(line);
-        }//for
+            break;
+        }
+
+        enum submit_result result = submit_scrobbles(tracks, n_tracks);
+
+        for (int t = 0; t < n_tracks; t++) {
+            g_strfreev(tracks[t]);
+        }
 
-        if (lines_to_remove != NULL) {
-            delete_lines_from_scrobble_log(&lines_to_remove, queuepath);
-            g_slist_free_full(lines_to_remove, g_free);
+        if (result == SUBMIT_RETRY) {
+            break;
         }
-        g_strfreev(lines);
+
+        if (result == SUBMIT_REJECTED && n_tracks > 1) {
+            singles_until = batch_end;
+            parse = batch_start;
+            continue;
+        }
+
+        submitted = batch_end;
+        write_queue_offset(offsetpath, submitted);
     }
 
     g_free(contents);
+
+    if (submitted > 0) {
+        compact_scrobble_log(queuepath, offsetpath, submitted);
+    }
+
     g_free(queuepath);
+    g_free(offsetpath);
 }
 
 
@@ -715,7 +824,11 @@ gpointer scrobbling_thread (gpointer input_data) {
 
             pthread_mutex_lock(&communication_mutex);
             if (scrobbling_enabled) {
-                pthread_cond_wait(&communication_signal, &communication_mutex);
+                //the queue may have been left early for a "now playing"
+                //request whose signal came while we were busy
+                if (!now_playing_requested) {
+                    pthread_cond_wait(&communication_signal, &communication_mutex);
+                }
                 pthread_mutex_unlock(&communication_mutex);
             }
             else {
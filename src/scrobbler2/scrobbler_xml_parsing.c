@@ -1,96 +1,99 @@
+//external includes
+#include <libxml/xmlreader.h>
 
 //plugin includes
 #include "scrobbler.h"
 
 //static (private) variables
-static xmlDocPtr doc = NULL;
-static xmlXPathContextPtr context = NULL;
+//The few values we ever look at, picked out of the response in a single pass
+static struct {
+    xmlChar *status;      // /lfm[@status]
+    xmlChar *error_code;  // /lfm/error[@code]
+    xmlChar *error;       // /lfm/error
+    xmlChar *user;        // /lfm/recommendations[@user]
+    xmlChar *token;       // /lfm/token
+    xmlChar *session_key; // /lfm/session/key
+} response;
+
+static void clean_data() {
+    xmlFree(response.status);
+    xmlFree(response.error_code);
+    xmlFree(response.error);
+    xmlFree(response.user);
+    xmlFree(response.token);
+    xmlFree(response.session_key);
+    memset(&response, 0, sizeof response);
+}
 
 static bool_t prepare_data () {
+    if (received_data == NULL) {
+        AUDDBG("No data received from last.fm.\n");
+        return FALSE;
+    }
+
     received_data[received_data_size] = '\0';
     AUDDBG("Data received from last.fm:\n%s\n%%%%End of data%%%%\n", received_data);
 
-    doc = xmlParseMemory(received_data, received_data_size+1);
+    xmlTextReaderPtr reader = xmlReaderForMemory(received_data, received_data_size,
+                                                 NULL, NULL, XML_PARSE_NONET);
     received_data_size = 0;
-    if (doc == NULL) {
+    if (reader == NULL) {
         AUDDBG("Document not parsed successfully.\n");
         return FALSE;
     }
 
-    context = xmlXPathNewContext(doc);
-    if (context == NULL) {
-        AUDDBG("Error in xmlXPathNewContext\n");
-        xmlFreeDoc(doc);
-        doc = NULL;
-        return FALSE;
-    }
-    return TRUE;
-}
-
-static void clean_data() {
-    xmlXPathFreeContext(context);
-    xmlFreeDoc(doc);
-    context = NULL;
-    doc = NULL;
-}
+    bool_t in_session = FALSE;
+    int ret;
 
+    while ((ret = xmlTextReaderRead(reader)) == 1) {
+        if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+            continue;
+        }
 
-//returns:
-// NULL if an error occurs or the attribute was not found
-// the attribute's value if it was found
-static xmlChar *get_attribute_value (xmlChar *node_expression, xmlChar *attribute) {
-    if (doc == NULL || context == NULL) {
-        AUDDBG("Response from last.fm not parsed successfully. Did you call prepare_data?\n");
-        return NULL;
+        int depth = xmlTextReaderDepth(reader);
+        const xmlChar *name = xmlTextReaderConstLocalName(reader);
+
+        if (depth == 0) {
+            if (!xmlStrEqual(name, (xmlChar *) "lfm")) {
+                break;
+            }
+            response.status = xmlTextReaderGetAttribute(reader, (xmlChar *) "status");
+
+        } else if (depth == 1) {
+            in_session = xmlStrEqual(name, (xmlChar *) "session");
+
+            if (xmlStrEqual(name, (xmlChar *) "error") && response.error_code == NULL) {
+                response.error_code = xmlTextReaderGetAttribute(reader, (xmlChar *) "code");
+                response.error = xmlTextReaderReadString(reader);
+            } else if (xmlStrEqual(name, (xmlChar *) "token") && response.token == NULL) {
+                response.token = xmlTextReaderReadString(reader);
+            } else if (xmlStrEqual(name, (xmlChar *) "recommendations") && response.user == NULL) {
+                response.user = xmlTextReaderGetAttribute(reader, (xmlChar *) "user");
+            }
+
+        } else if (depth == 2 && in_session && xmlStrEqual(name, (xmlChar *) "key")
+                   && response.session_key == NULL) {
+            response.session_key = xmlTextReaderReadString(reader);
+        }
     }
 
-    xmlXPathObjectPtr statusObj;
-    xmlChar *result;
+    xmlFreeTextReader(reader);
 
-
-    statusObj = xmlXPathEvalExpression((xmlChar *) node_expression, context);
-    if (statusObj == NULL) {
-        AUDDBG ("Error in xmlXPathEvalExpression.\n");
-        return NULL;
-    }
-    if (xmlXPathNodeSetIsEmpty(statusObj->nodesetval)) {
-        AUDDBG("No result.\n");
-        xmlXPathFreeObject(statusObj);
-        return NULL;
+    if (ret < 0) {
+        AUDDBG("Document not parsed successfully.\n");
+        clean_data();
+        return FALSE;
     }
 
-    result = xmlGetProp(statusObj->nodesetval->nodeTab[0], (xmlChar *) attribute);
-
-    xmlXPathFreeObject(statusObj);
-    AUDDBG("RESULT FOR THIS FUNCTION: %s.\n", result);
-    return result;
+    return TRUE;
 }
 
 //returns:
-// NULL if an error occurs or the node was not found
-static xmlChar *get_node_string (const char * node_expression) {
-    if (doc == NULL || context == NULL) {
-        AUDDBG("Response from last.fm not parsed successfully. Did you call prepare_data?\n");
-        return NULL;
-    }
-
-    xmlXPathObjectPtr statusObj;
-    xmlChar *result;
-
-
-    statusObj = xmlXPathEvalExpression((xmlChar *) node_expression, context);
-    if (statusObj == NULL) {
-        AUDDBG ("Error in xmlXPathEvalExpression.\n");
-        return NULL;
-    }
-    if (xmlXPathNodeSetIsEmpty(statusObj->nodesetval)) {
-        AUDDBG("No result.\n");
-        xmlXPathFreeObject(statusObj);
-        return NULL;
-    }
-
-    result = xmlNodeListGetString(doc, statusObj->nodesetval->nodeTab[0]->children, 1);
-    xmlXPathFreeObject(statusObj);
+// NULL if the value was not in the response
+// the value otherwise, which the caller now owns
+static xmlChar *take_value (xmlChar **value) {
+    xmlChar *result = *value;
+    *value = NULL;
     AUDDBG("RESULT FOR THIS FUNCTION: %s.\n", result);
     return result;
 }
@@ -104,22 +107,23 @@ static xmlChar *check_status (xmlChar **error_code, xmlChar **error_detail) {
     (*error_code) = NULL;
     (*error_detail) = NULL;
 
-    xmlChar *status = get_attribute_value((xmlChar *) "/lfm[@status]", (xmlChar *) "status");
+    xmlChar *status = take_value(&response.status);
     if (status == NULL || xmlStrlen(status) == 0) {
         AUDDBG("last.fm not answering according to the API.\n");
+        xmlFree(status);
         return NULL;
     }
 
     AUDDBG ("status is %s.\n", status);
     if (!xmlStrEqual(status, (xmlChar *) "ok")) {
 
-        (*error_code) = get_attribute_value((xmlChar *) "/lfm/error[@code]", (xmlChar *) "code");
+        (*error_code) = take_value(&response.error_code);
         if ((*error_code) == NULL || xmlStrlen(*error_code) == 0) {
             AUDDBG("Weird API answer. Last.fm says status is %s but there is no error code?\n", status);
             xmlFree(status);
             status = NULL;
         } else {
-            (*error_detail) = get_node_string("/lfm/error");
+            (*error_detail) = take_value(&response.error);
         }
     }
 
@@ -197,7 +201,7 @@ bool_t read_authentication_test_result (char **error_code_out, char **error_deta
         result = FALSE;
 
     } else {
-      username = (gchar *) get_attribute_value((xmlChar *) "/lfm/recommendations[@user]", (xmlChar *) "user");
+      username = (gchar *) take_value(&response.user);
       if (username == NULL || strlen(username) == 0) {
         AUDDBG("last.fm not answering according to the API.\n");
         result = FALSE;
@@ -246,7 +250,7 @@ bool_t read_token (char **error_code_out, char **error_detail_out) {
         result = FALSE;
     }
     else {
-        request_token = (gchar *) get_node_string("/lfm/token");
+        request_token = (gchar *) take_value(&response.token);
 
         if (request_token == NULL || strlen(request_token) == 0) {
             AUDDBG("Could not read the received token. Something's wrong with the API?\n");
@@ -299,7 +303,7 @@ bool_t read_session_key(char **error_code_out, char **error_detail_out) {
 
     } else {
         g_free(session_key);
-        session_key = (gchar *) get_node_string("/lfm/session/key");
+        session_key = (gchar *) take_value(&response.session_key);
 
         if (session_key == NULL || strlen(session_key) == 0) {
             AUDDBG("Could not read the received session key. Something's wrong with the API?\n");
@@ -21,6 +21,7 @@
 #include <audacious/plugin.h>
 
 #include "sdlout.h"
+#include "../outcore/outcore.h"
 
 static const char sdlout_about[] =
  N_("SDL Output Plugin for Audacious\n"
@@ -38,11 +39,11 @@ AUD_OUTPUT_PLUGIN
     .set_volume = sdlout_set_volume,
     .open_audio = sdlout_open_audio,
     .close_audio = sdlout_close_audio,
-    .buffer_free = sdlout_buffer_free,
-    .period_wait = sdlout_period_wait,
-    .write_audio = sdlout_write_audio,
-    .drain = sdlout_drain,
-    .output_time = sdlout_output_time,
-    .pause = sdlout_pause,
-    .flush = sdlout_flush
+    .buffer_free = outcore_buffer_free,
+    .period_wait = outcore_period_wait,
+    .write_audio = outcore_write,
+    .drain = outcore_drain,
+    .output_time = outcore_output_time,
+    .pause = outcore_pause,
+    .flush = outcore_flush
 )
@@ -27,12 +27,5 @@ void sdlout_get_volume (int * left, int * right);
 void sdlout_set_volume (int left, int right);
 int sdlout_open_audio (int format, int rate, int chan);
 void sdlout_close_audio (void);
-int sdlout_buffer_free (void);
-void sdlout_period_wait (void);
-void sdlout_write_audio (void * data, int len);
-void sdlout_drain (void);
-int sdlout_output_time (void);
-void sdlout_pause (int pause);
-void sdlout_flush (int time);
 
 #endif
@@ -18,7 +18,9 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <gtk/gtk.h>
 
@@ -32,11 +34,12 @@
 
 #define MAX_RESULTS 100
 #define SEARCH_DELAY 300
+#define MAX_WORKERS 8
 
 enum {ARTIST, ALBUM, TITLE, FIELDS};
 
 typedef struct item {
-    int field;
+    int field, id;
     char * name, * folded;
     struct item * parent;
     GHashTable * children;
@@ -45,7 +48,10 @@ typedef struct item {
 
 typedef struct {
     Index * items[FIELDS];
-    int mask;
+    int full; /* number of fields that have reached MAX_RESULTS */
+    int n_terms;
+    const char * * terms;
+    GHashTable * * hits;
 } SearchState;
 
 static int playlist_id;
@@ -53,6 +59,17 @@ static char * * search_terms;
 
 static GHashTable * added_table;
 static GHashTable * database;
+static GArray * entry_items; /* title item for each playlist entry, or NULL */
+
+/* Every trigram of every folded name maps to the ids of the items containing
+ * it.  Ids are handed out in increasing order, so each list is sorted and a
+ * repeated trigram within one name is caught by looking at the last id.  Ids
+ * of freed items are left in the lists and skipped by searches until the
+ * index is rebuilt. */
+static GHashTable * gram_index;
+static GPtrArray * item_table; /* id -> item, or NULL once freed */
+static int dead_items;
+
 static Index * items;
 static GArray * selection;
 
@@ -63,6 +80,38 @@ static GtkWidget * entry, * help_label, * wait_label, * scrolled, * results_list
 
 static void item_free (Item * item);
 
+static void free_ids (GArray * ids)
+{
+    g_array_free (ids, TRUE);
+}
+
+#define GRAM(s) ((unsigned char) (s)[0] | (unsigned char) (s)[1] << 8 | \
+ (unsigned char) (s)[2] << 16)
+
+static void index_item (GHashTable * grams, GPtrArray * table, Item * item)
+{
+    item->id = table->len;
+    g_ptr_array_add (table, item);
+
+    int len = strlen (item->folded);
+
+    for (int i = 0; i + 3 <= len; i ++)
+    {
+        void * key = GUINT_TO_POINTER (GRAM (item->folded + i));
+        GArray * ids = g_hash_table_lookup (grams, key);
+
+        if (! ids)
+        {
+            ids = g_array_new (FALSE, FALSE, sizeof (int));
+            g_hash_table_insert (grams, key, ids);
+        }
+        else if (g_array_index (ids, int, ids->len - 1) == item->id)
+            continue;
+
+        g_array_append_val (ids, item->id);
+    }
+}
+
 /* str_unref() may be a macro */
 static void str_unref_cb (void * str)
 {
@@ -77,6 +126,7 @@ static Item * item_new (int field, char * name, Item * parent)
     item->folded = g_utf8_casefold (name, -1);
     item->parent = parent;
     item->matches = g_array_new (FALSE, FALSE, sizeof (int));
+    item->id = -1; /* not indexed yet */
 
     /* speed things up by using g_direct_equal() instead of g_str_equal()
        because identical pooled strings have the same pointer */
@@ -91,6 +141,14 @@ static Item * item_new (int field, char * name, Item * parent)
 
 static void item_free (Item * item)
 {
+    /* items from a discarded build were never part of the live index */
+    if (item_table && item->id >= 0 && item->id < item_table->len &&
+     g_ptr_array_index (item_table, item->id) == item)
+    {
+        g_ptr_array_index (item_table, item->id) = NULL;
+        dead_items ++;
+    }
+
     if (item->children)
         g_hash_table_destroy (item->children);
 
@@ -188,107 +246,336 @@ static void destroy_database (void)
         g_hash_table_destroy (database);
         database = NULL;
     }
+
+    if (gram_index)
+    {
+        g_hash_table_destroy (gram_index);
+        gram_index = NULL;
+    }
+
+    if (item_table)
+    {
+        g_ptr_array_free (item_table, TRUE);
+        item_table = NULL;
+    }
+
+    if (entry_items)
+    {
+        g_array_free (entry_items, TRUE);
+        entry_items = NULL;
+    }
 }
 
-static void create_database (int list)
+/* matches are kept in ascending order; returns the position of the first
+ * entry number not less than <entry> */
+static int matches_find (GArray * matches, int entry)
 {
-    destroy_database ();
+    int low = 0, high = matches->len;
 
-    /* speed things up by using g_direct_equal() instead of g_str_equal()
-       because identical pooled strings have the same pointer */
-    database = g_hash_table_new_full (g_str_hash, g_direct_equal, NULL,
-     (GDestroyNotify) item_free);
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
 
-    int entries = aud_playlist_entry_count (list);
+        if (g_array_index (matches, int, mid) < entry)
+            low = mid + 1;
+        else
+            high = mid;
+    }
 
-    for (int e = 0; e < entries; e ++)
+    return low;
+}
+
+static void matches_insert (GArray * matches, int entry)
+{
+    /* fast path for a full rebuild or for entries added at the end */
+    if (! matches->len || g_array_index (matches, int, matches->len - 1) < entry)
+        g_array_append_val (matches, entry);
+    else
+        g_array_insert_val (matches, matches_find (matches, entry), entry);
+}
+
+/* returns FALSE if the entry has no title and cannot be filed */
+static bool_t describe_entry (int list, int e, char * * title, char * * artist,
+ char * * album)
+{
+    /* left untouched if the entry has gone away meanwhile */
+    * title = * artist = * album = NULL;
+
+    aud_playlist_entry_describe (list, e, title, artist, album, TRUE);
+
+    if (! * title)
     {
-        char * title, * artist, * album;
-        Item * artist_item, * album_item, * title_item;
+        str_unref (* artist);
+        str_unref (* album);
+        return FALSE;
+    }
 
-        aud_playlist_entry_describe (list, e, & title, & artist, & album, TRUE);
+    if (! * artist)
+        * artist = str_get (_("Unknown Artist"));
+    if (! * album)
+        * album = str_get (_("Unknown Album"));
 
-        if (! title)
-        {
-            str_unref (artist);
-            str_unref (album);
-            continue;
-        }
+    return TRUE;
+}
 
-        if (! artist)
-            artist = str_get (_("Unknown Artist"));
-        if (! album)
-            album = str_get (_("Unknown Album"));
+/* takes ownership of the references to title, artist, and album; returns the
+ * title item the entry was filed under */
+static Item * file_entry (GHashTable * db, int e, char * title, char * artist,
+ char * album)
+{
+    Item * artist_item, * album_item, * title_item;
 
-        artist_item = g_hash_table_lookup (database, artist);
+    artist_item = g_hash_table_lookup (db, artist);
 
-        if (! artist_item)
-        {
-            /* item_new() takes ownership of reference to artist */
-            artist_item = item_new (ARTIST, artist, NULL);
-            g_hash_table_insert (database, artist, artist_item);
-        }
-        else
-            str_unref (artist);
+    if (! artist_item)
+    {
+        /* item_new() takes ownership of reference to artist */
+        artist_item = item_new (ARTIST, artist, NULL);
+        g_hash_table_insert (db, artist, artist_item);
+    }
+    else
+        str_unref (artist);
 
-        g_array_append_val (artist_item->matches, e);
+    matches_insert (artist_item->matches, e);
 
-        album_item = g_hash_table_lookup (artist_item->children, album);
+    album_item = g_hash_table_lookup (artist_item->children, album);
 
-        if (! album_item)
-        {
-            /* item_new() takes ownership of reference to album */
-            album_item = item_new (ALBUM, album, artist_item);
-            g_hash_table_insert (artist_item->children, album, album_item);
-        }
-        else
-            str_unref (album);
+    if (! album_item)
+    {
+        /* item_new() takes ownership of reference to album */
+        album_item = item_new (ALBUM, album, artist_item);
+        g_hash_table_insert (artist_item->children, album, album_item);
+    }
+    else
+        str_unref (album);
 
-        g_array_append_val (album_item->matches, e);
+    matches_insert (album_item->matches, e);
 
-        title_item = g_hash_table_lookup (album_item->children, title);
+    title_item = g_hash_table_lookup (album_item->children, title);
 
-        if (! title_item)
-        {
-            /* item_new() takes ownership of reference to title */
-            title_item = item_new (TITLE, title, album_item);
-            g_hash_table_insert (album_item->children, title, title_item);
-        }
-        else
-            str_unref (title);
+    if (! title_item)
+    {
+        /* item_new() takes ownership of reference to title */
+        title_item = item_new (TITLE, title, album_item);
+        g_hash_table_insert (album_item->children, title, title_item);
+    }
+    else
+        str_unref (title);
+
+    matches_insert (title_item->matches, e);
+
+    return title_item;
+}
+
+/* files the entry in the live database, indexing any items it creates */
+static Item * add_entry (int list, int e)
+{
+    char * title, * artist, * album;
+
+    if (! describe_entry (list, e, & title, & artist, & album))
+        return NULL;
+
+    Item * title_item = file_entry (database, e, title, artist, album);
 
-        g_array_append_val (title_item->matches, e);
+    for (Item * item = title_item; item && item->id < 0; item = item->parent)
+        index_item (gram_index, item_table, item);
+
+    return title_item;
+}
+
+/* removes the entry from the title item and its parents, freeing any item
+ * that no longer matches anything */
+static void remove_entry (Item * item, int e)
+{
+    while (item)
+    {
+        Item * parent = item->parent;
+        int pos = matches_find (item->matches, e);
+
+        if (pos < item->matches->len && g_array_index (item->matches, int, pos) == e)
+            g_array_remove_index (item->matches, pos);
+
+        if (! item->matches->len)
+            g_hash_table_remove (parent ? parent->children : database, item->name);
+
+        item = parent;
     }
 }
 
-static void search_cb (void * key, void * _item, void * _state)
+typedef struct {
+    int from, delta;
+} ShiftState;
+
+static void shift_cb (void * key, void * _item, void * _state)
 {
     Item * item = _item;
-    SearchState * state = _state;
+    ShiftState * state = _state;
+
+    for (int m = matches_find (item->matches, state->from); m < item->matches->len; m ++)
+        g_array_index (item->matches, int, m) += state->delta;
+
+    if (item->children)
+        g_hash_table_foreach (item->children, shift_cb, state);
+}
 
-    if (index_count (state->items[item->field]) > MAX_RESULTS)
+static void create_index (GHashTable * * grams, GPtrArray * * table)
+{
+    * grams = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+     (GDestroyNotify) free_ids);
+    * table = g_ptr_array_new ();
+}
+
+typedef struct {
+    GHashTable * grams;
+    GPtrArray * table;
+} IndexState;
+
+static void reindex_cb (void * key, void * _item, void * _state)
+{
+    Item * item = _item;
+    IndexState * state = _state;
+
+    index_item (state->grams, state->table, item);
+
+    if (item->children)
+        g_hash_table_foreach (item->children, reindex_cb, state);
+}
+
+/* drops the ids of freed items once they make up half the index */
+static void compact_index (void)
+{
+    if (dead_items <= item_table->len / 2)
         return;
 
-    int oldmask = state->mask;
+    g_hash_table_destroy (gram_index);
+    g_ptr_array_free (item_table, TRUE);
+
+    create_index (& gram_index, & item_table);
+    dead_items = 0;
+
+    IndexState state = {gram_index, item_table};
+    g_hash_table_foreach (database, reindex_cb, & state);
+}
+
+/* Applies a playlist update in place.  The core reports the changed range as
+ * the entries between an unchanged head [0, at) and an unchanged tail of
+ * (entries - at - count) entries, so whatever lay between the two in the old
+ * playlist has been replaced by the <count> entries now at <at>.  Returns
+ * FALSE if the caller should rebuild instead. */
+static bool_t update_entries (int list, int at, int count)
+{
+    int entries = aud_playlist_entry_count (list);
+    int old_entries = entry_items->len;
+    int old_end = old_entries - (entries - at - count);
+
+    if (at < 0 || count < 0 || at + count > entries || old_end < at)
+        return FALSE;
+
+    /* a sort or shuffle touches nearly everything; starting over is cheaper */
+    if ((old_end - at) + count > entries / 2 + 1)
+        return FALSE;
+
+    /* the results list points into the tree, so it must go first */
+    index_delete (items, 0, index_count (items));
+
+    for (int e = at; e < old_end; e ++)
+        remove_entry (g_array_index (entry_items, Item *, e), e);
+
+    int delta = count - (old_end - at);
+
+    if (delta)
+    {
+        ShiftState state = {old_end, delta};
+        g_hash_table_foreach (database, shift_cb, & state);
+    }
+
+    g_array_remove_range (entry_items, at, old_end - at);
+    g_array_set_size (entry_items, old_entries + delta);
+
+    Item * * slots = (Item * *) entry_items->data;
+    memmove (slots + at + count, slots + at, sizeof (Item *) * (entries - at - count));
+
+    for (int e = at; e < at + count; e ++)
+        slots[e] = add_entry (list, e);
+
+    compact_index ();
+    return TRUE;
+}
+
+/* returns the items whose own names contain the term, or NULL if the term is
+ * too short to look up and has to be matched by hand */
+static GHashTable * lookup_term (const char * term)
+{
+    int len = strlen (term);
+    if (len < 3)
+        return NULL;
+
+    GHashTable * hits = g_hash_table_new (g_direct_hash, g_direct_equal);
+    GArray * shortest = NULL;
 
-    for (int t = 0, bit = 1; search_terms[t]; t ++, bit <<= 1)
+    for (int i = 0; i + 3 <= len; i ++)
     {
-        if (! (state->mask & bit))
-            continue; /* skip term if it is already found */
+        GArray * ids = g_hash_table_lookup (gram_index, GUINT_TO_POINTER (GRAM (term + i)));
+        if (! ids)
+            return hits;
 
-        if (strstr (item->folded, search_terms[t]))
-            state->mask &= ~bit; /* we found it */
-        else if (! item->children)
-            break; /* quit early if there are no children to search */
+        if (! shortest || ids->len < shortest->len)
+            shortest = ids;
     }
 
-    if (! state->mask)
-        index_append (state->items[item->field], item);
+    /* every trigram matched, so check the candidates from the rarest one */
+    for (int i = 0; i < shortest->len; i ++)
+    {
+        Item * item = g_ptr_array_index (item_table, g_array_index (shortest, int, i));
 
-    if (item->children)
-        g_hash_table_foreach (item->children, search_cb, state);
+        if (item && strstr (item->folded, term))
+            g_hash_table_insert (hits, item, item);
+    }
+
+    return hits;
+}
+
+/* a term may be found in the item itself or in one of its parents */
+static bool_t term_found (SearchState * state, int t, Item * item)
+{
+    for (; item; item = item->parent)
+    {
+        if (state->hits[t] ? g_hash_table_lookup (state->hits[t], item) != NULL :
+         strstr (item->folded, state->terms[t]) != NULL)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void search_item (Item * item, SearchState * state)
+{
+    Index * results = state->items[item->field];
+
+    if (index_count (results) <= MAX_RESULTS)
+    {
+        int t = 0;
+        while (t < state->n_terms && term_found (state, t, item))
+            t ++;
+
+        if (t == state->n_terms)
+        {
+            index_append (results, item);
+            if (index_count (results) > MAX_RESULTS)
+                state->full ++;
+        }
+    }
+
+    if (! item->children)
+        return;
+
+    GHashTableIter iter;
+    void * child;
 
-    state->mask = oldmask;
+    g_hash_table_iter_init (& iter, item->children);
+
+    while (state->full < FIELDS && g_hash_table_iter_next (& iter, NULL, & child))
+        search_item (child, state);
 }
 
 static int item_compare (const void * _a, const void * _b)
@@ -304,17 +591,64 @@ static void do_search (void)
     if (! database)
         return;
 
+    int max_terms = g_strv_length (search_terms);
+    const char * terms[max_terms + 1];
+    GHashTable * hits[max_terms + 1];
+
     SearchState state;
 
     for (int f = 0; f < FIELDS; f ++)
         state.items[f] = index_new ();
 
-    /* effectively limits number of search terms to 32 */
-    state.mask = 0;
-    for (int t = 0, bit = 1; search_terms[t]; t ++, bit <<= 1)
-        state.mask |= bit;
+    state.full = 0;
+    state.n_terms = 0;
+    state.terms = terms;
+    state.hits = hits;
+
+    /* start from the term with the fewest hits; any result either contains it
+     * or lies below an item that does */
+    GHashTable * seed = NULL;
+
+    for (int t = 0; search_terms[t]; t ++)
+    {
+        if (! search_terms[t][0])
+            continue;
+
+        terms[state.n_terms] = search_terms[t];
+        hits[state.n_terms] = lookup_term (search_terms[t]);
+
+        if (hits[state.n_terms] && (! seed || g_hash_table_size
+         (hits[state.n_terms]) < g_hash_table_size (seed)))
+            seed = hits[state.n_terms];
+
+        state.n_terms ++;
+    }
+
+    GHashTableIter iter;
+    void * value;
+
+    g_hash_table_iter_init (& iter, seed ? seed : database);
+
+    while (state.full < FIELDS && g_hash_table_iter_next (& iter, NULL, & value))
+    {
+        Item * item = value;
 
-    g_hash_table_foreach (database, search_cb, & state);
+        /* skip items that will be reached from a parent that also matched */
+        Item * parent = seed ? item->parent : NULL;
+        while (parent && ! g_hash_table_lookup (seed, parent))
+            parent = parent->parent;
+
+        if (parent)
+            continue;
+
+        search_item (item, & state);
+    }
+
+    for (int t = 0; t < state.n_terms; t ++)
+    {
+        if (hits[t])
+            g_hash_table_destroy (hits[t]);
+    }
 
     int total = 0;
 
@@ -450,17 +784,238 @@ static void schedule_search (void)
     search_source = g_timeout_add (SEARCH_DELAY, search_timeout, NULL);
 }
 
-static void update_database (void)
+/* The initial database is built off the main thread.  Entries are described
+ * in parallel, each worker then files the entries of the artists that hash to
+ * it into a tree of its own, and since no artist spans two trees they are
+ * merged simply by moving the artist items into one table. */
+
+typedef struct {
+    char * title, * artist, * album;
+    int shard;
+} EntryInfo;
+
+typedef struct {
+    int list, entries, workers;
+    EntryInfo * info;
+    GHashTable * shards[MAX_WORKERS];
+    GHashTable * database, * gram_index;
+    GPtrArray * item_table;
+    GArray * entry_items;
+    bool_t cancel;
+    pthread_t thread;
+} Build;
+
+typedef struct {
+    Build * build;
+    int worker;
+} BuildTask;
+
+static pthread_mutex_t build_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Build * build;
+static bool_t build_stale;
+static int build_source;
+
+static bool_t build_done_cb (void * unused);
+
+static void * describe_worker (void * _task)
 {
-    int list = get_playlist (TRUE, TRUE);
+    BuildTask * task = _task;
+    Build * b = task->build;
+    int start = (int64_t) b->entries * task->worker / b->workers;
+    int end = (int64_t) b->entries * (task->worker + 1) / b->workers;
 
-    if (list >= 0)
+    for (int e = start; e < end; e ++)
     {
-        create_database (list);
-        schedule_search ();
+        if (__atomic_load_n (& b->cancel, __ATOMIC_RELAXED))
+            break;
+
+        EntryInfo * info = & b->info[e];
+
+        if (describe_entry (b->list, e, & info->title, & info->artist, & info->album))
+            info->shard = g_str_hash (info->artist) % b->workers;
+        else
+            info->title = info->artist = info->album = NULL;
+    }
+
+    return NULL;
+}
+
+static void * shard_worker (void * _task)
+{
+    BuildTask * task = _task;
+    Build * b = task->build;
+
+    /* speed things up by using g_direct_equal() instead of g_str_equal()
+       because identical pooled strings have the same pointer */
+    GHashTable * shard = g_hash_table_new_full (g_str_hash, g_direct_equal,
+     NULL, (GDestroyNotify) item_free);
+
+    for (int e = 0; e < b->entries; e ++)
+    {
+        EntryInfo * info = & b->info[e];
+
+        if (info->title && info->shard == task->worker)
+            g_array_index (b->entry_items, Item *, e) = file_entry (shard, e,
+             info->title, info->artist, info->album);
+    }
+
+    b->shards[task->worker] = shard;
+    return NULL;
+}
+
+/* runs one task per worker, the first on the calling thread */
+static void run_workers (Build * b, void * (* func) (void *))
+{
+    BuildTask tasks[MAX_WORKERS];
+    pthread_t threads[MAX_WORKERS];
+
+    for (int w = 0; w < b->workers; w ++)
+    {
+        tasks[w].build = b;
+        tasks[w].worker = w;
+    }
+
+    for (int w = 1; w < b->workers; w ++)
+        pthread_create (& threads[w], NULL, func, & tasks[w]);
+
+    func (& tasks[0]);
+
+    for (int w = 1; w < b->workers; w ++)
+        pthread_join (threads[w], NULL);
+}
+
+static void * build_thread (void * _build)
+{
+    Build * b = _build;
+
+    run_workers (b, describe_worker);
+
+    if (__atomic_load_n (& b->cancel, __ATOMIC_RELAXED))
+    {
+        for (int e = 0; e < b->entries; e ++)
+        {
+            str_unref (b->info[e].title);
+            str_unref (b->info[e].artist);
+            str_unref (b->info[e].album);
+        }
     }
     else
-        destroy_database ();
+    {
+        b->entry_items = g_array_sized_new (FALSE, TRUE, sizeof (Item *), b->entries);
+        g_array_set_size (b->entry_items, b->entries);
+
+        run_workers (b, shard_worker);
+
+        b->database = g_hash_table_new_full (g_str_hash, g_direct_equal,
+         NULL, (GDestroyNotify) item_free);
+
+        for (int w = 0; w < b->workers; w ++)
+        {
+            GHashTableIter iter;
+            void * key, * value;
+
+            g_hash_table_iter_init (& iter, b->shards[w]);
+
+            while (g_hash_table_iter_next (& iter, & key, & value))
+            {
+                g_hash_table_insert (b->database, key, value);
+                g_hash_table_iter_steal (& iter);
+            }
+
+            g_hash_table_destroy (b->shards[w]);
+        }
+
+        create_index (& b->gram_index, & b->item_table);
+
+        IndexState state = {b->gram_index, b->item_table};
+        g_hash_table_foreach (b->database, reindex_cb, & state);
+    }
+
+    g_free (b->info);
+    b->info = NULL;
+
+    pthread_mutex_lock (& build_mutex);
+    build_source = g_idle_add (build_done_cb, NULL);
+    pthread_mutex_unlock (& build_mutex);
+
+    return NULL;
+}
+
+static void start_build (int list)
+{
+    int entries = aud_playlist_entry_count (list);
+    int workers = sysconf (_SC_NPROCESSORS_ONLN);
+
+    /* threads are not worth starting for a small library */
+    if (entries < 1000 || workers < 1)
+        workers = 1;
+    else if (workers > MAX_WORKERS)
+        workers = MAX_WORKERS;
+
+    build = g_new0 (Build, 1);
+    build->list = list;
+    build->entries = entries;
+    build->workers = workers;
+    build->info = g_new0 (EntryInfo, entries);
+    build_stale = FALSE;
+
+    pthread_create (& build->thread, NULL, build_thread, build);
+}
+
+/* waits for the build thread and takes the result back from it */
+static Build * finish_build (void)
+{
+    pthread_join (build->thread, NULL);
+
+    if (build_source)
+    {
+        g_source_remove (build_source);
+        build_source = 0;
+    }
+
+    Build * b = build;
+    build = NULL;
+    return b;
+}
+
+static void discard_build (Build * b)
+{
+    if (b->database)
+        g_hash_table_destroy (b->database);
+    if (b->gram_index)
+        g_hash_table_destroy (b->gram_index);
+    if (b->item_table)
+        g_ptr_array_free (b->item_table, TRUE);
+    if (b->entry_items)
+        g_array_free (b->entry_items, TRUE);
+
+    g_free (b);
+}
+
+static void cancel_build (void)
+{
+    if (! build)
+        return;
+
+    __atomic_store_n (& build->cancel, TRUE, __ATOMIC_RELAXED);
+    discard_build (finish_build ());
+}
+
+static void update_database (void)
+{
+    /* picked up again once the build in progress is finished */
+    if (build)
+    {
+        build_stale = TRUE;
+        return;
+    }
+
+    destroy_database ();
+
+    int list = get_playlist (TRUE, TRUE);
+
+    if (list >= 0)
+        start_build (list);
 
     if (results_list)
         audgui_list_delete_rows (results_list, 0, audgui_list_row_count (results_list));
@@ -468,6 +1023,34 @@ static void update_database (void)
     show_hide_widgets ();
 }
 
+static bool_t build_done_cb (void * unused)
+{
+    pthread_mutex_lock (& build_mutex);
+    build_source = 0;
+    pthread_mutex_unlock (& build_mutex);
+
+    Build * b = finish_build ();
+
+    /* the playlist changed while we were working on it */
+    if (build_stale)
+    {
+        discard_build (b);
+        update_database ();
+        return FALSE;
+    }
+
+    database = b->database;
+    gram_index = b->gram_index;
+    item_table = b->item_table;
+    entry_items = b->entry_items;
+    dead_items = 0;
+    g_free (b);
+
+    schedule_search ();
+    show_hide_widgets ();
+    return FALSE;
+}
+
 static void add_complete_cb (void * unused, void * unused2)
 {
     if (adding)
@@ -482,28 +1065,50 @@ static void add_complete_cb (void * unused, void * unused2)
         }
     }
 
-    if (! database && ! aud_playlist_update_pending ())
+    if (! database && ! build && ! aud_playlist_update_pending ())
         update_database ();
 }
 
 static void scan_complete_cb (void * unused, void * unused2)
 {
-    if (! database && ! aud_playlist_update_pending ())
+    if (! database && ! build && ! aud_playlist_update_pending ())
         update_database ();
 }
 
 static void playlist_update_cb (void * data, void * unused)
 {
-    if (! database)
-        update_database ();
-    else
+    if (build)
     {
         int list = get_playlist (TRUE, TRUE);
         int at, count;
 
         if (list < 0 || aud_playlist_updated_range (list, & at, & count) >=
          PLAYLIST_UPDATE_METADATA)
+            build_stale = TRUE;
+    }
+    else if (! database)
+        update_database ();
+    else
+    {
+        int list = get_playlist (TRUE, TRUE);
+        int at, count;
+
+        if (list < 0)
             update_database ();
+        else if (aud_playlist_updated_range (list, & at, & count) >=
+         PLAYLIST_UPDATE_METADATA)
+        {
+            if (! update_entries (list, at, count))
+            {
+                update_database ();
+                return;
+            }
+
+            if (results_list)
+                audgui_list_delete_rows (results_list, 0, audgui_list_row_count (results_list));
+
+            schedule_search ();
+        }
     }
 }
 
@@ -530,6 +1135,8 @@ static void search_cleanup (void)
     hook_dissociate ("playlist scan complete", scan_complete_cb);
     hook_dissociate ("playlist update", playlist_update_cb);
 
+    cancel_build ();
+
     if (search_source)
     {
         g_source_remove (search_source);
@@ -30,6 +30,8 @@
 #include <audacious/plugin.h>
 
 #include "xs_sidplay2.h"
+#include "../perfstat/perfstat.h"
+#include "../ratepref/ratepref.h"
 
 
 /*
@@ -45,6 +47,7 @@ static void xs_get_song_tuple_info(Tuple *pResult, xs_tuneinfo_t *pInfo, int sub
  */
 bool_t xs_init(void)
 {
+    int64_t init_begin = perfstat_now();
     bool_t success;
 
     /* Initialize and get configuration */
@@ -75,17 +78,8 @@ bool_t xs_init(void)
     if (! success)
         return FALSE;
 
-    /* Initialize song-length database */
-    xs_songlen_close();
-    if (xs_cfg.songlenDBEnable && (xs_songlen_init() != 0)) {
-        xs_error("Error initializing song-length database!\n");
-    }
-
-    /* Initialize STIL database */
-    xs_stil_close();
-    if (xs_cfg.stilDBEnable && (xs_stil_init() != 0)) {
-        xs_error("Error initializing STIL database!\n");
-    }
+    /* The databases are loaded in the background */
+    xs_databases_start(init_begin);
 
     return TRUE;
 }
@@ -102,8 +96,145 @@ void xs_close(void)
     xs_sidplayfp_delete (& xs_status);
     xs_sidplayfp_close (& xs_status);
 
-    xs_songlen_close();
-    xs_stil_close();
+    xs_databases_close();
+}
+
+
+/*
+ * Render-ahead thread
+ * Keeps up to XS_AHEAD_BLOCKS blocks emulated ahead of the output, so that
+ * the filter emulation has headroom when the system is busy. The emulator
+ * is only ever used by this thread while it runs, so the playing thread
+ * stops it before seeking. Without the thread, blocks are rendered inline.
+ */
+#define XS_AHEAD_BLOCKS (8)
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    xs_status_t *status;
+    char *ring;
+    unsigned lengths[XS_AHEAD_BLOCKS];
+    int blockSize, head, fill;
+    bool_t threaded, quit;
+} xs_render_t;
+
+
+static void *xs_render_worker(void *data)
+{
+    xs_render_t *r = (xs_render_t *) data;
+
+    pthread_mutex_lock(&r->mutex);
+
+    while (!r->quit) {
+        int tail;
+        unsigned len;
+
+        if (r->fill == XS_AHEAD_BLOCKS) {
+            pthread_cond_wait(&r->cond, &r->mutex);
+            continue;
+        }
+
+        tail = (r->head + r->fill) % XS_AHEAD_BLOCKS;
+        pthread_mutex_unlock(&r->mutex);
+
+        /* The reader never touches the free blocks */
+        len = xs_sidplayfp_fillbuffer(r->status, r->ring + tail * r->blockSize, r->blockSize);
+
+        pthread_mutex_lock(&r->mutex);
+        r->lengths[tail] = len;
+        r->fill++;
+        pthread_cond_broadcast(&r->cond);
+
+        /* The emulation failed; the reader gets an empty block */
+        if (!len)
+            break;
+    }
+
+    pthread_mutex_unlock(&r->mutex);
+    return NULL;
+}
+
+
+static bool_t xs_render_init(xs_render_t *r, xs_status_t *status, int blockSize)
+{
+    memset(r, 0, sizeof(xs_render_t));
+
+    r->ring = (char *) malloc(XS_AHEAD_BLOCKS * blockSize);
+    if (!r->ring)
+        return FALSE;
+
+    r->status = status;
+    r->blockSize = blockSize;
+    pthread_mutex_init(&r->mutex, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return TRUE;
+}
+
+
+static void xs_render_start(xs_render_t *r)
+{
+    r->head = r->fill = 0;
+    r->quit = FALSE;
+    r->threaded = !pthread_create(&r->thread, NULL, xs_render_worker, r);
+}
+
+
+/* Stops the thread and discards what it rendered ahead
+ */
+static void xs_render_stop(xs_render_t *r)
+{
+    if (r->threaded) {
+        pthread_mutex_lock(&r->mutex);
+        r->quit = TRUE;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+
+        pthread_join(r->thread, NULL);
+        r->threaded = FALSE;
+    }
+}
+
+
+static void xs_render_free(xs_render_t *r)
+{
+    xs_render_stop(r);
+    pthread_mutex_destroy(&r->mutex);
+    pthread_cond_destroy(&r->cond);
+    free(r->ring);
+}
+
+
+/* Waits for the next block and returns it, or NULL if the emulation failed;
+ * call xs_render_release() once it has been written
+ */
+static char *xs_render_get(xs_render_t *r, unsigned *len)
+{
+    if (!r->threaded) {
+        *len = xs_sidplayfp_fillbuffer(r->status, r->ring, r->blockSize);
+        return *len ? r->ring : NULL;
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    while (!r->fill)
+        pthread_cond_wait(&r->cond, &r->mutex);
+    *len = r->lengths[r->head];
+    pthread_mutex_unlock(&r->mutex);
+
+    return *len ? r->ring + r->head * r->blockSize : NULL;
+}
+
+
+static void xs_render_release(xs_render_t *r)
+{
+    if (r->threaded) {
+        pthread_mutex_lock(&r->mutex);
+        r->head = (r->head + 1) % XS_AHEAD_BLOCKS;
+        r->fill--;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->mutex);
+    }
 }
 
 
@@ -114,8 +245,9 @@ bool_t xs_play_file(InputPlayback *pb, const char *filename, VFSFile *file,
  int start_time, int stop_time, bool_t pause)
 {
     xs_tuneinfo_t *tmpTune;
-    int audioBufSize, bufRemaining, tmpLength, subTune = -1;
-    char *audioBuffer = NULL, *oversampleBuffer = NULL;
+    int blockSize, tmpLength, subTune = -1;
+    xs_render_t render;
+    bool_t haveRender = FALSE;
     Tuple *tmpTuple;
 
     assert(pb);
@@ -152,12 +284,14 @@ bool_t xs_play_file(InputPlayback *pb, const char *filename, VFSFile *file,
 
     int channels = xs_status.audioChannels;
 
-    /* Allocate audio buffer */
-    audioBufSize = xs_status.audioFrequency * channels * FMT_SIZEOF (FMT_S16_NE);
-    if (audioBufSize < 512) audioBufSize = 512;
+    /* reSID resamples anyway, so render at the output's rate if known */
+    xs_status.audioFrequency = ratepref_get(xs_cfg.audioFrequency);
 
-    audioBuffer = (char *) malloc(audioBufSize);
-    if (audioBuffer == NULL) {
+    /* Allocate audio buffers, a quarter of a second each */
+    blockSize = (xs_status.audioFrequency / 4) * channels * FMT_SIZEOF (FMT_S16_NE);
+    if (blockSize < 512) blockSize = 512;
+
+    if (!(haveRender = xs_render_init(&render, &xs_status, blockSize))) {
         xs_error("Couldn't allocate memory for audio data buffer!\n");
         pthread_mutex_unlock(&xs_status_mutex);
         goto xs_err_exit;
@@ -197,14 +331,21 @@ bool_t xs_play_file(InputPlayback *pb, const char *filename, VFSFile *file,
     xs_get_song_tuple_info(tmpTuple, tmpTune, xs_status.currSong);
 
     xs_status.stop_flag = FALSE;
+    xs_status.seekTime = -1;
     pthread_mutex_unlock(&xs_status_mutex);
 
     pb->set_tuple(pb, tmpTuple);
     pb->set_params (pb, -1, xs_status.audioFrequency, channels);
     pb->set_pb_ready(pb);
 
+    xs_render_start(&render);
+
     while (1)
     {
+        char *block;
+        unsigned blockLen;
+        int seekTime;
+
         pthread_mutex_lock(&xs_status_mutex);
 
         if (xs_status.stop_flag)
@@ -213,11 +354,27 @@ bool_t xs_play_file(InputPlayback *pb, const char *filename, VFSFile *file,
             break;
         }
 
+        seekTime = xs_status.seekTime;
+        xs_status.seekTime = -1;
+
         pthread_mutex_unlock(&xs_status_mutex);
 
-        bufRemaining = xs_sidplayfp_fillbuffer(&xs_status, audioBuffer, audioBufSize);
+        if (seekTime >= 0)
+        {
+            xs_render_stop(&render);
+
+            if ((seekTime = xs_sidplayfp_seek(&xs_status, seekTime)) < 0)
+                goto xs_err_exit;
+
+            pb->output->flush(seekTime);
+            xs_render_start(&render);
+        }
+
+        if (!(block = xs_render_get(&render, &blockLen)))
+            break;
 
-        pb->output->write_audio (audioBuffer, bufRemaining);
+        pb->output->write_audio (block, blockLen);
+        xs_render_release(&render);
 
         /* Check if we have played enough */
         if (xs_cfg.playMaxTimeEnable) {
@@ -238,8 +395,8 @@ bool_t xs_play_file(InputPlayback *pb, const char *filename, VFSFile *file,
     }
 
 DONE:
-    free(audioBuffer);
-    free(oversampleBuffer);
+    if (haveRender)
+        xs_render_free(&render);
 
     /* Set playing status to false (stopped), thus when
      * XMMS next calls xs_get_time(), it can return appropriate
@@ -289,6 +446,23 @@ void xs_stop(InputPlayback *pb)
 }
 
 
+/*
+ * Seek to given time in milliseconds; done by the playing thread
+ */
+void xs_seek(InputPlayback *pb, int time)
+{
+    pthread_mutex_lock(&xs_status_mutex);
+
+    if (! xs_status.stop_flag)
+    {
+        xs_status.seekTime = time;
+        pb->output->abort_write ();
+    }
+
+    pthread_mutex_unlock(&xs_status_mutex);
+}
+
+
 /*
  * Pause/unpause the playing
  */
@@ -385,21 +559,17 @@ Tuple * xs_probe_for_tuple(const char *filename, VFSFile *fd)
     xs_tuneinfo_t *info;
     int tune = -1;
 
-    pthread_mutex_lock(&xs_status_mutex);
-    if (!xs_sidplayfp_probe(fd)) {
-        pthread_mutex_unlock(&xs_status_mutex);
+    /* Neither of these touches xs_status, so probing does not wait for
+     * playback, nor other probes */
+    if (!xs_sidplayfp_probe(fd))
         return NULL;
-    }
-    pthread_mutex_unlock(&xs_status_mutex);
 
     /* Get information from URL */
     tuple = tuple_new_from_filename (filename);
     tune = tuple_get_int (tuple, FIELD_SUBSONG_NUM, NULL);
 
-    /* Get tune information from emulation engine */
-    pthread_mutex_lock(&xs_status_mutex);
+    /* Get tune information, parsed once for probing and playing */
     info = xs_sidplayfp_getinfo (filename);
-    pthread_mutex_unlock(&xs_status_mutex);
 
     if (info == NULL)
         return tuple;
@@ -428,6 +598,7 @@ AUD_INPUT_PLUGIN
     .play = xs_play_file,               /* Play given file */
     .stop = xs_stop,                    /* Stop playing */
     .pause = xs_pause,                  /* Pause playing */
+    .mseek = xs_seek,                   /* Seek */
     .probe_for_tuple = xs_probe_for_tuple,
 
     .extensions = xs_sid_fmts,          /* File ext assist */
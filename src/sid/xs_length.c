@@ -27,40 +27,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+#include <libaudcore/audstrings.h>
 
 #include "xmms-sid.h"
 #include "xs_support.h"
 
-/* Free memory allocated for given SLDB node
+#define SLDB_CACHE_MAGIC "XSSLDB1" /* 8 bytes, including the nul */
+
+/* Header of the compiled cache file, which is followed by the sorted nodes
+ * and then the lengths they index
  */
-static void xs_sldb_node_free(sldb_node_t *node)
-{
-    if (node) {
-        /* Nothing much to do here ... */
-        free(node->lengths);
-        free(node);
-    }
-}
+typedef struct {
+    char magic[8];
+    int64_t size, mtime;    /* Of the text file; mtime in nanoseconds */
+    int64_t n, nlengths;
+} sldb_cache_header_t;
 
 
-/* Insert given node to db linked list
+/* A hash computed earlier, valid while the file is unchanged
  */
-static void xs_sldb_node_insert(xs_sldb_t *db, sldb_node_t *node)
-{
-    assert(db);
-
-    if (db->nodes) {
-        /* The first node's prev points to last node */
-        node->prev = db->nodes->prev;    /* New node's prev = Previous last node */
-        db->nodes->prev->next = node;    /* Previous last node's next = New node */
-        db->nodes->prev = node;    /* New last node = New node */
-        node->next = NULL;    /* But next is NULL! */
-    } else {
-        db->nodes = node;    /* First node ... */
-        node->prev = node;    /* ... it's also last */
-        node->next = NULL;    /* But next is NULL! */
-    }
-}
+typedef struct {
+    int64_t size, mtime;
+    xs_md5hash_t md5Hash;
+} sldb_hash_t;
 
 
 /* Parse a time-entry in SLDB format
@@ -101,108 +93,71 @@ static int xs_sldb_gettime(char *str, size_t *pos)
 }
 
 
-/* Parse one SLDB definition line, return SLDB node
+/* Parse one SLDB definition line into node, appending its lengths
  */
-sldb_node_t * xs_sldb_read_entry(char *inLine)
+static bool_t xs_sldb_read_entry(GArray *lengths, sldb_node_t *node, char *inLine)
 {
     size_t linePos;
     int i;
-    bool_t isOK;
-    sldb_node_t *tmnode;
 
-    /* Allocate new node */
-    tmnode = (sldb_node_t *) malloc(sizeof(sldb_node_t));
-    if (!tmnode) {
-        xs_error("Error allocating new node. Fatal error.\n");
-        return NULL;
-    }
-    memset(tmnode, 0, sizeof(sldb_node_t));
+    memset(node, 0, sizeof(sldb_node_t));
 
     /* Get hash value */
     linePos = 0;
     for (i = 0; i < XS_MD5HASH_LENGTH; i++, linePos += 2) {
         unsigned tmpu;
         sscanf(&inLine[linePos], "%2x", &tmpu);
-        tmnode->md5Hash[i] = tmpu;
+        node->md5Hash[i] = tmpu;
     }
 
     /* Get playtimes */
-    if (inLine[linePos] != 0) {
-        if (inLine[linePos] != '=') {
-            xs_error("'=' expected on column #%d.\n", (int)linePos);
-            xs_sldb_node_free(tmnode);
-            return NULL;
-        } else {
-            size_t tmpLen, savePos;
-
-            /* First playtime is after '=' */
-            savePos = ++linePos;
-            tmpLen = strlen(inLine);
-
-            /* Get number of sub-tune lengths */
-            isOK = TRUE;
-            while ((linePos < tmpLen) && isOK) {
-                xs_findnext(inLine, &linePos);
-
-                if (xs_sldb_gettime(inLine, &linePos) >= 0)
-                    tmnode->nlengths++;
-                else
-                    isOK = FALSE;
-            }
+    if (inLine[linePos] == 0)
+        return FALSE;
 
-            /* Allocate memory for lengths */
-            if (tmnode->nlengths > 0) {
-                tmnode->lengths = (int *) malloc(tmnode->nlengths * sizeof(int));
-                if (!tmnode->lengths) {
-                    xs_error("Could not allocate memory for node.\n");
-                    xs_sldb_node_free(tmnode);
-                    return NULL;
-                }
-                memset(tmnode->lengths, 0, tmnode->nlengths * sizeof(int));
-            } else {
-                xs_sldb_node_free(tmnode);
-                return NULL;
-            }
+    if (inLine[linePos] != '=') {
+        xs_error("'=' expected on column #%d.\n", (int)linePos);
+        return FALSE;
+    }
 
-            /* Read lengths in */
-            i = 0;
-            linePos = savePos;
-            isOK = TRUE;
-            while ((linePos < tmpLen) && (i < tmnode->nlengths) && isOK) {
-                int l;
+    /* First playtime is after '=', the rest up to the first invalid one */
+    node->offset = lengths->len;
+    linePos++;
 
-                xs_findnext(inLine, &linePos);
+    while (inLine[linePos]) {
+        int32_t l;
 
-                l = xs_sldb_gettime(inLine, &linePos);
-                if (l >= 0)
-                    tmnode->lengths[i] = l;
-                else
-                    isOK = FALSE;
+        xs_findnext(inLine, &linePos);
 
-                i++;
-            }
+        l = xs_sldb_gettime(inLine, &linePos);
+        if (l < 0)
+            break;
 
-            if (!isOK) {
-                xs_sldb_node_free(tmnode);
-                return NULL;
-            } else
-                return tmnode;
-        }
+        g_array_append_val(lengths, l);
+        node->nlengths++;
     }
 
-    return NULL;
+    return (node->nlengths > 0);
 }
 
 
-/* Read database to memory
+/* Compare two nodes
  */
-int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
+static int xs_sldb_cmp(const void *node1, const void *node2)
+{
+    return memcmp(((const sldb_node_t *) node1)->md5Hash,
+        ((const sldb_node_t *) node2)->md5Hash, XS_MD5HASH_LENGTH);
+}
+
+
+/* Parse the text database to memory and sort it
+ */
+static int xs_sldb_parse(xs_sldb_t *db, const char *dbFilename)
 {
     FILE *inFile;
     char inLine[XS_BUF_SIZE];
     size_t lineNum;
-    sldb_node_t *tmnode;
-    assert(db);
+    GArray *nodes, *lengths;
+    sldb_node_t tmnode;
 
     /* Try to open the file */
     if ((inFile = fopen(dbFilename, "r")) == NULL) {
@@ -210,6 +165,9 @@ int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
         return -1;
     }
 
+    nodes = g_array_new(FALSE, FALSE, sizeof(sldb_node_t));
+    lengths = g_array_new(FALSE, FALSE, sizeof(int32_t));
+
     /* Read and parse the data */
     lineNum = 0;
 
@@ -230,9 +188,12 @@ int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
                     dbFilename, (int)lineNum);
             } else {
                 /* Parse and add node to db */
-                if ((tmnode = xs_sldb_read_entry(inLine)) != NULL) {
-                    xs_sldb_node_insert(db, tmnode);
+                guint saveLen = lengths->len;
+
+                if (xs_sldb_read_entry(lengths, &tmnode, inLine)) {
+                    g_array_append_val(nodes, tmnode);
                 } else {
+                    g_array_set_size(lengths, saveLen);
                     xs_error("Invalid entry in SongLengthDB file '%s' line #%d!\n",
                         dbFilename, (int)lineNum);
                 }
@@ -247,80 +208,133 @@ int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
     /* Close the file */
     fclose(inFile);
 
+    /* Sort the nodes for binary search */
+    qsort(nodes->data, nodes->len, sizeof(sldb_node_t), xs_sldb_cmp);
+
+    db->n = nodes->len;
+    db->nlengths = lengths->len;
+    db->nodes = (sldb_node_t *) g_array_free(nodes, FALSE);
+    db->lengths = (int32_t *) g_array_free(lengths, FALSE);
+
     return 0;
 }
 
 
-/* Compare two given MD5-hashes.
- * Return: 0 if equal
- *         negative if testHash1 < testHash2
- *         positive if testHash1 > testHash2
+/* Returns the name of the cache file for the text database and sets its
+ * size and mtime, or returns NULL if the text file cannot be found.
  */
-static int xs_sldb_cmphash(xs_md5hash_t testHash1, xs_md5hash_t testHash2)
+static char *xs_sldb_cache_path(const char *dbFilename, int64_t *size, int64_t *mtime)
 {
-    int i, d;
+    struct stat st;
+    char *hash, *path;
 
-    /* Compute difference of hashes */
-    for (i = 0, d = 0; (i < XS_MD5HASH_LENGTH) && !d; i++)
-        d = (testHash1[i] - testHash2[i]);
+    if (g_stat(dbFilename, &st) < 0) {
+        xs_error("Could not open SongLengthDB '%s'\n", dbFilename);
+        return NULL;
+    }
 
-    return d;
+    *size = st.st_size;
+    *mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, dbFilename, -1);
+    path = g_build_filename(g_get_user_cache_dir(), "audacious", "sid", hash, NULL);
+    g_free(hash);
+
+    return path;
 }
 
 
-/* Compare two nodes
+/* Map the cache file, if it is there and matches the text file
  */
-static int xs_sldb_cmp(const void *node1, const void *node2)
+static bool_t xs_sldb_cache_load(xs_sldb_t *db, const char *path, int64_t size, int64_t mtime)
 {
-    /* We assume here that we never ever get NULL-pointers or similar */
-    return xs_sldb_cmphash(
-        (*(sldb_node_t **) node1)->md5Hash,
-        (*(sldb_node_t **) node2)->md5Hash);
+    GMappedFile *map;
+    const sldb_cache_header_t *head;
+    gsize mapSize;
+    char *data;
+
+    if (!(map = g_mapped_file_new(path, FALSE, NULL)))
+        return FALSE;
+
+    data = g_mapped_file_get_contents(map);
+    mapSize = g_mapped_file_get_length(map);
+    head = (const sldb_cache_header_t *) data;
+
+    if (mapSize < sizeof(sldb_cache_header_t) || memcmp(head->magic, SLDB_CACHE_MAGIC, 8) ||
+        head->size != size || head->mtime != mtime || head->n < 0 || head->nlengths < 0 ||
+        mapSize != sizeof(sldb_cache_header_t) + head->n * sizeof(sldb_node_t) +
+        head->nlengths * sizeof(int32_t)) {
+        g_mapped_file_unref(map);
+        return FALSE;
+    }
+
+    db->map = map;
+    db->n = head->n;
+    db->nlengths = head->nlengths;
+    db->nodes = (sldb_node_t *) (data + sizeof(sldb_cache_header_t));
+    db->lengths = (int32_t *) (db->nodes + db->n);
+
+    return TRUE;
 }
 
 
-/* (Re)create index
+/* Write the parsed database out for the next start
  */
-int xs_sldb_index(xs_sldb_t * db)
+static void xs_sldb_cache_save(xs_sldb_t *db, const char *path, int64_t size, int64_t mtime)
 {
-    sldb_node_t *pCurr;
-    size_t i;
-    assert(db);
-
-    /* Free old index */
-    if (db->pindex) {
-        free(db->pindex);
-        db->pindex = NULL;
+    sldb_cache_header_t head;
+    char *dir = g_path_get_dirname(path);
+    char *temp = g_strconcat(path, ".tmp", NULL);
+    FILE *outFile = NULL;
+    bool_t ok;
+
+    if (g_mkdir_with_parents(dir, 0700) < 0 || !(outFile = g_fopen(temp, "wb")))
+        goto out;
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, SLDB_CACHE_MAGIC, 8);
+    head.size = size;
+    head.mtime = mtime;
+    head.n = db->n;
+    head.nlengths = db->nlengths;
+
+    ok = (fwrite(&head, sizeof(head), 1, outFile) == 1 &&
+        fwrite(db->nodes, sizeof(sldb_node_t), db->n, outFile) == db->n &&
+        fwrite(db->lengths, sizeof(int32_t), db->nlengths, outFile) == db->nlengths);
+    ok = (fclose(outFile) == 0) && ok;
+
+    /* Written under a temporary name, so that a reader never maps half of it */
+    if (!ok || g_rename(temp, path) < 0) {
+        xs_error("Could not save SongLengthDB cache '%s'\n", path);
+        g_unlink(temp);
     }
 
-    /* Get size of db */
-    pCurr = db->nodes;
-    db->n = 0;
-    while (pCurr) {
-        db->n++;
-        pCurr = pCurr->next;
-    }
+out:
+    g_free(dir);
+    g_free(temp);
+}
 
-    /* Check number of nodes */
-    if (db->n > 0) {
-        /* Allocate memory for index-table */
-        db->pindex = (sldb_node_t **) malloc(sizeof(sldb_node_t *) * db->n);
-        if (!db->pindex)
-            return -1;
 
-        /* Get node-pointers to table */
-        i = 0;
-        pCurr = db->nodes;
-        while (pCurr && (i < db->n)) {
-            db->pindex[i++] = pCurr;
-            pCurr = pCurr->next;
-        }
+/* Read database to memory, from the compiled cache when it is up to date
+ */
+int xs_sldb_read(xs_sldb_t *db, const char *dbFilename)
+{
+    int64_t size, mtime;
+    char *path;
+    int result = 0;
+    assert(db);
+
+    if (!(path = xs_sldb_cache_path(dbFilename, &size, &mtime)))
+        return -1;
 
-        /* Sort the indexes */
-        qsort(db->pindex, db->n, sizeof(sldb_node_t *), xs_sldb_cmp);
+    if (!xs_sldb_cache_load(db, path, size, mtime)) {
+        result = xs_sldb_parse(db, dbFilename);
+        if (result == 0)
+            xs_sldb_cache_save(db, path, size, mtime);
     }
 
-    return 0;
+    g_free(path);
+    return result;
 }
 
 
@@ -328,30 +342,21 @@ int xs_sldb_index(xs_sldb_t * db)
  */
 void xs_sldb_free(xs_sldb_t * db)
 {
-    sldb_node_t *pCurr, *next;
-
     if (!db)
         return;
 
-    /* Free the memory allocated for nodes */
-    pCurr = db->nodes;
-    while (pCurr) {
-        next = pCurr->next;
-        xs_sldb_node_free(pCurr);
-        pCurr = next;
-    }
-
-    db->nodes = NULL;
+    if (db->hashes)
+        g_hash_table_destroy(db->hashes);
 
-    /* Free memory allocated for index */
-    if (db->pindex) {
-        free(db->pindex);
-        db->pindex = NULL;
+    if (db->map)
+        g_mapped_file_unref(db->map);
+    else {
+        g_free(db->nodes);
+        g_free(db->lengths);
     }
 
     /* Free structure */
-    db->n = 0;
-    free(db);
+    g_free(db);
 }
 
 
@@ -380,76 +385,66 @@ typedef struct {
 } psidv2_header_t;
 
 
-static int xs_get_sid_hash(const char *filename, xs_md5hash_t hash)
+static uint16_t xs_get_be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+
+static int xs_compute_sid_hash(const char *filename, const uint8_t *data, int64_t size, xs_md5hash_t hash)
 {
-    VFSFile *inFile;
     xs_md5state_t inState;
     psidv1_header_t psidH;
     psidv2_header_t psidH2;
-    uint8_t *songData;
+    const uint8_t *songData;
     uint8_t ib8[2], i8;
-    int index, result;
-
-    /* Try to open the file */
-    if ((inFile = vfs_fopen(filename, "rb")) == NULL)
-        return -1;
+    int index, result, headerLen;
 
-    /* Read PSID header in */
-    if (vfs_fread(psidH.magicID, 1, sizeof psidH.magicID, inFile) < sizeof psidH.magicID) {
-        vfs_fclose(inFile);
+    /* Check the PSID header */
+    if (size < 4)
         return -1;
-    }
 
+    memcpy(psidH.magicID, data, sizeof psidH.magicID);
     if (strncmp(psidH.magicID, "PSID", 4) && strncmp(psidH.magicID, "RSID", 4)) {
-        vfs_fclose(inFile);
         xs_error("Not a PSID or RSID file '%s'\n", filename);
         return -2;
     }
 
-    psidH.version = xs_fread_be16(inFile);
-    psidH.dataOffset = xs_fread_be16(inFile);
-    psidH.loadAddress = xs_fread_be16(inFile);
-    psidH.initAddress = xs_fread_be16(inFile);
-    psidH.playAddress = xs_fread_be16(inFile);
-    psidH.nSongs = xs_fread_be16(inFile);
-    psidH.startSong = xs_fread_be16(inFile);
-    psidH.speed = xs_fread_be32(inFile);
-
-    if (vfs_fread(psidH.sidName, 1, sizeof psidH.sidName, inFile) < sizeof psidH.sidName
-     || vfs_fread(psidH.sidAuthor, 1, sizeof psidH.sidAuthor, inFile) < sizeof psidH.sidAuthor
-     || vfs_fread(psidH.sidCopyright, 1, sizeof psidH.sidCopyright, inFile) < sizeof psidH.sidCopyright) {
-        vfs_fclose(inFile);
+    headerLen = 4 + 8 * 2 + 4 + sizeof psidH.sidName + sizeof psidH.sidAuthor + sizeof psidH.sidCopyright;
+    if (size < headerLen) {
         xs_error("Error reading SID file header from '%s'\n", filename);
         return -4;
     }
 
+    psidH.version = xs_get_be16(data + 4);
+    psidH.dataOffset = xs_get_be16(data + 6);
+    psidH.loadAddress = xs_get_be16(data + 8);
+    psidH.initAddress = xs_get_be16(data + 10);
+    psidH.playAddress = xs_get_be16(data + 12);
+    psidH.nSongs = xs_get_be16(data + 14);
+    psidH.startSong = xs_get_be16(data + 16);
+    psidH.speed = (uint32_t) xs_get_be16(data + 18) << 16 | xs_get_be16(data + 20);
+
     /* Check if we need to load PSIDv2NG header ... */
     psidH2.flags = 0;    /* Just silence a stupid gcc warning */
 
-    if (psidH.version == 2) {
+    if (psidH.version == 2 && size >= headerLen + 6) {
         /* Yes, we need to */
-        psidH2.flags = xs_fread_be16(inFile);
-        psidH2.startPage = vfs_getc(inFile);
-        psidH2.pageLength = vfs_getc(inFile);
-        psidH2.reserved = xs_fread_be16(inFile);
+        psidH2.flags = xs_get_be16(data + headerLen);
+        psidH2.startPage = data[headerLen + 2];
+        psidH2.pageLength = data[headerLen + 3];
+        psidH2.reserved = xs_get_be16(data + headerLen + 4);
+        headerLen += 6;
     }
 
-    /* Allocate buffer */
-    songData = (uint8_t *) malloc(XS_SIDBUF_SIZE * sizeof(uint8_t));
-    if (!songData) {
-        vfs_fclose(inFile);
-        xs_error("Error allocating temp data buffer for file '%s'\n", filename);
-        return -3;
-    }
-
-    /* Read data to buffer */
-    result = vfs_fread(songData, sizeof(uint8_t), XS_SIDBUF_SIZE, inFile);
-    vfs_fclose(inFile);
+    /* The data following the header */
+    songData = data + headerLen;
+    result = MIN(size - headerLen, XS_SIDBUF_SIZE);
 
     /* Initialize and start MD5-hash calculation */
     xs_md5_init(&inState);
 
-    if (psidH.loadAddress == 0) {
+    if (psidH.loadAddress == 0 && result >= 2) {
         /* Strip load address (2 first bytes) */
         xs_md5_append(&inState, &songData[2], result - 2);
     } else {
@@ -457,9 +452,6 @@ static int xs_get_sid_hash(const char *filename, xs_md5hash_t hash)
         xs_md5_append(&inState, songData, result);
     }
 
-    /* Free buffer */
-    free(songData);
-
     /* Append header data to hash */
 #define XSADDHASH(QDATAB) do {                    \
     ib8[0] = (QDATAB & 0xff);                \
@@ -499,28 +491,91 @@ static int xs_get_sid_hash(const char *filename, xs_md5hash_t hash)
 }
 
 
-/* Get node from db index via binary search
+/* Hash given SID-file from its contents, reading them if not given
  */
-sldb_node_t *xs_sldb_get(xs_sldb_t *db, const char *filename)
+static int xs_compute_sid_hash_for(const char *filename, const void *data, int64_t size, xs_md5hash_t hash)
 {
-    sldb_node_t keyItem, *key, **item;
+    void *buf = NULL;
+    int result;
+
+    if (!data) {
+        vfs_file_get_contents(filename, &buf, &size);
+        data = buf;
+    }
+
+    result = data ? xs_compute_sid_hash(filename, (const uint8_t *) data, size, hash) : -1;
+    free(buf);
+
+    return result;
+}
+
+
+/* Get the hash of given SID-file, computing it only if the file is not
+ * local or has changed since it was last hashed; data and size are the
+ * contents of the file if the caller has already read them, or NULL
+ */
+static int xs_get_sid_hash(xs_sldb_t *db, const char *filename, const void *data, int64_t size, xs_md5hash_t hash)
+{
+    struct stat st;
+    sldb_hash_t *item;
+    char *path = NULL;
+    bool_t local;
+
+    if (!strncmp(filename, "file://", 7))
+        path = uri_to_filename(filename);
+
+    local = (path && g_stat(path, &st) == 0);
+    free(path);
+
+    if (!local)
+        return xs_compute_sid_hash_for(filename, data, size, hash);
+
+    if (!db->hashes)
+        db->hashes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    item = g_hash_table_lookup(db->hashes, filename);
+
+    if (!item || item->size != st.st_size ||
+        item->mtime != (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec) {
+        xs_md5hash_t tmpHash;
+
+        if (xs_compute_sid_hash_for(filename, data, size, tmpHash) != 0)
+            return -1;
+
+        item = g_new(sldb_hash_t, 1);
+        item->size = st.st_size;
+        item->mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        memcpy(item->md5Hash, tmpHash, sizeof(xs_md5hash_t));
+
+        g_hash_table_replace(db->hashes, g_strdup(filename), item);
+    }
+
+    memcpy(hash, item->md5Hash, sizeof(xs_md5hash_t));
+    return 0;
+}
+
+
+/* Look up the lengths of given SID-file via binary search, and return their
+ * number, or 0 if it has none in the db; data and size are as above
+ */
+int xs_sldb_get(xs_sldb_t *db, const char *filename, const void *data, int64_t size, const int32_t **lengths)
+{
+    sldb_node_t keyItem, *item;
 
     /* Check the database pointers */
-    if (!db || !db->nodes || !db->pindex)
-        return NULL;
+    if (!db || !db->nodes)
+        return 0;
 
     /* Get the hash and then look up from db */
-    if (xs_get_sid_hash(filename, keyItem.md5Hash) == 0) {
-        key = &keyItem;
-        item = bsearch(&key, db->pindex, db->n,
-            sizeof(db->pindex[0]), xs_sldb_cmp);
-
-        if (item)
-            return *item;
-        else
-            return NULL;
-    } else
-        return NULL;
-}
+    if (xs_get_sid_hash(db, filename, data, size, keyItem.md5Hash) != 0)
+        return 0;
+
+    item = bsearch(&keyItem, db->nodes, db->n, sizeof(sldb_node_t), xs_sldb_cmp);
 
+    /* A cache file could be damaged */
+    if (!item || item->offset > db->nlengths || item->nlengths > db->nlengths - item->offset)
+        return 0;
 
+    *lengths = db->lengths + item->offset;
+    return item->nlengths;
+}
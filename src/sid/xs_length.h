@@ -1,8 +1,11 @@
 #ifndef XS_LENGTH_H
 #define XS_LENGTH_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
+#include <glib.h>
+
 #include "xs_md5.h"
 
 #ifdef __cplusplus
@@ -11,27 +14,27 @@ extern "C" {
 
 /* Types
  */
-typedef struct _sldb_node_t {
+typedef struct {
     xs_md5hash_t    md5Hash;    /* 128-bit MD5 hash-digest */
-    int            nlengths;   /* Number of lengths */
-    int            *lengths;   /* Lengths in seconds */
-    struct _sldb_node_t *prev, *next;
+    uint32_t        offset;     /* Index of the first length */
+    uint32_t        nlengths;   /* Number of lengths */
 } sldb_node_t;
 
 
 typedef struct {
-    sldb_node_t     *nodes,
-                    **pindex;
-    size_t          n;
+    sldb_node_t     *nodes;     /* Sorted by hash */
+    int32_t         *lengths;   /* Lengths in seconds */
+    size_t          n, nlengths;
+    GMappedFile     *map;       /* Cache file holding the above, if mapped */
+    GHashTable      *hashes;    /* Hashes of files looked up, by filename */
 } xs_sldb_t;
 
 
 /* Functions
  */
-int            xs_sldb_read(xs_sldb_t *, const char *);
-int            xs_sldb_index(xs_sldb_t *);
+int             xs_sldb_read(xs_sldb_t *, const char *);
 void            xs_sldb_free(xs_sldb_t *);
-sldb_node_t *   xs_sldb_get(xs_sldb_t *, const char *);
+int             xs_sldb_get(xs_sldb_t *, const char *, const void *, int64_t, const int32_t **);
 
 #ifdef __cplusplus
 }
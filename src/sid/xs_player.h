@@ -16,7 +16,8 @@ typedef struct xs_status_t {
                 isInitialized;
     bool_t stop_flag;
     int        currSong,           /* Current sub-tune */
-                lastTime;
+                lastTime,
+                seekTime;           /* Requested seek in ms, or -1 */
 
     xs_tuneinfo_t *tuneInfo;
 } xs_status_t;
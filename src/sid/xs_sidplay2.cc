@@ -27,8 +27,13 @@
 #include "xs_sidplay2.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#include <glib/gstdio.h>
+#include <libaudcore/audstrings.h>
 
 #include <sidplayfp/sidplayfp.h>
 #include <sidplayfp/SidDatabase.h>
@@ -37,14 +42,37 @@
 #include <sidplayfp/SidTuneInfo.h>
 #include <sidplayfp/builders/residfp.h>
 
+/* How many frames the mixer folds into one while seeking; 32 is the most
+ * sidplayfp allows */
+#define XS_SEEK_SPEED   (32)
+
+/* How many parsed tunes to keep, so that probing a file, getting its
+ * information and loading it for playback read and parse it only once */
+#define XS_TUNE_CACHE   (8)
+
+/* A file read and parsed, shared by whoever holds a reference to it. Only
+ * the tune of the one loaded into the engine ever has a song selected, and
+ * information that does not depend on the selected song is all the others
+ * read, so it can be looked at while playing.
+ */
+typedef struct {
+    char *filename;
+    int64_t size, mtime;    /* Of the file when read, if it is local */
+    void *buf;
+    int64_t bufSize;
+    SidTune *tune;
+    int refs;
+    unsigned used;          /* For replacing the least recently used */
+} xs_tune_entry_t;
+
 class xs_sidplayfp_t {
 public:
     sidplayfp *currEng;
     sidbuilder *currBuilder;
     SidConfig currConfig;
     SidTune *currTune;
-    void *buf;
-    int64_t bufSize;
+    xs_tune_entry_t *currEntry;
+    uint64_t currFrames;    /* Emulated since the song was started */
 
     xs_sidplayfp_t(void);
     virtual ~xs_sidplayfp_t(void) { ; }
@@ -54,10 +82,183 @@ public:
 xs_sidplayfp_t::xs_sidplayfp_t(void)
 :currEng(NULL)
 {
-    buf = NULL;
-    bufSize = 0;
     currTune = NULL;
+    currEntry = NULL;
     currBuilder = NULL;
+    currFrames = 0;
+}
+
+
+/* Recently parsed tunes, guarded by xs_tune_mutex along with the reference
+ * counts of all entries. Only local files are kept, as only they can be
+ * checked for changes.
+ */
+static xs_tune_entry_t *xs_tune_cache[XS_TUNE_CACHE];
+static unsigned xs_tune_clock;
+static pthread_mutex_t xs_tune_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void xs_tune_free(xs_tune_entry_t *entry)
+{
+    delete entry->tune;
+    free(entry->buf);
+    free(entry->filename);
+    delete entry;
+}
+
+
+/* Drop a reference with xs_tune_mutex held; returns the entry if it is no
+ * longer used, for freeing once the lock is released
+ */
+static xs_tune_entry_t *xs_tune_drop(xs_tune_entry_t *entry)
+{
+    return (entry && !--entry->refs) ? entry : NULL;
+}
+
+
+static void xs_tune_unref(xs_tune_entry_t *entry)
+{
+    pthread_mutex_lock(&xs_tune_mutex);
+    entry = xs_tune_drop(entry);
+    pthread_mutex_unlock(&xs_tune_mutex);
+
+    if (entry)
+        xs_tune_free(entry);
+}
+
+
+/* Get the size and mtime of given file, if it is local
+ */
+static bool_t xs_tune_stat(const char *filename, int64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    char *path = NULL;
+    bool_t local;
+
+    if (!strncmp(filename, "file://", 7))
+        path = uri_to_filename(filename);
+
+    local = (path && g_stat(path, &st) == 0);
+    free(path);
+
+    if (local) {
+        *size = st.st_size;
+        *mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    return local;
+}
+
+
+/* Look up an unchanged entry for given file with xs_tune_mutex held, taking
+ * a reference to it; an entry that has changed is taken out of the cache
+ * and returned in *stale
+ */
+static xs_tune_entry_t *xs_tune_find(const char *filename, bool_t local,
+    int64_t size, int64_t mtime, xs_tune_entry_t **stale)
+{
+    for (int i = 0; i < XS_TUNE_CACHE; i++) {
+        xs_tune_entry_t *entry = xs_tune_cache[i];
+        if (!entry || strcmp(entry->filename, filename))
+            continue;
+
+        if (local && entry->size == size && entry->mtime == mtime) {
+            entry->used = ++xs_tune_clock;
+            entry->refs++;
+            return entry;
+        }
+
+        /* Changed since */
+        *stale = xs_tune_drop(entry);
+        xs_tune_cache[i] = NULL;
+    }
+
+    return NULL;
+}
+
+
+/* Get given file read and parsed, from the cache if it is unchanged since,
+ * or NULL if it is not a valid tune; release it with xs_tune_unref(). The
+ * file is read and parsed without the lock held, so that probes of
+ * different files do not wait for each other.
+ */
+static xs_tune_entry_t *xs_tune_ref(const char *filename)
+{
+    xs_tune_entry_t *entry, *found, *stale = NULL;
+    int64_t size = -1, mtime = -1;
+    int i, slot = 0;
+    bool_t local = xs_tune_stat(filename, &size, &mtime);
+
+    pthread_mutex_lock(&xs_tune_mutex);
+    found = xs_tune_find(filename, local, size, mtime, &stale);
+    pthread_mutex_unlock(&xs_tune_mutex);
+
+    if (stale)
+        xs_tune_free(stale);
+    if (found)
+        return found;
+
+    entry = new xs_tune_entry_t();
+    entry->size = size;
+    entry->mtime = mtime;
+    entry->refs = 1;
+
+    vfs_file_get_contents(filename, &entry->buf, &entry->bufSize);
+    if (entry->bufSize)
+        entry->tune = new SidTune((uint8_t *) entry->buf, entry->bufSize);
+
+    if (!entry->tune || !entry->tune->getStatus()) {
+        xs_tune_free(entry);
+        return NULL;
+    }
+
+    entry->filename = strdup(filename);
+
+    if (!local)
+        return entry;
+
+    pthread_mutex_lock(&xs_tune_mutex);
+
+    /* Another thread may have got here first */
+    stale = NULL;
+    if ((found = xs_tune_find(filename, local, size, mtime, &stale))) {
+        pthread_mutex_unlock(&xs_tune_mutex);
+        xs_tune_free(entry);
+        return found;
+    }
+
+    /* Replace an empty or the least recently used slot */
+    for (i = 0; i < XS_TUNE_CACHE; i++) {
+        if (!xs_tune_cache[i]) {
+            slot = i;
+            break;
+        }
+        if (xs_tune_cache[i]->used < xs_tune_cache[slot]->used)
+            slot = i;
+    }
+
+    xs_tune_entry_t *evicted = xs_tune_drop(xs_tune_cache[slot]);
+    xs_tune_cache[slot] = entry;
+    entry->used = ++xs_tune_clock;
+    entry->refs++;
+
+    pthread_mutex_unlock(&xs_tune_mutex);
+
+    if (stale)
+        xs_tune_free(stale);
+    if (evicted)
+        xs_tune_free(evicted);
+
+    return entry;
+}
+
+
+static void xs_tune_cache_clear(void)
+{
+    for (int i = 0; i < XS_TUNE_CACHE; i++) {
+        xs_tune_unref(xs_tune_cache[i]);
+        xs_tune_cache[i] = NULL;
+    }
 }
 
 
@@ -168,13 +369,6 @@ bool_t xs_sidplayfp_init(xs_status_t * status)
         return FALSE;
     }
 
-    /* Create the sidtune */
-    engine->currTune = new SidTune(0);
-    if (!engine->currTune) {
-        xs_error("[SIDPlayFP] Could not initialize SIDTune object.\n");
-        return FALSE;
-    }
-
     return TRUE;
 }
 
@@ -199,12 +393,8 @@ void xs_sidplayfp_close(xs_status_t * status)
         engine->currEng = NULL;
     }
 
-    if (engine->currTune) {
-        delete engine->currTune;
-        engine->currTune = NULL;
-    }
-
     xs_sidplayfp_delete(status);
+    xs_tune_cache_clear();
 
     delete engine;
     status->sidEngine = NULL;
@@ -221,6 +411,15 @@ bool_t xs_sidplayfp_initsong(xs_status_t * status)
     engine = (xs_sidplayfp_t *) status->sidEngine;
     if (engine == NULL) return FALSE;
 
+    /* The rate may differ from one song to the next */
+    if (engine->currConfig.frequency != (unsigned) status->audioFrequency) {
+        engine->currConfig.frequency = status->audioFrequency;
+        if (engine->currEng->config(engine->currConfig) < 0) {
+            xs_error("[SIDPlayFP] Emulator engine configuration failed!\n");
+            return FALSE;
+        }
+    }
+
     if (!engine->currTune->selectSong(status->currSong)) {
         xs_error("[SIDPlayFP] currTune->selectSong() failed\n");
         return FALSE;
@@ -231,6 +430,7 @@ bool_t xs_sidplayfp_initsong(xs_status_t * status)
         return FALSE;
     }
 
+    engine->currFrames = 0;
     status->isInitialized = TRUE;
 
     return TRUE;
@@ -247,7 +447,59 @@ unsigned xs_sidplayfp_fillbuffer(xs_status_t * status, char * audioBuffer, unsig
     engine = (xs_sidplayfp_t *) status->sidEngine;
     if (!engine) return 0;
 
-    return engine->currEng->play((short *)audioBuffer, audioBufSize / 2) * 2;
+    unsigned samples = engine->currEng->play((short *)audioBuffer, audioBufSize / 2);
+    engine->currFrames += samples / status->audioChannels;
+
+    return samples * 2;
+}
+
+
+/* Emulate up to given time without output, restarting the song first if
+ * it is already past it. Returns the time reached in milliseconds.
+ */
+int xs_sidplayfp_seek(xs_status_t * status, int time)
+{
+    xs_sidplayfp_t *engine;
+    uint64_t target;
+    short scratch[4096];
+    assert(status != NULL);
+
+    engine = (xs_sidplayfp_t *) status->sidEngine;
+    if (!engine) return -1;
+
+    target = (uint64_t) time * status->audioFrequency / 1000;
+
+    if (target < engine->currFrames && !xs_sidplayfp_initsong(status))
+        return -1;
+
+    /* The chips still have to be clocked all the way, but the resampling
+     * and mixing only run for one frame in XS_SEEK_SPEED */
+    engine->currEng->fastForward(100 * XS_SEEK_SPEED);
+
+    while (engine->currFrames < target) {
+        uint64_t left = target - engine->currFrames;
+        unsigned frames = sizeof scratch / sizeof scratch[0] / status->audioChannels;
+        unsigned speed = XS_SEEK_SPEED;
+        unsigned samples;
+
+        /* Finish at normal speed, so as to land on the exact frame */
+        if (left < (uint64_t) frames * XS_SEEK_SPEED) {
+            engine->currEng->fastForward(100);
+            speed = 1;
+            if (left < frames)
+                frames = left;
+        }
+
+        samples = engine->currEng->play(scratch, frames * status->audioChannels);
+        if (!samples)
+            break;
+
+        engine->currFrames += (uint64_t) samples / status->audioChannels * speed;
+    }
+
+    engine->currEng->fastForward(100);
+
+    return engine->currFrames * 1000 / status->audioFrequency;
 }
 
 
@@ -296,17 +548,15 @@ bool_t xs_sidplayfp_load(xs_status_t * status, const char * pcFilename)
         loaded_roms = 1;
     }
 
-    /* Try to get the tune */
-    vfs_file_get_contents(pcFilename, &engine->buf, &engine->bufSize);
-    if(!engine->bufSize) {
-        free(engine->buf);
-        engine->buf = NULL;
+    /* Try to get the tune, usually parsed already for its information */
+    xs_sidplayfp_delete(status);
+
+    if (!(engine->currEntry = xs_tune_ref(pcFilename)))
         return FALSE;
-    }
 
-    engine->currTune->read((uint8_t*)engine->buf, engine->bufSize);
+    engine->currTune = engine->currEntry->tune;
 
-    return engine->currTune->getStatus();
+    return TRUE;
 }
 
 
@@ -320,49 +570,52 @@ void xs_sidplayfp_delete(xs_status_t * status)
     engine = (xs_sidplayfp_t *) status->sidEngine;
     if (engine == NULL) return;
 
-    free(engine->buf);
-    engine->buf = NULL;
-    engine->bufSize = 0;
+    /* The engine keeps pointing to the tune it was loaded with */
+    if (engine->currEntry && engine->currEng)
+        engine->currEng->load(NULL);
+
+    xs_tune_unref(engine->currEntry);
+    engine->currEntry = NULL;
+    engine->currTune = NULL;
 }
 
 
+/* Get information on given file, without the engine; any number of threads
+ * may call this at once, also while a tune is playing
+ */
 xs_tuneinfo_t* xs_sidplayfp_getinfo(const char *sidFilename)
 {
-    /* This is safe, since xmms-sid.c always calls us with xs_status locked */
+    /* The database, and the MD5 buffer of the tune, are used one at a time */
+    static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
     static int got_db = -1;
     static SidDatabase database;
 
     xs_tuneinfo_t *result;
     const SidTuneInfo *myInfo;
+    xs_tune_entry_t *entry;
     SidTune *myTune;
-    void *buf = NULL;
-    int64_t bufSize = 0;
-
-    /* Load file */
-    vfs_file_get_contents(sidFilename, &buf, &bufSize);
 
     /* Check if the tune exists and is readable */
-    if (!bufSize || !(myTune = new SidTune((uint8_t*)buf, bufSize))) {
-        free(buf);
-        return NULL;
-    }
-    free(buf);
-
-    if (!myTune->getStatus()) {
-        delete myTune;
+    if (!(entry = xs_tune_ref(sidFilename)))
         return NULL;
-    }
 
     /* Get general tune information */
+    myTune = entry->tune;
     myInfo = myTune->getInfo();
 
-    /* Allocate tuneinfo structure and set information */
-    result = xs_tuneinfo_new(sidFilename,
+    /* Allocate tuneinfo structure and set information, looking up the
+     * lengths of all subtunes from the contents already read */
+    result = xs_tuneinfo_new(sidFilename, entry->buf, entry->bufSize,
         myInfo->songs(), myInfo->startSong(),
         myInfo->infoString(0), myInfo->infoString(1), myInfo->infoString(2),
         myInfo->loadAddr(), myInfo->initAddr(), myInfo->playAddr(),
         myInfo->dataFileLen(), myInfo->formatString(), myInfo->sidModel1());
 
+    /* Hashed only once for all subtunes, if any are missing */
+    const char *md5 = NULL;
+
+    pthread_mutex_lock(&db_mutex);
+
     for (int i = 0; i < result->nsubTunes; i++) {
         if (result->subTunes[i].tuneLength >= 0)
             continue;
@@ -370,13 +623,18 @@ xs_tuneinfo_t* xs_sidplayfp_getinfo(const char *sidFilename)
         if (got_db == -1)
             got_db = database.open(SIDDATADIR "sidplayfp/Songlengths.txt");
 
-        if (got_db) {
-            myTune->selectSong(i + 1);
-            result->subTunes[i].tuneLength = database.length(*myTune);
-        }
+        if (!got_db)
+            break;
+
+        if (!md5 && !(md5 = myTune->createMD5()))
+            break;
+
+        result->subTunes[i].tuneLength = database.length(md5, i + 1);
     }
 
-    delete myTune;
+    pthread_mutex_unlock(&db_mutex);
+
+    xs_tune_unref(entry);
 
     return result;
 }
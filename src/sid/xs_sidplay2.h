@@ -14,6 +14,7 @@ void        xs_sidplayfp_close(xs_status_t *);
 bool_t    xs_sidplayfp_init(xs_status_t *);
 bool_t    xs_sidplayfp_initsong(xs_status_t *);
 unsigned        xs_sidplayfp_fillbuffer(xs_status_t *, char *, unsigned);
+int        xs_sidplayfp_seek(xs_status_t *, int);
 bool_t    xs_sidplayfp_load(xs_status_t *, const char *);
 void        xs_sidplayfp_delete(xs_status_t *);
 xs_tuneinfo_t*    xs_sidplayfp_getinfo(const char *);
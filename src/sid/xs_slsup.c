@@ -28,6 +28,7 @@
 #include <string.h>
 
 #include "xs_config.h"
+#include "../warmup/warmup.h"
 
 
 static xs_sldb_t *xs_sldb_db = NULL;
@@ -37,6 +38,35 @@ static xs_stildb_t *xs_stildb_db = NULL;
 pthread_mutex_t xs_stildb_db_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
+/* The databases take a while to parse and are needed only once a SID file
+ * turns up, so they are loaded in the background after init (see warmup.h).
+ */
+static void xs_databases_load(void)
+{
+    if (xs_cfg.songlenDBEnable && (xs_songlen_init() != 0)) {
+        xs_error("Error initializing song-length database!\n");
+    }
+
+    if (xs_cfg.stilDBEnable && (xs_stil_init() != 0)) {
+        xs_error("Error initializing STIL database!\n");
+    }
+}
+
+static Warmup xs_databases = WARMUP_INIT("SID Player", xs_databases_load);
+
+void xs_databases_start(int64_t init_begin)
+{
+    warmup_start(&xs_databases, init_begin);
+}
+
+void xs_databases_close(void)
+{
+    warmup_stop(&xs_databases);
+    xs_songlen_close();
+    xs_stil_close();
+}
+
+
 /* STIL-database handling
  */
 int xs_stil_init(void)
@@ -100,6 +130,8 @@ stil_node_t *xs_stil_get(char *filename)
     stil_node_t *result;
     char *tmpFilename;
 
+    warmup_wait(&xs_databases);
+
     pthread_mutex_lock(&xs_stildb_db_mutex);
     pthread_mutex_lock(&xs_cfg_mutex);
 
@@ -164,15 +196,6 @@ int xs_songlen_init(void)
         return -3;
     }
 
-    /* Create index */
-    if (xs_sldb_index(xs_sldb_db) != 0) {
-        xs_sldb_free(xs_sldb_db);
-        xs_sldb_db = NULL;
-        pthread_mutex_unlock(&xs_cfg_mutex);
-        pthread_mutex_unlock(&xs_sldb_db_mutex);
-        return -4;
-    }
-
     pthread_mutex_unlock(&xs_cfg_mutex);
     pthread_mutex_unlock(&xs_sldb_db_mutex);
     return 0;
@@ -188,16 +211,26 @@ void xs_songlen_close(void)
 }
 
 
-sldb_node_t *xs_songlen_get(const char * filename)
+/* Copy up to max lengths of given file into lengths, returning the number
+ * copied; they are copied here as the database may be reloaded meanwhile.
+ * The contents of the file may be given in data, to avoid reading it again.
+ */
+int xs_songlen_get(const char * filename, const void *data, int64_t size, int32_t *lengths, int max)
 {
-    sldb_node_t *result;
+    const int32_t *found;
+    int result = 0;
+
+    warmup_wait(&xs_databases);
 
     pthread_mutex_lock(&xs_sldb_db_mutex);
 
     if (xs_cfg.songlenDBEnable && xs_sldb_db)
-        result = xs_sldb_get(xs_sldb_db, filename);
-    else
-        result = NULL;
+        result = xs_sldb_get(xs_sldb_db, filename, data, size, &found);
+
+    if (result > max)
+        result = max;
+    if (result > 0)
+        memcpy(lengths, found, result * sizeof(int32_t));
 
     pthread_mutex_unlock(&xs_sldb_db_mutex);
 
@@ -205,17 +238,18 @@ sldb_node_t *xs_songlen_get(const char * filename)
 }
 
 
-/* Allocate a new tune information structure
+/* Allocate a new tune information structure; data and size are the
+ * contents of the file, or NULL
  */
 xs_tuneinfo_t *xs_tuneinfo_new(const char * filename,
-        int nsubTunes, int startTune, const char * sidName,
+        const void *data, int64_t size, int nsubTunes, int startTune, const char * sidName,
         const char * sidComposer, const char * sidCopyright,
         int loadAddr, int initAddr, int playAddr,
         int dataFileLen, const char *sidFormat, int sidModel)
 {
     xs_tuneinfo_t *result;
-    sldb_node_t *tmpLength;
-    int i;
+    int32_t *tmpLengths;
+    int i, nlengths;
 
     /* Allocate structure */
     result = (xs_tuneinfo_t *) g_malloc0(sizeof(xs_tuneinfo_t));
@@ -260,19 +294,22 @@ xs_tuneinfo_t *xs_tuneinfo_new(const char * filename,
 
     result->sidModel = sidModel;
 
-    /* Get length information (NOTE: Do not free this!) */
-    tmpLength = xs_songlen_get(filename);
+    /* Get length information */
+    tmpLengths = g_new(int32_t, nsubTunes + 1);
+    nlengths = xs_songlen_get(filename, data, size, tmpLengths, nsubTunes);
 
     /* Fill in sub-tune information */
     for (i = 0; i < result->nsubTunes; i++) {
-        if (tmpLength && (i < tmpLength->nlengths))
-            result->subTunes[i].tuneLength = tmpLength->lengths[i];
+        if (i < nlengths)
+            result->subTunes[i].tuneLength = tmpLengths[i];
         else
             result->subTunes[i].tuneLength = -1;
 
         result->subTunes[i].tuneSpeed = -1;
     }
 
+    g_free(tmpLengths);
+
     return result;
 }
 
@@ -9,15 +9,20 @@
 extern "C" {
 #endif
 
+void xs_databases_start(int64_t init_begin);
+void xs_databases_close(void);
+
 int xs_stil_init(void);
 void xs_stil_close(void);
 stil_node_t *xs_stil_get(char *filename);
 
 int xs_songlen_init(void);
 void xs_songlen_close(void);
-sldb_node_t *xs_songlen_get(const char *filename);
+int xs_songlen_get(const char *filename, const void *data, int64_t size,
+ int32_t *lengths, int max);
 
-xs_tuneinfo_t *xs_tuneinfo_new(const char *pcFilename, int nsubTunes,
+xs_tuneinfo_t *xs_tuneinfo_new(const char *pcFilename, const void *data,
+ int64_t size, int nsubTunes,
  int startTune, const char *sidName, const char *sidComposer,
  const char *sidCopyright, int loadAddr, int initAddr, int playAddr,
  int dataFileLen, const char *sidFormat, int sidModel);
@@ -125,28 +125,6 @@ static stil_node_t *xs_stildb_node_new(char *filename)
 }
 
 
-/* Insert given node to db linked list
- */
-static void xs_stildb_node_insert(xs_stildb_t *db, stil_node_t *node)
-{
-    assert(db != NULL);
-
-    if (db->nodes != NULL) {
-        /* The first node's pPrev points to last node */
-        node->prev = db->nodes->prev;    /* New node's prev = Previous last node */
-        db->nodes->prev->next = node;    /* Previous last node's next = New node */
-        db->nodes->prev = node;    /* New last node = New node */
-        node->next = NULL;    /* But next is NULL! */
-    } else {
-        db->nodes = node;    /* First node ... */
-        node->prev = node;    /* ... it's also last */
-        node->next = NULL;    /* But next is NULL! */
-    }
-}
-
-
-/* Read database (additively) to given db-structure
- */
 #define XS_STILDB_MULTI                                         \
     if (multi) {                                                \
         multi = FALSE;                                          \
@@ -164,31 +142,26 @@ static void XS_STILDB_ERR(int linenum, char *line, const char *fmt, ...)
     xs_error("#%d: '%s'\n", linenum, line);
 }
 
-int xs_stildb_read(xs_stildb_t *db, char *filename)
+/* Parse one STIL entry, starting from its filename line
+ */
+static stil_node_t *xs_stildb_read_entry(FILE *f, int lineNum)
 {
-    FILE *f;
     char line[XS_BUF_SIZE + 16];    /* Since we add some chars here and there */
     stil_node_t *node;
     bool_t error, multi;
-    int lineNum, subEntry;
+    int subEntry;
     char *tmpLine = line;
-    assert(db != NULL);
-
-    /* Try to open the file */
-    if ((f = fopen(filename, "r")) == NULL) {
-        xs_error("Could not open STILDB '%s'\n", filename);
-        return -1;
-    }
 
     /* Read and parse the data */
-    lineNum = 0;
     error = FALSE;
     multi = FALSE;
     node = NULL;
     subEntry = 0;
+    lineNum--;
 
     while (!error && fgets(line, XS_BUF_SIZE, f) != NULL) {
         size_t linePos = 0, eolPos = 0;
+        bool_t done = FALSE;
         line[XS_BUF_SIZE] = 0;
         xs_findeol(line, &eolPos);
         line[eolPos] = 0;
@@ -199,17 +172,15 @@ int xs_stildb_read(xs_stildb_t *db, char *filename)
         switch (tmpLine[0]) {
         case '/':
             /* Check if we are already parsing entry */
-            multi = FALSE;
             if (node != NULL) {
                 XS_STILDB_ERR(lineNum, tmpLine,
                     "New entry found before end of current ('%s')!\n",
                     node->filename);
-                xs_stildb_node_free(node);
-                node = NULL;
+                error = TRUE;
+                break;
             }
 
             /* A new node */
-            subEntry = 0;
             if ((node = xs_stildb_node_new(tmpLine)) == NULL) {
                 XS_STILDB_ERR(lineNum, tmpLine,
                     "Could not allocate new STILdb-node!\n");
@@ -255,11 +226,7 @@ int xs_stildb_read(xs_stildb_t *db, char *filename)
         case '\n':
         case '\r':
             /* End of entry/field */
-            multi = FALSE;
-            if (node != NULL) {
-                xs_stildb_node_insert(db, node);
-                node = NULL;
-            }
+            done = TRUE;
             break;
 
         default:
@@ -269,6 +236,7 @@ int xs_stildb_read(xs_stildb_t *db, char *filename)
             if (node == NULL) {
                 XS_STILDB_ERR(lineNum, tmpLine,
                     "Entry data encountered outside of entry or syntax error!\n");
+                done = TRUE;
                 break;
             }
 
@@ -314,69 +282,100 @@ int xs_stildb_read(xs_stildb_t *db, char *filename)
             break;
         }
         free(tmpLine);
+
+        if (done)
+            break;
     } /* while */
 
-    /* Check if there is one remaining node */
-    if (node != NULL)
-        xs_stildb_node_insert(db, node);
+    if (error) {
+        xs_stildb_node_free(node);
+        node = NULL;
+    }
+
+    return node;
+}
+
+
+/* Index the entries of given STIL file; they are parsed on first lookup
+ */
+int xs_stildb_read(xs_stildb_t *db, char *filename)
+{
+    FILE *f;
+    char line[XS_BUF_SIZE + 16];
+    GArray *index;
+    stil_index_t entry;
+    int lineNum;
+    long offset;
+    bool_t lineStart;
+    assert(db != NULL);
+
+    /* Try to open the file */
+    if ((f = fopen(filename, "r")) == NULL) {
+        xs_error("Could not open STILDB '%s'\n", filename);
+        return -1;
+    }
+
+    index = g_array_new(FALSE, FALSE, sizeof(stil_index_t));
+    memset(&entry, 0, sizeof(entry));
+
+    /* Only the filename lines are looked at here.  fgets() may split an
+     * overlong line, so track whether each piece starts a line. */
+    lineNum = 0;
+    lineStart = TRUE;
+    offset = 0;
+
+    while (fgets(line, XS_BUF_SIZE, f) != NULL) {
+        size_t eolPos = 0, len = strlen(line);
+        bool_t isStart = lineStart;
+
+        xs_findeol(line, &eolPos);
+        lineStart = (line[eolPos] != 0);
+
+        if (isStart) {
+            lineNum++;
+
+            if (line[0] == '/') {
+                line[eolPos] = 0;
+                entry.filename = g_convert(line, -1, "UTF-8", XS_STIL_CHARSET, NULL, NULL, NULL);
+                entry.offset = offset;
+                entry.lineNum = lineNum;
+
+                if (entry.filename)
+                    g_array_append_val(index, entry);
+            }
+        }
+
+        offset += len;
+    }
 
     /* Close the file */
     fclose(f);
 
+    db->filename = strdup(filename);
+    db->n = index->len;
+    db->index = (stil_index_t *) g_array_free(index, FALSE);
+
     return 0;
 }
 
 
-/* Compare two nodes
+/* Compare two index entries
  */
-static int xs_stildb_cmp(const void *node1, const void *node2)
+static int xs_stildb_cmp(const void *entry1, const void *entry2)
 {
     /* We assume here that we never ever get NULL-pointers or similar */
     return strcmp(
-        (*(stil_node_t **) node1)->filename,
-        (*(stil_node_t **) node2)->filename);
+        ((const stil_index_t *) entry1)->filename,
+        ((const stil_index_t *) entry2)->filename);
 }
 
 
-/* (Re)create index
+/* Sort the index for binary search
  */
 int xs_stildb_index(xs_stildb_t *db)
 {
-    stil_node_t *curr;
-    size_t i;
-
-    /* Free old index */
-    if (db->pindex) {
-        free(db->pindex);
-        db->pindex = NULL;
-    }
-
-    /* Get size of db */
-    curr = db->nodes;
-    db->n = 0;
-    while (curr) {
-        db->n++;
-        curr = curr->next;
-    }
-
-    /* Check number of nodes */
-    if (db->n > 0) {
-        /* Allocate memory for index-table */
-        db->pindex = (stil_node_t **) malloc(sizeof(stil_node_t *) * db->n);
-        if (!db->pindex)
-            return -1;
-
-        /* Get node-pointers to table */
-        i = 0;
-        curr = db->nodes;
-        while (curr && (i < db->n)) {
-            db->pindex[i++] = curr;
-            curr = curr->next;
-        }
-
-        /* Sort the indexes */
-        qsort(db->pindex, db->n, sizeof(stil_node_t *), xs_stildb_cmp);
-    }
+    if (db->n > 0)
+        qsort(db->index, db->n, sizeof(stil_index_t), xs_stildb_cmp);
 
     return 0;
 }
@@ -386,49 +385,55 @@ int xs_stildb_index(xs_stildb_t *db)
  */
 void xs_stildb_free(xs_stildb_t *db)
 {
-    stil_node_t *curr, *next;
+    size_t i;
 
     if (!db)
         return;
 
-    /* Free the memory allocated for nodes */
-    curr = db->nodes;
-    while (curr) {
-        next = curr->next;
-        xs_stildb_node_free(curr);
-        curr = next;
+    /* Free the index and the nodes parsed so far */
+    for (i = 0; i < db->n; i++) {
+        g_free(db->index[i].filename);
+        xs_stildb_node_free(db->index[i].node);
     }
 
-    db->nodes = NULL;
-
-    /* Free memory allocated for index */
-    if (db->pindex) {
-        free(db->pindex);
-        db->pindex = NULL;
-    }
+    g_free(db->index);
+    free(db->filename);
 
     /* Free structure */
-    db->n = 0;
     free(db);
 }
 
 
-/* Get STIL information node from database
+/* Get STIL information node from database, parsing it if not done yet
  */
 stil_node_t *xs_stildb_get_node(xs_stildb_t *db, char *filename)
 {
-    stil_node_t keyItem, *key, **item;
+    stil_index_t keyItem, *item;
+    FILE *f;
 
     /* Check the database pointers */
-    if (!db || !db->nodes || !db->pindex)
+    if (!db || !db->index)
         return NULL;
 
     /* Look-up index using binary search */
     keyItem.filename = filename;
-    key = &keyItem;
-    item = bsearch(&key, db->pindex, db->n, sizeof(stil_node_t *), xs_stildb_cmp);
-    if (item)
-        return *item;
-    else
+    item = bsearch(&keyItem, db->index, db->n, sizeof(stil_index_t), xs_stildb_cmp);
+    if (!item)
         return NULL;
+
+    if (!item->parsed) {
+        item->parsed = TRUE;
+
+        if ((f = fopen(db->filename, "r")) == NULL) {
+            xs_error("Could not open STILDB '%s'\n", db->filename);
+            return NULL;
+        }
+
+        if (fseek(f, item->offset, SEEK_SET) == 0)
+            item->node = xs_stildb_read_entry(f, item->lineNum);
+
+        fclose(f);
+    }
+
+    return item->node;
 }
@@ -14,16 +14,25 @@ typedef struct {
 } stil_subnode_t;
 
 
-typedef struct _stil_node_t {
+typedef struct {
     char *filename;
     int nsubTunes;
     stil_subnode_t **subTunes;
-    struct _stil_node_t *prev, *next;
 } stil_node_t;
 
 
 typedef struct {
-    stil_node_t *nodes, **pindex;
+    char *filename;
+    long offset;            /* Of the filename line in the STIL file */
+    int lineNum;
+    int parsed;             /* Set once node has been parsed (or failed to) */
+    stil_node_t *node;
+} stil_index_t;
+
+
+typedef struct {
+    char *filename;         /* Re-read for each entry looked up */
+    stil_index_t *index;    /* Sorted by filename */
     size_t n;
 } xs_stildb_t;
 
@@ -32,6 +32,8 @@
 #include "ui_skinned_playstatus.h"
 #include "ui_vis.h"
 #include "util.h"
+#include "../visbands/visbands.h"
+#include "../vislimit/vislimit.h"
 
 static void title_change (void)
 {
@@ -196,51 +198,20 @@ static void render_multi_pcm (const gfloat * pcm, gint channels)
 static void make_log_graph (const gfloat * freq, gint bands, gint db_range, gint
  int_range, guchar * graph)
 {
-    static gint last_bands = 0;
-    static gfloat * xscale = NULL;
+    static VisBands * vb = NULL;
+    gfloat levels[256];
 
-    /* conversion table for the x-axis */
-    if (bands != last_bands)
+    /* the bin table depends only on the number of bands */
+    if (! vb || visbands_count (vb) != bands)
     {
-        xscale = g_realloc (xscale, sizeof (gfloat) * (bands + 1));
-        for (int i = 0; i <= bands; i ++)
-            xscale[i] = powf (256, (float) i / bands) - 0.5f;
-
-        last_bands = bands;
+        visbands_free (vb);
+        vb = visbands_new (bands);
     }
 
-    for (gint i = 0; i < bands; i ++)
-    {
-        /* sum up values in freq array between xscale[i] and xscale[i + 1],
-           including fractional parts */
-        gint a = ceilf (xscale[i]);
-        gint b = floorf (xscale[i + 1]);
-        gfloat sum = 0;
-
-        if (b < a)
-            sum += freq[b] * (xscale[i + 1] - xscale[i]);
-        else
-        {
-            if (a > 0)
-                sum += freq[a - 1] * (a - xscale[i]);
-            for (; a < b; a ++)
-                sum += freq[a];
-            if (b < 256)
-                sum += freq[b] * (xscale[i + 1] - b);
-        }
-
-        /* fudge factor to make the graph have the same overall height as a
-           12-band one no matter how many bands there are */
-        sum *= (gfloat) bands / 12;
-
-        /* convert to dB */
-        gfloat val = 20 * log10f (sum);
+    visbands_compute (vb, freq, db_range, levels);
 
-        /* scale (-db_range, 0.0) to (0.0, int_range) */
-        val = (1 + val / db_range) * int_range;
-
-        graph[i] = CLAMP (val, 0, int_range);
-    }
+    for (gint i = 0; i < bands; i ++)
+        graph[i] = levels[i] * int_range;
 }
 
 static void render_freq (const gfloat * freq)
@@ -275,9 +246,17 @@ static void render_freq (const gfloat * freq)
         ui_vis_timeout_func (mainwin_vis, data);
 }
 
+/* stop the analysis while the player window is minimized or out of sight */
+static void mainwin_visible_cb (gboolean visible)
+{
+    start_stop_visual (FALSE);
+}
+
 void
 ui_main_evlistener_init(void)
 {
+    vislimit_attach (mainwin, (VisLimitFunc) mainwin_visible_cb, NULL);
+
     hook_associate("hide seekbar", ui_main_evlistener_hide_seekbar, NULL);
     hook_associate("playback begin", ui_main_evlistener_playback_begin, NULL);
     hook_associate("playback ready", ui_main_evlistener_playback_begin, NULL);
@@ -319,7 +298,7 @@ void start_stop_visual (gboolean exiting)
 {
     static char started = 0;
 
-    if (config.vis_type != VIS_OFF && ! exiting && gtk_widget_get_visible (mainwin))
+    if (config.vis_type != VIS_OFF && ! exiting && vislimit_visible (mainwin))
     {
         if (! started)
         {
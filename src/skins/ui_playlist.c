@@ -787,9 +787,21 @@ static void update_cb (void * unused, void * another)
 
     if (active_playlist != old)
     {
+        ui_skinned_playlist_invalidate (playlistwin_list, 0, -1);
         ui_skinned_playlist_scroll_to (playlistwin_list, 0);
         song_changed = TRUE;
     }
+    else
+    {
+        gint at, count;
+        gint level = aud_playlist_updated_range (active_playlist, & at, & count);
+
+        /* a structure change moves every entry after the first one touched */
+        if (level == PLAYLIST_UPDATE_STRUCTURE)
+            ui_skinned_playlist_invalidate (playlistwin_list, at, -1);
+        else if (level == PLAYLIST_UPDATE_METADATA)
+            ui_skinned_playlist_invalidate (playlistwin_list, at, count);
+    }
 
     if (song_changed)
     {
@@ -42,6 +42,7 @@
 #include "ui_main.h"
 #include "ui_playlist.h"
 #include "ui_skin.h"
+#include "ui_skinned_equalizer_graph.h"
 #include "ui_skinned_number.h"
 #include "ui_skinned_playstatus.h"
 #include "ui_skinned_textbox.h"
@@ -168,6 +169,7 @@ gboolean active_skin_load (const gchar * path)
 
     mainwin_refresh_hints ();
     textbox_update_all ();
+    eq_graph_update_skin ();
     ui_vis_set_colors ();
     gtk_widget_queue_draw (mainwin);
     gtk_widget_queue_draw (equalizerwin);
@@ -231,6 +233,107 @@ skin_destroy(Skin * skin)
     g_free(skin);
 }
 
+/* Recently used skin archives are kept decoded, so that going back to one
+ * (as when trying out skins in the selector) needs no extraction and no image
+ * loading.  Entries are matched by path, size and modification time. */
+
+#define SKIN_CACHE_SIZE 4
+
+typedef struct {
+    Skin skin;
+    gint64 size, mtime;
+} CachedSkin;
+
+static GQueue skin_cache = G_QUEUE_INIT; /* of CachedSkin *, newest first */
+
+static gboolean skin_stat (const gchar * path, gint64 * size, gint64 * mtime)
+{
+    struct stat info;
+
+    if (stat (path, & info) < 0)
+        return FALSE;
+
+    * size = info.st_size;
+    * mtime = info.st_mtime;
+    return TRUE;
+}
+
+/* Moves the contents of skin into the cache (or frees them), leaving skin
+ * empty. */
+static void skin_cache_put (Skin * skin)
+{
+    gint64 size, mtime;
+
+    if (! skin->path || ! file_is_archive (skin->path) || ! skin_stat
+     (skin->path, & size, & mtime))
+    {
+        skin_free (skin);
+        return;
+    }
+
+    CachedSkin * cached = g_slice_new (CachedSkin);
+    cached->skin = * skin;
+    cached->size = size;
+    cached->mtime = mtime;
+    g_queue_push_head (& skin_cache, cached);
+
+    memset (skin, 0, sizeof (Skin));
+
+    while (g_queue_get_length (& skin_cache) > SKIN_CACHE_SIZE)
+    {
+        cached = g_queue_pop_tail (& skin_cache);
+        skin_free (& cached->skin);
+        g_slice_free (CachedSkin, cached);
+    }
+}
+
+/* Replaces the contents of skin with a cached copy of path, if there is one. */
+static gboolean skin_cache_take (Skin * skin, const gchar * path)
+{
+    gint64 size, mtime;
+
+    if (! skin_stat (path, & size, & mtime))
+        return FALSE;
+
+    for (GList * node = skin_cache.head; node; node = node->next)
+    {
+        CachedSkin * cached = node->data;
+
+        if (strcmp (cached->skin.path, path))
+            continue;
+
+        g_queue_delete_link (& skin_cache, node);
+
+        if (cached->size != size || cached->mtime != mtime)
+        {
+            skin_free (& cached->skin);
+            g_slice_free (CachedSkin, cached);
+            return FALSE;
+        }
+
+        skin_cache_put (skin);
+        * skin = cached->skin;
+        g_slice_free (CachedSkin, cached);
+
+        skin_mask_info[0].width = skin->properties.mainwin_width;
+        skin_mask_info[0].height = skin->properties.mainwin_height;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void skin_cache_clear (void)
+{
+    CachedSkin * cached;
+
+    while ((cached = g_queue_pop_head (& skin_cache)))
+    {
+        skin_free (& cached->skin);
+        g_slice_free (CachedSkin, cached);
+    }
+}
+
 static const SkinPixmapIdMapping *
 skin_pixmap_id_lookup(guint id)
 {
@@ -442,6 +545,8 @@ void cleanup_skins()
 {
     skin_destroy(active_skin);
     active_skin = NULL;
+    skin_cache_clear ();
+    pl_frame_free ();
 
     gtk_widget_destroy (mainwin);
     mainwin = NULL;
@@ -859,6 +964,12 @@ skin_load_nolock(Skin * skin, const gchar * path, gboolean force)
         return FALSE;
     }
 
+    if (file_is_archive(path) && skin_cache_take(skin, path)) {
+        AUDDBG("Using cached copy of %s\n", path);
+        skin_current_num++;
+        goto LOADED;
+    }
+
     if (file_is_archive(path)) {
         AUDDBG("Attempt to load archive\n");
         if (!(skin_path = archive_decompress(path))) {
@@ -881,7 +992,7 @@ skin_load_nolock(Skin * skin, const gchar * path, gboolean force)
     // skin_free() frees skin->path and variable path can actually be skin->path
     // and we want to get the path before possibly freeing it.
     newpath = g_strdup(path);
-    skin_free(skin);
+    skin_cache_put(skin);
     skin->path = newpath;
 
     memset(&(skin->properties), 0, sizeof(SkinProperties)); /* do it only if all tests above passed! --asphyx */
@@ -901,6 +1012,7 @@ skin_load_nolock(Skin * skin, const gchar * path, gboolean force)
     if(archive) del_directory(skin_path);
     g_free(skin_path);
 
+LOADED:
     mainwin_set_shape ();
     equalizerwin_set_shape ();
 
@@ -1124,15 +1236,16 @@ static void skin_draw_playlistwin_frame_sides (cairo_t * cr, gint width, gint
     }
 }
 
-void skin_draw_playlistwin_frame (cairo_t * cr, gint width, gint height,
- gboolean focus)
+static void skin_draw_playlistwin_frame_pieces (cairo_t * cr, gint width, gint
+ height, gboolean focus)
 {
     skin_draw_playlistwin_frame_top (cr, width, height, focus);
     skin_draw_playlistwin_frame_bottom (cr, width, height, focus);
     skin_draw_playlistwin_frame_sides (cr, width, height, focus);
 }
 
-void skin_draw_playlistwin_shaded (cairo_t * cr, gint width, gboolean focus)
+static void skin_draw_playlistwin_shaded_pieces (cairo_t * cr, gint width,
+ gint height, gboolean focus)
 {
     /* The shade mode titlebar skin consists of 4 images:
      * a) left corner               offset (72,42) size (25,14)
@@ -1155,6 +1268,66 @@ void skin_draw_playlistwin_shaded (cairo_t * cr, gint width, gboolean focus)
      14);
 }
 
+/* The playlist frame is tiled together from dozens of small pieces, so it is
+ * composed once for each size and skin and then painted in a single step. */
+
+typedef void (* FrameDrawFunc) (cairo_t * cr, gint width, gint height,
+ gboolean focus);
+
+static struct {
+    cairo_surface_t * surface;
+    FrameDrawFunc draw;
+    gint width, height, skin_num;
+    gboolean focus;
+} pl_frame;
+
+static void pl_frame_free (void)
+{
+    if (pl_frame.surface)
+    {
+        cairo_surface_destroy (pl_frame.surface);
+        pl_frame.surface = NULL;
+    }
+}
+
+static void pl_frame_paint (cairo_t * cr, FrameDrawFunc draw, gint width,
+ gint height, gboolean focus)
+{
+    if (! pl_frame.surface || pl_frame.draw != draw || pl_frame.width != width
+     || pl_frame.height != height || pl_frame.focus != focus ||
+     pl_frame.skin_num != skin_current_num)
+    {
+        pl_frame_free ();
+
+        /* the middle of the frame is left transparent */
+        pl_frame.surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+         width, height);
+        pl_frame.draw = draw;
+        pl_frame.width = width;
+        pl_frame.height = height;
+        pl_frame.focus = focus;
+        pl_frame.skin_num = skin_current_num;
+
+        cairo_t * frame_cr = cairo_create (pl_frame.surface);
+        draw (frame_cr, width, height, focus);
+        cairo_destroy (frame_cr);
+    }
+
+    cairo_set_source_surface (cr, pl_frame.surface, 0, 0);
+    cairo_paint (cr);
+}
+
+void skin_draw_playlistwin_frame (cairo_t * cr, gint width, gint height,
+ gboolean focus)
+{
+    pl_frame_paint (cr, skin_draw_playlistwin_frame_pieces, width, height, focus);
+}
+
+void skin_draw_playlistwin_shaded (cairo_t * cr, gint width, gboolean focus)
+{
+    pl_frame_paint (cr, skin_draw_playlistwin_shaded_pieces, width, 14, focus);
+}
+
 void skin_draw_mainwin_titlebar (cairo_t * cr, gboolean shaded, gboolean focus)
 {
     /* The titlebar skin consists of 2 sets of 2 images, one for for
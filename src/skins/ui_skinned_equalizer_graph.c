@@ -77,32 +77,50 @@ gdouble eval_spline (const gdouble * xa, const gdouble * ya, const gdouble * y2a
              (b * b * b - b) * y2a[khi]) * (h * h) / 6.0);
 }
 
-DRAW_FUNC_BEGIN (eq_graph_draw)
+/* There is only the one graph, in the equalizer window.  The curve changes
+ * only with the bands, and the rest of the picture with the preamp or the
+ * skin, so the whole is rendered once into a surface that each expose merely
+ * copies; eq_graph_update() and eq_graph_update_skin() throw it away. */
+static gint curve[109];
+static gboolean curve_valid;
+static cairo_surface_t * graph_buf;
+
+static void compute_curve (void)
+{
     static const gdouble x[10] = {0, 11, 23, 35, 47, 59, 71, 83, 97, 109};
 
-    skin_draw_pixbuf (cr, SKIN_EQMAIN, 0, 294, 0, 0, 113, 19);
-    skin_draw_pixbuf (cr, SKIN_EQMAIN, 0, 314, 0, 9 + (aud_get_double (NULL,
-     "equalizer_preamp") * 9 + EQUALIZER_MAX_GAIN / 2) / EQUALIZER_MAX_GAIN, 113, 1);
-
-    guint32 cols[19];
-    skin_get_eq_spline_colors(active_skin, cols);
-
     gdouble bands[AUD_EQUALIZER_NBANDS];
     aud_eq_get_bands (bands);
 
     gdouble yf[10];
     init_spline (x, bands, 10, yf);
 
-    /* now draw a pixelated line with vector graphics ... -- jlindgren */
-    gint py = 0;
     for (gint i = 0; i < 109; i ++)
     {
         gint y = 9.5 - eval_spline (x, bands, yf, 10, i) * 9 / EQUALIZER_MAX_GAIN;
-        y = CLAMP (y, 0, 18);
+        curve[i] = CLAMP (y, 0, 18);
+    }
+
+    curve_valid = TRUE;
+}
+
+static void eq_graph_render (cairo_t * cr)
+{
+    skin_draw_pixbuf (cr, SKIN_EQMAIN, 0, 294, 0, 0, 113, 19);
+    skin_draw_pixbuf (cr, SKIN_EQMAIN, 0, 314, 0, 9 + (aud_get_double (NULL,
+     "equalizer_preamp") * 9 + EQUALIZER_MAX_GAIN / 2) / EQUALIZER_MAX_GAIN, 113, 1);
+
+    guint32 cols[19];
+    skin_get_eq_spline_colors(active_skin, cols);
 
-        if (!i)
-            py = y;
+    if (! curve_valid)
+        compute_curve ();
 
+    /* now draw a pixelated line with vector graphics ... -- jlindgren */
+    gint py = curve[0];
+    for (gint i = 0; i < 109; i ++)
+    {
+        gint y = curve[i];
         gint ymin, ymax;
 
         if (y > py)
@@ -127,17 +145,54 @@ DRAW_FUNC_BEGIN (eq_graph_draw)
             cairo_fill (cr);
         }
     }
+}
+
+static void drop_buf (void)
+{
+    if (graph_buf)
+    {
+        cairo_surface_destroy (graph_buf);
+        graph_buf = NULL;
+    }
+}
+
+DRAW_FUNC_BEGIN (eq_graph_draw)
+    if (! graph_buf)
+    {
+        graph_buf = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 113, 19);
+        cairo_t * buf_cr = cairo_create (graph_buf);
+        eq_graph_render (buf_cr);
+        cairo_destroy (buf_cr);
+    }
+
+    cairo_set_source_surface (cr, graph_buf, 0, 0);
+    cairo_paint (cr);
 DRAW_FUNC_END
 
+static void eq_graph_destroy (GtkWidget * graph)
+{
+    drop_buf ();
+}
+
 GtkWidget * eq_graph_new (void)
 {
     GtkWidget * graph = gtk_drawing_area_new ();
     gtk_widget_set_size_request (graph, 113, 19);
     DRAW_CONNECT (graph, eq_graph_draw);
+    g_signal_connect (graph, "destroy", (GCallback) eq_graph_destroy, NULL);
     return graph;
 }
 
+/* when the bands or preamp have changed */
 void eq_graph_update (GtkWidget * graph)
 {
+    curve_valid = FALSE;
+    drop_buf ();
     gtk_widget_queue_draw (graph);
 }
+
+/* when the skin has changed; the caller redraws the window */
+void eq_graph_update_skin (void)
+{
+    drop_buf ();
+}
@@ -44,6 +44,15 @@
 
 enum {DRAG_SELECT = 1, DRAG_MOVE};
 
+#define ROW_CACHE_SIZE 256
+
+/* laid out text of one entry; row is -1 for an empty slot */
+typedef struct {
+    gint row;
+    PangoLayout * number, * length, * title;
+    gint number_width, length_width;
+} CachedRow;
+
 typedef struct {
     GtkWidget * slider;
     PangoFontDescription * font;
@@ -51,6 +60,8 @@ typedef struct {
      hover, drag;
     gint popup_pos, popup_source;
     gboolean popup_shown;
+    CachedRow cache[ROW_CACHE_SIZE];
+    gint number_width, length_width; /* as last drawn */
 } PlaylistData;
 
 static gboolean playlist_button_press (GtkWidget * list, GdkEventButton * event);
@@ -116,6 +127,13 @@ static gint adjust_position (PlaylistData * data, gboolean relative, gint
     return position;
 }
 
+static void queue_draw_hover (GtkWidget * list, PlaylistData * data)
+{
+    if (data->hover >= data->first && data->hover <= data->first + data->rows)
+        gtk_widget_queue_draw_area (list, 0, data->offset + data->row_height *
+         (data->hover - data->first) - 1, data->width, 2);
+}
+
 static void cancel_all (GtkWidget * list, PlaylistData * data)
 {
     data->drag = FALSE;
@@ -128,13 +146,101 @@ static void cancel_all (GtkWidget * list, PlaylistData * data)
 
     if (data->hover != -1)
     {
+        queue_draw_hover (list, data);
         data->hover = -1;
-        gtk_widget_queue_draw (list);
     }
 
     popup_hide (list, data);
 }
 
+static void cache_clear_row (CachedRow * row)
+{
+    if (row->row < 0)
+        return;
+
+    g_object_unref (row->number);
+    g_object_unref (row->length);
+    g_object_unref (row->title);
+    row->row = -1;
+}
+
+/* count < 0 means everything from at to the end of the playlist */
+static void cache_invalidate (PlaylistData * data, gint at, gint count)
+{
+    for (gint i = 0; i < ROW_CACHE_SIZE; i ++)
+    {
+        gint row = data->cache[i].row;
+
+        if (row >= at && (count < 0 || row < at + count))
+            cache_clear_row (& data->cache[i]);
+    }
+}
+
+static PangoLayout * create_layout (GtkWidget * list, PlaylistData * data,
+ const gchar * text, gint * width)
+{
+    PangoLayout * layout = gtk_widget_create_pango_layout (list, text);
+    pango_layout_set_font_description (layout, data->font);
+
+    if (width)
+    {
+        PangoRectangle rect;
+        pango_layout_get_pixel_extents (layout, NULL, & rect);
+        * width = rect.width;
+    }
+
+    return layout;
+}
+
+/* The returned pointer is only good until the next lookup, since another row
+ * may map to the same slot. */
+static CachedRow * cache_lookup (GtkWidget * list, PlaylistData * data, gint i)
+{
+    CachedRow * row = & data->cache[i % ROW_CACHE_SIZE];
+
+    if (row->row == i)
+        return row;
+
+    cache_clear_row (row);
+
+    gchar buf[16];
+    snprintf (buf, sizeof buf, "%d.", 1 + i);
+    row->number = create_layout (list, data, buf, & row->number_width);
+
+    gint len = aud_playlist_entry_get_length (active_playlist, i, TRUE);
+
+    if (len > 0)
+        snprintf (buf, sizeof buf, "%d:%02d", len / 60000, len / 1000 % 60);
+    else
+        buf[0] = 0;
+
+    row->length = create_layout (list, data, buf, & row->length_width);
+
+    gchar * title = aud_playlist_entry_get_title (active_playlist, i, TRUE);
+    row->title = create_layout (list, data, title, NULL);
+    pango_layout_set_ellipsize (row->title, PANGO_ELLIPSIZE_END);
+    str_unref (title);
+
+    row->row = i;
+    return row;
+}
+
+/* the number and length columns are as wide as their widest visible entry */
+static void calc_column_widths (GtkWidget * list, PlaylistData * data,
+ gint * number_width, gint * length_width)
+{
+    gint last = MIN (data->first + data->rows, active_length);
+
+    * number_width = * length_width = 0;
+
+    for (gint i = data->first; i < last; i ++)
+    {
+        CachedRow * row = cache_lookup (list, data, i);
+        * number_width = MAX (* number_width, row->number_width);
+        * length_width = MAX (* length_width, row->length_width);
+    }
+}
+
 DRAW_FUNC_BEGIN (playlist_draw)
     PlaylistData * data = g_object_get_data ((GObject *) wid, "playlistdata");
     g_return_val_if_fail (data, FALSE);
@@ -144,6 +250,19 @@ DRAW_FUNC_BEGIN (playlist_draw)
     PangoLayout * layout;
     gint width;
 
+    gint last = MIN (data->first + data->rows, active_length);
+
+    /* only the rows inside the damaged area are drawn */
+
+    GdkRectangle clip = {0, 0, data->width, data->height};
+    gdk_cairo_get_clip_rectangle (cr, & clip);
+
+    gint top = data->first + MAX (clip.y - data->offset, 0) / data->row_height;
+    gint bottom = data->first + MAX (clip.y + clip.height - data->offset +
+     data->row_height - 1, 0) / data->row_height;
+
+    bottom = MIN (bottom, last);
+
     /* background */
 
     set_cairo_color (cr, active_skin->colors[SKIN_PLEDIT_NORMALBG]);
@@ -151,7 +270,7 @@ DRAW_FUNC_BEGIN (playlist_draw)
 
     /* playlist title */
 
-    if (data->offset)
+    if (data->offset && clip.y < data->offset)
     {
         layout = gtk_widget_create_pango_layout (wid, active_title);
         pango_layout_set_font_description (layout, data->font);
@@ -168,8 +287,7 @@ DRAW_FUNC_BEGIN (playlist_draw)
 
     /* selection highlight */
 
-    for (gint i = data->first; i < data->first + data->rows && i <
-     active_length; i ++)
+    for (gint i = top; i < bottom; i ++)
     {
         if (! aud_playlist_entry_get_selected (active_playlist, i))
             continue;
@@ -180,67 +298,15 @@ DRAW_FUNC_BEGIN (playlist_draw)
         cairo_fill (cr);
     }
 
-    /* entry numbers */
-
-    if (aud_get_bool (NULL, "show_numbers_in_pl"))
-    {
-        width = 0;
-
-        for (gint i = data->first; i < data->first + data->rows && i <
-         active_length; i ++)
-        {
-            gchar buf[16];
-            snprintf (buf, sizeof buf, "%d.", 1 + i);
+    /* entry numbers and lengths */
 
-            layout = gtk_widget_create_pango_layout (wid, buf);
-            pango_layout_set_font_description (layout, data->font);
+    gboolean numbers = aud_get_bool (NULL, "show_numbers_in_pl");
+    calc_column_widths (wid, data, & data->number_width, & data->length_width);
 
-            PangoRectangle rect;
-            pango_layout_get_pixel_extents (layout, NULL, & rect);
-            width = MAX (width, rect.width);
+    if (numbers)
+        left += data->number_width + 4;
 
-            cairo_move_to (cr, left, data->offset + data->row_height * (i -
-             data->first));
-            set_cairo_color (cr, active_skin->colors[(i == active_entry) ?
-             SKIN_PLEDIT_CURRENT : SKIN_PLEDIT_NORMAL]);
-            pango_cairo_show_layout (cr, layout);
-            g_object_unref (layout);
-        }
-
-        left += width + 4;
-    }
-
-    /* entry lengths */
-
-    width = 0;
-
-    for (gint i = data->first; i < data->first + data->rows && i <
-     active_length; i ++)
-    {
-        gint len = aud_playlist_entry_get_length (active_playlist, i, TRUE);
-        gchar buf[16];
-
-        if (len > 0)
-            snprintf (buf, sizeof buf, "%d:%02d", len / 60000, len / 1000 % 60);
-        else
-            buf[0] = 0;
-
-        layout = gtk_widget_create_pango_layout (wid, buf);
-        pango_layout_set_font_description (layout, data->font);
-
-        PangoRectangle rect;
-        pango_layout_get_pixel_extents (layout, NULL, & rect);
-        width = MAX (width, rect.width);
-
-        cairo_move_to (cr, data->width - right - rect.width, data->offset +
-         data->row_height * (i - data->first));
-        set_cairo_color (cr, active_skin->colors[(i == active_entry) ?
-         SKIN_PLEDIT_CURRENT : SKIN_PLEDIT_NORMAL]);
-        pango_cairo_show_layout (cr, layout);
-        g_object_unref (layout);
-    }
-
-    right += width + 6;
+    right += data->length_width + 6;
 
     /* queue positions */
 
@@ -258,14 +324,17 @@ DRAW_FUNC_BEGIN (playlist_draw)
             gchar buf[16];
             snprintf (buf, sizeof buf, "(#%d)", 1 + pos);
 
-            layout = gtk_widget_create_pango_layout (wid, buf);
-            pango_layout_set_font_description (layout, data->font);
+            gint text_width;
+            layout = create_layout (wid, data, buf, & text_width);
+            width = MAX (width, text_width);
 
-            PangoRectangle rect;
-            pango_layout_get_pixel_extents (layout, NULL, & rect);
-            width = MAX (width, rect.width);
+            if (i < top || i >= bottom)
+            {
+                g_object_unref (layout);
+                continue;
+            }
 
-            cairo_move_to (cr, data->width - right - rect.width, data->offset +
+            cairo_move_to (cr, data->width - right - text_width, data->offset +
              data->row_height * (i - data->first));
             set_cairo_color (cr, active_skin->colors[(i == active_entry) ?
              SKIN_PLEDIT_CURRENT : SKIN_PLEDIT_NORMAL]);
@@ -276,27 +345,31 @@ DRAW_FUNC_BEGIN (playlist_draw)
         right += width + 6;
     }
 
-    /* titles */
+    /* entry numbers, lengths and titles */
 
-    for (gint i = data->first; i < data->first + data->rows && i <
-     active_length; i ++)
+    for (gint i = top; i < bottom; i ++)
     {
-        gchar * title = aud_playlist_entry_get_title (active_playlist, i, TRUE);
-
-        layout = gtk_widget_create_pango_layout (wid, title);
-        pango_layout_set_font_description (layout, data->font);
-        pango_layout_set_width (layout, PANGO_SCALE * (data->width - left -
-         right));
-        pango_layout_set_ellipsize (layout, PANGO_ELLIPSIZE_END);
+        CachedRow * row = cache_lookup (wid, data, i);
+        gint y = data->offset + data->row_height * (i - data->first);
 
-        str_unref (title);
-
-        cairo_move_to (cr, left, data->offset + data->row_height * (i -
-         data->first));
         set_cairo_color (cr, active_skin->colors[(i == active_entry) ?
          SKIN_PLEDIT_CURRENT : SKIN_PLEDIT_NORMAL]);
-        pango_cairo_show_layout (cr, layout);
-        g_object_unref (layout);
+
+        if (numbers)
+        {
+            cairo_move_to (cr, 3, y);
+            pango_cairo_show_layout (cr, row->number);
+        }
+
+        cairo_move_to (cr, data->width - 3 - row->length_width, y);
+        pango_cairo_show_layout (cr, row->length);
+
+        /* no new layout pass unless the width actually changed */
+        pango_layout_set_width (row->title, PANGO_SCALE * (data->width - left -
+         right));
+
+        cairo_move_to (cr, left, y);
+        pango_cairo_show_layout (cr, row->title);
     }
 
     /* focus rectangle */
@@ -332,6 +405,7 @@ static void playlist_destroy (GtkWidget * list)
     g_return_if_fail (data);
 
     cancel_all (list, data);
+    cache_invalidate (data, 0, -1);
 
     pango_font_description_free (data->font);
     g_free (data);
@@ -360,6 +434,10 @@ GtkWidget * ui_skinned_playlist_new (gint width, gint height, const gchar * font
     data->height = height;
     data->hover = -1;
     data->popup_pos = -1;
+
+    for (gint i = 0; i < ROW_CACHE_SIZE; i ++)
+        data->cache[i].row = -1;
+
     g_object_set_data ((GObject *) list, "playlistdata", data);
 
     ui_skinned_playlist_set_font (list, font);
@@ -399,6 +477,7 @@ void ui_skinned_playlist_set_font (GtkWidget * list, const gchar * font)
 
     pango_font_description_free (data->font);
     data->font = pango_font_description_from_string (font);
+    cache_invalidate (data, 0, -1);
 
     PangoLayout * layout = gtk_widget_create_pango_layout (list, "A");
     pango_layout_set_font_description (layout, data->font);
@@ -431,6 +510,48 @@ void ui_skinned_playlist_update (GtkWidget * list)
         ui_skinned_playlist_slider_update (data->slider);
 }
 
+void ui_skinned_playlist_invalidate (GtkWidget * list, gint at, gint count)
+{
+    PlaylistData * data = g_object_get_data ((GObject *) list, "playlistdata");
+    g_return_if_fail (data);
+
+    cache_invalidate (data, at, count);
+}
+
+/* Moves the rows already on screen rather than redrawing all of them; only
+ * the rows scrolled into view are exposed. */
+static void scroll_rows (GtkWidget * list, PlaylistData * data, gint old_first)
+{
+    gint delta = old_first - data->first;
+    GdkWindow * window = gtk_widget_get_window (list);
+
+    if (! delta)
+        return;
+
+    /* the rows on screen can only be reused if the columns stay put */
+    gint number_width, length_width;
+    calc_column_widths (list, data, & number_width, & length_width);
+
+    if (! window || ! gtk_widget_is_drawable (list) || ABS (delta) >= data->rows
+     || number_width != data->number_width || length_width != data->length_width
+     || aud_playlist_queue_count (active_playlist))
+    {
+        gtk_widget_queue_draw (list);
+        return;
+    }
+
+    gint shift = data->row_height * ABS (delta);
+    gint height = data->row_height * data->rows - shift;
+
+    /* keep the moved rows out of the title area */
+    cairo_rectangle_int_t rect = {0, data->offset + (delta < 0 ? shift : 0),
+     data->width, height};
+    cairo_region_t * region = cairo_region_create_rectangle (& rect);
+
+    gdk_window_move_region (window, region, 0, data->row_height * delta);
+    cairo_region_destroy (region);
+}
+
 static void scroll_to (PlaylistData * data, gint position)
 {
     if (position < data->first || position >= data->first + data->rows)
@@ -669,10 +790,12 @@ void ui_skinned_playlist_scroll_to (GtkWidget * list, gint row)
     g_return_if_fail (data);
 
     cancel_all (list, data);
+
+    gint old_first = data->first;
     data->first = row;
     calc_layout (data);
 
-    gtk_widget_queue_draw (list);
+    scroll_rows (list, data, old_first);
 
     if (data->slider)
         ui_skinned_playlist_slider_update (data->slider);
@@ -710,8 +833,9 @@ void ui_skinned_playlist_hover (GtkWidget * list, gint x, gint y)
 
     if (new != data->hover)
     {
+        queue_draw_hover (list, data);
         data->hover = new;
-        gtk_widget_queue_draw (list);
+        queue_draw_hover (list, data);
     }
 }
 
@@ -721,9 +845,10 @@ gint ui_skinned_playlist_hover_end (GtkWidget * list)
     g_return_val_if_fail (data, -1);
 
     gint temp = data->hover;
+
+    queue_draw_hover (list, data);
     data->hover = -1;
 
-    gtk_widget_queue_draw (list);
     return temp;
 }
 
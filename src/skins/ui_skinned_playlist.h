@@ -35,6 +35,7 @@ void ui_skinned_playlist_set_slider (GtkWidget * list, GtkWidget * slider);
 void ui_skinned_playlist_resize (GtkWidget * list, gint w, gint h);
 void ui_skinned_playlist_set_font (GtkWidget * list, const gchar * font);
 void ui_skinned_playlist_update (GtkWidget * list);
+void ui_skinned_playlist_invalidate (GtkWidget * list, gint at, gint count);
 gboolean ui_skinned_playlist_key (GtkWidget * list, GdkEventKey * event);
 void ui_skinned_playlist_row_info (GtkWidget * list, gint * rows, gint * first);
 void ui_skinned_playlist_scroll_to (GtkWidget * list, gint row);
@@ -21,13 +21,14 @@
  * using our public API to be a derived work.
  */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
 
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
-#include <libaudgui/libaudgui-gtk.h>
 
 #include "plugin.h"
 #include "ui_skin.h"
@@ -55,25 +56,90 @@ typedef struct {
 
 static GList *skinlist = NULL;
 
+/* Thumbnails are loaded (or generated, which may mean extracting an archive)
+ * by a worker thread; rows show a blank placeholder until theirs arrives. */
+
+#define THUMB_SIZE 128
+
+typedef struct {
+    gchar * path;
+    GtkTreeRowReference * row; /* main thread only */
+    GdkPixbuf * thumb;
+} ThumbJob;
+
+static pthread_mutex_t thumb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t thumb_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thumb_worker;
+static gboolean thumb_running, thumb_quit;
+static GQueue thumb_queue = G_QUEUE_INIT; /* jobs waiting for the worker */
+static GList * thumb_finished;            /* jobs waiting for thumb_done_cb() */
+static gint thumb_source;
+static GdkPixbuf * thumb_placeholder;
+
+/* thumbnails are keyed by path and modification time, so that a skin that
+ * is replaced gets a new one */
 static gchar *
 get_thumbnail_filename(const gchar * path)
 {
-    gchar *basename, *pngname, *thumbname;
+    struct stat info;
+    gchar *key, *hash, *pngname, *thumbname;
 
     g_return_val_if_fail(path != NULL, NULL);
 
-    basename = g_path_get_basename(path);
-    pngname = g_strconcat(basename, ".png", NULL);
+    if (stat (path, & info) < 0)
+        return NULL;
+
+    key = g_strdup_printf ("%s\n%ld", path, (long) info.st_mtime);
+    hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, key, -1);
+    pngname = g_strconcat(hash, ".png", NULL);
 
     thumbname = g_build_filename(skins_paths[SKINS_PATH_SKIN_THUMB_DIR],
                                  pngname, NULL);
 
-    g_free(basename);
+    g_free(key);
+    g_free(hash);
     g_free(pngname);
 
     return thumbname;
 }
 
+/* Looks for main.<ext> the way find_file_case_path() would, but without its
+ * (main thread) lookup cache. */
+static gchar * find_main_image (const gchar * folder)
+{
+    GDir * dir = g_dir_open (folder, 0, NULL);
+    if (! dir)
+        return NULL;
+
+    const gchar * name, * found = NULL;
+    gint best = EXTENSION_TARGETS;
+    gchar * path = NULL;
+
+    while ((name = g_dir_read_name (dir)))
+    {
+        if (strncasecmp (name, "main.", 5))
+            continue;
+
+        for (gint i = 0; i < best; i ++)
+        {
+            if (! strcasecmp (name + 5, ext_targets[i]))
+            {
+                best = i;
+                found = name;
+                break;
+            }
+        }
+
+        if (found && best == 0)
+            break;
+    }
+
+    if (found)
+        path = g_build_filename (folder, found, NULL);
+
+    g_dir_close (dir);
+    return path;
+}
 
 static GdkPixbuf *
 skin_get_preview(const gchar * path)
@@ -81,8 +147,6 @@ skin_get_preview(const gchar * path)
     GdkPixbuf *preview = NULL;
     gchar *dec_path, *preview_path;
     gboolean is_archive = FALSE;
-    gint i = 0;
-    gchar buf[60];			/* gives us lots of room */
 
     if (file_is_archive(path))
     {
@@ -96,15 +160,7 @@ skin_get_preview(const gchar * path)
         dec_path = g_strdup(path);
     }
 
-    for (i = 0; i < EXTENSION_TARGETS; i++)
-    {
-        sprintf(buf, "main.%s", ext_targets[i]);
-
-        if ((preview_path = find_file_case_path (dec_path, buf)) != NULL)
-            break;
-    }
-
-    if (preview_path)
+    if ((preview_path = find_main_image (dec_path)) != NULL)
     {
         preview = gdk_pixbuf_new_from_file(preview_path, NULL);
         g_free(preview_path);
@@ -118,11 +174,40 @@ skin_get_preview(const gchar * path)
     return preview;
 }
 
+static void scale_within (GdkPixbuf * * pixbuf, gint size)
+{
+    gint width = gdk_pixbuf_get_width (* pixbuf);
+    gint height = gdk_pixbuf_get_height (* pixbuf);
+
+    if (width <= size && height <= size)
+        return;
+
+    if (width > height)
+    {
+        height = MAX (1, height * size / width);
+        width = size;
+    }
+    else
+    {
+        width = MAX (1, width * size / height);
+        height = size;
+    }
+
+    GdkPixbuf * scaled = gdk_pixbuf_scale_simple (* pixbuf, width, height,
+     GDK_INTERP_BILINEAR);
+    g_object_unref (* pixbuf);
+    * pixbuf = scaled;
+}
+
+/* called from the worker thread */
 static GdkPixbuf * skin_get_thumbnail (const gchar * path)
 {
     gchar * thumbname = get_thumbnail_filename (path);
     GdkPixbuf * thumb = NULL;
 
+    if (! thumbname)
+        return NULL;
+
     if (g_file_test (thumbname, G_FILE_TEST_EXISTS))
     {
         thumb = gdk_pixbuf_new_from_file (thumbname, NULL);
@@ -134,7 +219,7 @@ static GdkPixbuf * skin_get_thumbnail (const gchar * path)
     if (! thumb)
         goto DONE;
 
-    audgui_pixbuf_scale_within (& thumb, 128);
+    scale_within (& thumb, THUMB_SIZE);
 
     if (thumb)
         gdk_pixbuf_save (thumb, thumbname, "png", NULL, NULL);
@@ -144,6 +229,154 @@ DONE:
     return thumb;
 }
 
+static void thumb_job_free (ThumbJob * job)
+{
+    if (job->thumb)
+        g_object_unref (job->thumb);
+
+    gtk_tree_row_reference_free (job->row);
+    g_free (job->path);
+    g_slice_free (ThumbJob, job);
+}
+
+static gboolean thumb_done_cb (void * unused)
+{
+    pthread_mutex_lock (& thumb_mutex);
+    GList * jobs = thumb_finished;
+    thumb_finished = NULL;
+    thumb_source = 0;
+    pthread_mutex_unlock (& thumb_mutex);
+
+    for (GList * node = jobs; node; node = node->next)
+    {
+        ThumbJob * job = node->data;
+        GtkTreePath * path = gtk_tree_row_reference_get_path (job->row);
+
+        if (path)
+        {
+            GtkTreeModel * model = gtk_tree_row_reference_get_model (job->row);
+            GtkTreeIter iter;
+
+            if (gtk_tree_model_get_iter (model, & iter, path))
+                gtk_list_store_set ((GtkListStore *) model, & iter,
+                 SKIN_VIEW_COL_PREVIEW, job->thumb, -1);
+
+            gtk_tree_path_free (path);
+        }
+
+        thumb_job_free (job);
+    }
+
+    g_list_free (jobs);
+    return FALSE;
+}
+
+static void * thumb_thread (void * unused)
+{
+    pthread_mutex_lock (& thumb_mutex);
+
+    while (! thumb_quit)
+    {
+        ThumbJob * job = g_queue_pop_head (& thumb_queue);
+
+        if (! job)
+        {
+            pthread_cond_wait (& thumb_cond, & thumb_mutex);
+            continue;
+        }
+
+        pthread_mutex_unlock (& thumb_mutex);
+
+        job->thumb = skin_get_thumbnail (job->path);
+
+        pthread_mutex_lock (& thumb_mutex);
+
+        if (! thumb_source)
+            thumb_source = g_idle_add (thumb_done_cb, NULL);
+
+        thumb_finished = g_list_append (thumb_finished, job);
+    }
+
+    pthread_mutex_unlock (& thumb_mutex);
+    return NULL;
+}
+
+static void thumb_request (GtkTreeModel * model, GtkTreeIter * iter,
+ const gchar * path)
+{
+    ThumbJob * job = g_slice_new0 (ThumbJob);
+    GtkTreePath * row = gtk_tree_model_get_path (model, iter);
+
+    job->path = g_strdup (path);
+    job->row = gtk_tree_row_reference_new (model, row);
+    gtk_tree_path_free (row);
+
+    pthread_mutex_lock (& thumb_mutex);
+
+    if (! thumb_running)
+    {
+        thumb_quit = FALSE;
+        thumb_running = TRUE;
+        pthread_create (& thumb_worker, NULL, thumb_thread, NULL);
+    }
+
+    g_queue_push_tail (& thumb_queue, job);
+    pthread_cond_signal (& thumb_cond);
+    pthread_mutex_unlock (& thumb_mutex);
+}
+
+/* drops the thumbnails not yet started; the rest are discarded by
+ * thumb_done_cb() once their rows are gone */
+static void thumb_cancel (void)
+{
+    pthread_mutex_lock (& thumb_mutex);
+    GList * jobs = thumb_queue.head;
+    g_queue_init (& thumb_queue);
+    pthread_mutex_unlock (& thumb_mutex);
+
+    g_list_foreach (jobs, (GFunc) thumb_job_free, NULL);
+    g_list_free (jobs);
+}
+
+static void thumb_stop (void)
+{
+    thumb_cancel ();
+
+    pthread_mutex_lock (& thumb_mutex);
+
+    if (thumb_running)
+    {
+        thumb_quit = TRUE;
+        pthread_cond_signal (& thumb_cond);
+        pthread_mutex_unlock (& thumb_mutex);
+
+        pthread_join (thumb_worker, NULL);
+
+        pthread_mutex_lock (& thumb_mutex);
+        thumb_running = FALSE;
+    }
+
+    if (thumb_source)
+    {
+        g_source_remove (thumb_source);
+        thumb_source = 0;
+    }
+
+    GList * jobs = thumb_finished;
+    thumb_finished = NULL;
+
+    pthread_mutex_unlock (& thumb_mutex);
+
+    g_list_foreach (jobs, (GFunc) thumb_job_free, NULL);
+    g_list_free (jobs);
+
+    if (thumb_placeholder)
+    {
+        g_object_unref (thumb_placeholder);
+        thumb_placeholder = NULL;
+    }
+}
+
 static void
 skinlist_add(const gchar * filename)
 {
@@ -268,7 +501,6 @@ void skin_view_update (GtkTreeView * treeview)
     gboolean have_current_skin = FALSE;
     GtkTreePath *path;
 
-    GdkPixbuf *thumbnail;
     gchar *formattedname;
     gchar *name;
     GList *entry;
@@ -277,28 +509,36 @@ void skin_view_update (GtkTreeView * treeview)
 
     store = GTK_LIST_STORE(gtk_tree_view_get_model(treeview));
 
+    thumb_cancel ();
     gtk_list_store_clear(store);
 
+    /* the size of a main window image scaled to a thumbnail */
+    if (! thumb_placeholder)
+    {
+        thumb_placeholder = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+         THUMB_SIZE, THUMB_SIZE * 116 / 275);
+        gdk_pixbuf_fill (thumb_placeholder, 0);
+    }
+
     skinlist_update();
 
     for (entry = skinlist; entry; entry = entry->next)
     {
         SkinNode * node = entry->data;
 
-        thumbnail = skin_get_thumbnail (node->path);
         formattedname = g_strdup_printf ("<big><b>%s</b></big>\n<i>%s</i>",
          node->name, node->desc);
         name = node->name;
 
         gtk_list_store_append(store, &iter);
         gtk_list_store_set(store, &iter,
-                           SKIN_VIEW_COL_PREVIEW, thumbnail,
+                           SKIN_VIEW_COL_PREVIEW, thumb_placeholder,
                            SKIN_VIEW_COL_FORMATTEDNAME, formattedname,
                            SKIN_VIEW_COL_NAME, name, -1);
-        if (thumbnail)
-            g_object_unref(thumbnail);
         g_free(formattedname);
 
+        thumb_request (GTK_TREE_MODEL (store), & iter, node->path);
+
         if (g_strstr_len(active_skin->path,
                          strlen(active_skin->path), name) ) {
             iter_current_skin = iter;
@@ -394,4 +634,5 @@ skin_view_realize(GtkTreeView * treeview)
 
     g_signal_connect(treeview, "cursor-changed",
                      G_CALLBACK(skin_view_on_cursor_changed), NULL);
+    g_signal_connect (treeview, "destroy", (GCallback) thumb_stop, NULL);
 }
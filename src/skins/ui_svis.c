@@ -31,6 +31,7 @@
 #include "surface.h"
 #include "ui_skin.h"
 #include "ui_vis.h"
+#include "../vislimit/vislimit.h"
 
 static gint svis_analyzer_colors[] = {14, 11, 8, 5, 2};
 static gint svis_scope_colors[] = {20, 19, 18, 19, 20};
@@ -178,6 +179,7 @@ GtkWidget * ui_svis_new (void)
     gtk_widget_set_size_request (wid, 38, 5);
     gtk_widget_add_events (wid, GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
     DRAW_CONNECT (wid, ui_svis_draw);
+    vislimit_attach (wid, NULL, NULL);
     return wid;
 }
 
@@ -201,5 +203,7 @@ void ui_svis_timeout_func (GtkWidget * widget, guchar * data)
     }
 
     svis.active = TRUE;
-    gtk_widget_queue_draw (widget);
+
+    if (vislimit_frame_due (widget, TRUE))
+        gtk_widget_queue_draw (widget);
 }
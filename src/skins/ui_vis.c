@@ -31,6 +31,7 @@
 #include "surface.h"
 #include "ui_skin.h"
 #include "ui_vis.h"
+#include "../vislimit/vislimit.h"
 
 static const gfloat vis_afalloff_speeds[] = {0.34, 0.5, 1.0, 1.3, 1.6};
 static const gfloat vis_pfalloff_speeds[] = {1.2, 1.3, 1.4, 1.5, 1.6};
@@ -42,18 +43,28 @@ static guint32 vis_voice_color_fire[256];
 static guint32 vis_voice_color_ice[256];
 static guint32 pattern_fill[76 * 2];
 
+/* colors of an analyzer column [mode][height][row from the top of the bar]
+ * and of each scope row, looked up from the skin once per skin change */
+static guint32 analyzer_lut[3][17][16];
+static guint32 scope_lut[16];
+static guint32 peak_color;
+
 static struct {
-    gboolean active;
+    gboolean active, dirty;
     gfloat data[75], peak[75], peak_speed[75];
     guchar voiceprint_data[76 * 16];
     gboolean voiceprint_advance;
 } vis;
 
+/* the image is only regenerated when vis.dirty is set; the surface wrapping
+ * it lives as long as the widget */
+static guint32 vis_rgb[76 * 16];
+static cairo_surface_t * vis_surface = NULL;
+
 #define RGB_SEEK(x,y) (set = rgb + 76 * (y) + (x))
 #define RGB_SET(c) (* set ++ = (c))
 #define RGB_SET_Y(c) do {* set = (c); set += 76;} while (0)
 #define RGB_SET_INDEX(c) RGB_SET (active_skin->vis_colors[c])
-#define RGB_SET_INDEX_Y(c) RGB_SET_Y (active_skin->vis_colors[c])
 
 void ui_vis_set_colors (void)
 {
@@ -96,10 +107,27 @@ void ui_vis_set_colors (void)
         RGB_SET_INDEX (1);
         RGB_SET_INDEX (0);
     }
+
+    for (gint h = 0; h <= 16; h ++)
+    {
+        for (gint y = 0; y < h; y ++)
+        {
+            analyzer_lut[ANALYZER_NORMAL][h][y] = active_skin->vis_colors[18 - h + y];
+            analyzer_lut[ANALYZER_FIRE][h][y] = active_skin->vis_colors[2 + y];
+            analyzer_lut[ANALYZER_VLINES][h][y] = active_skin->vis_colors[18 - h];
+        }
+    }
+
+    for (gint y = 0; y < 16; y ++)
+        scope_lut[y] = active_skin->vis_colors[vis_scope_colors[y]];
+
+    peak_color = active_skin->vis_colors[23];
+    vis.dirty = TRUE;
 }
 
-DRAW_FUNC_BEGIN (ui_vis_draw)
-    guint32 rgb[76 * 16];
+static void ui_vis_render (void)
+{
+    guint32 * rgb = vis_rgb;
     guint32 * set;
 
     if (config.vis_type != VIS_VOICEPRINT)
@@ -112,6 +140,7 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
     {
     case VIS_ANALYZER:;
         gboolean bars = (config.analyzer_type == ANALYZER_BARS);
+        gint mode = CLAMP (config.analyzer_mode, ANALYZER_NORMAL, ANALYZER_VLINES);
 
         for (gint x = 0; x < 75; x ++)
         {
@@ -122,21 +151,10 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
             h = CLAMP (h, 0, 16);
             RGB_SEEK (x, 16 - h);
 
-            switch (config.analyzer_mode)
-            {
-            case ANALYZER_NORMAL:
-                for (gint y = 0; y < h; y ++)
-                    RGB_SET_INDEX_Y (18 - h + y);
-                break;
-            case ANALYZER_FIRE:
-                for (gint y = 0; y < h; y ++)
-                    RGB_SET_INDEX_Y (2 + y);
-                break;
-            default: /* ANALYZER_VLINES */
-                for (gint y = 0; y < h; y ++)
-                    RGB_SET_INDEX_Y (18 - h);
-                break;
-            }
+            const guint32 * column = analyzer_lut[mode][h];
+
+            for (gint y = 0; y < h; y ++)
+                RGB_SET_Y (column[y]);
 
             if (config.analyzer_peaks)
             {
@@ -146,7 +164,7 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
                 if (h)
                 {
                     RGB_SEEK (x, 16 - h);
-                    RGB_SET_INDEX (23);
+                    RGB_SET (peak_color);
                 }
             }
         }
@@ -175,7 +193,7 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
         break;
     case VIS_SCOPE:
         if (! vis.active)
-            goto DRAW;
+            break;
 
         switch (config.scope_mode)
         {
@@ -184,7 +202,7 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
             {
                 gint h = CLAMP (vis.data[x], 0, 15);
                 RGB_SEEK (x, h);
-                RGB_SET_INDEX (vis_scope_colors[h]);
+                RGB_SET (scope_lut[h]);
             }
             break;
         case SCOPE_LINE:
@@ -199,12 +217,12 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
                 RGB_SEEK (x, h);
 
                 for (gint y = h; y <= h2; y ++)
-                    RGB_SET_INDEX_Y (vis_scope_colors[y]);
+                    RGB_SET_Y (scope_lut[y]);
             }
 
             gint h = CLAMP (vis.data[74], 0, 15);
             RGB_SEEK (74, h);
-            RGB_SET_INDEX (vis_scope_colors[h]);
+            RGB_SET (scope_lut[h]);
             break;
         default: /* SCOPE_SOLID */
             for (gint x = 0; x < 75; x++)
@@ -218,33 +236,53 @@ DRAW_FUNC_BEGIN (ui_vis_draw)
                 RGB_SEEK (x, h);
 
                 for (gint y = h; y <= h2; y ++)
-                    RGB_SET_INDEX_Y (vis_scope_colors[y]);
+                    RGB_SET_Y (scope_lut[y]);
             }
             break;
         }
         break;
     }
+}
 
-DRAW:;
-    cairo_surface_t * surf = cairo_image_surface_create_for_data ((void *) rgb,
-     CAIRO_FORMAT_RGB24, 76, 16, 4 * 76);
-    cairo_set_source_surface (cr, surf, 0, 0);
+DRAW_FUNC_BEGIN (ui_vis_draw)
+    if (vis.dirty)
+    {
+        cairo_surface_flush (vis_surface);
+        ui_vis_render ();
+        cairo_surface_mark_dirty (vis_surface);
+        vis.dirty = FALSE;
+    }
+
+    cairo_set_source_surface (cr, vis_surface, 0, 0);
     cairo_paint (cr);
-    cairo_surface_destroy (surf);
 DRAW_FUNC_END
 
+static void ui_vis_destroy (GtkWidget * wid)
+{
+    cairo_surface_destroy (vis_surface);
+    vis_surface = NULL;
+}
+
 GtkWidget * ui_vis_new (void)
 {
     GtkWidget * wid = gtk_drawing_area_new ();
     gtk_widget_set_size_request (wid, 76, 16);
     gtk_widget_add_events (wid, GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
     DRAW_CONNECT (wid, ui_vis_draw);
+    g_signal_connect (wid, "destroy", (GCallback) ui_vis_destroy, NULL);
+    vislimit_attach (wid, NULL, NULL);
+
+    vis_surface = cairo_image_surface_create_for_data ((void *) vis_rgb,
+     CAIRO_FORMAT_RGB24, 76, 16, 4 * 76);
+    vis.dirty = TRUE;
+
     return wid;
 }
 
 void ui_vis_clear_data (GtkWidget * wid)
 {
     memset (& vis, 0, sizeof vis);
+    vis.dirty = TRUE;
     gtk_widget_queue_draw (wid);
 }
 
@@ -256,6 +294,8 @@ void ui_vis_timeout_func (GtkWidget * widget, guchar * data)
 
         for (gint i = 0; i < n; i++)
         {
+            gint old_data = vis.data[i], old_peak = vis.peak[i];
+
             if (data[i] > vis.data[i])
             {
                 vis.data[i] = data[i];
@@ -296,6 +336,10 @@ void ui_vis_timeout_func (GtkWidget * widget, guchar * data)
                         vis.peak[i] = 0.0;
                 }
             }
+
+            /* only whole pixels are drawn */
+            if ((gint) vis.data[i] != old_data || (gint) vis.peak[i] != old_peak)
+                vis.dirty = TRUE;
         }
     }
     else if (config.vis_type == VIS_VOICEPRINT)
@@ -304,13 +348,26 @@ void ui_vis_timeout_func (GtkWidget * widget, guchar * data)
             vis.data[i] = data[15 - i];
 
         vis.voiceprint_advance = TRUE;
+        vis.dirty = TRUE;
     }
     else
     {
         for (gint i = 0; i < 75; i++)
-            vis.data[i] = data[i];
+        {
+            if (vis.data[i] != data[i])
+            {
+                vis.data[i] = data[i];
+                vis.dirty = TRUE;
+            }
+        }
+    }
+
+    if (! vis.active)
+    {
+        vis.active = TRUE;
+        vis.dirty = TRUE;
     }
 
-    vis.active = TRUE;
-    gtk_widget_queue_draw (widget);
+    if (vislimit_frame_due (widget, vis.dirty))
+        gtk_widget_queue_draw (widget);
 }
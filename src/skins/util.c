@@ -33,6 +33,7 @@
 #include <unistd.h>
 
 #include <gtk/gtk.h>
+#include <zlib.h>
 
 #include <audacious/debug.h>
 #include <audacious/i18n.h>
@@ -158,7 +159,7 @@ typedef enum
     ARCHIVE_TBZ2
 } ArchiveType;
 
-typedef gchar *(*ArchiveExtractFunc) (const gchar *, const gchar *);
+typedef gboolean (* ArchiveExtractFunc) (const gchar * archive, const gchar * dest);
 
 typedef struct
 {
@@ -177,73 +178,285 @@ static ArchiveExtensionType archive_extensions[] = {
     {ARCHIVE_UNKNOWN, NULL}
 };
 
-static gchar *archive_extract_tar(const gchar *archive, const gchar *dest);
-static gchar *archive_extract_zip(const gchar *archive, const gchar *dest);
-static gchar *archive_extract_tgz(const gchar *archive, const gchar *dest);
-static gchar *archive_extract_tbz2(const gchar *archive, const gchar *dest);
+static gboolean archive_extract_tar (const gchar * archive, const gchar * dest);
+static gboolean archive_extract_zip (const gchar * archive, const gchar * dest);
+static gboolean archive_extract_tbz2 (const gchar * archive, const gchar * dest);
 
+/* zlib reads plain tar files as well as gzipped ones */
 static ArchiveExtractFunc archive_extract_funcs[] = {
     NULL,
     NULL,
     archive_extract_tar,
-    archive_extract_tgz,
+    archive_extract_tar,
     archive_extract_zip,
     archive_extract_tbz2
 };
 
+/* no skin has any business containing more than this */
+#define ARCHIVE_MAX_MEMBER (16 << 20)
+
+/* Writes one archive member into the destination directory.  Like "unzip -j",
+ * any directories in the name are dropped; this also keeps members from
+ * being written outside of dest. */
+static gboolean archive_write_member (const gchar * dest, const gchar * name,
+ const void * data, gsize len)
+{
+    const gchar * base = strrchr (name, '/');
+    base = base ? base + 1 : name;
+
+    if (! base[0] || ! strcmp (base, ".") || ! strcmp (base, ".."))
+        return TRUE;
+
+    gchar * path = g_build_filename (dest, base, NULL);
+    GError * err = NULL;
+
+    if (! g_file_set_contents (path, data, len, & err))
+    {
+        AUDDBG ("Failed to write %s: %s\n", path, err->message);
+        g_error_free (err);
+        g_free (path);
+        return FALSE;
+    }
 
-/* FIXME: these functions can be generalised into a function using a
- * command lookup table */
+    g_free (path);
+    return TRUE;
+}
 
-static const gchar *get_tar_command(void)
+static gint64 tar_read_octal (const gchar * field, gint size)
 {
-    static const gchar *command = NULL;
+    gint64 value = 0;
 
-    if (!command)
+    for (gint i = 0; i < size && field[i]; i ++)
     {
-        if (!(command = getenv("TARCMD")))
-            command = "tar";
+        if (field[i] >= '0' && field[i] <= '7')
+            value = (value << 3) + (field[i] - '0');
+        else if (field[i] != ' ')
+            break;
     }
 
-    return command;
+    return value;
 }
 
-static const gchar *get_unzip_command(void)
+static gboolean archive_extract_tar (const gchar * archive, const gchar * dest)
 {
-    static const gchar *command = NULL;
+    gzFile file = gzopen (archive, "rb");
+    if (! file)
+    {
+        AUDDBG ("Failed to open %s\n", archive);
+        return FALSE;
+    }
+
+    gchar header[512];
+    gboolean success = FALSE;
 
-    if (!command)
+    while (gzread (file, header, 512) == 512)
     {
-        if (!(command = getenv("UNZIPCMD")))
-            command = "unzip";
+        if (! header[0])
+        {
+            success = TRUE; /* end of archive */
+            break;
+        }
+
+        gint64 size = tar_read_octal (header + 124, 12);
+        gint64 padded = (size + 511) & ~(gint64) 511;
+        gchar type = header[156];
+
+        if ((type != '0' && type != 0) || size > ARCHIVE_MAX_MEMBER)
+        {
+            if (padded && gzseek (file, padded, SEEK_CUR) < 0)
+                break;
+            continue;
+        }
+
+        /* ustar splits long names into a prefix and a name */
+        gchar name[257];
+        if (! memcmp (header + 257, "ustar", 5) && header[345])
+            snprintf (name, sizeof name, "%.155s/%.100s", header + 345, header);
+        else
+            snprintf (name, sizeof name, "%.100s", header);
+
+        gchar * data = g_malloc (padded);
+        gboolean ok = (gzread (file, data, padded) == padded) &&
+         archive_write_member (dest, name, data, size);
+        g_free (data);
+
+        if (! ok)
+            break;
     }
 
-    return command;
+    gzclose (file);
+    return success;
 }
 
+#define ZIP_U16(p) ((p)[0] | (p)[1] << 8)
+#define ZIP_U32(p) ((guint32) ZIP_U16 (p) | (guint32) ZIP_U16 ((p) + 2) << 16)
 
-static gchar *archive_extract_tar(const gchar *archive, const gchar *dest)
+static gboolean zip_inflate (const guchar * in, gsize in_len, guchar * out,
+ gsize out_len)
 {
-    return g_strdup_printf("%s >/dev/null xf \"%s\" -C %s", get_tar_command(),
-                           archive, dest);
+    z_stream stream;
+    memset (& stream, 0, sizeof stream);
+
+    /* zip members are raw deflate streams without a zlib header */
+    if (inflateInit2 (& stream, -MAX_WBITS) != Z_OK)
+        return FALSE;
+
+    stream.next_in = (Bytef *) in;
+    stream.avail_in = in_len;
+    stream.next_out = out;
+    stream.avail_out = out_len;
+
+    gint ret = inflate (& stream, Z_FINISH);
+    inflateEnd (& stream);
+
+    return (ret == Z_STREAM_END && stream.total_out == out_len);
 }
 
-static gchar *archive_extract_zip(const gchar *archive, const gchar *dest)
+static gboolean archive_extract_zip (const gchar * archive, const gchar * dest)
 {
-    return g_strdup_printf("%s >/dev/null -o -j \"%s\" -d %s",
-                           get_unzip_command(), archive, dest);
+    gchar * contents;
+    gsize len;
+    GError * err = NULL;
+
+    if (! g_file_get_contents (archive, & contents, & len, & err))
+    {
+        AUDDBG ("Failed to read %s: %s\n", archive, err->message);
+        g_error_free (err);
+        return FALSE;
+    }
+
+    const guchar * buf = (const guchar *) contents;
+    const guchar * end = NULL;
+
+    /* the end of central directory record sits before an optional comment */
+    for (gsize i = len >= 22 ? len - 22 : 0; len >= 22 && i + 65557 >= len; i --)
+    {
+        if (ZIP_U32 (buf + i) == 0x06054b50)
+        {
+            end = buf + i;
+            break;
+        }
+
+        if (! i)
+            break;
+    }
+
+    if (! end)
+    {
+        AUDDBG ("%s is not a zip archive\n", archive);
+        g_free (contents);
+        return FALSE;
+    }
+
+    gint entries = ZIP_U16 (end + 10);
+    gsize pos = ZIP_U32 (end + 16);
+    gboolean success = TRUE;
+
+    for (gint i = 0; i < entries && success; i ++)
+    {
+        if (pos + 46 > len || ZIP_U32 (buf + pos) != 0x02014b50)
+        {
+            success = FALSE;
+            break;
+        }
+
+        const guchar * entry = buf + pos;
+        gint method = ZIP_U16 (entry + 10);
+        gsize packed = ZIP_U32 (entry + 20);
+        gsize size = ZIP_U32 (entry + 24);
+        gint name_len = ZIP_U16 (entry + 28);
+        gsize local = ZIP_U32 (entry + 42);
+
+        pos += 46 + name_len + ZIP_U16 (entry + 30) + ZIP_U16 (entry + 32);
+
+        if (pos > len || local + 30 > len || ZIP_U32 (buf + local) != 0x04034b50)
+        {
+            success = FALSE;
+            break;
+        }
+
+        gchar * name = g_strndup ((const gchar *) entry + 46, name_len);
+        gsize data = local + 30 + ZIP_U16 (buf + local + 26) + ZIP_U16 (buf +
+         local + 28);
+
+        if (g_str_has_suffix (name, "/") || size > ARCHIVE_MAX_MEMBER)
+            ; /* directory, or not something a skin needs */
+        else if (data > len || packed > len - data)
+            success = FALSE;
+        else if (method == 0 && packed == size)
+            success = archive_write_member (dest, name, buf + data, size);
+        else if (method == 8)
+        {
+            guchar * out = g_malloc (MAX (size, 1));
+
+            if (zip_inflate (buf + data, packed, out, size))
+                success = archive_write_member (dest, name, out, size);
+            else
+                AUDDBG ("Failed to inflate %s in %s\n", name, archive);
+
+            g_free (out);
+        }
+        else
+            AUDDBG ("Skipping %s in %s (method %d)\n", name, archive, method);
+
+        g_free (name);
+    }
+
+    g_free (contents);
+    return success;
 }
 
-static gchar *archive_extract_tgz(const gchar *archive, const gchar *dest)
+/**
+ * Escapes characters that are special to the shell inside double quotes.
+ *
+ * @param string String to be escaped.
+ * @return Given string with special characters escaped. Must be freed with g_free().
+ */
+static gchar *
+escape_shell_chars(const gchar * string)
 {
-    return g_strdup_printf("%s >/dev/null xzf \"%s\" -C %s", get_tar_command(),
-                           archive, dest);
+    const gchar *special = "$`\"\\";    /* Characters to escape */
+    const gchar *in = string;
+    gchar *out, *escaped;
+    gint num = 0;
+
+    while (*in != '\0')
+        if (strchr(special, *in++))
+            num++;
+
+    escaped = g_malloc(strlen(string) + num + 1);
+
+    in = string;
+    out = escaped;
+
+    while (*in != '\0') {
+        if (strchr(special, *in))
+            *out++ = '\\';
+        *out++ = *in++;
+    }
+    *out = '\0';
+
+    return escaped;
 }
 
-static gchar *archive_extract_tbz2(const gchar *archive, const gchar *dest)
+/* bzip2 is rare enough for skins that it is still left to the command line
+ * tools */
+static gboolean archive_extract_tbz2 (const gchar * archive, const gchar * dest)
 {
-    return g_strdup_printf("bzip2 -dc \"%s\" | %s >/dev/null xf - -C %s",
-                           archive, get_tar_command(), dest);
+    const gchar * tar = getenv ("TARCMD");
+    gchar * escaped = escape_shell_chars (archive);
+    gchar * cmd = g_strdup_printf ("bzip2 -dc \"%s\" | %s >/dev/null xf - -C %s",
+     escaped, tar ? tar : "tar", dest);
+
+    AUDDBG ("Attempt to execute \"%s\"\n", cmd);
+
+    gboolean success = (system (cmd) == 0);
+    if (! success)
+        AUDDBG ("could not execute cmd %s\n", cmd);
+
+    g_free (escaped);
+    g_free (cmd);
+    return success;
 }
 
 
@@ -292,50 +505,16 @@ gchar *archive_basename(const gchar *str)
     return NULL;
 }
 
-/**
- * Escapes characters that are special to the shell inside double quotes.
- *
- * @param string String to be escaped.
- * @return Given string with special characters escaped. Must be freed with g_free().
- */
-static gchar *
-escape_shell_chars(const gchar * string)
-{
-    const gchar *special = "$`\"\\";    /* Characters to escape */
-    const gchar *in = string;
-    gchar *out, *escaped;
-    gint num = 0;
-
-    while (*in != '\0')
-        if (strchr(special, *in++))
-            num++;
-
-    escaped = g_malloc(strlen(string) + num + 1);
-
-    in = string;
-    out = escaped;
-
-    while (*in != '\0') {
-        if (strchr(special, *in))
-            *out++ = '\\';
-        *out++ = *in++;
-    }
-    *out = '\0';
-
-    return escaped;
-}
-
 /*
    decompress_archive
 
    Decompresses the archive "filename" to a temporary directory,
-   returns the path to the temp dir, or NULL if failed,
-   watch out tho, doesn't actually check if the system command succeeds :-|
+   returns the path to the temp dir, or NULL if failed.
 */
 
 gchar *archive_decompress(const gchar *filename)
 {
-    gchar *tmpdir, *cmd, *escaped_filename;
+    gchar *tmpdir;
     ArchiveType type;
 #ifndef HAVE_MKDTEMP
 #ifdef S_IRGRP
@@ -362,27 +541,14 @@ gchar *archive_decompress(const gchar *filename)
     make_directory(tmpdir, mode755);
 #endif
 
-    escaped_filename = escape_shell_chars(filename);
-    cmd = archive_extract_funcs[type] (escaped_filename, tmpdir);
-    g_free(escaped_filename);
-
-    if (!cmd)
+    if (! archive_extract_funcs[type] (filename, tmpdir))
     {
-        AUDDBG("extraction function is NULL!\n");
+        AUDDBG("Unable to extract %s\n", filename);
+        del_directory(tmpdir);
         g_free(tmpdir);
         return NULL;
     }
 
-    AUDDBG("Attempt to execute \"%s\"\n", cmd);
-
-    if (system(cmd) != 0)
-    {
-        AUDDBG("could not execute cmd %s\n", cmd);
-        g_free(cmd);
-        return NULL;
-    }
-    g_free(cmd);
-
     return tmpdir;
 }
 
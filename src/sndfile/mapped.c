@@ -0,0 +1,447 @@
+/*
+ * Memory-mapped PCM for the sndfile plugin
+ * Copyright (c) 2014 Audacious developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <audacious/plugin.h>
+#include <libaudcore/audstrings.h>
+
+#include "mapped.h"
+#include "../cpudispatch/cpudispatch.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define USE_X86
+#include <immintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#define USE_NEON
+#include <arm_neon.h>
+#endif
+
+struct MappedFile {
+    void * map;
+    int64_t map_size;
+
+    const unsigned char * data;
+    int64_t frames;
+    int frame_size;     /* bytes per frame in the file */
+    int channels;
+
+    int format;         /* what is handed to the output */
+    bool_t unpack24, big_endian;
+};
+
+static uint32_t get_le32 (const unsigned char * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t get_le16 (const unsigned char * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint64_t get_le64 (const unsigned char * p)
+{
+    return get_le32 (p) | ((uint64_t) get_le32 (p + 4) << 32);
+}
+
+static uint32_t get_be32 (const unsigned char * p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint16_t get_be16 (const unsigned char * p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+/* Sets the output format from the sample layout, or returns FALSE. */
+static bool_t choose_format (MappedFile * m, int bytes, bool_t is_float,
+ bool_t is_unsigned)
+{
+    if (is_float)
+    {
+        /* FMT_FLOAT is native endian */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        if (bytes != 4 || ! m->big_endian)
+#else
+        if (bytes != 4 || m->big_endian)
+#endif
+            return FALSE;
+
+        m->format = FMT_FLOAT;
+        return TRUE;
+    }
+
+    switch (bytes)
+    {
+    case 1:
+        m->format = is_unsigned ? FMT_U8 : FMT_S8;
+        return TRUE;
+    case 2:
+        m->format = m->big_endian ? FMT_S16_BE : FMT_S16_LE;
+        return TRUE;
+    case 3:
+        m->format = FMT_S32_NE;
+        m->unpack24 = TRUE;
+        return TRUE;
+    case 4:
+        m->format = m->big_endian ? FMT_S32_BE : FMT_S32_LE;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static bool_t parse_wav (MappedFile * m, const unsigned char * p, int64_t size)
+{
+    bool_t rf64 = ! memcmp (p, "RF64", 4);
+    int64_t ds64_data = -1;
+    bool_t have_fmt = FALSE;
+
+    for (int64_t pos = 12; pos + 8 <= size; )
+    {
+        const unsigned char * chunk = p + pos;
+        int64_t len = get_le32 (chunk + 4);
+
+        if (! memcmp (chunk, "ds64", 4) && len >= 16 && pos + 8 + 16 <= size)
+            ds64_data = get_le64 (chunk + 16);
+        else if (! memcmp (chunk, "fmt ", 4) && len >= 16 && pos + 8 + len <= size)
+        {
+            int tag = get_le16 (chunk + 8);
+            int channels = get_le16 (chunk + 10);
+            int align = get_le16 (chunk + 20);
+
+            /* WAVE_FORMAT_EXTENSIBLE carries the real tag in its GUID */
+            if (tag == 0xfffe && len >= 26)
+                tag = get_le16 (chunk + 32);
+
+            if ((tag != 1 && tag != 3) || channels != m->channels || ! align ||
+             align % channels)
+                return FALSE;
+
+            m->frame_size = align;
+            have_fmt = choose_format (m, align / channels, tag == 3,
+             align / channels == 1);
+            if (! have_fmt)
+                return FALSE;
+        }
+        else if (! memcmp (chunk, "data", 4))
+        {
+            if (! have_fmt)
+                return FALSE;
+
+            if (rf64 && len == 0xffffffff && ds64_data >= 0)
+                len = ds64_data;
+
+            m->data = chunk + 8;
+            m->frames = MIN (len, size - pos - 8) / m->frame_size;
+            return TRUE;
+        }
+
+        pos += 8 + len + (len & 1);
+    }
+
+    return FALSE;
+}
+
+static bool_t parse_aiff (MappedFile * m, const unsigned char * p, int64_t size)
+{
+    bool_t aifc = ! memcmp (p + 8, "AIFC", 4);
+    int64_t comm_frames = -1;
+
+    m->big_endian = TRUE;
+
+    for (int64_t pos = 12; pos + 8 <= size; )
+    {
+        const unsigned char * chunk = p + pos;
+        int64_t len = get_be32 (chunk + 4);
+
+        if (pos + 8 + len > size)
+            return FALSE;
+
+        if (! memcmp (chunk, "COMM", 4) && len >= 18)
+        {
+            int channels = get_be16 (chunk + 8);
+            int bits = get_be16 (chunk + 14);
+            bool_t is_float = FALSE;
+
+            if (aifc)
+            {
+                if (len < 22)
+                    return FALSE;
+
+                const unsigned char * type = chunk + 26;
+
+                if (! memcmp (type, "sowt", 4))
+                    m->big_endian = FALSE;
+                else if (! memcmp (type, "fl32", 4) || ! memcmp (type, "FL32", 4))
+                    is_float = TRUE;
+                else if (memcmp (type, "NONE", 4) && memcmp (type, "twos", 4))
+                    return FALSE;
+            }
+
+            if (channels != m->channels || bits < 1 || bits > 32)
+                return FALSE;
+
+            int bytes = (bits + 7) / 8;
+
+            /* samples are left-aligned, so odd depths play as the next one up */
+            if (! choose_format (m, bytes, is_float, FALSE))
+                return FALSE;
+
+            m->frame_size = bytes * channels;
+            comm_frames = get_be32 (chunk + 10);
+        }
+        else if (! memcmp (chunk, "SSND", 4) && len >= 8)
+        {
+            if (comm_frames < 0)
+                return FALSE;
+
+            int64_t offset = get_be32 (chunk + 8);
+            if (offset > len - 8)
+                return FALSE;
+
+            m->data = chunk + 16 + offset;
+            m->frames = MIN ((len - 8 - offset) / m->frame_size, comm_frames);
+            return TRUE;
+        }
+
+        pos += 8 + len + (len & 1);
+    }
+
+    return FALSE;
+}
+
+MappedFile * mapped_open (const char * filename, int channels)
+{
+    if (strncmp (filename, "file://", 7) || channels < 1)
+        return NULL;
+
+    char * path = uri_to_filename (filename);
+    if (! path)
+        return NULL;
+
+    int fd = open (path, O_RDONLY);
+    free (path);
+
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    void * map = MAP_FAILED;
+
+    /* a mapping that does not fit in the address space just falls back */
+    if (! fstat (fd, & st) && st.st_size >= 12 && (uint64_t) st.st_size <= SIZE_MAX)
+        map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close (fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    MappedFile * m = calloc (1, sizeof (MappedFile));
+    m->map = map;
+    m->map_size = st.st_size;
+    m->channels = channels;
+
+    const unsigned char * p = map;
+    bool_t ok = FALSE;
+
+    if ((! memcmp (p, "RIFF", 4) || ! memcmp (p, "RF64", 4)) && ! memcmp (p + 8, "WAVE", 4))
+        ok = parse_wav (m, p, m->map_size);
+    else if (! memcmp (p, "FORM", 4) && (! memcmp (p + 8, "AIFF", 4) ||
+     ! memcmp (p + 8, "AIFC", 4)))
+        ok = parse_aiff (m, p, m->map_size);
+
+    if (! ok || m->frames < 1)
+    {
+        mapped_close (m);
+        return NULL;
+    }
+
+    madvise (map, m->map_size, MADV_SEQUENTIAL);
+    return m;
+}
+
+void mapped_close (MappedFile * m)
+{
+    munmap (m->map, m->map_size);
+    free (m);
+}
+
+int mapped_format (MappedFile * m)
+{
+    return m->format;
+}
+
+int64_t mapped_frames (MappedFile * m)
+{
+    return m->frames;
+}
+
+/* packed 24-bit to the top of 32-bit samples */
+
+typedef void (* UnpackFunc) (const unsigned char * in, int32_t * out, int samples);
+
+static void unpack_le24_c (const unsigned char * in, int32_t * out, int samples)
+{
+    for (int i = 0; i < samples; i ++, in += 3)
+        out[i] = (int32_t) ((in[0] << 8) | (in[1] << 16) | ((uint32_t) in[2] << 24));
+}
+
+static void unpack_be24_c (const unsigned char * in, int32_t * out, int samples)
+{
+    for (int i = 0; i < samples; i ++, in += 3)
+        out[i] = (int32_t) ((in[2] << 8) | (in[1] << 16) | ((uint32_t) in[0] << 24));
+}
+
+#ifdef USE_X86
+
+/* Each 16-byte load covers four samples plus four bytes of the next; the
+ * loops stop short so that no load reaches past the last sample. */
+
+__attribute__ ((target ("ssse3")))
+static void unpack_le24_ssse3 (const unsigned char * in, int32_t * out, int samples)
+{
+    const __m128i shuf = _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+     -1, 9, 10, 11);
+    int i = 0;
+
+    for (; i + 6 <= samples; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (in + 3 * i));
+        _mm_storeu_si128 ((__m128i *) (out + i), _mm_shuffle_epi8 (v, shuf));
+    }
+
+    unpack_le24_c (in + 3 * i, out + i, samples - i);
+}
+
+__attribute__ ((target ("ssse3")))
+static void unpack_be24_ssse3 (const unsigned char * in, int32_t * out, int samples)
+{
+    const __m128i shuf = _mm_setr_epi8 (-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6,
+     -1, 11, 10, 9);
+    int i = 0;
+
+    for (; i + 6 <= samples; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (in + 3 * i));
+        _mm_storeu_si128 ((__m128i *) (out + i), _mm_shuffle_epi8 (v, shuf));
+    }
+
+    unpack_be24_c (in + 3 * i, out + i, samples - i);
+}
+
+#endif /* USE_X86 */
+
+#ifdef USE_NEON
+
+/* vld3 splits 16 samples into their low, middle and high bytes; zipping
+ * them back together with a zero byte gives the 32-bit samples. */
+
+static inline void unpack24_neon_block (uint8x16_t lo, uint8x16_t mid,
+ uint8x16_t hi, int32_t * out)
+{
+    uint8x16x2_t a = vzipq_u8 (vdupq_n_u8 (0), lo);
+    uint8x16x2_t b = vzipq_u8 (mid, hi);
+    uint16x8x2_t c = vzipq_u16 (vreinterpretq_u16_u8 (a.val[0]),
+     vreinterpretq_u16_u8 (b.val[0]));
+    uint16x8x2_t d = vzipq_u16 (vreinterpretq_u16_u8 (a.val[1]),
+     vreinterpretq_u16_u8 (b.val[1]));
+
+    vst1q_s32 (out, vreinterpretq_s32_u16 (c.val[0]));
+    vst1q_s32 (out + 4, vreinterpretq_s32_u16 (c.val[1]));
+    vst1q_s32 (out + 8, vreinterpretq_s32_u16 (d.val[0]));
+    vst1q_s32 (out + 12, vreinterpretq_s32_u16 (d.val[1]));
+}
+
+static void unpack_le24_neon (const unsigned char * in, int32_t * out, int samples)
+{
+    int i = 0;
+
+    for (; i + 16 <= samples; i += 16)
+    {
+        uint8x16x3_t v = vld3q_u8 (in + 3 * i);
+        unpack24_neon_block (v.val[0], v.val[1], v.val[2], out + i);
+    }
+
+    unpack_le24_c (in + 3 * i, out + i, samples - i);
+}
+
+static void unpack_be24_neon (const unsigned char * in, int32_t * out, int samples)
+{
+    int i = 0;
+
+    for (; i + 16 <= samples; i += 16)
+    {
+        uint8x16x3_t v = vld3q_u8 (in + 3 * i);
+        unpack24_neon_block (v.val[2], v.val[1], v.val[0], out + i);
+    }
+
+    unpack_be24_c (in + 3 * i, out + i, samples - i);
+}
+
+#endif /* USE_NEON */
+
+static UnpackFunc unpack_le24 = unpack_le24_c;
+static UnpackFunc unpack_be24 = unpack_be24_c;
+
+typedef struct {
+    CpuVariant variant;
+    UnpackFunc le24, be24;
+} UnpackSet;
+
+static const UnpackSet unpack_sets[] = {
+#if defined (USE_X86)
+ {{"ssse3", CPU_SSSE3}, unpack_le24_ssse3, unpack_be24_ssse3},
+#elif defined (USE_NEON)
+ {{"neon", CPU_NEON}, unpack_le24_neon, unpack_be24_neon},
+#endif
+ {{"c"}, unpack_le24_c, unpack_be24_c}};
+
+void mapped_init (void)
+{
+    const UnpackSet * set = CPU_DISPATCH ("sndfile unpack", unpack_sets);
+
+    unpack_le24 = set->le24;
+    unpack_be24 = set->be24;
+}
+
+const void * mapped_get (MappedFile * m, int64_t frame, int max, void * buf,
+ int * bytes)
+{
+    int frames = (frame < m->frames) ? MIN (max, m->frames - frame) : 0;
+    const unsigned char * in = m->data + frame * m->frame_size;
+
+    if (! m->unpack24)
+    {
+        * bytes = frames * m->frame_size;
+        return in;
+    }
+
+    (m->big_endian ? unpack_be24 : unpack_le24) (in, buf, frames * m->channels);
+    * bytes = frames * m->channels * sizeof (int32_t);
+    return buf;
+}
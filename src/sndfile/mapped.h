@@ -0,0 +1,51 @@
+/*
+ * Memory-mapped PCM for the sndfile plugin
+ * Copyright (c) 2014 Audacious developers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SNDFILE_MAPPED_H
+#define SNDFILE_MAPPED_H
+
+#include <stdint.h>
+
+#include <libaudcore/core.h>
+
+/* Uncompressed WAV (including RF64) and AIFF files on local disk are played
+ * straight out of a read-only mapping of the file rather than through
+ * libsndfile.  Samples already in a format the output accepts are written
+ * from the mapping as they are; packed 24-bit samples are unpacked to 32 bits
+ * on the way.  Anything else is left to libsndfile. */
+
+typedef struct MappedFile MappedFile;
+
+void mapped_init (void);
+
+/* Returns NULL if the file cannot be mapped or is not a format handled here.
+ * The channel count found must match what libsndfile reported. */
+MappedFile * mapped_open (const char * filename, int channels);
+void mapped_close (MappedFile * m);
+
+int mapped_format (MappedFile * m);
+int64_t mapped_frames (MappedFile * m);
+
+/* Returns up to max frames starting at frame, either as a pointer into the
+ * mapping or converted into buf, which must hold max frames of 32-bit
+ * samples.  Sets * bytes to the length of the data returned, 0 at the end. */
+const void * mapped_get (MappedFile * m, int64_t frame, int max, void * buf,
+ int * bytes);
+
+#endif
@@ -47,6 +47,8 @@
 #include <audacious/plugin.h>
 #include <audacious/i18n.h>
 
+#include "mapped.h"
+
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static int seek_value;
 static bool_t stop_flag;
@@ -300,10 +302,25 @@ static bool_t play_start (InputPlayback * playback, const char * filename,
     if (sndfile == NULL)
         return FALSE;
 
-    if (! playback->output->open_audio (FMT_FLOAT, sfinfo.samplerate,
-     sfinfo.channels))
+    /* uncompressed local files are played from a mapping of the file */
+    MappedFile * mapped = mapped_open (filename, sfinfo.channels);
+    int format = FMT_FLOAT;
+
+    if (mapped)
     {
         sf_close (sndfile);
+        sndfile = NULL;
+        format = mapped_format (mapped);
+    }
+
+    if (! playback->output->open_audio (format, sfinfo.samplerate,
+     sfinfo.channels))
+    {
+        if (mapped)
+            mapped_close (mapped);
+        else
+            sf_close (sndfile);
+
         return FALSE;
     }
 
@@ -316,8 +333,10 @@ static bool_t play_start (InputPlayback * playback, const char * filename,
     stop_flag = FALSE;
     playback->set_pb_ready(playback);
 
-    int size = sfinfo.channels * (sfinfo.samplerate / 50);
-    float * buffer = malloc (sizeof (float) * size);
+    /* 32-bit samples, whether float or unpacked from 24 bits */
+    int frames = sfinfo.samplerate / 50;
+    void * buffer = malloc (4 * sfinfo.channels * frames);
+    int64_t frame = 0;
 
     while (stop_time < 0 || playback->output->written_time () < stop_time)
     {
@@ -331,23 +350,40 @@ static bool_t play_start (InputPlayback * playback, const char * filename,
 
         if (seek_value != -1)
         {
-            sf_seek (sndfile, (int64_t) seek_value * sfinfo.samplerate / 1000,
-             SEEK_SET);
+            frame = (int64_t) seek_value * sfinfo.samplerate / 1000;
+
+            if (! mapped)
+                sf_seek (sndfile, frame, SEEK_SET);
+
             playback->output->flush (seek_value);
             seek_value = -1;
         }
 
         pthread_mutex_unlock (& mutex);
 
-        int samples = sf_read_float (sndfile, buffer, size);
+        const void * data = buffer;
+        int bytes;
 
-        if (! samples)
+        if (mapped)
+        {
+            data = mapped_get (mapped, frame, frames, buffer, & bytes);
+            frame += frames;
+        }
+        else
+            bytes = sizeof (float) * sfinfo.channels * sf_readf_float (sndfile,
+             buffer, frames);
+
+        if (! bytes)
             break;
 
-        playback->output->write_audio (buffer, sizeof (float) * samples);
+        playback->output->write_audio ((void *) data, bytes);
     }
 
-    sf_close (sndfile);
+    if (mapped)
+        mapped_close (mapped);
+    else
+        sf_close (sndfile);
+
     free (buffer);
 
     pthread_mutex_lock (& mutex);
@@ -393,6 +429,12 @@ static void file_mseek (InputPlayback * p, int time)
     pthread_mutex_unlock (& mutex);
 }
 
+static bool_t sndfile_init (void)
+{
+    mapped_init ();
+    return TRUE;
+}
+
 static int
 is_our_file_from_vfs(const char *filename, VFSFile *fin)
 {
@@ -435,6 +477,7 @@ AUD_INPUT_PLUGIN
     .name = N_("Sndfile Plugin"),
     .domain = PACKAGE,
     .about_text = plugin_about,
+    .init = sndfile_init,
     .play = play_start,
     .stop = play_stop,
     .pause = play_pause,
@@ -17,7 +17,6 @@
 
 #include <errno.h>
 #include <poll.h>
-#include <pthread.h>
 #include <sndio.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -30,6 +29,8 @@
 #include <libaudgui/libaudgui.h>
 #include <libaudgui/libaudgui-gtk.h>
 
+#include "../outcore/outcore.h"
+
 /*
  * minimum output buffer size in milliseconds
  */
@@ -45,12 +46,6 @@ void	sndio_get_volume(int *, int *);
 void	sndio_set_volume(int, int);
 bool_t	sndio_open(int, int, int);
 void	sndio_close(void);
-int	sndio_buffer_free(void);
-void    sndio_period_wait(void);
-void	sndio_write(void *, int);
-void	sndio_pause(bool_t);
-void	sndio_flush(int);
-int	sndio_output_time(void);
 
 void	onmove_cb(void *, int);
 void	onvol_cb(void *, unsigned);
@@ -61,10 +56,6 @@ static struct sio_par par;
 static struct sio_hdl *hdl;
 static long long rdpos;
 static long long wrpos;
-static int paused, restarted;
-static int pause_pending, flush_pending, volume_pending;
-static int bytes_per_sec;
-static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static GtkWidget *configure_win;
 static GtkWidget *adevice_entry;
@@ -79,13 +70,14 @@ AUD_OUTPUT_PLUGIN
 	.get_volume = sndio_get_volume,
 	.set_volume = sndio_set_volume,
 	.open_audio = sndio_open,
-	.write_audio = sndio_write,
+	.write_audio = outcore_write,
 	.close_audio = sndio_close,
-	.buffer_free = sndio_buffer_free,
-	.period_wait = sndio_period_wait,
-	.flush = sndio_flush,
-	.pause = sndio_pause,
-	.output_time = sndio_output_time
+	.buffer_free = outcore_buffer_free,
+	.period_wait = outcore_period_wait,
+	.drain = outcore_drain,
+	.flush = outcore_flush,
+	.pause = outcore_pause,
+	.output_time = outcore_output_time
 )
 
 static struct fmt_to_par {
@@ -105,15 +97,15 @@ static const gchar * const sndio_defaults[] = {
 	NULL,
 };
 
+/*
+ * the functions below are called by the output core, one at a time
+ */
 static void
 reset(void)
 {
-	if (!restarted) {
-		restarted = 1;
-		sio_stop(hdl);
-		sio_start(hdl);
-		rdpos = wrpos;
-	}
+	sio_stop(hdl);
+	sio_start(hdl);
+	rdpos = wrpos;
 }
 
 static void
@@ -122,39 +114,69 @@ wait_ready(void)
 	int n;
 	struct pollfd pfds[16];
 
-	if (volume_pending) {
-		sio_setvol(hdl, get_volume() * SIO_MAXVOL / 100);
-		volume_pending = 0;
-	}
-	if (flush_pending) {
-		reset();
-		flush_pending = 0;
-	}
-	if (pause_pending) {
-		if (paused)
-			reset();
-		pause_pending = 0;
-	}
-	if (paused) {
-		pthread_mutex_unlock(&mtx);
-		usleep(20000);
-		pthread_mutex_lock(&mtx);
-		return;
-	}
 	n = sio_pollfd(hdl, pfds, POLLOUT);
 	if (n != 0) {
-		pthread_mutex_unlock(&mtx);
 		while (poll(pfds, n, -1) < 0) {
 			if (errno != EINTR) {
 				perror("poll");
 				exit(1);
 			}
 		}
-		pthread_mutex_lock(&mtx);
 	}
 	(void)sio_revents(hdl, pfds);
 }
 
+static int
+write_device(const void *ptr, int length)
+{
+	unsigned n;
+
+	for (;;) {
+		n = sio_write(hdl, ptr, length);
+		if (n > 0) {
+			wrpos += n;
+			return n;
+		}
+		if (sio_eof(hdl))
+			return -1;
+		wait_ready();
+	}
+}
+
+static int
+device_delay(void)
+{
+	return (wrpos - rdpos) / (par.bps * par.pchan);
+}
+
+/*
+ * sndio cannot pause, so drop what the device holds; the output core
+ * keeps the time right.
+ */
+static void
+pause_device(bool_t flag)
+{
+	if (flag)
+		reset();
+}
+
+static const OutCoreOps sndio_ops = {
+	.name = "sndio",
+	.write = write_device,
+	.delay = device_delay,
+	.pause = pause_device,
+	.flush = reset
+};
+
+static void
+close_device(void)
+{
+	if (!hdl)
+		return;
+	sio_close(hdl);
+	hdl = NULL;
+}
+
 bool_t
 sndio_init(void)
 {
@@ -184,10 +206,11 @@ void
 sndio_set_volume(int l, int r)
 {
 	/* Ignore balance control, so use unattenuated channel. */
-	pthread_mutex_lock(&mtx);
 	set_volume(MAX(l, r));
-	volume_pending = 1;
-	pthread_mutex_unlock(&mtx);
+	outcore_lock_device();
+	if (hdl)
+		sio_setvol(hdl, get_volume() * SIO_MAXVOL / 100);
+	outcore_unlock_device();
 }
 
 bool_t
@@ -213,7 +236,7 @@ sndio_open(int fmt, int rate, int nch)
 	for (i = 0; ; i++) {
 		if (i == sizeof(fmt_to_par) / sizeof(struct fmt_to_par)) {
 			g_warning("unknown format %d requested", fmt);
-			sndio_close();
+			close_device();
 			return 0;
 		}
 		if (fmt_to_par[i].fmt == fmt)
@@ -234,7 +257,7 @@ sndio_open(int fmt, int rate, int nch)
 	askpar.appbufsz = buffer_size * rate / 1000;
 	if (!sio_setpar(hdl, &askpar) || !sio_getpar(hdl, &par)) {
 		g_warning("failed to set parameters");
-		sndio_close();
+		close_device();
 		return (0);
 	}
 	if ((par.bps > 1 && par.le != askpar.le) ||
@@ -249,7 +272,7 @@ sndio_open(int fmt, int rate, int nch)
 		    _("A format not supported by the audio device "
 		    "was requested.\n\n"
 		    "Please try again with the sndiod(1) server running."));
-		sndio_close();
+		close_device();
 		return (0);
 	}
 	rdpos = 0;
@@ -259,37 +282,14 @@ sndio_open(int fmt, int rate, int nch)
 	sio_setvol(hdl, get_volume() * SIO_MAXVOL / 100);
 	if (!sio_start(hdl)) {
 		g_warning("failed to start audio device");
-		sndio_close();
+		close_device();
 		return (0);
 	}
-	pause_pending = flush_pending = volume_pending = 0;
-	bytes_per_sec = par.bps * par.pchan * par.rate;
-	restarted = 1;
-	paused = 0;
-	return (1);
-}
-
-void
-sndio_write(void *ptr, int length)
-{
-	unsigned n;
-
-	pthread_mutex_lock(&mtx);
-	for (;;) {
-		if (paused)
-			break;
-		restarted = 0;
-		n = sio_write(hdl, ptr, length);
-		if (n == 0 && sio_eof(hdl))
-			return;
-		wrpos += n;
-		length -= n;
-		ptr = (char *)ptr + n;
-		if (length == 0)
-			break;
-		wait_ready();
+	if (!outcore_open(&sndio_ops, rate, par.bps * par.pchan, par.round)) {
+		close_device();
+		return (0);
 	}
-	pthread_mutex_unlock(&mtx);
+	return (1);
 }
 
 void
@@ -297,51 +297,8 @@ sndio_close(void)
 {
 	if (!hdl)
 		return;
-	sio_close(hdl);
-	hdl = NULL;
-}
-
-int
-sndio_buffer_free(void)
-{
-	return paused ? 0 : par.round * par.pchan * par.bps;
-}
-
-void
-sndio_period_wait(void)
-{
-	pthread_mutex_lock(&mtx);
-	wait_ready();
-	pthread_mutex_unlock(&mtx);
-}
-
-void
-sndio_flush(int time)
-{
-	pthread_mutex_lock(&mtx);
-	rdpos = wrpos = (long long)time * bytes_per_sec / 1000;
-	flush_pending = 1;
-	pthread_mutex_unlock(&mtx);
-}
-
-void
-sndio_pause(bool_t flag)
-{
-	pthread_mutex_lock(&mtx);
-	paused = flag;
-	pause_pending = 1;
-	pthread_mutex_unlock(&mtx);
-}
-
-int
-sndio_output_time(void)
-{
-	int time;
-
-	pthread_mutex_lock(&mtx);
-	time = rdpos * 1000 / bytes_per_sec;
-	pthread_mutex_unlock(&mtx);
-	return time;
+	outcore_close();
+	close_device();
 }
 
 void
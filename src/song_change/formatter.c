@@ -54,50 +54,129 @@ formatter_associate(Formatter * formatter, const guchar id, const gchar *value)
     formatter->values[id] = g_strdup(value);
 }
 
+void
+formatter_associate_escaped(Formatter * formatter, const guchar id, const gchar *value)
+{
+    formatter_associate(formatter, id, value);
+    formatter->escape[id] = TRUE;
+}
+
 void
 formatter_dissociate(Formatter * formatter, const guchar id)
 {
     if (formatter->values[id])
         g_free(formatter->values[id]);
     formatter->values[id] = 0;
+    formatter->escape[id] = FALSE;
 }
 
 gchar *
 formatter_format(Formatter * formatter, gchar *format)
 {
-    gchar *p, *q, *buffer;
-    gint len;
-
-    for (p = format, len = 0; *p; p++)
-        if (*p == '%') {
-            if (formatter->values[(int) *++p])
-                len += strlen(formatter->values[(int) *p]);
-            else if (!*p) {
-                len += 1;
-                p--;
-            }
-            else
-                len += 2;
+    FormatTemplate *tmpl = format_template_new(format);
+    gchar *buffer = g_strdup(format_template_render(tmpl, formatter));
+
+    format_template_destroy(tmpl);
+    return buffer;
+}
+
+static void
+add_token(GArray * tokens, guchar id, gint start, gint length)
+{
+    FormatToken token = {id, start, length};
+
+    /* merge runs of literal text */
+    if (!id && tokens->len) {
+        FormatToken *last = &g_array_index(tokens, FormatToken, tokens->len - 1);
+
+        if (!last->id && last->start + last->length == start) {
+            last->length += length;
+            return;
+        }
+    }
+
+    g_array_append_val(tokens, token);
+}
+
+FormatTemplate *
+format_template_new(const gchar *format)
+{
+    FormatTemplate *tmpl = g_slice_new(FormatTemplate);
+    GArray *tokens = g_array_new(FALSE, FALSE, sizeof(FormatToken));
+    const gchar *p;
+
+    tmpl->text = g_strdup(format ? format : "");
+
+    for (p = tmpl->text; *p; p++) {
+        if (*p != '%')
+            add_token(tokens, 0, p - tmpl->text, 1);
+        else if (!p[1])                         /* trailing % */
+            add_token(tokens, 0, p - tmpl->text, 1);
+        else if (p[1] == '%') {                 /* %% */
+            add_token(tokens, 0, p + 1 - tmpl->text, 1);
+            p++;
         }
-        else
-            len++;
-    buffer = g_malloc(len + 1);
-    for (p = format, q = buffer; *p; p++)
-        if (*p == '%') {
-            if (formatter->values[(int) *++p]) {
-                g_strlcpy(q, formatter->values[(int) *p], len - 1);
-                q += strlen(q);
-            }
-            else {
-                *q++ = '%';
-                if (*p != '\0')
-                    *q++ = *p;
-                else
-                    p--;
-            }
+        else {
+            add_token(tokens, (guchar) p[1], p - tmpl->text, 2);
+            p++;
+        }
+    }
+
+    tmpl->n_tokens = tokens->len;
+    tmpl->tokens = (FormatToken *) g_array_free(tokens, FALSE);
+    tmpl->buffer = g_string_sized_new(strlen(tmpl->text) + 256);
+
+    return tmpl;
+}
+
+void
+format_template_destroy(FormatTemplate * tmpl)
+{
+    if (!tmpl)
+        return;
+
+    g_free(tmpl->text);
+    g_free(tmpl->tokens);
+    g_string_free(tmpl->buffer, TRUE);
+    g_slice_free(FormatTemplate, tmpl);
+}
+
+static void
+append_escaped(GString * buffer, const gchar * value)
+{
+    const gchar *special = "$`\"\\";    /* Characters to escape */
+    const gchar *run = value;
+
+    for (; *value; value++) {
+        if (strchr(special, *value)) {
+            g_string_append_len(buffer, run, value - run);
+            g_string_append_c(buffer, '\\');
+            run = value;
         }
+    }
+
+    g_string_append_len(buffer, run, value - run);
+}
+
+const gchar *
+format_template_render(FormatTemplate * tmpl, Formatter * formatter)
+{
+    GString *buffer = tmpl->buffer;
+    gint i;
+
+    g_string_truncate(buffer, 0);
+
+    for (i = 0; i < tmpl->n_tokens; i++) {
+        FormatToken *token = &tmpl->tokens[i];
+        const gchar *value = token->id ? formatter->values[token->id] : NULL;
+
+        if (!value)     /* literal text, or an unknown code left as it is */
+            g_string_append_len(buffer, tmpl->text + token->start, token->length);
+        else if (formatter->escape[token->id])
+            append_escaped(buffer, value);
         else
-            *q++ = *p;
-    *q = 0;
-    return buffer;
+            g_string_append(buffer, value);
+    }
+
+    return buffer->str;
 }
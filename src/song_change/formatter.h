@@ -5,12 +5,35 @@
 
 typedef struct {
     gchar *values[256];
+    gboolean escape[256];
 } Formatter;
 
+/* A format string split up once into literal text and format codes, so that
+ * it can be filled in repeatedly without scanning it again. */
+typedef struct {
+    guchar id;              /* format code, or 0 for literal text */
+    gint start, length;     /* of the literal text within the template */
+} FormatToken;
+
+typedef struct {
+    gchar *text;
+    FormatToken *tokens;
+    gint n_tokens;
+    GString *buffer;        /* reused by every format_template_render() */
+} FormatTemplate;
+
 Formatter *formatter_new(void);
 void formatter_destroy(Formatter * formatter);
 void formatter_associate(Formatter * formatter, const guchar id, const gchar * value);
+/* Like formatter_associate(), but the value is escaped for use inside double
+ * quotes in a shell command as it is filled in. */
+void formatter_associate_escaped(Formatter * formatter, const guchar id, const gchar * value);
 void formatter_dissociate(Formatter * formatter, const guchar id);
 gchar *formatter_format(Formatter * formatter, gchar * format);
 
+FormatTemplate *format_template_new(const gchar * format);
+void format_template_destroy(FormatTemplate * tmpl);
+/* Returns a string owned by the template, valid until it is rendered again. */
+const gchar *format_template_render(FormatTemplate * tmpl, Formatter * formatter);
+
 #endif
@@ -7,7 +7,9 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
 #include <stdio.h>
 
@@ -47,6 +49,10 @@ static char *cmd_line_after = NULL;
 static char *cmd_line_end = NULL;
 static char *cmd_line_ttc = NULL;
 
+/* the command lines above, compiled */
+static FormatTemplate *tmpl_line, *tmpl_line_after, *tmpl_line_end, *tmpl_line_ttc;
+static Formatter *formatter;
+
 static GtkWidget *cmd_warn_label, *cmd_warn_img;
 
 AUD_GENERAL_PLUGIN
@@ -58,55 +64,169 @@ AUD_GENERAL_PLUGIN
     .cleanup = cleanup
 )
 
-/**
- * Escapes characters that are special to the shell inside double quotes.
- *
- * @param string String to be escaped.
- * @return Given string with special characters escaped. Must be freed with g_free().
- */
-static gchar *escape_shell_chars(const gchar * string)
+/* Commands are run one at a time.  While one is running, later requests wait
+ * in a queue holding at most one entry per hook, so that skipping quickly
+ * through a playlist runs the command for the latest song only. */
+
+#define COMMAND_TIMEOUT 30 /* seconds */
+
+typedef struct {
+    const char * source;  /* the configured command line this came from */
+    char * command;
+} PendingCommand;
+
+static GQueue pending = G_QUEUE_INIT;
+static pid_t running_pid;
+static int watch_source, timeout_source;
+
+extern char * * environ;
+
+static void run_next_command (void);
+
+/* A command needs the shell only if it uses more than quoting and escapes.
+ * The values substituted for format codes are escaped the same way by
+ * escape_shell_chars() either way. */
+static gboolean needs_shell (const char * cmd)
+{
+    return strpbrk (cmd, "|&;<>()$`*?[]{}~#=\n") != NULL;
+}
+
+static pid_t spawn_command (const char * cmd)
 {
-    const gchar *special = "$`\"\\";    /* Characters to escape */
-    const gchar *in = string;
-    gchar *out, *escaped;
-    gint num = 0;
+    char * sh_argv[4] = {"/bin/sh", "-c", (char *) cmd, NULL};
+    char * * argv = sh_argv;
+    char * * parsed = NULL;
+
+    if (! needs_shell (cmd) && g_shell_parse_argv (cmd, NULL, & parsed, NULL))
+        argv = parsed;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init (& actions);
+
+    /* We don't want this process to hog the audio device etc */
+    for (int fd = 3; fd < 255; fd ++)
+    {
+        int flags = fcntl (fd, F_GETFD);
+        if (flags >= 0 && ! (flags & FD_CLOEXEC))
+            posix_spawn_file_actions_addclose (& actions, fd);
+    }
 
-    while (*in != '\0')
-        if (strchr(special, *in++))
-            num++;
+    /* own process group, so that a timeout also stops whatever it started */
+    posix_spawnattr_t attr;
+    posix_spawnattr_init (& attr);
+    posix_spawnattr_setflags (& attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup (& attr, 0);
 
-    escaped = g_malloc(strlen(string) + num + 1);
+    pid_t pid;
+    int error = posix_spawnp (& pid, argv[0], & actions, & attr, argv, environ);
 
-    in = string;
-    out = escaped;
+    posix_spawnattr_destroy (& attr);
+    posix_spawn_file_actions_destroy (& actions);
 
-    while (*in != '\0') {
-        if (strchr(special, *in))
-            *out++ = '\\';
-        *out++ = *in++;
+    if (error)
+    {
+        fprintf (stderr, "song_change: Failed to run %s: %s\n", argv[0], strerror (error));
+        pid = 0;
     }
-    *out = '\0';
 
-    return escaped;
+    g_strfreev (parsed);
+    return pid;
 }
 
-static void bury_child(int signal)
+static void command_done (GPid pid, int status, void * unused)
 {
-    waitpid(-1, NULL, WNOHANG);
+    g_spawn_close_pid (pid);
+
+    if (timeout_source)
+    {
+        g_source_remove (timeout_source);
+        timeout_source = 0;
+    }
+
+    running_pid = 0;
+    watch_source = 0;
+    run_next_command ();
 }
 
-static void execute_command(char *cmd)
+static gboolean command_timeout (void * unused)
 {
-    char *argv[4] = {"/bin/sh", "-c", NULL, NULL};
-    int i;
-    argv[2] = cmd;
-    signal(SIGCHLD, bury_child);
-    if (fork() == 0)
+    fprintf (stderr, "song_change: Command still running after %d seconds; "
+     "stopping it.\n", COMMAND_TIMEOUT);
+
+    kill (- running_pid, SIGTERM);
+    timeout_source = 0;
+    return FALSE;
+}
+
+static void run_next_command (void)
+{
+    PendingCommand * item;
+
+    while (! running_pid && (item = g_queue_pop_head (& pending)))
+    {
+        running_pid = spawn_command (item->command);
+        g_free (item->command);
+        g_slice_free (PendingCommand, item);
+    }
+
+    if (running_pid)
+    {
+        watch_source = g_child_watch_add (running_pid, command_done, NULL);
+        timeout_source = g_timeout_add_seconds (COMMAND_TIMEOUT, command_timeout, NULL);
+    }
+}
+
+/* takes ownership of <cmd> */
+static void execute_command (const char * source, char * cmd)
+{
+    for (GList * node = pending.head; node; node = node->next)
+    {
+        PendingCommand * item = node->data;
+
+        if (item->source == source)
+        {
+            g_free (item->command);
+            item->command = cmd;
+            return;
+        }
+    }
+
+    PendingCommand * item = g_slice_new (PendingCommand);
+    item->source = source;
+    item->command = cmd;
+    g_queue_push_tail (& pending, item);
+
+    if (! running_pid)
+        run_next_command ();
+}
+
+static void clear_commands (void)
+{
+    PendingCommand * item;
+
+    while ((item = g_queue_pop_head (& pending)))
     {
-        /* We don't want this process to hog the audio device etc */
-        for (i = 3; i < 255; i++)
-            close(i);
-        execv("/bin/sh", argv);
+        g_free (item->command);
+        g_slice_free (PendingCommand, item);
+    }
+
+    if (watch_source)
+    {
+        g_source_remove (watch_source);
+        watch_source = 0;
+    }
+
+    if (timeout_source)
+    {
+        g_source_remove (timeout_source);
+        timeout_source = 0;
+    }
+
+    /* the last command is left to finish on its own; reap it if it already has */
+    if (running_pid)
+    {
+        waitpid (running_pid, NULL, WNOHANG);
+        running_pid = 0;
     }
 }
 
@@ -125,46 +245,31 @@ static void execute_command(char *cmd)
  *   b - album
  *   r - track title
  */
-/* do_command(): do @cmd after replacing the format codes
-   @cmd: command to run */
-static void do_command (char * cmd)
+/* do_command(): do @tmpl after filling in the format codes
+   @tmpl: compiled command to run */
+static void do_command (FormatTemplate * tmpl)
 {
     int playlist = aud_playlist_get_playing ();
     int pos = aud_playlist_get_position (playlist);
 
-    char *shstring = NULL, *temp, numbuf[32];
+    char numbuf[32];
     gboolean playing;
-    Formatter *formatter;
 
-    if (cmd && strlen(cmd) > 0)
+    if (tmpl && tmpl->n_tokens > 0)
     {
-        formatter = formatter_new();
+        if (! formatter)
+            formatter = formatter_new ();
 
         char * ctitle = aud_playlist_entry_get_title (playlist, pos, FALSE);
+        formatter_associate_escaped (formatter, 's', ctitle ? ctitle : "");
+        formatter_associate_escaped (formatter, 'n', ctitle ? ctitle : "");
         if (ctitle)
-        {
-            temp = escape_shell_chars (ctitle);
-            formatter_associate(formatter, 's', temp);
-            formatter_associate(formatter, 'n', temp);
-            g_free(temp);
             str_unref (ctitle);
-        }
-        else
-        {
-            formatter_associate(formatter, 's', "");
-            formatter_associate(formatter, 'n', "");
-        }
 
         char * filename = aud_playlist_entry_get_filename (playlist, pos);
+        formatter_associate_escaped (formatter, 'f', filename ? filename : "");
         if (filename)
-        {
-            temp = escape_shell_chars (filename);
-            formatter_associate(formatter, 'f', temp);
-            g_free(temp);
             str_unref (filename);
-        }
-        else
-            formatter_associate(formatter, 'f', "");
 
         g_snprintf(numbuf, sizeof(numbuf), "%02d", pos + 1);
         formatter_associate(formatter, 't', numbuf);
@@ -193,58 +298,54 @@ static void do_command (char * cmd)
             snprintf (numbuf, sizeof numbuf, "%d", chans);
             formatter_associate (formatter, 'c', numbuf);
         }
+        else
+        {
+            formatter_dissociate (formatter, 'r');
+            formatter_dissociate (formatter, 'F');
+            formatter_dissociate (formatter, 'c');
+        }
 
         Tuple * tuple = aud_playlist_entry_get_tuple
             (aud_playlist_get_active (), pos, 0);
 
         char * artist = tuple ? tuple_get_str (tuple, FIELD_ARTIST, NULL) : NULL;
+        formatter_associate (formatter, 'a', artist ? artist : "");
         if (artist)
-        {
-            formatter_associate(formatter, 'a', artist);
-            str_unref(artist);
-        }
-        else
-            formatter_associate(formatter, 'a', "");
+            str_unref (artist);
 
         char * album = tuple ? tuple_get_str (tuple, FIELD_ALBUM, NULL) : NULL;
+        formatter_associate (formatter, 'b', album ? album : "");
         if (album)
-        {
-            formatter_associate(formatter, 'b', album);
-            str_unref(album);
-        }
-        else
-            formatter_associate(formatter, 'b', "");
+            str_unref (album);
 
         char * title = tuple ? tuple_get_str (tuple, FIELD_TITLE, NULL) : NULL;
+        formatter_associate (formatter, 'T', title ? title : "");
         if (title)
-        {
-            formatter_associate(formatter, 'T', title);
-            str_unref(title);
-        }
-        else
-            formatter_associate(formatter, 'T', "");
+            str_unref (title);
 
         if (tuple)
             tuple_unref (tuple);
 
-        shstring = formatter_format(formatter, cmd);
-        formatter_destroy(formatter);
-
-        if (shstring)
-        {
-            execute_command(shstring);
-            /* FIXME: This can possibly be freed too early */
-            g_free(shstring);
-        }
+        execute_command (tmpl->text, g_strdup (format_template_render (tmpl, formatter)));
     }
 }
 
+/* replaces a command line and its compiled form; takes ownership of <value> */
+static void set_command (char * * cmd, FormatTemplate * * tmpl, char * value)
+{
+    g_free (* cmd);
+    * cmd = value;
+
+    format_template_destroy (* tmpl);
+    * tmpl = value ? format_template_new (value) : NULL;
+}
+
 static void read_config(void)
 {
-    cmd_line = aud_get_string("song_change", "cmd_line");
-    cmd_line_after = aud_get_string("song_change", "cmd_line_after");
-    cmd_line_end = aud_get_string("song_change", "cmd_line_end");
-    cmd_line_ttc = aud_get_string("song_change", "cmd_line_ttc");
+    set_command (& cmd_line, & tmpl_line, aud_get_string ("song_change", "cmd_line"));
+    set_command (& cmd_line_after, & tmpl_line_after, aud_get_string ("song_change", "cmd_line_after"));
+    set_command (& cmd_line_end, & tmpl_line_end, aud_get_string ("song_change", "cmd_line_end"));
+    set_command (& cmd_line_ttc, & tmpl_line_ttc, aud_get_string ("song_change", "cmd_line_ttc"));
 }
 
 static void cleanup(void)
@@ -262,15 +363,18 @@ static void cleanup(void)
         ttc_prevs = NULL;
     }
 
-    g_free(cmd_line);
-    g_free(cmd_line_after);
-    g_free(cmd_line_end);
-    g_free(cmd_line_ttc);
-    cmd_line = NULL;
-    cmd_line_after = NULL;
-    cmd_line_end = NULL;
-    cmd_line_ttc = NULL;
-    signal(SIGCHLD, SIG_DFL);
+    set_command (& cmd_line, & tmpl_line, NULL);
+    set_command (& cmd_line_after, & tmpl_line_after, NULL);
+    set_command (& cmd_line_end, & tmpl_line_end, NULL);
+    set_command (& cmd_line_ttc, & tmpl_line_ttc, NULL);
+
+    if (formatter)
+    {
+        formatter_destroy (formatter);
+        formatter = NULL;
+    }
+
+    clear_commands ();
 }
 
 static void save_and_close(gchar * cmd, gchar * cmd_after, gchar * cmd_end, gchar * cmd_ttc)
@@ -280,25 +384,10 @@ static void save_and_close(gchar * cmd, gchar * cmd_after, gchar * cmd_end, gcha
     aud_set_string("song_change", "cmd_line_end", cmd_end);
     aud_set_string("song_change", "cmd_line_ttc", cmd_ttc);
 
-    if (cmd_line != NULL)
-        g_free(cmd_line);
-
-    cmd_line = g_strdup(cmd);
-
-    if (cmd_line_after != NULL)
-        g_free(cmd_line_after);
-
-    cmd_line_after = g_strdup(cmd_after);
-
-    if (cmd_line_end != NULL)
-        g_free(cmd_line_end);
-
-    cmd_line_end = g_strdup(cmd_end);
-
-    if (cmd_line_ttc != NULL)
-        g_free(cmd_line_ttc);
-
-    cmd_line_ttc = g_strdup(cmd_ttc);
+    set_command (& cmd_line, & tmpl_line, g_strdup (cmd));
+    set_command (& cmd_line_after, & tmpl_line_after, g_strdup (cmd_after));
+    set_command (& cmd_line_end, & tmpl_line_end, g_strdup (cmd_end));
+    set_command (& cmd_line_ttc, & tmpl_line_ttc, g_strdup (cmd_ttc));
 }
 
 static int check_command(char *command)
@@ -335,12 +424,12 @@ static gboolean init (void)
 
 static void songchange_playback_begin(gpointer unused, gpointer unused2)
 {
-    do_command (cmd_line);
+    do_command (tmpl_line);
 }
 
 static void songchange_playback_end(gpointer unused, gpointer unused2)
 {
-    do_command (cmd_line_after);
+    do_command (tmpl_line_after);
 }
 
 #if 0
@@ -393,7 +482,7 @@ songchange_playback_ttc(gpointer plentry_gp, gpointer prevs_gp)
 
 static void songchange_playlist_eof(gpointer unused, gpointer unused2)
 {
-    do_command (cmd_line_end);
+    do_command (tmpl_line_end);
 }
 
 typedef struct {
@@ -30,6 +30,9 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../perfstat/perfstat.h"
+#include "../ratepref/ratepref.h"
+
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
@@ -39,6 +42,9 @@
 static const char * const sox_resampler_defaults[] = {
  "quality", "4", /* SOXR_HQ */
  "rate", "44100",
+ "phase-response", "0", /* SOXR_LINEAR_PHASE */
+ "steep-filter", "FALSE",
+ "multithread", "FALSE",
  NULL};
 
 static soxr_t soxr;
@@ -51,6 +57,7 @@ static size_t buffer_samples;
 bool_t sox_resampler_init (void)
 {
     aud_config_set_defaults ("soxr", sox_resampler_defaults);
+    ratepref_init ();
     return TRUE;
 }
 
@@ -68,15 +75,26 @@ void sox_resampler_start (int * channels, int * rate)
     soxr_delete (soxr);
     soxr = 0;
 
-    int new_rate = aud_get_int ("soxr", "rate");
+    /* converting to what the output runs at spares it converting again */
+    int new_rate = ratepref_get (aud_get_int ("soxr", "rate"));
     new_rate = CLAMP (new_rate, MIN_RATE, MAX_RATE);
 
+    /* passthrough: with no soxr instance, do_resample() leaves the audio alone */
     if (new_rate == * rate)
         return;
 
-    soxr_quality_spec_t q = soxr_quality_spec(aud_get_int ("soxr", "quality"), 0);
+    unsigned long recipe = aud_get_int ("soxr", "quality") |
+     aud_get_int ("soxr", "phase-response");
+
+    if (aud_get_bool ("soxr", "steep-filter"))
+        recipe |= SOXR_STEEP_FILTER;
+
+    soxr_quality_spec_t q = soxr_quality_spec (recipe, 0);
 
-    soxr = soxr_create((double) * rate, (double) new_rate, * channels, & error, NULL, & q, NULL);
+    /* zero threads lets soxr use one per core */
+    soxr_runtime_spec_t r = soxr_runtime_spec (aud_get_bool ("soxr", "multithread") ? 0 : 1);
+
+    soxr = soxr_create((double) * rate, (double) new_rate, * channels, & error, NULL, & q, & r);
 
     if (error)
     {
@@ -144,19 +162,35 @@ static const ComboBoxElements method_list[] = {
  {"4", N_("High")}, /* SOXR_QH */
  {"6", N_("Very High")}}; /* SOXR_VHQ */
 
+static const ComboBoxElements phase_list[] = {
+ {"0", N_("Linear")}, /* SOXR_LINEAR_PHASE */
+ {"16", N_("Intermediate")}, /* SOXR_INTERMEDIATE_PHASE */
+ {"48", N_("Minimum")}}; /* SOXR_MINIMUM_PHASE */
+
 static const PreferencesWidget sox_resampler_widgets[] = {
  {WIDGET_COMBO_BOX, N_("Quality:"),
   .cfg_type = VALUE_STRING, .csect = "soxr", .cname = "quality",
   .data = {.combo = {method_list, sizeof method_list / sizeof method_list[0]}}},
  {WIDGET_SPIN_BTN, N_("Rate:"),
   .cfg_type = VALUE_INT, .csect = "soxr", .cname = "rate",
-  .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}}
+  .data = {.spin_btn = {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}}},
+ {WIDGET_CHK_BTN, N_("Use the output's native rate when known"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "ratepref", .cname = "match_output"},
+ {WIDGET_COMBO_BOX, N_("Phase response:"),
+  .cfg_type = VALUE_STRING, .csect = "soxr", .cname = "phase-response",
+  .data = {.combo = {phase_list, sizeof phase_list / sizeof phase_list[0]}}},
+ {WIDGET_CHK_BTN, N_("Steep filter"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "soxr", .cname = "steep-filter"},
+ {WIDGET_CHK_BTN, N_("Use multiple threads"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "soxr", .cname = "multithread"}
 };
 
 static const PluginPreferences sox_resampler_prefs = {
  .widgets = sox_resampler_widgets,
  .n_widgets = sizeof sox_resampler_widgets / sizeof sox_resampler_widgets[0]};
 
+PERFSTAT_EFFECT (N_("SoX Resampler"), sox_resampler_start, sox_resampler_process, sox_resampler_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("SoX Resampler"),
@@ -165,9 +199,9 @@ AUD_EFFECT_PLUGIN
     .prefs = & sox_resampler_prefs,
     .init = sox_resampler_init,
     .cleanup = sox_resampler_cleanup,
-    .start = sox_resampler_start,
-    .process = sox_resampler_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = sox_resampler_flush,
-    .finish = sox_resampler_finish,
+    .finish = perfstat_finish,
     .order = 2 /* must be before crossfade */
 )
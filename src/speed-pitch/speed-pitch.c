@@ -21,6 +21,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <samplerate.h>
 
 #include <audacious/i18n.h>
@@ -28,6 +32,8 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../perfstat/perfstat.h"
+
 /* The general idea of the speed change algorithm is to divide the input signal
  * into pieces, spaced at a time interval A, using a cosine-shaped window
  * function.  The pieces are then reassembled by adding them together again,
@@ -35,11 +41,20 @@
  * speed of the audio.  To get better results at the two ends of a song, we add
  * a short period of silence (half the width of the cosine window, to be exact)
  * to each end of the input signal beforehand and afterwards trim the same
- * amount from each end of the output signal. */
+ * amount from each end of the output signal.
+ *
+ * In WSOLA mode, each piece is not taken exactly at its nominal position but
+ * anywhere within SEEK_TIME of it, wherever it best matches the audio that
+ * would naturally have followed the previous piece.  The pieces then add up in
+ * phase, which avoids most of the "phasiness" of the plain method, especially
+ * on speech. */
 
 #define FREQ    10
 #define OVERLAP  3
 
+#define SEEK_TIME 0.01 /* seconds */
+#define SEEK_STEP 4 /* frames, for the coarse search */
+
 #define CFGSECT "speed-pitch"
 #define MINSPEED 0.5
 #define MAXSPEED 2.0
@@ -49,50 +64,95 @@
 #define BYTES(frames) ((frames) * curchans * sizeof (float))
 #define OFFSET(buf,frames) ((buf) + (frames) * curchans)
 
+/* Buffers are cut from the front by moving a start offset; their contents
+ * are moved back to the beginning only when they run into the end of the
+ * allocated memory. */
 typedef struct {
     float * mem;
-    int size, len;
+    int size, start, len;
 } Buffer;
 
+#define BUFDATA(b) OFFSET ((b)->mem, (b)->start)
+
 static int curchans, currate;
 static SRC_STATE * srcstate;
-static int outstep, width;
-static double * cosine;
+static int outstep, width, seek, corrlen;
+static float * cosine; /* one value per sample, not per frame */
 static Buffer in, out;
+static int insrc, inref;
 static int trim, written;
 static bool_t ending;
 
-static void bufgrow (Buffer * b, int len)
+/* settings snapshot, updated when the settings change */
+static double cfg_speed, cfg_pitch;
+static bool_t cfg_wsola;
+
+/* At speed and pitch 1 the audio is passed through untouched.  Switching to
+ * that mid-song first returns everything still buffered, as at the end of a
+ * song; switching back starts over as at the beginning of one, so no audio is
+ * lost or repeated either way. */
+static bool_t bypass;
+
+static void speed_update_config (void)
+{
+    cfg_speed = aud_get_double (CFGSECT, "speed");
+    cfg_pitch = aud_get_double (CFGSECT, "pitch");
+    cfg_wsola = aud_get_bool (CFGSECT, "wsola");
+}
+
+static bool_t is_neutral (void)
 {
+    return cfg_speed == 1 && cfg_pitch == 1;
+}
+
+static void bufreserve (Buffer * b, int len)
+{
+    if (b->start + len <= b->size)
+        return;
+
+    if (b->start)
+    {
+        memmove (b->mem, BUFDATA (b), BYTES (b->len));
+        b->start = 0;
+    }
+
     if (len > b->size)
     {
         b->mem = realloc (b->mem, BYTES (len));
         b->size = len;
     }
+}
+
+static void bufgrow (Buffer * b, int len)
+{
+    bufreserve (b, len);
 
     if (len > b->len)
     {
-        memset (OFFSET (b->mem, b->len), 0, BYTES (len - b->len));
+        memset (OFFSET (BUFDATA (b), b->len), 0, BYTES (len - b->len));
         b->len = len;
     }
 }
 
 static void bufcut (Buffer * b, int len)
 {
-    memmove (b->mem, OFFSET (b->mem, len), BYTES (b->len - len));
+    b->start += len;
     b->len -= len;
+
+    if (! b->len)
+        b->start = 0;
 }
 
 static void bufadd (Buffer * b, float * data, int len, double ratio)
 {
     int oldlen = b->len;
     int max = len * ratio + 100;
-    bufgrow (b, oldlen + max);
+    bufreserve (b, oldlen + max);
 
     SRC_DATA d = {
      .data_in = data,
      .input_frames = len,
-     .data_out = OFFSET (b->mem, oldlen),
+     .data_out = OFFSET (BUFDATA (b), oldlen),
      .output_frames = max,
      .src_ratio = ratio};
 
@@ -100,21 +160,126 @@ static void bufadd (Buffer * b, float * data, int len, double ratio)
     b->len = oldlen + d.output_frames_gen;
 }
 
-static void speed_flush (void)
+/* out[i] += in[i] * window[i] */
+static void overlap_add (float * out, const float * in, const float * window, int samples)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128 prod = _mm_mul_ps (_mm_loadu_ps (in + i), _mm_loadu_ps (window + i));
+        _mm_storeu_ps (out + i, _mm_add_ps (_mm_loadu_ps (out + i), prod));
+    }
+#endif
+
+    for (; i < samples; i ++)
+        out[i] += in[i] * window[i];
+}
+
+/* Returns the dot product of a and b; the energy of a goes in energy. */
+static float correlate (const float * a, const float * b, int samples, float * energy)
+{
+    float ab = 0, aa = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    __m128 vab = _mm_setzero_ps ();
+    __m128 vaa = _mm_setzero_ps ();
+
+    for (; i + 4 <= samples; i += 4)
+    {
+        __m128 va = _mm_loadu_ps (a + i);
+        vab = _mm_add_ps (vab, _mm_mul_ps (va, _mm_loadu_ps (b + i)));
+        vaa = _mm_add_ps (vaa, _mm_mul_ps (va, va));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps (lanes, vab);
+    ab = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm_storeu_ps (lanes, vaa);
+    aa = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+
+    for (; i < samples; i ++)
+    {
+        ab += a[i] * b[i];
+        aa += a[i] * a[i];
+    }
+
+    * energy = aa;
+    return ab;
+}
+
+static float match_score (int pos, const float * ref)
+{
+    float energy;
+    float dot = correlate (OFFSET (BUFDATA (& in), pos), ref, corrlen * curchans, & energy);
+    return energy > 0 ? dot / sqrtf (energy) : 0;
+}
+
+/* Finds the offset from src, within +/- seek frames (and within the input
+ * buffer), at which the input best matches the audio at ref.  A coarse search
+ * is refined around its best result. */
+static int wsola_search (int src, int ref)
+{
+    const float * refdata = OFFSET (BUFDATA (& in), ref);
+    int lo = MAX (-seek, -src);
+    int hi = MIN (seek, in.len - width - src);
+    int best = 0;
+    float best_score = -INFINITY;
+
+    for (int d = lo; d <= hi; d += SEEK_STEP)
+    {
+        float score = match_score (src + d, refdata);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = d;
+        }
+    }
+
+    int coarse = best;
+
+    for (int d = MAX (lo, coarse - SEEK_STEP + 1); d <= MIN (hi, coarse + SEEK_STEP - 1); d ++)
+    {
+        if (d == coarse)
+            continue;
+
+        float score = match_score (src + d, refdata);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = d;
+        }
+    }
+
+    return best;
+}
+
+static void speed_reset (void)
 {
     src_reset (srcstate);
 
-    in.len = 0;
-    out.len = 0;
+    in.start = in.len = 0;
+    out.start = out.len = 0;
 
     /* Add silence to the beginning of the input signal. */
     bufgrow (& in, width / 2);
 
+    insrc = 0;
+    inref = -1;
     trim = width / 2;
     written = 0;
     ending = FALSE;
 }
 
+static void speed_flush (void)
+{
+    speed_reset ();
+    bypass = is_neutral ();
+}
+
 static void speed_start (int * chans, int * rate)
 {
     curchans = * chans;
@@ -130,19 +295,36 @@ static void speed_start (int * chans, int * rate)
     outstep = currate / FREQ;
     width = outstep * OVERLAP;
 
+    seek = currate * SEEK_TIME;
+    corrlen = outstep / 2;
+
     /* Generate the cosine window, scaled vertically to compensate for the
-     * overlap of the reassembled pieces of audio. */
-    cosine = realloc (cosine, width * sizeof (double));
+     * overlap of the reassembled pieces of audio.  It is repeated for each
+     * channel so that the overlap-add is one flat loop. */
+    cosine = realloc (cosine, BYTES (width));
     for (int i = 0; i < width; i ++)
-        cosine[i] = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
+    {
+        float value = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
+        for (int c = 0; c < curchans; c ++)
+            OFFSET (cosine, i)[c] = value;
+    }
+
+    /* Reserve enough room up front that the buffers do not need to grow while
+     * playing, except for unusually large blocks of input. */
+    int room = 2 * (width + seek) * MAXSPEED / MINPITCH + currate;
+    in.start = in.len = 0;
+    out.start = out.len = 0;
+    bufreserve (& in, room);
+    bufreserve (& out, room);
 
     speed_flush ();
 }
 
-static void speed_process (float * * data, int * samples)
+static void speed_run (float * * data, int * samples)
 {
-    double pitch = aud_get_double (CFGSECT, "pitch");
-    double speed = aud_get_double (CFGSECT, "speed");
+    double pitch = cfg_pitch;
+    double speed = cfg_speed;
+    bool_t wsola = cfg_wsola;
 
     /* Remove audio that has already been played from the output buffer. */
     bufcut (& out, written);
@@ -157,25 +339,47 @@ static void speed_process (float * * data, int * samples)
     /* Calculate the spacing interval for input. */
     int instep = round (outstep * speed / pitch);
 
+    /* WSOLA needs room to look ahead of the nominal position, except at the
+     * end, where the search is limited to what is left. */
+    int lookahead = (wsola && ! ending) ? seek : 0;
+
     /* Run the speed change algorithm. */
-    int src = 0;
+    int src = insrc;
     int dst = 0;
 
-    while (src + MAX (width, instep) <= in.len)
+    while (src + lookahead + MAX (width, instep) <= in.len)
     {
+        int pos = src;
+
+        if (wsola && inref >= 0 && inref + corrlen <= in.len)
+            pos += wsola_search (src, inref);
+
         bufgrow (& out, dst + width);
         out.len = dst + width;
 
-        for (int i = 0; i < width; i ++)
-        for (int c = 0; c < curchans; c ++)
-            OFFSET (out.mem, dst + i)[c] += OFFSET (in.mem, src + i)[c] * cosine[i];
+        overlap_add (OFFSET (BUFDATA (& out), dst), OFFSET (BUFDATA (& in), pos),
+         cosine, width * curchans);
 
+        inref = pos + outstep;
         src += instep;
         dst += outstep;
     }
 
-    /* Remove processed audio from the input buffer. */
-    bufcut (& in, src);
+    /* Remove processed audio from the input buffer, keeping what the next
+     * search may need. */
+    int cut = src;
+
+    if (wsola)
+    {
+        cut = MAX (0, cut - seek);
+        if (inref >= 0)
+            cut = MIN (cut, inref);
+    }
+
+    bufcut (& in, cut);
+    insrc = src - cut;
+    if (inref >= 0)
+        inref -= cut;
 
     /* Trim silence from the beginning of the output buffer. */
     if (trim > 0)
@@ -193,42 +397,72 @@ static void speed_process (float * * data, int * samples)
 
     /* Return processed audio in the output buffer and mark it to be removed on
      * the next call. */
-    * data = out.mem;
+    * data = BUFDATA (& out);
     * samples = dst * curchans;
     written = dst;
 }
 
+static void speed_process (float * * data, int * samples)
+{
+    if (bypass)
+    {
+        if (is_neutral ())
+            return;
+
+        speed_reset ();
+        bypass = FALSE;
+    }
+    else if (is_neutral () && ! ending)
+    {
+        ending = TRUE;
+        speed_run (data, samples);
+        ending = FALSE;
+        bypass = TRUE;
+        return;
+    }
+
+    speed_run (data, samples);
+}
+
 static void speed_finish (float * * data, int * samples)
 {
     /* Ignore the second "end of playlist" call since we are not in a state to
      * handle it properly. */
-    if (! ending)
+    if (! bypass && ! ending)
     {
         ending = TRUE;
-        speed_process (data, samples);
+        speed_run (data, samples);
     }
 }
 
 static int speed_adjust_delay (int delay)
 {
+    if (bypass)
+        return delay;
+
     /* Not sample-accurate, but should be a decent estimate. */
-    double speed = aud_get_double (CFGSECT, "speed");
-    return delay * speed + width * 1000 / currate;
+    return delay * cfg_speed + (width + seek) * 1000 / currate;
 }
 
 static const char * const speed_defaults[] = {
  "speed", "1",
  "pitch", "1",
+ "wsola", "FALSE",
  NULL};
 
 static const PreferencesWidget speed_widgets[] = {
  {WIDGET_LABEL, N_("<b>Speed and Pitch</b>")},
  {WIDGET_SPIN_BTN, N_("Speed:"),
   .cfg_type = VALUE_FLOAT, .csect = CFGSECT, .cname = "speed",
+  .callback = speed_update_config,
   .data = {.spin_btn = {MINSPEED, MAXSPEED, 0.05}}},
  {WIDGET_SPIN_BTN, N_("Pitch:"),
   .cfg_type = VALUE_FLOAT, .csect = CFGSECT, .cname = "pitch",
-  .data = {.spin_btn = {MINPITCH, MAXPITCH, 0.05}}}};
+  .callback = speed_update_config,
+  .data = {.spin_btn = {MINPITCH, MAXPITCH, 0.05}}},
+ {WIDGET_CHK_BTN, N_("Match waveforms (WSOLA, better for speech)"),
+  .cfg_type = VALUE_BOOLEAN, .csect = CFGSECT, .cname = "wsola",
+  .callback = speed_update_config}};
 
 static const PluginPreferences speed_prefs = {
  .widgets = speed_widgets,
@@ -237,6 +471,7 @@ static const PluginPreferences speed_prefs = {
 static bool_t speed_init (void)
 {
     aud_config_set_defaults (CFGSECT, speed_defaults);
+    speed_update_config ();
     return TRUE;
 }
 
@@ -252,13 +487,15 @@ static void speed_cleanup (void)
 
     free (in.mem);
     in.mem = NULL;
-    in.size = 0;
+    in.size = in.start = in.len = 0;
 
     free (out.mem);
     out.mem = NULL;
-    out.size = 0;
+    out.size = out.start = out.len = 0;
 }
 
+PERFSTAT_EFFECT (N_("Speed and Pitch"), speed_start, speed_process, speed_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Speed and Pitch"),
@@ -266,10 +503,10 @@ AUD_EFFECT_PLUGIN
     .prefs = & speed_prefs,
     .init = speed_init,
     .cleanup = speed_cleanup,
-    .start = speed_start,
-    .process = speed_process,
+    .start = perfstat_start,
+    .process = perfstat_process,
     .flush = speed_flush,
-    .finish = speed_finish,
+    .finish = perfstat_finish,
     .adjust_delay = speed_adjust_delay,
     .preserves_format = TRUE
 )
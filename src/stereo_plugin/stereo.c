@@ -7,7 +7,10 @@
 #include <audacious/plugin.h>
 #include <audacious/preferences.h>
 
+#include "../perfstat/perfstat.h"
+
 static bool_t init (void);
+static void stereo_update_config (void);
 
 static void stereo_start (int * channels, int * rate);
 static void stereo_process (float * * data, int * samples);
@@ -25,12 +28,15 @@ static const PreferencesWidget stereo_widgets[] = {
  {WIDGET_LABEL, N_("<b>Extra Stereo</b>")},
  {WIDGET_SPIN_BTN, N_("Intensity:"),
   .cfg_type = VALUE_FLOAT, .csect = "extra_stereo", .cname = "intensity",
+  .callback = stereo_update_config,
   .data = {.spin_btn = {0, 10, 0.1}}}};
 
 static const PluginPreferences stereo_prefs = {
  .widgets = stereo_widgets,
  .n_widgets = sizeof stereo_widgets / sizeof stereo_widgets[0]};
 
+PERFSTAT_EFFECT (N_("Extra Stereo"), stereo_start, stereo_process, stereo_finish)
+
 AUD_EFFECT_PLUGIN
 (
     .name = N_("Extra Stereo"),
@@ -38,42 +44,65 @@ AUD_EFFECT_PLUGIN
     .about_text = stereo_about,
     .prefs = & stereo_prefs,
     .init = init,
-    .start = stereo_start,
-    .process = stereo_process,
-    .finish = stereo_finish,
+    .start = perfstat_start,
+    .process = perfstat_process,
+    .finish = perfstat_finish,
     .preserves_format = TRUE
 )
 
+static int stereo_channels;
+
+/* An intensity of 1 leaves the audio as it is, and the block is passed through
+ * without being touched.  When the setting changes, the intensity glides from
+ * the old value to the new one over the next block. */
+static float target_value, current_value;
+
+static void stereo_update_config (void)
+{
+    target_value = aud_get_double ("extra_stereo", "intensity");
+}
+
 static bool_t init (void)
 {
     aud_config_set_defaults ("extra_stereo", stereo_defaults);
+    stereo_update_config ();
+    current_value = target_value;
     return TRUE;
 }
 
-static int stereo_channels;
-
 static void stereo_start (int * channels, int * rate)
 {
     stereo_channels = * channels;
+    current_value = target_value;
 }
 
 static void stereo_process (float * * data, int * samples)
 {
-    float value = aud_get_double ("extra_stereo", "intensity");
+    float target = target_value;
+    float value = current_value;
     float * f, * end;
     float center;
 
-    if (stereo_channels != 2 || samples == 0)
+    if (stereo_channels != 2 || * samples < 2)
+        return;
+
+    if (value == target && value == 1)
         return;
 
     end = (* data) + (* samples);
 
+    /* zero unless the intensity is gliding */
+    float step = (target - value) / (* samples / 2);
+
     for (f = * data; f < end; f += 2)
     {
         center = (f[0] + f[1]) / 2;
         f[0] = center + (f[0] - center) * value;
         f[1] = center + (f[1] - center) * value;
+        value += step;
     }
+
+    current_value = target;
 }
 
 static void stereo_finish (float * * data, int * samples)
@@ -0,0 +1,226 @@
+/*
+ * Stereo Tools Plugin for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Based on the Crystalizer, Extra Stereo and Voice Removal plugins:
+ * Copyright 1999 Johan Levin
+ * Copyright 2008-2010 William Pitcock
+ * Copyright 2009-2012 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Does the work of the Crystalizer, Extra Stereo and Voice Removal plugins, in
+ * that order, in a single pass over the audio.  Each stereo frame is sharpened
+ * and split into mid (L + R) / 2 and side (L - R) / 2; widening scales the
+ * side by the intensity, and voice removal drops the mid and inverts what is
+ * left, which comes out the same as running the separate plugins in turn:
+ *
+ *     left = a * mid + b * side, right = a * mid - b * side
+ *
+ * with a = 1, b = intensity normally, or a = 0, b = -2 * intensity with voice
+ * removal.  The settings are read once per block.  Widening and voice removal
+ * only apply to stereo; sharpening works with any number of channels. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include <audacious/i18n.h>
+#include <audacious/misc.h>
+#include <audacious/plugin.h>
+#include <audacious/preferences.h>
+
+#include "../perfstat/perfstat.h"
+
+static const char * const tools_defaults[] = {
+ "crystalizer", "FALSE",
+ "crystalizer_intensity", "1",
+ "extra_stereo", "TRUE",
+ "extra_stereo_intensity", "2.5",
+ "voice_removal", "FALSE",
+ NULL};
+
+static const PreferencesWidget tools_widgets[] = {
+ {WIDGET_LABEL, N_("<b>Stereo Tools</b>")},
+ {WIDGET_CHK_BTN, N_("Crystalizer"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "stereo_tools", .cname = "crystalizer"},
+ {WIDGET_SPIN_BTN, N_("Intensity:"), .child = TRUE,
+  .cfg_type = VALUE_FLOAT, .csect = "stereo_tools", .cname = "crystalizer_intensity",
+  .data = {.spin_btn = {0, 10, 0.1}}},
+ {WIDGET_CHK_BTN, N_("Extra stereo"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "stereo_tools", .cname = "extra_stereo"},
+ {WIDGET_SPIN_BTN, N_("Intensity:"), .child = TRUE,
+  .cfg_type = VALUE_FLOAT, .csect = "stereo_tools", .cname = "extra_stereo_intensity",
+  .data = {.spin_btn = {0, 10, 0.1}}},
+ {WIDGET_CHK_BTN, N_("Voice removal"),
+  .cfg_type = VALUE_BOOLEAN, .csect = "stereo_tools", .cname = "voice_removal"}};
+
+static const PluginPreferences tools_prefs = {
+ .widgets = tools_widgets,
+ .n_widgets = sizeof tools_widgets / sizeof tools_widgets[0]};
+
+static int tools_channels;
+static float * tools_prev; /* last input sample of each channel */
+
+static bool_t tools_init (void)
+{
+    aud_config_set_defaults ("stereo_tools", tools_defaults);
+    return TRUE;
+}
+
+static void tools_cleanup (void)
+{
+    free (tools_prev);
+    tools_prev = NULL;
+}
+
+static void tools_start (int * channels, int * rate)
+{
+    tools_channels = * channels;
+    tools_prev = realloc (tools_prev, sizeof (float) * tools_channels);
+    memset (tools_prev, 0, sizeof (float) * tools_channels);
+}
+
+static void sharpen (float * f, int samples, float k)
+{
+    float * end = f + samples;
+
+    while (f < end)
+    {
+        for (int channel = 0; channel < tools_channels; channel ++)
+        {
+            float current = * f;
+
+            * f ++ = current + (current - tools_prev[channel]) * k;
+            tools_prev[channel] = current;
+        }
+    }
+}
+
+static void process_stereo (float * f, int frames, float k, float a, float b)
+{
+    float prev_l = tools_prev[0], prev_r = tools_prev[1];
+    int i = 0;
+
+#ifdef __SSE__
+    /* two frames at a time; the previous input frame sits in lanes 2 and 3 */
+    __m128 last = _mm_set_ps (prev_r, prev_l, 0, 0);
+    __m128 vk = _mm_set1_ps (k);
+    __m128 va = _mm_set1_ps (a * 0.5f);
+    __m128 vb = _mm_set1_ps (b * 0.5f);
+
+    for (; i + 2 <= frames; i += 2)
+    {
+        __m128 x = _mm_loadu_ps (f + 2 * i);
+        __m128 prev = _mm_shuffle_ps (last, x, _MM_SHUFFLE (1, 0, 3, 2));
+        last = x;
+
+        __m128 c = _mm_add_ps (x, _mm_mul_ps (_mm_sub_ps (x, prev), vk));
+        __m128 swapped = _mm_shuffle_ps (c, c, _MM_SHUFFLE (2, 3, 0, 1));
+
+        /* lanes hold (mid, mid, ...) and (side, -side, ...), both times two */
+        __m128 mid = _mm_add_ps (c, swapped);
+        __m128 side = _mm_sub_ps (c, swapped);
+
+        _mm_storeu_ps (f + 2 * i, _mm_add_ps (_mm_mul_ps (mid, va), _mm_mul_ps (side, vb)));
+    }
+
+    float tail[4];
+    _mm_storeu_ps (tail, last);
+    prev_l = tail[2];
+    prev_r = tail[3];
+#endif
+
+    for (; i < frames; i ++)
+    {
+        float l = f[2 * i], r = f[2 * i + 1];
+        float cl = l + (l - prev_l) * k;
+        float cr = r + (r - prev_r) * k;
+
+        prev_l = l;
+        prev_r = r;
+
+        float mid = (cl + cr) * 0.5f, side = (cl - cr) * 0.5f;
+
+        f[2 * i] = a * mid + b * side;
+        f[2 * i + 1] = a * mid - b * side;
+    }
+
+    tools_prev[0] = prev_l;
+    tools_prev[1] = prev_r;
+}
+
+static void tools_process (float * * data, int * samples)
+{
+    bool_t cryst = aud_get_bool ("stereo_tools", "crystalizer");
+    bool_t extra = aud_get_bool ("stereo_tools", "extra_stereo");
+    bool_t voice = aud_get_bool ("stereo_tools", "voice_removal");
+
+    float k = cryst ? aud_get_double ("stereo_tools", "crystalizer_intensity") : 0;
+    float width = extra ? aud_get_double ("stereo_tools", "extra_stereo_intensity") : 1;
+
+    if (tools_channels != 2)
+    {
+        if (cryst)
+            sharpen (* data, * samples, k);
+
+        return;
+    }
+
+    if (! cryst && ! extra && ! voice)
+    {
+        /* keep the sharpening history current for when it is switched on */
+        if (* samples >= 2)
+        {
+            tools_prev[0] = (* data)[* samples - 2];
+            tools_prev[1] = (* data)[* samples - 1];
+        }
+
+        return;
+    }
+
+    process_stereo (* data, * samples / 2, k, voice ? 0 : 1, voice ? -2 * width : width);
+}
+
+static void tools_flush (void)
+{
+    memset (tools_prev, 0, sizeof (float) * tools_channels);
+}
+
+static const char tools_about[] =
+ N_("Stereo Tools Plugin for Audacious\n\n"
+    "Combines the Crystalizer, Extra Stereo and Voice Removal effects in a "
+    "single pass.");
+
+PERFSTAT_EFFECT (N_("Stereo Tools"), tools_start, tools_process, tools_process)
+
+AUD_EFFECT_PLUGIN
+(
+    .name = N_("Stereo Tools"),
+    .domain = PACKAGE,
+    .about_text = tools_about,
+    .prefs = & tools_prefs,
+    .init = tools_init,
+    .cleanup = tools_cleanup,
+    .start = perfstat_start,
+    .process = perfstat_process,
+    .flush = tools_flush,
+    .finish = perfstat_finish,
+    .preserves_format = TRUE
+)
@@ -16,6 +16,10 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include <audacious/i18n.h>
 #include <audacious/misc.h>
 #include <audacious/plugin.h>
@@ -27,14 +31,46 @@
 
 #define MIN_FREQ        10
 #define MAX_FREQ        20000
+#define MIN_RATE        8000
+#define MAX_RATE        192000
 #define OUTPUT_FREQ     44100
 #define BUF_SAMPLES     512
 #define BUF_BYTES       (BUF_SAMPLES * sizeof(float))
+#define MAX_TONES       4096
+#define SWEEP_CHUNK     32
 
 #ifndef PI
 #define PI              3.14159265358979323846
 #endif
 
+/* Tones are generated eight at a time, one per lane: each lane is a complex
+ * number rotated by its own step every sample, so that a sample costs four
+ * multiplies per tone instead of a call to sin().  The rotation is done in
+ * single precision and drifts, so at the start of every block each lane is set
+ * afresh from a phase kept in double precision. */
+#define LANES           8
+
+enum {
+    TONE_FIXED,         /* tone://f1;f2;... */
+    TONE_SWEEP,         /* tone://sweep;from;to;seconds */
+    TONE_NOISE          /* tone://noise;count;from;to */
+};
+
+typedef struct
+{
+    gint mode, rate;
+    GArray *freqs;              /* TONE_FIXED */
+    gdouble from, to, seconds;  /* TONE_SWEEP, TONE_NOISE */
+    gint count;                 /* TONE_NOISE */
+} ToneSpec;
+
+typedef struct
+{
+    gint groups;                /* of LANES tones; unused lanes are silent */
+    gdouble *phase, *step;      /* in radians */
+    gfloat *amp;
+} ToneBank;
+
 static gboolean stop_flag = FALSE;
 
 static gboolean tone_is_our_fd(const gchar *filename, VFSFile *fd)
@@ -44,73 +80,279 @@ static gboolean tone_is_our_fd(const gchar *filename, VFSFile *fd)
     return FALSE;
 }
 
-static GArray *tone_filename_parse(const gchar * filename)
+static gboolean freq_valid(gdouble freq, gint rate)
+{
+    return freq >= MIN_FREQ && freq <= MAX_FREQ && freq < rate / 2;
+}
+
+/* A field of the form "rate=N" may appear anywhere and sets the sample rate;
+ * the first of the others may name a mode, whose fields follow it in a fixed
+ * order and may be left off from the end. */
+static gboolean tone_filename_parse(const gchar * filename, ToneSpec * spec)
 {
-    GArray *frequencies = g_array_new(FALSE, FALSE, sizeof(double));
     gchar **strings, **ptr;
+    gint field = 0;
 
     if (strncmp(filename, "tone://", 7))
-        return NULL;
+        return FALSE;
 
-    strings = g_strsplit(filename + 7, ";", 100);
+    memset(spec, 0, sizeof(ToneSpec));
+    spec->rate = OUTPUT_FREQ;
+    spec->from = 20;
+    spec->to = MAX_FREQ;
+    spec->seconds = 10;
+    spec->count = 100;
+
+    strings = g_strsplit(filename + 7, ";", MAX_TONES);
 
     for (ptr = strings; *ptr != NULL; ptr++)
     {
-        gdouble freq = strtod(*ptr, NULL);
-        if (freq >= MIN_FREQ && freq <= MAX_FREQ)
-            g_array_append_val(frequencies, freq);
+        if (!strncmp(*ptr, "rate=", 5))
+            spec->rate = CLAMP(atoi(*ptr + 5), MIN_RATE, MAX_RATE);
+    }
+
+    if (strings[0] && !strcmp(strings[0], "sweep"))
+        spec->mode = TONE_SWEEP;
+    else if (strings[0] && !strcmp(strings[0], "noise"))
+        spec->mode = TONE_NOISE;
+    else
+        spec->freqs = g_array_new(FALSE, FALSE, sizeof(double));
+
+    for (ptr = strings + (spec->mode != TONE_FIXED); *ptr != NULL; ptr++)
+    {
+        if (!strncmp(*ptr, "rate=", 5))
+            continue;
+
+        gdouble value = strtod(*ptr, NULL);
+
+        if (spec->mode == TONE_FIXED)
+        {
+            if (freq_valid(value, spec->rate))
+                g_array_append_val(spec->freqs, value);
+        }
+        else if (spec->mode == TONE_SWEEP)
+        {
+            if (field == 0 && freq_valid(value, spec->rate))
+                spec->from = value;
+            else if (field == 1 && freq_valid(value, spec->rate))
+                spec->to = value;
+            else if (field == 2 && value > 0)
+                spec->seconds = value;
+        }
+        else
+        {
+            if (field == 0 && value >= 1)
+                spec->count = MIN((gint) value, MAX_TONES);
+            else if (field == 1 && freq_valid(value, spec->rate))
+                spec->from = value;
+            else if (field == 2 && freq_valid(value, spec->rate))
+                spec->to = value;
+        }
+
+        field++;
     }
     g_strfreev(strings);
 
-    if (frequencies->len == 0)
+    /* the default upper end may be out of reach at low rates */
+    spec->to = MIN(spec->to, spec->rate * 0.45);
+
+    if (spec->mode == TONE_FIXED && spec->freqs->len == 0)
     {
-        g_array_free(frequencies, TRUE);
-        frequencies = NULL;
+        g_array_free(spec->freqs, TRUE);
+        return FALSE;
     }
 
-    return frequencies;
+    return TRUE;
+}
+
+static void tone_spec_free(ToneSpec * spec)
+{
+    if (spec->freqs)
+        g_array_free(spec->freqs, TRUE);
 }
 
 static gchar *tone_title(const gchar * filename)
 {
-    GArray *freqs;
+    ToneSpec spec;
     gchar *title;
     gsize i;
 
-    freqs = tone_filename_parse(filename);
-    if (freqs == NULL)
+    if (!tone_filename_parse(filename, &spec))
         return NULL;
 
-    title = g_strdup_printf(_("%s %.1f Hz"), _("Tone Generator: "), g_array_index(freqs, double, 0));
-    for (i = 1; i < freqs->len; i++)
+    if (spec.mode == TONE_SWEEP)
+        title = g_strdup_printf(_("%s sweep %.1f-%.1f Hz, %.1f s"),
+         _("Tone Generator: "), spec.from, spec.to, spec.seconds);
+    else if (spec.mode == TONE_NOISE)
+        title = g_strdup_printf(_("%s %d tones, %.1f-%.1f Hz"),
+         _("Tone Generator: "), spec.count, spec.from, spec.to);
+    else
+    {
+        title = g_strdup_printf(_("%s %.1f Hz"), _("Tone Generator: "), g_array_index(spec.freqs, double, 0));
+        for (i = 1; i < spec.freqs->len; i++)
+        {
+            gchar *old_title = title;
+            title = g_strdup_printf("%s;%.1f Hz", old_title, g_array_index(spec.freqs, double, i));
+            g_free(old_title);
+        }
+    }
+
+    if (spec.rate != OUTPUT_FREQ)
     {
         gchar *old_title = title;
-        title = g_strdup_printf("%s;%.1f Hz", old_title, g_array_index(freqs, double, i));
+        title = g_strdup_printf("%s (%d Hz)", old_title, spec.rate);
         g_free(old_title);
     }
-    g_array_free(freqs, TRUE);
 
+    tone_spec_free(&spec);
     return title;
 }
 
+static void tone_bank_init(ToneBank * bank, gint count)
+{
+    bank->groups = (count + LANES - 1) / LANES;
+    bank->phase = g_new0(gdouble, bank->groups * LANES);
+    bank->step = g_new0(gdouble, bank->groups * LANES);
+    bank->amp = g_new0(gfloat, bank->groups * LANES);
+}
+
+static void tone_bank_free(ToneBank * bank)
+{
+    g_free(bank->phase);
+    g_free(bank->step);
+    g_free(bank->amp);
+}
+
+/* Adds one group of tones, as it stands at the start of the block, to acc,
+ * which keeps four partial sums per sample. */
+static void tone_group_render(const gfloat *re_in, const gfloat *im_in,
+    const gfloat *c, const gfloat *s, gfloat (*acc)[4], gint samples)
+{
+#ifdef __SSE__
+    __m128 re0 = _mm_loadu_ps(re_in), re1 = _mm_loadu_ps(re_in + 4);
+    __m128 im0 = _mm_loadu_ps(im_in), im1 = _mm_loadu_ps(im_in + 4);
+    __m128 c0 = _mm_loadu_ps(c), c1 = _mm_loadu_ps(c + 4);
+    __m128 s0 = _mm_loadu_ps(s), s1 = _mm_loadu_ps(s + 4);
+
+    for (gint i = 0; i < samples; i++)
+    {
+        _mm_storeu_ps(acc[i], _mm_add_ps(_mm_loadu_ps(acc[i]),
+         _mm_add_ps(im0, im1)));
+
+        __m128 next0 = _mm_sub_ps(_mm_mul_ps(re0, c0), _mm_mul_ps(im0, s0));
+        __m128 next1 = _mm_sub_ps(_mm_mul_ps(re1, c1), _mm_mul_ps(im1, s1));
+        im0 = _mm_add_ps(_mm_mul_ps(re0, s0), _mm_mul_ps(im0, c0));
+        im1 = _mm_add_ps(_mm_mul_ps(re1, s1), _mm_mul_ps(im1, c1));
+        re0 = next0;
+        re1 = next1;
+    }
+#else
+    gfloat re[LANES], im[LANES];
+
+    memcpy(re, re_in, sizeof re);
+    memcpy(im, im_in, sizeof im);
+
+    for (gint i = 0; i < samples; i++)
+    {
+        for (gint l = 0; l < 4; l++)
+            acc[i][l] += im[l] + im[l + 4];
+
+        for (gint l = 0; l < LANES; l++)
+        {
+            gfloat next = re[l] * c[l] - im[l] * s[l];
+            im[l] = re[l] * s[l] + im[l] * c[l];
+            re[l] = next;
+        }
+    }
+#endif
+}
+
+static void tone_bank_render(ToneBank * bank, gfloat * data, gint samples)
+{
+    gfloat acc[BUF_SAMPLES][4];
+
+    memset(acc, 0, sizeof(acc[0]) * samples);
+
+    for (gint g = 0; g < bank->groups; g++)
+    {
+        gfloat re[LANES], im[LANES], c[LANES], s[LANES];
+
+        for (gint l = 0; l < LANES; l++)
+        {
+            gint k = g * LANES + l;
+
+            re[l] = bank->amp[k] * cos(bank->phase[k]);
+            im[l] = bank->amp[k] * sin(bank->phase[k]);
+            c[l] = cos(bank->step[k]);
+            s[l] = sin(bank->step[k]);
+
+            bank->phase[k] = fmod(bank->phase[k] + bank->step[k] * samples, 2 * PI);
+        }
+
+        tone_group_render(re, im, c, s, acc, samples);
+    }
+
+    /* random phases can now and then add up past full scale */
+    for (gint i = 0; i < samples; i++)
+        data[i] = CLAMP(acc[i][0] + acc[i][1] + acc[i][2] + acc[i][3], -1, 1);
+}
+
+static void tone_bank_setup(ToneBank * bank, const ToneSpec * spec)
+{
+    gint i;
+
+    if (spec->mode == TONE_FIXED)
+    {
+        tone_bank_init(bank, spec->freqs->len);
+        for (i = 0; i < (gint) spec->freqs->len; i++)
+        {
+            gdouble f = g_array_index(spec->freqs, gdouble, i);
+            bank->step[i] = 2 * PI * f / spec->rate;
+            /* dithering can cause a little bit of clipping */
+            bank->amp[i] = 0.999 / spec->freqs->len;
+        }
+    }
+    else if (spec->mode == TONE_SWEEP)
+    {
+        tone_bank_init(bank, 1);
+        bank->amp[0] = 0.999;
+    }
+    else
+    {
+        /* log-spaced tones at random phases, the whole at about -15 dBFS RMS;
+         * the seed is fixed so that the same URI gives the same signal */
+        GRand *rand = g_rand_new_with_seed(spec->count);
+
+        tone_bank_init(bank, spec->count);
+        for (i = 0; i < spec->count; i++)
+        {
+            gdouble f = spec->count > 1 ? spec->from * pow(spec->to / spec->from,
+             (gdouble) i / (spec->count - 1)) : spec->from;
+            bank->step[i] = 2 * PI * f / spec->rate;
+            bank->phase[i] = g_rand_double_range(rand, 0, 2 * PI);
+            bank->amp[i] = 0.178 * sqrt(2.0 / spec->count);
+        }
+
+        g_rand_free(rand);
+    }
+}
+
 static gboolean tone_play(InputPlayback *playback, const gchar *filename,
     VFSFile *file, gint start_time, gint stop_time, gboolean pause)
 {
-    GArray *frequencies;
+    ToneSpec spec;
+    ToneBank bank;
     gfloat data[BUF_SAMPLES];
-    gsize i;
     gboolean error = FALSE;
-    struct
-    {
-        gdouble wd;
-        guint period, t;
-    } *tone = NULL;
+    gint64 sweep_pos = 0, sweep_length;
 
-    frequencies = tone_filename_parse(filename);
-    if (frequencies == NULL)
+    if (!tone_filename_parse(filename, &spec))
         return FALSE;
 
-    if (playback->output->open_audio(FMT_FLOAT, OUTPUT_FREQ, 1) == 0)
+    tone_bank_setup(&bank, &spec);
+    sweep_length = MAX((gint64) (spec.seconds * spec.rate), SWEEP_CHUNK);
+
+    if (playback->output->open_audio(FMT_FLOAT, spec.rate, 1) == 0)
     {
         error = TRUE;
         goto error_exit;
@@ -119,45 +361,38 @@ static gboolean tone_play(InputPlayback *playback, const gchar *filename,
     if (pause)
         playback->output->pause(TRUE);
 
-    playback->set_params(playback, 16 * OUTPUT_FREQ, OUTPUT_FREQ, 1);
-
-    tone = g_malloc(frequencies->len * sizeof(*tone));
-    for (i = 0; i < frequencies->len; i++)
-    {
-        gdouble f = g_array_index(frequencies, gdouble, i);
-        tone[i].wd = 2 * PI * f / OUTPUT_FREQ;
-        tone[i].period = (G_MAXINT * 2U / OUTPUT_FREQ) * (OUTPUT_FREQ / f);
-        tone[i].t = 0;
-    }
+    playback->set_params(playback, 16 * spec.rate, spec.rate, 1);
 
     stop_flag = FALSE;
     playback->set_pb_ready(playback);
 
     while (!stop_flag)
     {
-        for (i = 0; i < BUF_SAMPLES; i++)
+        if (spec.mode == TONE_SWEEP)
         {
-            gsize j;
-            double sum_sines;
-
-            for (sum_sines = 0, j = 0; j < frequencies->len; j++)
+            /* the frequency is held for a few samples at a time, taken at the
+             * middle of each stretch; the phase carries on across */
+            for (gint i = 0; i < BUF_SAMPLES; i += SWEEP_CHUNK)
             {
-                sum_sines += sin(tone[j].wd * tone[j].t);
-                if (tone[j].t > tone[j].period)
-                    tone[j].t -= tone[j].period;
-                tone[j].t++;
+                gdouble f = spec.from * pow(spec.to / spec.from,
+                 (sweep_pos + SWEEP_CHUNK / 2) / (gdouble) sweep_length);
+                bank.step[0] = 2 * PI * f / spec.rate;
+                tone_bank_render(&bank, data + i, SWEEP_CHUNK);
+
+                if ((sweep_pos += SWEEP_CHUNK) >= sweep_length)
+                    sweep_pos = 0;
             }
-            /* dithering can cause a little bit of clipping */
-            data[i] = (sum_sines * 0.999 / (gdouble) frequencies->len);
         }
+        else
+            tone_bank_render(&bank, data, BUF_SAMPLES);
 
         if (!stop_flag)
             playback->output->write_audio(data, BUF_BYTES);
     }
 
 error_exit:
-    g_array_free(frequencies, TRUE);
-    g_free(tone);
+    tone_bank_free(&bank);
+    tone_spec_free(&spec);
 
     stop_flag = TRUE;
 
@@ -197,7 +432,12 @@ static const char tone_about[] =
  N_("Sine tone generator by Håvard Kvålen <havardk@xmms.org>\n"
     "Modified by Daniel J. Peng <danielpeng@bigfoot.com>\n\n"
     "To use it, add a URL: tone://frequency1;frequency2;frequency3;...\n"
-    "e.g. tone://2000;2005 to play a 2000 Hz tone and a 2005 Hz tone");
+    "e.g. tone://2000;2005 to play a 2000 Hz tone and a 2005 Hz tone\n\n"
+    "tone://sweep;from;to;seconds sweeps from one frequency to another on a\n"
+    "log scale, over and over, e.g. tone://sweep;20;20000;10\n"
+    "tone://noise;count;from;to plays many tones at once, evenly spaced on a\n"
+    "log scale, e.g. tone://noise;1000;20;20000\n"
+    "Add rate=96000 (for example) to any of these to set the sample rate.");
 
 static const gchar * const schemes[] = {"tone", NULL};
 
@@ -27,18 +27,278 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 #include <audacious/i18n.h>
 #include <audacious/plugin.h>
 #include <libaudcore/audstrings.h>
 
-#define INT_TO_POINTER(x) ((void *) (ptrdiff_t) (x))
-#define POINTER_TO_INT(x) ((int) (ptrdiff_t) (x))
+/* Regular files opened read-only up to this size are memory-mapped, so that
+ * reads and seeks need no system calls.  Larger files are mostly played
+ * straight through, where read() does as well without tying up address
+ * space.  Files up to MAX_WILLNEED are also read ahead in full at once. */
+#define MAX_MAP_SIZE (256 << 20)
+#define MAX_WILLNEED (4 << 20)
+
+/* Other files go through a buffer of this size, which holds either data read
+ * ahead or data waiting to be written, never both.  Requests at least this
+ * large bypass it. */
+#define BUFFER_SIZE 65536
+
+#ifdef HAVE_LIBURING
+/* Regular files too large to map are read ahead through io_uring instead,
+ * URING_DEPTH blocks at a time, so that the disk always has requests queued
+ * while the decoder works through the data already in. */
+#define URING_DEPTH 4
+#define URING_BLOCK (256 << 10)
+
+typedef struct {
+    struct io_uring ring;
+    unsigned char * bufs;       /* URING_DEPTH blocks, registered if fixed */
+    bool_t fixed;
+    int64_t first;              /* first block of the window being read */
+    int len[URING_DEPTH];       /* bytes in each slot, or -1 while pending */
+} UringReader;
+#endif
+
+typedef struct {
+    int fd;
+    const unsigned char * map;  /* NULL if not mapped */
+#ifdef HAVE_LIBURING
+    UringReader * uring;        /* NULL if not read through io_uring */
+#endif
+    int64_t size, pos;          /* only valid if mapped or read through io_uring */
+    unsigned char * buf;        /* allocated on first use */
+    int read_pos, read_len;     /* unread data is buf[read_pos..read_len) */
+    int write_len;              /* pending data is buf[0..write_len) */
+} UnixFile;
+
+/* Whether pos and size stand in for the file offset and length. */
+static inline bool_t own_position (UnixFile * uf)
+{
+#ifdef HAVE_LIBURING
+    if (uf->uring)
+        return TRUE;
+#endif
+    return (uf->map != NULL);
+}
 
 #define unix_error(...) do { \
     fprintf (stderr, __VA_ARGS__); \
     fputc ('\n', stderr); \
 } while (0)
 
+#ifdef HAVE_LIBURING
+/* Slot <slot> always holds block <first + n> for the n that makes the two
+ * agree modulo URING_DEPTH; blocks past the end of the file are not read. */
+
+static void uring_request (UnixFile * uf, int64_t block)
+{
+    UringReader * ur = uf->uring;
+    int slot = block % URING_DEPTH;
+
+    if (block * URING_BLOCK >= uf->size)
+    {
+        ur->len[slot] = 0;
+        return;
+    }
+
+    struct io_uring_sqe * sqe = io_uring_get_sqe (& ur->ring);
+    unsigned char * buf = ur->bufs + slot * URING_BLOCK;
+
+    if (ur->fixed)
+        io_uring_prep_read_fixed (sqe, uf->fd, buf, URING_BLOCK, block * URING_BLOCK, 0);
+    else
+        io_uring_prep_read (sqe, uf->fd, buf, URING_BLOCK, block * URING_BLOCK);
+
+    io_uring_sqe_set_data (sqe, (void *) (intptr_t) slot);
+    ur->len[slot] = -1;
+}
+
+/* Reaps completions until <slot> is filled in. */
+static void uring_wait (UnixFile * uf, int slot)
+{
+    UringReader * ur = uf->uring;
+
+    while (ur->len[slot] < 0)
+    {
+        struct io_uring_cqe * cqe;
+        int ret = io_uring_wait_cqe (& ur->ring, & cqe);
+
+        if (ret < 0)
+        {
+            if (ret == -EINTR)
+                continue;
+
+            /* nothing more will complete; give up on everything pending */
+            unix_error ("io_uring_wait_cqe failed: %s.", strerror (- ret));
+            for (int i = 0; i < URING_DEPTH; i ++)
+                ur->len[i] = MAX (ur->len[i], 0);
+            break;
+        }
+
+        int done = (intptr_t) io_uring_cqe_get_data (cqe);
+
+        if (cqe->res < 0)
+            unix_error ("read failed: %s.", strerror (- cqe->res));
+
+        ur->len[done] = MAX (cqe->res, 0);
+        io_uring_cqe_seen (& ur->ring, cqe);
+    }
+}
+
+/* Moves the window so that it starts at <block>, refilling the slots it
+ * leaves behind. */
+static void uring_advance (UnixFile * uf, int64_t block)
+{
+    UringReader * ur = uf->uring;
+
+    if (block < ur->first || block >= ur->first + URING_DEPTH)
+    {
+        /* a seek: let every buffer come back before reusing them */
+        for (int i = 0; i < URING_DEPTH; i ++)
+            uring_wait (uf, i);
+
+        for (int i = 0; i < URING_DEPTH; i ++)
+            uring_request (uf, block + i);
+
+        ur->first = block;
+    }
+    else
+    {
+        for (; ur->first < block; ur->first ++)
+        {
+            uring_wait (uf, ur->first % URING_DEPTH);
+            uring_request (uf, ur->first + URING_DEPTH);
+        }
+    }
+
+    io_uring_submit (& ur->ring);
+}
+
+static UringReader * uring_open (int fd)
+{
+    UringReader * ur = calloc (1, sizeof (UringReader));
+
+    if (io_uring_queue_init (URING_DEPTH, & ur->ring, 0) < 0)
+    {
+        free (ur);
+        return NULL;
+    }
+
+    if (! (ur->bufs = malloc (URING_DEPTH * URING_BLOCK)))
+    {
+        io_uring_queue_exit (& ur->ring);
+        free (ur);
+        return NULL;
+    }
+
+    /* registering pins the buffers, which RLIMIT_MEMLOCK may not allow */
+    struct iovec iov = {ur->bufs, URING_DEPTH * URING_BLOCK};
+    ur->fixed = ! io_uring_register_buffers (& ur->ring, & iov, 1);
+
+    /* an empty window: the first read fills it */
+    ur->first = - URING_DEPTH;
+
+    return ur;
+}
+
+static void uring_close (UnixFile * uf)
+{
+    UringReader * ur = uf->uring;
+
+    for (int i = 0; i < URING_DEPTH; i ++)
+        uring_wait (uf, i);
+
+    io_uring_queue_exit (& ur->ring);
+    free (ur->bufs);
+    free (ur);
+}
+
+static int64_t uring_read (UnixFile * uf, void * ptr, int64_t len)
+{
+    UringReader * ur = uf->uring;
+    int64_t total = 0;
+
+    while (total < len && uf->pos < uf->size)
+    {
+        int64_t block = uf->pos / URING_BLOCK;
+        int offset = uf->pos % URING_BLOCK;
+        int slot = block % URING_DEPTH;
+
+        if (block != ur->first)
+            uring_advance (uf, block);
+
+        uring_wait (uf, slot);
+
+        /* a short read short of the end of the file; fill in the rest */
+        if (ur->len[slot] <= offset)
+        {
+            int64_t want = MIN (URING_BLOCK, uf->size - block * URING_BLOCK);
+            int64_t readed = pread (uf->fd, ur->bufs + slot * URING_BLOCK + ur->len[slot],
+             want - ur->len[slot], block * URING_BLOCK + ur->len[slot]);
+
+            if (readed <= 0)
+            {
+                if (readed < 0)
+                    unix_error ("read failed: %s.", strerror (errno));
+                break;
+            }
+
+            ur->len[slot] += readed;
+            continue;
+        }
+
+        int copy = MIN (len - total, ur->len[slot] - offset);
+        memcpy ((char *) ptr + total, ur->bufs + slot * URING_BLOCK + offset, copy);
+        uf->pos += copy;
+        total += copy;
+    }
+
+    return total;
+}
+#endif
+
+static void setup_read (UnixFile * uf)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise (uf->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+#ifndef _WIN32
+    struct stat st;
+
+    if (fstat (uf->fd, & st) < 0 || ! S_ISREG (st.st_mode) || st.st_size <= 0)
+        return;
+
+    void * map = (st.st_size <= MAX_MAP_SIZE) ? mmap (NULL, st.st_size,
+     PROT_READ, MAP_PRIVATE, uf->fd, 0) : MAP_FAILED;
+
+    if (map == MAP_FAILED)
+    {
+#ifdef HAVE_LIBURING
+        if ((uf->uring = uring_open (uf->fd)))
+            uf->size = st.st_size;
+#endif
+        return;
+    }
+
+#ifdef POSIX_FADV_WILLNEED
+    if (st.st_size <= MAX_WILLNEED)
+        posix_fadvise (uf->fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+    uf->map = map;
+    uf->size = st.st_size;
+#endif
+}
+
 static void * unix_fopen (const char * uri, const char * mode)
 {
     bool_t update;
@@ -90,32 +350,108 @@ static void * unix_fopen (const char * uri, const char * mode)
     }
 
     free (filename);
-    return INT_TO_POINTER (handle);
+
+    UnixFile * uf = calloc (1, sizeof (UnixFile));
+    uf->fd = handle;
+
+    if (mode[0] == 'r' && ! update)
+        setup_read (uf);
+
+    return uf;
+}
+
+static bool_t alloc_buffer (UnixFile * uf)
+{
+    if (! uf->buf && ! (uf->buf = malloc (BUFFER_SIZE)))
+    {
+        unix_error ("Cannot allocate I/O buffer.");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static bool_t write_all (int handle, const void * ptr, int64_t len)
+{
+    int64_t total = 0;
+
+    while (total < len)
+    {
+        int64_t written = write (handle, (const char *) ptr + total, len - total);
+
+        if (written < 0)
+        {
+            unix_error ("write failed: %s.", strerror (errno));
+            return FALSE;
+        }
+
+        total += written;
+    }
+
+    return TRUE;
+}
+
+static bool_t flush_write (UnixFile * uf)
+{
+    if (! uf->write_len)
+        return TRUE;
+
+    bool_t success = write_all (uf->fd, uf->buf, uf->write_len);
+    uf->write_len = 0;
+    return success;
+}
+
+/* Moves the file offset back over data read ahead but not consumed, so that
+ * it matches the logical position again. */
+static bool_t drop_read (UnixFile * uf)
+{
+    int unread = uf->read_len - uf->read_pos;
+    uf->read_pos = uf->read_len = 0;
+
+    if (unread && lseek (uf->fd, -unread, SEEK_CUR) < 0)
+    {
+        unix_error ("lseek failed: %s.", strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 static int unix_fclose (VFSFile * file)
 {
-    int handle = POINTER_TO_INT (vfs_get_handle (file));
+    UnixFile * uf = vfs_get_handle (file);
     int result = 0;
 
-    if (close (handle) < 0)
+#ifndef _WIN32
+    if (uf->map)
+        munmap ((void *) uf->map, uf->size);
+#endif
+#ifdef HAVE_LIBURING
+    if (uf->uring)
+        uring_close (uf);
+#endif
+
+    if (! flush_write (uf))
+        result = -1;
+
+    if (close (uf->fd) < 0)
     {
         unix_error ("close failed: %s.", strerror (errno));
         result = -1;
     }
 
+    free (uf->buf);
+    free (uf);
     return result;
 }
 
-static int64_t unix_fread (void * ptr, int64_t size, int64_t nitems, VFSFile * file)
+static int64_t read_raw (int handle, void * ptr, int64_t len)
 {
-    int handle = POINTER_TO_INT (vfs_get_handle (file));
-    int64_t goal = size * nitems;
     int64_t total = 0;
 
-    while (total < goal)
+    while (total < len)
     {
-        int64_t readed = read (handle, (char *) ptr + total, goal - total);
+        int64_t readed = read (handle, (char *) ptr + total, len - total);
 
         if (readed < 0)
         {
@@ -129,37 +465,129 @@ static int64_t unix_fread (void * ptr, int64_t size, int64_t nitems, VFSFile * f
         total += readed;
     }
 
-    return (size > 0) ? total / size : 0;
+    return total;
 }
 
-static int64_t unix_fwrite (const void * ptr, int64_t size, int64_t nitems,
- VFSFile * file)
+static int64_t unix_fread (void * ptr, int64_t size, int64_t nitems, VFSFile * file)
 {
-    int handle = POINTER_TO_INT (vfs_get_handle (file));
+    UnixFile * uf = vfs_get_handle (file);
     int64_t goal = size * nitems;
     int64_t total = 0;
 
+    if (uf->map)
+    {
+        if (size <= 0 || uf->pos >= uf->size)
+            return 0;
+
+        nitems = MIN (nitems, (uf->size - uf->pos) / size);
+        memcpy (ptr, uf->map + uf->pos, size * nitems);
+        uf->pos += size * nitems;
+        return nitems;
+    }
+
+#ifdef HAVE_LIBURING
+    if (uf->uring)
+        return (size > 0) ? uring_read (uf, ptr, goal) / size : 0;
+#endif
+
+    if (! flush_write (uf) || ! alloc_buffer (uf))
+        return 0;
+
     while (total < goal)
     {
-        int64_t written = write (handle, (char *) ptr + total, goal - total);
+        if (uf->read_pos < uf->read_len)
+        {
+            int copy = MIN (goal - total, uf->read_len - uf->read_pos);
+            memcpy ((char *) ptr + total, uf->buf + uf->read_pos, copy);
+            uf->read_pos += copy;
+            total += copy;
+            continue;
+        }
 
-        if (written < 0)
+        if (goal - total >= BUFFER_SIZE)
         {
-            unix_error ("write failed: %s.", strerror (errno));
+            total += read_raw (uf->fd, (char *) ptr + total, goal - total);
             break;
         }
 
-        total += written;
+        /* A single read() here: blocking for more than the file or pipe
+         * has right now would gain nothing. */
+        int64_t readed = read (uf->fd, uf->buf, BUFFER_SIZE);
+
+        if (readed < 0)
+        {
+            unix_error ("read failed: %s.", strerror (errno));
+            break;
+        }
+
+        if (! readed)
+            break;
+
+        uf->read_pos = 0;
+        uf->read_len = readed;
     }
 
     return (size > 0) ? total / size : 0;
 }
 
+static int64_t unix_fwrite (const void * ptr, int64_t size, int64_t nitems,
+ VFSFile * file)
+{
+    UnixFile * uf = vfs_get_handle (file);
+    int64_t goal = size * nitems;
+
+    if (! drop_read (uf) || ! alloc_buffer (uf))
+        return 0;
+
+    if (uf->write_len + goal > BUFFER_SIZE && ! flush_write (uf))
+        return 0;
+
+    if (goal >= BUFFER_SIZE)
+        return write_all (uf->fd, ptr, goal) ? nitems : 0;
+
+    memcpy (uf->buf + uf->write_len, ptr, goal);
+    uf->write_len += goal;
+
+    return (size > 0) ? nitems : 0;
+}
+
 static int unix_fseek (VFSFile * file, int64_t offset, int whence)
 {
-    int handle = POINTER_TO_INT (vfs_get_handle (file));
+    UnixFile * uf = vfs_get_handle (file);
+
+    if (own_position (uf))
+    {
+        int64_t base = (whence == SEEK_SET) ? 0 : (whence == SEEK_CUR) ?
+         uf->pos : (whence == SEEK_END) ? uf->size : -1;
+
+        /* like lseek(), allow seeking past the end, but not before the start */
+        if (base < 0 || base + offset < 0)
+        {
+            unix_error ("lseek failed: %s.", strerror (EINVAL));
+            return -1;
+        }
+
+        uf->pos = base + offset;
+        return 0;
+    }
 
-    if (lseek (handle, offset, whence) < 0)
+    if (! flush_write (uf))
+        return -1;
+
+    /* short relative seeks, such as from ungetc(), stay within the buffer */
+    if (whence == SEEK_CUR && uf->read_pos + offset >= 0 &&
+     uf->read_pos + offset <= uf->read_len)
+    {
+        uf->read_pos += offset;
+        return 0;
+    }
+
+    if (whence == SEEK_CUR)
+        offset -= uf->read_len - uf->read_pos;
+
+    uf->read_pos = uf->read_len = 0;
+
+    if (lseek (uf->fd, offset, whence) < 0)
     {
         unix_error ("lseek failed: %s.", strerror (errno));
         return -1;
@@ -170,19 +598,33 @@ static int unix_fseek (VFSFile * file, int64_t offset, int whence)
 
 static int64_t unix_ftell (VFSFile * file)
 {
-    int handle = POINTER_TO_INT (vfs_get_handle (file));
-    int64_t result = lseek (handle, 0, SEEK_CUR);
+    UnixFile * uf = vfs_get_handle (file);
+
+    if (own_position (uf))
+        return uf->pos;
+
+    int64_t result = lseek (uf->fd, 0, SEEK_CUR);
 
     if (result < 0)
+    {
         unix_error ("lseek failed: %s.", strerror (errno));
+        return result;
+    }
 
-    return result;
+    return result - (uf->read_len - uf->read_pos) + uf->write_len;
 }
 
 static int unix_getc (VFSFile * file)
 {
+    UnixFile * uf = vfs_get_handle (file);
     unsigned char c;
 
+    if (uf->map)
+        return (uf->pos < uf->size) ? uf->map[uf->pos ++] : -1;
+
+    if (uf->read_pos < uf->read_len)
+        return uf->buf[uf->read_pos ++];
+
     return (unix_fread (& c, 1, 1, file) == 1) ? c : -1;
 }
 
@@ -193,6 +635,11 @@ static int unix_ungetc (int c, VFSFile * file)
 
 static bool_t unix_feof (VFSFile * file)
 {
+    UnixFile * uf = vfs_get_handle (file);
+
+    if (own_position (uf))
+        return (uf->pos >= uf->size);
+
     int test = unix_getc (file);
 
     if (test < 0)
@@ -204,9 +651,12 @@ static bool_t unix_feof (VFSFile * file)
 
 static int unix_ftruncate (VFSFile * file, int64_t length)
 {
-    int handle = POINTER_TO_INT (vfs_get_handle (file));
+    UnixFile * uf = vfs_get_handle (file);
 
-    int result = ftruncate (handle, length);
+    if (! flush_write (uf) || ! drop_read (uf))
+        return -1;
+
+    int result = ftruncate (uf->fd, length);
 
     if (result < 0)
         unix_error ("ftruncate failed: %s.", strerror (errno));
@@ -216,7 +666,18 @@ static int unix_ftruncate (VFSFile * file, int64_t length)
 
 static int64_t unix_fsize (VFSFile * file)
 {
+    UnixFile * uf = vfs_get_handle (file);
     int64_t position, length;
+    struct stat st;
+
+    if (own_position (uf))
+        return uf->size;
+
+    if (! flush_write (uf))
+        return -1;
+
+    if (! fstat (uf->fd, & st) && S_ISREG (st.st_mode))
+        return st.st_size;
 
     position = unix_ftell (file);
 
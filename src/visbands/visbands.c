@@ -0,0 +1,143 @@
+/*
+ * Shared Spectrum Bands for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "visbands.h"
+
+/* band i is freq[lo_bin] * lo_weight + freq[first .. last - 1] +
+ * freq[hi_bin] * hi_weight */
+typedef struct {
+    int lo_bin, hi_bin, first, last;
+    float lo_weight, hi_weight;
+} Band;
+
+struct VisBands {
+    int bands;
+    float scale;
+    Band band[];
+};
+
+VisBands * visbands_new (int bands)
+{
+    VisBands * vb = calloc (1, sizeof (VisBands) + sizeof (Band) * bands);
+
+    vb->bands = bands;
+    vb->scale = (float) bands / 12;
+
+    float lo = powf (256, 0) - 0.5f;
+
+    for (int i = 0; i < bands; i ++)
+    {
+        float hi = powf (256, (float) (i + 1) / bands) - 0.5f;
+        Band * band = & vb->band[i];
+
+        int a = ceilf (lo);
+        int b = floorf (hi);
+
+        if (b < a)
+        {
+            /* the whole band lies within one bin */
+            band->lo_bin = b;
+            band->lo_weight = hi - lo;
+        }
+        else
+        {
+            if (a > 0)
+            {
+                band->lo_bin = a - 1;
+                band->lo_weight = a - lo;
+            }
+
+            band->first = a;
+            band->last = b;
+
+            if (b < 256)
+            {
+                band->hi_bin = b;
+                band->hi_weight = hi - b;
+            }
+        }
+
+        lo = hi;
+    }
+
+    return vb;
+}
+
+void visbands_free (VisBands * vb)
+{
+    free (vb);
+}
+
+int visbands_count (const VisBands * vb)
+{
+    return vb->bands;
+}
+
+void visbands_compute (const VisBands * vb, const float * freq, float db_range,
+ float * levels)
+{
+    for (int i = 0; i < vb->bands; i ++)
+    {
+        const Band * band = & vb->band[i];
+
+        float sum = freq[band->lo_bin] * band->lo_weight + freq[band->hi_bin] *
+         band->hi_weight;
+
+        for (int a = band->first; a < band->last; a ++)
+            sum += freq[a];
+
+        /* scale (-db_range, 0.0) to (0.0, 1.0) */
+        float val = 1 + 20 * log10f (sum * vb->scale) / db_range;
+
+        levels[i] = (val > 0) ? (val < 1 ? val : 1) : 0;
+    }
+}
+
+bool_t visbands_falloff (const float * levels, int bands, int range, int hold,
+ int falloff, int * bars, int * delay)
+{
+    bool_t changed = FALSE;
+
+    for (int i = 0; i < bands; i ++)
+    {
+        int x = levels[i] * range;
+        int old = bars[i];
+        int drop = falloff - delay[i];
+
+        if (drop > 0)
+            bars[i] -= drop;
+
+        if (delay[i])
+            delay[i] --;
+
+        if (x > bars[i])
+        {
+            bars[i] = x;
+            delay[i] = hold;
+        }
+
+        if (bars[i] != old)
+            changed = TRUE;
+    }
+
+    return changed;
+}
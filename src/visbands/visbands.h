@@ -0,0 +1,53 @@
+/*
+ * Shared Spectrum Bands for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_VISBANDS_H
+#define AUDACIOUS_VISBANDS_H
+
+#include <libaudcore/core.h>
+
+/* The spectrum visualizers all reduce the 256 linear frequency bins handed to
+ * them by Audacious to a smaller number of logarithmically spaced bands, the
+ * edges of band i being at 256 ^ (i / bands) - 0.5.  The bins (and the
+ * fractions of bins at either edge) that make up each band are worked out once
+ * when a VisBands is created, so that each frame is only a weighted sum.
+ *
+ * Levels are returned on a dB scale: 0 for db_range dB below full scale (or
+ * silence) up to 1 for full scale.  They are adjusted so that the overall
+ * height of the graph matches a 12-band one no matter how many bands there
+ * are. */
+
+typedef struct VisBands VisBands;
+
+VisBands * visbands_new (int bands);
+void visbands_free (VisBands * vb);
+int visbands_count (const VisBands * vb);
+
+/* Fills levels[0 .. bands - 1] from freq[0 .. 255]. */
+void visbands_compute (const VisBands * vb, const float * freq, float db_range,
+ float * levels);
+
+/* Peak hold: each bar jumps up to the new level (scaled to 0 .. range) at
+ * once, then falls back by up to falloff units per frame, slowly at first if
+ * hold is nonzero.  delay holds the remaining hold time of each bar and should
+ * start out zeroed along with bars.  Returns whether any bar moved. */
+bool_t visbands_falloff (const float * levels, int bands, int range, int hold,
+ int falloff, int * bars, int * delay);
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Visualization Frame Limiter for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "vislimit.h"
+
+#define HIDDEN_STATES (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)
+
+typedef struct {
+    VisLimitFunc changed;
+    void * user;
+    gboolean visible, obscured, pending;
+    gint64 last_frame;
+} VisLimit;
+
+static VisLimit * get_limit (GtkWidget * widget)
+{
+    return g_object_get_data ((GObject *) widget, "vislimit");
+}
+
+static void update (GtkWidget * widget)
+{
+    VisLimit * vl = get_limit (widget);
+    gboolean visible = gtk_widget_get_mapped (widget) && ! vl->obscured;
+
+    if (visible)
+    {
+        GdkWindow * window = gtk_widget_get_window (gtk_widget_get_toplevel (widget));
+        if (window && (gdk_window_get_state (window) & HIDDEN_STATES))
+            visible = FALSE;
+    }
+
+    if (visible == vl->visible)
+        return;
+
+    vl->visible = visible;
+    vl->pending = visible; /* whatever is on screen is out of date */
+    vl->last_frame = 0;
+
+    if (vl->changed)
+        vl->changed (visible, vl->user);
+}
+
+static gboolean state_cb (GtkWidget * toplevel, GdkEventWindowState * event,
+ GtkWidget * widget)
+{
+    if (event->changed_mask & HIDDEN_STATES)
+        update (widget);
+
+    return FALSE;
+}
+
+static gboolean visibility_cb (GtkWidget * widget, GdkEventVisibility * event)
+{
+    get_limit (widget)->obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+    update (widget);
+    return FALSE;
+}
+
+static void hierarchy_cb (GtkWidget * widget, GtkWidget * previous)
+{
+    if (previous)
+        g_signal_handlers_disconnect_by_func (previous, (void *) state_cb, widget);
+
+    GtkWidget * toplevel = gtk_widget_get_toplevel (widget);
+
+    /* disconnected automatically should the widget go first */
+    if (gtk_widget_is_toplevel (toplevel))
+        g_signal_connect_object (toplevel, "window-state-event", (GCallback)
+         state_cb, widget, 0);
+
+    update (widget);
+}
+
+void vislimit_attach (GtkWidget * widget, VisLimitFunc changed, void * user)
+{
+    VisLimit * vl = g_new0 (VisLimit, 1);
+    vl->changed = changed;
+    vl->user = user;
+
+    g_object_set_data_full ((GObject *) widget, "vislimit", vl, g_free);
+
+    gtk_widget_add_events (widget, GDK_VISIBILITY_NOTIFY_MASK);
+
+    g_signal_connect (widget, "map", (GCallback) update, NULL);
+    g_signal_connect (widget, "unmap", (GCallback) update, NULL);
+    g_signal_connect (widget, "visibility-notify-event", (GCallback) visibility_cb, NULL);
+    g_signal_connect (widget, "hierarchy-changed", (GCallback) hierarchy_cb, NULL);
+
+    hierarchy_cb (widget, NULL);
+}
+
+gboolean vislimit_visible (GtkWidget * widget)
+{
+    VisLimit * vl = get_limit (widget);
+    return vl ? vl->visible : gtk_widget_is_drawable (widget);
+}
+
+static gint64 refresh_interval (GtkWidget * widget)
+{
+#if GTK_CHECK_VERSION (3, 8, 0)
+    GdkFrameClock * clock = gtk_widget_get_frame_clock (widget);
+
+    if (clock)
+    {
+        gint64 interval = 0, presentation;
+        gdk_frame_clock_get_refresh_info (clock, 0, & interval, & presentation);
+
+        if (interval > 0)
+            return interval;
+    }
+#endif
+
+    return G_USEC_PER_SEC / 60;
+}
+
+gboolean vislimit_frame_due (GtkWidget * widget, gboolean changed)
+{
+    VisLimit * vl = get_limit (widget);
+
+    if (! vl)
+        return changed && gtk_widget_is_drawable (widget);
+
+    if (changed)
+        vl->pending = TRUE;
+
+    if (! vl->visible || ! vl->pending)
+        return FALSE;
+
+    gint64 now = g_get_monotonic_time ();
+    if (vl->last_frame && now - vl->last_frame < refresh_interval (widget))
+        return FALSE;
+
+    vl->pending = FALSE;
+    vl->last_frame = now;
+    return TRUE;
+}
@@ -0,0 +1,46 @@
+/*
+ * Visualization Frame Limiter for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_VISLIMIT_H
+#define AUDACIOUS_VISLIMIT_H
+
+#include <gtk/gtk.h>
+
+/* A visualizer has no business animating a widget that nobody can see, or
+ * drawing faster than the screen can show.  vislimit_attach() starts tracking
+ * whether a widget is on screen: it counts as hidden while it is unmapped, its
+ * window is fully covered, or its toplevel is minimized or withdrawn (which is
+ * also what happens on another workspace).  The optional callback is told
+ * whenever this changes, so that the visualizer can stop listening for
+ * analysis data altogether in the meantime.  The tracking goes away with the
+ * widget. */
+
+typedef void (* VisLimitFunc) (gboolean visible, void * user);
+
+void vislimit_attach (GtkWidget * widget, VisLimitFunc changed, void * user);
+gboolean vislimit_visible (GtkWidget * widget);
+
+/* Called once per analysis frame, with changed telling whether the picture
+ * differs from the last one.  Returns TRUE when the widget should be redrawn
+ * now: it is visible, something has changed since the last redraw, and at
+ * least one screen refresh has passed since then.  A change held back by the
+ * rate limit is returned on a later call. */
+gboolean vislimit_frame_due (GtkWidget * widget, gboolean changed);
+
+#endif
@@ -21,6 +21,8 @@
 #include <audacious/i18n.h>
 #include <audacious/plugin.h>
 
+#include "../perfstat/perfstat.h"
+
 static int voice_channels;
 
 static void voice_start(int *channels, int *rate)
@@ -53,11 +55,13 @@ static void voice_finish(float **d, int *samples)
 	voice_process(d, samples);
 }
 
+PERFSTAT_EFFECT (N_("Voice Removal"), voice_start, voice_process, voice_finish)
+
 AUD_EFFECT_PLUGIN
 (
 	.name = N_("Voice Removal"),
 	.domain = PACKAGE,
-	.start = voice_start,
-	.process = voice_process,
-	.finish = voice_finish
+	.start = perfstat_start,
+	.process = perfstat_process,
+	.finish = perfstat_finish
 )
@@ -44,6 +44,7 @@
 #include <libaudcore/audstrings.h>
 
 #include "vorbis.h"
+#include "../pcmconv/pcmconv.h"
 
 static size_t ovcb_read (void * buffer, size_t size, size_t count, void * file)
 {
@@ -270,21 +271,20 @@ vorbis_update_replaygain(OggVorbis_File *vf, ReplayGainInfo *rg_info)
     return TRUE;
 }
 
-static long
-vorbis_interleave_buffer(float **pcm, int samples, int ch, float *pcmout)
-{
-    int i, j;
-    for (i = 0; i < samples; i++)
-        for (j = 0; j < ch; j++)
-            *pcmout++ = pcm[j][i];
+/* Frames handed to the output at once.  Each seek starts over with small
+ * blocks, so that the output has something to play quickly; once it is
+ * running, the blocks double up to MAX_FRAMES, which also lets a single
+ * ov_read_float call return a whole long block of a high-rate stream. */
+#define MIN_FRAMES 1024
+#define MAX_FRAMES 8192
 
-    return ch * samples * sizeof(float);
+static void
+vorbis_write_frames(InputPlayback * playback, const float * pcmout, int frames, int ch)
+{
+    if (frames > 0)
+        playback->output->write_audio ((void *) pcmout, sizeof (float) * ch * frames);
 }
 
-
-#define PCM_FRAMES 1024
-#define PCM_BUFSIZE (PCM_FRAMES * 2)
-
 static gboolean vorbis_play (InputPlayback * playback, const gchar * filename,
  VFSFile * file, gint start_time, gint stop_time, gboolean pause)
 {
@@ -295,8 +295,9 @@ static gboolean vorbis_play (InputPlayback * playback, const gchar * filename,
     OggVorbis_File vf;
     gint last_section = -1;
     ReplayGainInfo rg_info;
-    gfloat pcmout[PCM_BUFSIZE*sizeof(float)], **pcm;
-    gint bytes, channels, samplerate, br;
+    gfloat * pcmout = NULL, **pcm;
+    gint frames = 0, block = MIN_FRAMES;
+    gint channels, samplerate, br;
     gchar * title = NULL;
 
     seek_value = (start_time > 0) ? start_time : -1;
@@ -337,6 +338,8 @@ static gboolean vorbis_play (InputPlayback * playback, const gchar * filename,
     vorbis_update_replaygain(&vf, &rg_info);
     playback->output->set_replaygain_info (& rg_info);
 
+    pcmout = g_new (gfloat, MAX_FRAMES * 2);
+
     playback->set_pb_ready(playback);
 
     /*
@@ -349,13 +352,14 @@ static gboolean vorbis_play (InputPlayback * playback, const gchar * filename,
     while (1)
     {
         if (stop_time >= 0 && playback->output->written_time () >= stop_time)
-            goto DRAIN;
+            break;
 
         pthread_mutex_lock (& seek_mutex);
 
         if (stop_flag)
         {
             pthread_mutex_unlock (& seek_mutex);
+            frames = 0;
             break;
         }
 
@@ -364,22 +368,20 @@ static gboolean vorbis_play (InputPlayback * playback, const gchar * filename,
             ov_time_seek (& vf, (double) seek_value / 1000);
             playback->output->flush (seek_value);
             seek_value = -1;
+
+            frames = 0;
+            block = MIN_FRAMES;
         }
 
         pthread_mutex_unlock (& seek_mutex);
 
         gint current_section = last_section;
-        bytes = ov_read_float(&vf, &pcm, PCM_FRAMES, &current_section);
-        if (bytes == OV_HOLE)
+        gint got = ov_read_float(&vf, &pcm, block - frames, &current_section);
+        if (got == OV_HOLE)
             continue;
 
-        if (bytes <= 0)
-        {
-DRAIN:
+        if (got <= 0)
             break;
-        }
-
-        bytes = vorbis_interleave_buffer (pcm, bytes, channels, pcmout);
 
         { /* try to detect when metadata has changed */
             vorbis_comment * comment = ov_comment (& vf, -1);
@@ -398,6 +400,10 @@ DRAIN:
 
         if (current_section != last_section)
         {
+            /* What is buffered belongs to the previous section. */
+            vorbis_write_frames (playback, pcmout, frames, channels);
+            frames = 0;
+
             /*
              * The info struct is different in each section.  vf
              * holds them all for the given bitstream.  This
@@ -406,7 +412,7 @@ DRAIN:
             vi = ov_info(&vf, -1);
 
             if (vi->channels > 2)
-                goto stop_processing;
+                break;
 
             if (vi->rate != samplerate || vi->channels != channels)
             {
@@ -415,26 +421,34 @@ DRAIN:
 
                 if (!playback->output->open_audio(FMT_FLOAT, vi->rate, vi->channels)) {
                     error = TRUE;
-                    goto stop_processing;
+                    break;
                 }
 
                 playback->output->flush(ov_time_tell(&vf) * 1000);
                 vorbis_update_replaygain(&vf, &rg_info);
                 playback->output->set_replaygain_info (& rg_info); /* audio reopened */
+                block = MIN_FRAMES;
             }
-        }
 
-        playback->output->write_audio (pcmout, bytes);
+            playback->set_params (playback, br, samplerate, channels);
+            last_section = current_section;
+        }
 
-stop_processing:
+        pcm_interleave ((const void * const *) pcm, FMT_FLOAT, channels,
+         pcmout + frames * channels, got);
+        frames += got;
 
-        if (current_section != last_section)
+        if (frames >= block)
         {
-            playback->set_params (playback, br, samplerate, channels);
-            last_section = current_section;
+            vorbis_write_frames (playback, pcmout, frames, channels);
+            frames = 0;
+            block = MIN (block * 2, MAX_FRAMES);
         }
     } /* main loop */
 
+    /* at the end of the stream, or at stop_time */
+    vorbis_write_frames (playback, pcmout, frames, channels);
+
     pthread_mutex_lock (& seek_mutex);
     stop_flag = TRUE;
     pthread_mutex_unlock (& seek_mutex);
@@ -442,6 +456,7 @@ stop_processing:
 play_cleanup:
 
     ov_clear(&vf);
+    g_free (pcmout);
     g_free (title);
     return ! error;
 }
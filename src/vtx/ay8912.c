@@ -1,6 +1,7 @@
 /* AY/YM emulator implementation. */
 
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include "ayemu.h"
 
@@ -392,17 +393,127 @@ static void prepare_generation(ayemu_ay_t *ay)
 }
 
 
+#define ENVVOL Envelope [ay->regs.env_style][ay->env_pos]
+
+/* Mix one chip tact with the current generator states. */
+static void mix_tact(ayemu_ay_t *ay, int *mix_l, int *mix_r)
+{
+  int tmpvol;
+
+  if ((ay->bit_a | !ay->regs.R7_tone_a) & (ay->bit_n | !ay->regs.R7_noise_a)) {
+    tmpvol = (ay->regs.env_a)? ENVVOL : ay->regs.vol_a * 2 + 1;
+    *mix_l += ay->vols[0][tmpvol];
+    *mix_r += ay->vols[1][tmpvol];
+  }
+
+  if ((ay->bit_b | !ay->regs.R7_tone_b) & (ay->bit_n | !ay->regs.R7_noise_b)) {
+    tmpvol =(ay->regs.env_b)? ENVVOL :  ay->regs.vol_b * 2 + 1;
+    *mix_l += ay->vols[2][tmpvol];
+    *mix_r += ay->vols[3][tmpvol];
+  }
+
+  if ((ay->bit_c | !ay->regs.R7_tone_c) & (ay->bit_n | !ay->regs.R7_noise_c)) {
+    tmpvol = (ay->regs.env_c)? ENVVOL : ay->regs.vol_c * 2 + 1;
+    *mix_l += ay->vols[4][tmpvol];
+    *mix_r += ay->vols[5][tmpvol];
+  }
+}
+
+/* Run one chip tact: step every generator, then mix. */
+static void step_tact(ayemu_ay_t *ay, int *mix_l, int *mix_r)
+{
+  if (++ay->cnt_a >= ay->regs.tone_a) {
+    ay->cnt_a = 0;
+    ay->bit_a = ! ay->bit_a;
+  }
+  if (++ay->cnt_b >= ay->regs.tone_b) {
+    ay->cnt_b = 0;
+    ay->bit_b = ! ay->bit_b;
+  }
+  if (++ay->cnt_c >= ay->regs.tone_c) {
+    ay->cnt_c = 0;
+    ay->bit_c = ! ay->bit_c;
+  }
+
+  /* GenNoise (c) Hacker KAY & Sergey Bulba */
+  if (++ay->cnt_n >= (ay->regs.noise * 2)) {
+    ay->cnt_n = 0;
+    ay->Cur_Seed = (ay->Cur_Seed * 2 + 1) ^ \
+      (((ay->Cur_Seed >> 16) ^ (ay->Cur_Seed >> 13)) & 1);
+    ay->bit_n = ((ay->Cur_Seed >> 16) & 1);
+  }
+
+  if (++ay->cnt_e >= ay->regs.env_freq) {
+    ay->cnt_e = 0;
+    if (++ay->env_pos > 127)
+      ay->env_pos = 64;
+  }
+
+  mix_tact(ay, mix_l, mix_r);
+}
+
+/* Number of tacts from now on during which no generator changes state,
+   i.e. one less than the tacts until the first counter wraps. */
+static int steady_tacts(ayemu_ay_t *ay)
+{
+  int run = ay->regs.tone_a - ay->cnt_a;
+
+#define NEAREST(period, cnt) if ((period) - (cnt) < run) run = (period) - (cnt)
+  NEAREST(ay->regs.tone_b, ay->cnt_b);
+  NEAREST(ay->regs.tone_c, ay->cnt_c);
+  NEAREST(ay->regs.noise * 2, ay->cnt_n);
+  NEAREST(ay->regs.env_freq, ay->cnt_e);
+#undef NEAREST
+
+  return (run > 1) ? run - 1 : 0;
+}
+
+/* Skip tacts that steady_tacts() has said change nothing. */
+static void advance_tacts(ayemu_ay_t *ay, int n)
+{
+  ay->cnt_a += n;
+  ay->cnt_b += n;
+  ay->cnt_c += n;
+  ay->cnt_n += n;
+  ay->cnt_e += n;
+}
+
+static unsigned char *put_sample(ayemu_ay_t *ay, unsigned char *sound_buf, int mix_l, int mix_r)
+{
+  if (ay->sndfmt.bpc == 8) {
+    mix_l = (mix_l >> 8) | 128; /* 8 bit sound */
+    mix_r = (mix_r >> 8) | 128;
+    *sound_buf++ = mix_l;
+    if (ay->sndfmt.channels != 1)
+      *sound_buf++ = mix_r;
+  } else {
+    *sound_buf++ = mix_l & 0x00FF; /* 16 bit sound */
+    *sound_buf++ = (mix_l >> 8);
+    if (ay->sndfmt.channels != 1) {
+      *sound_buf++ = mix_r & 0x00FF;
+      *sound_buf++ = (mix_r >> 8);
+    }
+  }
+  return sound_buf;
+}
+
 /*! Generate sound.
  * Fill sound buffer with current register data
  * Return value: pointer to next data in output sound buffer
  * \retval \b 1 if OK, \b 0 if error occures.
+ *
+ * Tone periods are usually far longer than one output sample, so whole
+ * samples in which no generator changes are written as copies of the
+ * first one, and steady stretches inside a sample are mixed once and
+ * multiplied rather than tact by tact.
  */
 void *ayemu_gen_sound(ayemu_ay_t *ay, void *buff, size_t sound_bufsize)
 {
   int mix_l, mix_r;
-  int tmpvol;
-  int m;
+  int cur_l, cur_r;
+  int m, run, nsamples;
   int snd_numcount;
+  int frame_size;
   unsigned char *sound_buf = buff;
 
   if (!check_magic(ay))
@@ -410,76 +521,62 @@ void *ayemu_gen_sound(ayemu_ay_t *ay, void *buff, size_t sound_bufsize)
 
   prepare_generation(ay);
 
-  snd_numcount = sound_bufsize / (ay->sndfmt.channels * (ay->sndfmt.bpc >> 3));
-  while (snd_numcount-- > 0) {
+  frame_size = ay->sndfmt.channels * (ay->sndfmt.bpc >> 3);
+  snd_numcount = sound_bufsize / frame_size;
+  while (snd_numcount > 0) {
     mix_l = mix_r = 0;
-
-    for (m = 0 ; m < ay->ChipTacts_per_outcount ; m++) {
-      if (++ay->cnt_a >= ay->regs.tone_a) {
-	ay->cnt_a = 0;
-	ay->bit_a = ! ay->bit_a;
-      }
-      if (++ay->cnt_b >= ay->regs.tone_b) {
-	ay->cnt_b = 0;
-	ay->bit_b = ! ay->bit_b;
+    m = ay->ChipTacts_per_outcount;
+
+    /* several whole samples without a state change: all come out equal */
+    run = steady_tacts(ay);
+    nsamples = (m > 0) ? run / m : 0;
+    if (nsamples > snd_numcount)
+      nsamples = snd_numcount;
+
+    if (nsamples > 1) {
+      unsigned char *first = sound_buf;
+      int done = 1;
+
+      mix_tact(ay, &mix_l, &mix_r);
+      sound_buf = put_sample(ay, sound_buf, mix_l * m / ay->Amp_Global, mix_r * m / ay->Amp_Global);
+
+      /* double the filled span until the run is covered */
+      while (done < nsamples) {
+	int n = (done * 2 <= nsamples) ? done : nsamples - done;
+	memcpy(sound_buf, first, (size_t) n * frame_size);
+	sound_buf += n * frame_size;
+	done += n;
       }
-      if (++ay->cnt_c >= ay->regs.tone_c) {
-	ay->cnt_c = 0;
-	ay->bit_c = ! ay->bit_c;
-      }
-
-      /* GenNoise (c) Hacker KAY & Sergey Bulba */
-      if (++ay->cnt_n >= (ay->regs.noise * 2)) {
-	ay->cnt_n = 0;
-	ay->Cur_Seed = (ay->Cur_Seed * 2 + 1) ^ \
-	  (((ay->Cur_Seed >> 16) ^ (ay->Cur_Seed >> 13)) & 1);
-	ay->bit_n = ((ay->Cur_Seed >> 16) & 1);
-      }
-
-      if (++ay->cnt_e >= ay->regs.env_freq) {
-	ay->cnt_e = 0;
-	if (++ay->env_pos > 127)
-	  ay->env_pos = 64;
-      }
-
-#define ENVVOL Envelope [ay->regs.env_style][ay->env_pos]
 
-      if ((ay->bit_a | !ay->regs.R7_tone_a) & (ay->bit_n | !ay->regs.R7_noise_a)) {
-	tmpvol = (ay->regs.env_a)? ENVVOL : ay->regs.vol_a * 2 + 1;
-	mix_l += ay->vols[0][tmpvol];
-	mix_r += ay->vols[1][tmpvol];
-      }
+      advance_tacts(ay, nsamples * m);
+      snd_numcount -= nsamples;
+      continue;
+    }
 
-      if ((ay->bit_b | !ay->regs.R7_tone_b) & (ay->bit_n | !ay->regs.R7_noise_b)) {
-	tmpvol =(ay->regs.env_b)? ENVVOL :  ay->regs.vol_b * 2 + 1;
-	mix_l += ay->vols[2][tmpvol];
-	mix_r += ay->vols[3][tmpvol];
+    while (m > 0) {
+      if (run > 0) {
+	if (run > m)
+	  run = m;
+	cur_l = cur_r = 0;
+	mix_tact(ay, &cur_l, &cur_r);
+	mix_l += cur_l * run;
+	mix_r += cur_r * run;
+	advance_tacts(ay, run);
+	m -= run;
+	if (m == 0)
+	  break;
       }
 
-      if ((ay->bit_c | !ay->regs.R7_tone_c) & (ay->bit_n | !ay->regs.R7_noise_c)) {
-	tmpvol = (ay->regs.env_c)? ENVVOL : ay->regs.vol_c * 2 + 1;
-	mix_l += ay->vols[4][tmpvol];
-	mix_r += ay->vols[5][tmpvol];
-      }
-    } /* end for (m=0; ...) */
+      step_tact(ay, &mix_l, &mix_r);
+      m--;
+      run = steady_tacts(ay);
+    }
 
     mix_l /= ay->Amp_Global;
     mix_r /= ay->Amp_Global;
 
-    if (ay->sndfmt.bpc == 8) {
-      mix_l = (mix_l >> 8) | 128; /* 8 bit sound */
-      mix_r = (mix_r >> 8) | 128;
-      *sound_buf++ = mix_l;
-      if (ay->sndfmt.channels != 1)
-	*sound_buf++ = mix_r;
-    } else {
-      *sound_buf++ = mix_l & 0x00FF; /* 16 bit sound */
-      *sound_buf++ = (mix_l >> 8);
-      if (ay->sndfmt.channels != 1) {
-	*sound_buf++ = mix_r & 0x00FF;
-	*sound_buf++ = (mix_r >> 8);
-      }
-    }
+    sound_buf = put_sample(ay, sound_buf, mix_l, mix_r);
+    snd_numcount--;
   }
   return sound_buf;
 }
@@ -54,7 +54,7 @@ typedef struct
 {
   VFSFile *fp;			/**< opening .vtx file pointer */
   struct VTXFileHeader hdr;  	/**< VTX header data */
-  char *regdata;		/**< unpacked song data */
+  char *regdata;		/**< unpacked song data, 14 bytes per frame */
   int pos;			/**< current data frame offset */
 } ayemu_vtx_t;
 
@@ -65,6 +65,14 @@ typedef struct
     \return Return true if success, else false
 */
 EXTERN int ayemu_vtx_open (ayemu_vtx_t *vtx, const char *filename);
+
+/** Read vtx file header from a file already open, which is left open
+    \arg \c vtx - pointer to ayemu_vtx_t structure
+    \arg \c fp - file positioned at the start of the header
+    \arg \c filename - name of the file, for error messages
+    \return Return true if success, else false
+*/
+EXTERN int ayemu_vtx_read_header (ayemu_vtx_t *vtx, VFSFile *fp, const char *filename);
   
 /** Read and encode lha data from .vtx file.
  * \return Return pointer to unpacked data or NULL.
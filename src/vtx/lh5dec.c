@@ -31,7 +31,6 @@ static unsigned short bitbuf;
 
 static unsigned long origsize, compsize;
 static unsigned char *in_buf;
-static unsigned char *out_buf;
 
 static unsigned short  subbitbuf;
 static int   bitcount;
@@ -269,7 +268,11 @@ static void decode(unsigned short count, unsigned char buffer[])
   }
 }
 
-void lh5_decode(unsigned char *inp, unsigned char *outp, unsigned long original_size, unsigned long packed_size)
+/* The output is passed to output() a dictionary at a time (up to 8 KB) as
+   it is decoded, so the caller can put it wherever it is wanted without
+   holding all of it in one piece first. */
+void lh5_decode(unsigned char *inp, unsigned long original_size, unsigned long packed_size,
+		void (*output)(unsigned char *data, unsigned short n, void *user), void *user)
 {
   unsigned short n;
   unsigned char *buffer;
@@ -277,7 +280,6 @@ void lh5_decode(unsigned char *inp, unsigned char *outp, unsigned long original_
   compsize = packed_size;
   origsize = original_size;
   in_buf = inp;
-  out_buf = outp;
 
   buffer = (unsigned char *) malloc(DICSIZ);
   if (!buffer) error ("Out of memory");
@@ -290,8 +292,7 @@ void lh5_decode(unsigned char *inp, unsigned char *outp, unsigned long original_
   while (origsize != 0) {
     n = (origsize > DICSIZ) ? DICSIZ : (unsigned short)origsize;
     decode(n, buffer);
-    memmove(out_buf, buffer, n);
-    out_buf += n;
+    output(buffer, n, user);
     origsize -= n;
   }
 
@@ -28,6 +28,7 @@
 
 #include "vtx.h"
 #include "ayemu.h"
+#include "../decodeahead/decodeahead.h"
 
 #define SNDBUFSIZE 1024
 static gchar sndbuf[SNDBUFSIZE];
@@ -36,9 +37,8 @@ static gint chans = 2;
 static gint bits = 16;
 
 static pthread_mutex_t seek_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t seek_cond = PTHREAD_COND_INITIALIZER;
-static gint seek_value;
 static gboolean stop_flag = FALSE;
+static DecodeAhead decodeahead = DECODEAHEAD_INIT;
 
 ayemu_ay_t ay;
 ayemu_vtx_t vtx;
@@ -79,20 +79,16 @@ Tuple *vtx_probe_for_tuple(const gchar *filename, VFSFile *fd)
 {
     ayemu_vtx_t tmp;
 
-    if (ayemu_vtx_open(&tmp, filename))
-    {
-        Tuple *ti = vtx_get_song_tuple_from_vtx(filename, &tmp);
-        ayemu_vtx_free(&tmp);
-        return ti;
-    }
+    /* only the header is needed, read from the file as given */
+    if (vfs_fseek(fd, 0, SEEK_SET) == 0 && ayemu_vtx_read_header(&tmp, fd, filename))
+        return vtx_get_song_tuple_from_vtx(filename, &tmp);
 
     return NULL;
 }
 
-static gboolean vtx_play(InputPlayback * playback, const gchar * filename,
- VFSFile * file, gint start_time, gint stop_time, gboolean pause)
+/* runs on the decode-ahead thread */
+static bool_t vtx_render(DecodeAhead * d, void * unused)
 {
-    gboolean error = FALSE;
     gboolean eof = FALSE;
     void *stream;               /* pointer to current position in sound buffer */
     guchar regs[14];
@@ -100,10 +96,62 @@ static gboolean vtx_play(InputPlayback * playback, const gchar * filename,
     gint left;                   /* how many sound frames can play with current AY register frame */
     gint donow;
     gint rate;
+    gint seek;
 
     left = 0;
     rate = chans * (bits / 8);
 
+    while (!stop_flag)
+    {
+        if ((seek = decodeahead_get_seek(d)) >= 0)
+        {
+            vtx.pos = seek * 50 / 1000;     /* (time in sec) * 50 = offset in AY register data frames */
+            left = 0;
+            eof = FALSE;
+            decodeahead_seek_done(d);
+        }
+
+        /* fill sound buffer */
+        stream = sndbuf;
+
+        for (need = SNDBUFSIZE / rate; need > 0; need -= donow)
+            if (left > 0)
+            {                   /* use current AY register frame */
+                donow = (need > left) ? left : need;
+                left -= donow;
+                stream = ayemu_gen_sound(&ay, (char *)stream, donow * rate);
+            }
+            else
+            {                   /* get next AY register frame */
+                if (ayemu_vtx_get_next_frame(&vtx, (char *)regs) == 0)
+                {
+                    donow = need;
+                    memset(stream, 0, donow * rate);
+                    eof = TRUE;
+                }
+                else
+                {
+                    left = freq / vtx.hdr.playerFreq;
+                    ayemu_set_regs(&ay, regs);
+                    donow = 0;
+                }
+            }
+
+        if (!decodeahead_write(d, sndbuf, SNDBUFSIZE))
+            break;
+
+        if (eof && !decodeahead_finish(d))
+            break;
+    }
+
+    return TRUE;
+}
+
+static gboolean vtx_play(InputPlayback * playback, const gchar * filename,
+ VFSFile * file, gint start_time, gint stop_time, gboolean pause)
+{
+    gboolean error = FALSE;
+
     memset(&ay, 0, sizeof(ay));
 
     if (!ayemu_vtx_open(&vtx, filename))
@@ -139,59 +187,13 @@ static gboolean vtx_play(InputPlayback * playback, const gchar * filename,
     playback->set_params(playback, 14 * 50 * 8, freq, bits / 8);
     playback->set_pb_ready(playback);
 
-    while (!stop_flag)
-    {
-        pthread_mutex_lock(&seek_mutex);
-
-        if (seek_value >= 0)
-        {
-            vtx.pos = seek_value * 50 / 1000;     /* (time in sec) * 50 = offset in AY register data frames */
-            playback->output->flush(seek_value);
-            seek_value = -1;
-            pthread_cond_broadcast(&seek_cond);
-        }
-
-        pthread_mutex_unlock(&seek_mutex);
-
-        /* fill sound buffer */
-        stream = sndbuf;
-
-        for (need = SNDBUFSIZE / rate; need > 0; need -= donow)
-            if (left > 0)
-            {                   /* use current AY register frame */
-                donow = (need > left) ? left : need;
-                left -= donow;
-                stream = ayemu_gen_sound(&ay, (char *)stream, donow * rate);
-            }
-            else
-            {                   /* get next AY register frame */
-                if (ayemu_vtx_get_next_frame(&vtx, (char *)regs) == 0)
-                {
-                    donow = need;
-                    memset(stream, 0, donow * rate);
-                    eof = TRUE;
-                }
-                else
-                {
-                    left = freq / vtx.hdr.playerFreq;
-                    ayemu_set_regs(&ay, regs);
-                    donow = 0;
-                }
-            }
-
-        if (!stop_flag)
-            playback->output->write_audio(sndbuf, SNDBUFSIZE);
+    decodeahead_play(&decodeahead, playback, freq, chans * (bits / 8),
+     vtx_render, NULL);
 
-        if (eof)
-            goto CLEANUP;
-    }
-
-CLEANUP:
     ayemu_vtx_free(&vtx);
 
     pthread_mutex_lock(&seek_mutex);
     stop_flag = TRUE;
-    pthread_cond_broadcast(&seek_cond); /* wake up any waiting request */
     pthread_mutex_unlock(&seek_mutex);
 
 ERR_NO_CLOSE:
@@ -207,7 +209,7 @@ void vtx_stop(InputPlayback * playback)
     {
         stop_flag = TRUE;
         playback->output->abort_write();
-        pthread_cond_broadcast(&seek_cond);
+        decodeahead_stop(&decodeahead);
     }
 
     pthread_mutex_unlock(&seek_mutex);
@@ -218,12 +220,7 @@ void vtx_seek(InputPlayback * playback, gint time)
     pthread_mutex_lock(&seek_mutex);
 
     if (!stop_flag)
-    {
-        seek_value = time;
-        playback->output->abort_write();
-        pthread_cond_broadcast(&seek_cond);
-        pthread_cond_wait(&seek_cond, &seek_mutex);
-    }
+        decodeahead_seek(&decodeahead, time);
 
     pthread_mutex_unlock(&seek_mutex);
 }
@@ -11,7 +11,8 @@
 #include "ayemu.h"
 
 /* defined in lh5dec.c */
-extern void lh5_decode(unsigned char *inp,unsigned char *outp,unsigned long original_size, unsigned long packed_size);
+extern void lh5_decode(unsigned char *inp, unsigned long original_size, unsigned long packed_size,
+		       void (*output)(unsigned char *data, unsigned short n, void *user), void *user);
 
 
 /* Read 8-bit integer from file.
@@ -105,21 +106,43 @@ static int read_NTstring(VFSFile *fp, char s[])
  *  Return value: true if success, else false
  */
 int ayemu_vtx_open (ayemu_vtx_t *vtx, const char *filename)
+{
+  VFSFile *fp;
+
+  if ((fp = vfs_fopen (filename, "rb")) == NULL) {
+    fprintf(stderr, "ayemu_vtx_open: Cannot open file %s: %s\n", filename, strerror(errno));
+    vtx->fp = NULL;
+    vtx->regdata = NULL;
+    return 0;
+  }
+
+  if (!ayemu_vtx_read_header (vtx, fp, filename)) {
+    vfs_fclose (fp);
+    return 0;
+  }
+
+  vtx->fp = fp;
+  return 1;
+}
+
+/** Read vtx file header from an open file
+ *
+ *  Reads the header in struct vtx from the current position of fp, which is
+ *  left open.  Touches nothing but vtx, so any number of files can be read
+ *  at once.  Return value: true if success, else false
+ */
+int ayemu_vtx_read_header (ayemu_vtx_t *vtx, VFSFile *fp, const char *filename)
 {
   char buf[2];
   int error = 0;
   int32_t int_regdata_size;
 
+  vtx->fp = NULL;
   vtx->regdata = NULL;
 
-  if ((vtx->fp = vfs_fopen (filename, "rb")) == NULL) {
-    fprintf(stderr, "ayemu_vtx_open: Cannot open file %s: %s\n", filename, strerror(errno));
-    return 0;
-  }
-
-  if (vfs_fread(buf, 2, 1, vtx->fp) != 1) {
+  if (vfs_fread(buf, 2, 1, fp) != 1) {
     fprintf(stderr,"ayemu_vtx_open: Can't read from %s: %s\n", filename, strerror(errno));
-    error = 1;
+    return 0;
   }
 
   buf[0] = tolower(buf[0]);
@@ -135,29 +158,48 @@ int ayemu_vtx_open (ayemu_vtx_t *vtx, const char *filename)
   }
 
   /* read VTX header info in order format specified, see http:// ..... */
-  if (!error) error = read_byte(vtx->fp, &vtx->hdr.stereo);
-  if (!error) error = read_word16(vtx->fp, &vtx->hdr.loop);
-  if (!error) error = read_word32(vtx->fp, &vtx->hdr.chipFreq);
-  if (!error) error = read_byte(vtx->fp, &vtx->hdr.playerFreq);
-  if (!error) error = read_word16(vtx->fp, &vtx->hdr.year);
+  if (!error) error = read_byte(fp, &vtx->hdr.stereo);
+  if (!error) error = read_word16(fp, &vtx->hdr.loop);
+  if (!error) error = read_word32(fp, &vtx->hdr.chipFreq);
+  if (!error) error = read_byte(fp, &vtx->hdr.playerFreq);
+  if (!error) error = read_word16(fp, &vtx->hdr.year);
   if (!error) {
-	error = read_word32(vtx->fp, &int_regdata_size);
+	error = read_word32(fp, &int_regdata_size);
 	vtx->hdr.regdata_size = (size_t) int_regdata_size;
   }
 
-  if (!error) error = read_NTstring(vtx->fp, vtx->hdr.title);
-  if (!error) error = read_NTstring(vtx->fp, vtx->hdr.author);
-  if (!error) error = read_NTstring(vtx->fp, vtx->hdr.from);
-  if (!error) error = read_NTstring(vtx->fp, vtx->hdr.tracker);
-  if (!error) error = read_NTstring (vtx->fp, vtx->hdr.comment);
+  if (!error) error = read_NTstring(fp, vtx->hdr.title);
+  if (!error) error = read_NTstring(fp, vtx->hdr.author);
+  if (!error) error = read_NTstring(fp, vtx->hdr.from);
+  if (!error) error = read_NTstring(fp, vtx->hdr.tracker);
+  if (!error) error = read_NTstring (fp, vtx->hdr.comment);
 
-  if (error) {
-    vfs_fclose(vtx->fp);
-    vtx->fp = NULL;
-  }
   return !error;
 }
 
+/* The file stores each register for all frames in turn.  The unpacked
+   bytes are scattered as they come out of the decoder so every 14-byte frame
+   is contiguous and fetching one is a single copy; bytes past the last whole
+   frame are dropped. */
+struct frame_sink {
+  char *frames;
+  size_t numframes;
+  size_t reg, frame;		/* where the next byte goes */
+};
+
+static void put_regdata (unsigned char *data, unsigned short n, void *user)
+{
+  struct frame_sink *sink = user;
+
+  while (n-- && sink->reg < 14) {
+    sink->frames[sink->frame * 14 + sink->reg] = *data++;
+    if (++sink->frame == sink->numframes) {
+      sink->frame = 0;
+      sink->reg++;
+    }
+  }
+}
+
 /** Read and encode lha data from .vtx file
  *
  * Return value: pointer to unpacked data or NULL
@@ -165,10 +207,11 @@ int ayemu_vtx_open (ayemu_vtx_t *vtx, const char *filename)
  */
 char *ayemu_vtx_load_data (ayemu_vtx_t *vtx)
 {
-  char *packed_data;
+  char *packed_data, *grown;
   size_t packed_size;
   size_t buf_alloc;
-  int c;
+  int64_t n;
+  struct frame_sink sink;
 
   if (vtx->fp == NULL) {
     fprintf(stderr, "ayemu_vtx_load_data: tune file not open yet (do you call ayemu_vtx_open first?)\n");
@@ -178,27 +221,35 @@ char *ayemu_vtx_load_data (ayemu_vtx_t *vtx)
   buf_alloc = 4096;
   packed_data = (char *) malloc (buf_alloc);
   /* read packed AY register data to end of file. */
-  while ((c = vfs_getc (vtx->fp)) != EOF) {
-    if (buf_alloc < packed_size) {
+  while (packed_data && (n = vfs_fread (packed_data + packed_size, 1, buf_alloc - packed_size, vtx->fp)) > 0) {
+    packed_size += n;
+    if (packed_size == buf_alloc) {
       buf_alloc *= 2;
-      packed_data = (char *) realloc (packed_data, buf_alloc);
-      if (packed_data == NULL) {
-	fprintf (stderr, "ayemu_vtx_load_data: Packed data out of memory!\n");
-	vfs_fclose (vtx->fp);
-	return NULL;
-      }
+      if ((grown = (char *) realloc (packed_data, buf_alloc)) == NULL)
+	free (packed_data);
+      packed_data = grown;
     }
-    packed_data[packed_size++] = c;
   }
   vfs_fclose (vtx->fp);
   vtx->fp = NULL;
-  if ((vtx->regdata = (char *) malloc (vtx->hdr.regdata_size)) == NULL) {
+  if (packed_data == NULL) {
+    fprintf (stderr, "ayemu_vtx_load_data: Packed data out of memory!\n");
+    return NULL;
+  }
+
+  sink.numframes = vtx->hdr.regdata_size / 14;
+  sink.reg = sink.numframes ? 0 : 14;
+  sink.frame = 0;
+
+  if ((sink.frames = (char *) malloc (sink.numframes * 14 + 1)) == NULL) {
     fprintf (stderr, "ayemu_vtx_load_data: Can allocate %d bytes for unpack register data\n", (int)(vtx->hdr.regdata_size));
     free (packed_data);
     return NULL;
   }
-  lh5_decode ((unsigned char *)packed_data, (unsigned char *)(vtx->regdata), vtx->hdr.regdata_size, packed_size);
+  lh5_decode ((unsigned char *)packed_data, vtx->hdr.regdata_size, packed_size, put_regdata, &sink);
   free (packed_data);
+
+  vtx->regdata = sink.frames;
   vtx->pos = 0;
   return vtx->regdata;
 }
@@ -210,13 +261,10 @@ char *ayemu_vtx_load_data (ayemu_vtx_t *vtx)
 int ayemu_vtx_get_next_frame (ayemu_vtx_t *vtx, char *regs)
 {
   int numframes = vtx->hdr.regdata_size / 14;
-  if (vtx->pos++ >= numframes)
+  if (vtx->pos >= numframes)
     return 0;
   else {
-    int n;
-    char *p = vtx->regdata + vtx->pos;
-    for(n = 0 ; n < 14 ; n++, p+=numframes)
-      regs[n] = *p;
+    memcpy (regs, vtx->regdata + vtx->pos++ * 14, 14);
     return 1;
   }
 }
@@ -0,0 +1,110 @@
+/*
+ * Background Warm-up for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "warmup.h"
+
+#include <audacious/debug.h>
+
+/* Runs the warm-up in the calling thread unless it is done or under way
+ * already, then waits for it to be done. */
+static void run_locked (Warmup * warmup, char background)
+{
+    if (! warmup->done && ! warmup->running)
+    {
+        warmup->running = TRUE;
+        pthread_mutex_unlock (& warmup->mutex);
+
+        int64_t begin = perfstat_now ();
+        warmup->run ();
+        int64_t spent = perfstat_now () - begin;
+
+        perfstat_add (& warmup->warmup, spent, 0);
+        AUDDBG ("%s: warm-up took %d ms (%s).\n", warmup->plugin, (int)
+         (spent / 1000000), background ? "in the background" : "on first use");
+
+        pthread_mutex_lock (& warmup->mutex);
+        warmup->running = FALSE;
+        warmup->done = TRUE;
+        pthread_cond_broadcast (& warmup->cond);
+    }
+
+    while (! warmup->done)
+        pthread_cond_wait (& warmup->cond, & warmup->mutex);
+}
+
+static void * warmup_thread (void * data)
+{
+    Warmup * warmup = data;
+
+    pthread_mutex_lock (& warmup->mutex);
+    run_locked (warmup, TRUE);
+    pthread_mutex_unlock (& warmup->mutex);
+
+    return NULL;
+}
+
+void warmup_start (Warmup * warmup, int64_t init_begin)
+{
+    int64_t spent = perfstat_now () - init_begin;
+
+    perfstat_register (& warmup->init);
+    perfstat_register (& warmup->warmup);
+    perfstat_register (& warmup->wait);
+    perfstat_add (& warmup->init, spent, 0);
+
+    AUDDBG ("%s: init took %d ms.\n", warmup->plugin, (int) (spent / 1000000));
+
+    pthread_mutex_lock (& warmup->mutex);
+
+    /* If no thread can be had, the work is done on first use instead. */
+    if (! warmup->thread_started && ! pthread_create (& warmup->thread, NULL,
+     warmup_thread, warmup))
+        warmup->thread_started = TRUE;
+
+    pthread_mutex_unlock (& warmup->mutex);
+}
+
+void warmup_wait (Warmup * warmup)
+{
+    pthread_mutex_lock (& warmup->mutex);
+
+    if (! warmup->done)
+    {
+        int64_t begin = perfstat_now ();
+        run_locked (warmup, FALSE);
+        perfstat_add (& warmup->wait, perfstat_now () - begin, 0);
+    }
+
+    pthread_mutex_unlock (& warmup->mutex);
+}
+
+void warmup_stop (Warmup * warmup)
+{
+    pthread_mutex_lock (& warmup->mutex);
+    char joinable = warmup->thread_started;
+    pthread_mutex_unlock (& warmup->mutex);
+
+    if (joinable)
+        pthread_join (warmup->thread, NULL);
+
+    pthread_mutex_lock (& warmup->mutex);
+    warmup->thread_started = FALSE;
+    warmup->done = FALSE;
+    pthread_mutex_unlock (& warmup->mutex);
+}
@@ -0,0 +1,65 @@
+/*
+ * Background Warm-up for Audacious Plugins
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUDACIOUS_WARMUP_H
+#define AUDACIOUS_WARMUP_H
+
+#include <pthread.h>
+
+#include "../perfstat/perfstat.h"
+
+/* Audacious initializes every enabled plugin at startup, whether or not it is
+ * going to be used.  A plugin with expensive setup (loading a database,
+ * scanning for modules) does only the cheap part in init and hands the rest to
+ * a Warmup, which runs it on a thread of its own.  Anything that needs the
+ * result first calls warmup_wait(), which returns at once if the work is done,
+ * waits if it is under way, and otherwise does it there and then.
+ *
+ * The time taken by init, by the warm-up itself, and by anyone who had to wait
+ * for it are recorded as perfstat stats ("init", "warm-up", "warm-up wait"),
+ * so that they show up with the other timings, and also logged in debug
+ * mode. */
+
+typedef struct {
+    const char * plugin;
+    void (* run) (void);
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    char thread_started, running, done;
+
+    PerfStat init, warmup, wait;
+} Warmup;
+
+#define WARMUP_INIT(plugin, run) {plugin, run, PTHREAD_MUTEX_INITIALIZER, \
+ PTHREAD_COND_INITIALIZER, .init = PERFSTAT_INIT (plugin, "init"), \
+ .warmup = PERFSTAT_INIT (plugin, "warm-up"), \
+ .wait = PERFSTAT_INIT (plugin, "warm-up wait")}
+
+/* Called at the end of init; init_begin is perfstat_now() as of the start. */
+void warmup_start (Warmup * warmup, int64_t init_begin);
+
+void warmup_wait (Warmup * warmup);
+
+/* Called from cleanup, before undoing what the warm-up did.  Waits for it if
+ * it is under way; afterward the Warmup can be started again. */
+void warmup_stop (Warmup * warmup);
+
+#endif
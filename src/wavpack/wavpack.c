@@ -1,3 +1,4 @@
+#include <math.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,9 +10,17 @@
 #include <audacious/i18n.h>
 #include <audacious/plugin.h>
 
-#define BUFFER_SIZE 256 /* read buffer size, in samples / frames */
-#define SAMPLE_SIZE(a) (a == 8 ? sizeof(uint8_t) : (a == 16 ? sizeof(uint16_t) : sizeof(uint32_t)))
-#define SAMPLE_FMT(a) (a == 8 ? FMT_S8 : (a == 16 ? FMT_S16_NE : (a == 24 ? FMT_S24_NE : FMT_S32_NE)))
+#include "../pcmconv/pcmconv.h"
+
+/* Frames unpacked at once.  Each seek starts over with small blocks, so that
+ * the output has something to play quickly; after that the blocks double up
+ * to MAX_BUFFER_SIZE. */
+#define MIN_BUFFER_SIZE 256
+#define MAX_BUFFER_SIZE 8192
+
+/* WavPack returns samples in the low bytes of 32-bit integers, or as floats
+ * in float mode; bits per sample is informational only. */
+#define SAMPLE_FMT(a) (a == 1 ? FMT_S8 : (a == 2 ? FMT_S16_NE : (a == 3 ? FMT_S24_NE : FMT_S32_NE)))
 
 
 /* Global mutexes etc.
@@ -115,9 +124,10 @@ static bool_t wv_play (InputPlayback * playback, const char * filename,
         return FALSE;
 
     int32_t *input = NULL;
-    void *output = NULL;
-    int sample_rate, num_channels, bits_per_sample;
+    int sample_rate, num_channels, bytes_per_sample, format;
     unsigned num_samples;
+    int block = MIN_BUFFER_SIZE;
+    float float_scale = 1;
     WavpackContext *ctx = NULL;
     VFSFile *wvc_input = NULL;
     bool_t error = FALSE;
@@ -132,10 +142,22 @@ static bool_t wv_play (InputPlayback * playback, const char * filename,
 
     sample_rate = WavpackGetSampleRate(ctx);
     num_channels = WavpackGetNumChannels(ctx);
-    bits_per_sample = WavpackGetBitsPerSample(ctx);
+    bytes_per_sample = WavpackGetBytesPerSample(ctx);
     num_samples = WavpackGetNumSamples(ctx);
 
-    if (!playback->output->open_audio(SAMPLE_FMT(bits_per_sample), sample_rate, num_channels))
+    if (WavpackGetMode(ctx) & MODE_FLOAT)
+    {
+        int norm_exp = WavpackGetFloatNormExp(ctx);
+
+        format = FMT_FLOAT;
+
+        if (norm_exp != 127)
+            float_scale = ldexpf(1, 127 - norm_exp);
+    }
+    else
+        format = SAMPLE_FMT(bytes_per_sample);
+
+    if (!playback->output->open_audio(format, sample_rate, num_channels))
     {
         fprintf (stderr, "Error opening audio output.");
         error = TRUE;
@@ -145,9 +167,10 @@ static bool_t wv_play (InputPlayback * playback, const char * filename,
     if (pause)
         playback->output->pause(TRUE);
 
-    input = malloc(BUFFER_SIZE * num_channels * sizeof(uint32_t));
-    output = malloc(BUFFER_SIZE * num_channels * SAMPLE_SIZE(bits_per_sample));
-    if (input == NULL || output == NULL)
+    /* 8- and 16-bit samples are narrowed in place; everything else is
+     * written straight from the unpack buffer. */
+    input = malloc(MAX_BUFFER_SIZE * num_channels * sizeof(int32_t));
+    if (input == NULL)
         goto error_exit;
 
     playback->set_gain_from_playlist(playback);
@@ -178,6 +201,7 @@ static bool_t wv_play (InputPlayback * playback, const char * filename,
             playback->output->flush (seek_value);
             WavpackSeekSample (ctx, (int64_t) seek_value * sample_rate / 1000);
             seek_value = -1;
+            block = MIN_BUFFER_SIZE;
         }
 
         pthread_mutex_unlock (& mutex);
@@ -185,7 +209,7 @@ static bool_t wv_play (InputPlayback * playback, const char * filename,
         /* Decode audio data */
         samples_left = num_samples - WavpackGetSampleIndex(ctx);
 
-        ret = WavpackUnpackSamples(ctx, input, BUFFER_SIZE);
+        ret = WavpackUnpackSamples(ctx, input, block);
         if (samples_left == 0)
             stop_flag = TRUE;
         else if (ret < 0)
@@ -196,36 +220,22 @@ static bool_t wv_play (InputPlayback * playback, const char * filename,
         else
         {
             /* Perform audio data conversion and output */
-            unsigned i;
-            int32_t *rp = input;
-            int8_t *wp = output;
-            int16_t *wp2 = output;
-            int32_t *wp4 = output;
-
-            if (bits_per_sample == 8)
-            {
-                for (i = 0; i < ret * num_channels; i++, wp++, rp++)
-                    *wp = *rp & 0xff;
-            }
-            else if (bits_per_sample == 16)
-            {
-                for (i = 0; i < ret * num_channels; i++, wp2++, rp++)
-                    *wp2 = *rp & 0xffff;
-            }
-            else if (bits_per_sample == 24 || bits_per_sample == 32)
-            {
-                for (i = 0; i < ret * num_channels; i++, wp4++, rp++)
-                    *wp4 = *rp;
-            }
-
-            playback->output->write_audio(output, ret * num_channels * SAMPLE_SIZE(bits_per_sample));
+            int samples = ret * num_channels;
+
+            if (format == FMT_S8 || format == FMT_S16_NE)
+                pcm_pack((const int32_t * const *) &input, 8 * bytes_per_sample, 1,
+                 input, format, samples);
+            else if (format == FMT_FLOAT && float_scale != 1)
+                pcm_gain(input, FMT_FLOAT, samples, float_scale, FALSE);
+
+            playback->output->write_audio(input, samples * FMT_SIZEOF(format));
+            block = MIN(block * 2, MAX_BUFFER_SIZE);
         }
     }
 
 error_exit:
 
     free(input);
-    free(output);
     wv_deattach (wvc_input, ctx);
 
     stop_flag = TRUE;
@@ -28,6 +28,8 @@ typedef struct {
   u8 *blank_memory[0x20000];
 } ARM9_struct;
 
-extern ARM9_struct ARM9Mem;
+/* Allocated by the plugin before NDS_Init() (see xsf_mem_get() in vio2sf.c) */
+extern ARM9_struct * ARM9MemPtr;
+#define ARM9Mem (* ARM9MemPtr)
 
 #endif
@@ -46,7 +46,7 @@
 #include "MMU.h"
 #include "GPU.h"
 
-ARM9_struct ARM9Mem;
+ARM9_struct * ARM9MemPtr;
 
 NDS_Screen MainScreen;
 NDS_Screen SubScreen;
@@ -121,20 +121,16 @@ char szRomBaseName[512];
 
 MMU_struct MMU;
 
+/* entries for ARM9Mem are filled in by MMU_Init(), as it is allocated */
 u8 * MMU_ARM9_MEM_MAP[256]={
-/* 0X*/	DUP16(ARM9Mem.ARM9_ITCM), 
-/* 1X*/	//DUP16(ARM9Mem.ARM9_ITCM)
-/* 1X*/	DUP16(ARM9Mem.ARM9_WRAM), 
-/* 2X*/	DUP16(ARM9Mem.MAIN_MEM),
+/* 0X*/	DUP16(NULL), 
+/* 1X*/	DUP16(NULL), 
+/* 2X*/	DUP16(NULL),
 /* 3X*/	DUP16(MMU.SWIRAM),
-/* 4X*/	DUP16(ARM9Mem.ARM9_REG),
-/* 5X*/	DUP16(ARM9Mem.ARM9_VMEM),
-/* 6X*/	DUP2(ARM9Mem.ARM9_ABG), 
-		DUP2(ARM9Mem.ARM9_BBG),
-		DUP2(ARM9Mem.ARM9_AOBJ),
-		DUP2(ARM9Mem.ARM9_BOBJ),
-		DUP8(ARM9Mem.ARM9_LCD),
-/* 7X*/	DUP16(ARM9Mem.ARM9_OAM),
+/* 4X*/	DUP16(NULL),
+/* 5X*/	DUP16(NULL),
+/* 6X*/	DUP16(NULL),
+/* 7X*/	DUP16(NULL),
 /* 8X*/	DUP16(NULL),
 /* 9X*/	DUP16(NULL),
 /* AX*/	DUP16(MMU.CART_RAM),
@@ -142,7 +138,7 @@ u8 * MMU_ARM9_MEM_MAP[256]={
 /* CX*/	DUP16(MMU.UNUSED_RAM),
 /* DX*/	DUP16(MMU.UNUSED_RAM),
 /* EX*/	DUP16(MMU.UNUSED_RAM),
-/* FX*/	DUP16(ARM9Mem.ARM9_BIOS)
+/* FX*/	DUP16(NULL)
 };
 	   
 u32 MMU_ARM9_MEM_MASK[256]={
@@ -172,13 +168,13 @@ u32 MMU_ARM9_MEM_MASK[256]={
 u8 * MMU_ARM7_MEM_MAP[256]={
 /* 0X*/	DUP16(MMU.ARM7_BIOS), 
 /* 1X*/	DUP16(MMU.UNUSED_RAM), 
-/* 2X*/	DUP16(ARM9Mem.MAIN_MEM),
+/* 2X*/	DUP16(NULL),
 /* 3X*/	DUP8(MMU.SWIRAM),
 		DUP8(MMU.ARM7_ERAM),
 /* 4X*/	DUP8(MMU.ARM7_REG),
 		DUP8(MMU.ARM7_WIRAM),
 /* 5X*/	DUP16(MMU.UNUSED_RAM),
-/* 6X*/	DUP16(ARM9Mem.ARM9_ABG), 
+/* 6X*/	DUP16(NULL), 
 /* 7X*/	DUP16(MMU.UNUSED_RAM),
 /* 8X*/	DUP16(NULL),
 /* 9X*/	DUP16(NULL),
@@ -227,6 +223,12 @@ u32 MMU_ARM7_WAIT32[16]={
 	1, 1, 1, 1, 1, 1, 1, 1, 8, 8, 5, 1, 1, 1, 1, 1,
 };
 
+static void MMU_map(u8 * * map, int first, int count, u8 * mem)
+{
+	while (count--)
+		map[first++] = mem;
+}
+
 void MMU_Init(void) {
 	int i;
 
@@ -234,6 +236,22 @@ void MMU_Init(void) {
 
 	memset(&MMU, 0, sizeof(MMU_struct));
 
+	MMU_map(MMU_ARM9_MEM_MAP, 0x00, 16, ARM9Mem.ARM9_ITCM);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x10, 16, ARM9Mem.ARM9_WRAM);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x20, 16, ARM9Mem.MAIN_MEM);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x40, 16, ARM9Mem.ARM9_REG);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x50, 16, ARM9Mem.ARM9_VMEM);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x60, 2, ARM9Mem.ARM9_ABG);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x62, 2, ARM9Mem.ARM9_BBG);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x64, 2, ARM9Mem.ARM9_AOBJ);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x66, 2, ARM9Mem.ARM9_BOBJ);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x68, 8, ARM9Mem.ARM9_LCD);
+	MMU_map(MMU_ARM9_MEM_MAP, 0x70, 16, ARM9Mem.ARM9_OAM);
+	MMU_map(MMU_ARM9_MEM_MAP, 0xF0, 16, ARM9Mem.ARM9_BIOS);
+
+	MMU_map(MMU_ARM7_MEM_MAP, 0x20, 16, ARM9Mem.MAIN_MEM);
+	MMU_map(MMU_ARM7_MEM_MAP, 0x60, 16, ARM9Mem.ARM9_ABG);
+
 	MMU.CART_ROM = MMU.UNUSED_RAM;
 
         for(i = 0x80; i<0xA0; ++i)
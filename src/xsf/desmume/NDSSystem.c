@@ -536,6 +536,50 @@ static void timer_check(void)
 	}
 }
 
+static INLINE BOOL branch_to_self(armcpu_t *armcpu)
+{
+	if (armcpu->CPSR.bits.T)
+		return armcpu->instruction == 0xE7FE;	/* b . */
+	return armcpu->instruction == 0xEAFFFFFE;	/* b . */
+}
+
+/* Runs a CPU until it reaches nb cycles or waits for an interrupt.  A CPU
+ * looping on an unconditional branch to itself only burns cycles until the
+ * next interrupt, and interrupts are only taken between slices, so the rest
+ * of its slice is skipped, rounded up to whole turns of the loop as though
+ * it had run them. */
+static s32 exec_slice(armcpu_t *armcpu, s32 cycles, s32 nb, int shift)
+{
+	while (nb > cycles && !armcpu->waitIRQ)
+	{
+		u32 adr = armcpu->instruct_adr;
+		s32 c = armcpu_exec(armcpu) << shift;
+
+		cycles += c;
+		if (armcpu->instruct_adr == adr && nb > cycles && branch_to_self(armcpu))
+			cycles += (nb - cycles + c - 1) / c * c;
+	}
+
+	return cycles;
+}
+
+/* In the sound-only profile the ARM9 only runs to service interrupts, or
+ * while the ARM7 is waiting on it over IPC; the rest of the time its main
+ * loop, which most sound rips have no audible use for, is not emulated. */
+static BOOL sound_only = FALSE;
+
+#define IPC_IRQS ((1 << 16) | (1 << 17) | (1 << 18))
+
+void NDS_SetSoundOnly(BOOL enable)
+{
+	sound_only = enable;
+}
+
+static INLINE BOOL arm9_needed(void)
+{
+	return NDS_ARM9.CPSR.bits.mode == IRQ || (MMU.reg_IF[0] & MMU.reg_IE[0] & IPC_IRQS);
+}
+
 void NDS_exec_hframe(int cpu_clockdown_level_arm9, int cpu_clockdown_level_arm7)
 {
 	int h;
@@ -543,11 +587,12 @@ void NDS_exec_hframe(int cpu_clockdown_level_arm9, int cpu_clockdown_level_arm7)
 	{
 		s32 nb = nds.cycles + (h ? (99 * 12) : (256 * 12));
 
-		while (nb > nds.ARM9Cycle && !NDS_ARM9.waitIRQ)
-			nds.ARM9Cycle += armcpu_exec(&NDS_ARM9) << (cpu_clockdown_level_arm9);
+		if (sound_only && !arm9_needed())
+			nds.ARM9Cycle = nb;
+		else
+			nds.ARM9Cycle = exec_slice(&NDS_ARM9, nds.ARM9Cycle, nb, cpu_clockdown_level_arm9);
 		if (NDS_ARM9.waitIRQ) nds.ARM9Cycle = nb;
-		while (nb > nds.ARM7Cycle && !NDS_ARM7.waitIRQ)
-			nds.ARM7Cycle += armcpu_exec(&NDS_ARM7) << (1 + (cpu_clockdown_level_arm7));
+		nds.ARM7Cycle = exec_slice(&NDS_ARM7, nds.ARM7Cycle, nb, 1 + (cpu_clockdown_level_arm7));
 		if (NDS_ARM7.waitIRQ) nds.ARM7Cycle = nb;
 		nds.cycles = (nds.ARM9Cycle<nds.ARM7Cycle)?nds.ARM9Cycle : nds.ARM7Cycle;
 
@@ -243,6 +243,7 @@ NDS_exec(s32 nb, BOOL force);
  
  
 
+void NDS_SetSoundOnly(BOOL enable);
 void NDS_exec_frame(int cpu_clockdown_level_arm9, int cpu_clockdown_level_arm7);
 void NDS_exec_hframe(int cpu_clockdown_level_arm9, int cpu_clockdown_level_arm7);
 
@@ -22,6 +22,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "ARM9.h"
 #include "MMU.h"
 #include "SPU.h"
@@ -68,11 +74,12 @@ typedef struct
 {
 	s32 *pmixbuf;
 	s16 *pclipingbuf;
+	s16 *pchanbuf;
 	u32 buflen;
 	SChannel ch[16];
 } SPU_struct;
 
-static SPU_struct spu = { 0, 0, 0 };
+static SPU_struct spu = { 0, 0, 0, 0 };
 
 static SoundInterface_struct *SNDCore=NULL;
 extern SoundInterface_struct *SNDCoreList[];
@@ -98,6 +105,13 @@ int SPU_ChangeSoundCore(int coreid, int buffersize)
 		return -1;
 	}
 
+	spu.pchanbuf = malloc(buffersize * sizeof(s16)); /* one channel, mono */
+	if (!spu.pchanbuf)
+	{
+		SPU_DeInit();
+		return -1;
+	}
+
 	// So which core do we want?
 	if (coreid == SNDCORE_DEFAULT)
 		coreid = 0; // Assume we want the first one
@@ -159,6 +173,11 @@ void SPU_DeInit(void)
 		free(spu.pclipingbuf);
 		spu.pclipingbuf = 0;
 	}
+	if (spu.pchanbuf)
+	{
+		free(spu.pchanbuf);
+		spu.pchanbuf = 0;
+	}
 	if (SNDCore)
 	{
 		SNDCore->DeInit();
@@ -208,6 +227,14 @@ void SPU_Reset(void)
 	for (i = 0x400; i < 0x51D; i++)
 		T1WriteByte(MMU.ARM7_REG, i, 0);
 }
+
+/* channel state, for savestates; the mixing buffers are only scratch */
+void *SPU_GetState(u32 *size)
+{
+	*size = sizeof(spu.ch);
+	return spu.ch;
+}
+
 void SPU_KeyOn(int channel)
 {
 }
@@ -505,29 +532,21 @@ static INLINE s32 clipping(s32 x, s32 min, s32 max) {
 
 extern unsigned long dwChannelMute;
 
-static void decode_pcm8(SChannel *ch, s32 *out, int length)
+/* The decoders below fill buf with up to length samples of one channel and
+ * return how many there are (fewer if the channel stops); mix_channel() then
+ * adds them into the mix at the channel's volume. */
+
+static int decode_pcm8(SChannel *ch, s16 *buf, int length)
 {
 	int oi;
 	double pos, inc, len;
-	if (!ch->buf8) return;
+	if (!ch->buf8) return 0;
 
 	pos = ch->pos; inc = ch->inc; len = ch->loopend;
 
 	for(oi = 0; oi < length; oi++)
 	{
-		ch->output = ((s16)(s8)ch->buf8[(int)pos]) << 8;
-#if 0
-		if (dwChannelMute & (1 << ch->id))
-		{
-			out++;
-			out++;
-		}
-		else
-#endif
-		{
-			*(out++) += (ch->output * ch->volumel) >> VOL_SHIFT;
-			*(out++) += (ch->output * ch->volumer) >> VOL_SHIFT;
-		}
+		buf[oi] = ch->output = ((s16)(s8)ch->buf8[(int)pos]) << 8;
 		pos += inc;
 		if(pos >= len)
 		{
@@ -541,22 +560,22 @@ static void decode_pcm8(SChannel *ch, s32 *out, int length)
 				break;
 			default:
 				stop_channel(ch);
-				oi = length;
+				length = oi + 1;
 				break;
 			}
 		}
 	}
 
 	ch->pos = pos;
-	return;
+	return length;
 }
 
-static void decode_pcm16(SChannel *ch, s32 *out, int length)
+static int decode_pcm16(SChannel *ch, s16 *buf, int length)
 {
 	int oi;
 	double pos, inc, len;
 
-	if (!ch->buf16) return;
+	if (!ch->buf16) return 0;
 
 	pos = ch->pos; inc = ch->inc; len = ch->loopend;
 
@@ -567,18 +586,7 @@ static void decode_pcm16(SChannel *ch, s32 *out, int length)
 #else
 		ch->output = (s16)ch->buf16[(int)pos];
 #endif
-#if 0
-		if (dwChannelMute & (1 << ch->id))
-		{
-			out++;
-			out++;
-		}
-		else
-#endif
-		{
-			*(out++) += (ch->output * ch->volumel) >> VOL_SHIFT;
-			*(out++) += (ch->output * ch->volumer) >> VOL_SHIFT;
-		}
+		buf[oi] = ch->output;
 		pos += inc;
 		if(pos >= len)
 		{
@@ -592,13 +600,14 @@ static void decode_pcm16(SChannel *ch, s32 *out, int length)
 				break;
 			default:
 				stop_channel(ch);
-				oi = length;
+				length = oi + 1;
 				break;
 			}
 		}
 	}
 
 	ch->pos = pos;
+	return length;
 }
 
 static INLINE void decode_adpcmone_P4(SChannel *ch, int m)
@@ -724,11 +733,11 @@ static INLINE void decode_adpcmone_XX(SChannel *ch, int m)
 
 #define decode_adpcmone decode_adpcmone_P4
 
-static void decode_adpcm(SChannel *ch, s32 *out, int length)
+static int decode_adpcm(SChannel *ch, s16 *buf, int length)
 {
 	int oi;
 	double pos, inc, len;
-	if (!ch->buf8) return;
+	if (!ch->buf8) return 0;
 
 	pos = ch->pos; inc = ch->inc; len = ch->loopend;
 
@@ -739,18 +748,7 @@ static void decode_adpcm(SChannel *ch, s32 *out, int length)
 		if(i < m)
 			decode_adpcmone(ch, m);
 
-#if 0
-		if (dwChannelMute & (1 << ch->id))
-		{
-			out++;
-			out++;
-		}
-		else
-#endif
-		{
-			*(out++) += (ch->output * ch->volumel) >> VOL_SHIFT;
-			*(out++) += (ch->output * ch->volumer) >> VOL_SHIFT;
-		}
+		buf[oi] = ch->output;
 		pos += inc;
 		if(pos >= len)
 		{
@@ -779,15 +777,16 @@ static void decode_adpcm(SChannel *ch, s32 *out, int length)
 #endif
 			default:
 				stop_channel(ch);
-				oi = length;
+				length = oi + 1;
 				break;
 			}
 		}
 	}
 	ch->pos = pos;
+	return length;
 }
 
-static void decode_psg(SChannel *ch, s32 *out, int length)
+static int decode_psg(SChannel *ch, s16 *buf, int length)
 {
 	int oi;
 
@@ -798,22 +797,11 @@ static void decode_psg(SChannel *ch, s32 *out, int length)
 		pos = ch->pos; inc = ch->inc;
 		for(oi = 0; oi < length; oi++)
 		{
-			ch->output = (s16)g_psg_duty[ch->psg_duty][(int)pos & 0x00000007];
-#if 0
-			if (dwChannelMute & (1 << ch->id))
-			{
-				out++;
-				out++;
-			}
-			else
-#endif
-			{
-				*(out++) += (ch->output * ch->volumel) >> VOL_SHIFT;
-				*(out++) += (ch->output * ch->volumer) >> VOL_SHIFT;
-			}
+			buf[oi] = ch->output = (s16)g_psg_duty[ch->psg_duty][(int)pos & 0x00000007];
 			pos += inc;
 		}
 		ch->pos = pos;
+		return length;
 	}
 	else
 	{
@@ -834,62 +822,135 @@ static void decode_psg(SChannel *ch, s32 *out, int length)
 				ch->output = +0x7FFF;
 			}
 		}
-#if 0
-		if (dwChannelMute & (1 << ch->id))
-		{
-			out++;
-			out++;
-		}
-		else
-#endif
-		{
-			*(out++) += (ch->output * ch->volumel) >> VOL_SHIFT;
-			*(out++) += (ch->output * ch->volumer) >> VOL_SHIFT;
-		}
+		/* only the last value of the block is heard, at its start */
+		buf[0] = ch->output;
 		ch->pos = X;
+		return 1;
 	}
 }
 
 
 
-void SPU_EmulateSamples(u32 numsamples)
+/* Stereo samples are s32 pairs in the mix; the volumes are at most 10 bits,
+ * so each product fits comfortably in 32 bits. */
+static void mix_channel(const SChannel *ch, const s16 *buf, int length, s32 *out)
+{
+	int oi = 0;
+
+#if defined (__SSE2__)
+	const __m128i vol = _mm_set_epi16(ch->volumer, ch->volumel, ch->volumer, ch->volumel,
+		ch->volumer, ch->volumel, ch->volumer, ch->volumel);
+
+	for (; oi + 4 <= length; oi += 4)
+	{
+		__m128i x = _mm_loadl_epi64((const __m128i *)(buf + oi));
+		__m128i lo, hi;
+
+		x = _mm_unpacklo_epi16(x, x); /* each sample twice, for left and right */
+		lo = _mm_mullo_epi16(x, vol);
+		hi = _mm_mulhi_epi16(x, vol);
+
+		_mm_storeu_si128((__m128i *)out, _mm_add_epi32(_mm_loadu_si128((__m128i *)out),
+			_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), VOL_SHIFT)));
+		_mm_storeu_si128((__m128i *)(out + 4), _mm_add_epi32(_mm_loadu_si128((__m128i *)(out + 4)),
+			_mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), VOL_SHIFT)));
+		out += 8;
+	}
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	const s16 volumes[4] = { ch->volumel, ch->volumer, ch->volumel, ch->volumer };
+	const int16x4_t vol = vld1_s16(volumes);
+
+	for (; oi + 4 <= length; oi += 4)
+	{
+		int16x4_t x = vld1_s16(buf + oi);
+		int16x4x2_t lr = vzip_s16(x, x); /* each sample twice, for left and right */
+
+		vst1q_s32(out, vaddq_s32(vld1q_s32(out), vshrq_n_s32(vmull_s16(lr.val[0], vol), VOL_SHIFT)));
+		vst1q_s32(out + 4, vaddq_s32(vld1q_s32(out + 4), vshrq_n_s32(vmull_s16(lr.val[1], vol), VOL_SHIFT)));
+		out += 8;
+	}
+#endif
+
+	for (; oi < length; oi++)
+	{
+		*(out++) += (buf[oi] * ch->volumel) >> VOL_SHIFT;
+		*(out++) += (buf[oi] * ch->volumer) >> VOL_SHIFT;
+	}
+}
+
+static void clip_mix(const s32 *in, s16 *out, u32 count)
+{
+	u32 i = 0;
+
+#if defined (__SSE2__)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(in + i + 4));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+	}
+#elif defined (__ARM_NEON__) || defined (__ARM_NEON)
+	for (; i + 4 <= count; i += 4)
+		vst1_s16(out + i, vqmovn_s32(vld1q_s32(in + i)));
+#endif
+
+	for (; i < count; i++)
+		out[i] = (s16)clipping(in[i], -0x8000, 0x7fff);
+}
+
+/* Mixes all the channels for a block of samples, each channel decoded on its
+ * own and then added in, and writes the clipped result to buffer.  Returns the
+ * number of samples, which is limited to the size of the mixing buffer. */
+static u32 mix_block(s16 *buffer, u32 numsamples)
 {
 	u32 sizesmp = numsamples;
-	u32 sizebyte = sizesmp << 2;
-	if (sizebyte > spu.buflen * sizeof(s16)) sizebyte = spu.buflen * sizeof(s16);
-	sizesmp = sizebyte >> 2;
-	sizebyte = sizesmp << 2;
-	if (sizesmp > 0)
+	unsigned i;
+	SChannel *ch = spu.ch;
+
+	if (sizesmp > spu.buflen / 2) sizesmp = spu.buflen / 2;
+	if (sizesmp == 0) return 0;
+
+	memset(spu.pmixbuf, 0, sizesmp * 2 * sizeof(s32));
+	for (i = 0; i < 16; i++)
 	{
-		unsigned i;
-		SChannel *ch = spu.ch;
-		memset(spu.pmixbuf, 0, spu.buflen * sizeof(s32));
-		for (i = 0; i < 16; i++)
+		if (ch->status)
 		{
-			if (ch->status)
+			int length = 0;
+			switch (ch->format)
 			{
-				switch (ch->format)
-				{
-				case 0:
-					decode_pcm8(ch, spu.pmixbuf, sizesmp);
-					break;
-				case 1:
-					decode_pcm16(ch, spu.pmixbuf, sizesmp);
-					break;
-				case 2:
-					decode_adpcm(ch, spu.pmixbuf, sizesmp);
-					break;
-				case 3:
-					decode_psg(ch, spu.pmixbuf, sizesmp);
-					break;
-				}
+			case 0:
+				length = decode_pcm8(ch, spu.pchanbuf, sizesmp);
+				break;
+			case 1:
+				length = decode_pcm16(ch, spu.pchanbuf, sizesmp);
+				break;
+			case 2:
+				length = decode_adpcm(ch, spu.pchanbuf, sizesmp);
+				break;
+			case 3:
+				length = decode_psg(ch, spu.pchanbuf, sizesmp);
+				break;
 			}
-			ch++;
+			mix_channel(ch, spu.pchanbuf, length, spu.pmixbuf);
 		}
-		for (i = 0; i < sizesmp * 2; i++)
-			spu.pclipingbuf[i] = (s16)clipping(spu.pmixbuf[i], -0x8000, 0x7fff);
-		SNDCore->UpdateAudio(spu.pclipingbuf, sizesmp);
+		ch++;
 	}
+	clip_mix(spu.pmixbuf, buffer, sizesmp * 2);
+	return sizesmp;
+}
+
+void SPU_EmulateSamples(u32 numsamples)
+{
+	u32 sizesmp = mix_block(spu.pclipingbuf, numsamples);
+	if (sizesmp > 0)
+		SNDCore->UpdateAudio(spu.pclipingbuf, sizesmp);
+}
+
+/* like SPU_EmulateSamples(), but mixes straight into the caller's buffer
+ * instead of handing the samples to the sound core */
+u32 SPU_EmulateSamplesTo(s16 *buffer, u32 numsamples)
+{
+	return mix_block(buffer, numsamples);
 }
 
 void SPU_Emulate(void)
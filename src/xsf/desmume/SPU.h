@@ -46,6 +46,7 @@ void SPU_Pause(int pause);
 void SPU_SetVolume(int volume);
 void SPU_Reset(void);
 void SPU_DeInit(void);
+void *SPU_GetState(u32 *size);
 void SPU_KeyOn(int channel);
 void SPU_WriteByte(u32 addr, u8 val);
 void SPU_WriteWord(u32 addr, u16 val);
@@ -53,5 +54,6 @@ void SPU_WriteLong(u32 addr, u32 val);
 u32 SPU_ReadLong(u32 addr);
 void SPU_Emulate(void);
 void SPU_EmulateSamples(u32 numsamples);
+u32 SPU_EmulateSamplesTo(s16 *buffer, u32 numsamples);
 
 #endif
@@ -23,6 +23,7 @@
 #include "thumb_instructions.h"
 #include "cp15.h"
 #include "bios.h"
+#include "mem.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -317,6 +318,16 @@ u32 armcpu_switchMode(armcpu_t *armcpu, u8 mode)
 	return oldmode;
 }
 
+#ifndef GDB_STUB
+/* Code runs from plain memory below the IO area, where MMU_read32() and
+ * MMU_read16() end up in the memory map after checking for IO registers,
+ * CFlash and the like; only the ARM9's DTCM needs to go the long way. */
+#define FAST_FETCH(proc, adr) ((adr) < 0x04000000 && \
+	((proc) != ARMCPU_ARM9 || ((adr) & ~0x3FFF) != MMU.DTCMRegion))
+#define FETCH_MAP(proc, adr) MMU.MMU_MEM[proc][((adr) >> 20) & 0xFF], \
+	(adr) & MMU.MMU_MASK[proc][((adr) >> 20) & 0xFF]
+#endif
+
 u32 armcpu_prefetch(armcpu_t *armcpu)
 {
 #ifdef GDB_STUB
@@ -337,7 +348,10 @@ u32 armcpu_prefetch(armcpu_t *armcpu)
 			armcpu->R[15] = armcpu->next_instruction + 4;
 		}
 #else
-		armcpu->instruction = MMU_read32_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
+		if (FAST_FETCH(armcpu->proc_ID, armcpu->next_instruction))
+			armcpu->instruction = T1ReadLong(FETCH_MAP(armcpu->proc_ID, armcpu->next_instruction));
+		else
+			armcpu->instruction = MMU_read32_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
 
 		armcpu->instruct_adr = armcpu->next_instruction;
 		armcpu->next_instruction += 4;
@@ -359,7 +373,10 @@ u32 armcpu_prefetch(armcpu_t *armcpu)
 		armcpu->R[15] = armcpu->next_instruction + 2;
 	}
 #else
-	armcpu->instruction = MMU_read16_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
+	if (FAST_FETCH(armcpu->proc_ID, armcpu->next_instruction))
+		armcpu->instruction = T1ReadWord(FETCH_MAP(armcpu->proc_ID, armcpu->next_instruction));
+	else
+		armcpu->instruction = MMU_read16_acl(armcpu->proc_ID, armcpu->next_instruction,CP15_ACCESS_EXECUTE);
 
 	armcpu->instruct_adr = armcpu->next_instruction;
 	armcpu->next_instruction += 2;
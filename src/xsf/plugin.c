@@ -37,10 +37,11 @@
 #include "ao.h"
 #include "corlett.h"
 #include "vio2sf.h"
+#include "../decodeahead/decodeahead.h"
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static int seek_value = -1;
 static bool_t stop_flag = FALSE;
+static DecodeAhead decodeahead = DECODEAHEAD_INIT;
 
 /* xsf_get_lib: called to load secondary files */
 static char *path;
@@ -59,24 +60,75 @@ int xsf_get_lib(char *filename, void **buffer, unsigned int *length)
 	return AO_SUCCESS;
 }
 
-Tuple *xsf_tuple(const char *filename, VFSFile *fd)
+/* Reads only the header and tags of a PSF file, skipping the reserved area
+ * and the program, which may be megabytes.  corlett_decode() gets the header
+ * with both marked empty in front of the tags, so it only parses the tags. */
+static corlett_t *xsf_read_tags(const char *filename, VFSFile *file)
 {
-	Tuple *t;
+	uint8_t header[16], *buf;
+	int64_t size, skip, tags_size;
 	corlett_t *c;
-	void *buf;
-	int64_t sz;
 
-	vfs_file_get_contents (filename, & buf, & sz);
+	if ((size = vfs_fsize(file)) < 0)
+	{
+		/* no size to go by; fall back to reading it all */
+		void *all;
+
+		vfs_file_get_contents(filename, &all, &size);
+		if (!all)
+			return NULL;
+
+		if (corlett_decode(all, size, NULL, NULL, &c) != AO_SUCCESS)
+			c = NULL;
+		else
+			c->res_section = NULL;
+
+		free(all);
+		return c;
+	}
+
+	if (vfs_fseek(file, 0, SEEK_SET) || vfs_fread(header, 1, 16, file) < 16)
+		return NULL;
 
-	if (!buf)
+	skip = (int64_t)(header[4] | header[5] << 8 | header[6] << 16 | (uint32_t)header[7] << 24) +
+	       (int64_t)(header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24);
+	if (16 + skip > size)
 		return NULL;
 
-	if (corlett_decode(buf, sz, NULL, NULL, &c) != AO_SUCCESS)
+	tags_size = size - 16 - skip;
+	if (!(buf = malloc(16 + tags_size)))
+		return NULL;
+
+	memcpy(buf, header, 4);
+	memset(buf + 4, 0, 12);
+
+	if (vfs_fseek(file, 16 + skip, SEEK_SET) ||
+	    vfs_fread(buf + 16, 1, tags_size, file) < tags_size ||
+	    corlett_decode(buf, 16 + tags_size, NULL, NULL, &c) != AO_SUCCESS)
+		c = NULL;
+	else
+		c->res_section = NULL;
+
+	free(buf);
+	return c;
+}
+
+static int xsf_length(corlett_t *c)
+{
+	return c->inf_length ? psfTimeToMS(c->inf_length) + psfTimeToMS(c->inf_fade) : -1;
+}
+
+Tuple *xsf_tuple(const char *filename, VFSFile *fd)
+{
+	Tuple *t;
+	corlett_t *c;
+
+	if (!(c = xsf_read_tags(filename, fd)))
 		return NULL;
 
 	t = tuple_new_from_filename(filename);
 
-	tuple_set_int(t, FIELD_LENGTH, NULL, c->inf_length ? psfTimeToMS(c->inf_length) + psfTimeToMS(c->inf_fade) : -1);
+	tuple_set_int(t, FIELD_LENGTH, NULL, xsf_length(c));
 	tuple_set_str(t, FIELD_ARTIST, NULL, c->inf_artist);
 	tuple_set_str(t, FIELD_ALBUM, NULL, c->inf_game);
 	tuple_set_str(t, -1, "game", c->inf_game);
@@ -87,48 +139,136 @@ Tuple *xsf_tuple(const char *filename, VFSFile *fd)
 	tuple_set_str(t, -1, "console", "GBA/Nintendo DS");
 
 	free(c);
-	free(buf);
 
 	return t;
 }
 
-static int xsf_get_length(const char *filename)
+static int xsf_get_length(const char *filename, VFSFile *file)
 {
-	corlett_t *c;
-	void *buf;
-	int64_t size;
-
-	vfs_file_get_contents(filename, &buf, &size);
+	corlett_t *c = xsf_read_tags(filename, file);
+	int length;
 
-	if (!buf)
+	if (!c)
 		return -1;
 
-	if (corlett_decode(buf, size, NULL, NULL, &c) != AO_SUCCESS)
-	{
-		free(buf);
-		return -1;
-	}
-
+	length = xsf_length(c);
 	free(c);
-	free(buf);
 
-	return c->inf_length ? psfTimeToMS(c->inf_length) + psfTimeToMS(c->inf_fade) : -1;
+	return length;
 }
 
-static bool_t xsf_play(InputPlayback * playback, const char * filename, VFSFile * file, int start_time, int stop_time, bool_t pause)
+/* Savestates taken every CHECKPOINT_SEGS segments of playback, so that a
+ * seek only has to emulate from the nearest one instead of from the start.
+ * A segment is 1/60 second. */
+#define CHECKPOINT_SEGS (60 * 5)
+#define MAX_CHECKPOINTS 1024
+#define CHECKPOINT_MEMORY (64 << 20)
+
+static xsf_state *checkpoints[MAX_CHECKPOINTS];
+static int n_checkpoints = 0;
+
+static void checkpoints_free(void)
+{
+	while (n_checkpoints)
+		xsf_free_state(checkpoints[--n_checkpoints]);
+}
+
+/* Generates the next segment, taking a savestate first if one is due.
+ * seg counts the segments generated since xsf_start(). */
+static void xsf_advance(int16_t *samples, int seglen, int *seg)
 {
+	if (*seg == n_checkpoints * CHECKPOINT_SEGS && n_checkpoints < MAX_CHECKPOINTS &&
+	    xsf_state_memory() < CHECKPOINT_MEMORY)
+	{
+		xsf_state *state = xsf_save_state(n_checkpoints ? checkpoints[n_checkpoints - 1] : NULL);
+
+		if (state)
+			checkpoints[n_checkpoints++] = state;
+	}
+
+	xsf_gen(samples, seglen);
+	(*seg)++;
+}
+
+typedef struct {
+	const char *filename;
 	void *buffer;
 	int64_t size;
-	int length = xsf_get_length(filename);
+	int length;
+} render_state;
+
+static bool_t xsf_render(DecodeAhead *d, void *user)
+{
+	render_state *rs = user;
 	int16_t samples[44100*2];
 	int seglen = 44100 / 60;
-	float pos;
+	int seg = 0;
+
+	while (!stop_flag)
+	{
+		int seek_value = decodeahead_get_seek(d);
+
+		if (seek_value >= 0)
+		{
+			int target = (int64_t)seek_value * 60 / 1000;
+			int nearest = MIN(target / CHECKPOINT_SEGS, n_checkpoints - 1);
+
+			/* restore the nearest savestate unless we are already closer */
+			if (nearest >= 0 && (target < seg || nearest * CHECKPOINT_SEGS > seg))
+			{
+				xsf_load_state(checkpoints[nearest]);
+				seg = nearest * CHECKPOINT_SEGS;
+			}
+			else if (target < seg)
+			{
+				xsf_term();
+				checkpoints_free();
+
+				free(path);
+				path = strdup(rs->filename);
+
+				if (xsf_start(rs->buffer, rs->size) != AO_SUCCESS)
+					return FALSE;
+
+				seg = 0;
+			}
+
+			while (seg < target)
+				xsf_advance(samples, seglen, &seg);
+
+			decodeahead_seek_done(d);
+		}
+
+		xsf_advance(samples, seglen, &seg);
+
+		if (!decodeahead_write(d, samples, seglen * 4))
+			break;
+
+		/* the output lags behind, so go by what has been rendered */
+		if ((int64_t)seg * 1000 / 60 >= rs->length && !decodeahead_finish(d))
+			break;
+	}
+
+	return TRUE;
+}
+
+static bool_t xsf_play(InputPlayback * playback, const char * filename, VFSFile * file, int start_time, int stop_time, bool_t pause)
+{
+	render_state rs = {filename};
 	bool_t error = FALSE;
 
+	rs.length = xsf_get_length(filename, file);
+
 	path = strdup(filename);
-	vfs_file_get_contents (filename, & buffer, & size);
+	vfs_file_get_contents (filename, & rs.buffer, & rs.size);
 
-	if (xsf_start(buffer, size) != AO_SUCCESS)
+	if (!xsf_mem_get())
+	{
+		error = TRUE;
+		goto ERR_NO_MEM;
+	}
+
+	if (xsf_start(rs.buffer, rs.size) != AO_SUCCESS)
 	{
 		error = TRUE;
 		goto ERR_NO_CLOSE;
@@ -148,75 +288,30 @@ static bool_t xsf_play(InputPlayback * playback, const char * filename, VFSFile
 	stop_flag = FALSE;
 	playback->set_pb_ready(playback);
 
-	while (!stop_flag)
-	{
-		pthread_mutex_lock (& mutex);
-
-		if (seek_value >= 0)
-		{
-			if (seek_value > playback->output->written_time ())
-			{
-				pos = playback->output->written_time ();
-
-				while (pos < seek_value)
-				{
-					xsf_gen(samples, seglen);
-					pos += 16.666;
-				}
-
-				playback->output->flush(seek_value);
-				seek_value = -1;
-			}
-			else if (seek_value < playback->output->written_time ())
-			{
-				xsf_term();
-
-				free(path);
-				path = strdup(filename);
-
-				if (xsf_start(buffer, size) == AO_SUCCESS)
-				{
-					pos = 0;
-					while (pos < seek_value)
-					{
-						xsf_gen(samples, seglen);
-						pos += 16.666; /* each segment is 16.666ms */
-					}
-
-					playback->output->flush(seek_value);
-					seek_value = -1;
-				}
-			   	else
-				{
-					error = TRUE;
-					goto CLEANUP;
-				}
-			}
-		}
-
-		pthread_mutex_unlock (& mutex);
-
-		xsf_gen(samples, seglen);
-		playback->output->write_audio((uint8_t *)samples, seglen * 4);
-
-		if (playback->output->written_time() >= length)
-			goto CLEANUP;
-	}
+	error = !decodeahead_play(&decodeahead, playback, 44100, 4, xsf_render, &rs);
 
-CLEANUP:
 	xsf_term();
+	checkpoints_free();
 
 	pthread_mutex_lock (& mutex);
 	stop_flag = TRUE;
 	pthread_mutex_unlock (& mutex);
 
 ERR_NO_CLOSE:
-	free(buffer);
+	xsf_mem_put();
+
+ERR_NO_MEM:
+	free(rs.buffer);
 	free(path);
 
 	return !error;
 }
 
+static void xsf_cleanup(void)
+{
+	xsf_mem_free();
+}
+
 void xsf_stop(InputPlayback *playback)
 {
 	pthread_mutex_lock (& mutex);
@@ -224,7 +319,7 @@ void xsf_stop(InputPlayback *playback)
 	if (!stop_flag)
 	{
 		stop_flag = TRUE;
-		playback->output->abort_write();
+		decodeahead_stop(&decodeahead);
 	}
 
 	pthread_mutex_unlock (& mutex);
@@ -257,10 +352,7 @@ void xsf_seek(InputPlayback *playback, int time)
 	pthread_mutex_lock (& mutex);
 
 	if (!stop_flag)
-	{
-		seek_value = time;
-		playback->output->abort_write();
-	}
+		decodeahead_seek(&decodeahead, time);
 
 	pthread_mutex_unlock (& mutex);
 }
@@ -271,6 +363,7 @@ AUD_INPUT_PLUGIN
 (
 	.name = N_("2SF Decoder"),
 	.domain = PACKAGE,
+	.cleanup = xsf_cleanup,
 	.play = xsf_play,
 	.stop = xsf_stop,
 	.pause = xsf_pause,
@@ -13,6 +13,7 @@
 #include <zlib.h>
 #include "tagget.h"
 #include "vio2sf.h"
+#include "../lazymem/lazymem.h"
 
 volatile BOOL execute = FALSE;
 
@@ -556,7 +557,8 @@ static struct
 	int sync_type;
 	int arm7_clockdown_level;
 	int arm9_clockdown_level;
-} sndifwork = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	int sound_only;
+} sndifwork = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 static void SNDIFDeInit(void)
 {
@@ -635,6 +637,7 @@ int xsf_start(void *pfile, unsigned bytes)
 	sndifwork.sync_type = xsf_tagget_int("_vio2sf_sync_type", pfile, bytes, 0);
 	sndifwork.arm9_clockdown_level = xsf_tagget_int("_vio2sf_arm9_clockdown_level", pfile, bytes, clockdown);
 	sndifwork.arm7_clockdown_level = xsf_tagget_int("_vio2sf_arm7_clockdown_level", pfile, bytes, clockdown);
+	sndifwork.sound_only = xsf_tagget_int("_vio2sf_sound_only", pfile, bytes, 0);
 
 	sndifwork.xfs_load = 0;
 	printf("load_psf... ");
@@ -642,6 +645,8 @@ int xsf_start(void *pfile, unsigned bytes)
 		return XSF_FALSE;
 	printf("ok!\n");
 
+	NDS_SetSoundOnly(FALSE);
+
 #ifdef GDB_STUB
 	if (NDS_Init(&arm9_base_memory_iface, &arm9_ctrl_iface, &arm7_base_memory_iface, &arm7_ctrl_iface))
 #else
@@ -755,6 +760,9 @@ int xsf_start(void *pfile, unsigned bytes)
 	}
 	execute = TRUE;
 	sndifwork.xfs_load = 1;
+
+	/* the boot code and initial state above always run in full */
+	NDS_SetSoundOnly(sndifwork.sound_only);
 	return XSF_TRUE;
 }
 
@@ -827,7 +835,15 @@ int xsf_gen(void *pbuffer, unsigned samples)
 				}
 				NDS_exec_hframe(sndifwork.arm9_clockdown_level, sndifwork.arm7_clockdown_level);
 			}
-			SPU_EmulateSamples(numsamples);
+			if (bytes >= ((unsigned)numsamples << 2))
+			{
+				/* it all fits, so mix straight into the output */
+				unsigned mixed = SPU_EmulateSamplesTo((s16 *)ptr, numsamples) << 2;
+				ptr += mixed;
+				bytes -= mixed;
+			}
+			else
+				SPU_EmulateSamples(numsamples);
 		}
 	}
 	return ptr - (unsigned char *)pbuffer;
@@ -839,3 +855,223 @@ void xsf_term(void)
 	NDS_DeInit();
 	load_term();
 }
+
+/* The ARM9 memory is most of the emulator's footprint (some 38 MB), so it is
+ * only allocated while playing and for a while after. */
+static LazyMem arm9_mem = LAZYMEM_INIT("2SF ARM9 memory", sizeof(ARM9_struct));
+
+int xsf_mem_get(void)
+{
+	if (!(ARM9MemPtr = lazymem_get(&arm9_mem)))
+		return XSF_FALSE;
+
+	return XSF_TRUE;
+}
+
+void xsf_mem_put(void)
+{
+	lazymem_put(&arm9_mem);
+}
+
+void xsf_mem_free(void)
+{
+	lazymem_free(&arm9_mem);
+	ARM9MemPtr = NULL;
+}
+
+/* In-memory savestates, used for seeking.  The emulator state lives in a few
+ * large global structures, which a savestate keeps page by page: pages that
+ * are zero are left out and pages unchanged since the previous savestate are
+ * shared with it, so a savestate mostly costs what the game wrote in between.
+ * Pointers inside the structures are kept as they are, so a savestate is only
+ * good until xsf_term().  The GPU is left out, as it never reaches the sound
+ * output (the file format's own savestate leaves it out, too). */
+
+#define STATE_PAGE 4096
+#define STATE_MAX_REGIONS 24
+
+extern u16 SPI_CNT, SPI_CMD, AUX_SPI_CNT, AUX_SPI_CMD, partie;
+extern u32 rom_mask, DMASrc[2][4], DMADst[2][4];
+
+typedef struct
+{
+	unsigned refs;
+	unsigned len;
+	unsigned char data[1];
+} state_page_t;
+
+struct xsf_state
+{
+	unsigned npages;
+	state_page_t *pages[1];
+};
+
+typedef struct
+{
+	void *ptr;
+	unsigned size;
+} state_region_t;
+
+static const unsigned char zero_page[STATE_PAGE];
+static unsigned long state_memory = 0;
+
+static unsigned state_regions(state_region_t *r)
+{
+	unsigned n = 0;
+	u32 spu_size;
+	void *spu_state = SPU_GetState(&spu_size);
+
+#define ADD_REGION(p, s) (r[n].ptr = (p), r[n].size = (s), n++)
+	ADD_REGION(&ARM9Mem, sizeof(ARM9Mem));
+	ADD_REGION(&MMU, sizeof(MMU));
+	ADD_REGION(&NDS_ARM7, sizeof(NDS_ARM7));
+	ADD_REGION(&NDS_ARM9, sizeof(NDS_ARM9));
+	if (NDS_ARM7.coproc[15])
+		ADD_REGION(NDS_ARM7.coproc[15], sizeof(armcp15_t));
+	if (NDS_ARM9.coproc[15])
+		ADD_REGION(NDS_ARM9.coproc[15], sizeof(armcp15_t));
+	ADD_REGION(&nds, sizeof(nds));
+	ADD_REGION(spu_state, spu_size);
+	if (MMU.fw.data)
+		ADD_REGION(MMU.fw.data, MMU.fw.size);
+	if (MMU.bupmem.data)
+		ADD_REGION(MMU.bupmem.data, MMU.bupmem.size);
+	ADD_REGION(&sndifwork, sizeof(sndifwork));
+	ADD_REGION(sndifwork.pcmbuftop, sndifwork.bufferbytes);
+	ADD_REGION(&SPI_CNT, sizeof(SPI_CNT));
+	ADD_REGION(&SPI_CMD, sizeof(SPI_CMD));
+	ADD_REGION(&AUX_SPI_CNT, sizeof(AUX_SPI_CNT));
+	ADD_REGION(&AUX_SPI_CMD, sizeof(AUX_SPI_CMD));
+	ADD_REGION(&partie, sizeof(partie));
+	ADD_REGION(&rom_mask, sizeof(rom_mask));
+	ADD_REGION(DMASrc, sizeof(DMASrc));
+	ADD_REGION(DMADst, sizeof(DMADst));
+#undef ADD_REGION
+
+	return n;
+}
+
+static unsigned state_count_pages(const state_region_t *r, unsigned n)
+{
+	unsigned i, npages = 0;
+
+	for (i = 0; i < n; i++)
+		npages += (r[i].size + STATE_PAGE - 1) / STATE_PAGE;
+
+	return npages;
+}
+
+static void state_page_unref(state_page_t *p)
+{
+	if (p && !--p->refs)
+	{
+		state_memory -= p->len;
+		free(p);
+	}
+}
+
+void xsf_free_state(xsf_state *state)
+{
+	unsigned i;
+
+	for (i = 0; i < state->npages; i++)
+		state_page_unref(state->pages[i]);
+
+	state_memory -= state->npages * sizeof(state_page_t *);
+	free(state);
+}
+
+/* prev, if given, is the savestate to share unchanged pages with */
+xsf_state *xsf_save_state(const xsf_state *prev)
+{
+	state_region_t r[STATE_MAX_REGIONS];
+	unsigned n = state_regions(r);
+	unsigned npages = state_count_pages(r, n);
+	unsigned i, page = 0;
+	xsf_state *state;
+
+	if (prev && prev->npages != npages)
+		prev = 0;
+
+	state = malloc(sizeof(xsf_state) + (npages - 1) * sizeof(state_page_t *));
+	if (!state)
+		return 0;
+
+	for (i = 0; i < n; i++)
+	{
+		unsigned char *src = r[i].ptr;
+		unsigned offset;
+
+		for (offset = 0; offset < r[i].size; offset += STATE_PAGE, page++)
+		{
+			unsigned len = r[i].size - offset;
+			state_page_t *p = prev ? prev->pages[page] : 0;
+
+			if (len > STATE_PAGE)
+				len = STATE_PAGE;
+
+			if (p && !memcmp(p->data, src + offset, len))
+				p->refs++;
+			else if (!memcmp(zero_page, src + offset, len))
+				p = 0;
+			else
+			{
+				p = malloc(sizeof(state_page_t) - 1 + len);
+				if (!p)
+				{
+					while (page--)
+						state_page_unref(state->pages[page]);
+					free(state);
+					return 0;
+				}
+
+				p->refs = 1;
+				p->len = len;
+				memcpy(p->data, src + offset, len);
+				state_memory += len;
+			}
+
+			state->pages[page] = p;
+		}
+	}
+
+	state->npages = npages;
+	state_memory += npages * sizeof(state_page_t *);
+	return state;
+}
+
+void xsf_load_state(const xsf_state *state)
+{
+	state_region_t r[STATE_MAX_REGIONS];
+	unsigned n = state_regions(r);
+	unsigned i, page = 0;
+
+	if (state_count_pages(r, n) != state->npages)
+		return;
+
+	for (i = 0; i < n; i++)
+	{
+		unsigned char *dst = r[i].ptr;
+		unsigned offset;
+
+		for (offset = 0; offset < r[i].size; offset += STATE_PAGE, page++)
+		{
+			state_page_t *p = state->pages[page];
+			unsigned len = r[i].size - offset;
+
+			if (len > STATE_PAGE)
+				len = STATE_PAGE;
+
+			if (p)
+				memcpy(dst + offset, p->data, len);
+			else
+				memset(dst + offset, 0, len);
+		}
+	}
+}
+
+/* memory held by all savestates together */
+unsigned long xsf_state_memory(void)
+{
+	return state_memory;
+}
@@ -5,3 +5,16 @@ int xsf_start(void *pfile, unsigned bytes);
 int xsf_gen(void *pbuffer, unsigned samples);
 int xsf_get_lib(char *pfilename, void **ppbuffer, unsigned int *plength);
 void xsf_term(void);
+
+/* xsf_start() needs the emulator's memory, got with xsf_mem_get() beforehand
+ * and handed back with xsf_mem_put() after xsf_term(); xsf_mem_free() frees it
+ * for good. */
+int xsf_mem_get(void);
+void xsf_mem_put(void);
+void xsf_mem_free(void);
+
+typedef struct xsf_state xsf_state;
+xsf_state *xsf_save_state(const xsf_state *prev);
+void xsf_load_state(const xsf_state *state);
+void xsf_free_state(xsf_state *state);
+unsigned long xsf_state_memory(void);
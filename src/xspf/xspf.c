@@ -26,7 +26,7 @@
 #include <libxml/tree.h>
 #include <libxml/parser.h>
 #include <libxml/xmlreader.h>
-#include <libxml/xmlsave.h>
+#include <libxml/xmlwriter.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/uri.h>
@@ -171,18 +171,6 @@ static void xspf_add_file (xmlNode * track, const gchar * filename, const gchar
 }
 
 
-static void xspf_find_track (xmlNode * tracklist, const gchar * filename, const
- gchar * base, Index * filenames, Index * tuples)
-{
-    xmlNode *nptr;
-
-    for (nptr = tracklist->children; nptr != NULL; nptr = nptr->next) {
-        if (nptr->type == XML_ELEMENT_NODE &&
-         ! xmlStrcmp (nptr->name, (xmlChar *) "track"))
-            xspf_add_file (nptr, filename, base, filenames, tuples);
-    }
-}
-
 static gint read_cb (void * file, gchar * buf, gint len)
 {
     return vfs_fread (buf, 1, len, file);
@@ -198,51 +186,73 @@ static gint close_cb (void * file)
     return 0;
 }
 
+/* The playlist is streamed rather than read into a tree; only the element
+ * currently being looked at (the title or one track) is expanded, so memory
+ * use does not grow with the length of the playlist. */
 static gboolean xspf_playlist_load (const gchar * filename, VFSFile * file,
  gchar * * title, Index * filenames, Index * tuples)
 {
-    xmlDoc * doc = xmlReadIO (read_cb, close_cb, file, filename, NULL,
-     XML_PARSE_RECOVER);
-    if (! doc)
+    xmlTextReader * reader = xmlReaderForIO (read_cb, close_cb, file, filename,
+     NULL, XML_PARSE_RECOVER);
+    if (! reader)
         return FALSE;
 
     * title = NULL;
 
-    xmlNode *nptr, *nptr2;
+    gchar * base = NULL;
+    gboolean found = FALSE, in_playlist = FALSE, in_tracklist = FALSE;
+    gboolean skip = FALSE;
+    gint ret;
+
+    while ((ret = skip ? xmlTextReaderNext (reader) : xmlTextReaderRead (reader)) == 1)
+    {
+        skip = FALSE;
 
-    // find trackList
-    for (nptr = doc->children; nptr != NULL; nptr = nptr->next) {
-        if (nptr->type == XML_ELEMENT_NODE &&
-            !xmlStrcmp(nptr->name, (xmlChar *)"playlist")) {
-            gchar * base;
+        if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT)
+            continue;
 
-            base = (gchar *)xmlNodeGetBase(doc, nptr);
+        const xmlChar * name = xmlTextReaderConstLocalName (reader);
+        gint depth = xmlTextReaderDepth (reader);
 
-            for (nptr2 = nptr->children; nptr2; nptr2 = nptr2->next)
+        if (depth == 0)
+        {
+            if ((in_playlist = ! xmlStrcmp (name, (xmlChar *) "playlist")))
             {
-                if (nptr2->type != XML_ELEMENT_NODE)
-                    continue;
+                xmlFree (base);
+                base = (gchar *) xmlTextReaderBaseUri (reader);
+                found = TRUE;
+            }
+        }
+        else if (depth == 1 && in_playlist)
+        {
+            in_tracklist = ! xmlStrcmp (name, (xmlChar *) "trackList");
 
-                if (! xmlStrcmp (nptr2->name, (xmlChar *) "title"))
+            if (! xmlStrcmp (name, (xmlChar *) "title"))
+            {
+                xmlNode * node = xmlTextReaderExpand (reader);
+                xmlChar * xml_title = node ? xmlNodeGetContent (node) : NULL;
+                if (xml_title && xml_title[0])
                 {
-                    xmlChar * xml_title = xmlNodeGetContent (nptr2);
-                    if (xml_title && xml_title[0])
-                    {
-                        str_unref (* title);
-                        * title = str_get ((gchar *) xml_title);
-                    }
-                    xmlFree (xml_title);
+                    str_unref (* title);
+                    * title = str_get ((gchar *) xml_title);
                 }
-                else if (! xmlStrcmp (nptr2->name, (xmlChar *) "trackList"))
-                    xspf_find_track (nptr2, filename, base, filenames, tuples);
+                xmlFree (xml_title);
+                skip = TRUE;
             }
-
-            xmlFree (base);
+        }
+        else if (depth == 2 && in_playlist && in_tracklist &&
+         ! xmlStrcmp (name, (xmlChar *) "track"))
+        {
+            xmlNode * node = xmlTextReaderExpand (reader);
+            if (node)
+                xspf_add_file (node, filename, base, filenames, tuples);
+            skip = TRUE;
         }
     }
 
-    xmlFreeDoc(doc);
-    return TRUE;
+    xmlFree (base);
+    xmlFreeTextReader (reader);
+    return found || ret == 0;
 }
 
 
@@ -311,83 +321,86 @@ NOT_VALID:;
 }
 
 
-static void xspf_add_node(xmlNodePtr node, TupleValueType type,
-        gboolean isMeta, const gchar *xspfName, const gchar *strVal,
-        const gint intVal)
+static gboolean xspf_write_node (xmlTextWriter * writer, TupleValueType type,
+ gboolean isMeta, const gchar * xspfName, const gchar * strVal, const gint intVal)
 {
     gchar tmps[64];
-    xmlNodePtr tmp;
-
-    if (isMeta) {
-        tmp = xmlNewNode(NULL, (xmlChar *) "meta");
-        xmlSetProp(tmp, (xmlChar *) "rel", (xmlChar *) xspfName);
-    } else
-        tmp = xmlNewNode(NULL, (xmlChar *) xspfName);
+    gchar * subst = NULL;
+    gint ret;
 
     switch (type) {
-        case TUPLE_STRING:;
-            gchar * subst;
-            if (is_valid_string (strVal, & subst))
-                xmlAddChild (tmp, xmlNewText ((xmlChar *) strVal));
-            else
-            {
-                xmlAddChild (tmp, xmlNewText ((xmlChar *) subst));
-                g_free (subst);
-            }
+        case TUPLE_STRING:
+            if (! is_valid_string (strVal, & subst))
+                strVal = subst;
             break;
 
         case TUPLE_INT:
             g_snprintf(tmps, sizeof(tmps), "%d", intVal);
-            xmlAddChild(tmp, xmlNewText((xmlChar *) tmps));
+            strVal = tmps;
             break;
 
         default:
-            break;
+            return TRUE;
     }
 
-    xmlAddChild(node, tmp);
+    if (isMeta)
+        ret = (xmlTextWriterStartElement (writer, (xmlChar *) "meta") < 0 ||
+         xmlTextWriterWriteAttribute (writer, (xmlChar *) "rel",
+         (xmlChar *) xspfName) < 0 ||
+         xmlTextWriterWriteString (writer, (xmlChar *) strVal) < 0 ||
+         xmlTextWriterEndElement (writer) < 0) ? -1 : 0;
+    else
+        ret = xmlTextWriterWriteElement (writer, (xmlChar *) xspfName,
+         (xmlChar *) strVal);
+
+    g_free (subst);
+    return ret >= 0;
 }
 
 
+/* Entries are written out as they are visited instead of building a tree of
+ * the whole playlist first. */
 static gboolean xspf_playlist_save (const gchar * filename, VFSFile * file,
  const gchar * title, Index * filenames, Index * tuples)
 {
     gint entries = index_count (filenames);
-    xmlDocPtr doc;
-    xmlNodePtr rootnode, tracklist;
+    xmlOutputBuffer * out;
+    xmlTextWriter * writer;
     gint count;
 
-    doc = xmlNewDoc((xmlChar *)"1.0");
-    doc->charset = XML_CHAR_ENCODING_UTF8;
-    doc->encoding = xmlStrdup((xmlChar *)"UTF-8");
+    if (! (out = xmlOutputBufferCreateIO (write_cb, close_cb, file, NULL)))
+        return FALSE;
 
-    rootnode = xmlNewNode(NULL, (xmlChar *)XSPF_ROOT_NODE_NAME);
-    xmlSetProp(rootnode, (xmlChar *)"version", (xmlChar *)"1");
-    xmlSetProp(rootnode, (xmlChar *)"xmlns", (xmlChar *)XSPF_XMLNS);
+    /* takes over the output buffer, even on failure */
+    if (! (writer = xmlNewTextWriter (out)))
+        return FALSE;
 
-    /* common */
-    xmlDocSetRootElement(doc, rootnode);
+    xmlTextWriterSetIndent (writer, 1);
+    xmlTextWriterSetIndentString (writer, (xmlChar *) "  ");
 
-    if (title)
-        xspf_add_node (rootnode, TUPLE_STRING, FALSE, "title", title, 0);
+    if (xmlTextWriterStartDocument (writer, NULL, "UTF-8", NULL) < 0 ||
+     xmlTextWriterStartElement (writer, (xmlChar *) XSPF_ROOT_NODE_NAME) < 0 ||
+     xmlTextWriterWriteAttribute (writer, (xmlChar *) "version", (xmlChar *) "1") < 0 ||
+     xmlTextWriterWriteAttribute (writer, (xmlChar *) "xmlns", (xmlChar *) XSPF_XMLNS) < 0)
+        goto ERR;
 
-    tracklist = xmlNewNode(NULL, (xmlChar *)"trackList");
-    xmlAddChild(rootnode, tracklist);
+    if (title && ! xspf_write_node (writer, TUPLE_STRING, FALSE, "title", title, 0))
+        goto ERR;
+
+    if (xmlTextWriterStartElement (writer, (xmlChar *) "trackList") < 0)
+        goto ERR;
 
     for (count = 0; count < entries; count ++)
     {
         const gchar * filename = index_get (filenames, count);
         const Tuple * tuple = index_get (tuples, count);
-        xmlNodePtr track, location;
         gchar *scratch = NULL;
         gint scratchi = 0;
 
-        track = xmlNewNode(NULL, (xmlChar *)"track");
-        location = xmlNewNode(NULL, (xmlChar *)"location");
-
-        xmlAddChild(location, xmlNewText((xmlChar *)filename));
-        xmlAddChild(track, location);
-        xmlAddChild(tracklist, track);
+        if (xmlTextWriterStartElement (writer, (xmlChar *) "track") < 0 ||
+         xmlTextWriterWriteElement (writer, (xmlChar *) "location",
+         (xmlChar *) filename) < 0)
+            goto ERR;
 
         if (tuple != NULL)
         {
@@ -402,7 +415,6 @@ static gboolean xspf_playlist_save (const gchar * filename, VFSFile * file,
                         scratch = tuple_get_str (tuple, xs->tupleField, NULL);
                         if (! scratch)
                             isOK = FALSE;
-                        str_unref(scratch);
                         break;
                     case TUPLE_INT:
                         scratchi = tuple_get_int (tuple, xs->tupleField, NULL);
@@ -411,25 +423,31 @@ static gboolean xspf_playlist_save (const gchar * filename, VFSFile * file,
                         break;
                 }
 
-                if (isOK)
-                    xspf_add_node(track, xs->type, xs->isMeta, xs->xspfName, scratch, scratchi);
+                if (isOK && ! xspf_write_node (writer, xs->type, xs->isMeta,
+                 xs->xspfName, scratch, scratchi))
+                {
+                    str_unref (scratch);
+                    goto ERR;
+                }
+
+                str_unref (scratch);
+                scratch = NULL;
             }
         }
-    }
 
-    xmlSaveCtxt * save = xmlSaveToIO (write_cb, close_cb, file, NULL,
-     XML_SAVE_FORMAT);
-    if (! save)
-        goto ERR;
+        if (xmlTextWriterEndElement (writer) < 0)
+            goto ERR;
+    }
 
-    if (xmlSaveDoc (save, doc) < 0 || xmlSaveClose (save) < 0)
+    /* closes trackList and playlist */
+    if (xmlTextWriterEndDocument (writer) < 0)
         goto ERR;
 
-    xmlFreeDoc(doc);
+    xmlFreeTextWriter (writer);
     return TRUE;
 
 ERR:
-    xmlFreeDoc (doc);
+    xmlFreeTextWriter (writer);
     return FALSE;
 }
 
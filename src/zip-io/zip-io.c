@@ -0,0 +1,878 @@
+/*
+ * ZIP Archive Transport Plugin for Audacious
+ * Copyright 2014 Audacious developers
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Plays files inside ZIP archives without extracting them.  The URI of a
+ * member is that of the archive with "zip" for "file" and the path inside
+ * appended, as in zip:///music/HVSC.zip/C64Music/DEMOS/A-F/Afterburner.sid.
+ *
+ * The central directory of an archive is parsed once and kept, for up to
+ * MAX_ARCHIVES archives, until the archive changes on disk.  Archives are
+ * memory-mapped where possible, so that stored members are read in place.
+ * Deflated members are inflated in full when opened and kept, up to
+ * MEMBER_CACHE_SIZE in all, so that probing a file and then playing it, or
+ * reading its tags again, does not inflate it twice. */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include <glib.h>
+#include <zlib.h>
+
+#include <audacious/debug.h>
+#include <audacious/i18n.h>
+#include <audacious/plugin.h>
+#include <libaudcore/audstrings.h>
+
+#define MAX_ARCHIVES 8
+#define MEMBER_CACHE_SIZE (32 << 20)
+#define MAX_MEMBER_SIZE (256 << 20)     /* larger deflated members are refused */
+#define INFLATE_CHUNK 65536             /* input per read when not mapped */
+
+#define SIG_LOCAL 0x04034b50
+#define SIG_CENTRAL 0x02014b50
+#define SIG_END 0x06054b50
+#define SIG_END64 0x06064b50
+#define SIG_LOCATOR64 0x07064b50
+
+#define METHOD_STORED 0
+#define METHOD_DEFLATED 8
+
+typedef struct {
+    char * name;
+    int method;
+    uint32_t crc;
+    int64_t comp_size, size;
+    int64_t header;             /* offset of the local header */
+    int64_t data;               /* offset of the data, or -1 if not yet known */
+} ZipEntry;
+
+typedef struct {
+    char * path;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    int64_t size;
+
+    int fd;
+    const unsigned char * map;  /* NULL if not mapped */
+
+    ZipEntry * entries;
+    int n_entries;
+    GHashTable * index;         /* name -> ZipEntry */
+
+    int refs;                   /* open files and inflated members */
+    int files;                  /* open files */
+    bool_t cached;              /* FALSE once dropped from the cache */
+} ZipArchive;
+
+typedef struct {
+    ZipArchive * archive;
+    ZipEntry * entry;
+    unsigned char * data;
+    int refs;
+    bool_t cached;
+} ZipMember;
+
+typedef struct {
+    ZipArchive * archive;
+    ZipEntry * entry;
+    ZipMember * member;         /* NULL unless inflated */
+    const unsigned char * data; /* the whole member, or NULL if read piecewise */
+    int64_t pos;
+} ZipFile;
+
+#define zip_error(...) do { \
+    fprintf (stderr, "zip-io: " __VA_ARGS__); \
+    fputc ('\n', stderr); \
+} while (0)
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static GQueue archives = G_QUEUE_INIT;      /* most recently used first */
+static GQueue members = G_QUEUE_INIT;       /* most recently used first */
+static int64_t members_size;
+
+static inline unsigned get16 (const unsigned char * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32 (const unsigned char * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t get64 (const unsigned char * p)
+{
+    return get32 (p) | ((uint64_t) get32 (p + 4) << 32);
+}
+
+static bool_t read_at (ZipArchive * a, int64_t offset, void * buf, int64_t len)
+{
+    if (offset < 0 || len < 0 || offset > a->size || len > a->size - offset)
+        return FALSE;
+
+    if (a->map)
+    {
+        memcpy (buf, a->map + offset, len);
+        return TRUE;
+    }
+
+    while (len > 0)
+    {
+        int64_t readed = pread (a->fd, buf, len, offset);
+
+        if (readed < 0 && errno == EINTR)
+            continue;
+
+        if (readed <= 0)
+        {
+            zip_error ("Cannot read %s: %s.", a->path, readed < 0 ?
+             strerror (errno) : "unexpected end of file");
+            return FALSE;
+        }
+
+        buf = (char *) buf + readed;
+        offset += readed;
+        len -= readed;
+    }
+
+    return TRUE;
+}
+
+/* ----- central directory ----- */
+
+/* Finds the end of central directory record and returns the number of
+ * entries and the offset and size of the directory, looking through the
+ * Zip64 record if there is one. */
+static bool_t find_directory (ZipArchive * a, int64_t * count, int64_t *
+ offset, int64_t * size)
+{
+    /* the record is 22 bytes plus a comment of up to 65535 */
+    int64_t tail_len = MIN (a->size, 22 + 65535);
+    unsigned char * tail = malloc (tail_len);
+    bool_t found = FALSE;
+    int64_t end = 0;
+
+    if (read_at (a, a->size - tail_len, tail, tail_len))
+    {
+        for (int64_t i = tail_len - 22; i >= 0; i --)
+        {
+            if (get32 (tail + i) == SIG_END)
+            {
+                const unsigned char * p = tail + i;
+                end = a->size - tail_len + i;
+                * count = get16 (p + 10);
+                * size = get32 (p + 12);
+                * offset = get32 (p + 16);
+                found = TRUE;
+                break;
+            }
+        }
+    }
+
+    free (tail);
+
+    if (! found)
+        return FALSE;
+
+    if (* count != 0xffff && * size != 0xffffffff && * offset != 0xffffffff)
+        return TRUE;
+
+    unsigned char loc[20], rec[56];
+
+    if (end < 20 || ! read_at (a, end - 20, loc, 20) || get32 (loc) !=
+     SIG_LOCATOR64 || ! read_at (a, get64 (loc + 8), rec, 56) || get32 (rec)
+     != SIG_END64)
+        return FALSE;
+
+    * count = get64 (rec + 32);
+    * size = get64 (rec + 40);
+    * offset = get64 (rec + 48);
+    return TRUE;
+}
+
+/* Fills in the sizes and offset that were too large for their fields from
+ * the Zip64 extra field. */
+static bool_t read_zip64_extra (ZipEntry * e, const unsigned char * extra,
+ int len, bool_t need_size, bool_t need_comp, bool_t need_header)
+{
+    while (len >= 4)
+    {
+        int id = get16 (extra), field_len = get16 (extra + 2);
+
+        if (field_len > len - 4)
+            break;
+
+        if (id == 0x0001)
+        {
+            const unsigned char * p = extra + 4;
+            int left = field_len;
+
+            if (need_size && left >= 8)
+                e->size = get64 (p), p += 8, left -= 8, need_size = FALSE;
+            if (need_comp && left >= 8)
+                e->comp_size = get64 (p), p += 8, left -= 8, need_comp = FALSE;
+            if (need_header && left >= 8)
+                e->header = get64 (p), need_header = FALSE;
+
+            break;
+        }
+
+        extra += 4 + field_len;
+        len -= 4 + field_len;
+    }
+
+    return ! need_size && ! need_comp && ! need_header;
+}
+
+static bool_t read_directory (ZipArchive * a)
+{
+    int64_t count, offset, size;
+
+    if (! find_directory (a, & count, & offset, & size))
+    {
+        zip_error ("%s is not a ZIP archive.", a->path);
+        return FALSE;
+    }
+
+    /* each entry takes at least 46 bytes */
+    if (size > a->size || count > size / 46)
+    {
+        zip_error ("%s has a corrupt central directory.", a->path);
+        return FALSE;
+    }
+
+    unsigned char * dir = malloc (size);
+    const unsigned char * p = dir, * end = dir + size;
+
+    if (! read_at (a, offset, dir, size))
+    {
+        free (dir);
+        return FALSE;
+    }
+
+    a->entries = malloc (sizeof (ZipEntry) * MAX (count, 1));
+    a->index = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (int64_t i = 0; i < count; i ++)
+    {
+        if (end - p < 46 || get32 (p) != SIG_CENTRAL)
+            break;
+
+        int name_len = get16 (p + 28);
+        int extra_len = get16 (p + 30);
+        int comment_len = get16 (p + 32);
+
+        if (end - p < 46 + name_len + extra_len + comment_len)
+            break;
+
+        ZipEntry * e = a->entries + a->n_entries;
+        e->method = get16 (p + 10);
+        e->crc = get32 (p + 16);
+        e->comp_size = get32 (p + 20);
+        e->size = get32 (p + 24);
+        e->header = get32 (p + 42);
+        e->data = -1;
+
+        if ((e->size == 0xffffffff || e->comp_size == 0xffffffff || e->header
+         == 0xffffffff) && ! read_zip64_extra (e, p + 46 + name_len,
+         extra_len, e->size == 0xffffffff, e->comp_size == 0xffffffff,
+         e->header == 0xffffffff))
+            break;
+
+        const char * name = (const char *) p + 46;
+        p += 46 + name_len + extra_len + comment_len;
+
+        /* directories have no data */
+        if (! name_len || name[name_len - 1] == '/')
+            continue;
+
+        e->name = g_strndup (name, name_len);
+
+        /* the first of several with one name wins, as with unzip */
+        if (! g_hash_table_lookup (a->index, e->name))
+            g_hash_table_insert (a->index, e->name, e);
+
+        a->n_entries ++;
+    }
+
+    free (dir);
+
+    AUDDBG ("%s: %d members.\n", a->path, a->n_entries);
+    return TRUE;
+}
+
+/* ----- archive cache ----- */
+
+static void archive_free (ZipArchive * a)
+{
+    for (int i = 0; i < a->n_entries; i ++)
+        g_free (a->entries[i].name);
+
+    free (a->entries);
+
+    if (a->index)
+        g_hash_table_destroy (a->index);
+
+#ifndef _WIN32
+    if (a->map)
+        munmap ((void *) a->map, a->size);
+#endif
+
+    if (a->fd >= 0)
+        close (a->fd);
+
+    free (a->path);
+    free (a);
+}
+
+/* mutex must be locked */
+static void archive_unref (ZipArchive * a)
+{
+    if (! -- a->refs && ! a->cached)
+        archive_free (a);
+}
+
+/* mutex must be locked */
+static void member_drop (ZipMember * m)
+{
+    g_queue_remove (& members, m);
+    members_size -= m->entry->size;
+    m->cached = FALSE;
+
+    if (! m->refs)
+    {
+        archive_unref (m->archive);
+        free (m->data);
+        free (m);
+    }
+}
+
+/* mutex must be locked */
+static void archive_drop (ZipArchive * a)
+{
+    /* cached members go with it; the archive may have changed */
+    for (GList * node = members.head; node; )
+    {
+        ZipMember * m = node->data;
+        node = node->next;
+
+        if (m->archive == a)
+            member_drop (m);
+    }
+
+    g_queue_remove (& archives, a);
+    a->cached = FALSE;
+
+    if (! a->refs)
+        archive_free (a);
+}
+
+/* mutex must be locked */
+static void trim_archives (void)
+{
+    GList * node = archives.tail;
+
+    while (node && g_queue_get_length (& archives) > MAX_ARCHIVES)
+    {
+        ZipArchive * a = node->data;
+        node = node->prev;
+
+        if (! a->files)
+            archive_drop (a);
+    }
+}
+
+/* Returns the archive with a reference added; mutex must be locked. */
+static ZipArchive * archive_get (const char * path)
+{
+    struct stat st;
+
+    if (stat (path, & st) < 0)
+    {
+        zip_error ("Cannot open %s: %s.", path, strerror (errno));
+        return NULL;
+    }
+
+    for (GList * node = archives.head; node; node = node->next)
+    {
+        ZipArchive * a = node->data;
+
+        if (strcmp (a->path, path))
+            continue;
+
+        if (a->dev != st.st_dev || a->ino != st.st_ino || a->mtime !=
+         st.st_mtime || a->size != st.st_size)
+        {
+            archive_drop (a);
+            break;
+        }
+
+        g_queue_unlink (& archives, node);
+        g_queue_push_head_link (& archives, node);
+        a->refs ++;
+        return a;
+    }
+
+    ZipArchive * a = calloc (1, sizeof (ZipArchive));
+    a->path = strdup (path);
+    a->dev = st.st_dev;
+    a->ino = st.st_ino;
+    a->mtime = st.st_mtime;
+    a->size = st.st_size;
+
+    int flags = O_RDONLY;
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+#ifdef _WIN32
+    flags |= O_BINARY;
+#endif
+
+    if ((a->fd = open (path, flags)) < 0)
+    {
+        zip_error ("Cannot open %s: %s.", path, strerror (errno));
+        archive_free (a);
+        return NULL;
+    }
+
+#ifndef _WIN32
+    if (a->size > 0 && (uint64_t) a->size <= SIZE_MAX)
+    {
+        void * map = mmap (NULL, a->size, PROT_READ, MAP_SHARED, a->fd, 0);
+
+        /* without the address space, fall back to reading */
+        if (map != MAP_FAILED)
+            a->map = map;
+    }
+#endif
+
+    if (! read_directory (a))
+    {
+        archive_free (a);
+        return NULL;
+    }
+
+    a->refs = 1;
+    a->cached = TRUE;
+    g_queue_push_head (& archives, a);
+
+    return a;
+}
+
+/* ----- members ----- */
+
+/* Returns the offset of the data, from the local header; mutex must be
+ * locked. */
+static int64_t entry_data (ZipArchive * a, ZipEntry * e)
+{
+    if (e->data < 0)
+    {
+        unsigned char head[30];
+
+        if (! read_at (a, e->header, head, 30) || get32 (head) != SIG_LOCAL)
+        {
+            zip_error ("%s has a corrupt header for %s.", a->path, e->name);
+            return -1;
+        }
+
+        int64_t data = e->header + 30 + get16 (head + 26) + get16 (head + 28);
+
+        if (data > a->size || e->comp_size > a->size - data)
+        {
+            zip_error ("%s is truncated.", a->path);
+            return -1;
+        }
+
+        e->data = data;
+    }
+
+    return e->data;
+}
+
+static unsigned char * inflate_entry (ZipArchive * a, ZipEntry * e, int64_t data)
+{
+    unsigned char * out = malloc (MAX (e->size, 1));
+    unsigned char * in = a->map ? NULL : malloc (INFLATE_CHUNK);
+    int64_t in_pos = 0;
+    z_stream z;
+    int ret = Z_OK;
+
+    if (! out)
+    {
+        free (in);
+        return NULL;
+    }
+
+    memset (& z, 0, sizeof z);
+
+    if (inflateInit2 (& z, -MAX_WBITS) != Z_OK)
+    {
+        free (in);
+        free (out);
+        return NULL;
+    }
+
+    z.next_out = out;
+    z.avail_out = e->size;
+
+    while (ret == Z_OK)
+    {
+        if (! z.avail_in)
+        {
+            int64_t len = MIN (e->comp_size - in_pos, a->map ? UINT_MAX :
+             INFLATE_CHUNK);
+
+            if (! len)
+                break;
+
+            if (a->map)
+                z.next_in = (unsigned char *) a->map + data + in_pos;
+            else if (read_at (a, data + in_pos, in, len))
+                z.next_in = in;
+            else
+                break;
+
+            z.avail_in = len;
+            in_pos += len;
+        }
+
+        ret = inflate (& z, Z_NO_FLUSH);
+    }
+
+    bool_t ok = (ret == Z_STREAM_END && z.total_out == (uint64_t) e->size &&
+     crc32 (0, out, e->size) == e->crc);
+
+    inflateEnd (& z);
+    free (in);
+
+    if (! ok)
+    {
+        zip_error ("Cannot inflate %s in %s.", e->name, a->path);
+        free (out);
+        return NULL;
+    }
+
+    return out;
+}
+
+/* Returns the member with a reference added; mutex must be locked, but is
+ * unlocked while inflating. */
+static ZipMember * member_get (ZipArchive * a, ZipEntry * e, int64_t data)
+{
+    for (GList * node = members.head; node; node = node->next)
+    {
+        ZipMember * m = node->data;
+
+        if (m->entry == e)
+        {
+            g_queue_unlink (& members, node);
+            g_queue_push_head_link (& members, node);
+            m->refs ++;
+            return m;
+        }
+    }
+
+    /* the open file holds a reference to the archive meanwhile */
+    pthread_mutex_unlock (& mutex);
+    unsigned char * out = inflate_entry (a, e, data);
+    pthread_mutex_lock (& mutex);
+
+    if (! out)
+        return NULL;
+
+    ZipMember * m = calloc (1, sizeof (ZipMember));
+    m->archive = a;
+    m->entry = e;
+    m->data = out;
+    m->refs = 1;
+    a->refs ++;
+
+    /* another thread may have inflated it too; the cache keeps only one */
+    bool_t duplicate = FALSE;
+
+    for (GList * node = members.head; node; node = node->next)
+    {
+        if (((ZipMember *) node->data)->entry == e)
+            duplicate = TRUE;
+    }
+
+    if (! duplicate && a->cached && e->size <= MEMBER_CACHE_SIZE)
+    {
+        m->cached = TRUE;
+        g_queue_push_head (& members, m);
+        members_size += e->size;
+
+        for (GList * node = members.tail; node && members_size >
+         MEMBER_CACHE_SIZE; )
+        {
+            ZipMember * old = node->data;
+            node = node->prev;
+
+            if (! old->refs)
+                member_drop (old);
+        }
+    }
+
+    return m;
+}
+
+/* mutex must be locked */
+static void member_unref (ZipMember * m)
+{
+    if (! -- m->refs && ! m->cached)
+    {
+        archive_unref (m->archive);
+        free (m->data);
+        free (m);
+    }
+}
+
+/* ----- VFS interface ----- */
+
+/* Splits zip:///path/archive.zip/inner into the file name of the archive
+ * and the (unescaped) name inside it. */
+static bool_t split_uri (const char * uri, char * * path, char * * name)
+{
+    const char * rest = uri + 6;    /* past "zip://" */
+
+    for (const char * s = rest; (s = strchr (s, '/')); s ++)
+    {
+        if (s - rest < 4 || g_ascii_strncasecmp (s - 4, ".zip", 4))
+            continue;
+
+        char * file_uri = g_strdup_printf ("file://%.*s", (int) (s - rest), rest);
+        * path = uri_to_filename (file_uri);
+        g_free (file_uri);
+
+        if (! * path)
+            return FALSE;
+
+        * name = strdup (s + 1);
+        str_decode_percent (* name, -1, * name);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void * zip_fopen (const char * uri, const char * mode)
+{
+    char * path, * name;
+
+    if (mode[0] != 'r' || strchr (mode, '+'))
+    {
+        zip_error ("Cannot write to %s.", uri);
+        return NULL;
+    }
+
+    if (strncmp (uri, "zip://", 6) || ! split_uri (uri, & path, & name))
+    {
+        zip_error ("Invalid URI: %s.", uri);
+        return NULL;
+    }
+
+    ZipFile * zf = NULL;
+
+    pthread_mutex_lock (& mutex);
+
+    ZipArchive * a = archive_get (path);
+    ZipEntry * e = a ? g_hash_table_lookup (a->index, name) : NULL;
+    int64_t data = e ? entry_data (a, e) : -1;
+
+    if (a && ! e)
+        zip_error ("%s has no member %s.", path, name);
+    else if (e && e->method != METHOD_STORED && e->method != METHOD_DEFLATED)
+        zip_error ("%s in %s is compressed with method %d, which is not "
+         "supported.", name, path, e->method);
+    else if (e && e->method == METHOD_DEFLATED && e->size > MAX_MEMBER_SIZE)
+        zip_error ("%s in %s is too large.", name, path);
+    else if (e && e->method == METHOD_STORED && e->size != e->comp_size)
+        zip_error ("%s has a corrupt entry for %s.", path, name);
+    else if (data >= 0)
+    {
+        zf = calloc (1, sizeof (ZipFile));
+        zf->archive = a;
+        zf->entry = e;
+
+        /* keeps the archive in the cache while inflating */
+        a->files ++;
+
+        if (e->method == METHOD_DEFLATED)
+        {
+            if ((zf->member = member_get (a, e, data)))
+                zf->data = zf->member->data;
+            else
+            {
+                a->files --;
+                free (zf);
+                zf = NULL;
+            }
+        }
+        else if (a->map)
+            zf->data = a->map + data;
+    }
+
+    if (zf)
+        trim_archives ();
+    else if (a)
+        archive_unref (a);
+
+    pthread_mutex_unlock (& mutex);
+
+    free (path);
+    free (name);
+    return zf;
+}
+
+static int zip_fclose (VFSFile * file)
+{
+    ZipFile * zf = vfs_get_handle (file);
+
+    pthread_mutex_lock (& mutex);
+
+    if (zf->member)
+        member_unref (zf->member);
+
+    zf->archive->files --;
+    archive_unref (zf->archive);
+
+    pthread_mutex_unlock (& mutex);
+
+    free (zf);
+    return 0;
+}
+
+static int64_t zip_fread (void * ptr, int64_t size, int64_t nitems, VFSFile * file)
+{
+    ZipFile * zf = vfs_get_handle (file);
+    int64_t len = zf->entry->size;
+
+    if (size <= 0 || zf->pos >= len)
+        return 0;
+
+    nitems = MIN (nitems, (len - zf->pos) / size);
+
+    if (zf->data)
+        memcpy (ptr, zf->data + zf->pos, size * nitems);
+    else if (! read_at (zf->archive, zf->entry->data + zf->pos, ptr, size * nitems))
+        return 0;
+
+    zf->pos += size * nitems;
+    return nitems;
+}
+
+static int64_t zip_fwrite (const void * ptr, int64_t size, int64_t nitems,
+ VFSFile * file)
+{
+    return 0;
+}
+
+static int zip_fseek (VFSFile * file, int64_t offset, int whence)
+{
+    ZipFile * zf = vfs_get_handle (file);
+    int64_t base = (whence == SEEK_SET) ? 0 : (whence == SEEK_CUR) ? zf->pos :
+     (whence == SEEK_END) ? zf->entry->size : -1;
+
+    /* like lseek(), allow seeking past the end, but not before the start */
+    if (base < 0 || base + offset < 0)
+        return -1;
+
+    zf->pos = base + offset;
+    return 0;
+}
+
+static int64_t zip_ftell (VFSFile * file)
+{
+    return ((ZipFile *) vfs_get_handle (file))->pos;
+}
+
+static bool_t zip_feof (VFSFile * file)
+{
+    ZipFile * zf = vfs_get_handle (file);
+    return (zf->pos >= zf->entry->size);
+}
+
+static int zip_ftruncate (VFSFile * file, int64_t length)
+{
+    return -1;
+}
+
+static int64_t zip_fsize (VFSFile * file)
+{
+    return ((ZipFile *) vfs_get_handle (file))->entry->size;
+}
+
+static void zip_cleanup (void)
+{
+    pthread_mutex_lock (& mutex);
+
+    ZipMember * m;
+    while ((m = g_queue_peek_head (& members)))
+        member_drop (m);
+
+    ZipArchive * a;
+    while ((a = g_queue_peek_head (& archives)))
+        archive_drop (a);
+
+    pthread_mutex_unlock (& mutex);
+}
+
+static const char zip_about[] =
+ N_("ZIP Archive Plugin for Audacious\n"
+    "Copyright 2014 Audacious developers\n\n"
+    "Opens files inside ZIP archives, as in "
+    "zip:///path/to/archive.zip/path/inside.");
+
+static const char * const zip_schemes[] = {"zip", NULL};
+
+static VFSConstructor constructor = {
+    .vfs_fopen_impl = zip_fopen,
+    .vfs_fclose_impl = zip_fclose,
+    .vfs_fread_impl = zip_fread,
+    .vfs_fwrite_impl = zip_fwrite,
+    .vfs_fseek_impl = zip_fseek,
+    .vfs_ftell_impl = zip_ftell,
+    .vfs_feof_impl = zip_feof,
+    .vfs_ftruncate_impl = zip_ftruncate,
+    .vfs_fsize_impl = zip_fsize
+};
+
+AUD_TRANSPORT_PLUGIN
+(
+    .name = N_("ZIP Archive Plugin"),
+    .domain = PACKAGE,
+    .about_text = zip_about,
+    .cleanup = zip_cleanup,
+    .schemes = zip_schemes,
+    .vtable = & constructor
+)